@@ -29,6 +29,7 @@
 #include "ps/CStr.h"
 #include "ps/DllLoader.h"
 #include "ps/Filesystem.h"
+#include "ps/ThreadUtil.h"
 
 namespace Collada
 {
@@ -122,7 +123,9 @@ public:
 
 	static Status ReloadChangedFileCB(void* param, const VfsPath& path)
 	{
-		return static_cast<CColladaManagerImpl*>(param)->ReloadChangedFile(path);
+		CColladaManagerImpl* self = static_cast<CColladaManagerImpl*>(param);
+		CScopeLock lock(self->m_Mutex);
+		return self->ReloadChangedFile(path);
 	}
 
 	bool Convert(const VfsPath& daeFilename, const VfsPath& pmdFilename, CColladaManager::FileType type)
@@ -308,6 +311,10 @@ public:
 			hash.Update((const u8*)&(*it), sizeof(*it));
 	}
 
+	// Serializes the use of the DLL and the cache key state, since meshes
+	// can be loaded on the CMeshManager worker thread
+	CMutex m_Mutex;
+
 private:
 	PIVFS m_VFS;
 	bool m_skeletonHashInvalidated;
@@ -368,6 +375,8 @@ VfsPath CColladaManager::GetLoadablePath(const VfsPath& pathnameNoExtension, Fil
 
 	*/
 
+	CScopeLock lock(m->m_Mutex);
+
 	// Now we're looking for cached files
 	CCacheLoader cacheLoader(m_VFS, extn);
 	MD5 hash;
@@ -429,5 +438,6 @@ bool CColladaManager::GenerateCachedFile(const VfsPath& sourcePath, FileType typ
 
 	archiveCachePath = cacheLoader.ArchiveCachePath(sourcePath);
 
+	CScopeLock lock(m->m_Mutex);
 	return m->Convert(sourcePath, VfsPath("cache") / archiveCachePath, type);
 }
@@ -37,6 +37,7 @@ public:
 	/**
 	 * Returns the VFS path to a PMD/PSA file for the given source file.
 	 * Performs a (cached) conversion from COLLADA if necessary.
+	 * Can be called from any thread (conversions are serialized).
 	 *
 	 * @param pathnameNoExtension path and name, minus extension, of file to load.
 	 *		  One of either "sourceName.pmd" or "sourceName.dae" should exist.
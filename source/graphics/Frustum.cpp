@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -185,4 +185,21 @@ bool CFrustum::IsBoxVisible (const CVector3D &position,const CBoundingBoxAligned
 	return true;
 }
 
+bool CFrustum::IsBoxInside(const CBoundingBoxAligned& bounds) const
+{
+	// For every plane, the nearest point of the box to that plane
+	// must be in front of it
+	for (size_t i = 0; i < m_NumPlanes; i++)
+	{
+		const CVector3D& norm = m_aPlanes[i].m_Norm;
+		CVector3D nearPoint(
+			norm.X > 0.0f ? bounds[0].X : bounds[1].X,
+			norm.Y > 0.0f ? bounds[0].Y : bounds[1].Y,
+			norm.Z > 0.0f ? bounds[0].Z : bounds[1].Z);
 
+		if (m_aPlanes[i].ClassifyPoint(nearPoint) == PS_BACK)
+			return false;
+	}
+
+	return true;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -57,6 +57,9 @@ public:
 	bool IsSphereVisible (const CVector3D &center, float radius) const;
 	bool IsBoxVisible (const CVector3D &position,const CBoundingBoxAligned &bounds) const;
 
+	//Returns true if the box is completely in front of all the planes
+	bool IsBoxInside(const CBoundingBoxAligned& bounds) const;
+
 	CPlane& operator[](size_t idx) { return m_aPlanes[idx]; }
 	const CPlane& operator[](size_t idx) const { return m_aPlanes[idx]; }
 
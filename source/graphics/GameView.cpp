@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -514,67 +514,50 @@ void CGameView::EnumerateObjects(const CFrustum& frustum, SceneCollector* c)
 	CTerrain* pTerrain = m->Game->GetWorld()->GetTerrain();
 	const ssize_t patchesPerSide = pTerrain->GetPatchesPerSide();
 
-	// find out which patches will be drawn
-	for (ssize_t j=0; j<patchesPerSide; j++) {
-		for (ssize_t i=0; i<patchesPerSide; i++) {
-			CPatch* patch=pTerrain->GetPatch(i,j);	// can't fail
-
-			// If the patch is underwater, calculate a bounding box that also contains the water plane
-			CBoundingBoxAligned bounds = patch->GetWorldBounds();
-			float waterHeight = g_Renderer.GetWaterManager()->m_WaterHeight + 0.001f;
-			if(bounds[1].Y < waterHeight) {
-				bounds[1].Y = waterHeight;
-			}
-
-			if (!m->Culling || frustum.IsBoxVisible (CVector3D(0,0,0), bounds)) {
-				//c->Submit(patch);
-
-				// set the renderstate for this patch
-				patch->setDrawState(true);
-
-				// set the renderstate for the neighbors
-				CPatch *nPatch;
-
-				nPatch = pTerrain->GetPatch(i-1,j-1);
-				if(nPatch) nPatch->setDrawState(true);
-
-				nPatch = pTerrain->GetPatch(i,j-1);
-				if(nPatch) nPatch->setDrawState(true);
-
-				nPatch = pTerrain->GetPatch(i+1,j-1);
-				if(nPatch) nPatch->setDrawState(true);
-
-				nPatch = pTerrain->GetPatch(i-1,j);
-				if(nPatch) nPatch->setDrawState(true);
-
-				nPatch = pTerrain->GetPatch(i+1,j);
-				if(nPatch) nPatch->setDrawState(true);
-
-				nPatch = pTerrain->GetPatch(i-1,j+1);
-				if(nPatch) nPatch->setDrawState(true);
-
-				nPatch = pTerrain->GetPatch(i,j+1);
-				if(nPatch) nPatch->setDrawState(true);
-
-				nPatch = pTerrain->GetPatch(i+1,j+1);
-				if(nPatch) nPatch->setDrawState(true);
-			}
-		}
+	// find out which patches are visible (using bounding boxes that also contain
+	// the water plane, for underwater patches)
+	std::vector<CPatch*> visiblePatches;
+	if (m->Culling)
+	{
+		float waterHeight = g_Renderer.GetWaterManager()->m_WaterHeight + 0.001f;
+		pTerrain->GetPatchQuadtree().GetVisiblePatches(*pTerrain, frustum, waterHeight, visiblePatches);
+	}
+	else
+	{
+		for (ssize_t j = 0; j < patchesPerSide; j++)
+			for (ssize_t i = 0; i < patchesPerSide; i++)
+				visiblePatches.push_back(pTerrain->GetPatch(i, j));
 	}
 
-	// draw the patches
-	for (ssize_t j=0; j<patchesPerSide; j++)
+	// draw the visible patches and their neighbours
+	std::vector<CPatch*> drawPatches;
+	for (size_t n = 0; n < visiblePatches.size(); n++)
 	{
-		for (ssize_t i=0; i<patchesPerSide; i++)
+		ssize_t i = visiblePatches[n]->m_X;
+		ssize_t j = visiblePatches[n]->m_Z;
+		for (ssize_t dj = -1; dj <= 1; dj++)
 		{
-			CPatch* patch=pTerrain->GetPatch(i,j);	// can't fail
-			if(patch->getDrawState() == true)
+			for (ssize_t di = -1; di <= 1; di++)
 			{
-				c->Submit(patch);
-				patch->setDrawState(false);
+				CPatch* patch = pTerrain->GetPatch(i+di, j+dj);
+				if (patch && !patch->getDrawState())
+				{
+					patch->setDrawState(true);
+					drawPatches.push_back(patch);
+				}
 			}
 		}
 	}
+
+	// (patches are stored in row order, so this submits them in the same order
+	// as a scan over the whole terrain would)
+	std::sort(drawPatches.begin(), drawPatches.end());
+
+	for (size_t n = 0; n < drawPatches.size(); n++)
+	{
+		c->Submit(drawPatches[n]);
+		drawPatches[n]->setDrawState(false);
+	}
 	}
 
 	m->Game->GetSimulation2()->RenderSubmit(*c, frustum, m->Culling);
@@ -676,6 +659,9 @@ CVector3D CGameView::GetSmoothPivot(CCamera& camera) const
 
 void CGameView::Update(const float deltaRealTime)
 {
+	// Swap in the actors whose meshes have finished loading in the background
+	m->ObjectManager.UpdatePendingObjects();
+
 	// If camera movement is being handled by the touch-input system,
 	// then we should stop to avoid conflicting with it
 	if (g_TouchInput.IsEnabled())
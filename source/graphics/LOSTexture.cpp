@@ -51,7 +51,7 @@ The blurred bitmap is then uploaded into a GL texture for use by the renderer.
 static const size_t g_BlurSize = 7;
 
 CLOSTexture::CLOSTexture(CSimulation2& simulation) :
-	m_Simulation(simulation), m_Dirty(true), m_Texture(0), m_smoothFbo(0), m_MapSize(0), m_TextureSize(0), whichTex(true)
+	m_Simulation(simulation), m_Dirty(true), m_LosDirtyID(0), m_PlayerID(INVALID_PLAYER), m_Texture(0), m_smoothFbo(0), m_MapSize(0), m_TextureSize(0), whichTex(true)
 {
 	if (CRenderer::IsInitialised() && g_Renderer.m_Options.m_SmoothLOS)
 	{
@@ -286,14 +286,52 @@ void CLOSTexture::RecomputeTexture(int unit)
 
 	PROFILE("recompute LOS texture");
 
-	std::vector<u8> losData;
-	losData.resize(GetBitmapSize(m_MapSize, m_MapSize));
-
 	CmpPtr<ICmpRangeManager> cmpRangeManager(m_Simulation, SYSTEM_ENTITY);
 	if (!cmpRangeManager)
 		return;
 
-	ICmpRangeManager::CLosQuerier los(cmpRangeManager->GetLosQuerier(g_Game->GetPlayerID()));
+	// Find which vertexes have changed (which we have to ask for even if we're
+	// going to update everything, so the next update knows what has changed since this one)
+	i32 i0, j0, i1, j1;
+	bool changed = cmpRangeManager->GetLosDirtyRect(&m_LosDirtyID, i0, j0, i1, j1);
+
+	player_id_t player = g_Game->GetPlayerID();
+	if (player != m_PlayerID)
+	{
+		m_PlayerID = player;
+		recreated = true;
+	}
+
+	if (!changed && !recreated)
+		return;
+
+	ICmpRangeManager::CLosQuerier los(cmpRangeManager->GetLosQuerier(player));
+
+	std::vector<u8> losData;
+
+	if (!recreated)
+	{
+		// Update only the texels within blurring distance of the changed vertexes
+		const i32 border = g_BlurSize/2;
+		i0 = std::max(i0 - border, (i32)0);
+		j0 = std::max(j0 - border, (i32)0);
+		i1 = std::min(i1 + border, (i32)m_MapSize-1);
+		j1 = std::min(j1 + border, (i32)m_MapSize-1);
+		if (i1 < i0 || j1 < j0)
+			return;
+
+		size_t w = i1 - i0 + 1;
+		size_t h = j1 - j0 + 1;
+		losData.resize(GetBitmapSize(w, h));
+
+		GenerateBitmapRect(los, &losData[0], m_MapSize, i0, j0, w, h);
+
+		g_Renderer.BindTexture(unit, m_Texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, i0, j0, w, h, GL_ALPHA, GL_UNSIGNED_BYTE, &losData[0]);
+		return;
+	}
+
+	losData.resize(GetBitmapSize(m_MapSize, m_MapSize));
 
 	GenerateBitmap(los, &losData[0], m_MapSize, m_MapSize);
 
@@ -352,9 +390,47 @@ void CLOSTexture::GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData,
 		for (size_t i = 0; i < rowSize; ++i)
 			*dataPtr++ = 0;
 
-	// Horizontal blur:
+	BlurBitmap(losData, w, h);
+}
+
+void CLOSTexture::GenerateBitmapRect(ICmpRangeManager::CLosQuerier los, u8* losData, ssize_t mapSize, ssize_t i0, ssize_t j0, size_t w, size_t h)
+{
+	const ssize_t border = g_BlurSize/2;
+	const size_t rowSize = w + g_BlurSize-1; // size of losData rows
+
+	// Fill in the visibility data of the rect plus its padding, which is the
+	// neighbouring vertexes' data if they're on the map
+	u8 *dataPtr = losData;
+	for (ssize_t j = j0 - border; j < j0 + (ssize_t)h + border; ++j)
+	{
+		for (ssize_t i = i0 - border; i < i0 + (ssize_t)w + border; ++i)
+		{
+			if (i < 0 || j < 0 || i >= mapSize || j >= mapSize)
+				*dataPtr++ = 0;
+			else if (los.IsVisible_UncheckedRange(i, j))
+				*dataPtr++ = 255;
+			else if (los.IsExplored_UncheckedRange(i, j))
+				*dataPtr++ = 127;
+			else
+				*dataPtr++ = 0;
+		}
+	}
+
+	BlurBitmap(losData, w, h);
+
+	// Remove the padding, so the rect's rows are contiguous
+	for (size_t j = 1; j < h; ++j)
+		memmove(&losData[j*w], &losData[j*rowSize], w);
+}
+
+void CLOSTexture::BlurBitmap(u8* losData, size_t w, size_t h)
+{
+	const size_t rowSize = w + g_BlurSize-1; // size of losData rows
+
+	// Horizontal blur (including the padding rows, which the vertical blur reads,
+	// since they might not be empty when generating part of the bitmap):
 
-	for (size_t j = g_BlurSize/2; j < h + g_BlurSize/2; ++j)
+	for (size_t j = 0; j < h + g_BlurSize-1; ++j)
 	{
 		for (size_t i = 0; i < w; ++i)
 		{
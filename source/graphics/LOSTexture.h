@@ -84,10 +84,22 @@ private:
 	size_t GetBitmapSize(size_t w, size_t h);
 	void GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t w, size_t h);
 
+	/**
+	 * Generates the w*h part of the blurred bitmap (without padding) starting at
+	 * vertex (i0, j0) of a mapSize*mapSize map, for uploading just that part.
+	 * @p losData must have GetBitmapSize(w, h) bytes.
+	 */
+	void GenerateBitmapRect(ICmpRangeManager::CLosQuerier los, u8* losData, ssize_t mapSize, ssize_t i0, ssize_t j0, size_t w, size_t h);
+
+	static void BlurBitmap(u8* losData, size_t w, size_t h);
+
 	CSimulation2& m_Simulation;
 
 	bool m_Dirty;
 
+	size_t m_LosDirtyID; // for only updating the parts of the texture that changed
+	player_id_t m_PlayerID; // player whose LOS is in the texture
+
 	GLuint m_Texture;
 	GLuint m_TextureSmooth1, m_TextureSmooth2;
 	
@@ -24,18 +24,33 @@
 #include "ps/CLogger.h"
 #include "ps/FileIo.h" // to get access to its CError
 #include "ps/Profile.h"
+#include "ps/Profiler2.h"
 
 // TODO: should this cache models while they're not actively in the game?
 // (Currently they'll probably be deleted when the reference count drops to 0,
 // even if it's quite possible that they'll get reloaded very soon.)
 
 CMeshManager::CMeshManager(CColladaManager& colladaManager)
-: m_ColladaManager(colladaManager)
+: m_ColladaManager(colladaManager), m_AsyncLoading(false), m_WorkerStarted(false), m_WorkerSem(NULL), m_Shutdown(false)
 {
 }
 
 CMeshManager::~CMeshManager()
 {
+	if (!m_WorkerStarted)
+		return;
+
+	// Tell the thread to shut down, and wake it up so it sees the notification
+	{
+		CScopeLock lock(m_WorkerMutex);
+		m_Shutdown = true;
+	}
+	SDL_SemPost(m_WorkerSem);
+
+	// Wait for it to finish the mesh it's working on
+	pthread_join(m_WorkerThread, NULL);
+
+	SDL_DestroySemaphore(m_WorkerSem);
 }
 
 CModelDefPtr CMeshManager::GetMesh(const VfsPath& pathname)
@@ -49,19 +64,140 @@ CModelDefPtr CMeshManager::GetMesh(const VfsPath& pathname)
 
 	PROFILE("load mesh");
 
+	CModelDefPtr model = LoadMesh(name);
+	if (model)
+		m_MeshMap[name] = model;
+	return model;
+}
+
+CModelDefPtr CMeshManager::GetMeshAsync(const VfsPath& pathname, bool& pending)
+{
+	pending = false;
+
+	if (!m_AsyncLoading)
+		return GetMesh(pathname);
+
+	const VfsPath name = pathname.ChangeExtension(L"");
+
+	mesh_map::iterator iter = m_MeshMap.find(name);
+	if (iter != m_MeshMap.end() && !iter->second.expired())
+		return CModelDefPtr(iter->second);
+
+	// Return the result of a finished request (which might be a failure)
+	boost::unordered_map<VfsPath, CModelDefPtr>::iterator loaded = m_LoadedMeshes.find(name);
+	if (loaded != m_LoadedMeshes.end())
+	{
+		CModelDefPtr model = loaded->second;
+		m_LoadedMeshes.erase(loaded);
+		return model;
+	}
+
+	pending = true;
+
+	// Don't request the same mesh twice
+	if (!m_PendingMeshes.insert(name).second)
+		return CModelDefPtr();
+
+	{
+		CScopeLock lock(m_WorkerMutex);
+		m_RequestQueue.push_back(name);
+	}
+	SDL_SemPost(m_WorkerSem);
+
+	return CModelDefPtr();
+}
+
+bool CMeshManager::PollLoadedMeshes()
+{
+	if (!m_WorkerStarted)
+		return false;
+
+	std::deque<std::pair<VfsPath, CModelDefPtr> > results;
+	{
+		CScopeLock lock(m_WorkerMutex);
+		results.swap(m_ResultQueue);
+	}
+
+	if (results.empty())
+		return false;
+
+	// Drop the results from the last poll that nobody asked for again
+	m_LoadedMeshes.clear();
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const VfsPath& name = results[i].first;
+		if (results[i].second)
+			m_MeshMap[name] = results[i].second;
+		m_LoadedMeshes[name] = results[i].second;
+		m_PendingMeshes.erase(name);
+	}
+
+	return true;
+}
+
+void CMeshManager::SetAsyncLoading(bool enabled)
+{
+	m_AsyncLoading = enabled;
+
+	if (!enabled || m_WorkerStarted)
+		return;
+
+	// Use SDL semaphores since OS X doesn't implement sem_init
+	m_WorkerSem = SDL_CreateSemaphore(0);
+	ENSURE(m_WorkerSem);
+
+	int ret = pthread_create(&m_WorkerThread, NULL, &RunThread, this);
+	ENSURE(ret == 0);
+
+	m_WorkerStarted = true;
+}
+
+CModelDefPtr CMeshManager::GetPlaceholderMesh()
+{
+	if (m_PlaceholderMesh)
+		return m_PlaceholderMesh;
+
+	// A single zero-area triangle at the origin, which draws nothing
+	// but lets the actor be set up like any other
+	CModelDefPtr model(new CModelDef());
+	model->m_NumVertices = 3;
+	model->m_NumUVsPerVertex = 1;
+	model->m_pVertices = new SModelVertex[model->m_NumVertices];
+	for (size_t i = 0; i < model->m_NumVertices; ++i)
+	{
+		SModelVertex& vertex = model->m_pVertices[i];
+		vertex.m_Coords = CVector3D(0.f, 0.f, 0.f);
+		vertex.m_Norm = CVector3D(0.f, 1.f, 0.f);
+		vertex.m_UVs.resize(2, 0.f);
+		for (size_t j = 0; j < SVertexBlend::SIZE; ++j)
+		{
+			vertex.m_Blend.m_Bone[j] = 0xFF;
+			vertex.m_Blend.m_Weight[j] = 0.f;
+		}
+	}
+	model->m_NumFaces = 1;
+	model->m_pFaces = new SModelFace[model->m_NumFaces];
+	for (u16 i = 0; i < 3; ++i)
+		model->m_pFaces[0].m_Verts[i] = i;
+
+	m_PlaceholderMesh = model;
+	return m_PlaceholderMesh;
+}
+
+CModelDefPtr CMeshManager::LoadMesh(const VfsPath& name)
+{
 	VfsPath pmdFilename = m_ColladaManager.GetLoadablePath(name, CColladaManager::PMD);
 
 	if (pmdFilename.empty())
 	{
-		LOGERROR(L"Could not load mesh '%ls'", pathname.string().c_str());
+		LOGERROR(L"Could not load mesh '%ls'", name.string().c_str());
 		return CModelDefPtr();
 	}
 
 	try
 	{
-		CModelDefPtr model (CModelDef::Load(pmdFilename, name));
-		m_MeshMap[name] = model;
-		return model;
+		return CModelDefPtr(CModelDef::Load(pmdFilename, name));
 	}
 	catch (PSERROR_File&)
 	{
@@ -69,3 +205,38 @@ CModelDefPtr CMeshManager::GetMesh(const VfsPath& pathname)
 		return CModelDefPtr();
 	}
 }
+
+void* CMeshManager::RunThread(void* data)
+{
+	debug_SetThreadName("MeshManager");
+	g_Profiler2.RegisterCurrentThread("meshload");
+
+	CMeshManager* meshManager = static_cast<CMeshManager*>(data);
+
+	// Wait until the main thread wakes us up
+	while (SDL_SemWait(meshManager->m_WorkerSem) == 0)
+	{
+		VfsPath name;
+		{
+			CScopeLock lock(meshManager->m_WorkerMutex);
+			if (meshManager->m_Shutdown)
+				break;
+			// If we weren't woken up for shutdown, we must have been woken up for
+			// a new request
+			name = meshManager->m_RequestQueue.front();
+			meshManager->m_RequestQueue.pop_front();
+		}
+
+		CModelDefPtr model;
+		{
+			PROFILE2("load mesh");
+			PROFILE2_ATTR("name: %ls", name.string().c_str());
+			model = meshManager->LoadMesh(name);
+		}
+
+		CScopeLock lock(meshManager->m_WorkerMutex);
+		meshManager->m_ResultQueue.push_back(std::make_pair(name, model));
+	}
+
+	return NULL;
+}
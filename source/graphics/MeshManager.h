@@ -19,11 +19,17 @@
 #define INCLUDED_MESHMANAGER
 
 #include "lib/file/vfs/vfs_path.h"
+#include "lib/posix/posix_pthread.h"
+#include "lib/external_libraries/libsdl.h"
+#include "ps/ThreadUtil.h"
 
 #include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/weak_ptr.hpp>
 
+#include <deque>
+#include <set>
+
 class CModelDef;
 typedef boost::shared_ptr<CModelDef> CModelDefPtr;
 
@@ -38,10 +44,64 @@ public:
 
 	CModelDefPtr GetMesh(const VfsPath& pathname);
 
+	/**
+	 * Like GetMesh, but if asynchronous loading is enabled and the mesh
+	 * isn't loaded yet, queues it to be loaded (and converted from COLLADA
+	 * if needed) on the worker thread, and returns a null pointer with
+	 * pending set to true. The mesh can be requested again once
+	 * PollLoadedMeshes has returned true.
+	 */
+	CModelDefPtr GetMeshAsync(const VfsPath& pathname, bool& pending);
+
+	/**
+	 * Publishes the meshes finished by the worker thread, so the next
+	 * GetMeshAsync call returns them. Must be called on the main thread.
+	 * @return true if any requested mesh was finished (or failed to load)
+	 */
+	bool PollLoadedMeshes();
+
+	/**
+	 * Enables or disables asynchronous loading in GetMeshAsync.
+	 * (It's disabled by default, so that everything requested while loading
+	 * a map is ready when the game starts.)
+	 */
+	void SetAsyncLoading(bool enabled);
+
+	/**
+	 * Returns a mesh with a single degenerate triangle, to stand in for
+	 * meshes that are still being loaded.
+	 */
+	CModelDefPtr GetPlaceholderMesh();
+
 private:
+	// Loads the mesh without touching the cache, so it's safe to call on the worker thread
+	CModelDefPtr LoadMesh(const VfsPath& name);
+
+	static void* RunThread(void* data);
+
 	typedef boost::unordered_map<VfsPath, boost::weak_ptr<CModelDef> > mesh_map;
 	mesh_map m_MeshMap;
 	CColladaManager& m_ColladaManager;
+
+	CModelDefPtr m_PlaceholderMesh;
+
+	bool m_AsyncLoading;
+
+	// Meshes which have been requested from the worker thread and haven't
+	// been published yet
+	std::set<VfsPath> m_PendingMeshes;
+
+	// Meshes published by the last PollLoadedMeshes (null if they failed to load),
+	// held here so they don't expire before they're requested again
+	boost::unordered_map<VfsPath, CModelDefPtr> m_LoadedMeshes;
+
+	bool m_WorkerStarted;
+	pthread_t m_WorkerThread;
+	CMutex m_WorkerMutex;
+	SDL_sem* m_WorkerSem;
+	std::deque<VfsPath> m_RequestQueue; // protected by m_WorkerMutex
+	std::deque<std::pair<VfsPath, CModelDefPtr> > m_ResultQueue; // protected by m_WorkerMutex
+	bool m_Shutdown; // protected by m_WorkerMutex
 };
 
 #endif
@@ -339,7 +339,9 @@ void CModel::ValidatePosition()
 	
 		ENSURE(m_pModelDef->GetNumBones() == m_Anim->m_AnimDef->GetNumKeys());
 	
-		m_Anim->m_AnimDef->BuildBoneMatrices(m_AnimTime, m_BoneMatrices, !(m_Flags & MODELFLAG_NOLOOPANIMATION));
+		// Many models are usually playing the same animation, so share the pose with them
+		const CMatrix3D* poseMatrices = m_Anim->m_AnimDef->GetCachedBoneMatrices(m_AnimTime, !(m_Flags & MODELFLAG_NOLOOPANIMATION));
+		memcpy(m_BoneMatrices, poseMatrices, m_pModelDef->GetNumBones() * sizeof(CMatrix3D));
 	}
 	else if (m_BoneMatrices)
 	{
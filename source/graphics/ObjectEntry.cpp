@@ -40,7 +40,7 @@
 #include <sstream>
 
 CObjectEntry::CObjectEntry(CObjectBase* base, CSimulation2& simulation) :
-	m_Base(base), m_Color(1.0f, 1.0f, 1.0f, 1.0f), m_Model(NULL), m_Outdated(false), m_Simulation(simulation)
+	m_Base(base), m_Color(1.0f, 1.0f, 1.0f, 1.0f), m_Model(NULL), m_Outdated(false), m_Pending(false), m_Simulation(simulation)
 {
 }
 
@@ -116,8 +116,13 @@ bool CObjectEntry::BuildVariation(const std::vector<std::set<CStr> >& selections
 	// Build the model:
 
 	// try and create a model
-	CModelDefPtr modeldef (objectManager.GetMeshManager().GetMesh(m_ModelName));
-	if (!modeldef)
+	CModelDefPtr modeldef (objectManager.GetMeshManager().GetMeshAsync(m_ModelName, m_Pending));
+	if (m_Pending)
+	{
+		// Use an invisible placeholder until the mesh has been loaded in the background
+		modeldef = objectManager.GetMeshManager().GetPlaceholderMesh();
+	}
+	else if (!modeldef)
 	{
 		LOGERROR(L"CObjectEntry::BuildVariation(): Model %ls failed to load", m_ModelName.string().c_str());
 		return false;
@@ -152,8 +157,8 @@ bool CObjectEntry::BuildVariation(const std::vector<std::set<CStr> >& selections
 	// calculate initial object space bounds, based on vertex positions
 	model->CalcStaticObjectBounds();
 
-	// load the animations
-	for (std::multimap<CStr, CObjectBase::Anim>::iterator it = variation.anims.begin(); it != variation.anims.end(); ++it)
+	// load the animations (unless this is a placeholder, which has no skeleton)
+	for (std::multimap<CStr, CObjectBase::Anim>::iterator it = variation.anims.begin(); it != variation.anims.end() && !m_Pending; ++it)
 	{
 		CStr name = it->first.LowerCase();
 
@@ -213,6 +218,14 @@ bool CObjectEntry::BuildVariation(const std::vector<std::set<CStr> >& selections
 			continue;
 		}
 
+		// If a prop is still loading then so is this object. If our own mesh is
+		// still loading, we've only requested the props so they load in parallel,
+		// since the placeholder has no prop points to attach them to
+		if (oe->m_Pending)
+			m_Pending = true;
+		if (modeldef == objectManager.GetMeshManager().GetPlaceholderMesh())
+			continue;
+
 		// If we don't have a projectile but this prop does (e.g. it's our rider), then
 		// use that as our projectile too
 		if (m_ProjectileModelName.empty() && !oe->m_ProjectileModelName.empty())
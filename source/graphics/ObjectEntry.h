@@ -77,6 +77,11 @@ public:
 	// (If true then CObjectManager won't reuse this object from its cache.)
 	bool m_Outdated;
 
+	// Whether this object is only a placeholder, because its mesh (or the
+	// mesh of one of its props) is still being loaded in the background.
+	// (If true then CObjectManager will rebuild it once the mesh is loaded.)
+	bool m_Pending;
+
 private:
 	CSimulation2& m_Simulation;
 
@@ -19,6 +19,7 @@
 
 #include "ObjectManager.h"
 
+#include "graphics/MeshManager.h"
 #include "graphics/ObjectBase.h"
 #include "graphics/ObjectEntry.h"
 #include "ps/CLogger.h"
@@ -151,6 +152,23 @@ CObjectEntry* CObjectManager::FindObjectVariation(CObjectBase* base, const std::
 		return NULL;
 	}
 
+	if (obj->m_Pending)
+	{
+		// Don't cache the placeholder, so it'll be rebuilt once the meshes are
+		// loaded, but reuse the existing one for the same variation if there is one
+		m_PendingBases.insert(base);
+
+		std::map<ObjectKey, CObjectEntry*>::iterator pit = m_Placeholders.find(key);
+		if (pit != m_Placeholders.end())
+		{
+			delete obj;
+			return pit->second;
+		}
+
+		m_Placeholders[key] = obj;
+		return obj;
+	}
+
 	m_Objects[key] = obj;
 
 	return obj;
@@ -183,6 +201,14 @@ void CObjectManager::UnloadObjects()
 	);
 	m_Objects.clear();
 
+	std::for_each(
+		m_Placeholders.begin(),
+		m_Placeholders.end(),
+		delete_pair_2nd<ObjectKey, CObjectEntry*>
+	);
+	m_Placeholders.clear();
+	m_PendingBases.clear();
+
 	std::for_each(
 		m_ObjectBases.begin(),
 		m_ObjectBases.end(),
@@ -217,3 +243,27 @@ Status CObjectManager::ReloadChangedFile(const VfsPath& path)
 
 	return INFO::OK;
 }
+
+void CObjectManager::UpdatePendingObjects()
+{
+	if (!m_MeshManager.PollLoadedMeshes())
+		return;
+
+	PROFILE3("update pending objects");
+
+	// Rebuild every actor that was waiting for a mesh, in the same way as
+	// hotloading does. If some of their meshes are still loading, they'll
+	// get added back to m_PendingBases
+	std::set<CObjectBase*> pendingBases;
+	pendingBases.swap(m_PendingBases);
+
+	for (std::map<CStrW, CObjectBase*>::iterator it = m_ObjectBases.begin(); it != m_ObjectBases.end(); ++it)
+	{
+		if (pendingBases.find(it->second) == pendingBases.end())
+			continue;
+
+		const CSimulation2::InterfaceListUnordered& cmps = m_Simulation.GetEntitiesWithInterfaceUnordered(IID_Visual);
+		for (CSimulation2::InterfaceListUnordered::const_iterator eit = cmps.begin(); eit != cmps.end(); ++eit)
+			static_cast<ICmpVisual*>(eit->second)->Hotload(it->first);
+	}
+}
@@ -85,6 +85,13 @@ public:
 	 */
 	Status ReloadChangedFile(const VfsPath& path);
 
+	/**
+	 * Rebuilds the actors that were using placeholders, once the meshes
+	 * they were waiting for have been loaded in the background.
+	 * Should be called once per frame.
+	 */
+	void UpdatePendingObjects();
+
 private:
 	CMeshManager& m_MeshManager;
 	CSkeletonAnimManager& m_SkeletonAnimManager;
@@ -92,6 +99,14 @@ private:
 
 	std::map<ObjectKey, CObjectEntry*> m_Objects;
 	std::map<CStrW, CObjectBase*> m_ObjectBases;
+
+	// Placeholder objects, built while their meshes were loading. They're
+	// reused while still pending, and kept until UnloadObjects since some
+	// units might still refer to them
+	std::map<ObjectKey, CObjectEntry*> m_Placeholders;
+
+	// Actors which have built placeholder objects since the last UpdatePendingObjects
+	std::set<CObjectBase*> m_PendingBases;
 };
 
 #endif
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,11 +27,25 @@
 
 #include "renderer/Renderer.h"
 
+/**
+ * Returns whether emitters with compatible types should be simulated by the vertex shader.
+ * (The shaders only implement it in GLSL.)
+ */
+static bool UseGPUSimulation()
+{
+	return g_Renderer.m_Options.m_GPUParticles &&
+		g_Renderer.GetRenderPath() == CRenderer::RP_SHADER && g_Renderer.m_Options.m_PreferGLSL;
+}
+
 CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
-	m_Type(type), m_Active(true), m_NextParticleIdx(0), m_EmissionRoundingError(0.f),
+	m_Type(type), m_Active(true), m_GPUSimulation(type->m_GPUCompatible && UseGPUSimulation()),
+	m_NextParticleIdx(0), m_EmissionRoundingError(0.f),
 	m_LastUpdateTime(type->m_Manager.GetCurrentTime()),
+	m_FirstNewParticle(0), m_NumNewParticles(0),
+	m_SpawnBoundsTime(type->m_Manager.GetCurrentTime()),
 	m_IndexArray(GL_DYNAMIC_DRAW),
-	m_VertexArray(GL_DYNAMIC_DRAW)
+	// With the GPU simulation, the data only changes when particles are emitted
+	m_VertexArray(m_GPUSimulation ? GL_DYNAMIC_DRAW : GL_STREAM_DRAW)
 {
 	// If we should start with particles fully emitted, pretend that we
 	// were created in the past so the first update will produce lots of
@@ -49,9 +63,12 @@ CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
 	m_AttributePos.elems = 3;
 	m_VertexArray.AddAttribute(&m_AttributePos);
 
-	m_AttributeAxis.type = GL_FLOAT;
-	m_AttributeAxis.elems = 2;
-	m_VertexArray.AddAttribute(&m_AttributeAxis);
+	if (!m_GPUSimulation)
+	{
+		m_AttributeAxis.type = GL_FLOAT;
+		m_AttributeAxis.elems = 2;
+		m_VertexArray.AddAttribute(&m_AttributeAxis);
+	}
 
 	m_AttributeUV.type = GL_FLOAT;
 	m_AttributeUV.elems = 2;
@@ -61,9 +78,38 @@ CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
 	m_AttributeColor.elems = 4;
 	m_VertexArray.AddAttribute(&m_AttributeColor);
 
+	if (m_GPUSimulation)
+	{
+		// angle, angle speed, size
+		m_AttributeRotation.type = GL_FLOAT;
+		m_AttributeRotation.elems = 3;
+		m_VertexArray.AddAttribute(&m_AttributeRotation);
+
+		m_AttributeVelocity.type = GL_FLOAT;
+		m_AttributeVelocity.elems = 3;
+		m_VertexArray.AddAttribute(&m_AttributeVelocity);
+
+		// spawn time, maximum age
+		m_AttributeTime.type = GL_FLOAT;
+		m_AttributeTime.elems = 2;
+		m_VertexArray.AddAttribute(&m_AttributeTime);
+	}
+
 	m_VertexArray.SetNumVertices(m_Type->m_MaxParticles * 4);
 	m_VertexArray.Layout();
 
+	if (m_GPUSimulation)
+	{
+		// Unused particles are drawn as dead (i.e. invisible) ones until they're emitted
+		VertexArrayIterator<float[2]> attrTime = m_AttributeTime.GetIterator<float[2]>();
+		for (size_t i = 0; i < m_VertexArray.GetNumVertices(); ++i)
+		{
+			(*attrTime)[0] = -m_Type->m_MaxLifetime;
+			(*attrTime)[1] = 0.f;
+			++attrTime;
+		}
+	}
+
 	m_IndexArray.SetNumVertices(m_Type->m_MaxParticles * 6);
 	m_IndexArray.Layout();
 	VertexArrayIterator<u16> index = m_IndexArray.GetIterator();
@@ -86,6 +132,14 @@ void CParticleEmitter::UpdateArrayData()
 	m_Type->UpdateEmitter(*this, m_Type->m_Manager.GetCurrentTime() - m_LastUpdateTime);
 	m_LastUpdateTime = m_Type->m_Manager.GetCurrentTime();
 
+	if (m_GPUSimulation)
+		UpdateNewParticlesArrayData();
+	else
+		UpdateSimulatedArrayData();
+}
+
+void CParticleEmitter::UpdateSimulatedArrayData()
+{
 	// Regenerate the vertex array data:
 
 	VertexArrayIterator<CVector3D> attrPos = m_AttributePos.GetIterator<CVector3D>();
@@ -164,6 +218,90 @@ void CParticleEmitter::UpdateArrayData()
 	m_VertexArray.Upload();
 }
 
+void CParticleEmitter::UpdateNewParticlesArrayData()
+{
+	ENSURE(m_Particles.size() <= m_Type->m_MaxParticles);
+
+	// Start a new period of emission bounds once every particle emitted
+	// in the previous period must be dead
+	float time = m_Type->m_Manager.GetCurrentTime();
+	if (time - m_SpawnBoundsTime > m_Type->m_MaxLifetime)
+	{
+		m_SpawnBounds[1] = m_SpawnBounds[0];
+		m_SpawnBounds[0].SetEmpty();
+		m_SpawnBoundsTime = time;
+	}
+
+	if (m_NumNewParticles)
+	{
+		// The new particles may wrap around the end of the ring buffer
+		size_t first = m_FirstNewParticle;
+		size_t count = std::min(m_NumNewParticles, m_Particles.size() - first);
+		WriteInitialState(first, count);
+		m_VertexArray.UploadRange(first * 4, count * 4);
+		if (count < m_NumNewParticles)
+		{
+			WriteInitialState(0, m_NumNewParticles - count);
+			m_VertexArray.UploadRange(0, (m_NumNewParticles - count) * 4);
+		}
+		m_NumNewParticles = 0;
+	}
+
+	// Extend the emission positions by however far the particles might have moved
+	CBoundingBoxAligned bounds = m_SpawnBounds[0];
+	bounds += m_SpawnBounds[1];
+	if (!bounds.IsEmpty())
+	{
+		bounds[0] += m_Type->m_MaxMotionBounds[0];
+		bounds[1] += m_Type->m_MaxMotionBounds[1];
+	}
+	m_ParticleBounds = bounds;
+}
+
+void CParticleEmitter::WriteInitialState(size_t first, size_t count)
+{
+	VertexArrayIterator<CVector3D> attrPos = m_AttributePos.GetIterator<CVector3D>() + first*4;
+	VertexArrayIterator<float[2]> attrUV = m_AttributeUV.GetIterator<float[2]>() + first*4;
+	VertexArrayIterator<SColor4ub> attrColor = m_AttributeColor.GetIterator<SColor4ub>() + first*4;
+	VertexArrayIterator<float[3]> attrRotation = m_AttributeRotation.GetIterator<float[3]>() + first*4;
+	VertexArrayIterator<CVector3D> attrVelocity = m_AttributeVelocity.GetIterator<CVector3D>() + first*4;
+	VertexArrayIterator<float[2]> attrTime = m_AttributeTime.GetIterator<float[2]>() + first*4;
+
+	// The corner of each vertex (and therefore the direction of its offset from the
+	// centre) is implied by its UV coordinates
+	static const float cornerUVs[4][2] = { { 1, 0 }, { 0, 0 }, { 0, 1 }, { 1, 1 } };
+
+	for (size_t i = first; i < first + count; ++i)
+	{
+		const SParticle& p = m_Particles[i];
+
+		m_SpawnBounds[0] += p.pos;
+
+		for (size_t v = 0; v < 4; ++v)
+		{
+			*attrPos++ = p.pos;
+
+			(*attrUV)[0] = cornerUVs[v][0];
+			(*attrUV)[1] = cornerUVs[v][1];
+			++attrUV;
+
+			// (The alpha is computed by the shader)
+			*attrColor++ = p.color;
+
+			(*attrRotation)[0] = p.angle;
+			(*attrRotation)[1] = p.angleSpeed;
+			(*attrRotation)[2] = p.size;
+			++attrRotation;
+
+			*attrVelocity++ = p.velocity;
+
+			(*attrTime)[0] = p.spawnTime;
+			(*attrTime)[1] = p.maxAge;
+			++attrTime;
+		}
+	}
+}
+
 void CParticleEmitter::Bind(const CShaderProgramPtr& shader)
 {
 	CLOSTexture& los = g_Renderer.GetScene().GetLOSTexture();
@@ -175,6 +313,14 @@ void CParticleEmitter::Bind(const CShaderProgramPtr& shader)
 	shader->Uniform("fogColor", lightEnv.m_FogColor);
 	shader->Uniform("fogParams", lightEnv.m_FogFactor, lightEnv.m_FogMax, 0.f, 0.f);
 
+	if (m_GPUSimulation)
+	{
+		shader->Uniform("simTime", m_Type->m_Manager.GetCurrentTime());
+		shader->Uniform("accel", m_Type->m_Accel);
+		// See the special case in UpdateSimulatedArrayData
+		shader->Uniform("premultiplyAlpha", m_Type->m_BlendFuncDst == GL_ONE_MINUS_SRC_COLOR ? 1.f : 0.f);
+	}
+
 	shader->BindTexture("baseTex", m_Type->m_Texture);
 	pglBlendEquationEXT(m_Type->m_BlendEquation);
 	glBlendFunc(m_Type->m_BlendFuncSrc, m_Type->m_BlendFuncDst);
@@ -194,10 +340,19 @@ void CParticleEmitter::RenderArray(const CShaderProgramPtr& shader)
 
 	shader->VertexPointer(3, GL_FLOAT, stride, base + m_AttributePos.offset);
 
-	// Pass the sin/cos axis components as texcoords for no particular reason
-	// other than that they fit. (Maybe this should be glVertexAttrib* instead?)
 	shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, base + m_AttributeUV.offset);
-	shader->TexCoordPointer(GL_TEXTURE1, 2, GL_FLOAT, stride, base + m_AttributeAxis.offset);
+	if (m_GPUSimulation)
+	{
+		shader->TexCoordPointer(GL_TEXTURE1, 3, GL_FLOAT, stride, base + m_AttributeRotation.offset);
+		shader->TexCoordPointer(GL_TEXTURE2, 3, GL_FLOAT, stride, base + m_AttributeVelocity.offset);
+		shader->TexCoordPointer(GL_TEXTURE3, 2, GL_FLOAT, stride, base + m_AttributeTime.offset);
+	}
+	else
+	{
+		// Pass the sin/cos axis components as texcoords for no particular reason
+		// other than that they fit. (Maybe this should be glVertexAttrib* instead?)
+		shader->TexCoordPointer(GL_TEXTURE1, 2, GL_FLOAT, stride, base + m_AttributeAxis.offset);
+	}
 
 	shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, base + m_AttributeColor.offset);
 
@@ -216,6 +371,10 @@ void CParticleEmitter::Unattach(const CParticleEmitterPtr& self)
 
 void CParticleEmitter::AddParticle(const SParticle& particle)
 {
+	if (m_NumNewParticles == 0)
+		m_FirstNewParticle = m_NextParticleIdx;
+	m_NumNewParticles = std::min(m_NumNewParticles + 1, m_Type->m_MaxParticles);
+
 	if (m_NextParticleIdx >= m_Particles.size())
 		m_Particles.push_back(particle);
 	else
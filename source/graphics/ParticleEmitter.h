@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -38,6 +38,7 @@ struct SParticle
 	SColor4ub color;
 	float age;
 	float maxAge;
+	float spawnTime; // CParticleManager::GetCurrentTime() when it was emitted
 };
 
 typedef shared_ptr<CParticleEmitter> CParticleEmitterPtr;
@@ -59,6 +60,12 @@ typedef shared_ptr<CParticleEmitter> CParticleEmitterPtr;
  * array with alpha=0 until they're overwritten by a new particle after the maximum
  * lifetime.
  *
+ * If the emitter type's effectors allow it (and the gpuparticles option is enabled),
+ * the emitter uses the GPU simulation instead: the vertex array contains the initial
+ * state of each particle and its emission time, and the vertex shader computes the
+ * current position, rotation and alpha analytically. Then only the newly emitted
+ * particles have to be written and uploaded each frame.
+ *
  * (It's quite likely this could be made more efficient, if the overhead of any added
  * complexity is not high.)
  */
@@ -121,6 +128,10 @@ public:
 	/// Whether this emitter is still emitting new particles
 	bool m_Active;
 
+	/// Whether the particles are simulated by the vertex shader instead of the CPU
+	/// (fixed for the life of the emitter, since it determines the vertex format)
+	bool m_GPUSimulation;
+
 	CVector3D m_Pos;
 
 	std::map<std::string, float> m_EntityVariables;
@@ -132,16 +143,40 @@ public:
 	float m_EmissionRoundingError;
 
 private:
+	/// Update the vertex data of every particle, after simulating them on the CPU
+	void UpdateSimulatedArrayData();
+
+	/// Write and upload the vertex data of the particles emitted since the last update,
+	/// for the GPU simulation
+	void UpdateNewParticlesArrayData();
+
+	/// Write the vertex data of the particles [first, first+count) for the GPU simulation
+	void WriteInitialState(size_t first, size_t count);
+
 	/// Bounding box of the current particle center points
 	CBoundingBoxAligned m_ParticleBounds;
 
+	/// Range of particles that were emitted since the last update,
+	/// for the GPU simulation (may wrap around the end of m_Particles)
+	size_t m_FirstNewParticle;
+	size_t m_NumNewParticles;
+
+	/// Bounding boxes of the emission positions for the GPU simulation: [0] is for the
+	/// particles emitted since m_SpawnBoundsTime, and [1] for the previous period.
+	/// Periods are as long as the maximum lifetime, so older particles are all dead.
+	CBoundingBoxAligned m_SpawnBounds[2];
+	float m_SpawnBoundsTime;
+
 	VertexIndexArray m_IndexArray;
 
 	VertexArray m_VertexArray;
 	VertexArray::Attribute m_AttributePos;
-	VertexArray::Attribute m_AttributeAxis;
+	VertexArray::Attribute m_AttributeAxis; // CPU simulation only
 	VertexArray::Attribute m_AttributeUV;
 	VertexArray::Attribute m_AttributeColor;
+	VertexArray::Attribute m_AttributeRotation; // GPU simulation only
+	VertexArray::Attribute m_AttributeVelocity; // GPU simulation only
+	VertexArray::Attribute m_AttributeTime; // GPU simulation only
 };
 
 /**
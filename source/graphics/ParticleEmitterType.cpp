@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -220,6 +220,11 @@ public:
 	/// Returns maximum acceleration caused by this effector.
 	virtual CVector3D Max() = 0;
 
+	/**
+	 * Returns whether the acceleration is constant (and equal to Max()), so that
+	 * the particle motion can be computed analytically by the GPU simulation.
+	 */
+	virtual bool IsConstantForce() { return false; }
 };
 
 /**
@@ -246,6 +251,11 @@ public:
 		return m_Accel;
 	}
 
+	virtual bool IsConstantForce()
+	{
+		return true;
+	}
+
 private:
 	CVector3D m_Accel;
 };
@@ -278,8 +288,14 @@ CParticleEmitterType::CParticleEmitterType(const VfsPath& path, CParticleManager
 
 	// Compute combined acceleration (assume constant)
 	CVector3D accel;
+	m_GPUCompatible = true;
 	for (size_t i = 0; i < m_Effectors.size(); ++i)
+	{
 		accel += m_Effectors[i]->Max();
+		if (!m_Effectors[i]->IsConstantForce())
+			m_GPUCompatible = false;
+	}
+	m_Accel = accel;
 
 	CVector3D vmin(m_Variables[VAR_VELOCITY_X]->Min(*this), m_Variables[VAR_VELOCITY_Y]->Min(*this), m_Variables[VAR_VELOCITY_Z]->Min(*this));
 	CVector3D vmax(m_Variables[VAR_VELOCITY_X]->Max(*this), m_Variables[VAR_VELOCITY_Y]->Max(*this), m_Variables[VAR_VELOCITY_Z]->Max(*this));
@@ -307,6 +323,8 @@ CParticleEmitterType::CParticleEmitterType(const VfsPath& path, CParticleManager
 	if (accel.Z && 0 < -vmax.Z/accel.Z && -vmax.Z/accel.Z < m_MaxLifetime)
 		m_MaxBounds[1].Z = std::max(m_MaxBounds[1].Z, -0.5f*vmax.Z*vmax.Z / accel.Z);
 
+	m_MaxMotionBounds = m_MaxBounds;
+
 	// Offset by the initial positions
 	m_MaxBounds[0] += CVector3D(m_Variables[VAR_POSITION_X]->Min(*this), m_Variables[VAR_POSITION_Y]->Min(*this), m_Variables[VAR_POSITION_Z]->Min(*this));
 	m_MaxBounds[1] += CVector3D(m_Variables[VAR_POSITION_X]->Max(*this), m_Variables[VAR_POSITION_Y]->Max(*this), m_Variables[VAR_POSITION_Z]->Max(*this));
@@ -494,16 +512,19 @@ void CParticleEmitterType::UpdateEmitter(CParticleEmitter& emitter, float dt)
 	// period of the particles
 	dt = std::min(dt, m_MaxLifetime);
 
+	float time = m_Manager.GetCurrentTime() - dt;
+
 	while (dt > maxStepLength)
 	{
-		UpdateEmitterStep(emitter, maxStepLength);
+		UpdateEmitterStep(emitter, maxStepLength, time);
 		dt -= maxStepLength;
+		time += maxStepLength;
 	}
 
-	UpdateEmitterStep(emitter, dt);
+	UpdateEmitterStep(emitter, dt, time);
 }
 
-void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt)
+void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt, float time)
 {
 	ENSURE(emitter.m_Type.get() == this);
 
@@ -547,11 +568,16 @@ void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt
 
 			particle.age = 0.f;
 			particle.maxAge = m_Variables[VAR_LIFETIME]->Evaluate(emitter);
+			particle.spawnTime = time;
 
 			emitter.AddParticle(particle);
 		}
 	}
 
+	// The GPU simulation computes everything else from the initial state
+	if (emitter.m_GPUSimulation)
+		return;
+
 	// Update particle states
 	for (size_t i = 0; i < emitter.m_Particles.size(); ++i)
 	{
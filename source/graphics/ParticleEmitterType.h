@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,8 +22,8 @@
 #include "lib/ogl.h"
 #include "lib/file/vfs/vfs_path.h"
 #include "maths/BoundingBoxAligned.h"
+#include "maths/Vector3D.h"
 
-class CVector3D;
 class CParticleEmitter;
 class CParticleManager;
 class IParticleVar;
@@ -84,9 +84,9 @@ private:
 
 	/**
 	 * Update the state of an emitter's particles, by a short time @p dt that can
-	 * be computed in a single step.
+	 * be computed in a single step starting at @p time.
 	 */
-	void UpdateEmitterStep(CParticleEmitter& emitter, float dt);
+	void UpdateEmitterStep(CParticleEmitter& emitter, float dt, float time);
 
 	CBoundingBoxAligned CalculateBounds(CVector3D emitterPos, CBoundingBoxAligned emittedBounds);
 
@@ -101,6 +101,16 @@ private:
 	size_t m_MaxParticles;
 	CBoundingBoxAligned m_MaxBounds;
 
+	/// Bounds of the movement of any particle relative to where it was emitted
+	CBoundingBoxAligned m_MaxMotionBounds;
+
+	/// Whether all the effectors can be computed analytically by the GPU simulation
+	/// (i.e. they're all constant forces)
+	bool m_GPUCompatible;
+
+	/// Combined acceleration of all the effectors (if m_GPUCompatible)
+	CVector3D m_Accel;
+
 	typedef shared_ptr<IParticleVar> IParticleVarPtr;
 	std::vector<IParticleVarPtr> m_Variables;
 
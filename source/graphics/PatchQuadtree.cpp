@@ -0,0 +1,113 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "PatchQuadtree.h"
+
+#include "graphics/Frustum.h"
+#include "graphics/Patch.h"
+#include "graphics/Terrain.h"
+
+CPatchQuadtree::CPatchQuadtree() :
+	m_Dirty(true)
+{
+}
+
+void CPatchQuadtree::Rebuild(CTerrain& terrain)
+{
+	m_Levels.clear();
+	m_LevelSizes.clear();
+
+	ssize_t size = terrain.GetPatchesPerSide();
+	if (size == 0)
+		return;
+
+	m_Levels.push_back(std::vector<CBoundingBoxAligned>(size*size));
+	m_LevelSizes.push_back(size);
+	for (ssize_t j = 0; j < size; ++j)
+		for (ssize_t i = 0; i < size; ++i)
+			m_Levels[0][i + j*size] = terrain.GetPatch(i, j)->GetWorldBounds();
+
+	while (size > 1)
+	{
+		ssize_t parentSize = (size + 1) / 2;
+		std::vector<CBoundingBoxAligned> parents(parentSize*parentSize);
+		const std::vector<CBoundingBoxAligned>& children = m_Levels.back();
+		for (ssize_t j = 0; j < size; ++j)
+			for (ssize_t i = 0; i < size; ++i)
+				parents[i/2 + (j/2)*parentSize] += children[i + j*size];
+
+		m_Levels.push_back(parents);
+		m_LevelSizes.push_back(parentSize);
+		size = parentSize;
+	}
+}
+
+void CPatchQuadtree::GetVisiblePatches(CTerrain& terrain, const CFrustum& frustum, float minTop, std::vector<CPatch*>& patches)
+{
+	if (m_Dirty)
+	{
+		Rebuild(terrain);
+		m_Dirty = false;
+	}
+
+	if (m_Levels.empty())
+		return;
+
+	AddVisiblePatches(terrain, frustum, minTop, m_Levels.size() - 1, 0, 0, patches);
+}
+
+void CPatchQuadtree::AddVisiblePatches(CTerrain& terrain, const CFrustum& frustum, float minTop, size_t level, ssize_t i, ssize_t j, std::vector<CPatch*>& patches) const
+{
+	CBoundingBoxAligned bounds = m_Levels[level][i + j*m_LevelSizes[level]];
+	if (bounds[1].Y < minTop)
+		bounds[1].Y = minTop;
+
+	if (!frustum.IsBoxVisible(CVector3D(0, 0, 0), bounds))
+		return;
+
+	if (level == 0)
+	{
+		patches.push_back(terrain.GetPatch(i, j));
+		return;
+	}
+
+	if (frustum.IsBoxInside(bounds))
+	{
+		AddAllPatches(terrain, level, i, j, patches);
+		return;
+	}
+
+	ssize_t childSize = m_LevelSizes[level-1];
+	for (ssize_t cj = j*2; cj < std::min(j*2 + 2, childSize); ++cj)
+		for (ssize_t ci = i*2; ci < std::min(i*2 + 2, childSize); ++ci)
+			AddVisiblePatches(terrain, frustum, minTop, level-1, ci, cj, patches);
+}
+
+void CPatchQuadtree::AddAllPatches(CTerrain& terrain, size_t level, ssize_t i, ssize_t j, std::vector<CPatch*>& patches) const
+{
+	// Find the range of patches covered by this node
+	ssize_t size = m_LevelSizes[0];
+	ssize_t i0 = i << level;
+	ssize_t j0 = j << level;
+	ssize_t i1 = std::min(i0 + ((ssize_t)1 << level), size);
+	ssize_t j1 = std::min(j0 + ((ssize_t)1 << level), size);
+	for (ssize_t pj = j0; pj < j1; ++pj)
+		for (ssize_t pi = i0; pi < i1; ++pi)
+			patches.push_back(terrain.GetPatch(pi, pj));
+}
@@ -0,0 +1,78 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_PATCHQUADTREE
+#define INCLUDED_PATCHQUADTREE
+
+#include "maths/BoundingBoxAligned.h"
+
+#include <vector>
+
+class CFrustum;
+class CPatch;
+class CTerrain;
+
+/**
+ * Quadtree of the bounding boxes of a terrain's patches, for finding the
+ * patches that are visible in a frustum without testing every one of them.
+ *
+ * Level 0 stores the bounds of each patch, and each higher level stores the
+ * union of the bounds of (up to) 2x2 nodes of the level below, up to a single
+ * root node. Nodes that are outside the frustum are skipped along with all their
+ * children, and nodes that are entirely inside it are accepted without testing
+ * their children.
+ *
+ * The bounds are recomputed lazily after MakeDirty, which CTerrain calls
+ * whenever the patch bounds might have changed.
+ */
+class CPatchQuadtree
+{
+	NONCOPYABLE(CPatchQuadtree);
+public:
+	CPatchQuadtree();
+
+	/**
+	 * Marks the bounds as needing to be recomputed before the next query.
+	 */
+	void MakeDirty() { m_Dirty = true; }
+
+	/**
+	 * Appends every patch of @p terrain whose bounds are visible in @p frustum
+	 * to @p patches, in no particular order.
+	 * The top of each patch's bounds is first raised to at least @p minTop
+	 * (e.g. to include the water plane above underwater patches).
+	 * The result is exactly the same as testing each patch individually.
+	 */
+	void GetVisiblePatches(CTerrain& terrain, const CFrustum& frustum, float minTop, std::vector<CPatch*>& patches);
+
+private:
+	void Rebuild(CTerrain& terrain);
+
+	void AddVisiblePatches(CTerrain& terrain, const CFrustum& frustum, float minTop, size_t level, ssize_t i, ssize_t j, std::vector<CPatch*>& patches) const;
+
+	void AddAllPatches(CTerrain& terrain, size_t level, ssize_t i, ssize_t j, std::vector<CPatch*>& patches) const;
+
+	bool m_Dirty;
+
+	// Bounds of each node, indexed by level (0 = patches), then by i + j*m_LevelSizes[level]
+	std::vector<std::vector<CBoundingBoxAligned> > m_Levels;
+
+	// Number of nodes per side at each level
+	std::vector<ssize_t> m_LevelSizes;
+};
+
+#endif // INCLUDED_PATCHQUADTREE
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -110,9 +110,27 @@ CShaderParams<value_t>::CShaderParams()
 	m_Items = GetInterned(items);
 }
 
+template<typename value_t>
+size_t CShaderParams<value_t>::SSetKeyHash::operator()(const SSetKey& key) const
+{
+	size_t hash = 0;
+	boost::hash_combine(hash, key.items);
+	boost::hash_combine(hash, key.name);
+	boost::hash_combine(hash, key.value);
+	return hash;
+}
+
 template<typename value_t>
 void CShaderParams<value_t>::Set(CStrIntern name, const value_t& value)
 {
+	SSetKey key = { m_Items, name, value };
+	typename SetResults_t::iterator cached = s_SetResults.find(key);
+	if (cached != s_SetResults.end())
+	{
+		m_Items = cached->second;
+		return;
+	}
+
 	SItems items = *m_Items;
 
 	typename SItems::Item addedItem = std::make_pair(name, value);
@@ -134,11 +152,29 @@ void CShaderParams<value_t>::Set(CStrIntern name, const value_t& value)
 
 	items.RecalcHash();
 	m_Items = GetInterned(items);
+	s_SetResults[key] = m_Items;
 }
 
 template<typename value_t>
 void CShaderParams<value_t>::SetMany(const CShaderParams& params)
 {
+	// Trivial merges don't need a lookup
+	if (params.IsEmpty() || params.m_Items == m_Items)
+		return;
+	if (IsEmpty())
+	{
+		m_Items = params.m_Items;
+		return;
+	}
+
+	std::pair<SItems*, SItems*> key(m_Items, params.m_Items);
+	typename SetManyResults_t::iterator cached = s_SetManyResults.find(key);
+	if (cached != s_SetManyResults.end())
+	{
+		m_Items = cached->second;
+		return;
+	}
+
 	SItems items;
 	// set_union merges the two sorted lists into a new sorted list;
 	// if two items are equivalent (i.e. equal names, possibly different values)
@@ -150,6 +186,7 @@ void CShaderParams<value_t>::SetMany(const CShaderParams& params)
 		ItemNameCmp<value_t>());
 	items.RecalcHash();
 	m_Items = GetInterned(items);
+	s_SetManyResults[key] = m_Items;
 }
 
 template<typename value_t>
@@ -250,12 +287,12 @@ void CShaderRenderQueries::Add(const char* name)
 	}
 }
 
-size_t CShaderRenderQueries::GetSize()
+size_t CShaderRenderQueries::GetSize() const
 {
 	return m_Items.size();
 }
 
-CShaderRenderQueries::RenderQuery CShaderRenderQueries::GetItem(size_t i)
+CShaderRenderQueries::RenderQuery CShaderRenderQueries::GetItem(size_t i) const
 {
 	return m_Items[i];
 }
@@ -271,12 +308,12 @@ void CShaderConditionalDefines::Add(const char* defname, const char* defvalue, i
 	m_Defines.push_back(cd);
 }
 
-size_t CShaderConditionalDefines::GetSize()
+size_t CShaderConditionalDefines::GetSize() const
 {
 	return m_Defines.size();
 }
 
-CShaderConditionalDefines::CondDefine& CShaderConditionalDefines::GetItem(size_t i)
+const CShaderConditionalDefines::CondDefine& CShaderConditionalDefines::GetItem(size_t i) const
 {
 	return m_Defines[i];
 }
@@ -286,6 +323,10 @@ CShaderConditionalDefines::CondDefine& CShaderConditionalDefines::GetItem(size_t
 
 template<> CShaderParams<CStrIntern>::InternedItems_t CShaderParams<CStrIntern>::s_InternedItems = CShaderParams<CStrIntern>::InternedItems_t();
 template<> CShaderParams<CVector4D>::InternedItems_t CShaderParams<CVector4D>::s_InternedItems = CShaderParams<CVector4D>::InternedItems_t();
+template<> CShaderParams<CStrIntern>::SetResults_t CShaderParams<CStrIntern>::s_SetResults = CShaderParams<CStrIntern>::SetResults_t();
+template<> CShaderParams<CVector4D>::SetResults_t CShaderParams<CVector4D>::s_SetResults = CShaderParams<CVector4D>::SetResults_t();
+template<> CShaderParams<CStrIntern>::SetManyResults_t CShaderParams<CStrIntern>::s_SetManyResults = CShaderParams<CStrIntern>::SetManyResults_t();
+template<> CShaderParams<CVector4D>::SetManyResults_t CShaderParams<CVector4D>::s_SetManyResults = CShaderParams<CVector4D>::SetManyResults_t();
 
 template class CShaderParams<CStrIntern>;
 template class CShaderParams<CVector4D>;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -56,6 +56,14 @@ public:
 	 */
 	void SetMany(const CShaderParams& params);
 
+	/**
+	 * Return true if there are no parameters.
+	 */
+	bool IsEmpty() const
+	{
+		return m_Items->items.empty();
+	}
+
 	/**
 	 * Return a copy of the current name/value mapping.
 	 */
@@ -112,6 +120,29 @@ private:
 	typedef boost::unordered_map<SItems, shared_ptr<SItems> > InternedItems_t;
 	static InternedItems_t s_InternedItems;
 
+	// Results of Set and SetMany on interned items, so that repeating
+	// an earlier operation is a single hash lookup with no allocation
+	struct SSetKey
+	{
+		SItems* items;
+		CStrIntern name;
+		value_t value;
+
+		bool operator==(const SSetKey& b) const
+		{
+			return items == b.items && name == b.name && value == b.value;
+		}
+	};
+	struct SSetKeyHash
+	{
+		size_t operator()(const SSetKey& key) const;
+	};
+	typedef boost::unordered_map<SSetKey, SItems*, SSetKeyHash> SetResults_t;
+	static SetResults_t s_SetResults;
+
+	typedef boost::unordered_map<std::pair<SItems*, SItems*>, SItems*> SetManyResults_t;
+	static SetManyResults_t s_SetManyResults;
+
 	/**
 	 * Returns a pointer to an SItems equal to @p items.
 	 * The pointer will be valid forever, and the same pointer will be returned
@@ -186,8 +217,10 @@ public:
 	typedef std::pair<int, CStrIntern> RenderQuery;
 	
 	void Add(const char* name);
-	size_t GetSize();
-	RenderQuery GetItem(size_t i);
+	size_t GetSize() const;
+	RenderQuery GetItem(size_t i) const;
+
+	bool operator==(const CShaderRenderQueries& b) const { return m_Items == b.m_Items; }
 private:
 	std::vector<RenderQuery> m_Items;
 };
@@ -210,8 +243,8 @@ public:
 	};
 	
 	void Add(const char* defname, const char* defvalue, int type, std::vector<float> &args);
-	size_t GetSize();
-	CondDefine& GetItem(size_t i);
+	size_t GetSize() const;
+	const CondDefine& GetItem(size_t i) const;
 	
 private:
 	std::vector<CondDefine> m_Defines;
@@ -41,7 +41,8 @@ struct revcompare2nd
 	}
 };
 
-CShaderManager::CShaderManager()
+CShaderManager::CShaderManager() :
+	m_DeferPrograms(false)
 {
 #if USE_SHADER_XML_VALIDATION
 	{
@@ -68,10 +69,18 @@ CShaderManager::~CShaderManager()
 
 CShaderProgramPtr CShaderManager::LoadProgram(const char* name, const CShaderDefines& defines)
 {
-	CacheKey key = { name, defines };
-	std::map<CacheKey, CShaderProgramPtr>::iterator it = m_ProgramCache.find(key);
+	CacheKey key = { CStrIntern(name), defines };
+	ProgramCacheMap::iterator it = m_ProgramCache.find(key);
 	if (it != m_ProgramCache.end())
+	{
+		// If compiling the program was deferred but it's needed now, compile it immediately
+		if (!m_DeferPrograms && IsPending(it->second))
+		{
+			m_PendingPrograms.erase(std::find(m_PendingPrograms.begin(), m_PendingPrograms.end(), it->second));
+			it->second->Reload();
+		}
 		return it->second;
+	}
 
 	CShaderProgramPtr program;
 	if (!NewProgram(name, defines, program))
@@ -266,7 +275,10 @@ bool CShaderManager::NewProgram(const char* name, const CShaderDefines& baseDefi
 	else
 		program = CShaderProgramPtr(CShaderProgram::ConstructARB(vertexFile, fragmentFile, defines, vertexUniforms, fragmentUniforms, streamFlags));
 
-	program->Reload();
+	if (m_DeferPrograms)
+		m_PendingPrograms.push_back(program);
+	else
+		program->Reload();
 
 //	m_HotloadFiles[xmlFilename].insert(program); // TODO: should reload somehow when the XML changes
 	m_HotloadFiles[vertexFile].insert(program);
@@ -333,6 +345,14 @@ static GLenum ParseBlendFunc(const CStr& str)
 	return GL_ZERO;
 }
 
+size_t CShaderManager::CacheKeyHash::operator()(const CacheKey& key) const
+{
+	size_t hash = 0;
+	boost::hash_combine(hash, key.name.GetHash());
+	boost::hash_combine(hash, key.defines.GetHash());
+	return hash;
+}
+
 size_t CShaderManager::EffectCacheKeyHash::operator()(const EffectCacheKey& key) const
 {
 	size_t hash = 0;
@@ -377,6 +397,98 @@ CShaderTechniquePtr CShaderManager::LoadEffect(CStrIntern name, const CShaderDef
 	return tech;
 }
 
+CShaderTechniquePtr CShaderManager::LoadEffectWithFallback(CStrIntern name, const CShaderDefines& defines1, const CShaderDefines& defines2, bool& isFallback)
+{
+	isFallback = false;
+
+	if (!g_Renderer.m_Options.m_AsyncShaders)
+		return LoadEffect(name, defines1, defines2);
+
+	EffectCacheKey key = { name, defines1, defines2 };
+	EffectCacheMap::iterator it = m_EffectCache.find(key);
+	if (it != m_EffectCache.end())
+		return it->second;
+
+	it = m_PendingEffects.find(key);
+	if (it == m_PendingEffects.end())
+	{
+		CShaderDefines defines(defines1);
+		defines.SetMany(defines2);
+
+		// Construct the effect, but don't compile any new programs yet
+		CShaderTechniquePtr tech(new CShaderTechnique());
+		m_DeferPrograms = true;
+		bool ok = NewEffect(name.c_str(), defines, tech);
+		m_DeferPrograms = false;
+		if (!ok)
+		{
+			LOGERROR(L"Failed to load effect '%hs'", name.c_str());
+			tech = CShaderTechniquePtr();
+		}
+
+		bool pending = false;
+		if (tech)
+		{
+			for (int i = 0; i < tech->GetNumPasses(); ++i)
+				if (IsPending(tech->GetShader(i)))
+					pending = true;
+		}
+
+		// All the programs were already compiled, so it's ready to use
+		if (!pending)
+		{
+			m_EffectCache[key] = tech;
+			return tech;
+		}
+
+		m_PendingEffects[key] = tech;
+	}
+
+	isFallback = true;
+	return LoadEffect(name, defines1, CShaderDefines());
+}
+
+bool CShaderManager::IsPending(const CShaderProgramPtr& program) const
+{
+	return program && std::find(m_PendingPrograms.begin(), m_PendingPrograms.end(), program) != m_PendingPrograms.end();
+}
+
+void CShaderManager::MakeProgress()
+{
+	if (m_PendingPrograms.empty())
+		return;
+
+	PROFILE3("compile deferred shaders");
+
+	// Spend a few milliseconds per frame, but always compile at least one program
+	const double timeLimit = timer_Time() + 0.004;
+	size_t count = 0;
+	do
+	{
+		m_PendingPrograms[count++]->Reload();
+	}
+	while (count < m_PendingPrograms.size() && timer_Time() < timeLimit);
+	m_PendingPrograms.erase(m_PendingPrograms.begin(), m_PendingPrograms.begin() + count);
+
+	// Move the effects whose programs are all compiled into the effect cache
+	for (EffectCacheMap::iterator it = m_PendingEffects.begin(); it != m_PendingEffects.end(); )
+	{
+		bool pending = false;
+		for (int i = 0; i < it->second->GetNumPasses(); ++i)
+			if (IsPending(it->second->GetShader(i)))
+				pending = true;
+
+		if (pending)
+		{
+			++it;
+			continue;
+		}
+
+		m_EffectCache[it->first] = it->second;
+		it = m_PendingEffects.erase(it);
+	}
+}
+
 bool CShaderManager::NewEffect(const char* name, const CShaderDefines& baseDefines, CShaderTechniquePtr& tech)
 {
 	PROFILE2("loading effect");
@@ -67,6 +67,22 @@ public:
 	 */
 	CShaderTechniquePtr LoadEffect(const char* name);
 
+	/**
+	 * Load a shader effect like LoadEffect, but if its shaders haven't been
+	 * compiled yet then defer the compilation to MakeProgress and return
+	 * the effect without the defines2 (typically the material's defines),
+	 * which is more likely to have been compiled already.
+	 * @param isFallback set to true if the returned technique is the fallback,
+	 *  in which case the caller should not cache it
+	 */
+	CShaderTechniquePtr LoadEffectWithFallback(CStrIntern name, const CShaderDefines& defines1, const CShaderDefines& defines2, bool& isFallback);
+
+	/**
+	 * Compile some of the shaders deferred by LoadEffectWithFallback.
+	 * Should be called once per frame.
+	 */
+	void MakeProgress();
+
 	/**
 	 * Returns the number of shader effects that are currently loaded.
 	 */
@@ -76,22 +92,26 @@ private:
 
 	struct CacheKey
 	{
-		std::string name;
+		CStrIntern name;
 		CShaderDefines defines;
 
-		bool operator<(const CacheKey& k) const
+		bool operator==(const CacheKey& k) const
 		{
-			if (name < k.name) return true;
-			if (k.name < name) return false;
-			return defines < k.defines;
+			return name == k.name && defines == k.defines;
 		}
 	};
 
+	struct CacheKeyHash
+	{
+		size_t operator()(const CacheKey& key) const;
+	};
+
 	// A CShaderProgram contains expensive GL state, so we ought to cache it.
 	// The compiled state depends solely on the filename and list of defines,
 	// so we store that in CacheKey.
 	// TODO: is this cache useful when we already have an effect cache?
-	std::map<CacheKey, CShaderProgramPtr> m_ProgramCache;
+	typedef boost::unordered_map<CacheKey, CShaderProgramPtr, CacheKeyHash> ProgramCacheMap;
+	ProgramCacheMap m_ProgramCache;
 
 	/**
 	 * Key for effect cache lookups.
@@ -121,6 +141,17 @@ private:
 	typedef boost::unordered_map<VfsPath, std::set<boost::weak_ptr<CShaderProgram> > > HotloadFilesMap;
 	HotloadFilesMap m_HotloadFiles;
 
+	// If true, NewProgram adds the programs to m_PendingPrograms instead of compiling them
+	bool m_DeferPrograms;
+
+	// Programs that have been constructed but not compiled yet
+	std::vector<CShaderProgramPtr> m_PendingPrograms;
+
+	// Effects that are waiting for m_PendingPrograms to be compiled
+	EffectCacheMap m_PendingEffects;
+
+	bool IsPending(const CShaderProgramPtr& program) const;
+
 #if USE_SHADER_XML_VALIDATION
 	RelaxNGValidator m_Validator;
 #endif
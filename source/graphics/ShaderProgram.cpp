@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,12 +22,16 @@
 #include "graphics/ShaderManager.h"
 #include "graphics/TextureManager.h"
 #include "lib/res/graphics/ogl_tex.h"
+#include "maths/MD5.h"
 #include "maths/Matrix3D.h"
 #include "maths/Vector3D.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
 #include "ps/Overlay.h"
 #include "ps/PreprocessorWrapper.h"
+#include "renderer/Renderer.h"
+
+#include <iomanip>
 
 #if !CONFIG2_GLES
 
@@ -261,6 +265,7 @@ private:
 
 TIMER_ADD_CLIENT(tc_ShaderGLSLCompile);
 TIMER_ADD_CLIENT(tc_ShaderGLSLLink);
+TIMER_ADD_CLIENT(tc_ShaderGLSLLoadBinary);
 
 class CShaderProgramGLSL : public CShaderProgram
 {
@@ -346,6 +351,12 @@ public:
 		for (std::map<CStrIntern, int>::iterator it = m_VertexAttribs.begin(); it != m_VertexAttribs.end(); ++it)
 			pglBindAttribLocationARB(m_Program, it->second, it->first.c_str());
 
+#if !CONFIG2_GLES
+		// Let us read back the binary for the program cache
+		if (g_Renderer.GetCapabilities().m_ProgramBinary)
+			pglProgramParameteri(m_Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+
 		pglLinkProgramARB(m_Program);
 
 		GLint ok = 0;
@@ -375,6 +386,17 @@ public:
 		if (!ok)
 			return false;
 
+		SetupUniforms();
+
+		return true;
+	}
+
+	/**
+	 * Finds the active uniforms of the linked program, and assigns its
+	 * samplers to texture units.
+	 */
+	void SetupUniforms()
+	{
 		m_Uniforms.clear();
 		m_Samplers.clear();
 
@@ -420,10 +442,109 @@ public:
 		Unbind();
 
 		ogl_WarnIfError();
+	}
+
+#if !CONFIG2_GLES
+	/**
+	 * Returns the path of the program binary cache file for the given
+	 * (preprocessed) source code. The binaries depend on the driver, so
+	 * that's part of the key too.
+	 */
+	VfsPath GetBinaryCachePath(const CStr& vertexCode, const CStr& fragmentCode)
+	{
+		MD5 hash;
+		hash.Update((const u8*)vertexCode.data(), vertexCode.length());
+		hash.Update((const u8*)fragmentCode.data(), fragmentCode.length());
+		for (std::map<CStrIntern, int>::iterator it = m_VertexAttribs.begin(); it != m_VertexAttribs.end(); ++it)
+		{
+			hash.Update((const u8*)it->first.c_str(), it->first.length());
+			hash.Update((const u8*)&it->second, sizeof(it->second));
+		}
+		const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (size_t i = 0; i < ARRAY_SIZE(driverStrings); ++i)
+		{
+			const char* str = (const char*)glGetString(driverStrings[i]);
+			if (str)
+				hash.Update((const u8*)str, strlen(str));
+		}
 
+		u8 digest[MD5::DIGESTSIZE];
+		hash.Final(digest);
+		std::wstringstream digestString;
+		digestString << std::hex;
+		for (size_t i = 0; i < MD5::DIGESTSIZE; ++i)
+			digestString << std::setfill(L'0') << std::setw(2) << (int)digest[i];
+
+		return VfsPath("cache/shaders") / (digestString.str() + L".bin");
+	}
+
+	/**
+	 * Creates the program from a cached binary, if there is a usable one.
+	 */
+	bool LoadBinary(const VfsPath& path)
+	{
+		TIMER_ACCRUE(tc_ShaderGLSLLoadBinary);
+
+		if (!VfsFileExists(path))
+			return false;
+
+		shared_ptr<u8> buf;
+		size_t size;
+		if (g_VFS->LoadFile(path, buf, size) < 0 || size <= sizeof(u32))
+			return false;
+
+		// The file is the binary format followed by the binary itself
+		u32 format;
+		memcpy(&format, buf.get(), sizeof(format));
+
+		ENSURE(!m_Program);
+		m_Program = pglCreateProgramObjectARB();
+		pglProgramBinary(m_Program, (GLenum)format, buf.get() + sizeof(format), (GLsizei)(size - sizeof(format)));
+
+		// This fails if the driver has changed in a way that makes the binary
+		// unusable, in which case we just compile the program again
+		GLint ok = 0;
+		pglGetProgramiv(m_Program, GL_LINK_STATUS, &ok);
+		ogl_WarnIfError();
+		if (!ok)
+		{
+			pglDeleteProgram(m_Program);
+			m_Program = 0;
+			return false;
+		}
+
+		SetupUniforms();
 		return true;
 	}
 
+	/**
+	 * Saves the linked program's binary to the cache.
+	 */
+	void SaveBinary(const VfsPath& path)
+	{
+		GLint length = 0;
+		pglGetProgramiv(m_Program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+
+		shared_ptr<u8> buf;
+		AllocateAligned(buf, sizeof(u32) + length, maxSectorSize);
+
+		GLenum format = 0;
+		GLsizei written = 0;
+		pglGetProgramBinary(m_Program, length, &written, &format, buf.get() + sizeof(u32));
+		ogl_WarnIfError();
+		if (written <= 0)
+			return;
+
+		u32 format32 = (u32)format;
+		memcpy(buf.get(), &format32, sizeof(format32));
+
+		if (g_VFS->CreateFile(path, buf, sizeof(u32) + written) < 0)
+			LOGWARNING(L"Failed to write shader cache file '%ls'", path.string().c_str());
+	}
+#endif
+
 	virtual void Reload()
 	{
 		Unload();
@@ -462,6 +583,21 @@ public:
 		fragmentCode.Replace("#version 120\r\n", "#version 100\nprecision mediump float;\n");
 #endif
 
+#if !CONFIG2_GLES
+		// Try the program binary cache first, since loading a binary is much
+		// faster than compiling and linking
+		VfsPath binaryPath;
+		if (g_Renderer.GetCapabilities().m_ProgramBinary)
+		{
+			binaryPath = GetBinaryCachePath(vertexCode, fragmentCode);
+			if (LoadBinary(binaryPath))
+			{
+				m_IsValid = true;
+				return;
+			}
+		}
+#endif
+
 		if (!Compile(m_VertexShader, m_VertexFile, vertexCode))
 			return;
 
@@ -471,6 +607,11 @@ public:
 		if (!Link())
 			return;
 
+#if !CONFIG2_GLES
+		if (!binaryPath.empty())
+			SaveBinary(binaryPath);
+#endif
+
 		m_IsValid = true;
 	}
 
@@ -638,6 +779,14 @@ public:
 		}
 	}
 
+	virtual int GetVertexAttribLocation(const char* id)
+	{
+		std::map<CStrIntern, int>::iterator it = m_VertexAttribs.find(CStrIntern(id));
+		if (it == m_VertexAttribs.end())
+			return -1;
+		return it->second;
+	}
+
 	virtual void VertexAttribIPointer(const char* id, GLint size, GLenum type, GLsizei stride, void* pointer)
 	{
 		std::map<CStrIntern, int>::iterator it = m_VertexAttribs.find(CStrIntern(id));
@@ -796,6 +945,12 @@ void CShaderProgram::VertexAttribIPointer(const char* UNUSED(id), GLint UNUSED(s
 	debug_warn("Shader type doesn't support VertexAttribIPointer");
 }
 
+int CShaderProgram::GetVertexAttribLocation(const char* UNUSED(id))
+{
+	// Only GLSL programs have named attributes
+	return -1;
+}
+
 #if CONFIG2_GLES
 
 // These should all be overridden by CShaderProgramGLSL
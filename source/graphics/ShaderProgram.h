@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -191,6 +191,12 @@ public:
 	virtual void VertexAttribPointer(const char* id, GLint size, GLenum type, GLboolean normalized, GLsizei stride, void* pointer);
 	virtual void VertexAttribIPointer(const char* id, GLint size, GLenum type, GLsizei stride, void* pointer);
 
+	/**
+	 * Returns the location of the given named vertex attribute (as declared in the
+	 * program's XML file), or -1 if this program doesn't have it.
+	 */
+	virtual int GetVertexAttribLocation(const char* id);
+
 	/**
 	 * Checks that all the required vertex attributes have been set.
 	 * Call this before calling glDrawArrays/glDrawElements etc to avoid potential crashes.
@@ -25,11 +25,18 @@
 #include "maths/MathUtil.h"
 #include "ps/FileIo.h"
 
+#if ARCH_X86_X64
+# include <xmmintrin.h>
+# include "lib/sysdep/arch/x86_x64/x86_x64.h"
+#endif
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 // CSkeletonAnimDef constructor
 CSkeletonAnimDef::CSkeletonAnimDef() : m_FrameTime(0), m_NumKeys(0), m_NumFrames(0), m_Keys(0)
 {
+	for (size_t i = 0; i < POSE_CACHE_SIZE; ++i)
+		m_PoseCacheKeys[i] = (size_t)-1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -39,6 +46,85 @@ CSkeletonAnimDef::~CSkeletonAnimDef()
 	delete[] m_Keys;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////
+#if ARCH_X86_X64
+// BuildBoneMatrices_SSE: interpolate between two keys of every bone and build the
+// bone matrices, equivalent to the non-SSE loop in BuildBoneMatrices
+static void BuildBoneMatrices_SSE(const CSkeletonAnimDef::Key* startkeys, const CSkeletonAnimDef::Key* endkeys,
+	size_t numKeys, float deltatime, CMatrix3D* matrices)
+{
+	// Same threshold as CQuaternion::Slerp
+	const float EPSILON = 0.0001f;
+
+	const __m128 identity0 = _mm_setr_ps(1.0f, 0.0f, 0.0f, 0.0f);
+	const __m128 identity1 = _mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f);
+	const __m128 identity2 = _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f);
+	// Signs of the terms of each column of the rotation matrix (see CQuaternion::ToMatrix)
+	const __m128 signA0 = _mm_setr_ps(-1.0f, 1.0f, 1.0f, 0.0f);
+	const __m128 signC0 = _mm_setr_ps(-1.0f, 1.0f, -1.0f, 0.0f);
+	const __m128 signA1 = _mm_setr_ps(1.0f, -1.0f, 1.0f, 0.0f);
+	const __m128 signC1 = _mm_setr_ps(-1.0f, -1.0f, 1.0f, 0.0f);
+	const __m128 signA2 = _mm_setr_ps(1.0f, 1.0f, -1.0f, 0.0f);
+	const __m128 signC2 = _mm_setr_ps(1.0f, -1.0f, -1.0f, 0.0f);
+
+	for (size_t i = 0; i < numKeys; ++i)
+	{
+		const CSkeletonAnimDef::Key& startkey = startkeys[i];
+		const CSkeletonAnimDef::Key& endkey = endkeys[i];
+
+		// Slerp weights, computed like CQuaternion::Slerp
+		float cosom = startkey.m_Rotation.Dot(endkey.m_Rotation);
+		float sign = 1.0f;
+		if (cosom < 0.0f)
+		{
+			cosom = -cosom;
+			sign = -1.0f;
+		}
+		float scale0, scale1;
+		if ((1.0f - cosom) > EPSILON)
+		{
+			float omega = acosf(cosom);
+			float sinom = sinf(omega);
+			scale0 = sinf((1.0f - deltatime) * omega) / sinom;
+			scale1 = sinf(deltatime * omega) / sinom;
+		}
+		else
+		{
+			scale0 = 1.0f - deltatime;
+			scale1 = deltatime;
+		}
+
+		// q = [x, y, z, w]
+		__m128 q = _mm_add_ps(
+			_mm_mul_ps(_mm_loadu_ps(&startkey.m_Rotation.m_V.X), _mm_set1_ps(scale0)),
+			_mm_mul_ps(_mm_loadu_ps(&endkey.m_Rotation.m_V.X), _mm_set1_ps(scale1 * sign)));
+		__m128 q2 = _mm_add_ps(q, q);
+
+		// Each column is identity + A*B + C*D, where A,C are shuffled and signed
+		// components of q, and B,D are shuffled components of q2
+		__m128 col0 = _mm_add_ps(identity0, _mm_add_ps(
+			_mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 0, 0, 1)), signA0), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 2, 1, 1))),
+			_mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 3, 3, 2)), signC0), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 1, 2, 2)))));
+		__m128 col1 = _mm_add_ps(identity1, _mm_add_ps(
+			_mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 1, 0, 0)), signA1), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 2, 0, 1))),
+			_mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 3, 2, 3)), signC1), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 0, 2, 2)))));
+		__m128 col2 = _mm_add_ps(identity2, _mm_add_ps(
+			_mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 0, 1, 0)), signA2), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 0, 2, 2))),
+			_mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 1, 3, 3)), signC2), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 1, 0, 1)))));
+
+		_mm_storeu_ps(matrices[i]._data, col0);
+		_mm_storeu_ps(matrices[i]._data + 4, col1);
+		_mm_storeu_ps(matrices[i]._data + 8, col2);
+
+		CVector3D trans = Interpolate(startkey.m_Translation, endkey.m_Translation, deltatime);
+		matrices[i]._14 = trans.X;
+		matrices[i]._24 = trans.Y;
+		matrices[i]._34 = trans.Z;
+		matrices[i]._44 = 1.0f;
+	}
+}
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 // BuildBoneMatrices: build matrices for all bones at the given time (in MS) in this 
 // animation
@@ -53,6 +139,20 @@ void CSkeletonAnimDef::BuildBoneMatrices(float time, CMatrix3D* matrices, bool l
 	size_t endframe = startframe + 1;
 	endframe %= m_NumFrames; 
 
+#if ARCH_X86_X64
+	if (x86_x64::Cap(x86_x64::CAP_SSE))
+	{
+		// Display the final frame with no interpolation, as below
+		if (!loop && endframe == 0)
+		{
+			endframe = startframe;
+			deltatime = 0.0f;
+		}
+		BuildBoneMatrices_SSE(&GetKey(startframe, 0), &GetKey(endframe, 0), m_NumKeys, deltatime, matrices);
+		return;
+	}
+#endif
+
 	if (!loop && endframe == 0)
 	{
 		// This might be something like a death animation, and interpolating
@@ -85,6 +185,30 @@ void CSkeletonAnimDef::BuildBoneMatrices(float time, CMatrix3D* matrices, bool l
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////
+// GetCachedBoneMatrices: return matrices for all bones at approximately the given time,
+// shared with other models that are playing this animation at the same point
+const CMatrix3D* CSkeletonAnimDef::GetCachedBoneMatrices(float time, bool loop) const
+{
+	// Round the time to a fraction of a frame, so that models that are nearly
+	// in step can share the pose
+	const float step = m_FrameTime / POSE_CACHE_SUBFRAMES;
+	size_t substep = ((size_t)(int)(time / step)) % (m_NumFrames * POSE_CACHE_SUBFRAMES);
+	size_t key = substep * 2 + (loop ? 1 : 0);
+
+	if (m_PoseCache.empty())
+		m_PoseCache.resize(POSE_CACHE_SIZE * m_NumKeys);
+
+	size_t slot = substep % POSE_CACHE_SIZE;
+	CMatrix3D* matrices = &m_PoseCache[slot * m_NumKeys];
+	if (m_PoseCacheKeys[slot] != key)
+	{
+		BuildBoneMatrices(substep * step, matrices, loop);
+		m_PoseCacheKeys[slot] = key;
+	}
+	return matrices;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 // Load: try to load the anim from given file; return a new anim if successful
 CSkeletonAnimDef* CSkeletonAnimDef::Load(const VfsPath& filename)
@@ -22,6 +22,7 @@
 #ifndef INCLUDED_SKELETONANIMDEF
 #define INCLUDED_SKELETONANIMDEF
 
+#include "maths/Matrix3D.h"
 #include "maths/Vector3D.h"
 #include "maths/Quaternion.h"
 #include "lib/file/vfs/vfs_path.h"
@@ -77,6 +78,12 @@ public:
 	// build matrices for all bones at the given time (in MS) in this animation
 	void BuildBoneMatrices(float time, CMatrix3D* matrices, bool loop) const;
 
+	// return matrices for all bones at the given time (in MS) rounded to a
+	// fraction of a frame, from a cache shared by all models playing this
+	// animation. The returned pointer is only valid until the next call.
+	// Not thread-safe - must only be used from the main thread.
+	const CMatrix3D* GetCachedBoneMatrices(float time, bool loop) const;
+
 	// anim I/O functions
 	static CSkeletonAnimDef* Load(const VfsPath& filename);
 	static void Save(const VfsPath& pathname, const CSkeletonAnimDef* anim);
@@ -90,6 +97,18 @@ public:
 	size_t m_NumFrames;
 	// animation data - m_NumKeys*m_NumFrames total keys
 	Key* m_Keys;
+
+private:
+	// number of cached poses per frame (see GetCachedBoneMatrices)
+	static const size_t POSE_CACHE_SUBFRAMES = 4;
+	// number of cached poses; since models playing the same animation
+	// are usually near the same time, a few are enough
+	static const size_t POSE_CACHE_SIZE = 8;
+
+	// quantized time of each cached pose, or -1 if unused
+	mutable size_t m_PoseCacheKeys[POSE_CACHE_SIZE];
+	// bone matrices of the cached poses - POSE_CACHE_SIZE*m_NumKeys total
+	mutable std::vector<CMatrix3D> m_PoseCache;
 };
 
 #endif
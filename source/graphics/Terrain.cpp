@@ -567,6 +567,8 @@ void CTerrain::InitialisePatches()
 			patch->Initialize(this, i, j);
 		}
 	}
+
+	m_PatchQuadtree.MakeDirty();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -588,6 +590,8 @@ void CTerrain::SetHeightMap(u16* heightmap)
 		}
 	}
 
+	m_PatchQuadtree.MakeDirty();
+
 	// update mipmap
 	m_HeightMipmap.Update(m_Heightmap);
 }
@@ -614,6 +618,9 @@ void CTerrain::MakeDirty(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1, int dir
 		}
 	}
 
+	if (dirtyFlags & RENDERDATA_UPDATE_VERTICES)
+		m_PatchQuadtree.MakeDirty();
+
 	if (m_Heightmap)
 	{
 		m_HeightMipmap.Update(m_Heightmap,
@@ -638,6 +645,9 @@ void CTerrain::MakeDirty(int dirtyFlags)
 		}
 	}
 
+	if (dirtyFlags & RENDERDATA_UPDATE_VERTICES)
+		m_PatchQuadtree.MakeDirty();
+
 	if (m_Heightmap)
 		m_HeightMipmap.Update(m_Heightmap);
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,6 +26,7 @@
 #include "maths/Fixed.h"
 #include "graphics/SColor.h"
 #include "graphics/HeightMipmap.h"
+#include "graphics/PatchQuadtree.h"
 
 class CPatch;
 class CMiniPatch;
@@ -155,6 +156,9 @@ public:
 
 	const CHeightMipmap& GetHeightMipmap() const { return m_HeightMipmap; }
 
+	// get the quadtree of patch bounds, for culling patches against a frustum
+	CPatchQuadtree& GetPatchQuadtree() { return m_PatchQuadtree; }
+
 private:
 	// delete any data allocated by this terrain
 	void ReleaseData();
@@ -173,6 +177,8 @@ private:
 	SColor4ub m_BaseColour;
 	// heightmap mipmap
 	CHeightMipmap m_HeightMipmap;
+	// quadtree of patch bounds
+	CPatchQuadtree m_PatchQuadtree;
 };
 
 #endif
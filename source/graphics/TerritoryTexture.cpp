@@ -32,8 +32,15 @@
 
 // TODO: There's a lot of duplication with CLOSTexture - might be nice to refactor a bit
 
+// Alpha of the boundary texels, which is blurred outwards by decreasing alphaFalloff per texel
+static const int alphaMax = 0xC0;
+static const int alphaFalloff = 0x20;
+
+// Number of texels that the boundary is blurred over
+static const ssize_t BLUR_DISTANCE = alphaMax / alphaFalloff;
+
 CTerritoryTexture::CTerritoryTexture(CSimulation2& simulation) :
-	m_Simulation(simulation), m_DirtyID(0), m_Texture(0), m_MapSize(0), m_TextureSize(0)
+	m_Simulation(simulation), m_DirtyID(0), m_ChangedID(0), m_Texture(0), m_MapSize(0), m_TextureSize(0)
 {
 }
 
@@ -145,35 +152,71 @@ void CTerritoryTexture::RecomputeTexture(int unit)
 	if (m_Texture)
 	{
 		CmpPtr<ICmpTerrain> cmpTerrain(m_Simulation, SYSTEM_ENTITY);
-		if (cmpTerrain && m_MapSize != (ssize_t)cmpTerrain->GetVerticesPerSide())
+		if (cmpTerrain && m_MapSize != (ssize_t)cmpTerrain->GetVerticesPerSide() - 1)
 			DeleteTexture();
 	}
 
+	bool recreated = false;
 	if (!m_Texture)
+	{
 		ConstructTexture(unit);
+		recreated = true;
+	}
 
 	PROFILE("recompute territory texture");
 
-	std::vector<u8> bitmap;
-	bitmap.resize(m_MapSize * m_MapSize * 4);
-
 	CmpPtr<ICmpTerritoryManager> cmpTerritoryManager(m_Simulation, SYSTEM_ENTITY);
 	if (!cmpTerritoryManager)
 		return;
 
-	const Grid<u8> territories = cmpTerritoryManager->GetTerritoryGrid();
+	const Grid<u8>& territories = cmpTerritoryManager->GetTerritoryGrid();
 
-	GenerateBitmap(territories, &bitmap[0], m_MapSize, m_MapSize);
+	// (Always ask for the changes, so the next update knows what has changed since this one)
+	i32 i0 = 0, j0 = 0, i1 = m_MapSize-1, j1 = m_MapSize-1;
+	if (!cmpTerritoryManager->GetChangedTiles(&m_ChangedID, i0, j0, i1, j1) && !recreated)
+		return;
+
+	if (recreated)
+	{
+		i0 = j0 = 0;
+		i1 = j1 = m_MapSize-1;
+	}
+
+	// Texels up to one tile away from a change might have gained or lost a boundary,
+	// and the blur spreads that further. Those texels need to be uploaded, and
+	// computing them needs the neighbouring texels' unblurred boundaries too.
+	const ssize_t uploadBorder = 1 + BLUR_DISTANCE;
+	ssize_t ui0 = std::max((ssize_t)i0 - uploadBorder, (ssize_t)0);
+	ssize_t uj0 = std::max((ssize_t)j0 - uploadBorder, (ssize_t)0);
+	ssize_t ui1 = std::min((ssize_t)i1 + uploadBorder, m_MapSize-1);
+	ssize_t uj1 = std::min((ssize_t)j1 + uploadBorder, m_MapSize-1);
+	if (ui1 < ui0 || uj1 < uj0)
+		return;
+
+	ssize_t gi0 = std::max(ui0 - BLUR_DISTANCE, (ssize_t)0);
+	ssize_t gj0 = std::max(uj0 - BLUR_DISTANCE, (ssize_t)0);
+	ssize_t gi1 = std::min(ui1 + BLUR_DISTANCE, m_MapSize-1);
+	ssize_t gj1 = std::min(uj1 + BLUR_DISTANCE, m_MapSize-1);
+	ssize_t gw = gi1 - gi0 + 1;
+	ssize_t gh = gj1 - gj0 + 1;
+
+	std::vector<u8> bitmap;
+	bitmap.resize(gw * gh * 4);
+
+	GenerateBitmap(territories, &bitmap[0], gi0, gj0, gw, gh);
+
+	// Keep only the part to upload, with contiguous rows
+	ssize_t uw = ui1 - ui0 + 1;
+	ssize_t uh = uj1 - uj0 + 1;
+	for (ssize_t j = 0; j < uh; ++j)
+		memmove(&bitmap[j*uw*4], &bitmap[((uj0-gj0+j)*gw + (ui0-gi0))*4], uw*4);
 
 	g_Renderer.BindTexture(unit, m_Texture);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_MapSize, m_MapSize, GL_BGRA_EXT, GL_UNSIGNED_BYTE, &bitmap[0]);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, ui0, uj0, uw, uh, GL_BGRA_EXT, GL_UNSIGNED_BYTE, &bitmap[0]);
 }
 
-void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap, ssize_t w, ssize_t h)
+void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap, ssize_t i0, ssize_t j0, ssize_t w, ssize_t h)
 {
-	int alphaMax = 0xC0;
-	int alphaFalloff = 0x20;
-
 	CmpPtr<ICmpPlayerManager> cmpPlayerManager(m_Simulation, SYSTEM_ENTITY);
 
 	std::vector<CColor> colors;
@@ -187,10 +230,13 @@ void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap,
 		colors.push_back(color);
 	}
 
+	const ssize_t mapW = territories.m_W;
+	const ssize_t mapH = territories.m_H;
+
 	u8* p = bitmap;
-	for (ssize_t j = 0; j < h; ++j)
+	for (ssize_t j = j0; j < j0 + h; ++j)
 	{
-		for (ssize_t i = 0; i < w; ++i)
+		for (ssize_t i = i0; i < i0 + w; ++i)
 		{
 			u8 val = territories.get(i, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK;
 
@@ -206,9 +252,9 @@ void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap,
 			*p++ = (int)(color.r*255.f);
 
 			if ((i > 0 && (territories.get(i-1, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
-			 || (i < w-1 && (territories.get(i+1, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
+			 || (i < mapW-1 && (territories.get(i+1, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
 			 || (j > 0 && (territories.get(i, j-1) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
-			 || (j < h-1 && (territories.get(i, j+1) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
+			 || (j < mapH-1 && (territories.get(i, j+1) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
 			)
 			{
 				*p++ = alphaMax;
@@ -246,14 +292,14 @@ void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap,
 		int a;
 
 		a = 0;
-		for (ssize_t j = 0; j < w; ++j)
+		for (ssize_t j = 0; j < h; ++j)
 		{
 			a = std::max(a - alphaFalloff, (int)bitmap[(j*w+i)*4 + 3]);
 			bitmap[(j*w+i)*4 + 3] = a;
 		}
 
 		a = 0;
-		for (ssize_t j = w-1; j >= 0; --j)
+		for (ssize_t j = h-1; j >= 0; --j)
 		{
 			a = std::max(a - alphaFalloff, (int)bitmap[(j*w+i)*4 + 3]);
 			bitmap[(j*w+i)*4 + 3] = a;
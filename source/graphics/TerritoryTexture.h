@@ -73,11 +73,17 @@ private:
 	void ConstructTexture(int unit);
 	void RecomputeTexture(int unit);
 
-	void GenerateBitmap(const Grid<u8>& territories, u8* bitmap, ssize_t w, ssize_t h);
+	/**
+	 * Generates the w*h part of the bitmap starting at tile (i0, j0). The boundary
+	 * blur is only computed within that part, so texels within blurring distance
+	 * of its edges (other than the map's edges) are only approximate.
+	 */
+	void GenerateBitmap(const Grid<u8>& territories, u8* bitmap, ssize_t i0, ssize_t j0, ssize_t w, ssize_t h);
 
 	CSimulation2& m_Simulation;
 
 	size_t m_DirtyID;
+	size_t m_ChangedID; // for only updating the parts of the texture that changed
 
 	GLuint m_Texture;
 
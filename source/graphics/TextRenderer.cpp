@@ -19,9 +19,13 @@
 
 #include "TextRenderer.h"
 
+#include "lib/fnv_hash.h"
 #include "lib/ogl.h"
 #include "lib/res/graphics/unifont.h"
 #include "ps/Font.h"
+#include "ps/ThreadUtil.h"
+
+#include <boost/unordered_map.hpp>
 
 extern int g_xres, g_yres;
 
@@ -81,7 +85,7 @@ void CTextRenderer::Font(const CStrW& font)
 
 void CTextRenderer::PrintfAdvance(const wchar_t* fmt, ...)
 {
-	wchar_t buf[1024] = {0};
+	wchar_t buf[1024];
 
 	va_list args;
 	va_start(args, fmt);
@@ -89,7 +93,10 @@ void CTextRenderer::PrintfAdvance(const wchar_t* fmt, ...)
 	va_end(args);
 
 	if (ret < 0)
+	{
 		debug_printf(L"CTextRenderer::Printf vswprintf failed (buffer size exceeded?) - return value %d, errno %d\n", ret, errno);
+		buf[0] = 0;
+	}
 
 	PutAdvance(buf);
 }
@@ -97,7 +104,7 @@ void CTextRenderer::PrintfAdvance(const wchar_t* fmt, ...)
 
 void CTextRenderer::PrintfAt(float x, float y, const wchar_t* fmt, ...)
 {
-	wchar_t buf[1024] = {0};
+	wchar_t buf[1024];
 
 	va_list args;
 	va_start(args, fmt);
@@ -105,18 +112,210 @@ void CTextRenderer::PrintfAt(float x, float y, const wchar_t* fmt, ...)
 	va_end(args);
 
 	if (ret < 0)
+	{
 		debug_printf(L"CTextRenderer::PrintfAt vswprintf failed (buffer size exceeded?) - return value %d, errno %d\n", ret, errno);
+		buf[0] = 0;
+	}
 
 	Put(x, y, buf);
 }
 
+struct t2f_v2i
+{
+	t2f_v2i() : u(0), v(0), x(0), y(0) { }
+	float u, v;
+	i16 x, y;
+};
+
+struct t2f_v2f
+{
+	float u, v;
+	float x, y;
+};
+
+struct CTextRenderer::SGlyphRun
+{
+	std::vector<t2f_v2i> vertexes; // 4 per glyph
+	int width;
+};
+
+/**
+ * Cache of the glyph runs of all the recently printed strings, shared between
+ * every CTextRenderer so that text which doesn't change between frames (most
+ * GUI text, and the console and profiler lines) doesn't need laying out again.
+ *
+ * Runs are kept in two generations: when the current one gets full, the
+ * previous one is dropped, so strings that are no longer printed eventually
+ * get freed, and strings that still are get moved into the new generation.
+ */
+class CGlyphRunCache
+{
+public:
+	shared_ptr<CTextRenderer::SGlyphRun> Get(CFont& font, const wchar_t* text, size_t len);
+
+private:
+	// Runs are indexed by the glyphs of their font (rather than the font name,
+	// so that reloading a font doesn't reuse its old glyphs) and their text
+	typedef std::pair<const void*, std::wstring> Key;
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const
+		{
+			return (size_t)key.first ^ fnv_hash(key.second.c_str(), key.second.length()*sizeof(wchar_t));
+		}
+	};
+
+	// To avoid std::wstring memory allocations when looking up runs, we make
+	// use of boost::unordered_map's ability to do lookups with a functionally
+	// equivalent proxy object:
+
+	struct KeyProxy
+	{
+		const void* glyphs;
+		const wchar_t* text;
+		size_t len;
+	};
+
+	struct KeyProxyHash
+	{
+		size_t operator()(const KeyProxy& key) const
+		{
+			return (size_t)key.glyphs ^ fnv_hash(key.text, key.len*sizeof(wchar_t));
+		}
+	};
+
+	struct KeyProxyEq
+	{
+		bool operator()(const KeyProxy& proxy, const Key& key) const
+		{
+			return (proxy.glyphs == key.first && proxy.len == key.second.length() &&
+				memcmp(proxy.text, key.second.c_str(), proxy.len*sizeof(wchar_t)) == 0);
+		}
+	};
+
+	typedef boost::unordered_map<Key, shared_ptr<CTextRenderer::SGlyphRun>, KeyHash> Runs;
+
+	static Runs::iterator Find(Runs& runs, const KeyProxy& proxy)
+	{
+#if BOOST_VERSION >= 104200
+		return runs.find(proxy, KeyProxyHash(), KeyProxyEq());
+#else
+		// Boost <= 1.41 doesn't support the new find(), so do a slightly less efficient lookup
+		return runs.find(Key(proxy.glyphs, std::wstring(proxy.text, proxy.len)));
+#endif
+	}
+
+	static shared_ptr<CTextRenderer::SGlyphRun> LayOut(CFont& font, const wchar_t* text, size_t len);
+
+	// Number of runs in a generation (each is typically a few hundred bytes)
+	static const size_t MAX_RUNS = 4096;
+
+	Runs m_Current;
+	Runs m_Previous;
+};
+
+static CGlyphRunCache g_GlyphRunCache;
+
+shared_ptr<CTextRenderer::SGlyphRun> CGlyphRunCache::Get(CFont& font, const wchar_t* text, size_t len)
+{
+	// The cache is not thread-safe, but text is only rendered on the main thread
+	ENSURE(ThreadUtil::IsMainThread());
+
+	KeyProxy proxy = { &font.GetGlyphs(), text, len };
+
+	Runs::iterator it = Find(m_Current, proxy);
+	if (it != m_Current.end())
+		return it->second;
+
+	shared_ptr<CTextRenderer::SGlyphRun> run;
+	it = Find(m_Previous, proxy);
+	if (it != m_Previous.end())
+	{
+		run = it->second;
+		m_Previous.erase(it);
+	}
+	else
+	{
+		run = LayOut(font, text, len);
+	}
+
+	if (m_Current.size() >= MAX_RUNS)
+	{
+		m_Previous.swap(m_Current);
+		m_Current.clear();
+	}
+
+	m_Current.insert(std::make_pair(Key(proxy.glyphs, std::wstring(text, len)), run));
+	return run;
+}
+
+shared_ptr<CTextRenderer::SGlyphRun> CGlyphRunCache::LayOut(CFont& font, const wchar_t* text, size_t len)
+{
+	const std::map<u16, UnifontGlyphData>& glyphs = font.GetGlyphs();
+
+	shared_ptr<CTextRenderer::SGlyphRun> run(new CTextRenderer::SGlyphRun);
+	run->vertexes.reserve(len*4);
+	run->width = 0;
+
+	// Like unifont_stringsize, the width stops at the first unknown glyph
+	bool validWidth = true;
+
+	i16 x = 0;
+	for (size_t i = 0; i < len; ++i)
+	{
+		std::map<u16, UnifontGlyphData>::const_iterator it = glyphs.find(text[i]);
+
+		if (it == glyphs.end())
+			it = glyphs.find(0xFFFD); // Use the missing glyph symbol
+
+		if (it == glyphs.end()) // Missing the missing glyph symbol - give up
+		{
+			validWidth = false;
+			continue;
+		}
+
+		const UnifontGlyphData& g = it->second;
+
+		t2f_v2i vertexes[4];
+
+		vertexes[0].u = g.u1;
+		vertexes[0].v = g.v0;
+		vertexes[0].x = g.x1 + x;
+		vertexes[0].y = g.y0;
+
+		vertexes[1].u = g.u0;
+		vertexes[1].v = g.v0;
+		vertexes[1].x = g.x0 + x;
+		vertexes[1].y = g.y0;
+
+		vertexes[2].u = g.u0;
+		vertexes[2].v = g.v1;
+		vertexes[2].x = g.x0 + x;
+		vertexes[2].y = g.y1;
+
+		vertexes[3].u = g.u1;
+		vertexes[3].v = g.v1;
+		vertexes[3].x = g.x1 + x;
+		vertexes[3].y = g.y1;
+
+		run->vertexes.insert(run->vertexes.end(), vertexes, vertexes + 4);
+
+		x += g.xadvance;
+		if (validWidth)
+			run->width += g.xadvance;
+	}
+
+	return run;
+}
+
 void CTextRenderer::PutAdvance(const wchar_t* buf)
 {
-	Put(0.0f, 0.0f, buf);
+	shared_ptr<SGlyphRun> run = g_GlyphRunCache.Get(*m_Font, buf, wcslen(buf));
 
-	int w, h;
-	m_Font->CalculateStringSize(buf, w, h);
-	Translate((float)w, 0.0f, 0.0f);
+	PutRun(0.0f, 0.0f, run);
+
+	Translate((float)run->width, 0.0f, 0.0f);
 }
 
 void CTextRenderer::Put(float x, float y, const wchar_t* buf)
@@ -124,6 +323,14 @@ void CTextRenderer::Put(float x, float y, const wchar_t* buf)
 	if (buf[0] == 0)
 		return; // empty string; don't bother storing
 
+	PutRun(x, y, g_GlyphRunCache.Get(*m_Font, buf, wcslen(buf)));
+}
+
+void CTextRenderer::PutRun(float x, float y, const shared_ptr<SGlyphRun>& run)
+{
+	if (run->vertexes.empty())
+		return; // nothing to draw; don't bother storing
+
 	CMatrix3D translate;
 	translate.SetTranslation(x, y, 0.0f);
 
@@ -131,97 +338,114 @@ void CTextRenderer::Put(float x, float y, const wchar_t* buf)
 	batch.transform = m_Transform * translate;
 	batch.color = m_Color;
 	batch.font = m_Font;
-	batch.text = buf;
+	batch.run = run;
 	m_Batches.push_back(batch);
 }
 
-struct t2f_v2i
+/**
+ * If transform only differs from the first one by a translation in the text's
+ * plane, i.e. it is first * translate(offset.X, offset.Y, 0), computes the offset
+ * (using firstInverse, the inverse of first) and returns true.
+ */
+static bool GetTextOffset(const CMatrix3D& first, const CMatrix3D& firstInverse, const CMatrix3D& transform, float& offsetX, float& offsetY)
 {
-	t2f_v2i() : u(0), v(0), x(0), y(0) { }
-	float u, v;
-	i16 x, y;
-};
+	if (transform._11 != first._11 || transform._12 != first._12 || transform._13 != first._13 ||
+		transform._21 != first._21 || transform._22 != first._22 || transform._23 != first._23 ||
+		transform._31 != first._31 || transform._32 != first._32 || transform._33 != first._33 ||
+		transform._41 != first._41 || transform._42 != first._42 || transform._43 != first._43 ||
+		transform._44 != first._44)
+		return false;
+
+	float dx = transform._14 - first._14;
+	float dy = transform._24 - first._24;
+	float dz = transform._34 - first._34;
+
+	float offsetZ = firstInverse._31*dx + firstInverse._32*dy + firstInverse._33*dz;
+	float offsetW = firstInverse._41*dx + firstInverse._42*dy + firstInverse._43*dz;
+	if (fabsf(offsetZ) > 0.001f || fabsf(offsetW) > 0.001f)
+		return false;
+
+	offsetX = firstInverse._11*dx + firstInverse._12*dy + firstInverse._13*dz;
+	offsetY = firstInverse._21*dx + firstInverse._22*dy + firstInverse._23*dz;
+	return true;
+}
+
+// Scratch buffers for the merged batches, reused between frames
+static std::vector<t2f_v2f> g_TextVertexes;
+static std::vector<u16> g_TextIndexes;
 
 void CTextRenderer::Render()
 {
-	std::vector<u16> indexes;
-	std::vector<t2f_v2i> vertexes;
+	std::vector<t2f_v2f>& vertexes = g_TextVertexes;
+	std::vector<u16>& indexes = g_TextIndexes;
 
-	for (size_t i = 0; i < m_Batches.size(); ++i)
+	size_t i = 0;
+	while (i < m_Batches.size())
 	{
-		SBatch& batch = m_Batches[i];
+		// Merge the following batches which can be drawn with the same
+		// texture and uniforms, up to the limit of 16-bit indexes
+		const SBatch& first = m_Batches[i];
+		CMatrix3D firstInverse = first.transform.GetInverse();
 
-		if (batch.text.empty()) // avoid zero-length arrays
-			continue;
+		vertexes.clear();
+		for (; i < m_Batches.size(); ++i)
+		{
+			const SBatch& batch = m_Batches[i];
+
+			float offsetX = 0.0f;
+			float offsetY = 0.0f;
+			if (&batch != &first)
+			{
+				if (batch.font != first.font || batch.color != first.color)
+					break;
+				if (vertexes.size() + batch.run->vertexes.size() > 65536)
+					break;
+				if (!GetTextOffset(first.transform, firstInverse, batch.transform, offsetX, offsetY))
+					break;
+			}
+
+			const std::vector<t2f_v2i>& runVertexes = batch.run->vertexes;
+			size_t start = vertexes.size();
+			vertexes.resize(start + runVertexes.size());
+			for (size_t v = 0; v < runVertexes.size(); ++v)
+			{
+				vertexes[start+v].u = runVertexes[v].u;
+				vertexes[start+v].v = runVertexes[v].v;
+				vertexes[start+v].x = runVertexes[v].x + offsetX;
+				vertexes[start+v].y = runVertexes[v].y + offsetY;
+			}
+		}
 
-		const std::map<u16, UnifontGlyphData>& glyphs = batch.font->GetGlyphs();
+		// Every glyph is a quad, so the indexes never change and only need
+		// extending when drawing more glyphs than ever before
+		size_t numQuads = vertexes.size() / 4;
+		for (size_t q = indexes.size() / 6; q < numQuads; ++q)
+		{
+			indexes.push_back(q*4+0);
+			indexes.push_back(q*4+1);
+			indexes.push_back(q*4+2);
+			indexes.push_back(q*4+2);
+			indexes.push_back(q*4+3);
+			indexes.push_back(q*4+0);
+		}
 
-		m_Shader->BindTexture("tex", batch.font->GetTexture());
+		m_Shader->BindTexture("tex", first.font->GetTexture());
 
-		m_Shader->Uniform("transform", batch.transform);
+		m_Shader->Uniform("transform", first.transform);
 
 		// ALPHA-only textures will have .rgb sampled as 0, so we need to
 		// replace it with white (but not affect RGBA textures)
-		if (batch.font->HasRGB())
+		if (first.font->HasRGB())
 			m_Shader->Uniform("colorAdd", CColor(0.0f, 0.0f, 0.0f, 0.0f));
 		else
 			m_Shader->Uniform("colorAdd", CColor(1.0f, 1.0f, 1.0f, 0.0f));
 
-		m_Shader->Uniform("colorMul", batch.color);
-
-		vertexes.clear();
-		vertexes.resize(batch.text.size()*4);
-
-		indexes.clear();
-		indexes.resize(batch.text.size()*6);
-
-		i16 x = 0;
-		for (size_t i = 0; i < batch.text.size(); ++i)
-		{
-			std::map<u16, UnifontGlyphData>::const_iterator it = glyphs.find(batch.text[i]);
-
-			if (it == glyphs.end())
-				it = glyphs.find(0xFFFD); // Use the missing glyph symbol
-
-			if (it == glyphs.end()) // Missing the missing glyph symbol - give up
-				continue;
-
-			const UnifontGlyphData& g = it->second;
-
-			vertexes[i*4].u = g.u1;
-			vertexes[i*4].v = g.v0;
-			vertexes[i*4].x = g.x1 + x;
-			vertexes[i*4].y = g.y0;
-
-			vertexes[i*4+1].u = g.u0;
-			vertexes[i*4+1].v = g.v0;
-			vertexes[i*4+1].x = g.x0 + x;
-			vertexes[i*4+1].y = g.y0;
-
-			vertexes[i*4+2].u = g.u0;
-			vertexes[i*4+2].v = g.v1;
-			vertexes[i*4+2].x = g.x0 + x;
-			vertexes[i*4+2].y = g.y1;
-
-			vertexes[i*4+3].u = g.u1;
-			vertexes[i*4+3].v = g.v1;
-			vertexes[i*4+3].x = g.x1 + x;
-			vertexes[i*4+3].y = g.y1;
-
-			indexes[i*6+0] = i*4+0;
-			indexes[i*6+1] = i*4+1;
-			indexes[i*6+2] = i*4+2;
-			indexes[i*6+3] = i*4+2;
-			indexes[i*6+4] = i*4+3;
-			indexes[i*6+5] = i*4+0;
-
-			x += g.xadvance;
-		}
+		m_Shader->Uniform("colorMul", first.color);
 
-		m_Shader->VertexPointer(2, GL_SHORT, sizeof(t2f_v2i), &vertexes[0].x);
-		m_Shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, sizeof(t2f_v2i), &vertexes[0].u);
+		m_Shader->VertexPointer(2, GL_FLOAT, sizeof(t2f_v2f), &vertexes[0].x);
+		m_Shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, sizeof(t2f_v2f), &vertexes[0].u);
 
-		glDrawElements(GL_TRIANGLES, indexes.size(), GL_UNSIGNED_SHORT, &indexes[0]);
+		glDrawElements(GL_TRIANGLES, numQuads*6, GL_UNSIGNED_SHORT, &indexes[0]);
 	}
 
 	m_Batches.clear();
@@ -24,6 +24,7 @@
 #include "ps/Overlay.h"
 
 class CFont;
+class CGlyphRunCache;
 
 class CTextRenderer
 {
@@ -82,18 +83,29 @@ public:
 
 	/**
 	 * Render all of the previously printed text calls.
+	 * Consecutive calls with the same font and color, whose transforms only
+	 * differ by a translation, are drawn together.
 	 */
 	void Render();
 
 private:
+	friend class CGlyphRunCache;
+
+	/**
+	 * Vertex data of a string laid out in a font, cached between frames.
+	 */
+	struct SGlyphRun;
+
 	struct SBatch
 	{
 		CMatrix3D transform;
 		CColor color;
 		shared_ptr<CFont> font;
-		std::wstring text;
+		shared_ptr<SGlyphRun> run;
 	};
 
+	void PutRun(float x, float y, const shared_ptr<SGlyphRun>& run);
+
 	CShaderProgramPtr m_Shader;
 
 	CMatrix3D m_Transform;
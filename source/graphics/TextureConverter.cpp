@@ -23,6 +23,8 @@
 #include "lib/timer.h"
 #include "lib/allocators/shared_ptr.h"
 #include "lib/tex/tex.h"
+#include "lib/sysdep/os_cpu.h"
+#include "maths/MathUtil.h"
 #include "maths/MD5.h"
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
@@ -59,12 +61,13 @@ struct BufferOutputHandler : public nvtt::OutputHandler
  */
 struct CTextureConverter::ConversionRequest
 {
+	VfsPath src;
 	VfsPath dest;
 	CTexturePtr texture;
-	nvtt::InputOptions inputOptions;
-	nvtt::CompressionOptions compressionOptions;
-	nvtt::OutputOptions outputOptions;
-	bool isDXT1a; // see comment in RunThread
+	shared_ptr<u8> file;
+	size_t fileSize;
+	Settings settings;
+	bool highPriority;
 };
 
 /**
@@ -80,6 +83,10 @@ struct CTextureConverter::ConversionResult
 
 #endif // CONFIG2_NVTT
 
+// Upper limit on the number of converter threads, since each of them needs
+// memory for a whole uncompressed texture and its output
+static const size_t MAX_WORKER_THREADS = 8;
+
 void CTextureConverter::Settings::Hash(MD5& hash)
 {
 	hash.Update((const u8*)&format, sizeof(format));
@@ -281,7 +288,7 @@ CTextureConverter::CTextureConverter(PIVFS vfs, bool highQuality) :
 	ENSURE(nvtt::version() >= NVTT_VERSION);
 #endif
 
-	// Set up the worker thread:
+	// Set up the worker threads:
 
 	int ret;
 
@@ -292,43 +299,185 @@ CTextureConverter::CTextureConverter(PIVFS vfs, bool highQuality) :
 	ret = pthread_mutex_init(&m_WorkerMutex, NULL);
 	ENSURE(ret == 0);
 
-	ret = pthread_create(&m_WorkerThread, NULL, &RunThread, this);
-	ENSURE(ret == 0);
-
-	// Maybe we should share some centralised pool of worker threads?
-	// For now we'll just stick with a single thread for this specific use.
+	// Conversions are independent and CPU-bound, so use one thread per core
+	// (leaving one for the main thread)
+	size_t numThreads = clamp(os_cpu_NumProcessors(), (size_t)2, MAX_WORKER_THREADS + 1) - 1;
+	m_WorkerThreads.resize(numThreads);
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		ret = pthread_create(&m_WorkerThreads[i], NULL, &RunThread, this);
+		ENSURE(ret == 0);
+	}
 }
 
 CTextureConverter::~CTextureConverter()
 {
-	// Tell the thread to shut down
+	// Tell the threads to shut down
 	pthread_mutex_lock(&m_WorkerMutex);
 	m_Shutdown = true;
 	pthread_mutex_unlock(&m_WorkerMutex);
 
-	// Wake it up so it sees the notification
-	SDL_SemPost(m_WorkerSem);
+	// Wake them all up so they see the notification
+	for (size_t i = 0; i < m_WorkerThreads.size(); ++i)
+		SDL_SemPost(m_WorkerSem);
 
-	// Wait for it to shut down cleanly
-	pthread_join(m_WorkerThread, NULL);
+	// Wait for them to shut down cleanly
+	for (size_t i = 0; i < m_WorkerThreads.size(); ++i)
+		pthread_join(m_WorkerThreads[i], NULL);
 
 	// Clean up resources
 	SDL_DestroySemaphore(m_WorkerSem);
 	pthread_mutex_destroy(&m_WorkerMutex);
 }
 
-bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings)
+bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings, bool highPriority)
 {
-	shared_ptr<u8> file;
-	size_t fileSize;
-	if (m_VFS->LoadFile(src, file, fileSize) < 0)
+#if CONFIG2_NVTT
+
+	// Only load the file here, since the VFS is not thread-safe; decoding
+	// is done by the worker threads too
+	shared_ptr<ConversionRequest> request(new ConversionRequest);
+	if (m_VFS->LoadFile(src, request->file, request->fileSize) < 0)
 	{
 		LOGERROR(L"Failed to load texture \"%ls\"", src.string().c_str());
 		return false;
 	}
 
+	request->src = src;
+	request->dest = dest;
+	request->texture = texture;
+	request->settings = settings;
+	request->highPriority = highPriority;
+
+	pthread_mutex_lock(&m_WorkerMutex);
+	if (highPriority)
+	{
+		// Queue it after the other high-priority requests, but before all the others
+		std::deque<shared_ptr<ConversionRequest> >::iterator it = m_RequestQueue.begin();
+		while (it != m_RequestQueue.end() && (*it)->highPriority)
+			++it;
+		m_RequestQueue.insert(it, request);
+	}
+	else
+	{
+		m_RequestQueue.push_back(request);
+	}
+	pthread_mutex_unlock(&m_WorkerMutex);
+
+	// Wake up a worker thread
+	SDL_SemPost(m_WorkerSem);
+
+	return true;
+
+#else
+	UNUSED2(texture);
+	UNUSED2(dest);
+	UNUSED2(settings);
+	UNUSED2(highPriority);
+	LOGERROR(L"Failed to convert texture \"%ls\" (NVTT not available)", src.string().c_str());
+	return false;
+#endif
+}
+
+void CTextureConverter::Prioritize(const CTexturePtr& texture)
+{
+#if CONFIG2_NVTT
+	pthread_mutex_lock(&m_WorkerMutex);
+	std::deque<shared_ptr<ConversionRequest> >::iterator it = m_RequestQueue.begin();
+	while (it != m_RequestQueue.end() && (*it)->highPriority)
+		++it;
+	std::deque<shared_ptr<ConversionRequest> >::iterator firstLow = it;
+	for (; it != m_RequestQueue.end(); ++it)
+	{
+		if ((*it)->texture == texture)
+		{
+			shared_ptr<ConversionRequest> request = *it;
+			request->highPriority = true;
+			m_RequestQueue.erase(it);
+			m_RequestQueue.insert(firstLow, request);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m_WorkerMutex);
+#else
+	UNUSED2(texture);
+#endif
+}
+
+bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
+{
+#if CONFIG2_NVTT
+	shared_ptr<ConversionResult> result;
+
+	// Grab the first result (if any)
+	pthread_mutex_lock(&m_WorkerMutex);
+	if (!m_ResultQueue.empty())
+	{
+		result = m_ResultQueue.front();
+		m_ResultQueue.pop_front();
+	}
+	pthread_mutex_unlock(&m_WorkerMutex);
+
+	if (!result)
+	{
+		// no work to do
+		return false;
+	}
+
+	texture = result->texture;
+
+	if (!result->ret)
+	{
+		// conversion had failed
+		ok = false;
+		return true;
+	}
+
+	// Move output into a correctly-aligned buffer
+	size_t size = result->output.buffer.size();
+	shared_ptr<u8> file;
+	AllocateAligned(file, size, maxSectorSize);
+	memcpy(file.get(), &result->output.buffer[0], size);
+	if (m_VFS->CreateFile(result->dest, file, size) < 0)
+	{
+		// error writing file
+		ok = false;
+		return true;
+	}
+
+	// Succeeded in converting texture
+	dest = result->dest;
+	ok = true;
+	return true;
+
+#else // #if CONFIG2_NVTT
+	UNUSED2(texture);
+	UNUSED2(dest);
+	UNUSED2(ok);
+	return false;
+#endif
+}
+
+bool CTextureConverter::IsBusy()
+{
+	// Keep one request queued per thread, so the threads never wait for the
+	// main thread to send more work
+	pthread_mutex_lock(&m_WorkerMutex);
+	bool busy = m_RequestQueue.size() >= m_WorkerThreads.size();
+	pthread_mutex_unlock(&m_WorkerMutex);
+
+	return busy;
+}
+
+#if CONFIG2_NVTT
+
+bool CTextureConverter::Convert(const ConversionRequest& request, BufferOutputHandler& output, bool highQuality)
+{
+	const VfsPath& src = request.src;
+	const Settings& settings = request.settings;
+
 	Tex tex;
-	if (tex_decode(file, fileSize, &tex) < 0)
+	if (tex_decode(request.file, request.fileSize, &tex) < 0)
 	{
 		LOGERROR(L"Failed to decode texture \"%ls\"", src.string().c_str());
 		return false;
@@ -342,6 +491,7 @@ bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath
 	if (tex.flags & TEX_GREY)
 	{
 		LOGERROR(L"Failed to convert grayscale texture \"%ls\" - only RGB textures are currently supported", src.string().c_str());
+		tex_free(&tex);
 		return false;
 	}
 
@@ -369,146 +519,97 @@ bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath
 		}
 	}
 
-#if CONFIG2_NVTT
-
-	shared_ptr<ConversionRequest> request(new ConversionRequest);
-	request->dest = dest;
-	request->texture = texture;
+	nvtt::InputOptions inputOptions;
+	nvtt::CompressionOptions compressionOptions;
+	nvtt::OutputOptions outputOptions;
 
 	// Apply the chosen settings:
 
-	request->inputOptions.setMipmapGeneration(settings.mipmap == MIP_TRUE);
+	inputOptions.setMipmapGeneration(settings.mipmap == MIP_TRUE);
 
 	if (settings.alpha == ALPHA_TRANSPARENCY)
-		request->inputOptions.setAlphaMode(nvtt::AlphaMode_Transparency);
+		inputOptions.setAlphaMode(nvtt::AlphaMode_Transparency);
 	else
-		request->inputOptions.setAlphaMode(nvtt::AlphaMode_None);
+		inputOptions.setAlphaMode(nvtt::AlphaMode_None);
 
-	request->isDXT1a = false;
+	bool isDXT1a = false;
 
 	if (settings.format == FMT_RGBA)
 	{
-		request->compressionOptions.setFormat(nvtt::Format_RGBA);
+		compressionOptions.setFormat(nvtt::Format_RGBA);
 		// Change the default component order (see tex_dds.cpp decode_pf)
-		request->compressionOptions.setPixelFormat(32, 0xFF, 0xFF00, 0xFF0000, 0xFF000000u);
+		compressionOptions.setPixelFormat(32, 0xFF, 0xFF00, 0xFF0000, 0xFF000000u);
 	}
 	else if (!hasAlpha)
 	{
 		// if no alpha channel then there's no point using DXT3 or DXT5
-		request->compressionOptions.setFormat(nvtt::Format_DXT1);
+		compressionOptions.setFormat(nvtt::Format_DXT1);
 	}
 	else if (settings.format == FMT_DXT1)
 	{
-		request->compressionOptions.setFormat(nvtt::Format_DXT1a);
-		request->isDXT1a = true;
+		compressionOptions.setFormat(nvtt::Format_DXT1a);
+		isDXT1a = true;
 	}
 	else if (settings.format == FMT_DXT3)
 	{
-		request->compressionOptions.setFormat(nvtt::Format_DXT3);
+		compressionOptions.setFormat(nvtt::Format_DXT3);
 	}
 	else if (settings.format == FMT_DXT5)
 	{
-		request->compressionOptions.setFormat(nvtt::Format_DXT5);
+		compressionOptions.setFormat(nvtt::Format_DXT5);
 	}
 
 	if (settings.filter == FILTER_BOX)
-		request->inputOptions.setMipmapFilter(nvtt::MipmapFilter_Box);
+		inputOptions.setMipmapFilter(nvtt::MipmapFilter_Box);
 	else if (settings.filter == FILTER_TRIANGLE)
-		request->inputOptions.setMipmapFilter(nvtt::MipmapFilter_Triangle);
+		inputOptions.setMipmapFilter(nvtt::MipmapFilter_Triangle);
 	else if (settings.filter == FILTER_KAISER)
-		request->inputOptions.setMipmapFilter(nvtt::MipmapFilter_Kaiser);
+		inputOptions.setMipmapFilter(nvtt::MipmapFilter_Kaiser);
 
 	if (settings.normal == NORMAL_TRUE)
-		request->inputOptions.setNormalMap(true);
+		inputOptions.setNormalMap(true);
 
-	request->inputOptions.setKaiserParameters(settings.kaiserWidth, settings.kaiserAlpha, settings.kaiserStretch);
+	inputOptions.setKaiserParameters(settings.kaiserWidth, settings.kaiserAlpha, settings.kaiserStretch);
 
-	request->inputOptions.setWrapMode(nvtt::WrapMode_Mirror); // TODO: should this be configurable?
+	inputOptions.setWrapMode(nvtt::WrapMode_Mirror); // TODO: should this be configurable?
 
-	request->compressionOptions.setQuality(m_HighQuality ? nvtt::Quality_Production : nvtt::Quality_Fastest);
+	compressionOptions.setQuality(highQuality ? nvtt::Quality_Production : nvtt::Quality_Fastest);
 
 	// TODO: normal maps, gamma, etc
 
 	// Load the texture data
-	request->inputOptions.setTextureLayout(nvtt::TextureType_2D, tex.w, tex.h);
-	request->inputOptions.setMipmapData(tex_get_data(&tex), tex.w, tex.h);
+	inputOptions.setTextureLayout(nvtt::TextureType_2D, tex.w, tex.h);
+	inputOptions.setMipmapData(tex_get_data(&tex), tex.w, tex.h);
 
 	// NVTT copies the texture data so we can free it now
 	tex_free(&tex);
 
-	pthread_mutex_lock(&m_WorkerMutex);
-	m_RequestQueue.push_back(request);
-	pthread_mutex_unlock(&m_WorkerMutex);
-
-	// Wake up the worker thread
-	SDL_SemPost(m_WorkerSem);
-
-	return true;
-
-#else
-	LOGERROR(L"Failed to convert texture \"%ls\" (NVTT not available)", src.string().c_str());
-	return false;
-#endif
-}
-
-bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
-{
-#if CONFIG2_NVTT
-	shared_ptr<ConversionResult> result;
-
-	// Grab the first result (if any)
-	pthread_mutex_lock(&m_WorkerMutex);
-	if (!m_ResultQueue.empty())
-	{
-		result = m_ResultQueue.front();
-		m_ResultQueue.pop_front();
-	}
-	pthread_mutex_unlock(&m_WorkerMutex);
+	outputOptions.setOutputHandler(&output);
 
-	if (!result)
-	{
-		// no work to do
-		return false;
-	}
+//	TIMER(L"TextureConverter compress");
 
-	if (!result->ret)
+	bool ret;
 	{
-		// conversion had failed
-		ok = false;
-		return true;
-	}
+		PROFILE2("compress");
 
-	// Move output into a correctly-aligned buffer
-	size_t size = result->output.buffer.size();
-	shared_ptr<u8> file;
-	AllocateAligned(file, size, maxSectorSize);
-	memcpy(file.get(), &result->output.buffer[0], size);
-	if (m_VFS->CreateFile(result->dest, file, size) < 0)
-	{
-		// error writing file
-		ok = false;
-		return true;
+		// Perform the compression
+		nvtt::Compressor compressor;
+		ret = compressor.process(inputOptions, compressionOptions, outputOptions);
 	}
 
-	// Succeeded in converting texture
-	texture = result->texture;
-	dest = result->dest;
-	ok = true;
-	return true;
+	// Ugly hack: NVTT 2.0 doesn't set DDPF_ALPHAPIXELS for DXT1a, so we can't
+	// distinguish it from DXT1. (It's fixed in trunk by
+	// http://code.google.com/p/nvidia-texture-tools/source/detail?r=924&path=/trunk).
+	// Rather than using a trunk NVTT (unstable, makes packaging harder)
+	// or patching our copy (makes packaging harder), we'll just manually
+	// set the flag here.
+	if (isDXT1a && ret && output.buffer.size() > 80)
+		output.buffer[80] |= 1; // DDPF_ALPHAPIXELS in DDS_PIXELFORMAT.dwFlags
 
-#else // #if CONFIG2_NVTT
-	return false;
-#endif
+	return ret;
 }
 
-bool CTextureConverter::IsBusy()
-{
-	pthread_mutex_lock(&m_WorkerMutex);
-	bool busy = !m_RequestQueue.empty();
-	pthread_mutex_unlock(&m_WorkerMutex);
-
-	return busy;
-}
+#endif // CONFIG2_NVTT
 
 void* CTextureConverter::RunThread(void* data)
 {
@@ -532,7 +633,7 @@ void* CTextureConverter::RunThread(void* data)
 			break;
 		}
 		// If we weren't woken up for shutdown, we must have been woken up for
-		// a new request, so grab it from the queue
+		// a new request, so grab the most important one from the queue
 		shared_ptr<ConversionRequest> request = textureConverter->m_RequestQueue.front();
 		textureConverter->m_RequestQueue.pop_front();
 		pthread_mutex_unlock(&textureConverter->m_WorkerMutex);
@@ -541,27 +642,7 @@ void* CTextureConverter::RunThread(void* data)
 		shared_ptr<ConversionResult> result(new ConversionResult());
 		result->dest = request->dest;
 		result->texture = request->texture;
-
-		request->outputOptions.setOutputHandler(&result->output);
-
-//		TIMER(L"TextureConverter compress");
-
-		{
-			PROFILE2("compress");
-
-			// Perform the compression
-			nvtt::Compressor compressor;
-			result->ret = compressor.process(request->inputOptions, request->compressionOptions, request->outputOptions);
-		}
-
-		// Ugly hack: NVTT 2.0 doesn't set DDPF_ALPHAPIXELS for DXT1a, so we can't
-		// distinguish it from DXT1. (It's fixed in trunk by
-		// http://code.google.com/p/nvidia-texture-tools/source/detail?r=924&path=/trunk).
-		// Rather than using a trunk NVTT (unstable, makes packaging harder)
-		// or patching our copy (makes packaging harder), we'll just manually
-		// set the flag here.
-		if (request->isDXT1a && result->ret && result->output.buffer.size() > 80)
-			result->output.buffer[80] |= 1; // DDPF_ALPHAPIXELS in DDS_PIXELFORMAT.dwFlags
+		result->ret = Convert(*request, result->output, textureConverter->m_HighQuality);
 
 		// Push the result onto the queue
 		pthread_mutex_lock(&textureConverter->m_WorkerMutex);
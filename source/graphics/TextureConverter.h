@@ -25,6 +25,7 @@
 #include "TextureManager.h"
 
 class MD5;
+struct BufferOutputHandler;
 
 /**
  * Texture conversion helper class.
@@ -152,9 +153,9 @@ public:
 	CTextureConverter(PIVFS vfs, bool highQuality);
 
 	/**
-	 * Destroy texture converter and wait to shut down worker thread.
-	 * This might take a long time (maybe seconds) if the worker is busy
-	 * processing a texture.
+	 * Destroy texture converter and wait to shut down worker threads.
+	 * This might take a long time (maybe seconds) if the workers are busy
+	 * processing textures.
 	 */
 	~CTextureConverter();
 
@@ -177,8 +178,14 @@ public:
 	 * Otherwise it will return true and start an asynchronous conversion request,
 	 * whose result will be returned from Poll() (with the texture and dest passed
 	 * into this function).
+	 * High-priority requests are converted before all the other queued requests.
 	 */
-	bool ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings);
+	bool ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings, bool highPriority = false);
+
+	/**
+	 * Moves the queued request for the given texture (if any) to high priority.
+	 */
+	void Prioritize(const CTexturePtr& texture);
 
 	/**
 	 * Returns the result of a successful ConvertTexture call.
@@ -186,30 +193,36 @@ public:
 	 * Otherwise, if the conversion succeeded, it sets ok to true and sets
 	 * texture and dest to the corresponding values passed into ConvertTexture(),
 	 * then returns true.
-	 * If the conversion failed, it sets ok to false and doesn't touch the other arguments,
-	 * then returns true.
+	 * If the conversion failed, it sets ok to false and sets texture to the one
+	 * passed into ConvertTexture(), then returns true.
 	 */
 	bool Poll(CTexturePtr& texture, VfsPath& dest, bool& ok);
 
 	/**
-	 * Returns whether there is currently a queued request from ConvertTexture().
-	 * (Note this may return false while the worker thread is still converting the last texture.)
+	 * Returns whether there are already enough queued requests from ConvertTexture()
+	 * to keep all the worker threads busy.
+	 * (Note this may return false while the worker threads are still converting textures.)
 	 */
 	bool IsBusy();
 
 private:
+	struct ConversionRequest;
+	struct ConversionResult;
+
 	static void* RunThread(void* data);
 
+	/**
+	 * Decodes and compresses the texture of a request. Called on the worker threads.
+	 */
+	static bool Convert(const ConversionRequest& request, BufferOutputHandler& output, bool highQuality);
+
 	PIVFS m_VFS;
 	bool m_HighQuality;
 
-	pthread_t m_WorkerThread;
+	std::vector<pthread_t> m_WorkerThreads;
 	pthread_mutex_t m_WorkerMutex;
 	SDL_sem* m_WorkerSem;
 
-	struct ConversionRequest;
-	struct ConversionResult;
-
 	std::deque<shared_ptr<ConversionRequest> > m_RequestQueue; // protected by m_WorkerMutex
 	std::deque<shared_ptr<ConversionResult> > m_ResultQueue; // protected by m_WorkerMutex
 	bool m_Shutdown; // protected by m_WorkerMutex
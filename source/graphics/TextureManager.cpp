@@ -23,7 +23,9 @@
 #include "lib/allocators/shared_ptr.h"
 #include "lib/res/h_mgr.h"
 #include "lib/file/vfs/vfs_tree.h"
+#include "lib/file/vfs/vfs_util.h"
 #include "lib/res/graphics/ogl_tex.h"
+#include "lib/tex/tex.h"
 #include "lib/timer.h"
 #include "maths/MD5.h"
 #include "ps/CacheLoader.h"
@@ -79,7 +81,8 @@ class CTextureManagerImpl
 public:
 	CTextureManagerImpl(PIVFS vfs, bool highQuality, bool disableGL) :
 		m_VFS(vfs), m_CacheLoader(vfs, L".dds"), m_DisableGL(disableGL), m_TextureConverter(vfs, highQuality),
-		m_DefaultHandle(0), m_ErrorHandle(0)
+		m_DefaultHandle(0), m_ErrorHandle(0),
+		m_Streaming(false), m_MemoryBudget(0), m_TextureMemory(0), m_Frame(0)
 	{
 		// Initialise some textures that will always be available,
 		// without needing to load any files
@@ -162,11 +165,40 @@ public:
 		return texture;
 	}
 
+	/**
+	 * Returns the approximate GL memory used by a texture of the given
+	 * size, with its top skippedLevels mip levels not uploaded.
+	 */
+	static size_t EstimateTextureMemory(size_t w, size_t h, size_t bpp, size_t skippedLevels, bool mipmaps)
+	{
+		w = std::max(w >> skippedLevels, (size_t)1);
+		h = std::max(h >> skippedLevels, (size_t)1);
+		size_t size = w * h * bpp / 8;
+		// A full mipmap chain adds about a third
+		if (mipmaps)
+			size += size / 3;
+		return size;
+	}
+
+	/**
+	 * Updates the texture's memory usage and the total memory usage.
+	 */
+	void SetMemoryUsage(const CTexturePtr& texture, size_t skippedLevels, size_t memoryUsage, size_t fullMemoryUsage)
+	{
+		m_TextureMemory -= texture->m_MemoryUsage;
+		m_TextureMemory += memoryUsage;
+		texture->m_SkippedLevels = skippedLevels;
+		texture->m_MemoryUsage = memoryUsage;
+		texture->m_FullMemoryUsage = fullMemoryUsage;
+	}
+
 	/**
 	 * Load the given file into the texture object and upload it to OpenGL.
 	 * Assumes the file already exists.
+	 * If maxSize is non-zero and the file contains mipmaps, the top levels
+	 * that are larger than maxSize are not uploaded.
 	 */
-	void LoadTexture(const CTexturePtr& texture, const VfsPath& path)
+	void LoadTexture(const CTexturePtr& texture, const VfsPath& path, size_t maxSize = 0)
 	{
 		if (m_DisableGL)
 			return;
@@ -181,6 +213,7 @@ public:
 
 			// Replace with error texture to make it obvious
 			texture->SetHandle(m_ErrorHandle);
+			SetMemoryUsage(texture, 0, 0, 0);
 			return;
 		}
 
@@ -188,6 +221,19 @@ public:
 		size_t flags = 0;
 		(void)ogl_tex_get_format(h, &flags, NULL);
 
+		size_t width = 0, height = 0, bpp = 0;
+		(void)ogl_tex_get_size(h, &width, &height, &bpp);
+		const bool mipmaps = (flags & TEX_MIPMAPS) != 0;
+
+		// Skip the top mip levels that are larger than maxSize
+		size_t skippedLevels = 0;
+		if (maxSize && mipmaps)
+		{
+			while (skippedLevels < OGL_TEX_REDUCE_RES_MASK && std::max(width, height) >> skippedLevels > maxSize)
+				++skippedLevels;
+			(void)ogl_tex_reduce_res(h, skippedLevels);
+		}
+
 		// Initialise base colour from the texture
 		(void)ogl_tex_get_average_colour(h, &texture->m_BaseColour);
 
@@ -223,11 +269,17 @@ public:
 
 			// Replace with error texture to make it obvious
 			texture->SetHandle(m_ErrorHandle);
+			SetMemoryUsage(texture, 0, 0, 0);
 			return;
 		}
 
 		// Let the texture object take ownership of this handle
 		texture->SetHandle(h, true);
+
+		texture->m_LoadPath = path;
+		SetMemoryUsage(texture, skippedLevels,
+			EstimateTextureMemory(width, height, bpp, skippedLevels, mipmaps),
+			EstimateTextureMemory(width, height, bpp, 0, mipmaps));
 	}
 
 	/**
@@ -261,8 +313,8 @@ public:
 
 		if (ret == INFO::OK)
 		{
-			// Found a cached texture - load it
-			LoadTexture(texture, loadPath);
+			// Found a cached texture - load it (only the low mip levels, if streaming)
+			LoadTexture(texture, loadPath, m_Streaming ? STREAMING_MIN_SIZE : 0);
 			return true;
 		}
 		else if (ret == INFO::SKIPPED)
@@ -286,7 +338,7 @@ public:
 	 * Initiates an asynchronous conversion process, from the texture's
 	 * source file to the corresponding loose cache file.
 	 */
-	void ConvertTexture(const CTexturePtr& texture)
+	void ConvertTexture(const CTexturePtr& texture, bool highPriority)
 	{
 		VfsPath sourcePath = texture->m_Properties.m_Path;
 
@@ -302,7 +354,70 @@ public:
 
 		CTextureConverter::Settings settings = GetConverterSettings(texture);
 
-		m_TextureConverter.ConvertTexture(texture, sourcePath, looseCachePath, settings);
+		if (!m_TextureConverter.ConvertTexture(texture, sourcePath, looseCachePath, settings, highPriority))
+		{
+			// Replace with error texture to make it obvious, instead of waiting
+			// forever for a conversion that never started
+			texture->SetHandle(m_ErrorHandle);
+			texture->m_State = CTexture::LOADED;
+		}
+	}
+
+	/**
+	 * Moves the texture's queued conversion (if any) ahead of the other
+	 * prefetched textures, because it is needed now.
+	 */
+	void PrioritizeConversion(const CTexturePtr& texture)
+	{
+		m_TextureConverter.Prioritize(texture);
+	}
+
+	/**
+	 * See CTextureManager::PrewarmCache
+	 */
+	void PrewarmCache(const VfsPath& path)
+	{
+		vfs::ForEachFile(m_VFS, path, &CollectPrewarmFileCB, (uintptr_t)static_cast<void*>(this), 0, vfs::DIR_RECURSIVE);
+	}
+
+	static Status CollectPrewarmFileCB(const VfsPath& pathname, const FileInfo& UNUSED(fileInfo), const uintptr_t cbData)
+	{
+		CTextureManagerImpl* self = static_cast<CTextureManagerImpl*>((void*)cbData);
+		// Skip the directories where the engine doesn't use CTextureManager yet
+		// (same as CArchiveBuilder)
+		const std::wstring& name = pathname.string();
+		if (tex_is_known_extension(pathname) &&
+			name.find(L"art/textures/cursors/") != 0 &&
+			name.find(L"art/textures/terrain/alphamaps/") != 0)
+			self->m_PrewarmQueue.push_back(pathname);
+		return INFO::OK;
+	}
+
+	/**
+	 * Starts converting the next texture of the pre-warm queue that isn't
+	 * cached yet. Returns false if the queue is empty.
+	 */
+	bool PrewarmNextTexture()
+	{
+		while (!m_PrewarmQueue.empty())
+		{
+			// This texture is not in the texture cache, so it will never get loaded
+			CTexturePtr texture(new CTexture(m_DefaultHandle, CTextureProperties(m_PrewarmQueue.front()), this));
+			m_PrewarmQueue.pop_front();
+
+			MD5 hash;
+			u32 version;
+			PrepareCacheKey(texture, hash, version);
+			VfsPath loadPath;
+			if (m_CacheLoader.TryLoadingCached(texture->m_Properties.m_Path, hash, version, loadPath) != INFO::SKIPPED)
+				continue;
+
+			texture->m_State = CTexture::PREWARM_IS_CONVERTING;
+			ConvertTexture(texture, false);
+			return true;
+		}
+
+		return false;
 	}
 
 	bool GenerateCachedTexture(const VfsPath& sourcePath, VfsPath& archiveCachePath)
@@ -338,9 +453,15 @@ public:
 			bool ok;
 			if (m_TextureConverter.Poll(texture, dest, ok))
 			{
-				if (ok)
+				if (texture->m_State == CTexture::PREWARM_IS_CONVERTING)
+				{
+					// Only the cache file was needed
+					if (!ok)
+						LOGERROR(L"Texture failed to convert: \"%ls\"", texture->m_Properties.m_Path.string().c_str());
+				}
+				else if (ok)
 				{
-					LoadTexture(texture, dest);
+					LoadTexture(texture, dest, m_Streaming ? STREAMING_MIN_SIZE : 0);
 				}
 				else
 				{
@@ -352,27 +473,25 @@ public:
 			}
 		}
 
-		// We'll only push new conversion requests if it's not already busy
-		bool converterBusy = m_TextureConverter.IsBusy();
-
-		if (!converterBusy)
+		// High-priority textures are needed on screen now, so they always get
+		// sent, and go ahead of everything else in the converter's queue.
+		// (Iterating over all textures isn't optimally efficient, but it
+		// doesn't seem to be a problem yet and it's simpler than maintaining
+		// multiple queues.)
+		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
 		{
-			// Look for all high-priority textures needing conversion.
-			// (Iterating over all textures isn't optimally efficient, but it
-			// doesn't seem to be a problem yet and it's simpler than maintaining
-			// multiple queues.)
-			for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+			if ((*it)->m_State == CTexture::HIGH_NEEDS_CONVERTING)
 			{
-				if ((*it)->m_State == CTexture::HIGH_NEEDS_CONVERTING)
-				{
-					// Start converting this texture
-					(*it)->m_State = CTexture::HIGH_IS_CONVERTING;
-					ConvertTexture(*it);
-					return true;
-				}
+				// Start converting this texture
+				(*it)->m_State = CTexture::HIGH_IS_CONVERTING;
+				ConvertTexture(*it, true);
+				return true;
 			}
 		}
 
+		// We'll only push new low-priority conversion requests if it's not already busy
+		bool converterBusy = m_TextureConverter.IsBusy();
+
 		// Try loading prefetched textures from their cache
 		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
 		{
@@ -398,15 +517,118 @@ public:
 				if ((*it)->m_State == CTexture::PREFETCH_NEEDS_CONVERTING)
 				{
 					(*it)->m_State = CTexture::PREFETCH_IS_CONVERTING;
-					ConvertTexture(*it);
+					ConvertTexture(*it, false);
 					return true;
 				}
 			}
+
+			// And then the textures that are only being pre-warmed
+			if (PrewarmNextTexture())
+				return true;
+		}
+
+		// Finally, stream in the top mip levels of textures that are being used
+		if (m_Streaming && StreamInNextTexture())
+			return true;
+
+		return false;
+	}
+
+	/**
+	 * Reloads, with all its mip levels, one texture of reduced resolution that
+	 * was bound in the last frame. If that would exceed the memory budget,
+	 * the least recently used textures are reduced first.
+	 * Returns false if there was nothing to do.
+	 */
+	bool StreamInNextTexture()
+	{
+		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+		{
+			CTexturePtr texture = *it;
+			if (texture->m_State != CTexture::LOADED || texture->m_SkippedLevels == 0 || texture->m_LastUsedFrame + 1 < m_Frame)
+				continue;
+
+			const size_t extra = texture->m_FullMemoryUsage - texture->m_MemoryUsage;
+			while (m_MemoryBudget && m_TextureMemory + extra > m_MemoryBudget)
+			{
+				// Everything else is in use, so keep this one reduced
+				if (!StreamOutLeastRecentlyUsed())
+					return false;
+			}
+
+			PROFILE2("stream in texture");
+			LoadTexture(texture, texture->m_LoadPath);
+			return true;
 		}
 
 		return false;
 	}
 
+	/**
+	 * Reloads the least recently used full-resolution texture, which wasn't
+	 * bound in the last frame, without its top mip levels.
+	 * Returns false if there is no such texture.
+	 */
+	bool StreamOutLeastRecentlyUsed()
+	{
+		CTexturePtr oldest;
+		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+		{
+			const CTexturePtr& texture = *it;
+			if (texture->m_State != CTexture::LOADED || texture->m_SkippedLevels != 0 || texture->m_LastUsedFrame + 1 >= m_Frame)
+				continue;
+
+			// Ignore textures that are already small, since reloading them wouldn't free anything
+			if (texture->m_LoadPath.empty() || texture->m_FullMemoryUsage <= EstimateTextureMemory(STREAMING_MIN_SIZE, STREAMING_MIN_SIZE, 32, 0, true))
+				continue;
+
+			if (!oldest || texture->m_LastUsedFrame < oldest->m_LastUsedFrame)
+				oldest = texture;
+		}
+
+		if (!oldest)
+			return false;
+
+		PROFILE2("stream out texture");
+		LoadTexture(oldest, oldest->m_LoadPath, STREAMING_MIN_SIZE);
+		return true;
+	}
+
+	/**
+	 * See CTextureManager::EndFrame
+	 */
+	void EndFrame()
+	{
+		++m_Frame;
+
+		// Reduce one texture per frame while over budget, to spread the cost
+		if (m_Streaming && m_MemoryBudget && m_TextureMemory > m_MemoryBudget)
+			StreamOutLeastRecentlyUsed();
+	}
+
+	/**
+	 * See CTextureManager::SetStreaming
+	 */
+	void SetStreaming(bool enabled, size_t budget)
+	{
+		m_Streaming = enabled && !m_DisableGL;
+		m_MemoryBudget = budget;
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_TextureMemory;
+	}
+
+	size_t GetNumReducedTextures() const
+	{
+		size_t count = 0;
+		for (TextureCache::const_iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+			if ((*it)->m_SkippedLevels != 0)
+				++count;
+		return count;
+	}
+
 	/**
 	 * Compute the conversion settings that apply to a given texture, by combining
 	 * the textures.xml files from its directory and all parent directories
@@ -474,6 +696,7 @@ public:
 				{
 					texture->m_State = CTexture::UNLOADED;
 					texture->SetHandle(m_DefaultHandle);
+					SetMemoryUsage(texture, 0, 0, 0);
 				}
 			}
 		}
@@ -489,6 +712,16 @@ private:
 
 	Handle m_DefaultHandle;
 	Handle m_ErrorHandle;
+
+	// Mip level streaming (see CTextureManager::SetStreaming)
+	bool m_Streaming;
+	size_t m_MemoryBudget;
+	size_t m_TextureMemory;
+	size_t m_Frame;
+
+	// Largest level uploaded when a texture is first loaded, if streaming
+	static const size_t STREAMING_MIN_SIZE = 128;
+
 	CTexturePtr m_ErrorTexture;
 
 	// Cache of all loaded textures
@@ -504,10 +737,14 @@ private:
 	// Cache for the conversion settings files
 	typedef boost::unordered_map<VfsPath, shared_ptr<CTextureConverter::SettingsFile> > SettingsFilesMap;
 	SettingsFilesMap m_SettingsFiles;
+
+	// Source files still to be converted by PrewarmCache
+	std::deque<VfsPath> m_PrewarmQueue;
 };
 
 CTexture::CTexture(Handle handle, const CTextureProperties& props, CTextureManagerImpl* textureManager) :
-	m_Handle(handle), m_BaseColour(0), m_State(UNLOADED), m_Properties(props), m_TextureManager(textureManager)
+	m_Handle(handle), m_BaseColour(0), m_State(UNLOADED), m_Properties(props), m_TextureManager(textureManager),
+	m_SkippedLevels(0), m_MemoryUsage(0), m_FullMemoryUsage(0), m_LastUsedFrame(0)
 {
 	// Add a reference to the handle (it might be shared by multiple CTextures
 	// so we can't take ownership of it)
@@ -517,6 +754,8 @@ CTexture::CTexture(Handle handle, const CTextureProperties& props, CTextureManag
 
 CTexture::~CTexture()
 {
+	m_TextureManager->m_TextureMemory -= m_MemoryUsage;
+
 	if (m_Handle)
 		ogl_tex_free(m_Handle);
 }
@@ -534,6 +773,8 @@ Handle CTexture::GetHandle()
 
 	TryLoad();
 
+	m_LastUsedFrame = m_TextureManager->m_Frame;
+
 	return m_Handle;
 }
 
@@ -551,6 +792,15 @@ bool CTexture::TryLoad()
 				m_State = HIGH_NEEDS_CONVERTING;
 		}
 	}
+	// If the prefetched conversion is still queued behind others, move it forward
+	else if (m_State == PREFETCH_IS_CONVERTING)
+	{
+		if (shared_ptr<CTexture> self = m_Self.lock())
+		{
+			m_TextureManager->PrioritizeConversion(self);
+			m_State = HIGH_IS_CONVERTING;
+		}
+	}
 
 	return (m_State == LOADED);
 }
@@ -637,6 +887,31 @@ bool CTextureManager::MakeProgress()
 	return m->MakeProgress();
 }
 
+void CTextureManager::PrewarmCache(const VfsPath& path)
+{
+	m->PrewarmCache(path);
+}
+
+void CTextureManager::SetStreaming(bool enabled, size_t budget)
+{
+	m->SetStreaming(enabled, budget);
+}
+
+void CTextureManager::EndFrame()
+{
+	m->EndFrame();
+}
+
+size_t CTextureManager::GetMemoryUsage() const
+{
+	return m->GetMemoryUsage();
+}
+
+size_t CTextureManager::GetNumReducedTextures() const
+{
+	return m->GetNumReducedTextures();
+}
+
 bool CTextureManager::GenerateCachedTexture(const VfsPath& path, VfsPath& outputPath)
 {
 	return m->GenerateCachedTexture(path, outputPath);
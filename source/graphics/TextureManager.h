@@ -103,6 +103,40 @@ public:
 	 */
 	bool MakeProgress();
 
+	/**
+	 * Queues the conversion of every texture file under the given VFS directory
+	 * that has no cached version yet, so that the cache is ready before the
+	 * textures are needed. The textures are converted (but not loaded) by
+	 * MakeProgress, after all the textures that were requested or prefetched.
+	 */
+	void PrewarmCache(const VfsPath& path);
+
+	/**
+	 * Enables the streaming of mip levels. Textures are then first uploaded
+	 * without their top (highest-resolution) levels, which get loaded by
+	 * MakeProgress once the texture is used. If budget is non-zero, the top
+	 * levels of the least recently used textures are dropped again, to keep
+	 * the estimated texture memory under budget (in bytes).
+	 */
+	void SetStreaming(bool enabled, size_t budget);
+
+	/**
+	 * Advances the frame counter used to find recently used textures, and
+	 * drops top mip levels while over the memory budget.
+	 * Should be called once per rendered frame.
+	 */
+	void EndFrame();
+
+	/**
+	 * Returns the estimated GL memory used by all the loaded textures, in bytes.
+	 */
+	size_t GetMemoryUsage() const;
+
+	/**
+	 * Returns the number of textures currently uploaded without their top mip levels.
+	 */
+	size_t GetNumReducedTextures() const;
+
 	/**
 	 * Synchronously converts and compresses and saves the texture,
 	 * and returns the output path (minus a "cache/" prefix). This
@@ -278,11 +312,26 @@ private:
 		PREFETCH_IS_CONVERTING, // was prefetched; currently being processed by the texture converter
 		HIGH_NEEDS_CONVERTING, // high-priority; currently waiting to be sent to the texture converter
 		HIGH_IS_CONVERTING, // high-priority; currently being processed by the texture converter
+		PREWARM_IS_CONVERTING, // not used by the game; only being converted into the cache by PrewarmCache
 		LOADED // loading has completed (successfully or not)
 	} m_State;
 
 	CTextureManagerImpl* m_TextureManager;
 
+	// File the texture data was loaded from, to reload it with more or
+	// fewer mip levels when streaming
+	VfsPath m_LoadPath;
+
+	// Number of top mip levels which are not uploaded
+	size_t m_SkippedLevels;
+
+	// Estimated GL memory used by the texture as uploaded, and with all its levels
+	size_t m_MemoryUsage;
+	size_t m_FullMemoryUsage;
+
+	// Frame in which the texture was last bound
+	size_t m_LastUsedFrame;
+
 	// Self-reference to let us recover the CTexturePtr for this object.
 	// (weak pointer to avoid cycles)
 	boost::weak_ptr<CTexture> m_Self;
@@ -58,6 +58,41 @@ public:
 		TS_ASSERT_EQUALS(losData[0], 104);
 	}
 
+	void test_rect()
+	{
+		CSimulation2 sim(NULL, NULL);
+		CLOSTexture tex(sim);
+
+		const ssize_t size = 20;
+		std::vector<u32> inputDataVec(size*size);
+		srand(1234);
+		for (size_t i = 0; i < inputDataVec.size(); ++i)
+			inputDataVec[i] = rand() % 4; // unexplored, explored or visible
+
+		ICmpRangeManager::CLosQuerier los(ICmpRangeManager::LOS_MASK, inputDataVec, size);
+
+		std::vector<u8> losData;
+		losData.resize(tex.GetBitmapSize(size, size));
+		tex.GenerateBitmap(los, &losData[0], size, size);
+		const size_t rowSize = size + 6;
+
+		// Parts of the bitmap (including ones touching the edges) must match the whole bitmap
+		ssize_t rects[][4] = { { 0, 0, 20, 20 }, { 0, 0, 1, 1 }, { 5, 3, 7, 9 }, { 15, 12, 5, 8 }, { 19, 0, 1, 20 } };
+		for (size_t r = 0; r < ARRAY_SIZE(rects); ++r)
+		{
+			ssize_t i0 = rects[r][0], j0 = rects[r][1];
+			size_t w = rects[r][2], h = rects[r][3];
+
+			std::vector<u8> rectData;
+			rectData.resize(tex.GetBitmapSize(w, h));
+			tex.GenerateBitmapRect(los, &rectData[0], size, i0, j0, w, h);
+
+			for (size_t j = 0; j < h; ++j)
+				for (size_t i = 0; i < w; ++i)
+					TS_ASSERT_EQUALS(rectData[i + j*w], losData[(i0+i) + (j0+j)*rowSize]);
+		}
+	}
+
 	void test_perf_DISABLED()
 	{
 		CSimulation2 sim(NULL, NULL);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,7 @@
 
 #include "graphics/Terrain.h"
 
+#include "graphics/Frustum.h"
 #include "graphics/Patch.h"
 #include "graphics/RenderableObject.h"
 #include "maths/FixedVector3D.h"
@@ -192,4 +193,58 @@ public:
 		TS_ASSERT_EQUALS(vec.Y.ToFloat(), 1.f);
 		TS_ASSERT_EQUALS(vec.Z.ToFloat(), 0.f);
 	}
+
+	void test_PatchQuadtree()
+	{
+		// Use a size that isn't a power of two, so some nodes are partially empty
+		CTerrain terrain;
+		terrain.Initialize(5, NULL);
+
+		srand(1234);
+		for (int n = 0; n < 40; ++n)
+		{
+			ssize_t i = rand() % terrain.GetVerticesPerSide();
+			ssize_t j = rand() % terrain.GetVerticesPerSide();
+			SetVertex(terrain, i, j, rand() % 10000);
+
+			float size = (float)(terrain.GetVerticesPerSide() - 1) * TERRAIN_TILE_SIZE;
+			for (int f = 0; f < 10; ++f)
+			{
+				CFrustum frustum;
+				int numPlanes = 1 + rand() % 4;
+				for (int p = 0; p < numPlanes; ++p)
+				{
+					CVector3D norm(rand() % 200 - 100.f, rand() % 200 - 100.f, rand() % 200 - 100.f);
+					if (norm.LengthSquared() == 0.f)
+						norm = CVector3D(1.f, 0.f, 0.f);
+					norm.Normalize();
+					CVector3D point(size * (rand() % 100) / 100.f, 0.f, size * (rand() % 100) / 100.f);
+					CPlane plane;
+					plane.Set(norm, point);
+					frustum.AddPlane(plane);
+				}
+
+				float minTop = (float)(rand() % 50);
+
+				std::vector<CPatch*> patches;
+				terrain.GetPatchQuadtree().GetVisiblePatches(terrain, frustum, minTop, patches);
+				std::sort(patches.begin(), patches.end());
+
+				std::vector<CPatch*> expected;
+				for (ssize_t pj = 0; pj < terrain.GetPatchesPerSide(); ++pj)
+				{
+					for (ssize_t pi = 0; pi < terrain.GetPatchesPerSide(); ++pi)
+					{
+						CBoundingBoxAligned bounds = terrain.GetPatch(pi, pj)->GetWorldBounds();
+						if (bounds[1].Y < minTop)
+							bounds[1].Y = minTop;
+						if (frustum.IsBoxVisible(CVector3D(0, 0, 0), bounds))
+							expected.push_back(terrain.GetPatch(pi, pj));
+					}
+				}
+
+				TS_ASSERT(patches == expected);
+			}
+		}
+	}
 };
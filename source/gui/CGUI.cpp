@@ -464,6 +464,9 @@ void CGUI::Draw()
 	{
 		LOGERROR(L"GUI draw error: %hs", e.what());
 	}
+
+	// Draw the sprites that are still queued
+	GUIRenderer::Flush();
 }
 
 void CGUI::DrawSprite(const CGUISpriteInstance& Sprite,
@@ -943,6 +946,9 @@ SGUIText CGUI::GenerateText(const CGUIString &string,
 void CGUI::DrawText(SGUIText &Text, const CColor &DefaultColor, 
 					const CPos &pos, const float &z, const CRect &clipping)
 {
+	// The text must be drawn over the sprites queued so far
+	GUIRenderer::Flush();
+
 	CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect("gui_text");
 
 	tech->BeginPass();
@@ -980,6 +986,9 @@ void CGUI::DrawText(SGUIText &Text, const CColor &DefaultColor,
 		DrawSprite(it->m_Sprite, it->m_CellID, z, it->m_Area + pos);
 	}
 
+	// Draw the text's sprites before the clipping is disabled
+	GUIRenderer::Flush();
+
 	if (clipping != CRect())
 		glDisable(GL_SCISSOR_TEST);
 
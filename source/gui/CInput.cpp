@@ -1078,6 +1078,9 @@ void CInput::Draw()
 				cliparea.left = GetScrollBar(0).GetOuterRect().right;
 		}
 
+		// Draw the sprites queued so far without the clipping
+		GUIRenderer::Flush();
+
 		if (cliparea != CRect())
 		{
 			glEnable(GL_SCISSOR_TEST);
@@ -1269,6 +1272,9 @@ void CInput::Draw()
 		// Setup initial color (then it might change and change back, when drawing selected area)
 		textRenderer.Color(color);
 
+		// The text must be drawn over the selected areas
+		GUIRenderer::Flush();
+
 		tech->BeginPass();
 
 		bool using_selected_color = false;
@@ -328,40 +328,70 @@ CRect SDrawCall::ComputeTexCoords() const
 	return TexCoords;
 }
 
-void GUIRenderer::Draw(DrawCalls &Calls, float Z)
+// Sprites are queued by Draw and merged into batches, which Flush draws with
+// a single call each. Only consecutive sprites are merged, so they are still
+// drawn in the same order (which matters for the blended ones).
+
+struct SBatch
 {
-	// Called every frame, to draw the object (based on cached calculations)
+	CShaderTechniquePtr m_Shader;
+	CTexturePtr m_Texture; // NULL for solid colours
+	CColor m_Color;
+	bool m_EnableBlending;
+	GLenum m_Mode; // GL_TRIANGLES or GL_LINES
 
-	// TODO: batching by shader/texture/etc would be nice
+	// Range of vertexes in g_BatchVertexes
+	size_t m_First;
+	size_t m_Count;
+};
 
-	CMatrix3D matrix = GetDefaultGuiMatrix();
+// Number of floats per vertex (texcoords u,v and position x,y,z)
+static const size_t BATCH_VERTEX_SIZE = 5;
 
-	glDisable(GL_BLEND);
+static std::vector<SBatch> g_Batches;
+static std::vector<float> g_BatchVertexes;
 
-	// Set LOD bias so mipmapped textures are prettier
-#if CONFIG2_GLES
-#warning TODO: implement GUI LOD bias for GLES
-#else
-	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, -1.f);
-#endif
+static void AddBatchVertexes(const CShaderTechniquePtr& shader, const CTexturePtr& texture, const CColor& color,
+	bool enableBlending, GLenum mode, const float* vertexes, size_t count)
+{
+	size_t first = g_BatchVertexes.size() / BATCH_VERTEX_SIZE;
+	g_BatchVertexes.insert(g_BatchVertexes.end(), vertexes, vertexes + count*BATCH_VERTEX_SIZE);
+
+	if (!g_Batches.empty())
+	{
+		SBatch& last = g_Batches.back();
+		if (last.m_Shader == shader && last.m_Texture == texture && last.m_Color == color &&
+			last.m_EnableBlending == enableBlending && last.m_Mode == mode)
+		{
+			last.m_Count += count;
+			return;
+		}
+	}
+
+	SBatch batch;
+	batch.m_Shader = shader;
+	batch.m_Texture = texture;
+	batch.m_Color = color;
+	batch.m_EnableBlending = enableBlending;
+	batch.m_Mode = mode;
+	batch.m_First = first;
+	batch.m_Count = count;
+	g_Batches.push_back(batch);
+}
+
+void GUIRenderer::Draw(DrawCalls &Calls, float Z)
+{
+	// Called every frame, to draw the object (based on cached calculations)
 
-	// Iterate through each DrawCall, and execute whatever drawing code is being called
+	// Iterate through each DrawCall, and queue its vertexes
 	for (DrawCalls::const_iterator cit = Calls.begin(); cit != Calls.end(); ++cit)
 	{
-		cit->m_Shader->BeginPass();
-		CShaderProgramPtr shader = cit->m_Shader->GetShader();
-		shader->Uniform("transform", matrix);
+		float z = Z + cit->m_DeltaZ;
 
 		if (cit->m_HasTexture)
 		{
-			shader->Uniform("color", cit->m_ShaderColorParameter);
-			shader->BindTexture("tex", cit->m_Texture);
-
-			if (cit->m_EnableBlending || cit->m_Texture->HasAlpha()) // (shouldn't call HasAlpha before BindTexture)
-			{
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				glEnable(GL_BLEND);
-			}
+			// Start loading the texture now, since its size is needed for the texcoords
+			cit->m_Texture->TryLoad();
 
 			CRect TexCoords = cit->ComputeTexCoords();
 
@@ -378,31 +408,20 @@ void GUIRenderer::Draw(DrawCalls &Calls, float Z)
 				std::swap(TexCoords.bottom, TexCoords.top);
 			}
 
-			std::vector<float> data;
-#define ADD(u, v, x, y, z) STMT(data.push_back(u); data.push_back(v); data.push_back(x); data.push_back(y); data.push_back(z))
-			ADD(TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
-			ADD(TexCoords.right, TexCoords.bottom, Verts.right, Verts.bottom, Z + cit->m_DeltaZ);
-			ADD(TexCoords.right, TexCoords.top, Verts.right, Verts.top, Z + cit->m_DeltaZ);
-
-			ADD(TexCoords.right, TexCoords.top, Verts.right, Verts.top, Z + cit->m_DeltaZ);
-			ADD(TexCoords.left, TexCoords.top, Verts.left, Verts.top, Z + cit->m_DeltaZ);
-			ADD(TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
-#undef ADD
-
-			shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, 5*sizeof(float), &data[0]);
-			shader->VertexPointer(3, GL_FLOAT, 5*sizeof(float), &data[2]);
-			glDrawArrays(GL_TRIANGLES, 0, 6);
+			float data[] = {
+				TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, z,
+				TexCoords.right, TexCoords.bottom, Verts.right, Verts.bottom, z,
+				TexCoords.right, TexCoords.top, Verts.right, Verts.top, z,
+
+				TexCoords.right, TexCoords.top, Verts.right, Verts.top, z,
+				TexCoords.left, TexCoords.top, Verts.left, Verts.top, z,
+				TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, z
+			};
+			AddBatchVertexes(cit->m_Shader, cit->m_Texture, cit->m_ShaderColorParameter, cit->m_EnableBlending,
+				GL_TRIANGLES, data, 6);
 		}
 		else
 		{
-			shader->Uniform("color", cit->m_BackColor);
-
-			if (cit->m_EnableBlending)
-			{
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				glEnable(GL_BLEND);
-			}
-
 			// Ensure the quad has the correct winding order
 			CRect Verts = cit->m_Vertices;
 			if (Verts.right < Verts.left)
@@ -410,36 +429,87 @@ void GUIRenderer::Draw(DrawCalls &Calls, float Z)
 			if (Verts.bottom < Verts.top)
 				std::swap(Verts.bottom, Verts.top);
 
-			std::vector<float> data;
-#define ADD(x, y, z) STMT(data.push_back(x); data.push_back(y); data.push_back(z))
-			ADD(Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
-			ADD(Verts.right, Verts.bottom, Z + cit->m_DeltaZ);
-			ADD(Verts.right, Verts.top, Z + cit->m_DeltaZ);
+			float data[] = {
+				0.f, 0.f, Verts.left, Verts.bottom, z,
+				0.f, 0.f, Verts.right, Verts.bottom, z,
+				0.f, 0.f, Verts.right, Verts.top, z,
 
-			ADD(Verts.right, Verts.top, Z + cit->m_DeltaZ);
-			ADD(Verts.left, Verts.top, Z + cit->m_DeltaZ);
-			ADD(Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
-
-			shader->VertexPointer(3, GL_FLOAT, 3*sizeof(float), &data[0]);
-			glDrawArrays(GL_TRIANGLES, 0, 6);
+				0.f, 0.f, Verts.right, Verts.top, z,
+				0.f, 0.f, Verts.left, Verts.top, z,
+				0.f, 0.f, Verts.left, Verts.bottom, z
+			};
+			AddBatchVertexes(cit->m_Shader, CTexturePtr(), cit->m_BackColor, cit->m_EnableBlending,
+				GL_TRIANGLES, data, 6);
 
 			if (cit->m_BorderColor != CColor())
 			{
-				shader->Uniform("color", cit->m_BorderColor);
+				// Draw the outline as separate lines (rather than a line loop),
+				// so that it can be batched with other outlines
+				float left = Verts.left + 0.5f;
+				float right = Verts.right - 0.5f;
+				float top = Verts.top + 0.5f;
+				float bottom = Verts.bottom - 0.5f;
+				float lines[] = {
+					0.f, 0.f, left, top, z,
+					0.f, 0.f, right, top, z,
+					0.f, 0.f, right, top, z,
+					0.f, 0.f, right, bottom, z,
+					0.f, 0.f, right, bottom, z,
+					0.f, 0.f, left, bottom, z,
+					0.f, 0.f, left, bottom, z,
+					0.f, 0.f, left, top, z
+				};
+				AddBatchVertexes(cit->m_Shader, CTexturePtr(), cit->m_BorderColor, cit->m_EnableBlending,
+					GL_LINES, lines, 8);
+			}
+		}
+	}
+}
+
+void GUIRenderer::Flush()
+{
+	if (g_Batches.empty())
+		return;
 
-				data.clear();
-				ADD(Verts.left + 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.right - 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.right - 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.left + 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
+	CMatrix3D matrix = GetDefaultGuiMatrix();
 
-				shader->VertexPointer(3, GL_FLOAT, 3*sizeof(float), &data[0]);
-				glDrawArrays(GL_LINE_LOOP, 0, 4);
-			}
-#undef ADD
+	glDisable(GL_BLEND);
+
+	// Set LOD bias so mipmapped textures are prettier
+#if CONFIG2_GLES
+#warning TODO: implement GUI LOD bias for GLES
+#else
+	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, -1.f);
+#endif
+
+	for (std::vector<SBatch>::const_iterator it = g_Batches.begin(); it != g_Batches.end(); ++it)
+	{
+		it->m_Shader->BeginPass();
+		CShaderProgramPtr shader = it->m_Shader->GetShader();
+		shader->Uniform("transform", matrix);
+		shader->Uniform("color", it->m_Color);
+
+		bool enableBlending = it->m_EnableBlending;
+		if (it->m_Texture)
+		{
+			shader->BindTexture("tex", it->m_Texture);
+			if (it->m_Texture->HasAlpha()) // (shouldn't call HasAlpha before BindTexture)
+				enableBlending = true;
+		}
+
+		if (enableBlending)
+		{
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glEnable(GL_BLEND);
 		}
-		
-		cit->m_Shader->EndPass();
+
+		const float* data = &g_BatchVertexes[it->m_First * BATCH_VERTEX_SIZE];
+		if (it->m_Texture)
+			shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, BATCH_VERTEX_SIZE*sizeof(float), data);
+		shader->VertexPointer(3, GL_FLOAT, BATCH_VERTEX_SIZE*sizeof(float), data + 2);
+		glDrawArrays(it->m_Mode, 0, it->m_Count);
+
+		it->m_Shader->EndPass();
 
 		glDisable(GL_BLEND);
 	}
@@ -449,4 +519,7 @@ void GUIRenderer::Draw(DrawCalls &Calls, float Z)
 #else
 	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, 0.f);
 #endif
+
+	g_Batches.clear();
+	g_BatchVertexes.clear();
 }
@@ -79,7 +79,17 @@ namespace GUIRenderer
 {
 	void UpdateDrawCallCache(DrawCalls &Calls, const CStr& SpriteName, const CRect& Size, int CellID, std::map<CStr, CGUISprite> &Sprites);
 
+	/**
+	 * Queues the sprite's draw calls. Consecutive sprites with the same shader,
+	 * texture and color are merged, and drawn by the next Flush.
+	 */
 	void Draw(DrawCalls &Calls, float Z);
+
+	/**
+	 * Draws all the queued sprites. Must be called before anything else is
+	 * drawn over them or the GL state they depend on (e.g. scissoring) changes.
+	 */
+	void Flush();
 }
 
 #endif // GUIRenderer_h
@@ -335,6 +335,9 @@ void CMiniMap::Draw()
 	if(!(GetGUI() && g_Game && g_Game->IsGameStarted()))
 		return;
 
+	// The minimap is drawn directly, so it must be drawn over the sprites queued so far
+	GUIRenderer::Flush();
+
 	CSimulation2* sim = g_Game->GetSimulation2();
 	CmpPtr<ICmpRangeManager> cmpRangeManager(*sim, SYSTEM_ENTITY);
 	ENSURE(cmpRangeManager);
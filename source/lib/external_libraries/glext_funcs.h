@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -141,6 +141,9 @@ FUNC2(void, glBlendColorEXT, glBlendColor, "1.4", (GLclampf red, GLclampf green,
 // GL_EXT_blend_minmax / GL1.4 (optional in 1.2):
 FUNC2(void, glBlendEquationEXT, glBlendEquation, "1.4", (GLenum mode))
 
+// GL_EXT_multi_draw_arrays / GL1.4:
+FUNC2(void, glMultiDrawElementsEXT, glMultiDrawElements, "1.4", (GLenum, const GLsizei*, GLenum, const GLvoid**, GLsizei))
+
 // GL_ARB_vertex_buffer_object / GL1.5:
 FUNC2(void, glBindBufferARB, glBindBuffer, "1.5", (int target, GLuint buffer))
 FUNC2(void, glDeleteBuffersARB, glDeleteBuffers, "1.5", (GLsizei n, const GLuint* buffers))
@@ -349,9 +352,20 @@ FUNC2(void, glGetQueryivARB, glGetQueryiv, "1.5", (GLenum target, GLenum pname,
 FUNC2(void, glGetQueryObjectivARB, glGetQueryObjectiv, "1.5", (GLuint id, GLenum pname, GLint *params))
 FUNC2(void, glGetQueryObjectuivARB, glGetQueryObjectuiv, "1.5", (GLuint id, GLenum pname, GLuint *params))
 
+// GL_ARB_draw_instanced / GL3.1:
+FUNC2(void, glDrawElementsInstancedARB, glDrawElementsInstanced, "3.1", (GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount))
+
+// GL_ARB_instanced_arrays / GL3.3:
+FUNC2(void, glVertexAttribDivisorARB, glVertexAttribDivisor, "3.3", (GLuint index, GLuint divisor))
+
 // GL_ARB_sync / GL3.2:
 FUNC2(void, glGetInteger64v, glGetInteger64v, "3.2", (GLenum pname, GLint64 *params))
 
+// GL_ARB_get_program_binary / GL4.1:
+FUNC2(void, glGetProgramBinary, glGetProgramBinary, "4.1", (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, GLvoid *binary))
+FUNC2(void, glProgramBinary, glProgramBinary, "4.1", (GLuint program, GLenum binaryFormat, const GLvoid *binary, GLsizei length))
+FUNC2(void, glProgramParameteri, glProgramParameteri, "4.1", (GLuint program, GLenum pname, GLint value))
+
 // GL_EXT_timer_query:
 FUNC(void, glGetQueryObjecti64vEXT, (GLuint id, GLenum pname, GLint64 *params))
 FUNC(void, glGetQueryObjectui64vEXT, (GLuint id, GLenum pname, GLuint64 *params))
@@ -34,6 +34,7 @@
 #include "lib/bits.h"
 #include "lib/byte_order.h"
 #include "lib/allocators/pool.h"
+#include "lib/posix/posix_mman.h"
 #include "lib/sysdep/filesystem.h"
 #include "lib/file/archive/archive.h"
 #include "lib/file/archive/codec_zlib.h"
@@ -285,6 +286,80 @@ cassert(sizeof(ECDR) == 22);
 #pragma pack(pop)
 
 
+//-----------------------------------------------------------------------------
+// ArchiveMapping
+//-----------------------------------------------------------------------------
+
+// the entire archive file, mapped into memory once so that its entries can
+// be used (stored) or decompressed (deflated) in place. this avoids reading
+// them into temporary buffers, and lets several processes share the
+// archive's pages in the OS file cache.
+class ArchiveMapping
+{
+	NONCOPYABLE(ArchiveMapping);
+public:
+	ArchiveMapping(const PFile& file, off_t fileSize)
+		: m_data(0), m_size(0)
+	{
+		// don't use up the address space of 32-bit processes with large archives
+		if(sizeof(void*) < 8 || fileSize <= 0)
+			return;
+
+		// (private and writable, so that the views returned by LoadView may
+		// be modified in place without changing the archive - the pages are
+		// only copied when written to)
+		void* p = mmap(0, (size_t)fileSize, PROT_READ|PROT_WRITE, MAP_PRIVATE, file->Descriptor(), 0);
+		if(p == MAP_FAILED)
+			return;	// fall back to reading the file
+		m_data = (u8*)p;
+		m_size = (size_t)fileSize;
+	}
+
+	~ArchiveMapping()
+	{
+		if(m_data)
+			(void)munmap(m_data, m_size);
+	}
+
+	bool IsValid() const
+	{
+		return m_data != 0;
+	}
+
+	u8* Data() const
+	{
+		return m_data;
+	}
+
+	size_t Size() const
+	{
+		return m_size;
+	}
+
+private:
+	u8* m_data;
+	size_t m_size;
+};
+
+typedef shared_ptr<ArchiveMapping> PArchiveMapping;
+
+// shared_ptr deleter for views into the mapping, which keeps the mapping
+// alive until all views have been released.
+struct ArchiveMappingReference
+{
+	ArchiveMappingReference(const PArchiveMapping& mapping)
+		: mapping(mapping)
+	{
+	}
+
+	void operator()(u8* UNUSED(p)) const
+	{
+	}
+
+	PArchiveMapping mapping;
+};
+
+
 //-----------------------------------------------------------------------------
 // ArchiveFile_Zip
 //-----------------------------------------------------------------------------
@@ -292,8 +367,8 @@ cassert(sizeof(ECDR) == 22);
 class ArchiveFile_Zip : public IArchiveFile
 {
 public:
-	ArchiveFile_Zip(const PFile& file, off_t ofs, off_t csize, u32 checksum, ZipMethod method)
-		: m_file(file), m_ofs(ofs)
+	ArchiveFile_Zip(const PFile& file, const PArchiveMapping& mapping, off_t ofs, off_t csize, u32 checksum, ZipMethod method)
+		: m_file(file), m_mapping(mapping), m_ofs(ofs)
 		, m_csize(csize), m_checksum(checksum), m_method((u16)method)
 		, m_flags(NeedsFixup)
 	{
@@ -333,9 +408,17 @@ public:
 
 		Stream stream(codec);
 		stream.SetOutputBuffer(buf.get(), size);
-		io::Operation op(*m_file.get(), 0, m_csize, m_ofs);
-		StreamFeeder streamFeeder(stream);
-		RETURN_STATUS_IF_ERR(io::Run(op, io::Parameters(), streamFeeder));
+		if(IsMapped())
+		{
+			// decompress straight from the mapped archive
+			RETURN_STATUS_IF_ERR(stream.Feed(m_mapping->Data() + m_ofs, (size_t)m_csize));
+		}
+		else
+		{
+			io::Operation op(*m_file.get(), 0, m_csize, m_ofs);
+			StreamFeeder streamFeeder(stream);
+			RETURN_STATUS_IF_ERR(io::Run(op, io::Parameters(), streamFeeder));
+		}
 		RETURN_STATUS_IF_ERR(stream.Finish());
 #if CODEC_COMPUTE_CHECKSUM
 		ENSURE(m_checksum == stream.Checksum());
@@ -344,6 +427,20 @@ public:
 		return INFO::OK;
 	}
 
+	virtual Status LoadView(const OsPath& UNUSED(name), shared_ptr<u8>& buf, size_t size) const
+	{
+		// only stored entries can be used in place
+		if(m_method != ZIP_METHOD_NONE)
+			return INFO::SKIPPED;
+
+		AdjustOffset();
+		if(!IsMapped() || size_t(m_csize) != size)
+			return INFO::SKIPPED;
+
+		buf = shared_ptr<u8>(m_mapping->Data() + m_ofs, ArchiveMappingReference(m_mapping));
+		return INFO::OK;
+	}
+
 private:
 	enum Flags
 	{
@@ -404,6 +501,13 @@ private:
 			return;
 		m_flags &= ~NeedsFixup;
 
+		if(m_mapping && m_mapping->IsValid())
+		{
+			if(size_t(m_ofs) + sizeof(LFH) <= m_mapping->Size())
+				m_ofs += (off_t)((const LFH*)(m_mapping->Data() + m_ofs))->Size();
+			return;
+		}
+
 		// performance note: this ends up reading one file block, which is
 		// only in the block cache if the file starts in the same block as a
 		// previously read file (i.e. both are small).
@@ -413,7 +517,16 @@ private:
 			m_ofs += (off_t)lfh.Size();
 	}
 
+	/**
+	 * @return whether the (adjusted) entry data lies within the archive mapping.
+	 **/
+	bool IsMapped() const
+	{
+		return m_mapping && m_mapping->IsValid() && size_t(m_ofs) + size_t(m_csize) <= m_mapping->Size();
+	}
+
 	PFile m_file;
+	PArchiveMapping m_mapping;
 
 	// all relevant LFH/CDFH fields not covered by FileInfo
 	mutable off_t m_ofs;
@@ -439,6 +552,8 @@ public:
 		m_fileSize = fileInfo.Size();
 		const size_t minFileSize = sizeof(LFH)+sizeof(CDFH)+sizeof(ECDR);
 		ENSURE(m_fileSize >= off_t(minFileSize));
+
+		m_mapping.reset(new ArchiveMapping(m_file, m_fileSize));
 	}
 
 	virtual Status ReadEntries(ArchiveEntryCallback cb, uintptr_t cbData)
@@ -467,7 +582,7 @@ public:
 			{
 				const OsPath name = relativePathname.Filename();
 				FileInfo fileInfo(name, cdfh->USize(), cdfh->MTime());
-				shared_ptr<ArchiveFile_Zip> archiveFile(new ArchiveFile_Zip(m_file, cdfh->HeaderOffset(), cdfh->CSize(), cdfh->Checksum(), cdfh->Method()));
+				shared_ptr<ArchiveFile_Zip> archiveFile(new ArchiveFile_Zip(m_file, m_mapping, cdfh->HeaderOffset(), cdfh->CSize(), cdfh->Checksum(), cdfh->Method()));
 				cb(relativePathname, fileInfo, archiveFile, cbData);
 			}
 
@@ -564,6 +679,7 @@ private:
 
 	PFile m_file;
 	off_t m_fileSize;
+	PArchiveMapping m_mapping;
 };
 
 PIArchiveReader CreateArchiveReader_Zip(const OsPath& archivePathname)
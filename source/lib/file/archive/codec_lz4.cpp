@@ -0,0 +1,467 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * LZ4 codec (block format), implemented here because it's small and
+ * avoids another external library.
+ *
+ * the stream consists of independent blocks of up to BLOCK_SIZE bytes of
+ * uncompressed data, each preceded by a little-endian u32 holding the
+ * size of the block data. if BLOCK_STORED is set in that header,
+ * the block couldn't be compressed and is stored as-is.
+ */
+
+#include "precompiled.h"
+#include "lib/file/archive/codec_lz4.h"
+
+#include "lib/byte_order.h"
+#include "lib/file/archive/codec.h"
+#include "lib/external_libraries/zlib.h"	// crc32
+
+static const size_t BLOCK_SIZE = 256*KiB;
+static const size_t BLOCK_HEADER_SIZE = 4;
+static const u32 BLOCK_STORED = 0x80000000u;
+
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 0xFFFF;
+// the format requires the last 5 bytes to be literals and the last match
+// to start at least 12 bytes before the end of the block.
+static const size_t LAST_LITERALS = 5;
+static const size_t MATCH_FIND_LIMIT = 12;
+
+static const size_t HASH_BITS = 14;
+
+
+static inline u32 Read32(const u8* p)
+{
+	u32 x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static inline size_t Hash(u32 sequence)
+{
+	return (sequence * 2654435761u) >> (32-HASH_BITS);
+}
+
+// writes the extra length bytes for length fields that don't fit in
+// the token nibble.
+static inline u8* WriteLength(u8* op, size_t length)
+{
+	for(; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = (u8)length;
+	return op;
+}
+
+static inline bool ReadLength(const u8*& ip, const u8* iend, size_t& length)
+{
+	u8 b;
+	do
+	{
+		if(ip >= iend)
+			return false;
+		b = *ip++;
+		length += b;
+	}
+	while(b == 255);
+	return true;
+}
+
+// greedy single-probe compressor.
+// @return compressed size, or 0 if it wouldn't fit into outSize.
+static size_t CompressBlock(const u8* in, size_t inSize, u8* out, size_t outSize, u32* table)
+{
+	memset(table, 0, sizeof(u32) << HASH_BITS);
+
+	const u8* ip = in;
+	const u8* anchor = in;
+	const u8* const iend = in + inSize;
+	const u8* const matchFindLimit = (inSize > MATCH_FIND_LIMIT)? iend - MATCH_FIND_LIMIT : in;
+	const u8* const matchLimit = (inSize > LAST_LITERALS)? iend - LAST_LITERALS : in;
+	u8* op = out;
+	u8* const oend = out + outSize;
+
+	size_t misses = 0;
+	while(ip < matchFindLimit)
+	{
+		const u32 sequence = Read32(ip);
+		const size_t h = Hash(sequence);
+		const u8* ref = in + table[h];
+		table[h] = u32(ip - in);
+
+		if(ref >= ip || size_t(ip - ref) > MAX_OFFSET || Read32(ref) != sequence)
+		{
+			// skip ahead faster through data that doesn't compress
+			ip += 1 + (misses++ >> 6);
+			continue;
+		}
+		misses = 0;
+
+		const u8* matchEnd = ip + MIN_MATCH;
+		for(const u8* r = ref + MIN_MATCH; matchEnd < matchLimit && *matchEnd == *r; ++matchEnd, ++r)
+		{
+		}
+
+		const size_t literalLength = size_t(ip - anchor);
+		const size_t matchLength = size_t(matchEnd - ip) - MIN_MATCH;
+		// token + lengths + literals + offset
+		if(size_t(oend - op) < 1 + literalLength/255+1 + literalLength + 2 + matchLength/255+1)
+			return 0;
+
+		u8* token = op++;
+		*token = u8(std::min(literalLength, size_t(15)) << 4);
+		if(literalLength >= 15)
+			op = WriteLength(op, literalLength - 15);
+		memcpy(op, anchor, literalLength);
+		op += literalLength;
+
+		const size_t offset = size_t(ip - ref);
+		*op++ = u8(offset & 0xFF);
+		*op++ = u8(offset >> 8);
+
+		*token |= u8(std::min(matchLength, size_t(15)));
+		if(matchLength >= 15)
+			op = WriteLength(op, matchLength - 15);
+
+		ip = anchor = matchEnd;
+	}
+
+	// last literals
+	const size_t literalLength = size_t(iend - anchor);
+	if(size_t(oend - op) < 1 + literalLength/255+1 + literalLength)
+		return 0;
+	u8* token = op++;
+	*token = u8(std::min(literalLength, size_t(15)) << 4);
+	if(literalLength >= 15)
+		op = WriteLength(op, literalLength - 15);
+	memcpy(op, anchor, literalLength);
+	op += literalLength;
+
+	return size_t(op - out);
+}
+
+// bounds-checked decompressor; never reads or writes outside the buffers,
+// even if the input is corrupted.
+static Status DecompressBlock(const u8* in, size_t inSize, u8* out, size_t outSize, size_t& outProduced)
+{
+	const u8* ip = in;
+	const u8* const iend = in + inSize;
+	u8* op = out;
+	u8* const oend = out + outSize;
+
+	for(;;)
+	{
+		if(ip >= iend)
+			WARN_RETURN(ERR::CORRUPTED);
+		const u8 token = *ip++;
+
+		size_t literalLength = token >> 4;
+		if(literalLength == 15 && !ReadLength(ip, iend, literalLength))
+			WARN_RETURN(ERR::CORRUPTED);
+		if(literalLength > size_t(iend - ip) || literalLength > size_t(oend - op))
+			WARN_RETURN(ERR::CORRUPTED);
+		memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		// the last sequence has no match
+		if(ip == iend)
+			break;
+
+		if(iend - ip < 2)
+			WARN_RETURN(ERR::CORRUPTED);
+		const size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+		ip += 2;
+		if(offset == 0 || offset > size_t(op - out))
+			WARN_RETURN(ERR::CORRUPTED);
+
+		size_t matchLength = token & 15;
+		if(matchLength == 15 && !ReadLength(ip, iend, matchLength))
+			WARN_RETURN(ERR::CORRUPTED);
+		matchLength += MIN_MATCH;
+		if(matchLength > size_t(oend - op))
+			WARN_RETURN(ERR::CORRUPTED);
+
+		const u8* match = op - offset;
+		if(offset >= matchLength)
+			memcpy(op, match, matchLength);
+		else	// overlapping (e.g. runs); must copy bytewise
+		{
+			for(size_t i = 0; i < matchLength; i++)
+				op[i] = match[i];
+		}
+		op += matchLength;
+	}
+
+	outProduced = size_t(op - out);
+	return INFO::OK;
+}
+
+
+//-----------------------------------------------------------------------------
+
+class Codec_LZ4 : public ICodec
+{
+public:
+	u32 UpdateChecksum(u32 checksum, const u8* in, size_t inSize) const
+	{
+#if CODEC_COMPUTE_CHECKSUM
+		return (u32)crc32(checksum, in, (uInt)inSize);
+#else
+		UNUSED2(checksum);
+		UNUSED2(in);
+		UNUSED2(inSize);
+		return 0;
+#endif
+	}
+
+protected:
+	u32 InitializeChecksum()
+	{
+#if CODEC_COMPUTE_CHECKSUM
+		return crc32(0, 0, 0);
+#else
+		return 0;
+#endif
+	}
+
+	// holds the block that is currently being assembled
+	std::vector<u8> m_block;
+	u32 m_checksum;
+};
+
+
+//-----------------------------------------------------------------------------
+
+class Compressor_LZ4 : public Codec_LZ4
+{
+public:
+	Compressor_LZ4()
+		: m_table(size_t(1) << HASH_BITS)
+	{
+		m_block.reserve(BLOCK_SIZE);
+		Reset();
+	}
+
+	virtual size_t MaxOutputSize(size_t inSize) const
+	{
+		// blocks that don't compress are stored
+		const size_t numBlocks = (inSize + BLOCK_SIZE-1) / BLOCK_SIZE;
+		return inSize + numBlocks*BLOCK_HEADER_SIZE;
+	}
+
+	virtual Status Reset()
+	{
+		m_checksum = InitializeChecksum();
+		m_block.clear();
+		m_out = 0;
+		m_outSize = 0;
+		return INFO::OK;
+	}
+
+	virtual Status Process(const u8* in, size_t inSize, u8* out, size_t outSize, size_t& inConsumed, size_t& outProduced)
+	{
+		m_checksum = UpdateChecksum(m_checksum, in, inSize);
+
+		outProduced = 0;
+		for(size_t pos = 0; pos < inSize; )
+		{
+			const size_t copySize = std::min(inSize - pos, BLOCK_SIZE - m_block.size());
+			m_block.insert(m_block.end(), in + pos, in + pos + copySize);
+			pos += copySize;
+
+			if(m_block.size() == BLOCK_SIZE)
+			{
+				size_t blockSize;
+				RETURN_STATUS_IF_ERR(FlushBlock(out + outProduced, outSize - outProduced, blockSize));
+				outProduced += blockSize;
+			}
+		}
+		inConsumed = inSize;
+
+		// (Finish doesn't receive the output buffer, so remember where
+		// the remaining data goes.)
+		m_out = out + outProduced;
+		m_outSize = outSize - outProduced;
+		return INFO::OK;
+	}
+
+	virtual Status Finish(u32& checksum, size_t& outProduced)
+	{
+		outProduced = 0;
+		if(!m_block.empty())
+			RETURN_STATUS_IF_ERR(FlushBlock(m_out, m_outSize, outProduced));
+
+		checksum = m_checksum;
+		return INFO::OK;
+	}
+
+private:
+	Status FlushBlock(u8* out, size_t outSize, size_t& outProduced)
+	{
+		const size_t size = m_block.size();
+		if(outSize < BLOCK_HEADER_SIZE + size)	// MaxOutputSize guarantees this much space
+			WARN_RETURN(ERR::INVALID_PARAM);
+
+		// only keep the compressed version if it's smaller
+		size_t csize = CompressBlock(&m_block[0], size, out + BLOCK_HEADER_SIZE, size-1, &m_table[0]);
+		if(csize)
+			write_le32(out, u32(csize));
+		else
+		{
+			csize = size;
+			memcpy(out + BLOCK_HEADER_SIZE, &m_block[0], size);
+			write_le32(out, u32(csize) | BLOCK_STORED);
+		}
+
+		outProduced = BLOCK_HEADER_SIZE + csize;
+		m_block.clear();
+		return INFO::OK;
+	}
+
+	std::vector<u32> m_table;
+	u8* m_out;
+	size_t m_outSize;
+};
+
+
+//-----------------------------------------------------------------------------
+
+class Decompressor_LZ4 : public Codec_LZ4
+{
+public:
+	Decompressor_LZ4()
+	{
+		Reset();
+	}
+
+	virtual size_t MaxOutputSize(size_t inSize) const
+	{
+		// see Decompressor_ZLib::MaxOutputSize
+		ENSURE(inSize < 1*MiB);
+
+		return inSize*255;	// each match byte encodes at most 255 output bytes
+	}
+
+	virtual Status Reset()
+	{
+		m_checksum = InitializeChecksum();
+		m_block.clear();
+		return INFO::OK;
+	}
+
+	virtual Status Process(const u8* in, size_t inSize, u8* out, size_t outSize, size_t& inConsumed, size_t& outProduced)
+	{
+		outProduced = 0;
+		size_t pos = 0;
+		while(pos < inSize)
+		{
+			// complete blocks in the input are decoded in place (this is
+			// the usual case for memory-mapped archives); all others are
+			// first assembled in m_block.
+			if(m_block.empty() && inSize - pos >= BLOCK_HEADER_SIZE)
+			{
+				const size_t blockSize = BLOCK_HEADER_SIZE + (read_le32(in + pos) & ~BLOCK_STORED);
+				if(inSize - pos >= blockSize)
+				{
+					size_t produced;
+					RETURN_STATUS_IF_ERR(DecodeBlock(in + pos, out + outProduced, outSize - outProduced, produced));
+					pos += blockSize;
+					outProduced += produced;
+					continue;
+				}
+			}
+
+			size_t wanted = BLOCK_HEADER_SIZE;
+			if(m_block.size() >= BLOCK_HEADER_SIZE)
+			{
+				const size_t csize = read_le32(&m_block[0]) & ~BLOCK_STORED;
+				if(csize == 0 || csize > BLOCK_SIZE)
+					WARN_RETURN(ERR::CORRUPTED);
+				wanted += csize;
+			}
+
+			const size_t copySize = std::min(inSize - pos, wanted - m_block.size());
+			m_block.insert(m_block.end(), in + pos, in + pos + copySize);
+			pos += copySize;
+
+			if(m_block.size() == wanted && wanted > BLOCK_HEADER_SIZE)
+			{
+				size_t produced;
+				RETURN_STATUS_IF_ERR(DecodeBlock(&m_block[0], out + outProduced, outSize - outProduced, produced));
+				outProduced += produced;
+				m_block.clear();
+			}
+		}
+		inConsumed = inSize;
+
+		return INFO::OK;
+	}
+
+	virtual Status Finish(u32& checksum, size_t& outProduced)
+	{
+		// all complete blocks have already been decoded
+		outProduced = 0;
+		if(!m_block.empty())
+			WARN_RETURN(ERR::CORRUPTED);
+
+		checksum = m_checksum;
+		return INFO::OK;
+	}
+
+private:
+	// @param block the header followed by all of the block data
+	Status DecodeBlock(const u8* block, u8* out, size_t outSize, size_t& outProduced)
+	{
+		const u32 header = read_le32(block);
+		const size_t csize = header & ~BLOCK_STORED;
+		const u8* data = block + BLOCK_HEADER_SIZE;
+		const size_t maxSize = std::min(outSize, BLOCK_SIZE);
+
+		if(header & BLOCK_STORED)
+		{
+			if(csize > maxSize)
+				WARN_RETURN(ERR::CORRUPTED);
+			memcpy(out, data, csize);
+			outProduced = csize;
+		}
+		else
+			RETURN_STATUS_IF_ERR(DecompressBlock(data, csize, out, maxSize, outProduced));
+
+		m_checksum = UpdateChecksum(m_checksum, out, outProduced);
+		return INFO::OK;
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+
+PICodec CreateCompressor_LZ4()
+{
+	return PICodec(new Compressor_LZ4);
+}
+
+PICodec CreateDecompressor_LZ4()
+{
+	return PICodec(new Decompressor_LZ4);
+}
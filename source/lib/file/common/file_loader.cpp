@@ -26,3 +26,8 @@
 /*virtual*/ IFileLoader::~IFileLoader()
 {
 }
+
+/*virtual*/ Status IFileLoader::LoadView(const OsPath& UNUSED(name), shared_ptr<u8>& UNUSED(buf), size_t UNUSED(size)) const
+{
+	return INFO::SKIPPED;
+}
@@ -34,6 +34,16 @@ struct IFileLoader
 	virtual OsPath Path() const = 0;
 
 	virtual Status Load(const OsPath& name, const shared_ptr<u8>& buf, size_t size) const = 0;
+
+	/**
+	 * return a buffer that refers to the file contents without copying
+	 * them (e.g. within a memory-mapped archive), if possible.
+	 * writes to the buffer do not affect the underlying file.
+	 *
+	 * @return INFO::SKIPPED if not possible (the default); the caller
+	 * should then allocate a buffer and Load the file into it.
+	 **/
+	virtual Status LoadView(const OsPath& name, shared_ptr<u8>& buf, size_t size) const;
 };
 
 typedef shared_ptr<IFileLoader> PIFileLoader;
@@ -194,17 +194,24 @@ public:
 			size = file->Size();
 			if(size != 0)	// (the file cache can't handle zero-length allocations)
 			{
-				if(size < m_cacheSize/2)	// (avoid evicting lots of previous data)
-					fileContents = m_fileCache.Reserve(size);
-				if(fileContents)
+				// files that can be used in place (e.g. stored entries of
+				// memory-mapped archives) needn't be copied nor cached.
+				const Status viewStatus = file->Loader()->LoadView(file->Name(), fileContents, size);
+				RETURN_STATUS_IF_ERR(viewStatus);
+				if(viewStatus != INFO::OK)
 				{
-					RETURN_STATUS_IF_ERR(file->Loader()->Load(file->Name(), fileContents, file->Size()));
-					m_fileCache.Add(pathname, fileContents, size);
-				}
-				else
-				{
-					RETURN_STATUS_IF_ERR(AllocateAligned(fileContents, size, maxSectorSize));
-					RETURN_STATUS_IF_ERR(file->Loader()->Load(file->Name(), fileContents, file->Size()));
+					if(size < m_cacheSize/2)	// (avoid evicting lots of previous data)
+						fileContents = m_fileCache.Reserve(size);
+					if(fileContents)
+					{
+						RETURN_STATUS_IF_ERR(file->Loader()->Load(file->Name(), fileContents, file->Size()));
+						m_fileCache.Add(pathname, fileContents, size);
+					}
+					else
+					{
+						RETURN_STATUS_IF_ERR(AllocateAligned(fileContents, size, maxSectorSize));
+						RETURN_STATUS_IF_ERR(file->Loader()->Load(file->Name(), fileContents, file->Size()));
+					}
 				}
 			}
 		}
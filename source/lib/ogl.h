@@ -111,6 +111,13 @@ extern const char* ogl_ExtensionString();
 #ifndef GL_ARB_framebuffer_object
 # define GL_INVALID_FRAMEBUFFER_OPERATION 0x0506
 #endif
+#ifndef GL_ARB_texture_float
+# define GL_RGBA32F_ARB 0x8814
+#endif
+#ifndef GL_ARB_get_program_binary
+# define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+# define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
 // Also need some more for OS X 10.5:
 #ifndef GL_EXT_texture_array
 # define GL_MAX_ARRAY_TEXTURE_LAYERS_EXT 0x88FF
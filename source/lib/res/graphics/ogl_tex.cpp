@@ -185,7 +185,7 @@ static int default_q_flags = OGL_TEX_FULL_QUALITY;	// OglTexQualityFlags
 
 static bool q_flags_valid(int q_flags)
 {
-	const size_t bits = OGL_TEX_FULL_QUALITY|OGL_TEX_HALF_BPP|OGL_TEX_HALF_RES;
+	const size_t bits = OGL_TEX_FULL_QUALITY|OGL_TEX_HALF_BPP|OGL_TEX_REDUCE_RES_MASK;
 	// unrecognized bits are set - invalid
 	if((q_flags & ~bits) != 0)
 		return false;
@@ -692,6 +692,26 @@ Status ogl_tex_set_anisotropy(Handle ht, GLfloat anisotropy)
 }
 
 
+// skip uploading the top <levels> mip levels (see OGL_TEX_REDUCE_RES_MASK).
+// must be called before uploading (raises a warning if called afterwards).
+Status ogl_tex_reduce_res(Handle ht, size_t levels)
+{
+	H_DEREF(ht, OglTex, ot);
+
+	if(levels == 0)
+		return INFO::OK;
+
+	const size_t total = std::min((ot->q_flags & OGL_TEX_REDUCE_RES_MASK) + levels, (size_t)OGL_TEX_REDUCE_RES_MASK);
+	const u8 q_flags = u8((ot->q_flags & ~(OGL_TEX_REDUCE_RES_MASK|OGL_TEX_FULL_QUALITY)) | total);
+	if(ot->q_flags != q_flags)
+	{
+		warn_if_uploaded(ht, ot);
+		ot->q_flags = q_flags;
+	}
+	return INFO::OK;
+}
+
+
 //----------------------------------------------------------------------------
 // upload
 //----------------------------------------------------------------------------
@@ -852,9 +872,12 @@ static Status get_mipmaps(Tex* t, GLint filter, int q_flags, int* plevels_to_ski
 		//
 		// note: we don't just use GL_TEXTURE_BASE_LEVEL because it would
 		// require uploading unused levels, which is wasteful.
-		// .. can be expanded to reduce to 1/4, 1/8 by encoding factor in q_flags.
-		if(q_flags & OGL_TEX_HALF_RES)
-			(*plevels_to_skip)++;
+		// .. reduced to 1/2, 1/4, 1/8, .. by the factor encoded in q_flags.
+		*plevels_to_skip += q_flags & OGL_TEX_REDUCE_RES_MASK;
+
+		// (but keep at least the smallest level)
+		while(*plevels_to_skip > 0 && (t->w >> *plevels_to_skip) == 0 && (t->h >> *plevels_to_skip) == 0)
+			(*plevels_to_skip)--;
 	}
 
 	return INFO::OK;
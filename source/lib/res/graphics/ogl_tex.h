@@ -189,10 +189,17 @@ enum OglTexQualityFlags
 	 * which are not affected by OGL_TEX_HALF_BPP.
 	 * currently only implemented for images that contain mipmaps
 	 * (otherwise, we'd have to resample, which is slow).
-	 * note: scaling down to 1/4, 1/8, .. is easily possible without
-	 * extra work, so we leave some bits free for that.
+	 * note: scaling down to 1/4, 1/8, .. is done by storing the number
+	 * of levels to skip in the bits of OGL_TEX_REDUCE_RES_MASK
+	 * (see ogl_tex_reduce_res).
 	 */
-	OGL_TEX_HALF_RES = 0x01
+	OGL_TEX_HALF_RES = 0x01,
+
+	/**
+	 * bits holding the number of top (high-resolution) mip levels to skip
+	 * when uploading; OGL_TEX_HALF_RES is the same as skipping 1 level.
+	 */
+	OGL_TEX_REDUCE_RES_MASK = 0x0F
 };
 
 /**
@@ -309,6 +316,20 @@ extern Status ogl_tex_set_wrap(Handle ht, GLint wrap_s, GLint wrap_t);
 */
 extern Status ogl_tex_set_anisotropy(Handle ht, GLfloat anisotropy);
 
+/**
+* Skip uploading the given number of top mip levels of the texture, in
+* addition to the reduction from its quality flags. This is used to
+* reduce the memory used by textures that don't need the full resolution.
+* Only has an effect for textures that contain mipmaps.
+*
+* @param ht Texture handle
+* @param levels number of mip levels to skip
+* @return Status
+*
+* Must be called before uploading (raises a warning if called afterwards).
+*/
+extern Status ogl_tex_reduce_res(Handle ht, size_t levels);
+
 
 //
 // upload
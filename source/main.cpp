@@ -39,6 +39,7 @@ that of Atlas depending on commandline parameters.
 #include "lib/ogl.h"
 #include "lib/timer.h"
 #include "lib/external_libraries/libsdl.h"
+#include "lib/sysdep/os_cpu.h"
 
 #include "ps/ArchiveBuilder.h"
 #include "ps/CConsole.h"
@@ -458,7 +459,10 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 		return;
 
 	// run non-visual simulation replay if requested
-	if (args.Has("replay"))
+	// (-replay-fast=... skips all the per-turn output, and reports the performance;
+	// if it's given several times, the replays are verified in -replay-jobs=N parallel processes;
+	// -replay-seek=N starts from the replay's last keyframe before turn N)
+	if (args.Has("replay") || args.Has("replay-fast"))
 	{
 		// TODO: Support mods
 		Paths paths(args);
@@ -466,10 +470,23 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 		g_VFS->Mount(L"cache/", paths.Cache(), VFS_MOUNT_ARCHIVABLE);
 		g_VFS->Mount(L"", paths.RData()/"mods"/"public", VFS_MOUNT_MUST_EXIST);
 
+		std::vector<CStr> fastReplays = args.GetMultiple("replay-fast");
+		if (fastReplays.size() > 1 || args.Has("replay-jobs"))
 		{
+			size_t jobs = 1;
+			if (args.Has("replay-jobs"))
+				jobs = args.Get("replay-jobs").empty() ? os_cpu_NumProcessors() : args.Get("replay-jobs").ToUInt();
+			std::vector<std::string> replayPaths(fastReplays.begin(), fastReplays.end());
+			CReplayPlayer::VerifyReplays(replayPaths, jobs);
+		}
+		else
+		{
+			bool fast = args.Has("replay-fast");
 			CReplayPlayer replay;
-			replay.Load(args.Get("replay"));
-			replay.Replay();
+			replay.Load(fast ? args.Get("replay-fast") : args.Get("replay"));
+			if (args.Has("replay-seek"))
+				replay.SetSeekTurn(args.Get("replay-seek").ToUInt());
+			replay.Replay(fast);
 		}
 
 		g_VFS.reset();
@@ -0,0 +1,153 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+// Implementation of the xxHash64 algorithm, following the
+// specification at https://github.com/Cyan4973/xxHash
+
+#include "XXH64.h"
+
+static const u64 PRIME64_1 = 0x9E3779B185EBCA87ull;
+static const u64 PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+static const u64 PRIME64_3 = 0x165667B19E3779F9ull;
+static const u64 PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+static const u64 PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+static inline u64 Rotl64(u64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline u64 Read64(const u8* p)
+{
+	u64 v;
+	memcpy(&v, p, sizeof(v)); // ignores alignment
+	return to_le64(v);
+}
+
+static inline u32 Read32(const u8* p)
+{
+	u32 v;
+	memcpy(&v, p, sizeof(v));
+	return to_le32(v);
+}
+
+static inline u64 Round(u64 acc, u64 input)
+{
+	acc += input * PRIME64_2;
+	acc = Rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline u64 MergeRound(u64 acc, u64 val)
+{
+	acc ^= Round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+XXH64::XXH64(u64 seed) :
+	m_BufLen(0), m_InputLen(0), m_Seed(seed)
+{
+	m_State[0] = seed + PRIME64_1 + PRIME64_2;
+	m_State[1] = seed + PRIME64_2;
+	m_State[2] = seed;
+	m_State[3] = seed - PRIME64_1;
+}
+
+void XXH64::Transform(const u8* in)
+{
+	m_State[0] = Round(m_State[0], Read64(in));
+	m_State[1] = Round(m_State[1], Read64(in + 8));
+	m_State[2] = Round(m_State[2], Read64(in + 16));
+	m_State[3] = Round(m_State[3], Read64(in + 24));
+}
+
+void XXH64::UpdateRest(const u8* data, size_t len)
+{
+	const size_t CHUNK_SIZE = sizeof(m_Buf);
+
+	// Add as much data as possible to the buffer
+	size_t n = CHUNK_SIZE - m_BufLen;
+	memcpy(m_Buf + m_BufLen, data, n);
+	data += n;
+	len -= n;
+
+	// Flush the (now full) buffer
+	Transform(m_Buf);
+
+	// Process whole chunks of the input
+	while (len >= CHUNK_SIZE)
+	{
+		Transform(data);
+		data += CHUNK_SIZE;
+		len -= CHUNK_SIZE;
+	}
+
+	// Fill the buffer with the remaining input
+	memcpy(m_Buf, data, len);
+	m_BufLen = len;
+}
+
+void XXH64::Final(u8* digest)
+{
+	u64 h;
+	if (m_InputLen >= sizeof(m_Buf))
+	{
+		h = Rotl64(m_State[0], 1) + Rotl64(m_State[1], 7) + Rotl64(m_State[2], 12) + Rotl64(m_State[3], 18);
+		h = MergeRound(h, m_State[0]);
+		h = MergeRound(h, m_State[1]);
+		h = MergeRound(h, m_State[2]);
+		h = MergeRound(h, m_State[3]);
+	}
+	else
+	{
+		h = m_Seed + PRIME64_5;
+	}
+
+	h += m_InputLen;
+
+	// Process the remaining buffered bytes
+	const u8* p = m_Buf;
+	const u8* end = m_Buf + m_BufLen;
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= Round(0, Read64(p));
+		h = Rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= (u64)Read32(p) * PRIME64_1;
+		h = Rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+	{
+		h ^= (*p) * PRIME64_5;
+		h = Rotl64(h, 11) * PRIME64_1;
+	}
+
+	// Final mixing
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	for (size_t i = 0; i < DIGESTSIZE; ++i)
+		digest[i] = (u8)(h >> (56 - 8*i));
+}
@@ -0,0 +1,103 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "maths/XXH64.h"
+
+class TestXXH64 : public CxxTest::TestSuite
+{
+public:
+	std::string decode(u8* digest)
+	{
+		char digeststr[XXH64::DIGESTSIZE*2+1];
+		for (size_t i = 0; i < XXH64::DIGESTSIZE; ++i)
+			sprintf_s(digeststr+2*i, 3, "%02x", (unsigned int)digest[i]);
+		return digeststr;
+	}
+
+	void compare(const char* input, const char* expected)
+	{
+		u8 digest[XXH64::DIGESTSIZE];
+
+		XXH64 h;
+		h.Update((const u8*)input, strlen(input));
+		h.Final(digest);
+
+		TSM_ASSERT_STR_EQUALS(input, decode(digest), expected);
+	}
+
+	void test_reference()
+	{
+		// Matches output from the reference implementation (xxhsum -H1)
+		compare("", "ef46db3751d8e999");
+		compare("a", "d24ec4f1a98c6e5b");
+		compare("abc", "44bc2cf5ad770999");
+		compare("Nobody inspects the spammish repetition", "fbcea83c8a378bf1");
+	}
+
+	void test_align_long()
+	{
+		// Make sure it's not sensitive to alignment
+		// when processing long chunks (where it won't memcpy to an intermediate buffer)
+		std::string a0 (1000, 'a');
+		std::string a1 ("?" + a0);
+		std::string a2 ("??" + a0);
+		std::string a3 ("???" + a0);
+		compare(a0.c_str()+0, "56e43b712eda4223");
+		compare(a1.c_str()+1, "56e43b712eda4223");
+		compare(a2.c_str()+2, "56e43b712eda4223");
+		compare(a3.c_str()+3, "56e43b712eda4223");
+	}
+
+	void test_chunks()
+	{
+		u8 digest[XXH64::DIGESTSIZE];
+
+		const u8* in = (const u8*)"12345678901234567890123456789012345678901234567890123456789012345678901234567890";
+		size_t len = 80;
+		const char* expected = "e04a477f19ee145d";
+
+		// Process in one chunk
+		{
+			XXH64 h;
+			h.Update(in, len);
+			h.Final(digest);
+			TS_ASSERT_STR_EQUALS(decode(digest), expected);
+		}
+
+		// Process one byte at a time
+		{
+			XXH64 h;
+			for (size_t i = 0; i < len; ++i)
+				h.Update(in+i, 1);
+			h.Final(digest);
+			TS_ASSERT_STR_EQUALS(decode(digest), expected);
+		}
+
+		// Process in chunks that straddle the internal buffer
+		{
+			XXH64 h;
+			h.Update(in, 31);
+			h.Update(in+31, 2);
+			h.Update(in+33, 0);
+			h.Update(in+33, len-33);
+			h.Final(digest);
+			TS_ASSERT_STR_EQUALS(decode(digest), expected);
+		}
+	}
+};
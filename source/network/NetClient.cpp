@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -49,12 +49,25 @@ public:
 	{
 	}
 
+	virtual bool OnData(const std::string& data)
+	{
+		// Decompress the state while it's downloading, instead of all at once
+		// after the whole (potentially large) compressed buffer has arrived
+		return m_Decompressor.Decompress((const u8*)data.data(), data.size());
+	}
+
 	virtual void OnComplete()
 	{
 		// We've received the game state from the server
 
+		if (!m_Decompressor.IsComplete())
+		{
+			LOGERROR(L"Net client: Truncated rejoin game state");
+			return;
+		}
+
 		// Save it so we can use it after the map has finished loading
-		m_Client.m_JoinSyncBuffer = m_Buffer;
+		m_Client.m_JoinSyncBuffer.swap(m_Decompressor.GetOutput());
 
 		// Pretend the server told us to start the game
 		CGameStartMessage start;
@@ -63,6 +76,7 @@ public:
 
 private:
 	CNetClient& m_Client;
+	CZLibStreamDecompressor m_Decompressor;
 };
 
 CNetClient::CNetClient(CGame* game) :
@@ -264,19 +278,17 @@ bool CNetClient::HandleMessage(CNetMessage* message)
 		// TODO: we should support different transfer request types, instead of assuming
 		// it's always requesting the simulation state
 
-		std::stringstream stream;
-
 		LOGMESSAGERENDER(L"Serializing game at turn %u for rejoining player", m_ClientTurnManager->GetCurrentTurn());
 		u32 turn = to_le32(m_ClientTurnManager->GetCurrentTurn());
-		stream.write((char*)&turn, sizeof(turn));
+		std::string state((const char*)&turn, sizeof(turn));
 
-		bool ok = m_Game->GetSimulation2()->SerializeState(stream);
+		bool ok = m_Game->GetSimulation2()->SerializeState(state);
 		ENSURE(ok);
 
 		// Compress the content with zlib to save bandwidth
 		// (TODO: if this is still too large, compressing with e.g. LZMA works much better)
 		std::string compressed;
-		CompressZLib(stream.str(), compressed, true);
+		CompressZLib(state, compressed, true);
 
 		m_Session->GetFileTransferer().StartResponse(reqMessage->m_RequestID, compressed);
 
@@ -296,19 +308,18 @@ void CNetClient::LoadFinished()
 	{
 		// We're rejoining a game, and just finished loading the initial map,
 		// so deserialize the saved game state now
+		// (which was already decompressed as it was received)
 
-		std::string state;
-		DecompressZLib(m_JoinSyncBuffer, state, true);
-
-		std::stringstream stream(state);
+		const std::string& state = m_JoinSyncBuffer;
 
 		u32 turn;
-		stream.read((char*)&turn, sizeof(turn));
+		ENSURE(state.size() >= sizeof(turn));
+		memcpy(&turn, state.data(), sizeof(turn));
 		turn = to_le32(turn);
 
 		LOGMESSAGE(L"Rejoining client deserializing state at turn %u\n", turn);
 
-		bool ok = m_Game->GetSimulation2()->DeserializeState(stream);
+		bool ok = m_Game->GetSimulation2()->DeserializeState((const u8*)state.data() + sizeof(turn), state.size() - sizeof(turn));
 		ENSURE(ok);
 
 		m_ClientTurnManager->ResetState(turn, turn);
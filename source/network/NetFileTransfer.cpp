@@ -28,7 +28,6 @@ Status CNetFileTransferer::HandleMessageReceive(const CNetMessage* message)
 		shared_ptr<CNetFileReceiveTask> task = m_FileReceiveTasks[respMessage->m_RequestID];
 
 		task->m_Length = respMessage->m_Length;
-		task->m_Buffer.reserve(respMessage->m_Length);
 
 		LOGMESSAGERENDER(L"Downloading data over network (%d KB) - please wait...", (int)(task->m_Length/1024));
 		m_LastProgressReportTime = timer_Time();
@@ -47,11 +46,17 @@ Status CNetFileTransferer::HandleMessageReceive(const CNetMessage* message)
 
 		shared_ptr<CNetFileReceiveTask> task = m_FileReceiveTasks[dataMessage->m_RequestID];
 
-		task->m_Buffer += dataMessage->m_Data;
+		task->m_ReceivedLength += dataMessage->m_Data.size();
 
-		if (task->m_Buffer.size() > task->m_Length)
+		if (task->m_ReceivedLength > task->m_Length)
 		{
-			LOGERROR(L"Net transfer: Invalid size for file transfer data (length=%d actual=%d)", (int)task->m_Length, (int)task->m_Buffer.size());
+			LOGERROR(L"Net transfer: Invalid size for file transfer data (length=%d actual=%d)", (int)task->m_Length, (int)task->m_ReceivedLength);
+			return ERR::FAIL;
+		}
+
+		if (!task->OnData(dataMessage->m_Data))
+		{
+			LOGERROR(L"Net transfer: Invalid file transfer data (id=%d)", (int)dataMessage->m_RequestID);
 			return ERR::FAIL;
 		}
 
@@ -60,7 +65,7 @@ Status CNetFileTransferer::HandleMessageReceive(const CNetMessage* message)
 		ackMessage.m_NumPackets = 1; // TODO: would be nice to send a single ack for multiple packets at once
 		m_Session->SendMessage(&ackMessage);
 
-		if (task->m_Buffer.size() == task->m_Length)
+		if (task->m_ReceivedLength == task->m_Length)
 		{
 			LOGMESSAGERENDER(L"Download completed");
 
@@ -75,7 +80,7 @@ Status CNetFileTransferer::HandleMessageReceive(const CNetMessage* message)
 		double t = timer_Time();
 		if (t > m_LastProgressReportTime + 0.5)
 		{
-			LOGMESSAGERENDER(L"Downloading data: %.1f%% of %d KB", 100.f*task->m_Buffer.size()/task->m_Length, (int)(task->m_Length/1024));
+			LOGMESSAGERENDER(L"Downloading data: %.1f%% of %d KB", 100.f*task->m_ReceivedLength/task->m_Length, (int)(task->m_Length/1024));
 			m_LastProgressReportTime = t;
 		}
 
@@ -102,6 +107,18 @@ Status CNetFileTransferer::HandleMessageReceive(const CNetMessage* message)
 
 		task.packetsInFlight -= ackMessage->m_NumPackets;
 
+		// Packets are delivered in order, so the acks are too
+		double t = timer_Time();
+		for (size_t i = 0; i < ackMessage->m_NumPackets; ++i)
+		{
+			UpdateWindowSize(task, t - task.sendTimes.front(), t);
+			task.sendTimes.pop_front();
+		}
+
+		// Forget about the task once it has been entirely received
+		if (task.packetsInFlight == 0 && task.offset == task.buffer.size())
+			m_FileSendTasks.erase(ackMessage->m_RequestID);
+
 		return INFO::OK;
 	}
 
@@ -129,6 +146,8 @@ void CNetFileTransferer::StartResponse(u32 requestID, const std::string& data)
 	task.offset = 0;
 	task.packetsInFlight = 0;
 	task.maxWindowSize = DEFAULT_FILE_TRANSFER_WINDOW_SIZE;
+	task.minRoundTripTime = std::numeric_limits<double>::max();
+	task.lastBackoffTime = 0;
 
 	m_FileSendTasks[task.requestID] = task;
 	CFileTransferResponseMessage respMessage;
@@ -137,10 +156,34 @@ void CNetFileTransferer::StartResponse(u32 requestID, const std::string& data)
 	m_Session->SendMessage(&respMessage);
 }
 
+void CNetFileTransferer::UpdateWindowSize(CNetFileSendTask& task, double roundTripTime, double time)
+{
+	// This is a simple delay-based congestion control: the minimum round-trip time
+	// approximates the latency of the connection, so if packets take much longer than
+	// that then they're being queued (in ENet or in the network) because we're sending
+	// them faster than the connection can handle. Otherwise we can send them faster.
+	// (The tolerances are large since the receiver only sends acks once per frame.)
+
+	task.minRoundTripTime = std::min(task.minRoundTripTime, roundTripTime);
+
+	if (roundTripTime <= task.minRoundTripTime*1.5 + 0.020)
+	{
+		// Growing by one packet per ack means doubling the window every round trip
+		task.maxWindowSize = std::min(task.maxWindowSize + 1, MAX_FILE_TRANSFER_WINDOW_SIZE);
+	}
+	else if (roundTripTime > task.minRoundTripTime*2 + 0.050 && time > task.lastBackoffTime + roundTripTime)
+	{
+		// Back off (at most once per round trip, so we only react once to each burst of delayed acks)
+		task.maxWindowSize = std::max(task.maxWindowSize*3/4, DEFAULT_FILE_TRANSFER_WINDOW_SIZE);
+		task.lastBackoffTime = time;
+	}
+}
+
 void CNetFileTransferer::Poll()
 {
 	// Find tasks which have fewer packets in flight than their window size,
 	// and send more packets
+	double t = timer_Time();
 	for (FileSendTasksMap::iterator it = m_FileSendTasks.begin(); it != m_FileSendTasks.end(); ++it)
 	{
 		while (it->second.packetsInFlight < it->second.maxWindowSize && it->second.offset < it->second.buffer.size())
@@ -151,9 +194,8 @@ void CNetFileTransferer::Poll()
 			dataMessage.m_Data = it->second.buffer.substr(it->second.offset, packetSize);
 			it->second.offset += packetSize;
 			it->second.packetsInFlight++;
+			it->second.sendTimes.push_back(t);
 			m_Session->SendMessage(&dataMessage);
 		}
 	}
-
-	// TODO: need to garbage-collect finished tasks
 }
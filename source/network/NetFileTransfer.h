@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,7 @@
 #ifndef NETFILETRANSFER_H
 #define NETFILETRANSFER_H
 
+#include <deque>
 #include <map>
 
 class CNetMessage;
@@ -35,6 +36,11 @@ static const size_t DEFAULT_FILE_TRANSFER_PACKET_SIZE = 1024;
 // we can hopefully get windowSize*packetSize*1000/200 = 160KB/s bandwidth
 static const size_t DEFAULT_FILE_TRANSFER_WINDOW_SIZE = 32;
 
+// The window grows while packets are acknowledged without any extra delay (i.e. while
+// they're not being queued up anywhere), up to this size, so that transfers can use
+// most of the bandwidth of fast connections (5MB/s with 200ms latency)
+static const size_t MAX_FILE_TRANSFER_WINDOW_SIZE = 1024;
+
 // Some arbitrary limit to make it slightly harder to use up all of someone's RAM
 static const size_t MAX_FILE_TRANSFER_SIZE = 8*MiB;
 
@@ -46,11 +52,23 @@ static const size_t MAX_FILE_TRANSFER_SIZE = 8*MiB;
 class CNetFileReceiveTask
 {
 public:
-	CNetFileReceiveTask() : m_RequestID(0), m_Length(0) { }
+	CNetFileReceiveTask() : m_RequestID(0), m_Length(0), m_ReceivedLength(0) { }
 	virtual ~CNetFileReceiveTask() {}
 
 	/**
-	 * Called when m_Buffer contains the full received data.
+	 * Called for each packet of data as it arrives.
+	 * The default implementation appends it to m_Buffer; subclasses can override
+	 * this to process the data incrementally instead (e.g. to decompress it).
+	 * Returns false if the data is invalid.
+	 */
+	virtual bool OnData(const std::string& data)
+	{
+		m_Buffer += data;
+		return true;
+	}
+
+	/**
+	 * Called when all the data has been received (and passed to OnData).
 	 */
 	virtual void OnComplete() = 0;
 
@@ -64,6 +82,8 @@ public:
 
 	size_t m_Length;
 
+	size_t m_ReceivedLength;
+
 	std::string m_Buffer;
 };
 
@@ -115,8 +135,16 @@ private:
 		size_t offset;
 		size_t maxWindowSize;
 		size_t packetsInFlight;
+		std::deque<double> sendTimes; // of the packets in flight, for measuring their round-trip time
+		double minRoundTripTime;
+		double lastBackoffTime;
 	};
 
+	/**
+	 * Adjusts the task's window size after a packet was acknowledged with the given round-trip time.
+	 */
+	void UpdateWindowSize(CNetFileSendTask& task, double roundTripTime, double time);
+
 	INetSession* m_Session;
 
 	u32 m_NextRequestID;
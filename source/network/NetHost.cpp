@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 
 #include "lib/external_libraries/enet.h"
 #include "network/NetMessage.h"
+#include "network/Serialization.h"
 #include "ps/CLogger.h"
 
 bool CNetHost::SendMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName)
@@ -46,6 +47,70 @@ bool CNetHost::SendMessage(const CNetMessage* message, ENetPeer* peer, const cha
 	return true;
 }
 
+bool CNetHost::QueueMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName, std::vector<u8>& batch)
+{
+	size_t size = message->GetSerializedLength();
+
+	ENSURE(size); // else we'll fail when accessing the 0th element
+
+	// The receiver uses the size in each message's header to split up the batch,
+	// but that's only 16 bits, so send any larger message on its own
+	if (size > 0xFFFF)
+		return SendBatch(batch, peer) && SendMessage(message, peer, peerName);
+
+	LOGMESSAGE(L"Net: Sending message %hs of size %lu to %hs", message->ToString().c_str(), (unsigned long)size, peerName);
+
+	if (!batch.empty() && batch.size() + size > MAX_BATCH_SIZE)
+	{
+		if (!SendBatch(batch, peer))
+			return false;
+	}
+
+	size_t offset = batch.size();
+	batch.resize(offset + size);
+	message->Serialize(&batch[offset]);
+
+	return true;
+}
+
+bool CNetHost::SendBatch(std::vector<u8>& batch, ENetPeer* peer)
+{
+	if (batch.empty())
+		return true;
+
+	ENetPacket* packet = enet_packet_create(&batch[0], batch.size(), ENET_PACKET_FLAG_RELIABLE);
+	batch.clear();
+	if (!packet)
+	{
+		LOGERROR(L"Net: Failed to construct packet");
+		return false;
+	}
+
+	if (enet_peer_send(peer, DEFAULT_CHANNEL, packet) < 0)
+	{
+		LOGERROR(L"Net: Failed to send packet to peer");
+		return false;
+	}
+
+	return true;
+}
+
+size_t CNetHost::GetMessageLength(const u8* data, size_t dataSize)
+{
+	// Read the size from the standard CNetMessage header (u8 type, u16 size)
+	if (dataSize < 3)
+		return 0;
+
+	const u8* pos = data + 1;
+	size_t size;
+	Deserialize_int_2(pos, size);
+
+	if (size < 3 || size > dataSize)
+		return 0;
+
+	return size;
+}
+
 ENetPacket* CNetHost::CreatePacket(const CNetMessage* message)
 {
 	size_t size = message->GetSerializedLength();
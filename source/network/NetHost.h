@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 #include "ps/CStr.h"
 
 #include <map>
+#include <vector>
 
 /**
  * @file
@@ -76,6 +77,34 @@ public:
 	 */
 	static bool SendMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName);
 
+	/**
+	 * Maximum size of a batch of messages to be sent in a single packet.
+	 * (Individual messages larger than this are still sent, in their own packet.)
+	 */
+	static const size_t MAX_BATCH_SIZE = 16384;
+
+	/**
+	 * Serialise a message and append it to a batch of messages for the given peer,
+	 * which will be transmitted as a single packet by SendBatch.
+	 * If the message would make the batch exceed MAX_BATCH_SIZE, the batch is sent first.
+	 * @param batch buffer of the messages queued so far for this peer
+	 * @return true on success, false on failure
+	 */
+	static bool QueueMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName, std::vector<u8>& batch);
+
+	/**
+	 * Transmit all the messages in the batch (if any) to the given peer, and clear it.
+	 * @return true on success, false on failure
+	 */
+	static bool SendBatch(std::vector<u8>& batch, ENetPeer* peer);
+
+	/**
+	 * Returns the length of the first message in the given packet data
+	 * (since a packet may contain a batch of several messages),
+	 * or 0 if the data is too short to contain a whole message.
+	 */
+	static size_t GetMessageLength(const u8* data, size_t dataSize);
+
 	/**
 	 * Construct an ENet packet by serialising the given message.
 	 * @return NULL on failure
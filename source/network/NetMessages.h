@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,7 +28,7 @@
 
 #define PS_PROTOCOL_MAGIC				0x5073013f		// 'P', 's', 0x01, '?'
 #define PS_PROTOCOL_MAGIC_RESPONSE		0x50630121		// 'P', 'c', 0x01, '!'
-#define PS_PROTOCOL_VERSION				0x01010005		// Arbitrary protocol
+#define PS_PROTOCOL_VERSION				0x01010009		// Arbitrary protocol
 #define PS_DEFAULT_PORT					0x5073			// 'P', 's'
 
 // Defines the list of message types. The order of the list must not change.
@@ -163,6 +163,7 @@ END_NMT_CLASS()
 START_NMT_CLASS_(SyncCheck, NMT_SYNC_CHECK)
 	NMT_FIELD_INT(m_Turn, u32, 4)
 	NMT_FIELD(CStr, m_Hash)
+	NMT_FIELD_INT(m_UpdateTime, u32, 2) // real time (msecs) the client took to simulate the turn
 END_NMT_CLASS()
 
 START_NMT_CLASS_(SyncError, NMT_SYNC_ERROR)
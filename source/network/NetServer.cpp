@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -190,8 +190,9 @@ bool CNetServerWorker::SendMessage(ENetPeer* peer, const CNetMessage* message)
 	ENSURE(m_Host);
 
 	CNetServerSession* session = static_cast<CNetServerSession*>(peer->data);
+	ENSURE(session);
 
-	return CNetHost::SendMessage(message, peer, DebugName(session).c_str());
+	return CNetHost::QueueMessage(message, peer, DebugName(session).c_str(), session->GetOutgoingBatch());
 }
 
 bool CNetServerWorker::Broadcast(const CNetMessage* message)
@@ -240,6 +241,11 @@ void CNetServerWorker::Run()
 		if (m_State == SERVER_STATE_PREGAME && (int)m_PlayerAssignments.size() == m_AutostartPlayers)
 			StartGame();
 
+		// Send everything we queued in this step immediately, instead of
+		// waiting for the next enet_host_service
+		FlushBatches();
+		enet_host_flush(m_Host);
+
 		// Update profiler stats
 		m_Stats->LatchHostState(m_Host);
 	}
@@ -291,6 +297,9 @@ bool CNetServerWorker::RunStep()
 	for (size_t i = 0; i < m_Sessions.size(); ++i)
 		m_Sessions[i]->GetFileTransferer().Poll();
 
+	// Queue up the messages from the above, so they'll be sent by enet_host_service
+	FlushBatches();
+
 	// Process network events:
 
 	ENetEvent event;
@@ -364,15 +373,31 @@ bool CNetServerWorker::RunStep()
 		CNetServerSession* session = static_cast<CNetServerSession*>(event.peer->data);
 		if (session)
 		{
-			// Create message from raw data
-			CNetMessage* msg = CNetMessageFactory::CreateMessage(event.packet->data, event.packet->dataLength, GetScriptInterface());
-			if (msg)
+			// The packet may contain a batch of messages
+			const u8* data = event.packet->data;
+			size_t remaining = event.packet->dataLength;
+			while (remaining)
 			{
-				LOGMESSAGE(L"Net server: Received message %hs of size %lu from %hs", msg->ToString().c_str(), (unsigned long)msg->GetSerializedLength(), DebugName(session).c_str());
-
-				HandleMessageReceive(msg, session);
-
-				delete msg;
+				size_t length = CNetHost::GetMessageLength(data, remaining);
+				if (!length)
+				{
+					LOGERROR(L"Net server: Corrupt packet from %hs", DebugName(session).c_str());
+					break;
+				}
+
+				// Create message from raw data
+				CNetMessage* msg = CNetMessageFactory::CreateMessage(data, length, GetScriptInterface());
+				if (msg)
+				{
+					LOGMESSAGE(L"Net server: Received message %hs of size %lu from %hs", msg->ToString().c_str(), (unsigned long)msg->GetSerializedLength(), DebugName(session).c_str());
+
+					HandleMessageReceive(msg, session);
+
+					delete msg;
+				}
+
+				data += length;
+				remaining -= length;
 			}
 		}
 
@@ -389,6 +414,12 @@ bool CNetServerWorker::RunStep()
 	return true;
 }
 
+void CNetServerWorker::FlushBatches()
+{
+	for (size_t i = 0; i < m_Sessions.size(); ++i)
+		m_Sessions[i]->FlushBatch();
+}
+
 void CNetServerWorker::HandleMessageReceive(const CNetMessage* message, CNetServerSession* session)
 {
 	// Handle non-FSM messages first
@@ -716,7 +747,8 @@ bool CNetServerWorker::OnInGame(void* context, CFsmEvent* event)
 	else if (message->GetType() == (uint)NMT_SYNC_CHECK)
 	{
 		CSyncCheckMessage* syncMessage = static_cast<CSyncCheckMessage*> (message);
-		server.m_ServerTurnManager->NotifyFinishedClientUpdate(session->GetHostID(), syncMessage->m_Turn, syncMessage->m_Hash);
+		server.m_ServerTurnManager->NotifyFinishedClientUpdate(session->GetHostID(), syncMessage->m_Turn, syncMessage->m_Hash,
+			syncMessage->m_UpdateTime, session->GetMeanRTT());
 	}
 	else if (message->GetType() == (uint)NMT_END_COMMAND_BATCH)
 	{
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -137,7 +137,8 @@ public:
 
 	/**
 	 * Set the turn length to a fixed value.
-	 * TODO: we should replace this with some adapative lag-dependent computation.
+	 * If msecs is 0, the turn length will be adapted to the clients' latency and
+	 * simulation performance instead (which is the default).
 	 */
 	void SetTurnLength(u32 msecs);
 
@@ -166,6 +167,8 @@ public:
 
 	/**
 	 * Send a message to the given network peer.
+	 * Messages are queued and combined into a single packet per peer by FlushBatches,
+	 * which is called at the end of each step of the worker thread.
 	 */
 	bool SendMessage(ENetPeer* peer, const CNetMessage* message);
 
@@ -225,8 +228,7 @@ private:
 	ScriptInterface& GetScriptInterface();
 
 	/**
-	 * Set the turn length to a fixed value.
-	 * TODO: we should replace this with some adaptive lag-dependent computation.
+	 * Set the turn length to a fixed value, or 0 for an adaptive turn length.
 	 */
 	void SetTurnLength(u32 msecs);
 
@@ -303,6 +305,11 @@ private:
 	void Run();
 	bool RunStep();
 
+	/**
+	 * Send each session's batch of queued messages.
+	 */
+	void FlushBatches();
+
 	pthread_t m_WorkerThread;
 	CMutex m_WorkerMutex;
 
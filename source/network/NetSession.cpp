@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -130,14 +130,30 @@ void CNetClientSession::Poll()
 
 		case ENET_EVENT_TYPE_RECEIVE:
 		{
-			CNetMessage* msg = CNetMessageFactory::CreateMessage(event.packet->data, event.packet->dataLength, m_Client.GetScriptInterface());
-			if (msg)
+			// The server sends batches of messages in a single packet
+			const u8* data = event.packet->data;
+			size_t remaining = event.packet->dataLength;
+			while (remaining)
 			{
-				LOGMESSAGE(L"Net client: Received message %hs of size %lu from server", msg->ToString().c_str(), (unsigned long)msg->GetSerializedLength());
+				size_t length = CNetHost::GetMessageLength(data, remaining);
+				if (!length)
+				{
+					LOGERROR(L"Net client: Corrupt packet from server");
+					break;
+				}
 
-				m_Client.HandleMessage(msg);
+				CNetMessage* msg = CNetMessageFactory::CreateMessage(data, length, m_Client.GetScriptInterface());
+				if (msg)
+				{
+					LOGMESSAGE(L"Net client: Received message %hs of size %lu from server", msg->ToString().c_str(), (unsigned long)msg->GetSerializedLength());
 
-				delete msg;
+					m_Client.HandleMessage(msg);
+
+					delete msg;
+				}
+
+				data += length;
+				remaining -= length;
 			}
 
 			enet_packet_destroy(event.packet);
@@ -179,6 +195,10 @@ void CNetServerSession::Disconnect(u32 reason)
 {
 	Update((uint)NMT_CONNECTION_LOST, NULL);
 
+	// ENet will send any queued packets before disconnecting,
+	// so make sure our queued messages are included
+	FlushBatch();
+
 	enet_peer_disconnect(m_Peer, reason);
 }
 
@@ -187,7 +207,17 @@ void CNetServerSession::DisconnectNow(u32 reason)
 	enet_peer_disconnect_now(m_Peer, reason);
 }
 
+u32 CNetServerSession::GetMeanRTT() const
+{
+	return m_Peer->roundTripTime;
+}
+
 bool CNetServerSession::SendMessage(const CNetMessage* message)
 {
 	return m_Server.SendMessage(m_Peer, message);
 }
+
+bool CNetServerSession::FlushBatch()
+{
+	return CNetHost::SendBatch(m_OutgoingBatch, m_Peer);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -137,11 +137,27 @@ public:
 	 */
 	void DisconnectNow(u32 reason);
 
+	/**
+	 * Returns ENet's estimate of the mean round-trip time to the client, in msecs.
+	 */
+	u32 GetMeanRTT() const;
+
 	/**
 	 * Send a message to the client.
+	 * The message is queued until the next FlushBatch.
 	 */
 	virtual bool SendMessage(const CNetMessage* message);
 
+	/**
+	 * Transmit all the messages queued by SendMessage, combined into as few packets as possible.
+	 */
+	bool FlushBatch();
+
+	/**
+	 * Returns the serialised messages queued by SendMessage, which haven't been transmitted yet.
+	 */
+	std::vector<u8>& GetOutgoingBatch() { return m_OutgoingBatch; }
+
 	CNetFileTransferer& GetFileTransferer() { return m_FileTransferer; }
 
 private:
@@ -151,6 +167,8 @@ private:
 
 	ENetPeer* m_Peer;
 
+	std::vector<u8> m_OutgoingBatch;
+
 	CStr m_GUID;
 	CStrW m_UserName;
 	u32 m_HostID;
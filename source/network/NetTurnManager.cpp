@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,8 +24,10 @@
 #include "network/NetMessage.h"
 
 #include "gui/GUIManager.h"
+#include "lib/timer.h"
 #include "maths/MathUtil.h"
 #include "ps/CLogger.h"
+#include "ps/Compress.h"
 #include "ps/Profile.h"
 #include "ps/Pyrogenesis.h"
 #include "ps/Replay.h"
@@ -42,6 +44,14 @@ static const int DEFAULT_TURN_LENGTH_SP = 200;
 
 static const int COMMAND_DELAY = 2;
 
+// Bounds for the adaptive multiplayer turn length (in msecs)
+static const u32 MIN_TURN_LENGTH_MP = 200;
+static const u32 MAX_TURN_LENGTH_MP = 1000;
+
+// Maximum decrease of the adaptive turn length per turn (in msecs), so it only
+// shrinks gradually once the clients' latency or simulation time improves
+static const u32 TURN_LENGTH_SHRINK_STEP = 10;
+
 #if 0
 #define NETTURN_LOG(args) debug_printf args
 #else
@@ -150,9 +160,7 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 		if (m_TimeWarpNumTurns && (m_CurrentTurn % m_TimeWarpNumTurns) == 0)
 		{
 			PROFILE3("time warp serialization");
-			std::stringstream stream;
-			m_Simulation2.SerializeState(stream);
-			m_TimeWarpStates.push_back(stream.str());
+			StoreTimeWarpState();
 		}
 
 		// Put all the client commands into a single list, in a globally consistent order
@@ -164,13 +172,17 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 		m_QueuedCommands.pop_front();
 		m_QueuedCommands.resize(m_QueuedCommands.size() + 1);
 
+		SaveReplayKeyframe(m_CurrentTurn-1);
+
 		m_Replay.Turn(m_CurrentTurn-1, m_TurnLength, commands);
 
 		NETTURN_LOG((L"Running %d cmds\n", commands.size()));
 
+		double updateStart = timer_Time();
+
 		m_Simulation2.Update(m_TurnLength, commands);
 
-		NotifyFinishedUpdate(m_CurrentTurn);
+		NotifyFinishedUpdate(m_CurrentTurn, timer_Time() - updateStart);
 
 		// Set the time for the next turn update
 		m_DeltaSimTime -= m_TurnLength / 1000.f;
@@ -208,6 +220,8 @@ bool CNetTurnManager::UpdateFastForward()
 		m_QueuedCommands.pop_front();
 		m_QueuedCommands.resize(m_QueuedCommands.size() + 1);
 
+		SaveReplayKeyframe(m_CurrentTurn-1);
+
 		m_Replay.Turn(m_CurrentTurn-1, m_TurnLength, commands);
 
 		NETTURN_LOG((L"Running %d cmds\n", commands.size()));
@@ -218,6 +232,18 @@ bool CNetTurnManager::UpdateFastForward()
 	return true;
 }
 
+void CNetTurnManager::SaveReplayKeyframe(u32 turn)
+{
+	if (!m_Replay.WantsKeyframe(turn))
+		return;
+
+	PROFILE3("replay keyframe serialization");
+	std::string state;
+	bool ok = m_Simulation2.SerializeState(state);
+	ENSURE(ok);
+	m_Replay.Keyframe(turn, state);
+}
+
 void CNetTurnManager::OnSyncError(u32 turn, const std::string& expectedHash)
 {
 	NETTURN_LOG((L"OnSyncError(%d, %ls)\n", turn, Hexify(expectedHash).c_str()));
@@ -289,8 +315,8 @@ bool CNetTurnManager::TurnNeedsFullHash(u32 turn)
 		return true;
 
 	// Otherwise check the full state every ~10 seconds in multiplayer games
-	// (TODO: should probably remove this when we're reasonably sure the game
-	// isn't too buggy, since the full hash is still pretty slow)
+	// (The quick hashes on other turns cover the native components, but not the
+	// script components, which are what makes the full hash slow)
 	if (turn % 20 == 0)
 		return true;
 
@@ -300,17 +326,74 @@ bool CNetTurnManager::TurnNeedsFullHash(u32 turn)
 void CNetTurnManager::EnableTimeWarpRecording(size_t numTurns)
 {
 	m_TimeWarpStates.clear();
+	m_TimeWarpLatestState.clear();
 	m_TimeWarpNumTurns = numTurns;
 }
 
+static const size_t TIME_WARP_KEYFRAME_INTERVAL = 16;
+
+void CNetTurnManager::StoreTimeWarpState()
+{
+	std::string state;
+	m_Simulation2.SerializeState(state);
+
+	size_t numDeltas = 0;
+	for (std::list<TimeWarpState>::reverse_iterator it = m_TimeWarpStates.rbegin(); it != m_TimeWarpStates.rend() && it->isDelta; ++it)
+		++numDeltas;
+
+	m_TimeWarpStates.push_back(TimeWarpState());
+	TimeWarpState& snapshot = m_TimeWarpStates.back();
+
+	// (The first snapshot is always stored in full, so there's always one to start the chain from)
+	if (m_TimeWarpStates.size() == 1 || numDeltas + 1 >= TIME_WARP_KEYFRAME_INTERVAL)
+	{
+		snapshot.isDelta = false;
+		CompressZLib(state, snapshot.data, true);
+	}
+	else
+	{
+		std::string delta;
+		CompressDelta(m_TimeWarpLatestState, state, delta);
+		snapshot.isDelta = true;
+		CompressZLib(delta, snapshot.data, true);
+	}
+
+	m_TimeWarpLatestState.swap(state);
+}
+
+void CNetTurnManager::DecompressLatestTimeWarpState(std::string& outState)
+{
+	outState.clear();
+	if (m_TimeWarpStates.empty())
+		return;
+
+	// Find the latest full snapshot, then apply the following deltas
+	std::list<TimeWarpState>::const_iterator it = --m_TimeWarpStates.end();
+	while (it->isDelta)
+		--it;
+
+	DecompressZLib(it->data, outState, true);
+
+	std::string delta, state;
+	for (++it; it != m_TimeWarpStates.end(); ++it)
+	{
+		DecompressZLib(it->data, delta, true);
+		DecompressDelta(outState, delta, state);
+		outState.swap(state);
+	}
+}
+
 void CNetTurnManager::RewindTimeWarp()
 {
 	if (m_TimeWarpStates.empty())
 		return;
 
-	std::stringstream stream(m_TimeWarpStates.back());
-	m_Simulation2.DeserializeState(stream);
+	// The latest snapshot is already available uncompressed
+	m_Simulation2.DeserializeState((const u8*)m_TimeWarpLatestState.data(), m_TimeWarpLatestState.size());
+
+	// Reconstruct the one before it, so later snapshots can be stored as deltas against it
 	m_TimeWarpStates.pop_back();
+	DecompressLatestTimeWarpState(m_TimeWarpLatestState);
 
 	// Reset the turn manager state, so we won't execute stray commands and
 	// won't do the next snapshot until the appropriate time.
@@ -323,15 +406,15 @@ void CNetTurnManager::QuickSave()
 {
 	TIMER(L"QuickSave");
 	
-	std::stringstream stream;
-	bool ok = m_Simulation2.SerializeState(stream);
+	std::string state;
+	bool ok = m_Simulation2.SerializeState(state);
 	if (!ok)
 	{
 		LOGERROR(L"Failed to quicksave game");
 		return;
 	}
 
-	m_QuickSaveState = stream.str();
+	CompressZLib(state, m_QuickSaveState, true);
 	if (g_GUI)
 		m_QuickSaveMetadata = g_GUI->GetScriptInterface().StringifyJSON(g_GUI->GetSavedGameData().get(), false);
 	else
@@ -351,8 +434,10 @@ void CNetTurnManager::QuickLoad()
 		return;
 	}
 
-	std::stringstream stream(m_QuickSaveState);
-	bool ok = m_Simulation2.DeserializeState(stream);
+	std::string state;
+	DecompressZLib(m_QuickSaveState, state, true);
+
+	bool ok = m_Simulation2.DeserializeState((const u8*)state.data(), state.size());
 	if (!ok)
 	{
 		LOGERROR(L"Failed to quickload game");
@@ -399,8 +484,10 @@ void CNetClientTurnManager::NotifyFinishedOwnCommands(u32 turn)
 	m_NetClient.SendMessage(&msg);
 }
 
-void CNetClientTurnManager::NotifyFinishedUpdate(u32 turn)
+void CNetClientTurnManager::NotifyFinishedUpdate(u32 turn, double updateTime)
 {
+	double hashStart = timer_Time();
+
 	bool quick = !TurnNeedsFullHash(turn);
 	std::string hash;
 	{
@@ -414,9 +501,14 @@ void CNetClientTurnManager::NotifyFinishedUpdate(u32 turn)
 	m_Replay.Hash(hash, quick);
 
 	// Send message to the server
+	// Report the time taken, including the hash computation, so the server can pick
+	// a turn length that we can keep up with
+	updateTime += timer_Time() - hashStart;
+
 	CSyncCheckMessage msg;
 	msg.m_Turn = turn;
 	msg.m_Hash = hash;
+	msg.m_UpdateTime = (u32)std::min(updateTime * 1000.0, 65535.0);
 	m_NetClient.SendMessage(&msg);
 }
 
@@ -444,7 +536,7 @@ void CNetLocalTurnManager::NotifyFinishedOwnCommands(u32 turn)
 	FinishedAllCommands(turn, m_TurnLength);
 }
 
-void CNetLocalTurnManager::NotifyFinishedUpdate(u32 UNUSED(turn))
+void CNetLocalTurnManager::NotifyFinishedUpdate(u32 UNUSED(turn), double UNUSED(updateTime))
 {
 #if 0 // this hurts performance and is only useful for verifying log replays
 	std::string hash;
@@ -466,7 +558,7 @@ void CNetLocalTurnManager::OnSimulationMessage(CSimulationMessage* UNUSED(msg))
 
 
 CNetServerTurnManager::CNetServerTurnManager(CNetServerWorker& server) :
-	m_NetServer(server), m_ReadyTurn(1), m_TurnLength(DEFAULT_TURN_LENGTH_MP)
+	m_NetServer(server), m_ReadyTurn(1), m_TurnLength(DEFAULT_TURN_LENGTH_MP), m_AdaptiveTurnLength(true)
 {
 	// The first turn we will actually execute is number 2,
 	// so store dummy values into the saved lengths list
@@ -502,6 +594,9 @@ void CNetServerTurnManager::CheckClientsReady()
 	// Advance the turn
 	++m_ReadyTurn;
 
+	if (m_AdaptiveTurnLength)
+		UpdateAdaptiveTurnLength();
+
 	NETTURN_LOG((L"CheckClientsReady: ready for turn %d\n", m_ReadyTurn));
 
 	// Tell all clients that the next turn is ready
@@ -515,12 +610,45 @@ void CNetServerTurnManager::CheckClientsReady()
 	m_SavedTurnLengths.push_back(m_TurnLength);
 }
 
-void CNetServerTurnManager::NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash)
+void CNetServerTurnManager::UpdateAdaptiveTurnLength()
+{
+	u32 maxUpdateTime = 0;
+	for (std::map<int, u32>::iterator it = m_ClientUpdateTimes.begin(); it != m_ClientUpdateTimes.end(); ++it)
+		maxUpdateTime = std::max(maxUpdateTime, it->second);
+
+	u32 maxRoundTripTime = 0;
+	for (std::map<int, u32>::iterator it = m_ClientRoundTripTimes.begin(); it != m_ClientRoundTripTimes.end(); ++it)
+		maxRoundTripTime = std::max(maxRoundTripTime, it->second);
+
+	// Clients send their commands for a turn COMMAND_DELAY turns in advance,
+	// so to avoid stalling, the commands must reach us (and our
+	// end-of-batch message must reach the clients) within that time,
+	// with some allowance for jitter and for clients only updating once per frame.
+	// And clients must be able to simulate a turn in much less than its length,
+	// else they will fall behind (and leave no time for rendering).
+	u32 target = std::max(maxRoundTripTime * 3 / 2 / COMMAND_DELAY + 50, maxUpdateTime * 2);
+	target = clamp(target, MIN_TURN_LENGTH_MP, MAX_TURN_LENGTH_MP);
+
+	// Grow quickly to stop any stalls, but shrink slowly to avoid oscillating
+	if (target > m_TurnLength)
+		m_TurnLength += (target - m_TurnLength + 1) / 2;
+	else
+		m_TurnLength -= std::min(m_TurnLength - target, TURN_LENGTH_SHRINK_STEP);
+}
+
+void CNetServerTurnManager::NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash, u32 updateTime, u32 roundTripTime)
 {
 	// Clients must advance one turn at a time
 	ENSURE(turn == m_ClientsSimulated[client] + 1);
 	m_ClientsSimulated[client] = turn;
 
+	// Smooth out the update times, since they're often spiky (garbage collection, AI, etc)
+	u32& smoothedUpdateTime = m_ClientUpdateTimes[client];
+	smoothedUpdateTime = (smoothedUpdateTime * 7 + updateTime) / 8;
+
+	// (ENet already smooths its RTT estimate)
+	m_ClientRoundTripTimes[client] = roundTripTime;
+
 	m_ClientStateHashes[turn][client] = hash;
 
 	// Find the newest turn which we know all clients have simulated
@@ -578,6 +706,8 @@ void CNetServerTurnManager::UninitialiseClient(int client)
 	ENSURE(m_ClientsReady.find(client) != m_ClientsReady.end());
 	m_ClientsReady.erase(client);
 	m_ClientsSimulated.erase(client);
+	m_ClientUpdateTimes.erase(client);
+	m_ClientRoundTripTimes.erase(client);
 
 	// Check whether we're ready for the next turn now that we're not
 	// waiting for this client any more
@@ -586,7 +716,9 @@ void CNetServerTurnManager::UninitialiseClient(int client)
 
 void CNetServerTurnManager::SetTurnLength(u32 msecs)
 {
-	m_TurnLength = msecs;
+	m_AdaptiveTurnLength = (msecs == 0);
+	if (!m_AdaptiveTurnLength)
+		m_TurnLength = msecs;
 }
 
 u32 CNetServerTurnManager::GetSavedTurnLength(u32 turn)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -148,8 +148,15 @@ protected:
 
 	/**
 	 * Called when this client has finished a simulation update.
+	 * @param updateTime real time taken by the update, in seconds
 	 */
-	virtual void NotifyFinishedUpdate(u32 turn) = 0;
+	virtual void NotifyFinishedUpdate(u32 turn, double updateTime) = 0;
+
+	/**
+	 * Saves the current state as a keyframe in the replay log,
+	 * if the log wants one before the given turn.
+	 */
+	void SaveReplayKeyframe(u32 turn);
 
 	/**
 	 * Returns whether we should compute a complete state hash for the given turn,
@@ -183,9 +190,29 @@ protected:
 	IReplayLogger& m_Replay;
 
 private:
+	/**
+	 * A state snapshot for rewinding, compressed with zlib. To save memory, most are
+	 * stored as a delta against the previous snapshot (see CompressDelta); every
+	 * TIME_WARP_KEYFRAME_INTERVAL'th is stored in full, to limit the length of the delta
+	 * chain that has to be replayed to reconstruct a snapshot.
+	 */
+	struct TimeWarpState
+	{
+		bool isDelta;
+		std::string data;
+	};
+
+	void StoreTimeWarpState();
+
+	/**
+	 * Reconstructs the latest snapshot from m_TimeWarpStates (or returns an empty string if there is none).
+	 */
+	void DecompressLatestTimeWarpState(std::string& outState);
+
 	size_t m_TimeWarpNumTurns; // 0 if disabled
-	std::list<std::string> m_TimeWarpStates;
-	std::string m_QuickSaveState; // TODO: should implement a proper disk-based quicksave system
+	std::list<TimeWarpState> m_TimeWarpStates;
+	std::string m_TimeWarpLatestState; // uncompressed copy of the latest snapshot, to compute deltas against
+	std::string m_QuickSaveState; // zlib-compressed; TODO: should implement a proper disk-based quicksave system
 	std::string m_QuickSaveMetadata;
 };
 
@@ -204,7 +231,7 @@ public:
 protected:
 	virtual void NotifyFinishedOwnCommands(u32 turn);
 
-	virtual void NotifyFinishedUpdate(u32 turn);
+	virtual void NotifyFinishedUpdate(u32 turn, double updateTime);
 
 	CNetClient& m_NetClient;
 };
@@ -224,7 +251,7 @@ public:
 protected:
 	virtual void NotifyFinishedOwnCommands(u32 turn);
 
-	virtual void NotifyFinishedUpdate(u32 turn);
+	virtual void NotifyFinishedUpdate(u32 turn, double updateTime);
 };
 
 
@@ -244,7 +271,12 @@ public:
 
 	void NotifyFinishedClientCommands(int client, u32 turn);
 
-	void NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash);
+	/**
+	 * Called when a client has finished simulating the given turn.
+	 * @param updateTime real time (msecs) the client took to simulate it
+	 * @param roundTripTime current estimate of the network round-trip time (msecs) to the client
+	 */
+	void NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash, u32 updateTime, u32 roundTripTime);
 
 	/**
 	 * Inform the turn manager of a new client who will be sending commands.
@@ -257,6 +289,10 @@ public:
 	 */
 	void UninitialiseClient(int client);
 
+	/**
+	 * Set the turn length to a fixed value, or 0 to adapt it automatically
+	 * to the clients' latency and simulation performance.
+	 */
 	void SetTurnLength(u32 msecs);
 
 	/**
@@ -274,6 +310,11 @@ public:
 protected:
 	void CheckClientsReady();
 
+	/**
+	 * Moves m_TurnLength towards the length that all clients can keep up with.
+	 */
+	void UpdateAdaptiveTurnLength();
+
 	/// The latest turn for which we have received all commands from all clients
 	u32 m_ReadyTurn;
 
@@ -290,6 +331,15 @@ protected:
 	// Current turn length
 	u32 m_TurnLength;
 
+	// Whether m_TurnLength is adapted automatically (else it's only changed by SetTurnLength)
+	bool m_AdaptiveTurnLength;
+
+	// Client ID -> smoothed real time (msecs) taken to simulate a turn
+	std::map<int, u32> m_ClientUpdateTimes;
+
+	// Client ID -> latest network round-trip time (msecs)
+	std::map<int, u32> m_ClientRoundTripTimes;
+
 	// Turn lengths for all previously executed turns
 	std::vector<u32> m_SavedTurnLengths;
 
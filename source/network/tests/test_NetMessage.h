@@ -17,6 +17,7 @@
 
 #include "lib/self_test.h"
 
+#include "network/NetHost.h"
 #include "network/NetMessage.h"
 
 #include "scriptinterface/ScriptInterface.h"
@@ -44,4 +45,33 @@ public:
 		delete msg2;
 		delete[] buf;
 	}
+
+	void test_batch()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		CScriptValRooted val;
+		script.Eval("[4]", val);
+		CSimulationMessage msg1(script, 1, 2, 3, val.get());
+		CEndCommandBatchMessage msg2;
+		msg2.m_Turn = 3;
+		msg2.m_TurnLength = 200;
+
+		// Messages serialised one after another (like a batch) must be separable again
+		size_t len1 = msg1.GetSerializedLength();
+		size_t len2 = msg2.GetSerializedLength();
+		std::vector<u8> buf(len1 + len2);
+		msg1.Serialize(&buf[0]);
+		msg2.Serialize(&buf[len1]);
+
+		TS_ASSERT_EQUALS(CNetHost::GetMessageLength(&buf[0], buf.size()), len1);
+		TS_ASSERT_EQUALS(CNetHost::GetMessageLength(&buf[len1], len2), len2);
+		TS_ASSERT_EQUALS(CNetHost::GetMessageLength(&buf[len1], len2 - 1), (size_t)0);
+		TS_ASSERT_EQUALS(CNetHost::GetMessageLength(&buf[0], 2), (size_t)0);
+
+		CNetMessage* out = CNetMessageFactory::CreateMessage(&buf[len1], len2, script);
+		TS_ASSERT(out);
+		TS_ASSERT_EQUALS(out->GetType(), NMT_END_COMMAND_BATCH);
+		TS_ASSERT_EQUALS(((CEndCommandBatchMessage*)out)->m_TurnLength, (u32)200);
+		delete out;
+	}
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,6 +22,8 @@
 #include "lib/byte_order.h"
 #include "lib/external_libraries/zlib.h"
 
+#include <boost/unordered_map.hpp>
+
 void CompressZLib(const std::string& data, std::string& out, bool includeLengthHeader)
 {
 	uLongf maxCompressedSize = compressBound(data.size());
@@ -61,3 +63,208 @@ void DecompressZLib(const std::string& data, std::string& out, bool includeLengt
 
 	// TODO: better error reporting might be nice
 }
+
+CZLibStreamDecompressor::CZLibStreamDecompressor() :
+	m_Stream(NULL), m_HeaderLength(0), m_Complete(false)
+{
+}
+
+CZLibStreamDecompressor::~CZLibStreamDecompressor()
+{
+	if (m_Stream)
+	{
+		inflateEnd(m_Stream);
+		delete m_Stream;
+	}
+}
+
+bool CZLibStreamDecompressor::Decompress(const u8* data, size_t len)
+{
+	// Read the uncompressed length header first, so we can allocate the whole output
+	while (m_HeaderLength < sizeof(m_Header) && len > 0)
+	{
+		m_Header[m_HeaderLength++] = *data++;
+		--len;
+	}
+
+	if (m_HeaderLength < sizeof(m_Header))
+		return true;
+
+	if (!m_Stream)
+	{
+		m_Output.resize(read_le32(m_Header));
+
+		m_Stream = new z_stream;
+		memset(m_Stream, 0, sizeof(*m_Stream));
+		if (inflateInit(m_Stream) != Z_OK)
+			return false;
+
+		// (This stays valid since m_Output is never resized again)
+		m_Stream->next_out = m_Output.empty() ? NULL : (Bytef*)&m_Output[0];
+		m_Stream->avail_out = (uInt)m_Output.size();
+	}
+
+	if (len == 0)
+		return true;
+
+	if (m_Complete)
+		return false;
+
+	m_Stream->next_in = (Bytef*)data;
+	m_Stream->avail_in = (uInt)len;
+
+	int zok = inflate(m_Stream, Z_NO_FLUSH);
+	if (zok == Z_STREAM_END)
+	{
+		m_Complete = true;
+		return m_Stream->avail_in == 0 && m_Stream->total_out == m_Output.size();
+	}
+
+	// If all the input couldn't be consumed, then there was more data than the header said
+	return zok == Z_OK && m_Stream->avail_in == 0;
+}
+
+/*
+ * Delta format: the length of the output, followed by a sequence of instructions.
+ * Each instruction starts with (len << 1) | isCopy; literals are followed by len bytes
+ * of data, copies by the offset in base to copy len bytes from.
+ * All numbers are stored as variable-length integers, 7 bits per byte (LSB first),
+ * with the top bit set on all but the last byte.
+ *
+ * To find the copies, we index every DELTA_BLOCK_SIZE-aligned block of base by a hash,
+ * then slide a rolling hash over the data looking for matching blocks, and extend every
+ * match as far as possible in both directions.
+ */
+
+static const size_t DELTA_BLOCK_SIZE = 32;
+static const u32 DELTA_HASH_MULTIPLIER = 0x01000193;
+
+static void PutVarint(std::string& out, size_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((char)((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+static size_t GetVarint(const std::string& in, size_t& pos)
+{
+	size_t value = 0;
+	for (size_t shift = 0; ; shift += 7)
+	{
+		ENSURE(pos < in.size() && shift < sizeof(size_t)*8);
+		u8 b = (u8)in[pos++];
+		value |= (size_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return value;
+	}
+}
+
+static u32 HashDeltaBlock(const u8* data)
+{
+	u32 h = 0;
+	for (size_t i = 0; i < DELTA_BLOCK_SIZE; ++i)
+		h = h*DELTA_HASH_MULTIPLIER + data[i];
+	return h;
+}
+
+static void PutDeltaLiteral(std::string& out, const u8* data, size_t len)
+{
+	if (len == 0)
+		return;
+	PutVarint(out, len << 1);
+	out.append((const char*)data, len);
+}
+
+void CompressDelta(const std::string& base, const std::string& data, std::string& out)
+{
+	const u8* b = (const u8*)base.data();
+	const u8* d = (const u8*)data.data();
+	const size_t baseLen = base.size();
+	const size_t dataLen = data.size();
+
+	out.clear();
+	PutVarint(out, dataLen);
+
+	boost::unordered_map<u32, size_t> blocks;
+	blocks.rehash(baseLen / DELTA_BLOCK_SIZE);
+	for (size_t offset = 0; offset + DELTA_BLOCK_SIZE <= baseLen; offset += DELTA_BLOCK_SIZE)
+		blocks.insert(std::make_pair(HashDeltaBlock(b + offset), offset)); // (keeps the first of any duplicates)
+
+	// For removing the oldest byte from the rolling hash
+	u32 topMultiplier = 1;
+	for (size_t i = 1; i < DELTA_BLOCK_SIZE; ++i)
+		topMultiplier *= DELTA_HASH_MULTIPLIER;
+
+	size_t literalStart = 0;
+	size_t pos = 0;
+	u32 h = (dataLen >= DELTA_BLOCK_SIZE) ? HashDeltaBlock(d) : 0;
+	while (pos + DELTA_BLOCK_SIZE <= dataLen)
+	{
+		boost::unordered_map<u32, size_t>::const_iterator it = blocks.find(h);
+		if (it != blocks.end() && memcmp(b + it->second, d + pos, DELTA_BLOCK_SIZE) == 0)
+		{
+			// Extend the match backwards into the pending literal, and forwards as far as possible
+			size_t start = pos;
+			size_t baseStart = it->second;
+			while (start > literalStart && baseStart > 0 && b[baseStart-1] == d[start-1])
+			{
+				--start;
+				--baseStart;
+			}
+
+			size_t len = pos + DELTA_BLOCK_SIZE - start;
+			while (start + len < dataLen && baseStart + len < baseLen && b[baseStart + len] == d[start + len])
+				++len;
+
+			PutDeltaLiteral(out, d + literalStart, start - literalStart);
+			PutVarint(out, (len << 1) | 1);
+			PutVarint(out, baseStart);
+
+			pos = start + len;
+			literalStart = pos;
+			if (pos + DELTA_BLOCK_SIZE <= dataLen)
+				h = HashDeltaBlock(d + pos);
+			continue;
+		}
+
+		if (pos + DELTA_BLOCK_SIZE < dataLen)
+			h = (h - d[pos]*topMultiplier)*DELTA_HASH_MULTIPLIER + d[pos + DELTA_BLOCK_SIZE];
+		++pos;
+	}
+
+	PutDeltaLiteral(out, d + literalStart, dataLen - literalStart);
+}
+
+void DecompressDelta(const std::string& base, const std::string& delta, std::string& out)
+{
+	size_t pos = 0;
+	size_t dataLen = GetVarint(delta, pos);
+
+	out.clear();
+	out.reserve(dataLen);
+
+	while (pos < delta.size())
+	{
+		size_t op = GetVarint(delta, pos);
+		size_t len = op >> 1;
+		if (op & 1)
+		{
+			size_t offset = GetVarint(delta, pos);
+			ENSURE(offset <= base.size() && len <= base.size() - offset);
+			out.append(base, offset, len);
+		}
+		else
+		{
+			ENSURE(len <= delta.size() - pos);
+			out.append(delta, pos, len);
+			pos += len;
+		}
+	}
+
+	ENSURE(out.size() == dataLen);
+
+	// TODO: better error reporting might be nice
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,11 +20,64 @@
 
 /**
  * @file
- * Simple (non-streaming) compression functions.
+ * Simple (mostly non-streaming) compression functions.
  */
 
+struct z_stream_s;
+
 void CompressZLib(const std::string& data, std::string& out, bool includeLengthHeader);
 
 void DecompressZLib(const std::string& data, std::string& out, bool includeLengthHeader);
 
+/**
+ * Decompresses the output of CompressZLib (with includeLengthHeader) incrementally,
+ * so that e.g. data received over the network can be decompressed as it arrives
+ * instead of all at once at the end.
+ */
+class CZLibStreamDecompressor
+{
+	NONCOPYABLE(CZLibStreamDecompressor);
+public:
+	CZLibStreamDecompressor();
+	~CZLibStreamDecompressor();
+
+	/**
+	 * Decompresses the next part of the input.
+	 * Returns false if the data is invalid (including if there is any data
+	 * after the end of the compressed stream).
+	 */
+	bool Decompress(const u8* data, size_t len);
+
+	/**
+	 * Returns whether the whole compressed stream has been decompressed.
+	 */
+	bool IsComplete() const { return m_Complete; }
+
+	/**
+	 * Returns the decompressed data, which is only valid once IsComplete.
+	 * (Callers may swap it out to avoid copying it.)
+	 */
+	std::string& GetOutput() { return m_Output; }
+
+private:
+	z_stream_s* m_Stream; // NULL until the length header has been read
+	u8 m_Header[4];
+	size_t m_HeaderLength;
+	std::string m_Output;
+	bool m_Complete;
+};
+
+/**
+ * Encodes @p data as a delta against @p base: a sequence of instructions to either
+ * copy a range of bytes from @p base or insert literal bytes. This is compact when
+ * the two have long runs of bytes in common (even if they have moved), e.g. successive
+ * serialized simulation states. The delta isn't compressed itself, but compresses well.
+ */
+void CompressDelta(const std::string& base, const std::string& data, std::string& out);
+
+/**
+ * Reconstructs the data that was passed to CompressDelta, given the same @p base.
+ */
+void DecompressDelta(const std::string& base, const std::string& delta, std::string& out);
+
 #endif // INCLUDED_COMPRESS
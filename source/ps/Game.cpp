@@ -21,6 +21,8 @@
 
 #include "graphics/GameView.h"
 #include "graphics/LOSTexture.h"
+#include "graphics/MeshManager.h"
+#include "graphics/ObjectManager.h"
 #include "graphics/ParticleManager.h"
 #include "graphics/UnitManager.h"
 #include "gui/GUIManager.h"
@@ -31,6 +33,7 @@
 #include "network/NetTurnManager.h"
 #include "ps/CConsole.h"
 #include "ps/CLogger.h"
+#include "ps/ConfigDB.h"
 #include "ps/CStr.h"
 #include "ps/Loader.h"
 #include "ps/LoaderThunks.h"
@@ -59,7 +62,7 @@ CGame *g_Game=NULL;
  * Constructor
  *
  **/
-CGame::CGame(bool disableGraphics):
+CGame::CGame(bool disableGraphics, bool replayLog):
 	m_World(new CWorld(this)),
 	m_Simulation2(new CSimulation2(&m_World->GetUnitManager(), m_World->GetTerrain())),
 	m_GameView(disableGraphics ? NULL : new CGameView(this)),
@@ -69,7 +72,10 @@ CGame::CGame(bool disableGraphics):
 	m_PlayerID(-1),
 	m_IsSavedGame(false)
 {
-	m_ReplayLogger = new CReplayLogger(m_Simulation2->GetScriptInterface());
+	if (replayLog)
+		m_ReplayLogger = new CReplayLogger(m_Simulation2->GetScriptInterface());
+	else
+		m_ReplayLogger = new CDummyReplayLogger();
 	// TODO: should use CDummyReplayLogger unless activated by cmd-line arg, perhaps?
 
 	// Need to set the CObjectManager references after various objects have
@@ -210,6 +216,15 @@ PSRETURN CGame::ReallyStartGame()
 	Interpolate(0, 0);
 
 	m_GameStarted=true;
+
+	// Now that the map's actors are ready, load the meshes of new ones in
+	// the background instead of stalling the game
+	if (m_GameView)
+	{
+		bool asyncMeshes = true;
+		CFG_GET_VAL("asyncmeshes", Bool, asyncMeshes);
+		m_GameView->GetObjectManager().GetMeshManager().SetAsyncLoading(asyncMeshes);
+	}
 	
 	// Render a frame to begin loading assets
 	if (CRenderer::IsInitialised())
@@ -65,7 +65,7 @@ class CGame
 	CNetTurnManager* m_TurnManager;
 
 public:
-	CGame(bool disableGraphics = false);
+	CGame(bool disableGraphics = false, bool replayLog = true);
 	~CGame();
 
 	/**
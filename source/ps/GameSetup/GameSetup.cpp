@@ -41,6 +41,7 @@
 #include "graphics/MapReader.h"
 #include "graphics/MaterialManager.h"
 #include "graphics/TerrainTextureManager.h"
+#include "graphics/TextureManager.h"
 #include "gui/GUI.h"
 #include "gui/GUIManager.h"
 #include "gui/scripting/JSInterface_IGUIObject.h"
@@ -626,6 +627,13 @@ static void InitRenderer()
 
 	g_Renderer.Open(g_xres, g_yres);
 
+	// Optionally convert all the textures into the cache up front, in the
+	// background, so they don't have to be converted when they are first used
+	bool prewarmTextures = false;
+	CFG_GET_VAL("textures.prewarm", Bool, prewarmTextures);
+	if (prewarmTextures)
+		g_Renderer.GetTextureManager().PrewarmCache(L"art/textures/");
+
 	// Setup lighting environment. Since the Renderer accesses the
 	// lighting environment through a pointer, this has to be done before
 	// the first Frame.
@@ -935,6 +943,12 @@ void Init(const CmdLineArgs& args, int UNUSED(flags))
 	if (profilerHTTPEnable)
 		g_Profiler2.EnableHTTP();
 
+	// Optionally stream the profiler data to logs/profile2.trace
+	bool profilerTraceEnable = false;
+	CFG_GET_VAL("profiler2.trace.autoenable", Bool, profilerTraceEnable);
+	if (profilerTraceEnable)
+		g_Profiler2.EnableTrace();
+
 	if (!g_Quickstart)
 		g_UserReporter.Initialize(); // after config
 
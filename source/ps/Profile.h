@@ -151,19 +151,21 @@ class CProfileSample
 public:
 	CProfileSample(const char* name)
 	{
-		if (CProfileManager::IsInitialised())
-		{
-			// The profiler is only safe to use on the main thread
-			ENSURE(ThreadUtil::IsMainThread());
-
+		// The profiler is only safe to use on the main thread,
+		// but some code (e.g. the pathfinder) also runs on worker threads,
+		// so ignore samples from those
+		m_Enabled = CProfileManager::IsInitialised() && ThreadUtil::IsMainThread();
+		if (m_Enabled)
 			g_Profiler.Start(name);
-		}
 	}
 	~CProfileSample()
 	{
-		if (CProfileManager::IsInitialised())
+		if (m_Enabled)
 			g_Profiler.Stop();
 	}
+
+private:
+	bool m_Enabled;
 };
 
 class CProfileSampleScript
@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -25,11 +25,13 @@
 #include "Profiler2.h"
 
 #include "lib/allocators/shared_ptr.h"
+#include "lib/external_libraries/libsdl.h"
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
 #include "ps/Profiler2GPU.h"
 #include "third_party/mongoose/mongoose.h"
 
+#include <fstream>
 #include <iomanip>
 
 CProfiler2 g_Profiler2;
@@ -37,8 +39,126 @@ CProfiler2 g_Profiler2;
 // A human-recognisable pattern (for debugging) followed by random bytes (for uniqueness)
 const u8 CProfiler2::RESYNC_MAGIC[8] = {0x11, 0x22, 0x33, 0x44, 0xf4, 0x93, 0xbe, 0x15};
 
+/**
+ * Streams the contents of every thread's buffer to a binary trace file,
+ * from a background thread, so long sessions can be recorded without the
+ * cost of the JSON output and without being limited by the buffer size.
+ *
+ * Every TRACE_INTERVAL msecs, each thread's buffer is copied and parsed, and
+ * the items that haven't been written by a previous pass are appended to the file.
+ * Items that were overwritten before they could be copied (because the thread
+ * filled its whole buffer in less than one interval) are counted, and reported
+ * both in the file and in the HTTP overview.
+ *
+ * The file starts with the 8 bytes "P2TRACE1", followed by a sequence of records,
+ * each starting with a u8 ETraceRecord. All numbers are in native byte order.
+ *  - TRACE_THREAD: u32 thread ID, u32 length, name
+ *  - TRACE_STRING: u32 string ID, u32 length, string
+ *  - TRACE_EVENT, TRACE_ENTER, TRACE_LEAVE: u32 thread ID, double time, u32 string ID
+ *  - TRACE_ATTRIBUTE: u32 thread ID, u32 length, string
+ *  - TRACE_OVERWRITTEN: u32 thread ID, u32 number of items lost since the previous TRACE_OVERWRITTEN
+ * Thread and string IDs are defined by a TRACE_THREAD/TRACE_STRING record before
+ * their first use. Attributes belong to the preceding item of the same thread.
+ */
+class CProfiler2Trace
+{
+	NONCOPYABLE(CProfiler2Trace);
+public:
+	enum ETraceRecord
+	{
+		TRACE_THREAD = 1,
+		TRACE_STRING = 2,
+		TRACE_EVENT = 3,
+		TRACE_ENTER = 4,
+		TRACE_LEAVE = 5,
+		TRACE_ATTRIBUTE = 6,
+		TRACE_OVERWRITTEN = 7,
+	};
+
+	static const u32 TRACE_INTERVAL = 100;
+
+	/**
+	 * Opens the file and starts the background thread.
+	 */
+	CProfiler2Trace(CProfiler2& profiler, const OsPath& path);
+
+	/**
+	 * Stops the background thread and writes the remaining items.
+	 * Must not be called with the profiler's mutex held.
+	 */
+	~CProfiler2Trace();
+
+	/**
+	 * Writes the remaining items of a thread that is about to be destroyed.
+	 * Must be called with the profiler's mutex held.
+	 */
+	void RemoveThread(CProfiler2::ThreadStorage& storage);
+
+	/**
+	 * Returns the number of items from the given thread that were overwritten
+	 * before they could be written to the file.
+	 * Must be called with the profiler's mutex held.
+	 */
+	u32 GetOverwrittenCount(CProfiler2::ThreadStorage& storage);
+
+	void WriteItem(ETraceRecord type, u32 thread, double time, const char* id);
+	void WriteAttribute(u32 thread, const std::string& attr);
+
+	/**
+	 * Per-thread state, recording which items have already been written.
+	 * Items are identified by their time, plus the number of preceding items
+	 * with the same time, plus the number of attributes following them.
+	 */
+	struct SThread
+	{
+		u32 id;
+		double lastTime; // time of the latest item written
+		u32 lastTimeCount; // number of items written with time == lastTime
+		u32 attributesAfterLast; // number of attributes written after the latest item
+		u32 written; // total number of items handled (including sync markers, which aren't stored in the file)
+		u32 overwritten; // total number of items lost
+	};
+
+private:
+	static void* RunThread(void* data);
+	void Run();
+
+	/**
+	 * Writes the new items from the given thread's buffer.
+	 * Must be called with the profiler's mutex held.
+	 */
+	void Update(CProfiler2::ThreadStorage& storage);
+
+	SThread& GetThread(CProfiler2::ThreadStorage& storage);
+
+	u32 GetStringID(const char* str);
+
+	void WriteString(const char* str, u32 len)
+	{
+		m_Stream.write((const char*)&len, sizeof(len));
+		m_Stream.write(str, len);
+	}
+
+	template<typename T>
+	void Write(const T& value)
+	{
+		m_Stream.write((const char*)&value, sizeof(value));
+	}
+
+	CProfiler2& m_Profiler;
+	std::ofstream m_Stream;
+	pthread_t m_Thread;
+	bool m_Shutdown; // protected by the profiler's mutex
+
+	// Only accessed with the profiler's mutex held:
+	std::map<CProfiler2::ThreadStorage*, SThread> m_Threads;
+	std::map<const char*, u32> m_Strings;
+	u32 m_NextThreadID;
+	u32 m_TotalOverwritten;
+};
+
 CProfiler2::CProfiler2() :
-	m_Initialised(false), m_FrameNumber(0), m_MgContext(NULL), m_GPU(NULL)
+	m_Initialised(false), m_FrameNumber(0), m_MgContext(NULL), m_GPU(NULL), m_Trace(NULL)
 {
 }
 
@@ -189,6 +309,8 @@ void CProfiler2::Shutdown()
 
 	ENSURE(!m_GPU); // must shutdown GPU before profiler
 
+	StopTrace();
+
 	if (m_MgContext)
 	{
 		mg_stop(m_MgContext);
@@ -263,11 +385,13 @@ void CProfiler2::AddThreadStorage(ThreadStorage* storage)
 void CProfiler2::RemoveThreadStorage(ThreadStorage* storage)
 {
 	CScopeLock lock(m_Mutex);
+	if (m_Trace)
+		m_Trace->RemoveThread(*storage);
 	m_Threads.erase(std::find(m_Threads.begin(), m_Threads.end(), storage));
 }
 
 CProfiler2::ThreadStorage::ThreadStorage(CProfiler2& profiler, const std::string& name) :
-	m_Profiler(profiler), m_Name(name), m_BufferPos0(0), m_BufferPos1(0), m_LastTime(timer_Time())
+	m_Profiler(profiler), m_Name(name), m_BufferPos0(0), m_BufferPos1(0), m_ItemCount(0), m_LastTime(timer_Time())
 {
 	m_Buffer = new u8[BUFFER_SIZE];
 	memset(m_Buffer, ITEM_NOP, BUFFER_SIZE);
@@ -278,7 +402,7 @@ CProfiler2::ThreadStorage::~ThreadStorage()
 	delete[] m_Buffer;
 }
 
-std::string CProfiler2::ThreadStorage::GetBuffer()
+std::string CProfiler2::ThreadStorage::GetBuffer(u32* itemCount)
 {
 	// Called from an arbitrary thread (not the one writing to the buffer).
 	// 
@@ -286,6 +410,10 @@ std::string CProfiler2::ThreadStorage::GetBuffer()
 
 	shared_ptr<u8> buffer(new u8[BUFFER_SIZE], ArrayDeleter());
 
+	if (itemCount)
+		*itemCount = m_ItemCount;
+	COMPILER_FENCE; // must read m_ItemCount before m_BufferPos1
+
 	u32 pos1 = m_BufferPos1;
 	COMPILER_FENCE; // must read m_BufferPos1 before m_Buffer
 
@@ -333,7 +461,10 @@ void CProfiler2::ConstructJSONOverview(std::ostream& stream)
 	{
 		if (i != 0)
 			stream << ",";
-		stream << "{\"name\":\"" << CStr(m_Threads[i]->GetName()).EscapeToPrintableASCII() << "\"}";
+		stream << "{\"name\":\"" << CStr(m_Threads[i]->GetName()).EscapeToPrintableASCII() << "\"";
+		if (m_Trace)
+			stream << ",\"overwritten\":" << m_Trace->GetOverwrittenCount(*m_Threads[i]);
+		stream << "}";
 	}
 	stream << "]}";
 }
@@ -345,8 +476,6 @@ void CProfiler2::ConstructJSONOverview(std::ostream& stream)
 template<typename V>
 void RunBufferVisitor(const std::string& buffer, V& visitor)
 {
-	TIMER(L"profile2 visitor");
-
 	// The buffer doesn't necessarily start at the beginning of an item
 	// (we just grabbed it from some arbitrary point in the middle),
 	// so scan forwards until we find a sync marker.
@@ -529,8 +658,11 @@ const char* CProfiler2::ConstructJSONResponse(std::ostream& stream, const std::s
 		buffer = storage->GetBuffer();
 	}
 
-	BufferVisitor_Dump visitor(stream);
-	RunBufferVisitor(buffer, visitor);
+	{
+		TIMER(L"profile2 visitor");
+		BufferVisitor_Dump visitor(stream);
+		RunBufferVisitor(buffer, visitor);
+	}
 
 	stream << "null]\n]}";
 
@@ -562,3 +694,280 @@ void CProfiler2::SaveToFile()
 	}
 	stream << "\n]});\n";
 }
+
+void CProfiler2::EnableTrace()
+{
+	ENSURE(m_Initialised);
+
+	// Ignore multiple enablings
+	if (m_Trace)
+		return;
+
+	CProfiler2Trace* trace = new CProfiler2Trace(*this, psLogDir()/"profile2.trace");
+
+	CScopeLock lock(m_Mutex);
+	m_Trace = trace;
+}
+
+void CProfiler2::StopTrace()
+{
+	CProfiler2Trace* trace;
+	{
+		CScopeLock lock(m_Mutex);
+		trace = m_Trace;
+		m_Trace = NULL;
+	}
+
+	// (Must be deleted without the lock, since it waits for the trace thread)
+	delete trace;
+}
+
+/**
+ * Visitor class that writes the items that haven't already been written
+ * by an earlier pass over the same thread's buffer.
+ */
+struct BufferVisitor_Trace
+{
+	NONCOPYABLE(BufferVisitor_Trace);
+public:
+	BufferVisitor_Trace(CProfiler2Trace& trace, CProfiler2Trace::SThread& thread) :
+		m_Trace(trace), m_Thread(thread), m_New(false), m_SeenAtLastTime(0), m_SeenAttributes(0)
+	{
+	}
+
+	void OnSync(double time)
+	{
+		IsNewItem(time);
+	}
+
+	void OnEvent(double time, const char* id)
+	{
+		if (IsNewItem(time))
+			m_Trace.WriteItem(CProfiler2Trace::TRACE_EVENT, m_Thread.id, time, id);
+	}
+
+	void OnEnter(double time, const char* id)
+	{
+		if (IsNewItem(time))
+			m_Trace.WriteItem(CProfiler2Trace::TRACE_ENTER, m_Thread.id, time, id);
+	}
+
+	void OnLeave(double time, const char* id)
+	{
+		if (IsNewItem(time))
+			m_Trace.WriteItem(CProfiler2Trace::TRACE_LEAVE, m_Thread.id, time, id);
+	}
+
+	void OnAttribute(const std::string& attr)
+	{
+		if (!m_New)
+		{
+			// Only the attributes following the latest written item might be new
+			bool afterLast = (m_Thread.lastTimeCount > 0 && m_SeenAtLastTime == m_Thread.lastTimeCount);
+			if (!afterLast)
+				return;
+			if (m_SeenAttributes < m_Thread.attributesAfterLast)
+			{
+				++m_SeenAttributes;
+				return;
+			}
+			m_New = true;
+		}
+
+		++m_Thread.attributesAfterLast;
+		++m_Thread.written;
+		m_Trace.WriteAttribute(m_Thread.id, attr);
+	}
+
+private:
+	/**
+	 * Returns whether the item with the given time comes after all the
+	 * items that have already been written, and updates the thread state if so.
+	 * (Since the buffer is always in time order, once one item is new,
+	 * everything after it is new too.)
+	 */
+	bool IsNewItem(double time)
+	{
+		if (!m_New)
+		{
+			if (time > m_Thread.lastTime || (time == m_Thread.lastTime && m_SeenAtLastTime == m_Thread.lastTimeCount))
+			{
+				m_New = true;
+			}
+			else
+			{
+				if (time == m_Thread.lastTime)
+				{
+					++m_SeenAtLastTime;
+					m_SeenAttributes = 0;
+				}
+				return false;
+			}
+		}
+
+		if (time == m_Thread.lastTime)
+		{
+			++m_Thread.lastTimeCount;
+		}
+		else
+		{
+			m_Thread.lastTime = time;
+			m_Thread.lastTimeCount = 1;
+		}
+		m_Thread.attributesAfterLast = 0;
+		++m_Thread.written;
+		return true;
+	}
+
+	CProfiler2Trace& m_Trace;
+	CProfiler2Trace::SThread& m_Thread;
+	bool m_New;
+	u32 m_SeenAtLastTime;
+	u32 m_SeenAttributes;
+};
+
+CProfiler2Trace::CProfiler2Trace(CProfiler2& profiler, const OsPath& path) :
+	m_Profiler(profiler), m_Stream(OsString(path).c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary),
+	m_Shutdown(false), m_NextThreadID(0), m_TotalOverwritten(0)
+{
+	ENSURE(m_Stream.good());
+	m_Stream.write("P2TRACE1", 8);
+
+	int ret = pthread_create(&m_Thread, NULL, &RunThread, this);
+	ENSURE(ret == 0);
+}
+
+CProfiler2Trace::~CProfiler2Trace()
+{
+	{
+		CScopeLock lock(m_Profiler.m_Mutex);
+		m_Shutdown = true;
+	}
+
+	pthread_join(m_Thread, NULL);
+
+	{
+		CScopeLock lock(m_Profiler.m_Mutex);
+		for (size_t i = 0; i < m_Profiler.m_Threads.size(); ++i)
+			Update(*m_Profiler.m_Threads[i]);
+	}
+
+	m_Stream.close();
+
+	if (m_TotalOverwritten)
+		LOGWARNING(L"Profiler2 trace: %u items were overwritten before they could be saved", m_TotalOverwritten);
+}
+
+void* CProfiler2Trace::RunThread(void* data)
+{
+	debug_SetThreadName("profiler2 trace");
+
+	static_cast<CProfiler2Trace*>(data)->Run();
+
+	return NULL;
+}
+
+void CProfiler2Trace::Run()
+{
+	while (true)
+	{
+		{
+			CScopeLock lock(m_Profiler.m_Mutex);
+			if (m_Shutdown)
+				break;
+
+			for (size_t i = 0; i < m_Profiler.m_Threads.size(); ++i)
+				Update(*m_Profiler.m_Threads[i]);
+
+			m_Stream.flush();
+		}
+
+		SDL_Delay(TRACE_INTERVAL);
+	}
+}
+
+void CProfiler2Trace::RemoveThread(CProfiler2::ThreadStorage& storage)
+{
+	Update(storage);
+	m_Threads.erase(&storage);
+}
+
+u32 CProfiler2Trace::GetOverwrittenCount(CProfiler2::ThreadStorage& storage)
+{
+	return GetThread(storage).overwritten;
+}
+
+CProfiler2Trace::SThread& CProfiler2Trace::GetThread(CProfiler2::ThreadStorage& storage)
+{
+	std::map<CProfiler2::ThreadStorage*, SThread>::iterator it = m_Threads.find(&storage);
+	if (it != m_Threads.end())
+		return it->second;
+
+	// (IDs of removed threads aren't reused, so the file stays unambiguous)
+	SThread thread = { m_NextThreadID++, -1.0, 0, 0, 0, 0 };
+
+	Write((u8)TRACE_THREAD);
+	Write(thread.id);
+	WriteString(storage.GetName().c_str(), (u32)storage.GetName().length());
+
+	return m_Threads.insert(std::make_pair(&storage, thread)).first->second;
+}
+
+u32 CProfiler2Trace::GetStringID(const char* str)
+{
+	// Region/event names are required to be static strings, so they can be
+	// identified by their pointers
+	std::map<const char*, u32>::iterator it = m_Strings.find(str);
+	if (it != m_Strings.end())
+		return it->second;
+
+	u32 id = (u32)m_Strings.size();
+	m_Strings[str] = id;
+
+	Write((u8)TRACE_STRING);
+	Write(id);
+	WriteString(str, (u32)strlen(str));
+
+	return id;
+}
+
+void CProfiler2Trace::WriteItem(ETraceRecord type, u32 thread, double time, const char* id)
+{
+	u32 stringID = GetStringID(id);
+	Write((u8)type);
+	Write(thread);
+	Write(time);
+	Write(stringID);
+}
+
+void CProfiler2Trace::WriteAttribute(u32 thread, const std::string& attr)
+{
+	Write((u8)TRACE_ATTRIBUTE);
+	Write(thread);
+	WriteString(attr.c_str(), (u32)attr.length());
+}
+
+void CProfiler2Trace::Update(CProfiler2::ThreadStorage& storage)
+{
+	SThread& thread = GetThread(storage);
+
+	u32 itemCount;
+	std::string buffer = storage.GetBuffer(&itemCount);
+
+	BufferVisitor_Trace visitor(*this, thread);
+	RunBufferVisitor(buffer, visitor);
+
+	// Every item counted by itemCount is either in the buffer copy (and has now
+	// been written) or was overwritten. (The copy may include a few items written
+	// after itemCount was read, in which case this underestimates the losses
+	// until the next update.)
+	u32 lost = itemCount - thread.written; // (modulo 2^32)
+	if (lost < 0x80000000u && lost > thread.overwritten)
+	{
+		Write((u8)TRACE_OVERWRITTEN);
+		Write(thread.id);
+		Write(lost - thread.overwritten);
+		m_TotalOverwritten += lost - thread.overwritten;
+		thread.overwritten = lost;
+	}
+}
@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -70,6 +70,10 @@
  * and to simplify the visualisation of the data by doing it externally in an
  * environment with better UI tools (i.e. HTML) instead of within the game engine.
  * 
+ * For long sessions, EnableTrace streams the buffers of all threads to a compact
+ * binary file instead (see CProfiler2Trace), and counts the items that were
+ * overwritten before they could be saved.
+ * 
  * The initial setup of g_Profiler2 must happen in the game's main thread.
  * RegisterCurrentThread and the Record functions may be called from any thread.
  * The HTTP server runs its own threads, which may call the ConstructJSON functions.
@@ -87,10 +91,12 @@ struct mg_context;
 // minimise performance overhead.
 
 class CProfiler2GPU;
+class CProfiler2Trace;
 
 class CProfiler2
 {
 	friend class CProfiler2GPU_base;
+	friend class CProfiler2Trace;
 
 public:
 	// Items stored in the buffers:
@@ -185,9 +191,12 @@ private:
 		/**
 		 * Returns a copy of a subset of the thread's buffer.
 		 * Not guaranteed to start on an item boundary.
+		 * If @p itemCount is non-NULL, it is set to the number of items written
+		 * before the copy was made (so every one of them is either in the copy
+		 * or has been overwritten).
 		 * May be called by any thread.
 		 */
-		std::string GetBuffer();
+		std::string GetBuffer(u32* itemCount = NULL);
 
 	private:
 		/**
@@ -222,6 +231,9 @@ private:
 			
 			COMPILER_FENCE; // must write m_BufferPos1 after m_Buffer
 			m_BufferPos1 = start + size;
+
+			COMPILER_FENCE; // must write m_ItemCount after m_BufferPos1
+			++m_ItemCount;
 		}
 
 		CProfiler2& m_Profiler;
@@ -244,6 +256,10 @@ private:
 		// actually work in practice?
 		u32 m_BufferPos0;
 		u32 m_BufferPos1;
+
+		// Total number of items ever written (wrapping around at 2^32), so that
+		// readers can tell how many have been lost when the buffer wrapped
+		u32 m_ItemCount;
 	};
 
 public:
@@ -288,6 +304,15 @@ public:
 	 */
 	void RegisterCurrentThread(const std::string& name);
 
+	/**
+	 * Returns whether RegisterCurrentThread has been called in this thread
+	 * (so the Record functions may be used).
+	 */
+	bool IsCurrentThreadRegistered()
+	{
+		return m_Initialised && pthread_getspecific(m_TLS) != NULL;
+	}
+
 	/**
 	 * Non-main threads should call this occasionally,
 	 * especially if it's been a long time since their last call to the profiler,
@@ -354,6 +379,19 @@ public:
 	 */
 	void SaveToFile();
 
+	/**
+	 * Call in main thread to start streaming the buffers of all threads to
+	 * a binary trace file named profile2.trace in the logs directory,
+	 * until Shutdown or StopTrace is called.
+	 * See CProfiler2Trace for the file format.
+	 */
+	void EnableTrace();
+
+	/**
+	 * Call in main thread to finish writing the trace file.
+	 */
+	void StopTrace();
+
 	double GetTime()
 	{
 		return timer_Time();
@@ -394,6 +432,8 @@ private:
 
 	CProfiler2GPU* m_GPU;
 
+	CProfiler2Trace* m_Trace; // protected by m_Mutex
+
 	CMutex m_Mutex;
 	std::vector<ThreadStorage*> m_Threads; // thread-safe; protected by m_Mutex
 };
@@ -20,10 +20,14 @@
 #include "Replay.h"
 
 #include "graphics/TerrainTextureManager.h"
+#include "lib/byte_order.h"
 #include "lib/timer.h"
 #include "lib/file/file_system.h"
 #include "lib/res/h_mgr.h"
 #include "lib/tex/tex.h"
+#include "maths/MD5.h"
+#include "ps/Compress.h"
+#include "ps/ConfigDB.h"
 #include "ps/Game.h"
 #include "ps/Loader.h"
 #include "ps/Profile.h"
@@ -32,6 +36,8 @@
 #include "scriptinterface/ScriptStats.h"
 #include "simulation2/Simulation2.h"
 #include "simulation2/helpers/SimulationCommand.h"
+#include "simulation2/system/ComponentManager.h"
+#include "simulation2/system/SimContext.h"
 
 #include <sstream>
 #include <fstream>
@@ -42,6 +48,11 @@
 #define getpid _getpid // use the non-deprecated function name
 #endif
 
+#if !OS_WIN
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 static std::string Hexify(const std::string& s)
 {
 	std::stringstream str;
@@ -52,7 +63,7 @@ static std::string Hexify(const std::string& s)
 }
 
 CReplayLogger::CReplayLogger(ScriptInterface& scriptInterface) :
-	m_ScriptInterface(scriptInterface)
+	m_ScriptInterface(scriptInterface), m_KeyframeStream(NULL), m_KeyframeInterval(0)
 {
 	// Construct the directory name based on the PID, to be relatively unique.
 	// Append "-1", "-2" etc if we run multiple matches in a single session,
@@ -66,13 +77,18 @@ CReplayLogger::CReplayLogger(ScriptInterface& scriptInterface) :
 		name << "-" << run;
 
 	OsPath path = psLogDir() / L"sim_log" / name.str() / L"commands.txt";
-	CreateDirectories(path.Parent(), 0700);
+	m_Directory = path.Parent();
+	CreateDirectories(m_Directory, 0700);
 	m_Stream = new std::ofstream(OsString(path).c_str(), std::ofstream::out | std::ofstream::trunc);
+
+	if (CConfigDB::IsInitialised())
+		CFG_GET_VAL("replay.keyframeinterval", UnsignedInt, m_KeyframeInterval);
 }
 
 CReplayLogger::~CReplayLogger()
 {
 	delete m_Stream;
+	delete m_KeyframeStream;
 }
 
 void CReplayLogger::StartGame(const CScriptValRooted& attribs)
@@ -99,10 +115,36 @@ void CReplayLogger::Hash(const std::string& hash, bool quick)
 		*m_Stream << "hash " << Hexify(hash) << "\n";
 }
 
+bool CReplayLogger::WantsKeyframe(u32 n)
+{
+	return m_KeyframeInterval && n > 0 && n % m_KeyframeInterval == 0;
+}
+
+void CReplayLogger::Keyframe(u32 n, const std::string& state)
+{
+	if (!m_KeyframeStream)
+	{
+		OsPath path = m_Directory / L"keyframes.dat";
+		m_KeyframeStream = new std::ofstream(OsString(path).c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+	}
+
+	std::string compressed;
+	CompressZLib(state, compressed, true);
+
+	// Each keyframe is stored as the turn number and the compressed data's length
+	// (both 32-bit little-endian), followed by the compressed data
+	u8 header[8];
+	write_le32(header, n);
+	write_le32(header + 4, (u32)compressed.size());
+	m_KeyframeStream->write((const char*)header, sizeof(header));
+	m_KeyframeStream->write(compressed.data(), compressed.size());
+	m_KeyframeStream->flush();
+}
+
 ////////////////////////////////////////////////////////////////
 
 CReplayPlayer::CReplayPlayer() :
-	m_Stream(NULL)
+	m_Stream(NULL), m_SeekTurn(0)
 {
 }
 
@@ -117,9 +159,64 @@ void CReplayPlayer::Load(const std::string& path)
 
 	m_Stream = new std::ifstream(path.c_str());
 	ENSURE(m_Stream->good());
+	m_Path = path;
+}
+
+u32 CReplayPlayer::LoadKeyframe(CSimulation2& simulation)
+{
+	// The keyframes are saved next to the commands file
+	std::string path = OsString(OsPath(m_Path).Parent() / L"keyframes.dat");
+	std::ifstream stream(path.c_str(), std::ifstream::in | std::ifstream::binary);
+	if (!stream.good())
+	{
+		debug_printf(L"No keyframes found for seeking (%hs)\n", path.c_str());
+		return 0;
+	}
+
+	// Find the last suitable keyframe, skipping over the data of the others
+	u32 bestTurn = 0;
+	std::streamoff bestOffset = 0;
+	u32 bestSize = 0;
+	u8 header[8];
+	while (stream.read((char*)header, sizeof(header)))
+	{
+		u32 turn = read_le32(header);
+		u32 size = read_le32(header + 4);
+		if (turn <= m_SeekTurn && turn > bestTurn)
+		{
+			bestTurn = turn;
+			bestOffset = stream.tellg();
+			bestSize = size;
+		}
+		stream.seekg(size, std::ios::cur);
+	}
+
+	if (!bestTurn)
+	{
+		debug_printf(L"No keyframe found at or before turn %u\n", m_SeekTurn);
+		return 0;
+	}
+
+	std::string compressed(bestSize, '\0');
+	stream.clear();
+	stream.seekg(bestOffset);
+	if (!bestSize || !stream.read(&compressed[0], bestSize))
+	{
+		debug_printf(L"Failed to read keyframe at turn %u\n", bestTurn);
+		return 0;
+	}
+
+	std::string state;
+	DecompressZLib(compressed, state, true);
+
+	bool ok = simulation.DeserializeState((const u8*)state.data(), state.size());
+	ENSURE(ok);
+
+	debug_printf(L"Loaded keyframe at turn %u\n", bestTurn);
+	return bestTurn;
 }
 
-void CReplayPlayer::Replay()
+bool CReplayPlayer::Replay(bool fast)
 {
 	ENSURE(m_Stream);
 
@@ -128,7 +225,8 @@ void CReplayPlayer::Replay()
 	g_ScriptStatsTable = new CScriptStatsTable;
 	g_ProfileViewer.AddRootTable(g_ScriptStatsTable);
 
-	CGame game(true);
+	// (Don't write a new replay log of the replay in fast mode)
+	CGame game(true, !fast);
 	g_Game = &game;
 
 	// Need some stuff for terrain movement costs:
@@ -140,10 +238,22 @@ void CReplayPlayer::Replay()
 	// Initialise h_mgr so it doesn't crash when emitting sounds
 	h_mgr_init();
 
+	CComponentManager& componentManager = game.GetSimulation2()->GetSimContext().GetComponentManager();
+	if (fast)
+		componentManager.SetProfileMessageHandlers(true);
+
 	std::vector<SimulationCommand> commands;
 	u32 turn = 0;
 	u32 turnLength = 0;
 
+	u32 numTurns = 0;
+	u32 numMismatches = 0;
+	double simTime = 0.0;
+
+	// When seeking, skip all the turns before the loaded keyframe
+	u32 keyframeTurn = 0;
+	bool skipping = false;
+
 	std::string type;
 	while ((*m_Stream >> type).good())
 	{
@@ -162,11 +272,17 @@ void CReplayPlayer::Replay()
 
 			PSRETURN ret = game.ReallyStartGame();
 			ENSURE(ret == PSRETURN_OK);
+
+			// The keyframe has to be loaded on top of the initial map
+			if (m_SeekTurn)
+				keyframeTurn = LoadKeyframe(*game.GetSimulation2());
 		}
 		else if (type == "turn")
 		{
 			*m_Stream >> turn >> turnLength;
-			debug_printf(L"Turn %u (%u)... ", turn, turnLength);
+			skipping = (turn < keyframeTurn);
+			if (!fast && !skipping)
+				debug_printf(L"Turn %u (%u)... ", turn, turnLength);
 		}
 		else if (type == "cmd")
 		{
@@ -175,6 +291,9 @@ void CReplayPlayer::Replay()
 
 			std::string line;
 			std::getline(*m_Stream, line);
+			if (skipping)
+				continue;
+
 			CScriptValRooted data = game.GetSimulation2()->GetScriptInterface().ParseJSON(line);
 
 			SimulationCommand cmd = { player, data };
@@ -187,22 +306,51 @@ void CReplayPlayer::Replay()
 
 			bool quick = (type == "hash-quick");
 
+			if (skipping)
+				continue;
+
 //			if (turn >= 1300)
 //			if (turn >= 0)
 			if (turn % 100 == 0)
 			{
+				// Replays recorded by older versions contain MD5 hashes
+				bool md5 = (replayHash.length() == MD5::DIGESTSIZE*2);
+
 				std::string hash;
-				bool ok = game.GetSimulation2()->ComputeStateHash(hash, quick);
+				bool ok = game.GetSimulation2()->ComputeStateHash(hash, quick, md5);
 				ENSURE(ok);
 				std::string hexHash = Hexify(hash);
 				if (hexHash == replayHash)
-					debug_printf(L"hash ok (%hs)", hexHash.c_str());
+				{
+					if (!fast)
+						debug_printf(L"hash ok (%hs)", hexHash.c_str());
+				}
 				else
+				{
+					++numMismatches;
+					if (fast)
+						debug_printf(L"Turn %u: ", turn);
 					debug_printf(L"HASH MISMATCH (%hs != %hs)", hexHash.c_str(), replayHash.c_str());
+					if (fast)
+						debug_printf(L"\n");
+				}
 			}
 		}
 		else if (type == "end")
 		{
+			if (skipping)
+				continue;
+
+			if (fast)
+			{
+				double t = timer_Time();
+				game.GetSimulation2()->Update(turnLength, commands);
+				simTime += timer_Time() - t;
+				commands.clear();
+				++numTurns;
+				continue;
+			}
+
 			{
 				g_Profiler2.RecordFrameStart();
 				PROFILE2("frame");
@@ -234,14 +382,33 @@ void CReplayPlayer::Replay()
 		}
 	}
 
-	g_Profiler2.SaveToFile();
+	if (!fast)
+		g_Profiler2.SaveToFile();
 
 	std::string hash;
 	bool ok = game.GetSimulation2()->ComputeStateHash(hash, false);
 	ENSURE(ok);
 	debug_printf(L"# Final state: %hs\n", Hexify(hash).c_str());
 
-	timer_DisplayClientTotals();
+	if (fast)
+	{
+		debug_printf(L"# %u turns in %.3f s (%.1f turns/s), %u hash mismatches\n",
+			numTurns, simTime, simTime > 0.0 ? numTurns / simTime : 0.0, numMismatches);
+
+		// Time per message handler, excluding any nested messages they sent
+		std::vector<CComponentManager::MessageHandlerStats> stats = componentManager.GetMessageHandlerStats();
+		debug_printf(L"#   %-40hs %10hs %10hs %10hs\n", "message handler", "calls", "self (s)", "total (s)");
+		for (size_t i = 0; i < stats.size(); ++i)
+		{
+			std::string name = stats[i].componentName + " " + stats[i].messageName;
+			debug_printf(L"#   %-40hs %10u %10.3f %10.3f (%5.1f%%)\n", name.c_str(), stats[i].calls,
+				stats[i].selfTime, stats[i].totalTime, 100.0 * stats[i].selfTime / simTime);
+		}
+	}
+	else
+	{
+		timer_DisplayClientTotals();
+	}
 
 	// Clean up
 	delete &g_TexMan;
@@ -251,4 +418,105 @@ void CReplayPlayer::Replay()
 	delete &g_ProfileViewer;
 
 	g_Game = NULL;
+
+	return numMismatches == 0;
+}
+
+static bool VerifyReplay(const std::string& path)
+{
+	CReplayPlayer replay;
+	replay.Load(path);
+	return replay.Replay(true);
+}
+
+size_t CReplayPlayer::VerifyReplays(const std::vector<std::string>& paths, size_t numJobs)
+{
+	std::vector<std::string> failed;
+
+#if OS_WIN
+	UNUSED2(numJobs);
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		double t = timer_Time();
+		debug_printf(L"# Replay %hs\n", paths[i].c_str());
+		bool ok = VerifyReplay(paths[i]);
+		debug_printf(L"# Replay %hs: %ls (%.1f s)\n", paths[i].c_str(), ok ? L"OK" : L"FAILED", timer_Time() - t);
+		if (!ok)
+			failed.push_back(paths[i]);
+	}
+#else
+	// Maps from the running child processes to their replay index and start time
+	std::map<pid_t, std::pair<size_t, double> > running;
+	size_t next = 0;
+
+	while (next < paths.size() || !running.empty())
+	{
+		while (running.size() < std::max(numJobs, (size_t)1) && next < paths.size())
+		{
+			debug_printf(L"# Replay %hs\n", paths[next].c_str());
+
+			// Flush before forking, so the child doesn't print our buffered output again
+			fflush(stdout);
+
+			pid_t pid = fork();
+			if (pid == 0)
+			{
+				// Don't run any of the parent's exit handlers or destructors in the child
+				bool ok = VerifyReplay(paths[next]);
+				fflush(stdout);
+				_exit(ok ? 0 : 1);
+			}
+
+			if (pid < 0)
+			{
+				debug_printf(L"# Replay %hs: FAILED (fork failed)\n", paths[next].c_str());
+				failed.push_back(paths[next]);
+			}
+			else
+			{
+				running[pid] = std::make_pair(next, timer_Time());
+			}
+			++next;
+		}
+
+		if (running.empty())
+			continue;
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0)
+		{
+			debug_printf(L"# waitpid failed\n");
+			break;
+		}
+
+		std::map<pid_t, std::pair<size_t, double> >::iterator it = running.find(pid);
+		if (it == running.end())
+			continue;
+
+		const std::string& path = paths[it->second.first];
+		double time = timer_Time() - it->second.second;
+		running.erase(it);
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		{
+			debug_printf(L"# Replay %hs: OK (%.1f s)\n", path.c_str(), time);
+		}
+		else
+		{
+			// Exit status 1 means hash mismatches; anything else means it crashed
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 1)
+				debug_printf(L"# Replay %hs: FAILED (hash mismatch) (%.1f s)\n", path.c_str(), time);
+			else
+				debug_printf(L"# Replay %hs: FAILED (crashed) (%.1f s)\n", path.c_str(), time);
+			failed.push_back(path);
+		}
+	}
+#endif
+
+	debug_printf(L"# %lu of %lu replays verified successfully\n", (unsigned long)(paths.size() - failed.size()), (unsigned long)paths.size());
+	for (size_t i = 0; i < failed.size(); ++i)
+		debug_printf(L"#   FAILED: %hs\n", failed[i].c_str());
+
+	return failed.size();
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,7 +18,10 @@
 #ifndef INCLUDED_REPLAY
 #define INCLUDED_REPLAY
 
+#include "lib/os_path.h"
+
 class CScriptValRooted;
+class CSimulation2;
 struct SimulationCommand;
 class ScriptInterface;
 
@@ -46,6 +49,17 @@ public:
 	 * Optional hash of simulation state (for sync checking).
 	 */
 	virtual void Hash(const std::string& hash, bool quick) = 0;
+
+	/**
+	 * Returns whether a keyframe should be saved before running the given turn.
+	 */
+	virtual bool WantsKeyframe(u32 n) = 0;
+
+	/**
+	 * Serialized simulation state (from CSimulation2::SerializeState) at the start of
+	 * the given turn, so that replays can seek to it without simulating all the earlier turns.
+	 */
+	virtual void Keyframe(u32 n, const std::string& state) = 0;
 };
 
 /**
@@ -57,10 +71,15 @@ public:
 	virtual void StartGame(const CScriptValRooted& UNUSED(attribs)) { }
 	virtual void Turn(u32 UNUSED(n), u32 UNUSED(turnLength), const std::vector<SimulationCommand>& UNUSED(commands)) { }
 	virtual void Hash(const std::string& UNUSED(hash), bool UNUSED(quick)) { }
+	virtual bool WantsKeyframe(u32 UNUSED(n)) { return false; }
+	virtual void Keyframe(u32 UNUSED(n), const std::string& UNUSED(state)) { }
 };
 
 /**
  * Implementation of IReplayLogger that saves data to a file in the logs directory.
+ *
+ * If the "replay.keyframeinterval" config value is non-zero, a compressed keyframe
+ * is also saved every that many turns, in a keyframes.dat file next to the commands.
  */
 class CReplayLogger : public IReplayLogger
 {
@@ -72,10 +91,15 @@ public:
 	virtual void StartGame(const CScriptValRooted& attribs);
 	virtual void Turn(u32 n, u32 turnLength, const std::vector<SimulationCommand>& commands);
 	virtual void Hash(const std::string& hash, bool quick);
+	virtual bool WantsKeyframe(u32 n);
+	virtual void Keyframe(u32 n, const std::string& state);
 
 private:
 	ScriptInterface& m_ScriptInterface;
 	std::ostream* m_Stream;
+	OsPath m_Directory;
+	std::ostream* m_KeyframeStream; // NULL until the first keyframe
+	u32 m_KeyframeInterval;
 };
 
 /**
@@ -88,10 +112,45 @@ public:
 	~CReplayPlayer();
 
 	void Load(const std::string& path);
-	void Replay();
+
+	/**
+	 * Make Replay start from the last keyframe at or before the given turn
+	 * (if the replay has any keyframes), instead of simulating every turn
+	 * from the start of the game.
+	 */
+	void SetSeekTurn(u32 turn) { m_SeekTurn = turn; }
+
+	/**
+	 * Runs the whole replay.
+	 * If @p fast is true, it runs the simulation as fast as possible: no per-turn output
+	 * or profiler dumps, and no new replay log. It only reports hash mismatches, and
+	 * at the end it prints the number of turns per second and the time spent in
+	 * each component type, which makes it suitable for benchmarking and for
+	 * validating many replays.
+	 * Returns false if any of the checked state hashes didn't match.
+	 */
+	bool Replay(bool fast);
+
+	/**
+	 * Verifies each of the given replays with Replay(true), running up to @p numJobs
+	 * of them at once, and prints the result and time taken for each one.
+	 * (The engine has too much global state to run several simulations on different
+	 * threads, so each replay is run in its own child process where that's supported,
+	 * and they're run one at a time otherwise.)
+	 * Returns the number of replays that failed (due to hash mismatches or crashes).
+	 */
+	static size_t VerifyReplays(const std::vector<std::string>& paths, size_t numJobs);
 
 private:
+	/**
+	 * Loads the state from the last keyframe at or before m_SeekTurn.
+	 * Returns the turn of that keyframe, or 0 if there was none.
+	 */
+	u32 LoadKeyframe(CSimulation2& simulation);
+
 	std::istream* m_Stream;
+	std::string m_Path;
+	u32 m_SeekTurn;
 };
 
 #endif // INCLUDED_REPLAY
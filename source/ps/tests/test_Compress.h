@@ -0,0 +1,150 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "ps/Compress.h"
+
+class TestCompress : public CxxTest::TestSuite
+{
+	void roundtrip_delta(const std::string& base, const std::string& data)
+	{
+		std::string delta, out;
+		CompressDelta(base, data, delta);
+		DecompressDelta(base, delta, out);
+		TS_ASSERT_EQUALS(out, data);
+	}
+
+	std::string RandomData(size_t len)
+	{
+		std::string data;
+		for (size_t i = 0; i < len; ++i)
+			data.push_back((char)(rand() % 256));
+		return data;
+	}
+
+public:
+	void test_zlib()
+	{
+		std::string data = RandomData(1000) + std::string(10000, 'x');
+		std::string compressed, out;
+		CompressZLib(data, compressed, true);
+		TS_ASSERT_LESS_THAN(compressed.size(), (size_t)2000);
+		DecompressZLib(compressed, out, true);
+		TS_ASSERT_EQUALS(out, data);
+	}
+
+	void test_zlib_stream()
+	{
+		std::string data = RandomData(1000) + std::string(10000, 'x') + RandomData(1000);
+		std::string compressed;
+		CompressZLib(data, compressed, true);
+
+		// Feed the data in chunks of various sizes, including splitting the length header
+		const size_t chunkSizes[] = { 1, 3, 7, 100, 1000000 };
+		for (size_t i = 0; i < ARRAY_SIZE(chunkSizes); ++i)
+		{
+			CZLibStreamDecompressor decompressor;
+			for (size_t offset = 0; offset < compressed.size(); offset += chunkSizes[i])
+			{
+				TS_ASSERT(!decompressor.IsComplete());
+				size_t len = std::min(chunkSizes[i], compressed.size() - offset);
+				TS_ASSERT(decompressor.Decompress((const u8*)compressed.data() + offset, len));
+			}
+			TS_ASSERT(decompressor.IsComplete());
+			TS_ASSERT_EQUALS(decompressor.GetOutput(), data);
+		}
+	}
+
+	void test_zlib_stream_invalid()
+	{
+		std::string data = RandomData(1000);
+		std::string compressed;
+		CompressZLib(data, compressed, true);
+
+		// Truncated
+		{
+			CZLibStreamDecompressor decompressor;
+			TS_ASSERT(decompressor.Decompress((const u8*)compressed.data(), compressed.size() - 1));
+			TS_ASSERT(!decompressor.IsComplete());
+		}
+
+		// Trailing garbage, in the same chunk or a later one
+		{
+			std::string extra = compressed + "x";
+			CZLibStreamDecompressor decompressor;
+			TS_ASSERT(!decompressor.Decompress((const u8*)extra.data(), extra.size()));
+		}
+		{
+			CZLibStreamDecompressor decompressor;
+			TS_ASSERT(decompressor.Decompress((const u8*)compressed.data(), compressed.size()));
+			TS_ASSERT(!decompressor.Decompress((const u8*)"x", 1));
+		}
+
+		// Corrupted
+		{
+			std::string corrupt = compressed;
+			corrupt[4] = (char)~corrupt[4];
+			CZLibStreamDecompressor decompressor;
+			TS_ASSERT(!decompressor.Decompress((const u8*)corrupt.data(), corrupt.size()));
+		}
+	}
+
+	void test_delta_empty()
+	{
+		roundtrip_delta("", "");
+		roundtrip_delta("", "abc");
+		roundtrip_delta("abc", "");
+		roundtrip_delta("short", "shorter"); // smaller than a block
+	}
+
+	void test_delta_identical()
+	{
+		std::string data = RandomData(10000);
+		std::string delta;
+		CompressDelta(data, data, delta);
+		TS_ASSERT_LESS_THAN(delta.size(), (size_t)16);
+		roundtrip_delta(data, data);
+	}
+
+	void test_delta_edits()
+	{
+		srand(1234);
+		std::string base = RandomData(20000);
+
+		// Insertions and deletions shift the rest of the data, which must still be found
+		std::string data = base;
+		data.insert(100, "inserted");
+		data.erase(5000, 123);
+		data.replace(12000, 10, RandomData(50));
+		data += "appended";
+
+		std::string delta;
+		CompressDelta(base, data, delta);
+		TS_ASSERT_LESS_THAN(delta.size(), (size_t)200);
+		roundtrip_delta(base, data);
+
+		// Moved blocks can be copied from anywhere in the base
+		std::string moved = base.substr(10000) + base.substr(0, 10000);
+		CompressDelta(base, moved, delta);
+		TS_ASSERT_LESS_THAN(delta.size(), (size_t)32);
+		roundtrip_delta(base, moved);
+
+		// Unrelated data just turns into literals
+		roundtrip_delta(base, RandomData(5000));
+	}
+};
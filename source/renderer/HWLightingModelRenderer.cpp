@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -85,7 +85,7 @@ struct ShaderModel : public CModelRData
 	VertexArray::Attribute m_Normal; // valid iff cpuLighting == false
 	VertexArray::Attribute m_Color; // valid iff cpuLighting == true
 
-	ShaderModel(const void* key) : CModelRData(key), m_Array(GL_DYNAMIC_DRAW) { }
+	ShaderModel(const void* key, GLenum usage) : CModelRData(key), m_Array(usage) { }
 };
 
 
@@ -137,8 +137,10 @@ CModelRData* ShaderModelVertexRenderer::CreateModelData(const void* key, CModel*
 		mdef->SetRenderData(m, shadermodeldef);
 	}
 
-	// Build the per-model data
-	ShaderModel* shadermodel = new ShaderModel(key);
+	// Build the per-model data.
+	// Skinned models are usually animated and rewritten every frame, so they
+	// can use the streaming buffer
+	ShaderModel* shadermodel = new ShaderModel(key, mdef->GetNumBones() ? GL_STREAM_DRAW : GL_DYNAMIC_DRAW);
 
 	if (m->cpuLighting)
 	{
@@ -182,10 +184,12 @@ CModelRData* ShaderModelVertexRenderer::CreateModelData(const void* key, CModel*
 
 
 // Fill in and upload dynamic vertex array
-void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data, int updateflags)
+void ShaderModelVertexRenderer::PrepareModelData(CModel* model, CModelRData* data, int updateflags)
 {
 	ShaderModel* shadermodel = static_cast<ShaderModel*>(data);
-	
+
+	// (CPU lighting shares its normals buffer between models, so it's all
+	// done in UpdateModelData instead)
 	if (!m->cpuLighting && (updateflags & RENDERDATA_UPDATE_VERTICES))
 	{
 		// build vertices
@@ -193,8 +197,17 @@ void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data
 		VertexArrayIterator<CVector3D> Normal = shadermodel->m_Normal.GetIterator<CVector3D>();
 
 		ModelRenderer::BuildPositionAndNormals(model, Position, Normal);
+	}
+}
 
-		// upload everything to vertex buffer
+
+void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data, int updateflags)
+{
+	ShaderModel* shadermodel = static_cast<ShaderModel*>(data);
+	
+	if (!m->cpuLighting && (updateflags & RENDERDATA_UPDATE_VERTICES))
+	{
+		// upload the vertices built by PrepareModelData
 		shadermodel->m_Array.Upload();
 	}
 
@@ -302,3 +315,14 @@ void ShaderModelVertexRenderer::RenderModel(const CShaderProgramPtr& shader, int
 	g_Renderer.m_Stats.m_ModelTris += numFaces;
 }
 
+// Skinned models all have their own vertex data, so can't be instanced
+bool ShaderModelVertexRenderer::BeginInstancing(const CShaderProgramPtr& UNUSED(shader))
+{
+	return false;
+}
+
+void ShaderModelVertexRenderer::RenderModelsInstanced(const CShaderProgramPtr& UNUSED(shader), int UNUSED(streamflags),
+	CModel** UNUSED(models), size_t UNUSED(numModels))
+{
+	debug_warn(L"Instancing not supported");
+}
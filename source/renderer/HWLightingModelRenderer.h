@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,12 +40,15 @@ public:
 
 	// Implementations
 	CModelRData* CreateModelData(const void* key, CModel* model);
+	void PrepareModelData(CModel* model, CModelRData* data, int updateflags);
 	void UpdateModelData(CModel* model, CModelRData* data, int updateflags);
 
 	void BeginPass(int streamflags);
 	void EndPass(int streamflags);
 	void PrepareModelDef(const CShaderProgramPtr& shader, int streamflags, const CModelDef& def);
 	void RenderModel(const CShaderProgramPtr& shader, int streamflags, CModel* model, CModelRData* data);
+	bool BeginInstancing(const CShaderProgramPtr& shader);
+	void RenderModelsInstanced(const CShaderProgramPtr& shader, int streamflags, CModel** models, size_t numModels);
 
 protected:
 	ShaderModelRendererInternals* m;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,6 +31,10 @@
 #include "graphics/LightEnv.h"
 #include "graphics/Model.h"
 #include "graphics/ModelDef.h"
+#include "graphics/SkeletonAnim.h"
+#include "graphics/SkeletonAnimDef.h"
+#include "lib/bits.h"
+#include "ps/Game.h"
 
 #include "renderer/InstancingModelRenderer.h"
 #include "renderer/Renderer.h"
@@ -61,15 +65,60 @@ struct IModelDef : public CModelDefRPrivate
 	/// Indices are the same for all models, so share them
 	VertexIndexArray m_IndexArray;
 
+	/// Bone matrices of the animations used with this modeldef, for instanced
+	/// GPU skinning (see InstancingModelRenderer). Lazily created.
+	GLuint m_PoseTexture;
+
+	/// Size of m_PoseTexture, in texels
+	size_t m_PoseTextureWidth;
+	size_t m_PoseTextureHeight;
+
+	/// Texture data (four floats per texel) of all the rows used so far
+	std::vector<float> m_PoseData;
+
+	/// Whether m_PoseData has changed since it was uploaded
+	bool m_PoseDataDirty;
+
+	/// First row of each animation in m_PoseData
+	std::map<const CSkeletonAnimDef*, size_t> m_PoseAnimRows;
+
 	IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateTangents);
+	~IModelDef();
+
+	/**
+	 * Returns the first row of the given animation's frames in the pose
+	 * texture, adding them if necessary. Returns 0 (the bind pose) if the
+	 * animation can't be added.
+	 */
+	size_t GetPoseAnimRow(const CSkeletonAnimDef* animDef, CModelDef& mdef);
+
+	/**
+	 * Uploads m_PoseData to m_PoseTexture, if it has changed.
+	 */
+	void UploadPoseTexture();
+
+private:
+	/**
+	 * Appends a row of pose texture data for the given animation pose,
+	 * or for the bind pose if @p matrices is NULL.
+	 */
+	void AddPoseRow(CModelDef& mdef, const CMatrix3D* matrices);
 };
 
 
 IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateTangents)
-	: m_IndexArray(GL_STATIC_DRAW), m_Array(GL_STATIC_DRAW)
+	: m_IndexArray(GL_STATIC_DRAW), m_Array(GL_STATIC_DRAW),
+	m_PoseTexture(0), m_PoseTextureWidth(0), m_PoseTextureHeight(0), m_PoseDataDirty(false)
 {
 	size_t numVertices = mdef->GetNumVertices();
 
+	if (gpuSkinning)
+	{
+		// Three texels per bone, plus the bind-shape bone; the first row is the bind pose
+		m_PoseTextureWidth = (mdef->GetNumBones() + 1) * 3;
+		AddPoseRow(*mdef, NULL);
+	}
+
 	m_Position.type = GL_FLOAT;
 	m_Position.elems = 3;
 	m_Array.AddAttribute(&m_Position);
@@ -247,12 +296,163 @@ IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateT
 }
 
 
+IModelDef::~IModelDef()
+{
+	if (m_PoseTexture)
+		glDeleteTextures(1, &m_PoseTexture);
+}
+
+void IModelDef::AddPoseRow(CModelDef& mdef, const CMatrix3D* matrices)
+{
+	size_t numBones = mdef.GetNumBones();
+	size_t offset = m_PoseData.size();
+	m_PoseData.resize(offset + m_PoseTextureWidth * 4);
+	float* out = &m_PoseData[offset];
+
+	for (size_t bone = 0; bone <= numBones; ++bone)
+	{
+		// Like CModel::ValidatePosition, but the bind-shape bone is identity
+		// since the shader applies the model's transform afterwards
+		CMatrix3D mat;
+		if (matrices && bone < numBones)
+			mat = matrices[bone] * mdef.GetInverseBindBoneMatrices()[bone];
+		else
+			mat.SetIdentity();
+
+		for (int row = 0; row < 3; ++row)
+			for (int col = 0; col < 4; ++col)
+				*out++ = mat(row, col);
+	}
+
+	m_PoseDataDirty = true;
+}
+
+size_t IModelDef::GetPoseAnimRow(const CSkeletonAnimDef* animDef, CModelDef& mdef)
+{
+	std::map<const CSkeletonAnimDef*, size_t>::iterator it = m_PoseAnimRows.find(animDef);
+	if (it != m_PoseAnimRows.end())
+		return it->second;
+
+	// Add every frame, plus the first frame again at the end so that looping
+	// animations can interpolate between the last and first frames
+	size_t row = m_PoseData.size() / (m_PoseTextureWidth * 4);
+	size_t numFrames = animDef->GetNumFrames();
+	if (animDef->GetNumKeys() != mdef.GetNumBones() || numFrames == 0 || row + numFrames + 1 > (size_t)ogl_max_tex_size)
+	{
+		LOGWARNING(L"Can't add animation to skinning texture of model '%ls'", mdef.GetName().string().c_str());
+		m_PoseAnimRows[animDef] = 0;
+		return 0;
+	}
+
+	std::vector<CMatrix3D> matrices(mdef.GetNumBones());
+	for (size_t frame = 0; frame <= numFrames; ++frame)
+	{
+		animDef->BuildBoneMatrices((frame % numFrames) * animDef->GetFrameTime(), &matrices[0], true);
+		AddPoseRow(mdef, &matrices[0]);
+	}
+
+	m_PoseAnimRows[animDef] = row;
+	return row;
+}
+
+void IModelDef::UploadPoseTexture()
+{
+	if (!m_PoseDataDirty)
+		return;
+
+	if (!m_PoseTexture)
+		glGenTextures(1, &m_PoseTexture);
+
+	g_Renderer.BindTexture(0, m_PoseTexture);
+
+	// Only the vertical filtering matters, to interpolate between frames;
+	// the shader samples the centres of texels horizontally
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// Round up the height, so the texture doesn't have to be reallocated
+	// every time an animation is added
+	size_t numRows = m_PoseData.size() / (m_PoseTextureWidth * 4);
+	size_t height = std::min(round_up_to_pow2(numRows), (size_t)ogl_max_tex_size);
+	if (height != m_PoseTextureHeight)
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F_ARB, (GLsizei)m_PoseTextureWidth, (GLsizei)height, 0, GL_RGBA, GL_FLOAT, NULL);
+		m_PoseTextureHeight = height;
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)m_PoseTextureWidth, (GLsizei)numRows, GL_RGBA, GL_FLOAT, &m_PoseData[0]);
+
+	g_Renderer.BindTexture(0, 0);
+
+	ogl_WarnIfError();
+
+	m_PoseDataDirty = false;
+}
+
+
+/// Names of the per-instance vertex attributes, each a vec4
+static const char* const INSTANCE_ATTRIB_NAMES[] = {
+	"a_instancingTransform0", "a_instancingTransform1", "a_instancingTransform2",
+	"a_shadingColor",
+	"a_playerColor",
+	"a_skinPose" // only with GPU skinning
+};
+
+static const size_t NUM_INSTANCE_ATTRIBS = ARRAY_SIZE(INSTANCE_ATTRIB_NAMES);
+
+/**
+ * Returns the row of @p imodeldef's pose texture for the model's current
+ * animation state, with the fraction selecting the position between that
+ * row and the next one.
+ */
+static float GetPoseRow(IModelDef* imodeldef, CModel* model)
+{
+	CSkeletonAnim* anim = model->GetAnimation();
+	if (!anim || !anim->m_AnimDef)
+		return 0.f;
+
+	const CSkeletonAnimDef* animDef = anim->m_AnimDef;
+	size_t row = imodeldef->GetPoseAnimRow(animDef, *model->GetModelDef());
+	if (row == 0)
+		return 0.f;
+
+	// Select the frames like CSkeletonAnimDef::BuildBoneMatrices
+	float fstartframe = model->GetAnimTime() / animDef->GetFrameTime();
+	size_t startframe = (size_t)(int)fstartframe;
+	float deltatime = fstartframe - startframe;
+	startframe %= animDef->GetNumFrames();
+
+	if ((model->GetFlags() & MODELFLAG_NOLOOPANIMATION) && startframe + 1 == animDef->GetNumFrames())
+		deltatime = 0.f;
+
+	return (float)(row + startframe) + deltatime;
+}
+
 struct InstancingModelRendererInternals
 {
 	bool gpuSkinning;
 	
 	bool calculateTangents;
 
+	/// Whether instanced draw calls may be used, if the shader supports them
+	bool hwInstancing;
+
+	/// Whether the current pass uses instanced draw calls
+	bool instancing;
+
+	/// Number of INSTANCE_ATTRIB_NAMES used by this renderer
+	size_t numInstanceAttribs;
+
+	/// Attribute locations of INSTANCE_ATTRIB_NAMES in the current pass's shader
+	int instanceAttribs[NUM_INSTANCE_ATTRIBS];
+
+	/// Per-instance data for the current draw call
+	std::vector<float> instanceData;
+
+	/// Streamed buffer for instanceData (lazily created)
+	GLuint instanceBuffer;
+
 	/// Previously prepared modeldef
 	IModelDef* imodeldef;
 
@@ -262,16 +462,23 @@ struct InstancingModelRendererInternals
 
 
 // Construction and Destruction
-InstancingModelRenderer::InstancingModelRenderer(bool gpuSkinning, bool calculateTangents)
+InstancingModelRenderer::InstancingModelRenderer(bool gpuSkinning, bool calculateTangents, bool hwInstancing)
 {
 	m = new InstancingModelRendererInternals;
 	m->gpuSkinning = gpuSkinning;
 	m->calculateTangents = calculateTangents;
+	m->hwInstancing = hwInstancing;
+	m->instancing = false;
+	// Skinned models also need the row of the pose texture
+	m->numInstanceAttribs = gpuSkinning ? NUM_INSTANCE_ATTRIBS : NUM_INSTANCE_ATTRIBS - 1;
+	m->instanceBuffer = 0;
 	m->imodeldef = 0;
 }
 
 InstancingModelRenderer::~InstancingModelRenderer()
 {
+	if (m->instanceBuffer)
+		pglDeleteBuffersARB(1, &m->instanceBuffer);
 	delete m;
 }
 
@@ -297,6 +504,12 @@ CModelRData* InstancingModelRenderer::CreateModelData(const void* key, CModel* m
 }
 
 
+void InstancingModelRenderer::PrepareModelData(CModel* UNUSED(model), CModelRData* UNUSED(data), int UNUSED(updateflags))
+{
+	// We have no per-CModel data
+}
+
+
 void InstancingModelRenderer::UpdateModelData(CModel* UNUSED(model), CModelRData* UNUSED(data), int UNUSED(updateflags))
 {
 	// We have no per-CModel data
@@ -312,6 +525,17 @@ void InstancingModelRenderer::BeginPass(int streamflags)
 // Cleanup rendering pass.
 void InstancingModelRenderer::EndPass(int UNUSED(streamflags))
 {
+#if !CONFIG2_GLES
+	// The divisors aren't part of the shader state, so reset them
+	// before other shaders use the same attribute locations
+	if (m->instancing)
+	{
+		for (size_t i = 0; i < m->numInstanceAttribs; ++i)
+			pglVertexAttribDivisorARB(m->instanceAttribs[i], 0);
+		m->instancing = false;
+	}
+#endif
+
 	CVertexBuffer::Unbind();
 }
 
@@ -389,3 +613,108 @@ void InstancingModelRenderer::RenderModel(const CShaderProgramPtr& shader, int U
 	g_Renderer.m_Stats.m_ModelTris += numFaces;
 
 }
+
+
+bool InstancingModelRenderer::BeginInstancing(const CShaderProgramPtr& shader)
+{
+#if CONFIG2_GLES
+	UNUSED2(shader);
+	return false;
+#else
+	if (!m->hwInstancing)
+		return false;
+
+	for (size_t i = 0; i < m->numInstanceAttribs; ++i)
+	{
+		m->instanceAttribs[i] = shader->GetVertexAttribLocation(INSTANCE_ATTRIB_NAMES[i]);
+		if (m->instanceAttribs[i] < 0)
+			return false;
+	}
+
+	for (size_t i = 0; i < m->numInstanceAttribs; ++i)
+		pglVertexAttribDivisorARB(m->instanceAttribs[i], 1);
+
+	if (!m->instanceBuffer)
+		pglGenBuffersARB(1, &m->instanceBuffer);
+
+	m->instancing = true;
+	return true;
+#endif
+}
+
+
+// Render several models with the same modeldef and material
+void InstancingModelRenderer::RenderModelsInstanced(const CShaderProgramPtr& shader, int UNUSED(streamflags), CModel** models, size_t numModels)
+{
+#if CONFIG2_GLES
+	UNUSED2(shader);
+	UNUSED2(models);
+	UNUSED2(numModels);
+	debug_warn(L"Instancing not supported");
+#else
+	ENSURE(m->instancing);
+
+	CModelDefPtr mdldef = models[0]->GetModelDef();
+
+	// Pack the per-instance data, in the order of INSTANCE_ATTRIB_NAMES
+	m->instanceData.resize(numModels * m->numInstanceAttribs * 4);
+	float* out = &m->instanceData[0];
+	for (size_t i = 0; i < numModels; ++i)
+	{
+		CModel* model = models[i];
+
+		const CMatrix3D& transform = model->GetTransform();
+		for (int row = 0; row < 3; ++row)
+			for (int col = 0; col < 4; ++col)
+				*out++ = transform(row, col);
+
+		CColor shadingColor = model->GetShadingColor();
+		*out++ = shadingColor.r;
+		*out++ = shadingColor.g;
+		*out++ = shadingColor.b;
+		*out++ = shadingColor.a;
+
+		CColor playerColor = g_Game->GetPlayerColour(model->GetPlayerID());
+		*out++ = playerColor.r;
+		*out++ = playerColor.g;
+		*out++ = playerColor.b;
+		*out++ = playerColor.a;
+
+		if (m->gpuSkinning)
+		{
+			*out++ = GetPoseRow(m->imodeldef, model);
+			*out++ = 0.f;
+			*out++ = 0.f;
+			*out++ = 0.f;
+		}
+	}
+
+	if (m->gpuSkinning)
+	{
+		// (This must be after GetPoseRow, which might have added animations)
+		m->imodeldef->UploadPoseTexture();
+
+		float width = (float)m->imodeldef->m_PoseTextureWidth;
+		float height = (float)m->imodeldef->m_PoseTextureHeight;
+		shader->BindTexture("skinPoseTex", m->imodeldef->m_PoseTexture);
+		shader->Uniform("skinPoseTexSize", width, height, 1.f / width, 1.f / height);
+	}
+
+	// Re-specify the whole buffer each time, so the driver doesn't have to
+	// wait for the previous draw call to finish using it
+	const GLsizei stride = (GLsizei)(m->numInstanceAttribs * 4 * sizeof(float));
+	pglBindBufferARB(GL_ARRAY_BUFFER, m->instanceBuffer);
+	pglBufferDataARB(GL_ARRAY_BUFFER, numModels * stride, &m->instanceData[0], GL_STREAM_DRAW);
+	for (size_t i = 0; i < m->numInstanceAttribs; ++i)
+		pglVertexAttribPointerARB(m->instanceAttribs[i], 4, GL_FLOAT, GL_FALSE, stride, (u8*)0 + i * 4 * sizeof(float));
+
+	size_t numFaces = mdldef->GetNumFaces();
+
+	if (!g_Renderer.m_SkipSubmit)
+		pglDrawElementsInstancedARB(GL_TRIANGLES, (GLsizei)numFaces*3, GL_UNSIGNED_SHORT, m->imodeldefIndexBase, (GLsizei)numModels);
+
+	// bump stats
+	g_Renderer.m_Stats.m_DrawCalls++;
+	g_Renderer.m_Stats.m_ModelTris += numFaces * numModels;
+#endif
+}
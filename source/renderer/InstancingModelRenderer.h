@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,21 +31,38 @@ struct InstancingModelRendererInternals;
  * Render non-animated (but potentially moving) models using a ShaderRenderModifier.
  * This computes and binds per-vertex data; the modifier is responsible
  * for setting any shader uniforms etc (including the instancing transform).
+ *
+ * With @p hwInstancing, models that share a modeldef and material are drawn
+ * with a single instanced draw call when the shader supports it, i.e. when it
+ * declares the per-instance attributes a_instancingTransform0..2 (the rows of
+ * the transform), a_shadingColor and a_playerColor (which then replace the
+ * corresponding uniforms set by the modifier).
+ *
+ * With @p gpuSkinning as well, the shader must also declare a_skinPose, and
+ * read the bone matrices from the texture skinPoseTex instead of the
+ * skinBlendMatrices uniform. Each row of the texture holds the first three
+ * rows of every bone's matrix (including the final bind-shape bone), for one
+ * frame of one of the animations used with the modeldef. a_skinPose.x is the
+ * (fractional) row to sample, and the uniform skinPoseTexSize is the size of
+ * the texture and its reciprocal.
  */
 class InstancingModelRenderer : public ModelVertexRenderer
 {
 public:
-	InstancingModelRenderer(bool gpuSkinning, bool calculateTangents);
+	InstancingModelRenderer(bool gpuSkinning, bool calculateTangents, bool hwInstancing);
 	~InstancingModelRenderer();
 
 	// Implementations
 	CModelRData* CreateModelData(const void* key, CModel* model);
+	void PrepareModelData(CModel* model, CModelRData* data, int updateflags);
 	void UpdateModelData(CModel* model, CModelRData* data, int updateflags);
 
 	void BeginPass(int streamflags);
 	void EndPass(int streamflags);
 	void PrepareModelDef(const CShaderProgramPtr& shader, int streamflags, const CModelDef& def);
 	void RenderModel(const CShaderProgramPtr& shader, int streamflags, CModel* model, CModelRData* data);
+	bool BeginInstancing(const CShaderProgramPtr& shader);
+	void RenderModelsInstanced(const CShaderProgramPtr& shader, int streamflags, CModel** models, size_t numModels);
 
 protected:
 	InstancingModelRendererInternals* m;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,8 @@
 #include "precompiled.h"
 
 #include "lib/ogl.h"
+#include "lib/allocators/allocator_adapters.h"
+#include "lib/allocators/arena.h"
 #include "maths/Vector3D.h"
 #include "maths/Vector4D.h"
 
@@ -40,6 +42,8 @@
 #include "renderer/SkyManager.h"
 #include "renderer/WaterManager.h"
 
+#include "simulation2/helpers/WorkerPool.h"
+
 #include <boost/weak_ptr.hpp>
 
 #if ARCH_X86_X64
@@ -202,9 +206,86 @@ void ModelRenderer::BuildIndices(
  * Separated into the source file to increase implementation hiding (and to
  * avoid some causes of recompiles).
  */
+struct SMRMaterialBucketKey
+{
+	SMRMaterialBucketKey(CStrIntern effect, const CShaderDefines& defines)
+		: effect(effect), defines(defines) { }
+
+	CStrIntern effect;
+	CShaderDefines defines;
+
+	bool operator==(const SMRMaterialBucketKey& b) const
+	{
+		return (effect == b.effect && defines == b.defines);
+	}
+
+private:
+	SMRMaterialBucketKey& operator=(const SMRMaterialBucketKey&);
+};
+
+struct SMRMaterialBucketKeyHash
+{
+	size_t operator()(const SMRMaterialBucketKey& key) const
+	{
+		size_t hash = 0;
+		boost::hash_combine(hash, key.effect.GetHash());
+		boost::hash_combine(hash, key.defines.GetHash());
+		return hash;
+	}
+};
+
+/**
+ * The models using one material (effect and defines) in the current call to
+ * ShaderModelRenderer::Render. Buckets are kept from frame to frame, so that
+ * their model lists needn't be reallocated and their techniques needn't be
+ * looked up again.
+ */
+struct SMRMaterialBucket
+{
+	std::vector<CModel*> models;
+
+	/// Technique for this material in each of the contexts it has been rendered with
+	std::vector<std::pair<CShaderDefines, CShaderTechniquePtr> > techs;
+
+	/// Value of ShaderModelRendererInternals::frameNumber when this bucket was last used
+	size_t lastUsedFrame;
+
+	/// Technique used while the real one is still waiting to be compiled
+	CShaderTechniquePtr fallbackTech;
+
+	const CShaderTechniquePtr& GetTechnique(const SMRMaterialBucketKey& key, const CShaderDefines& context)
+	{
+		for (size_t i = 0; i < techs.size(); ++i)
+			if (techs[i].first == context)
+				return techs[i].second;
+
+		bool isFallback;
+		CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffectWithFallback(key.effect, context, key.defines, isFallback);
+
+		// Try again next time, by which point the real technique might be compiled
+		if (isFallback)
+		{
+			fallbackTech = tech;
+			return fallbackTech;
+		}
+
+		// (The shader manager caches every effect it loads, so it's safe to keep these)
+		techs.push_back(std::make_pair(context, tech));
+		return techs.back().second;
+	}
+};
+
+/// Number of frames after which unused material buckets are deleted
+static const size_t MATERIAL_BUCKET_MAX_UNUSED_FRAMES = 100;
+
 struct ShaderModelRendererInternals
 {
-	ShaderModelRendererInternals(ShaderModelRenderer* r) : m_Renderer(r) { }
+	ShaderModelRendererInternals(ShaderModelRenderer* r) : m_Renderer(r), frameNumber(0), arena(NULL) { }
+
+	~ShaderModelRendererInternals()
+	{
+		delete arena;
+	}
 
 	/// Back-link to "our" renderer
 	ShaderModelRenderer* m_Renderer;
@@ -214,6 +295,23 @@ struct ShaderModelRendererInternals
 
 	/// List of submitted models for rendering in this frame
 	std::vector<CModel*> submissions;
+
+	typedef boost::unordered_map<SMRMaterialBucketKey, SMRMaterialBucket, SMRMaterialBucketKeyHash> MaterialBuckets_t;
+
+	/// Submissions grouped by material, refilled in each call to Render
+	MaterialBuckets_t materialBuckets;
+
+	/// Number of calls to EndFrame so far
+	size_t frameNumber;
+
+	/// Scratch memory for Render, which is all thrown away at the start of the next call
+	/// (lazily allocated, and reallocated when a call needs more than before)
+	Allocators::Arena<>* arena;
+
+	/// GL state tracked while rendering, kept here to avoid reallocating it
+	std::vector<CTexture*> currentTexs;
+	std::vector<CShaderProgram::Binding> texBindings;
+	std::vector<CStrIntern> texBindingNames;
 };
 
 
@@ -248,9 +346,43 @@ void ShaderModelRenderer::Submit(CModel* model)
 }
 
 
+// Number of models prepared by each job on the worker threads
+// (so that the per-job overhead is insignificant even for simple models)
+static const size_t PREPARE_MODELS_BATCH_SIZE = 16;
+
+struct PrepareModelsJobs
+{
+	ModelVertexRenderer* vertexRenderer;
+	const std::vector<CModel*>* submissions;
+};
+
+static void PrepareModelsJob(void* data, size_t index)
+{
+	const PrepareModelsJobs& jobs = *static_cast<PrepareModelsJobs*>(data);
+
+	size_t end = std::min((index + 1) * PREPARE_MODELS_BATCH_SIZE, jobs.submissions->size());
+	for (size_t i = index * PREPARE_MODELS_BATCH_SIZE; i < end; ++i)
+	{
+		CModel* model = (*jobs.submissions)[i];
+		CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
+		jobs.vertexRenderer->PrepareModelData(model, rdata, rdata->m_UpdateFlags);
+	}
+}
+
 // Call update for all submitted models and enter the rendering phase
 void ShaderModelRenderer::PrepareModels()
 {
+	// Do the CPU-side work (mostly skinning) on the worker threads, since
+	// the models are independent of each other
+	{
+		PROFILE3("prepare model data");
+		PrepareModelsJobs jobs = { m->vertexRenderer.get(), &m->submissions };
+		size_t numJobs = (m->submissions.size() + PREPARE_MODELS_BATCH_SIZE - 1) / PREPARE_MODELS_BATCH_SIZE;
+		g_Renderer.GetWorkerPool().Run(&PrepareModelsJob, &jobs, numJobs);
+	}
+
+	// Then upload the results from this thread, which owns the GL context
+	PROFILE3("update model data");
 	for (size_t i = 0; i < m->submissions.size(); ++i)
 	{
 		CModel* model = m->submissions[i];
@@ -268,6 +400,17 @@ void ShaderModelRenderer::PrepareModels()
 void ShaderModelRenderer::EndFrame()
 {
 	m->submissions.clear();
+
+	// Forget materials that haven't been seen recently, so the buckets don't
+	// keep accumulating over a long game
+	++m->frameNumber;
+	for (ShaderModelRendererInternals::MaterialBuckets_t::iterator it = m->materialBuckets.begin(); it != m->materialBuckets.end(); )
+	{
+		if (m->frameNumber - it->second.lastUsedFrame > MATERIAL_BUCKET_MAX_UNUSED_FRAMES)
+			it = m->materialBuckets.erase(it);
+		else
+			++it;
+	}
 }
 
 
@@ -310,34 +453,6 @@ struct SMRCompareSortByDistItem
 	}
 };
 
-struct SMRMaterialBucketKey
-{
-	SMRMaterialBucketKey(CStrIntern effect, const CShaderDefines& defines)
-		: effect(effect), defines(defines) { }
-
-	CStrIntern effect;
-	CShaderDefines defines;
-
-	bool operator==(const SMRMaterialBucketKey& b) const
-	{
-		return (effect == b.effect && defines == b.defines);
-	}
-
-private:
-	SMRMaterialBucketKey& operator=(const SMRMaterialBucketKey&);
-};
-
-struct SMRMaterialBucketKeyHash
-{
-	size_t operator()(const SMRMaterialBucketKey& key) const
-	{
-		size_t hash = 0;
-		boost::hash_combine(hash, key.effect.GetHash());
-		boost::hash_combine(hash, key.defines.GetHash());
-		return hash;
-	}
-};
-
 struct SMRTechBucket
 {
 	CShaderTechniquePtr tech;
@@ -356,6 +471,34 @@ struct SMRCompareTechBucket
 	}
 };
 
+// Containers for Render's scratch data, allocated from ShaderModelRendererInternals::arena.
+// They must have all their memory reserved up front, since the arena can't reuse
+// the memory released when they grow.
+typedef std::vector<SMRSortByDistItem, ProxyAllocator<SMRSortByDistItem, Allocators::Arena<> > > SMRSortByDistItems;
+typedef std::vector<CShaderTechniquePtr, ProxyAllocator<CShaderTechniquePtr, Allocators::Arena<> > > SMRTechniques;
+typedef std::vector<SMRTechBucket, ProxyAllocator<SMRTechBucket, Allocators::Arena<> > > SMRTechBuckets;
+typedef std::vector<CModel*, ProxyAllocator<CModel*, Allocators::Arena<> > > SMRModels;
+
+/**
+ * Returns whether models with these materials can be drawn without changing
+ * any uniforms or textures in between.
+ */
+static bool SameMaterialBindings(const CMaterial& a, const CMaterial& b)
+{
+	if (a.GetStaticUniforms() != b.GetStaticUniforms() || !(a.GetRenderQueries() == b.GetRenderQueries()))
+		return false;
+
+	const CMaterial::SamplersVector& samplersA = a.GetSamplers();
+	const CMaterial::SamplersVector& samplersB = b.GetSamplers();
+	if (samplersA.size() != samplersB.size())
+		return false;
+	for (size_t s = 0; s < samplersA.size(); ++s)
+		if (!(samplersA[s].Name == samplersB[s].Name) || samplersA[s].Sampler != samplersB[s].Sampler)
+			return false;
+
+	return true;
+}
+
 void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShaderDefines& context, int flags)
 {
 	if (m->submissions.empty())
@@ -396,7 +539,9 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 	 * There are a smallish number of materials, and a smaller number of techniques.
 	 * 
 	 * To minimise technique lookups, we first group models by material,
-	 * in 'materialBuckets' (a hash table).
+	 * in 'materialBuckets' (a hash table). The buckets persist between frames
+	 * (only their model lists are refilled each time), and cache their technique
+	 * for each context.
 	 * 
 	 * For each material bucket we then look up the appropriate shader technique.
 	 * If the technique requires sort-by-distance, the model is added to the
@@ -415,24 +560,35 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 	 * Extra tech buckets are added for the sorted-by-distance models without reordering.
 	 * Finally we render by looping over each tech bucket, then looping over the model
 	 * list in each, rebinding the GL state whenever it changes.
+	 * 
+	 * All the other lists only live for this call, so they're allocated from
+	 * a persistent arena and steady-state frames don't need any heap allocations.
 	 */
 
- 	typedef boost::unordered_map<SMRMaterialBucketKey, std::vector<CModel*>, SMRMaterialBucketKeyHash> MaterialBuckets_t;
-	MaterialBuckets_t materialBuckets;
+ 	typedef ShaderModelRendererInternals::MaterialBuckets_t MaterialBuckets_t;
+	MaterialBuckets_t& materialBuckets = m->materialBuckets;
+
+	// Number of buckets used by this call
+	size_t numMaterialBuckets = 0;
 
 	{
 		PROFILE3("bucketing by material");
 
+		// Clear the buckets from the previous call
+		// (keeping their memory, since they'll probably be refilled with similar models)
+		for (MaterialBuckets_t::iterator it = materialBuckets.begin(); it != materialBuckets.end(); ++it)
+			it->second.models.clear();
+
 		for (size_t i = 0; i < m->submissions.size(); ++i)
 		{
 			CModel* model = m->submissions[i];
 			
 			CShaderDefines defs = model->GetMaterial().GetShaderDefines();
-			CShaderConditionalDefines condefs = model->GetMaterial().GetConditionalDefines();
+			const CShaderConditionalDefines& condefs = model->GetMaterial().GetConditionalDefines();
 			
 			for (size_t j = 0; j < condefs.GetSize(); ++j)
 			{
-				CShaderConditionalDefines::CondDefine &item = condefs.GetItem(j);
+				const CShaderConditionalDefines::CondDefine& item = condefs.GetItem(j);
 				int type = item.m_CondType;
 				switch (type)
 				{
@@ -445,7 +601,7 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 						float dmax = item.m_CondArgs[1];
 						
 						if ((dmin < 0 || dist >= dmin) && (dmax < 0 || dist < dmax))
-							defs.Add(item.m_DefName.c_str(), item.m_DefValue.c_str());
+							defs.Set(item.m_DefName, item.m_DefValue);
 						
 						break;
 					}
@@ -453,27 +609,56 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 			}
 
 			SMRMaterialBucketKey key(model->GetMaterial().GetShaderEffect(), defs);
-			std::vector<CModel*>& bucketItems = materialBuckets[key];
-			bucketItems.push_back(model);
+			SMRMaterialBucket& bucket = materialBuckets[key];
+			if (bucket.models.empty())
+			{
+				bucket.lastUsedFrame = m->frameNumber;
+				++numMaterialBuckets;
+			}
+			bucket.models.push_back(model);
 		}
 	}
 
-	std::vector<SMRSortByDistItem> sortByDistItems;
+	// Make sure the arena is big enough for everything allocated below
+	// (there can't be more tech buckets than material buckets plus sorted-by-distance models)
+	size_t numSubmissions = m->submissions.size();
+	size_t arenaSize =
+		numSubmissions * sizeof(SMRSortByDistItem) +
+		numMaterialBuckets * sizeof(CShaderTechniquePtr) +
+		(numMaterialBuckets + numSubmissions) * sizeof(SMRTechBucket) +
+		2 * numSubmissions * sizeof(CModel*);
+	if (m->arena)
+		m->arena->DeallocateAll();
+	if (!m->arena || m->arena->RemainingBytes() < arenaSize)
+	{
+		delete m->arena;
+		m->arena = new Allocators::Arena<>(arenaSize + arenaSize/2); // leave room for more models next time
+	}
+	Allocators::Arena<>& arena = *m->arena;
 
-	std::vector<CShaderTechniquePtr> sortByDistTechs;
+	SMRSortByDistItems sortByDistItems((SMRSortByDistItems::allocator_type(arena)));
+	sortByDistItems.reserve(numSubmissions);
+
+	SMRTechniques sortByDistTechs((SMRTechniques::allocator_type(arena)));
+	sortByDistTechs.reserve(numMaterialBuckets);
 		// indexed by sortByDistItems[i].techIdx
 		// (which stores indexes instead of CShaderTechniquePtr directly
 		// to avoid the shared_ptr copy cost when sorting; maybe it'd be better
 		// if we just stored raw CShaderTechnique* and assumed the shader manager
 		// will keep it alive long enough)
 
-	std::vector<SMRTechBucket> techBuckets;
+	SMRTechBuckets techBuckets((SMRTechBuckets::allocator_type(arena)));
+	techBuckets.reserve(numMaterialBuckets + numSubmissions);
 
 	{
 		PROFILE3("processing material buckets");
 		for (MaterialBuckets_t::iterator it = materialBuckets.begin(); it != materialBuckets.end(); ++it)
 		{
-			CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(it->first.effect, context, it->first.defines);
+			std::vector<CModel*>& bucketModels = it->second.models;
+			if (bucketModels.empty())
+				continue;
+
+			const CShaderTechniquePtr& tech = it->second.GetTechnique(it->first, context);
 
 			// Skip invalid techniques (e.g. from data file errors)
 			if (!tech)
@@ -488,12 +673,12 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 				size_t techIdx = sortByDistTechs.size()-1;
 
 				// Add each model into sortByDistItems
-				for (size_t i = 0; i < it->second.size(); ++i)
+				for (size_t i = 0; i < bucketModels.size(); ++i)
 				{
 					SMRSortByDistItem itemWithDist;
 					itemWithDist.techIdx = techIdx;
 
-					CModel* model = it->second[i];
+					CModel* model = bucketModels[i];
 					itemWithDist.model = model;
 
 					CVector3D modelpos = model->GetTransform().GetTranslation();
@@ -508,10 +693,10 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 				// TODO: This only sorts by base texture. While this is an OK approximation
 				// for most cases (as related samplers are usually used together), it would be better
 				// to take all the samplers into account when sorting here.
-				std::sort(it->second.begin(), it->second.end(), SMRBatchModel());
+				std::sort(bucketModels.begin(), bucketModels.end(), SMRBatchModel());
 
 				// Add a tech bucket pointing at this model list
-				SMRTechBucket techBucket = { tech, &it->second[0], it->second.size() };
+				SMRTechBucket techBucket = { tech, &bucketModels[0], bucketModels.size() };
 				techBuckets.push_back(techBucket);
 			}
 		}
@@ -527,7 +712,7 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 	// (This exists primarily because techBuckets wants a CModel**;
 	// we could avoid the cost of copying into this list by adding
 	// a stride length into techBuckets and not requiring contiguous CModel*s)
-	std::vector<CModel*> sortByDistModels;
+	SMRModels sortByDistModels((SMRModels::allocator_type(arena)));
 
 	if (!sortByDistItems.empty())
 	{
@@ -539,6 +724,7 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 		{
 			PROFILE3("batching dist-sorted items");
 
+			// (This must not be reallocated, since techBuckets points into it)
 			sortByDistModels.reserve(sortByDistItems.size());
 
 			// Find runs of distance-sorted models that share a technique,
@@ -573,19 +759,19 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 
 		size_t idxTechStart = 0;
 		
-		// This vector keeps track of texture changes during rendering. It is kept outside the
-		// loops to avoid excessive reallocations. The token allocation of 64 elements 
-		// should be plenty, though it is reallocated below (at a cost) if necessary.
-		std::vector<CTexture*> currentTexs;
-		currentTexs.reserve(64);
+		// This vector keeps track of texture changes during rendering. It is kept between
+		// calls to avoid excessive reallocations, and is grown below if necessary.
+		std::vector<CTexture*>& currentTexs = m->currentTexs;
 		
 		// texBindings holds the identifier bindings in the shader, which can no longer be defined 
 		// statically in the ShaderRenderModifier class. texBindingNames uses interned strings to
 		// keep track of when bindings need to be reevaluated.
-		std::vector<CShaderProgram::Binding> texBindings;
-		texBindings.reserve(64);
-		std::vector<CStrIntern> texBindingNames;
-		texBindingNames.reserve(64);
+		std::vector<CShaderProgram::Binding>& texBindings = m->texBindings;
+		std::vector<CStrIntern>& texBindingNames = m->texBindingNames;
+
+		// Models drawn by the current instanced draw call
+		SMRModels instancedModels((SMRModels::allocator_type(arena)));
+		instancedModels.reserve(numSubmissions);
 
 		while (idxTechStart < techBuckets.size())
 		{
@@ -610,6 +796,8 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 				modifier->BeginPass(shader);
 
 				m->vertexRenderer->BeginPass(streamflags);
+
+				bool instancing = m->vertexRenderer->BeginInstancing(shader);
 				
 				// When the shader technique changes, textures need to be
 				// rebound, so ensure there are no remnants from the last pass.
@@ -632,7 +820,7 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 						if (flags && !(model->GetFlags() & flags))
 							continue;
 
-						CMaterial::SamplersVector samplers = model->GetMaterial().GetSamplers();
+						const CMaterial::SamplersVector& samplers = model->GetMaterial().GetSamplers();
 						size_t samplersNum = samplers.size();
 						
 						// make sure the vectors are the right virtual sizes, and also
@@ -652,7 +840,7 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 						// bind the samplers to the shader
 						for (size_t s = 0; s < samplersNum; ++s)
 						{
-							CMaterial::TextureSampler &samp = samplers[s];
+							const CMaterial::TextureSampler& samp = samplers[s];
 							
 							CShaderProgram::Binding bind = texBindings[s];
 							// check that the handles are current
@@ -693,7 +881,7 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 							currentStaticUniforms.BindUniforms(shader);
 						}
 						
-						CShaderRenderQueries renderQueries = model->GetMaterial().GetRenderQueries();
+						const CShaderRenderQueries& renderQueries = model->GetMaterial().GetRenderQueries();
 						
 						for (size_t q = 0; q < renderQueries.GetSize(); q++)
 						{
@@ -725,11 +913,34 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 							}
 						}
 
-						modifier->PrepareModel(shader, model);
-
 						CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
 						ENSURE(rdata->GetKey() == m->vertexRenderer.get());
 
+						if (instancing)
+						{
+							// Draw this and all the following models that need the same
+							// bindings with a single call (the per-model state that
+							// PrepareModel would set is passed per instance instead)
+							instancedModels.clear();
+							instancedModels.push_back(model);
+							while (i+1 < numModels)
+							{
+								CModel* next = models[i+1];
+								if (!(flags && !(next->GetFlags() & flags)))
+								{
+									if (next->GetModelDef().get() != currentModeldef || !SameMaterialBindings(model->GetMaterial(), next->GetMaterial()))
+										break;
+									instancedModels.push_back(next);
+								}
+								++i;
+							}
+
+							m->vertexRenderer->RenderModelsInstanced(shader, streamflags, &instancedModels[0], instancedModels.size());
+							continue;
+						}
+
+						modifier->PrepareModel(shader, model);
+
 						m->vertexRenderer->RenderModel(shader, streamflags, model, rdata);
 					}
 				}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -64,17 +64,40 @@ public:
 
 
 	/**
-	 * UpdateModelData: Calculate per-model data for each frame.
+	 * PrepareModelData: Calculate the CPU-side per-model data for each frame.
+	 *
+	 * ModelRenderer implementations must call this once per frame for
+	 * every model that is to be rendered in this frame, before calling
+	 * UpdateModelData with the same updateflags.
+	 *
+	 * This may be called from worker threads, concurrently for different
+	 * models, so it must not use OpenGL or modify any state other than the
+	 * model's own data. ModelVertexRenderer implementations should use this
+	 * function to perform software vertex transforms (e.g. CPU skinning)
+	 * into the model's vertex arrays.
+	 *
+	 * @param model The model.
+	 * @param data Private data as returned by CreateModelData.
+	 * @param updateflags Flags indicating which data has changed during
+	 * the frame. The value is the same as the value of the model's
+	 * CRenderData::m_UpdateFlags.
+	 */
+	virtual void PrepareModelData(CModel* model, CModelRData* data, int updateflags) = 0;
+
+
+	/**
+	 * UpdateModelData: Finish calculating per-model data for each frame.
 	 *
 	 * ModelRenderer implementations must call this once per frame for
 	 * every model that is to be rendered in this frame, even if the
-	 * value of updateflags will be zero.
+	 * value of updateflags will be zero, after PrepareModelData
+	 * and from the thread that owns the OpenGL context.
 	 * This implies that this function will also be called at least once
 	 * between a call to CreateModelData and a call to RenderModel.
 	 *
 	 * ModelVertexRenderer implementations should use this function to
-	 * perform software vertex transforms and potentially other per-frame
-	 * calculations.
+	 * upload the data computed by PrepareModelData, and to perform any
+	 * other per-frame calculations that can't be done on worker threads.
 	 *
 	 * @param model The model.
 	 * @param data Private data as returned by CreateModelData.
@@ -154,6 +177,36 @@ public:
 	 * succeed.
 	 */
 	virtual void RenderModel(const CShaderProgramPtr& shader, int streamflags, CModel* model, CModelRData* data) = 0;
+
+
+	/**
+	 * BeginInstancing: Check whether several models can be rendered
+	 * with a single call to RenderModelsInstanced in this pass.
+	 *
+	 * ModelRenderer implementations may call this once after BeginPass.
+	 * Instancing needs support from both the ModelVertexRenderer and the
+	 * shader (which must read per-model data from the per-instance
+	 * attributes instead of from uniforms).
+	 *
+	 * @return true if RenderModelsInstanced must be used instead of
+	 * RenderModel for the rest of this pass.
+	 */
+	virtual bool BeginInstancing(const CShaderProgramPtr& shader) = 0;
+
+
+	/**
+	 * RenderModelsInstanced: Invoke the rendering commands for several
+	 * models that share the same CModelDef and material.
+	 *
+	 * preconditions  : BeginInstancing returned true in this pass, and
+	 * the most recent call to PrepareModelDef has been for the models'
+	 * CModelDef.
+	 *
+	 * @param streamflags Vertex streams required by the fragment stage.
+	 * @param models The models that should be rendered.
+	 * @param numModels Number of models (at least 1).
+	 */
+	virtual void RenderModelsInstanced(const CShaderProgramPtr& shader, int streamflags, CModel** models, size_t numModels) = 0;
 };
 
 
@@ -120,7 +120,7 @@ struct OverlayRendererInternals
 const float OverlayRenderer::OVERLAY_VOFFSET = 0.2f;
 
 OverlayRendererInternals::OverlayRendererInternals()
-	: quadVertices(GL_DYNAMIC_DRAW), quadIndices(GL_DYNAMIC_DRAW)
+	: quadVertices(GL_STREAM_DRAW), quadIndices(GL_DYNAMIC_DRAW)
 {
 	quadAttributePos.elems = 3;
 	quadAttributePos.type = GL_FLOAT;
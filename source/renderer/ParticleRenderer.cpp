@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,6 +29,9 @@ struct ParticleRendererInternals
 {
 	CShaderTechniquePtr shader;
 	CShaderTechniquePtr shaderSolid;
+	// Variants for emitters using the GPU simulation (loaded when first needed)
+	CShaderTechniquePtr shaderGPU;
+	CShaderTechniquePtr shaderGPUSolid;
 	std::vector<CParticleEmitter*> emitters;
 };
 
@@ -97,6 +100,14 @@ void ParticleRenderer::PrepareForRendering(const CShaderDefines& context)
 		{
 			CParticleEmitter* emitter = m->emitters[i];
 			emitter->UpdateArrayData();
+
+			if (emitter->m_GPUSimulation && !m->shaderGPU)
+			{
+				CShaderDefines defines;
+				defines.Add("USE_GPU_SIMULATION", "1");
+				m->shaderGPU = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("particle"), context, defines);
+				m->shaderGPUSolid = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("particle_solid"), context, defines);
+			}
 		}
 	}
 
@@ -113,20 +124,32 @@ void ParticleRenderer::PrepareForRendering(const CShaderDefines& context)
 
 void ParticleRenderer::RenderParticles(bool solidColor)
 {
-	CShaderTechniquePtr shader = solidColor ? m->shaderSolid : m->shader;
-
-	shader->BeginPass();
-
-	shader->GetShader()->Uniform("transform", g_Renderer.GetViewCamera().GetViewProjection());
-
 	if (!solidColor)
 		glEnable(GL_BLEND);
 	glDepthMask(0);
 
+	// Switch technique whenever the simulation mode changes, since the emitters
+	// have to stay sorted by distance
+	CShaderTechniquePtr shader;
 	for (size_t i = 0; i < m->emitters.size(); ++i)
 	{
 		CParticleEmitter* emitter = m->emitters[i];
 
+		CShaderTechniquePtr emitterShader;
+		if (emitter->m_GPUSimulation)
+			emitterShader = solidColor ? m->shaderGPUSolid : m->shaderGPU;
+		else
+			emitterShader = solidColor ? m->shaderSolid : m->shader;
+
+		if (emitterShader != shader)
+		{
+			if (shader)
+				shader->EndPass();
+			shader = emitterShader;
+			shader->BeginPass();
+			shader->GetShader()->Uniform("transform", g_Renderer.GetViewCamera().GetViewProjection());
+		}
+
 		emitter->Bind(shader->GetShader());
 		emitter->RenderArray(shader->GetShader());
 	}
@@ -139,7 +162,8 @@ void ParticleRenderer::RenderParticles(bool solidColor)
 	glDisable(GL_BLEND);
 	glDepthMask(1);
 
-	shader->EndPass();
+	if (shader)
+		shader->EndPass();
 }
 
 void ParticleRenderer::RenderBounds(CShaderProgramPtr& shader)
@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <numeric>
 
+#include "graphics/Camera.h"
 #include "graphics/GameView.h"
 #include "graphics/LightEnv.h"
 #include "graphics/LOSTexture.h"
@@ -45,10 +46,6 @@
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpWaterManager.h"
 
-#include "tools/atlas/GameInterface/GameLoop.h"
-
-extern GameLoopState* g_AtlasGameLoop;
-
 const ssize_t BlendOffsets[9][2] = {
 	{  0, -1 },
 	{ -1, -1 },
@@ -68,10 +65,19 @@ CPatchRData::CPatchRData(CPatch* patch, CSimulation2* simulation) :
 	m_VBBase(0), m_VBBaseIndices(0),
 	m_VBBlends(0), m_VBBlendIndices(0),
 	m_VBWater(0), m_VBWaterIndices(0),
-	m_Simulation(simulation)
+	m_Simulation(simulation), m_LOD(0)
 {
 	ENSURE(patch);
-	Build();
+
+	for (size_t l = 0; l < NUM_LOD_LEVELS; ++l)
+	{
+		m_LODIndexStart[l] = m_LODIndexCount[l] = 0;
+		// (Until the patch is built, only the full detail level is selectable)
+		m_LODError[l] = l == 0 ? 0.f : FLT_MAX;
+	}
+
+	// Build everything in the next Update
+	m_UpdateFlags = RENDERDATA_UPDATE_VERTICES | RENDERDATA_UPDATE_INDICES;
 }
 
 ///////////////////////////////////////////////////////////////////
@@ -144,14 +150,14 @@ struct SBlendLayer
 	std::vector<Tile> m_Tiles;
 };
 
-void CPatchRData::BuildBlends()
+void CPatchRData::BuildBlends(SBuildData& data)
 {
 	PROFILE3("build blends");
 
 	m_BlendSplats.clear();
 
-	std::vector<SBlendVertex> blendVertices;
-	std::vector<u16> blendIndices;
+	std::vector<SBlendVertex>& blendVertices = data.blendVertices;
+	std::vector<u16>& blendIndices = data.blendIndices;
 
 	CTerrain* terrain = m_Patch->m_Parent;
 
@@ -285,34 +291,6 @@ void CPatchRData::BuildBlends()
 
 		splat.m_IndexCount = blendIndices.size() - splat.m_IndexStart;
 	}
-
-	// Release existing vertex buffer chunks
-	if (m_VBBlends)
-	{
-		g_VBMan.Release(m_VBBlends);
-		m_VBBlends = 0;
-	}
-
-	if (m_VBBlendIndices)
-	{
-		g_VBMan.Release(m_VBBlendIndices);
-		m_VBBlendIndices = 0;
-	}
-
-	if (blendVertices.size())
-	{
-		// Construct vertex buffer
-
-		m_VBBlends = g_VBMan.Allocate(sizeof(SBlendVertex), blendVertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
-		m_VBBlends->m_Owner->UpdateChunkVertices(m_VBBlends, &blendVertices[0]);
-
-		// Update the indices to include the base offset of the vertex data
-		for (size_t k = 0; k < blendIndices.size(); ++k)
-			blendIndices[k] += m_VBBlends->m_Index;
-
-		m_VBBlendIndices = g_VBMan.Allocate(sizeof(u16), blendIndices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
-		m_VBBlendIndices->m_Owner->UpdateChunkVertices(m_VBBlendIndices, &blendIndices[0]);
-	}
 }
 
 void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector<u16>& blendIndices, 
@@ -429,7 +407,7 @@ void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector
 	}
 }
 
-void CPatchRData::BuildIndices()
+void CPatchRData::BuildIndices(SBuildData& data)
 {
 	PROFILE3("build indices");
 
@@ -438,17 +416,16 @@ void CPatchRData::BuildIndices()
 	ssize_t px = m_Patch->m_X * PATCH_SIZE;
 	ssize_t pz = m_Patch->m_Z * PATCH_SIZE;
 
-	// must have allocated some vertices before trying to build corresponding indices
-	ENSURE(m_VBBase);
-
 	// number of vertices in each direction in each patch
 	ssize_t vsize=PATCH_SIZE+1;
 
-	std::vector<unsigned short> indices;
+	// (the indices are relative to the patch's vertices, until they are uploaded)
+	std::vector<u16>& indices = data.indices;
 	indices.reserve(PATCH_SIZE * PATCH_SIZE * 4);
 
 	// release existing splats
-	m_Splats.clear();
+	for (size_t l = 0; l < NUM_LOD_LEVELS; ++l)
+		m_Splats[l].clear();
 
 	// build grid of textures on this patch
 	std::vector<CTerrainTextureEntry*> textures;
@@ -464,14 +441,13 @@ void CPatchRData::BuildIndices()
 	}
 
 	// now build base splats from interior textures
-	m_Splats.resize(textures.size());
+	m_Splats[0].resize(textures.size());
 	// build indices for base splats
-	size_t base=m_VBBase->m_Index;
-	ENSURE(base + vsize*vsize < 65536); // mustn't overflow u16 indexes
-	for (size_t i=0;i<m_Splats.size();i++) {
+	size_t base=0;
+	for (size_t i=0;i<m_Splats[0].size();i++) {
 		CTerrainTextureEntry* tex=textures[i];
 
-		SSplat& splat=m_Splats[i];
+		SSplat& splat=m_Splats[0][i];
 		splat.m_Texture=tex;
 		splat.m_IndexStart=indices.size();
 
@@ -508,22 +484,159 @@ void CPatchRData::BuildIndices()
 		splat.m_IndexCount=indices.size()-splat.m_IndexStart;
 	}
 
-	// Release existing vertex buffer chunk
-	if (m_VBBaseIndices)
-	{
-		g_VBMan.Release(m_VBBaseIndices);
-		m_VBBaseIndices = 0;
-	}
+	m_LODIndexStart[0] = 0;
+	m_LODIndexCount[0] = indices.size();
+	m_LODError[0] = 0.f;
 
+	for (size_t l = 1; l < NUM_LOD_LEVELS; ++l)
+		BuildLODIndices(data, l, &texgrid[0][0], textures);
 	ENSURE(indices.size());
+}
+
+
+void CPatchRData::BuildLODIndices(SBuildData& data, size_t level, CTerrainTextureEntry* const* texgrid, const std::vector<CTerrainTextureEntry*>& textures)
+{
+	// The coarser levels are drawn with the full detail vertices, skipping
+	// the ones inside cells of step*step tiles. The cells on the border of
+	// the patch are drawn as fans around their centre, with every vertex of
+	// the border, so the patch matches its neighbours whatever their level
+	// is. The other cells are drawn as two triangles.
+
+	const ssize_t step = (ssize_t)1 << level;
+	const ssize_t vsize = PATCH_SIZE + 1;
+	cassert(PATCH_SIZE % (1 << (NUM_LOD_LEVELS-1)) == 0);
+
+	const std::vector<SBaseVertex>& vertices = data.vertices;
+	std::vector<u16>& indices = data.indices;
+
+	m_LODIndexStart[level] = indices.size();
+
+	float error = 0.f;
+	for (size_t t = 0; t < textures.size(); ++t)
+	{
+		SSplat splat;
+		splat.m_Texture = textures[t];
+		splat.m_IndexStart = indices.size();
+
+		for (ssize_t z0 = 0; z0 < PATCH_SIZE; z0 += step)
+		{
+			for (ssize_t x0 = 0; x0 < PATCH_SIZE; x0 += step)
+			{
+				// Use the texture of the tile under the centre of the cell
+				if (texgrid[(z0 + step/2)*PATCH_SIZE + x0 + step/2] != textures[t])
+					continue;
+
+				ssize_t x1 = x0 + step;
+				ssize_t z1 = z0 + step;
+
+				u16 v00 = u16(z0*vsize + x0);
+				u16 v10 = u16(z0*vsize + x1);
+				u16 v01 = u16(z1*vsize + x0);
+				u16 v11 = u16(z1*vsize + x1);
+
+				float h00 = vertices[v00].m_Position.Y;
+				float h10 = vertices[v10].m_Position.Y;
+				float h01 = vertices[v01].m_Position.Y;
+				float h11 = vertices[v11].m_Position.Y;
+
+				// Estimate the error of the cell against the bilinear interpolation of its corners
+				for (ssize_t z = z0; z <= z1; ++z)
+				{
+					for (ssize_t x = x0; x <= x1; ++x)
+					{
+						float fx = (x - x0) / (float)step;
+						float fz = (z - z0) / (float)step;
+						float h = (h00*(1.f-fx) + h10*fx)*(1.f-fz) + (h01*(1.f-fx) + h11*fx)*fz;
+						error = std::max(error, fabsf(vertices[z*vsize + x].m_Position.Y - h));
+					}
+				}
 
-	// Construct vertex buffer
-	m_VBBaseIndices = g_VBMan.Allocate(sizeof(u16), indices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
-	m_VBBaseIndices->m_Owner->UpdateChunkVertices(m_VBBaseIndices, &indices[0]);
+				if (x0 > 0 && z0 > 0 && x1 < PATCH_SIZE && z1 < PATCH_SIZE)
+				{
+					// Same triangulation rule as CTerrain::GetTriangulationDir
+					if (h00 + h11 < h01 + h10)
+					{
+						indices.push_back(v00); indices.push_back(v10); indices.push_back(v01);
+						indices.push_back(v10); indices.push_back(v11); indices.push_back(v01);
+					}
+					else
+					{
+						indices.push_back(v00); indices.push_back(v10); indices.push_back(v11);
+						indices.push_back(v11); indices.push_back(v01); indices.push_back(v00);
+					}
+					continue;
+				}
+
+				u16 centre = u16((z0 + step/2)*vsize + x0 + step/2);
+
+				// Walk around the cell in the same winding as the full detail triangles
+				ssize_t southStep = z0 == 0 ? 1 : step;
+				ssize_t eastStep = x1 == PATCH_SIZE ? 1 : step;
+				ssize_t northStep = z1 == PATCH_SIZE ? 1 : step;
+				ssize_t westStep = x0 == 0 ? 1 : step;
+
+				for (ssize_t x = x0; x < x1; x += southStep)
+				{
+					indices.push_back(u16(z0*vsize + x));
+					indices.push_back(u16(z0*vsize + x + southStep));
+					indices.push_back(centre);
+				}
+				for (ssize_t z = z0; z < z1; z += eastStep)
+				{
+					indices.push_back(u16(z*vsize + x1));
+					indices.push_back(u16((z + eastStep)*vsize + x1));
+					indices.push_back(centre);
+				}
+				for (ssize_t x = x1; x > x0; x -= northStep)
+				{
+					indices.push_back(u16(z1*vsize + x));
+					indices.push_back(u16(z1*vsize + x - northStep));
+					indices.push_back(centre);
+				}
+				for (ssize_t z = z1; z > z0; z -= westStep)
+				{
+					indices.push_back(u16(z*vsize + x0));
+					indices.push_back(u16((z - westStep)*vsize + x0));
+					indices.push_back(centre);
+				}
+			}
+		}
+
+		splat.m_IndexCount = indices.size() - splat.m_IndexStart;
+		if (splat.m_IndexCount)
+			m_Splats[level].push_back(splat);
+	}
+
+	m_LODIndexCount[level] = indices.size() - m_LODIndexStart[level];
+	m_LODError[level] = std::max(error, m_LODError[level-1]);
 }
 
+void CPatchRData::SelectLOD(const CCamera& camera)
+{
+	m_LOD = 0;
+	if (!g_Renderer.m_Options.m_TerrainLOD)
+		return;
+
+	// Distance from the camera to the nearest point of the patch
+	const CBoundingBoxAligned& bounds = m_Patch->GetWorldBounds();
+	CVector3D pos = camera.GetOrientation().GetTranslation();
+	CVector3D nearest(
+		clamp(pos.X, bounds[0].X, bounds[1].X),
+		clamp(pos.Y, bounds[0].Y, bounds[1].Y),
+		clamp(pos.Z, bounds[0].Z, bounds[1].Z));
+	float distance = (nearest - pos).Length();
+	if (distance <= 0.f)
+		return;
+
+	// Number of pixels covered by one world unit at that distance
+	float pixelsPerUnit = camera.GetViewPort().m_Height / (2.f * tanf(camera.GetFOV() * 0.5f) * distance);
+
+	float maxError = g_Renderer.m_Options.m_TerrainLODError;
+	while (m_LOD + 1 < NUM_LOD_LEVELS && m_LODError[m_LOD + 1] * pixelsPerUnit <= maxError)
+		++m_LOD;
+}
 
-void CPatchRData::BuildVertices()
+void CPatchRData::BuildVertices(SBuildData& data)
 {
 	PROFILE3("build vertices");
 
@@ -532,7 +645,7 @@ void CPatchRData::BuildVertices()
 	// number of vertices in each direction in each patch
 	ssize_t vsize=PATCH_SIZE+1;
 
-	std::vector<SBaseVertex> vertices;
+	std::vector<SBaseVertex>& vertices = data.vertices;
 	vertices.resize(vsize*vsize);
 
 	// get index of this patch
@@ -565,19 +678,12 @@ void CPatchRData::BuildVertices()
 			vertices[v].m_DiffuseColor = cpuLighting ? lightEnv.EvaluateTerrainDiffuseScaled(normal) : lightEnv.EvaluateTerrainDiffuseFactor(normal);
 		}
 	}
-
-	// upload to vertex buffer
-	if (!m_VBBase)
-		m_VBBase = g_VBMan.Allocate(sizeof(SBaseVertex), vsize * vsize, GL_STATIC_DRAW, GL_ARRAY_BUFFER);
-
-	m_VBBase->m_Owner->UpdateChunkVertices(m_VBBase, &vertices[0]);
 }
 
-void CPatchRData::BuildSide(std::vector<SSideVertex>& vertices, CPatchSideFlags side)
+void CPatchRData::BuildSide(std::vector<SSideVertex>& vertices, CPatchSideFlags side, CmpPtr<ICmpWaterManager>& cmpWaterManager)
 {
 	ssize_t vsize = PATCH_SIZE + 1;
 	CTerrain* terrain = m_Patch->m_Parent;
-	CmpPtr<ICmpWaterManager> cmpWaterManager(*m_Simulation, SYSTEM_ENTITY);
 
 	for (ssize_t k = 0; k < vsize; k++)
 	{
@@ -619,11 +725,11 @@ void CPatchRData::BuildSide(std::vector<SSideVertex>& vertices, CPatchSideFlags
 	}
 }
 
-void CPatchRData::BuildSides()
+void CPatchRData::BuildSides(SBuildData& data, CmpPtr<ICmpWaterManager>& cmpWaterManager)
 {
 	PROFILE3("build sides");
 
-	std::vector<SSideVertex> sideVertices;
+	std::vector<SSideVertex>& sideVertices = data.sideVertices;
 
 	int sideFlags = m_Patch->GetSideFlags();
 
@@ -635,48 +741,164 @@ void CPatchRData::BuildSides()
 	// level and a vertex underneath at height 0.
 
 	if (sideFlags & CPATCH_SIDE_NEGX)
-		BuildSide(sideVertices, CPATCH_SIDE_NEGX);
+		BuildSide(sideVertices, CPATCH_SIDE_NEGX, cmpWaterManager);
 
 	if (sideFlags & CPATCH_SIDE_POSX)
-		BuildSide(sideVertices, CPATCH_SIDE_POSX);
+		BuildSide(sideVertices, CPATCH_SIDE_POSX, cmpWaterManager);
 
 	if (sideFlags & CPATCH_SIDE_NEGZ)
-		BuildSide(sideVertices, CPATCH_SIDE_NEGZ);
+		BuildSide(sideVertices, CPATCH_SIDE_NEGZ, cmpWaterManager);
 
 	if (sideFlags & CPATCH_SIDE_POSZ)
-		BuildSide(sideVertices, CPATCH_SIDE_POSZ);
+		BuildSide(sideVertices, CPATCH_SIDE_POSZ, cmpWaterManager);
+}
 
-	if (sideVertices.empty())
-		return;
+void CPatchRData::Build(SBuildData& data, CmpPtr<ICmpWaterManager>& cmpWaterManager)
+{
+	// TODO,RC 11/04/04 - need to only rebuild necessary bits of renderdata rather
+	// than everything; it's complicated slightly because the blends are dependent
+	// on both vertex and index data
+	BuildVertices(data);
+	BuildSides(data, cmpWaterManager);
+	BuildIndices(data);
+	BuildBlends(data);
+	BuildWater(data, cmpWaterManager);
+}
 
-	if (!m_VBSides)
-		m_VBSides = g_VBMan.Allocate(sizeof(SSideVertex), sideVertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
-	m_VBSides->m_Owner->UpdateChunkVertices(m_VBSides, &sideVertices[0]);
+void CPatchRData::Upload(SBuildData& data)
+{
+	// number of vertices in each direction in each patch
+	ssize_t vsize = PATCH_SIZE + 1;
+
+	// Base vertices and indices
+	if (!m_VBBase)
+		m_VBBase = g_VBMan.Allocate(sizeof(SBaseVertex), vsize * vsize, GL_STATIC_DRAW, GL_ARRAY_BUFFER);
+	m_VBBase->m_Owner->UpdateChunkVertices(m_VBBase, &data.vertices[0]);
+
+	size_t base = m_VBBase->m_Index;
+	ENSURE(base + vsize*vsize < 65536); // mustn't overflow u16 indexes
+	for (size_t k = 0; k < data.indices.size(); ++k)
+		data.indices[k] += base;
+
+	if (m_VBBaseIndices)
+	{
+		g_VBMan.Release(m_VBBaseIndices);
+		m_VBBaseIndices = 0;
+	}
+	m_VBBaseIndices = g_VBMan.Allocate(sizeof(u16), data.indices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
+	m_VBBaseIndices->m_Owner->UpdateChunkVertices(m_VBBaseIndices, &data.indices[0]);
+
+	// Sides
+	if (!data.sideVertices.empty())
+	{
+		if (!m_VBSides)
+			m_VBSides = g_VBMan.Allocate(sizeof(SSideVertex), data.sideVertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
+		m_VBSides->m_Owner->UpdateChunkVertices(m_VBSides, &data.sideVertices[0]);
+	}
+
+	// Blends
+	if (m_VBBlends)
+	{
+		g_VBMan.Release(m_VBBlends);
+		m_VBBlends = 0;
+	}
+	if (m_VBBlendIndices)
+	{
+		g_VBMan.Release(m_VBBlendIndices);
+		m_VBBlendIndices = 0;
+	}
+	if (!data.blendVertices.empty())
+	{
+		m_VBBlends = g_VBMan.Allocate(sizeof(SBlendVertex), data.blendVertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
+		m_VBBlends->m_Owner->UpdateChunkVertices(m_VBBlends, &data.blendVertices[0]);
+
+		// Update the indices to include the base offset of the vertex data
+		for (size_t k = 0; k < data.blendIndices.size(); ++k)
+			data.blendIndices[k] += m_VBBlends->m_Index;
+
+		m_VBBlendIndices = g_VBMan.Allocate(sizeof(u16), data.blendIndices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
+		m_VBBlendIndices->m_Owner->UpdateChunkVertices(m_VBBlendIndices, &data.blendIndices[0]);
+	}
+
+	// Water
+	if (m_VBWater)
+	{
+		g_VBMan.Release(m_VBWater);
+		m_VBWater = 0;
+	}
+	if (m_VBWaterIndices)
+	{
+		g_VBMan.Release(m_VBWaterIndices);
+		m_VBWaterIndices = 0;
+	}
+	if (!data.waterIndices.empty())
+	{
+		m_VBWater = g_VBMan.Allocate(sizeof(SWaterVertex), data.waterVertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
+		m_VBWater->m_Owner->UpdateChunkVertices(m_VBWater, &data.waterVertices[0]);
+
+		m_VBWaterIndices = g_VBMan.Allocate(sizeof(GLushort), data.waterIndices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
+		m_VBWaterIndices->m_Owner->UpdateChunkVertices(m_VBWaterIndices, &data.waterIndices[0]);
+	}
 }
 
-void CPatchRData::Build()
+struct CPatchRData::SUpdatePatchesJobs
+{
+	const std::vector<CPatchRData*>* patches;
+	std::vector<SBuildData>* data;
+	CmpPtr<ICmpWaterManager>* cmpWaterManager;
+};
+
+void CPatchRData::BuildJob(void* data, size_t index)
 {
-	BuildVertices();
-	BuildSides();
-	BuildIndices();
-	BuildBlends();
-	BuildWater();
+	const SUpdatePatchesJobs& jobs = *static_cast<SUpdatePatchesJobs*>(data);
+	(*jobs.patches)[index]->Build((*jobs.data)[index], *jobs.cmpWaterManager);
 }
 
 void CPatchRData::Update(CSimulation2* simulation)
 {
-	m_Simulation = simulation;
-	if (m_UpdateFlags!=0) {
-		// TODO,RC 11/04/04 - need to only rebuild necessary bits of renderdata rather
-		// than everything; it's complicated slightly because the blends are dependent
-		// on both vertex and index data
-		BuildVertices();
-		BuildSides();
-		BuildIndices();
-		BuildBlends();
-		BuildWater();
-
-		m_UpdateFlags=0;
+	std::vector<CPatchRData*> patches(1, this);
+	UpdatePatches(patches, simulation);
+}
+
+void CPatchRData::UpdatePatches(const std::vector<CPatchRData*>& patches, CSimulation2* simulation)
+{
+	std::vector<CPatchRData*> dirtyPatches;
+	for (size_t i = 0; i < patches.size(); ++i)
+	{
+		patches[i]->m_Simulation = simulation;
+		if (patches[i]->m_UpdateFlags != 0)
+			dirtyPatches.push_back(patches[i]);
+	}
+
+	if (dirtyPatches.empty())
+		return;
+
+	PROFILE3("update patches");
+
+	// We need to use this to access the water manager or we may not have the
+	// actual values but some compiled-in defaults
+	CmpPtr<ICmpWaterManager> cmpWaterManager(*simulation, SYSTEM_ENTITY);
+
+	// The water vertices use the shore data, which is computed on the worker
+	// threads too, so it must be ready before the patches get built
+	WaterManager* WaterMgr = g_Renderer.GetWaterManager();
+	if (cmpWaterManager && WaterMgr->NeedsSuperfancyInfoUpdate())
+		WaterMgr->CreateSuperfancyInfo(simulation);
+
+	// The patches only read the terrain and write their own data, so they
+	// can be built in parallel. The vertex buffers can only be updated on
+	// this thread, so keep the data until they are all built.
+	std::vector<SBuildData> data(dirtyPatches.size());
+	SUpdatePatchesJobs jobs = { &dirtyPatches, &data, &cmpWaterManager };
+	g_Renderer.GetWorkerPool().Run(&BuildJob, &jobs, dirtyPatches.size());
+
+	{
+		PROFILE3("upload patches");
+		for (size_t i = 0; i < dirtyPatches.size(); ++i)
+		{
+			dirtyPatches[i]->Upload(data[i]);
+			dirtyPatches[i]->m_UpdateFlags = 0;
+		}
 	}
 }
 
@@ -715,6 +937,51 @@ static const size_t ARENA_SIZE = 4*MiB; // this should be enough for fairly huge
 // Each multidraw batch has a list of index counts, and a list of pointers-to-first-indexes
 typedef std::pair<std::vector<GLint, ProxyAllocator<GLint, Allocators::Arena<> > >, std::vector<void*, ProxyAllocator<void*, Allocators::Arena<> > > > BatchElements;
 
+/**
+ * Appends a range of u16 indices to a batch, extending the last range instead
+ * when the new one directly follows it in the index buffer.
+ */
+template<typename T>
+static void AddBatchElements(T& batch, GLint count, u8* indices)
+{
+	if (!batch.first.empty() && (u8*)batch.second.back() + sizeof(u16)*batch.first.back() == indices)
+	{
+		batch.first.back() += count;
+		return;
+	}
+
+	batch.first.push_back(count);
+	batch.second.push_back(indices);
+}
+
+/**
+ * Draws all the ranges of a batch from the bound index buffer, as a single
+ * glMultiDrawElements call when the driver supports it.
+ */
+template<typename T>
+static void DrawBatchElements(const T& batch)
+{
+	if (batch.first.empty())
+		return;
+
+#if !CONFIG2_GLES
+	if (g_Renderer.GetCapabilities().m_MultiDraw)
+	{
+		if (!g_Renderer.m_SkipSubmit)
+			pglMultiDrawElementsEXT(GL_TRIANGLES, (const GLsizei*)&batch.first[0], GL_UNSIGNED_SHORT, (const GLvoid**)&batch.second[0], (GLsizei)batch.first.size());
+		g_Renderer.m_Stats.m_DrawCalls++;
+		return;
+	}
+#endif
+
+	if (!g_Renderer.m_SkipSubmit)
+	{
+		for (size_t i = 0; i < batch.first.size(); ++i)
+			glDrawElements(GL_TRIANGLES, batch.first[i], GL_UNSIGNED_SHORT, batch.second[i]);
+	}
+	g_Renderer.m_Stats.m_DrawCalls += batch.first.size();
+}
+
 // Group batches by index buffer
 typedef POOLED_BATCH_MAP(CVertexBuffer*, BatchElements) IndexBufferBatches;
 
@@ -737,9 +1004,10 @@ void CPatchRData::RenderBases(const std::vector<CPatchRData*>& patches, const CS
  	for (size_t i = 0; i < patches.size(); ++i)
  	{
  		CPatchRData* patch = patches[i];
- 		for (size_t j = 0; j < patch->m_Splats.size(); ++j)
+ 		std::vector<SSplat>& splats = patch->m_Splats[patch->m_LOD];
+ 		for (size_t j = 0; j < splats.size(); ++j)
  		{
- 			SSplat& splat = patch->m_Splats[j];
+ 			SSplat& splat = splats[j];
 
  			BatchElements& batch = PooledPairGet(
 				PooledMapGet(
@@ -749,10 +1017,8 @@ void CPatchRData::RenderBases(const std::vector<CPatchRData*>& patches, const CS
 				patch->m_VBBaseIndices->m_Owner, arena
 			);
 
- 			batch.first.push_back(splat.m_IndexCount);
-
  			u8* indexBase = patch->m_VBBaseIndices->m_Owner->GetBindAddress();
- 			batch.second.push_back(indexBase + sizeof(u16)*(patch->m_VBBaseIndices->m_Index + splat.m_IndexStart));
+ 			AddBatchElements(batch, splat.m_IndexCount, indexBase + sizeof(u16)*(patch->m_VBBaseIndices->m_Index + splat.m_IndexStart));
 		}
  	}
 
@@ -839,16 +1105,7 @@ void CPatchRData::RenderBases(const std::vector<CPatchRData*>& patches, const CS
 
 					BatchElements& batch = it->second;
 
-					if (!g_Renderer.m_SkipSubmit)
-					{
-						// Don't use glMultiDrawElements here since it doesn't have a significant
-						// performance impact and it suffers from various driver bugs (e.g. it breaks
-						// in Mesa 7.10 swrast with index VBOs)
-						for (size_t i = 0; i < batch.first.size(); ++i)
-							glDrawElements(GL_TRIANGLES, batch.first[i], GL_UNSIGNED_SHORT, batch.second[i]);
-					}
-
-					g_Renderer.m_Stats.m_DrawCalls++;
+					DrawBatchElements(batch);
 					g_Renderer.m_Stats.m_TerrainTris += std::accumulate(batch.first.begin(), batch.first.end(), 0) / 3;
 				}
 			}
@@ -926,7 +1183,7 @@ void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const C
  	for (size_t i = 0; i < patches.size(); ++i)
  	{
  		CPatchRData* patch = patches[i];
- 		if (!patch->m_BlendSplats.empty())
+ 		if (!patch->m_BlendSplats.empty() && patch->m_LOD == 0)
  		{
 
  			blendStacks.push_back(SBlendStackItem(patch->m_VBBlends, patch->m_VBBlendIndices, patch->m_BlendSplats, arena));
@@ -955,10 +1212,8 @@ void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const C
 					CVertexBuffer::VBChunk* indices = blendStacks[k].indices;
 
 					BatchElements& batch = PooledPairGet(PooledMapGet(batches.back().m_Batches, vertices->m_Owner, arena), indices->m_Owner, arena);
-					batch.first.push_back(splats.back().m_IndexCount);
-
 		 			u8* indexBase = indices->m_Owner->GetBindAddress();
-		 			batch.second.push_back(indexBase + sizeof(u16)*(indices->m_Index + splats.back().m_IndexStart));
+		 			AddBatchElements(batch, splats.back().m_IndexCount, indexBase + sizeof(u16)*(indices->m_Index + splats.back().m_IndexStart));
 
 					splats.pop_back();
 				}
@@ -1080,13 +1335,8 @@ void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const C
 
 					BatchElements& batch = it->second;
 
-					if (!g_Renderer.m_SkipSubmit)
-					{
-						for (size_t i = 0; i < batch.first.size(); ++i)
-							glDrawElements(GL_TRIANGLES, batch.first[i], GL_UNSIGNED_SHORT, batch.second[i]);
-					}
+					DrawBatchElements(batch);
 
-					g_Renderer.m_Stats.m_DrawCalls++;
 					g_Renderer.m_Stats.m_BlendSplats++;
 					g_Renderer.m_Stats.m_TerrainTris += std::accumulate(batch.first.begin(), batch.first.end(), 0) / 3;
 				}
@@ -1134,10 +1384,8 @@ void CPatchRData::RenderStreams(const std::vector<CPatchRData*>& patches, const
  		CPatchRData* patch = patches[i];
 		BatchElements& batch = batches[patch->m_VBBase->m_Owner][patch->m_VBBaseIndices->m_Owner];
 
-		batch.first.push_back(patch->m_VBBaseIndices->m_Count);
-
 		u8* indexBase = patch->m_VBBaseIndices->m_Owner->GetBindAddress();
- 		batch.second.push_back(indexBase + sizeof(u16)*(patch->m_VBBaseIndices->m_Index));
+ 		AddBatchElements(batch, patch->m_LODIndexCount[patch->m_LOD], indexBase + sizeof(u16)*(patch->m_VBBaseIndices->m_Index + patch->m_LODIndexStart[patch->m_LOD]));
  	}
 
  	PROFILE_END("compute batches");
@@ -1166,13 +1414,7 @@ void CPatchRData::RenderStreams(const std::vector<CPatchRData*>& patches, const
 
 			BatchElements& batch = it->second;
 
-			if (!g_Renderer.m_SkipSubmit)
-			{
-				for (size_t i = 0; i < batch.first.size(); ++i)
-					glDrawElements(GL_TRIANGLES, batch.first[i], GL_UNSIGNED_SHORT, batch.second[i]);
-			}
-
-			g_Renderer.m_Stats.m_DrawCalls++;
+			DrawBatchElements(batch);
 			g_Renderer.m_Stats.m_TerrainTris += std::accumulate(batch.first.begin(), batch.first.end(), 0) / 3;
 		}
 	}
@@ -1277,45 +1519,27 @@ void CPatchRData::RenderPriorities(CTextRenderer& textRenderer)
 //
 
 // Build vertex buffer for water vertices over our patch
-void CPatchRData::BuildWater()
+void CPatchRData::BuildWater(SBuildData& data, CmpPtr<ICmpWaterManager>& cmpWaterManager)
 {
 	PROFILE3("build water");
 
 	// number of vertices in each direction in each patch
 	ENSURE((PATCH_SIZE % water_cell_size) == 0);
 
-	if (m_VBWater)
-	{
-		g_VBMan.Release(m_VBWater);
-		m_VBWater = 0;
-	}
-	if (m_VBWaterIndices)
-	{
-		g_VBMan.Release(m_VBWaterIndices);
-		m_VBWaterIndices = 0;
-	}
 	m_WaterBounds.SetEmpty();
 
-	// We need to use this to access the water manager or we may not have the
-	// actual values but some compiled-in defaults
-	CmpPtr<ICmpWaterManager> cmpWaterManager(*m_Simulation, SYSTEM_ENTITY);
 	if (!cmpWaterManager)
 		return;
 	
 	// Build data for water
-	std::vector<SWaterVertex> water_vertex_data;
-	std::vector<GLushort> water_indices;
+	std::vector<SWaterVertex>& water_vertex_data = data.waterVertices;
+	std::vector<GLushort>& water_indices = data.waterIndices;
 	u16 water_index_map[PATCH_SIZE+1][PATCH_SIZE+1];
 	memset(water_index_map, 0xFF, sizeof(water_index_map));
 
 	// TODO: This is not (yet) exported via the ICmp interface so... we stick to these values which can be compiled in defaults
-	WaterManager* WaterMgr = g_Renderer.GetWaterManager();
+	const WaterManager* WaterMgr = g_Renderer.GetWaterManager();
 
-	if (WaterMgr->m_NeedsFullReloading && !g_AtlasGameLoop->running)
-	{
-		WaterMgr->m_NeedsFullReloading = false;
-		WaterMgr->CreateSuperfancyInfo(m_Simulation);
-	}
 	CPatch* patch = m_Patch;
 	CTerrain* terrain = patch->m_Parent;
 
@@ -1388,18 +1612,10 @@ void CPatchRData::BuildWater()
 					int tx = x+x1;
 					int ty = z+z1 + j*water_cell_size;
 
-					if (g_AtlasGameLoop->running)
-					{
-						// currently no foam is used so push whatever
-						vertex.m_WaterData = CVector4D(0.0f,0.0f,0.0f,0.0f);
-					}
-					else
-					{
-						vertex.m_WaterData = CVector4D(WaterMgr->m_WaveX[tx + ty*mapSize],
-												   WaterMgr->m_WaveZ[tx + ty*mapSize],
-												   WaterMgr->m_DistanceToShore[tx + ty*mapSize],
-												   WaterMgr->m_FoamFactor[tx + ty*mapSize]);
-					}
+					vertex.m_WaterData = CVector4D(WaterMgr->m_WaveX[tx + ty*mapSize],
+											   WaterMgr->m_WaveZ[tx + ty*mapSize],
+											   WaterMgr->m_DistanceToShore[tx + ty*mapSize],
+											   WaterMgr->m_FoamFactor[tx + ty*mapSize]);
 					water_index_map[z+j*water_cell_size][x] = water_vertex_data.size();
 					water_vertex_data.push_back(vertex);
 				}
@@ -1417,18 +1633,6 @@ void CPatchRData::BuildWater()
 			}
 		}
 	}
-
-	// no vertex buffers if no data generated
-	if (water_indices.size() == 0)
-		return;
-
-	// allocate vertex buffer
-	m_VBWater = g_VBMan.Allocate(sizeof(SWaterVertex), water_vertex_data.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
-	m_VBWater->m_Owner->UpdateChunkVertices(m_VBWater, &water_vertex_data[0]);
-
-	// Construct indices buffer
-	m_VBWaterIndices = g_VBMan.Allocate(sizeof(GLushort), water_indices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
-	m_VBWaterIndices->m_Owner->UpdateChunkVertices(m_VBWaterIndices, &water_indices[0]);
 }
 
 void CPatchRData::RenderWater(CShaderProgramPtr& shader)
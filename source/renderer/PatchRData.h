@@ -26,8 +26,11 @@
 #include "renderer/ShadowMap.h"
 #include "VertexBufferManager.h"
 
+class CCamera;
 class CPatch;
 class CSimulation2;
+class ICmpWaterManager;
+template<typename T> class CmpPtr;
 class CTerrainTextureEntry;
 class CTextRenderer;
 
@@ -37,10 +40,20 @@ class CTextRenderer;
 class CPatchRData : public CRenderData
 {
 public:
+	// number of terrain LOD levels; level i is drawn with cells of 2^i*2^i tiles
+	static const size_t NUM_LOD_LEVELS = 4;
+
 	CPatchRData(CPatch* patch, CSimulation2* simulation);
 	~CPatchRData();
 
 	void Update(CSimulation2* simulation);
+
+	/**
+	 * Rebuilds the render data of all the dirty patches in the list.
+	 * The vertex data is computed on the renderer's worker threads, and is
+	 * then uploaded to the vertex buffers on the calling thread.
+	 */
+	static void UpdatePatches(const std::vector<CPatchRData*>& patches, CSimulation2* simulation);
 	void RenderOutline();
 	void RenderSides(CShaderProgramPtr& shader);
 	void RenderPriorities(CTextRenderer& textRenderer);
@@ -59,6 +72,15 @@ public:
 
 	const CBoundingBoxAligned& GetWaterBounds() const { return m_WaterBounds; }
 
+	/**
+	 * Picks the coarsest level of detail whose height error, projected onto
+	 * the screen of the given camera, stays below the terrain LOD threshold.
+	 * Uses the errors from the last time the patch was built.
+	 */
+	void SelectLOD(const CCamera& camera);
+
+	size_t GetLOD() const { return m_LOD; }
+
 private:
 	friend struct SBlendStackItem;
 
@@ -113,18 +135,41 @@ private:
 	};
 	cassert(sizeof(SWaterVertex) == 32);
 
-	// build this renderdata object
-	void Build();
+	// CPU-side data of a patch, built on a worker thread and kept until it is
+	// uploaded to the vertex buffers
+	struct SBuildData {
+		std::vector<SBaseVertex> vertices;
+		std::vector<SSideVertex> sideVertices;
+		// base indices, relative to the first base vertex
+		std::vector<u16> indices;
+		std::vector<SBlendVertex> blendVertices;
+		// blend indices, relative to the first blend vertex
+		std::vector<u16> blendIndices;
+		std::vector<SWaterVertex> waterVertices;
+		std::vector<u16> waterIndices;
+	};
+
+	struct SUpdatePatchesJobs;
+
+	// build the CPU-side data of this renderdata object; safe to call
+	// from a worker thread
+	void Build(SBuildData& data, CmpPtr<ICmpWaterManager>& cmpWaterManager);
+
+	// upload the built data to the vertex buffers
+	void Upload(SBuildData& data);
+
+	static void BuildJob(void* data, size_t index);
 
 	void AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector<u16>& blendIndices, 
 			   u16 i, u16 j, u8 shape, CTerrainTextureEntry* texture);
 
-	void BuildBlends();
-	void BuildIndices();
-	void BuildVertices();
-	void BuildSides();
+	void BuildBlends(SBuildData& data);
+	void BuildIndices(SBuildData& data);
+	void BuildLODIndices(SBuildData& data, size_t level, CTerrainTextureEntry* const* texgrid, const std::vector<CTerrainTextureEntry*>& textures);
+	void BuildVertices(SBuildData& data);
+	void BuildSides(SBuildData& data, CmpPtr<ICmpWaterManager>& cmpWaterManager);
 
-	void BuildSide(std::vector<SSideVertex>& vertices, CPatchSideFlags side);
+	void BuildSide(std::vector<SSideVertex>& vertices, CPatchSideFlags side, CmpPtr<ICmpWaterManager>& cmpWaterManager);
 
 	// owner patch
 	CPatch* m_Patch;
@@ -144,8 +189,18 @@ private:
 	// vertex buffer handle for blend vertex indices
 	CVertexBuffer::VBChunk* m_VBBlendIndices;
 
-	// list of base splats to apply to this patch
-	std::vector<SSplat> m_Splats;
+	// list of base splats to apply to this patch, for each LOD level
+	std::vector<SSplat> m_Splats[NUM_LOD_LEVELS];
+
+	// range of the base indices used by each LOD level
+	size_t m_LODIndexStart[NUM_LOD_LEVELS];
+	size_t m_LODIndexCount[NUM_LOD_LEVELS];
+
+	// maximum height difference between each LOD level and the full detail terrain
+	float m_LODError[NUM_LOD_LEVELS];
+
+	// LOD level currently drawn; the blends are only drawn at level 0
+	size_t m_LOD;
 
 	// splats used in blend pass
 	std::vector<SSplat> m_BlendSplats;
@@ -161,8 +216,8 @@ private:
 
 	CSimulation2* m_Simulation;
 
-	// Build water vertices and indices (vertex buffer and data vector)
-	void BuildWater();
+	// Build water vertices and indices
+	void BuildWater(SBuildData& data, CmpPtr<ICmpWaterManager>& cmpWaterManager);
 
 	// parameter allowing a varying number of triangles per patch for LOD
 	// MUST be an exact divisor of PATCH_SIZE
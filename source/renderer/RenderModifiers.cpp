@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -78,11 +78,7 @@ void ShaderRenderModifier::BeginPass(const CShaderProgramPtr& shader)
 
 	if (GetShadowMap() && shader->GetTextureBinding("shadowTex").Active())
 	{
-		shader->BindTexture("shadowTex", GetShadowMap()->GetTexture());
-		shader->Uniform("shadowTransform", GetShadowMap()->GetTextureMatrix());
-		int width = GetShadowMap()->GetWidth();
-		int height = GetShadowMap()->GetHeight();
-		shader->Uniform("shadowScale", width, height, 1.0f / width, 1.0f / height); 
+		GetShadowMap()->BindTo(shader);
 	}
 
 	if (GetLightEnv())
@@ -51,6 +51,7 @@
 #include "graphics/Model.h"
 #include "graphics/ModelDef.h"
 #include "graphics/ParticleManager.h"
+#include "graphics/Patch.h"
 #include "graphics/ShaderManager.h"
 #include "graphics/Terrain.h"
 #include "graphics/Texture.h"
@@ -60,6 +61,7 @@
 #include "renderer/ModelRenderer.h"
 #include "renderer/OverlayRenderer.h"
 #include "renderer/ParticleRenderer.h"
+#include "renderer/PatchRData.h"
 #include "renderer/RenderModifiers.h"
 #include "renderer/ShadowMap.h"
 #include "renderer/SkyManager.h"
@@ -69,6 +71,8 @@
 #include "renderer/VertexBufferManager.h"
 #include "renderer/WaterManager.h"
 
+#include "simulation2/helpers/WorkerPool.h"
+
 extern bool g_GameRestarted;
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -112,7 +116,11 @@ private:
 		Row_Particles,
 		Row_VBReserved,
 		Row_VBAllocated,
+		Row_VBFragmented,
+		Row_VBBuffers,
 		Row_ShadersLoaded,
+		Row_TextureMemory,
+		Row_TexturesReduced,
 
 		// Must be last to count number of rows
 		NumberRows
@@ -208,12 +216,36 @@ CStr CRendererStatsTable::GetCellText(size_t row, size_t col)
 		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_VBMan.GetBytesAllocated());
 		return buf;
 
+	case Row_VBFragmented:
+		if (col == 0)
+			return "VB bytes fragmented";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_VBMan.GetBytesFragmented());
+		return buf;
+
+	case Row_VBBuffers:
+		if (col == 0)
+			return "# VBs";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_VBMan.GetBufferList().size());
+		return buf;
+
 	case Row_ShadersLoaded:
 		if (col == 0)
 			return "shader effects loaded";
 		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_Renderer.GetShaderManager().GetNumEffectsLoaded());
 		return buf;
 
+	case Row_TextureMemory:
+		if (col == 0)
+			return "texture bytes (estimated)";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_Renderer.GetTextureManager().GetMemoryUsage());
+		return buf;
+
+	case Row_TexturesReduced:
+		if (col == 0)
+			return "# textures streamed out";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_Renderer.GetTextureManager().GetNumReducedTextures());
+		return buf;
+
 	default:
 		return "???";
 	}
@@ -311,13 +343,31 @@ public:
 		ModelVertexRendererPtr VertexGPUSkinningShader;
 
 		LitRenderModifierPtr ModShader;
+
+		/// Whether VertexInstancingShader may draw models with instanced draw calls
+		bool HWInstancing;
+
+		/// Whether VertexGPUSkinningShader may draw models with instanced draw calls,
+		/// using textures of baked animation poses
+		bool SkinningTextures;
 	} Model;
 
 	CShaderDefines globalContext;
 
+	/// Threads for preparing models (lazily constructed)
+	WorkerPool* workerPool;
+
 	CRendererInternals() :
-		IsOpen(false), ShadersDirty(true), profileTable(g_Renderer.m_Stats), textureManager(g_VFS, false, false)
+		IsOpen(false), ShadersDirty(true), profileTable(g_Renderer.m_Stats), textureManager(g_VFS, false, false),
+		workerPool(NULL)
 	{
+		Model.HWInstancing = false;
+		Model.SkinningTextures = false;
+	}
+
+	~CRendererInternals()
+	{
+		delete workerPool;
 	}
 
 	/**
@@ -354,6 +404,11 @@ public:
 		{
 			contextSkinned.Add("USE_INSTANCING", "1");
 			contextSkinned.Add("USE_GPU_SKINNING", "1");
+			if (Model.SkinningTextures)
+			{
+				contextSkinned.Add("USE_HW_INSTANCING", "1");
+				contextSkinned.Add("USE_SKINNING_TEXTURE", "1");
+			}
 		}
 		Model.NormalSkinned->Render(Model.ModShader, contextSkinned, flags);
 
@@ -361,6 +416,8 @@ public:
 		{
 			CShaderDefines contextUnskinned = context;
 			contextUnskinned.Add("USE_INSTANCING", "1");
+			if (Model.HWInstancing)
+				contextUnskinned.Add("USE_HW_INSTANCING", "1");
 			Model.NormalUnskinned->Render(Model.ModShader, contextUnskinned, flags);
 		}
 	}
@@ -375,6 +432,11 @@ public:
 		{
 			contextSkinned.Add("USE_INSTANCING", "1");
 			contextSkinned.Add("USE_GPU_SKINNING", "1");
+			if (Model.SkinningTextures)
+			{
+				contextSkinned.Add("USE_HW_INSTANCING", "1");
+				contextSkinned.Add("USE_SKINNING_TEXTURE", "1");
+			}
 		}
 		Model.TranspSkinned->Render(Model.ModShader, contextSkinned, flags);
 
@@ -382,6 +444,8 @@ public:
 		{
 			CShaderDefines contextUnskinned = context;
 			contextUnskinned.Add("USE_INSTANCING", "1");
+			if (Model.HWInstancing)
+				contextUnskinned.Add("USE_HW_INSTANCING", "1");
 			Model.TranspUnskinned->Render(Model.ModShader, contextUnskinned, flags);
 		}
 	}
@@ -433,11 +497,21 @@ CRenderer::CRenderer()
 	m_Options.m_ShadowAlphaFix = true;
 	m_Options.m_ARBProgramShadow = true;
 	m_Options.m_ShadowPCF = false;
+	m_Options.m_ShadowCache = true;
+	m_Options.m_ShadowCascades = 1;
+	m_Options.m_TerrainLOD = false;
+	m_Options.m_MultiDraw = true;
+	m_Options.m_TerrainLODError = 2.0f;
+	m_Options.m_ShaderCache = true;
+	m_Options.m_AsyncShaders = true;
 	m_Options.m_Particles = false;
 	m_Options.m_Silhouettes = false;
 	m_Options.m_PreferGLSL = false;
 	m_Options.m_ForceAlphaTest = false;
 	m_Options.m_GPUSkinning = false;
+	m_Options.m_HWInstancing = true;
+	m_Options.m_SkinningTextures = true;
+	m_Options.m_GPUParticles = false;
 	m_Options.m_GenTangents = false;
 	m_Options.m_SmoothLOS = false;
 	m_Options.m_Postproc = false;
@@ -447,10 +521,26 @@ CRenderer::CRenderer()
 	CFG_GET_VAL("preferglsl", Bool, m_Options.m_PreferGLSL);
 	CFG_GET_VAL("forcealphatest", Bool, m_Options.m_ForceAlphaTest);
 	CFG_GET_VAL("gpuskinning", Bool, m_Options.m_GPUSkinning);
+	CFG_GET_VAL("hwinstancing", Bool, m_Options.m_HWInstancing);
+	CFG_GET_VAL("skinningtextures", Bool, m_Options.m_SkinningTextures);
+	CFG_GET_VAL("gpuparticles", Bool, m_Options.m_GPUParticles);
+	CFG_GET_VAL("shadowcache", Bool, m_Options.m_ShadowCache);
+	CFG_GET_VAL("shadowcascades", Int, m_Options.m_ShadowCascades);
+	CFG_GET_VAL("terrainlod", Bool, m_Options.m_TerrainLOD);
+	CFG_GET_VAL("terrainloderror", Float, m_Options.m_TerrainLODError);
+	CFG_GET_VAL("multidraw", Bool, m_Options.m_MultiDraw);
+	CFG_GET_VAL("shadercache", Bool, m_Options.m_ShaderCache);
+	CFG_GET_VAL("asyncshaders", Bool, m_Options.m_AsyncShaders);
 	CFG_GET_VAL("gentangents", Bool, m_Options.m_GenTangents);
 	CFG_GET_VAL("smoothlos", Bool, m_Options.m_SmoothLOS);
 	CFG_GET_VAL("postproc", Bool, m_Options.m_Postproc);
 
+	bool textureStreaming = false;
+	int textureBudget = 0;
+	CFG_GET_VAL("textures.streaming", Bool, textureStreaming);
+	CFG_GET_VAL("textures.budget", Int, textureBudget);
+	m->textureManager.SetStreaming(textureStreaming, (size_t)std::max(textureBudget, 0) * MiB);
+
 	CStr skystring = "0 0 0";
 	CColor skycolor;
 	CFG_GET_VAL("skycolor", String, skystring);
@@ -519,6 +609,10 @@ void CRenderer::EnumCaps()
 	m_Caps.m_VertexShader = false;
 	m_Caps.m_FragmentShader = false;
 	m_Caps.m_Shadows = false;
+	m_Caps.m_Instancing = false;
+	m_Caps.m_MultiDraw = false;
+	m_Caps.m_ProgramBinary = false;
+	m_Caps.m_VertexTextures = false;
 
 	// now start querying extensions
 	if (!m_Options.m_NoVBO) {
@@ -550,6 +644,29 @@ void CRenderer::EnumCaps()
 		if (ogl_max_tex_units >= 4)
 			m_Caps.m_Shadows = true;
 	}
+
+	if (m_Caps.m_VBO && 0 == ogl_HaveExtensions(0, "GL_ARB_draw_instanced", "GL_ARB_instanced_arrays", NULL))
+		m_Caps.m_Instancing = true;
+
+	// (Can be disabled in the config for drivers where it's broken, e.g. Mesa 7.10
+	// swrast with index VBOs)
+	if (m_Options.m_MultiDraw && (ogl_HaveVersion("1.4") || ogl_HaveExtension("GL_EXT_multi_draw_arrays")))
+		m_Caps.m_MultiDraw = true;
+
+	// Compiled GLSL programs can be saved to the cache, to avoid recompiling
+	// them on the next run
+	if (m_Options.m_ShaderCache && (ogl_HaveVersion("4.1") || ogl_HaveExtension("GL_ARB_get_program_binary")))
+		m_Caps.m_ProgramBinary = true;
+
+	// Vertex shaders can read float textures (e.g. the baked animation poses
+	// used for instanced GPU skinning)
+	if (ogl_HaveVersion("3.0") || ogl_HaveExtension("GL_ARB_texture_float"))
+	{
+		GLint vertexTextureUnits = 0;
+		glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &vertexTextureUnits);
+		if (vertexTextureUnits > 0)
+			m_Caps.m_VertexTextures = true;
+	}
 #endif
 }
 
@@ -585,6 +702,9 @@ void CRenderer::ReloadShaders()
 #if !CONFIG2_GLES
 		m->globalContext.Add("USE_SHADOW_SAMPLER", "1");
 #endif
+		int cascades = clamp(m_Options.m_ShadowCascades, 1, (int)ShadowMap::MAX_CASCADES);
+		if (cascades > 1)
+			m->globalContext.Add("SHADOW_CASCADES", CStr::FromInt(cascades).c_str());
 	}
 
 	if (m_LightEnv)
@@ -594,16 +714,19 @@ void CRenderer::ReloadShaders()
 
 	bool cpuLighting = (GetRenderPath() == RP_FIXED);
 	m->Model.VertexRendererShader = ModelVertexRendererPtr(new ShaderModelVertexRenderer(cpuLighting));
-	m->Model.VertexInstancingShader = ModelVertexRendererPtr(new InstancingModelRenderer(false, m_Options.m_GenTangents));
+	m->Model.HWInstancing = (GetRenderPath() == RP_SHADER && m_Caps.m_Instancing && m_Options.m_HWInstancing);
+	m->Model.VertexInstancingShader = ModelVertexRendererPtr(new InstancingModelRenderer(false, m_Options.m_GenTangents, m->Model.HWInstancing));
 
 	if (GetRenderPath() == RP_SHADER && m_Options.m_GPUSkinning) // TODO: should check caps and GLSL etc too
 	{
-		m->Model.VertexGPUSkinningShader = ModelVertexRendererPtr(new InstancingModelRenderer(true, m_Options.m_GenTangents));
+		m->Model.SkinningTextures = (m->Model.HWInstancing && m_Caps.m_VertexTextures && m_Options.m_SkinningTextures);
+		m->Model.VertexGPUSkinningShader = ModelVertexRendererPtr(new InstancingModelRenderer(true, m_Options.m_GenTangents, m->Model.SkinningTextures));
 		m->Model.NormalSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexGPUSkinningShader));
 		m->Model.TranspSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexGPUSkinningShader));
 	}
 	else
 	{
+		m->Model.SkinningTextures = false;
 		m->Model.VertexGPUSkinningShader.reset();
 		m->Model.NormalSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexRendererShader));
 		m->Model.TranspSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexRendererShader));
@@ -850,6 +973,9 @@ void CRenderer::BeginFrame()
 
 	if (m->ShadersDirty)
 		ReloadShaders();
+
+	// Compile some of the shaders that were deferred by LoadEffectWithFallback
+	m->shaderManager.MakeProgress();
 	
 	m->Model.ModShader->SetShadowMap(&m->shadow);
 	m->Model.ModShader->SetLightEnv(m_LightEnv);
@@ -871,41 +997,92 @@ void CRenderer::SetClearColor(SColor4ub color)
 	m_ClearColor[3] = float(color.A) / 255.0f;
 }
 
-void CRenderer::RenderShadowMap(const CShaderDefines& context)
+/**
+ * Selects the shadow casters that can affect the visible scene in the given
+ * cascade, and that are (or aren't) in the shadow map's static layer.
+ */
+class CShadowCasterFilter : public CModelFilter
 {
-	PROFILE3_GPU("shadow map");
-
-	m->shadow.BeginRender();
+public:
+	CShadowCasterFilter(const ShadowMap& shadow, bool staticLayer, size_t cascade) :
+		m_Shadow(shadow), m_StaticLayer(staticLayer), m_Cascade(cascade)
+	{
+	}
 
+	bool Filter(CModel *model)
 	{
-		PROFILE("render patches");
-		glCullFace(GL_FRONT);
-		glEnable(GL_CULL_FACE);
-		m->terrainRenderer.RenderPatches();
-		glCullFace(GL_BACK);
+		return (model->GetFlags() & MODELFLAG_CASTSHADOWS) &&
+			m_Shadow.IsInStaticLayer(model) == m_StaticLayer &&
+			m_Shadow.IsCasterVisible(model->GetWorldBounds(), m_Cascade);
 	}
 
+private:
+	const ShadowMap& m_Shadow;
+	bool m_StaticLayer;
+	size_t m_Cascade;
+};
+
+void CRenderer::RenderShadowMap(const CShaderDefines& context)
+{
+	PROFILE3_GPU("shadow map");
+
 	CShaderDefines contextCast = context;
 	contextCast.Add("MODE_SHADOWCAST", "1");
 
-	{
-		PROFILE("render models");
-		m->CallModelRenderers(contextCast, MODELFLAG_CASTSHADOWS);
-	}
+	bool staticCache = m->shadow.IsStaticCacheEnabled();
 
+	if (m->shadow.BeginRenderStatic())
 	{
-		PROFILE("render transparent models");
-		// disable face-culling for two-sided models
-		glDisable(GL_CULL_FACE);
-		m->CallTranspModelRenderers(contextCast, MODELFLAG_CASTSHADOWS);
-		glEnable(GL_CULL_FACE);
+		RenderShadowCasters(contextCast, true, true);
+		m->shadow.EndRender();
 	}
 
+	m->shadow.BeginRender();
+	// With the static layer, the terrain has already been rendered into it
+	RenderShadowCasters(contextCast, !staticCache, false);
 	m->shadow.EndRender();
 
 	m->SetOpenGLCamera(m_ViewCamera);
 }
 
+void CRenderer::RenderShadowCasters(const CShaderDefines& contextCast, bool patches, bool staticLayer)
+{
+	for (size_t i = 0; i < m->shadow.GetCascadeCount(); ++i)
+	{
+		if (!m->shadow.BeginCascade(i))
+			continue;
+
+		if (patches)
+		{
+			PROFILE("render patches");
+			if (m->terrainRenderer.CullPatches(&m->shadow.GetCasterFrustum(i)))
+			{
+				glCullFace(GL_FRONT);
+				glEnable(GL_CULL_FACE);
+				m->terrainRenderer.RenderPatches(true);
+				glCullFace(GL_BACK);
+			}
+		}
+
+		CShadowCasterFilter filter(m->shadow, staticLayer, i);
+
+		{
+			PROFILE("render models");
+			m->FilterModels(filter, MODELFLAG_FILTERED);
+			m->CallModelRenderers(contextCast, MODELFLAG_FILTERED);
+		}
+
+		{
+			PROFILE("render transparent models");
+			// disable face-culling for two-sided models
+			glDisable(GL_CULL_FACE);
+			m->FilterTranspModels(filter, MODELFLAG_FILTERED);
+			m->CallTranspModelRenderers(contextCast, MODELFLAG_FILTERED);
+			glEnable(GL_CULL_FACE);
+		}
+	}
+}
+
 void CRenderer::RenderPatches(const CShaderDefines& context, const CFrustum* frustum)
 {
 	PROFILE3_GPU("patches");
@@ -1626,6 +1803,10 @@ void CRenderer::EndFrame()
 	if (m->Model.TranspUnskinned != m->Model.TranspSkinned)
 		m->Model.TranspUnskinned->EndFrame();
 
+	g_VBMan.EndFrame();
+
+	m->textureManager.EndFrame();
+
 	ogl_tex_bind(0, 0);
 
 	{
@@ -1700,7 +1881,18 @@ void CRenderer::SetViewport(const SViewPort &vp)
 
 void CRenderer::Submit(CPatch* patch)
 {
+	// (Check before TerrainRenderer::Submit selects the patch's LOD)
+	CPatchRData* data = static_cast<CPatchRData*>(patch->GetRenderData());
+	bool changed = !data || (data->m_UpdateFlags & RENDERDATA_UPDATE_VERTICES);
+	size_t lod = data ? data->GetLOD() : 0;
+
 	m->terrainRenderer.Submit(patch);
+
+	if (m_Caps.m_Shadows && m_Options.m_Shadows && GetRenderPath() == RP_SHADER)
+	{
+		data = static_cast<CPatchRData*>(patch->GetRenderData());
+		m->shadow.SubmitStaticPatch(patch, changed || data->GetLOD() != lod);
+	}
 }
 
 void CRenderer::Submit(SOverlayLine* overlay)
@@ -1735,16 +1927,20 @@ void CRenderer::Submit(CParticleEmitter* emitter)
 
 void CRenderer::SubmitNonRecursive(CModel* model)
 {
+	bool requiresSkinning = (model->GetModelDef()->GetNumBones() != 0);
+
 	if (model->GetFlags() & MODELFLAG_CASTSHADOWS)
 	{
 		m->shadow.AddShadowedBound(model->GetWorldBounds());
+
+		// Unskinned models (buildings, trees, etc) rarely move, so they can be cached
+		if (!requiresSkinning)
+			m->shadow.SubmitStaticCaster(model, model->GetWorldBounds());
 	}
 
 	// Tricky: The call to GetWorldBounds() above can invalidate the position
 	model->ValidatePosition();
 
-	bool requiresSkinning = (model->GetModelDef()->GetNumBones() != 0);
-
 	if (model->GetMaterial().UsesAlphaBlending())
 	{
 		if (requiresSkinning)
@@ -2112,6 +2308,13 @@ TerrainRenderer& CRenderer::GetTerrainRenderer()
 	return m->terrainRenderer;
 }
 
+WorkerPool& CRenderer::GetWorkerPool()
+{
+	if (!m->workerPool)
+		m->workerPool = new WorkerPool("Render worker");
+	return *m->workerPool;
+}
+
 CTimeManager& CRenderer::GetTimeManager()
 {
 	return m->timeManager;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -50,6 +50,7 @@ class RenderPathVertexShader;
 class SkyManager;
 class TerrainRenderer;
 class WaterManager;
+class WorkerPool;
 
 // rendering modes
 enum ERenderMode { WIREFRAME, SOLID, EDGED_FACES };
@@ -142,10 +143,20 @@ public:
 		bool m_ShadowAlphaFix;
 		bool m_ARBProgramShadow;
 		bool m_ShadowPCF;
+		bool m_ShadowCache;
+		int m_ShadowCascades;
+		bool m_TerrainLOD;
+		bool m_MultiDraw;
+		float m_TerrainLODError;
+		bool m_ShaderCache;
+		bool m_AsyncShaders;
 		bool m_Particles;
 		bool m_PreferGLSL;
 		bool m_ForceAlphaTest;
 		bool m_GPUSkinning;
+		bool m_HWInstancing;
+		bool m_SkinningTextures;
+		bool m_GPUParticles;
 		bool m_Silhouettes;
 		bool m_GenTangents;
 		bool m_SmoothLOS;
@@ -160,6 +171,10 @@ public:
 		bool m_VertexShader;
 		bool m_FragmentShader;
 		bool m_Shadows;
+		bool m_Instancing;
+		bool m_MultiDraw;
+		bool m_ProgramBinary;
+		bool m_VertexTextures;
 	};
 
 public:
@@ -310,6 +325,12 @@ public:
 	
 	CPostprocManager& GetPostprocManager();
 
+	/**
+	 * Returns the pool of threads for preparing independent pieces of data
+	 * each frame (e.g. skinning models).
+	 */
+	WorkerPool& GetWorkerPool();
+
 	/**
 	 * GetCapabilities: Return which OpenGL capabilities are available and enabled.
 	 *
@@ -322,6 +343,7 @@ public:
 protected:
 	friend struct CRendererInternals;
 	friend class CVertexBuffer;
+	friend class CStreamingBuffer;
 	friend class CPatchRData;
 	friend class CDecalRData;
 	friend class FixedFunctionModelRenderer;
@@ -380,6 +402,8 @@ protected:
 
 	// shadow rendering stuff
 	void RenderShadowMap(const CShaderDefines& context);
+	// render the terrain (if @p patches) and the shadow casters that are (or aren't) in the static layer
+	void RenderShadowCasters(const CShaderDefines& contextCast, bool patches, bool staticLayer);
 
 	// render water reflection and refraction textures
 	SScreenRect RenderReflections(const CShaderDefines& context, const CBoundingBoxAligned& scissor);
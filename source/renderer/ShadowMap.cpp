@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,20 +27,73 @@
 #include "ps/CLogger.h"
 #include "ps/Profile.h"
 
+#include "graphics/Camera.h"
+#include "graphics/Frustum.h"
 #include "graphics/LightEnv.h"
 #include "graphics/ShaderManager.h"
 
 #include "maths/BoundingBoxAligned.h"
 #include "maths/MathUtil.h"
 #include "maths/Matrix3D.h"
+#include "maths/Vector4D.h"
 
 #include "renderer/Renderer.h"
 #include "renderer/ShadowMap.h"
 
+#include <boost/unordered_map.hpp>
+
+// The static layer is re-rendered when the camera moves further than this (in world space)...
+static const float STATIC_CACHE_MOVE_THRESHOLD = 16.f;
+// ...or turns so that the cosine of the angle to the cached view direction is below this
+static const float STATIC_CACHE_TURN_THRESHOLD = 0.9995f;
+// Extra space around the shadow bounds of the static layer, to keep covering
+// the view while the camera moves within the thresholds
+static const float STATIC_CACHE_MARGIN = 32.f;
+// Maximum number of static casters that are rendered with the dynamic ones (because
+// they weren't visible when the static layer was rendered) before it's re-rendered
+static const size_t STATIC_CACHE_MAX_UNCACHED = 64;
+// Casters that have moved are treated as dynamic until they've not been submitted
+// for this many frames
+static const size_t STATIC_CACHE_MOVING_EXPIRY_FRAMES = 1000;
+
+// Weight of the logarithmic distribution (against the uniform one) when splitting
+// the view frustum into cascades
+static const float CASCADE_SPLIT_LOG_WEIGHT = 0.75f;
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // ShadowMap implementation
 
+/**
+ * Struct ShadowCascade: Data for one cascade of the shadow map, which covers part
+ * of the view frustum with its own part of the texture
+ */
+struct ShadowCascade
+{
+	// view-space distance of the far end of the cascade's part of the view frustum
+	float SplitDistance;
+	// camera for the cascade's part of the view frustum, transformed into light space
+	CCamera LightspaceCamera;
+	// bounding box of shadowed objects in the cascade, in light space
+	CBoundingBoxAligned ShadowBound;
+	// transform light space into projected light space
+	// in projected light space, the shadowbound box occupies the [-1..1] cube
+	// calculated on BeginRender, after the final shadow bounds are known
+	CMatrix3D LightProjection;
+	// Transform world space into texture space of the shadow map;
+	// calculated on BeginRender, after the final shadow bounds are known
+	CMatrix3D TextureMatrix;
+	// World space volume containing all casters that can shadow anything in
+	// ShadowBound, for culling; calculated with the matrices
+	CFrustum CasterFrustum;
+
+	// Copies of the above used for rendering the static layer
+	CMatrix3D CachedLightProjection;
+	CMatrix3D CachedTextureMatrix;
+	CBoundingBoxAligned CachedShadowBound;
+	CFrustum CachedCasterFrustum;
+};
+
 /**
  * Struct ShadowMapInternals: Internal data for the ShadowMap implementation
  */
@@ -54,25 +107,19 @@ struct ShadowMapInternals
 	GLuint Texture;
 	// width, height of shadow map
 	int Width, Height;
-	// used width, height of shadow map
+	// used width, height of each cascade's part of the shadow map
 	int EffectiveWidth, EffectiveHeight;
-	// transform light space into projected light space
-	// in projected light space, the shadowbound box occupies the [-1..1] cube
-	// calculated on BeginRender, after the final shadow bounds are known
-	CMatrix3D LightProjection;
 	// Transform world space into light space; calculated on SetupFrame
 	CMatrix3D LightTransform;
-	// Transform world space into texture space of the shadow map;
-	// calculated on BeginRender, after the final shadow bounds are known
-	CMatrix3D TextureMatrix;
 
 	// transform light space into world space
 	CMatrix3D InvLightTransform;
-	// bounding box of shadowed objects in light space
+	// bounding box of all shadowed objects in light space
 	CBoundingBoxAligned ShadowBound;
 
-	// Camera transformed into light space
-	CCamera LightspaceCamera;
+	// The cascades (side by side in the texture, nearest on the left)
+	ShadowCascade Cascades[ShadowMap::MAX_CASCADES];
+	size_t CascadeCount;
 
 	// Some drivers (at least some Intel Mesa ones) appear to handle alpha testing
 	// incorrectly when the FBO has only a depth attachment.
@@ -87,9 +134,53 @@ struct ShadowMapInternals
 	// Save the caller's FBO so it can be restored
 	GLint SavedViewFBO;
 
+	// Static shadow caching (see ShadowMap::SubmitStaticCaster):
+	// whether it's supported and enabled
+	bool UseStaticCache;
+	// depth texture (and its framebuffer) containing the shadows of the static casters
+	GLuint StaticFramebuffer;
+	GLuint StaticTexture;
+	// whether StaticTexture and the cached matrices can be used for this frame
+	bool StaticValid;
+	// incremented by SetupFrame
+	size_t FrameNumber;
+
+	// Camera and light when the static layer was rendered, and this frame's ones
+	CVector3D CachedEyePos, CachedViewDir, CachedLightDir;
+	CVector3D EyePos, ViewDir, LightDir;
+	// Culling frustum of this frame's camera
+	CFrustum CameraFrustum;
+
+	// Matrices used for rendering the static layer (see also ShadowCascade)
+	CMatrix3D CachedLightTransform, CachedInvLightTransform;
+
+	struct CasterEntry
+	{
+		CBoundingBoxAligned bounds;
+		size_t frame; // last frame it was submitted (unmoved)
+	};
+	typedef boost::unordered_map<const void*, CasterEntry> CasterMap;
+	// Static casters included in the static layer
+	CasterMap StaticCasters;
+	// Static casters submitted this frame (except the moving ones)
+	std::vector<std::pair<const void*, CBoundingBoxAligned> > FrameStaticCasters;
+	// Number of FrameStaticCasters that aren't in the static layer
+	size_t NumUncachedCasters;
+	// Casters which have moved since they were cached, and the last frame they were submitted
+	boost::unordered_map<const void*, size_t> MovingCasters;
+
+	// Order-independent checksum (and count) of the patches submitted this frame,
+	// and of the ones in the static layer
+	size_t PatchChecksum, NumPatches;
+	size_t CachedPatchChecksum, CachedNumPatches;
+	// Whether any submitted patch has changed since it was last rendered
+	bool PatchChanged;
+
 	// Helper functions
-	void CalcShadowMatrices();
+	void CalcShadowMatrices(size_t cascade);
 	void CreateTexture();
+	bool IsStaticCacheUsable();
+	void BeginFramebuffer(GLuint framebuffer, bool copyStatic);
 };
 
 
@@ -106,6 +197,16 @@ ShadowMap::ShadowMap()
 	m->EffectiveWidth = 0;
 	m->EffectiveHeight = 0;
 	m->DepthTextureBits = 0;
+	m->CascadeCount = 1;
+	m->UseStaticCache = false;
+	m->StaticFramebuffer = 0;
+	m->StaticTexture = 0;
+	m->StaticValid = false;
+	m->FrameNumber = 0;
+	m->NumUncachedCasters = 0;
+	m->PatchChecksum = m->NumPatches = 0;
+	m->CachedPatchChecksum = m->CachedNumPatches = 0;
+	m->PatchChanged = false;
 	// DepthTextureBits: 24/32 are very much faster than 16, on GeForce 4 and FX;
 	// but they're very much slower on Radeon 9800.
 	// In both cases, the default (no specified depth) is fast, so we just use
@@ -125,6 +226,10 @@ ShadowMap::~ShadowMap()
 		glDeleteTextures(1, &m->DummyTexture);
 	if (m->Framebuffer)
 		pglDeleteFramebuffersEXT(1, &m->Framebuffer);
+	if (m->StaticTexture)
+		glDeleteTextures(1, &m->StaticTexture);
+	if (m->StaticFramebuffer)
+		pglDeleteFramebuffersEXT(1, &m->StaticFramebuffer);
 
 	delete m;
 }
@@ -140,10 +245,17 @@ void ShadowMap::RecreateTexture()
 		glDeleteTextures(1, &m->DummyTexture);
 	if (m->Framebuffer)
 		pglDeleteFramebuffersEXT(1, &m->Framebuffer);
+	if (m->StaticTexture)
+		glDeleteTextures(1, &m->StaticTexture);
+	if (m->StaticFramebuffer)
+		pglDeleteFramebuffersEXT(1, &m->StaticFramebuffer);
 
 	m->Texture = 0;
 	m->DummyTexture = 0;
 	m->Framebuffer = 0;
+	m->StaticTexture = 0;
+	m->StaticFramebuffer = 0;
+	m->StaticValid = false;
 
 	// (Texture will be constructed in next SetupFrame)
 }
@@ -155,6 +267,24 @@ void ShadowMap::SetupFrame(const CCamera& camera, const CVector3D& lightdir)
 	if (!m->Texture)
 		m->CreateTexture();
 
+	++m->FrameNumber;
+	m->FrameStaticCasters.clear();
+	m->NumUncachedCasters = 0;
+	m->PatchChecksum = m->NumPatches = 0;
+	m->PatchChanged = false;
+
+	m->EyePos = camera.m_Orientation.GetTranslation();
+	m->ViewDir = camera.m_Orientation.GetIn();
+	m->LightDir = lightdir;
+	m->CameraFrustum = camera.GetFrustum();
+
+	// The static layer can only be reused while the camera and light stay (nearly) still
+	if (m->StaticValid && (
+		(m->EyePos - m->CachedEyePos).LengthSquared() > STATIC_CACHE_MOVE_THRESHOLD*STATIC_CACHE_MOVE_THRESHOLD ||
+		m->ViewDir.Dot(m->CachedViewDir) < STATIC_CACHE_TURN_THRESHOLD ||
+		m->LightDir != m->CachedLightDir))
+		m->StaticValid = false;
+
 	CVector3D z = lightdir;
 	CVector3D y;
 	CVector3D x = camera.m_Orientation.GetIn();
@@ -200,10 +330,36 @@ void ShadowMap::SetupFrame(const CCamera& camera, const CVector3D& lightdir)
 	m->LightTransform.GetInverse(m->InvLightTransform);
 	m->ShadowBound.SetEmpty();
 
-	//
-	m->LightspaceCamera = camera;
-	m->LightspaceCamera.m_Orientation = m->LightTransform * camera.m_Orientation;
-	m->LightspaceCamera.UpdateFrustum();
+	// Split the view frustum between the cascades, using a mixture of the uniform
+	// and logarithmic distributions (so the nearer cascades cover less)
+	float nearPlane = camera.GetNearPlane();
+	float farPlane = camera.GetFarPlane();
+	for (size_t i = 0; i < m->CascadeCount; ++i)
+	{
+		ShadowCascade& cascade = m->Cascades[i];
+		cascade.LightspaceCamera = camera;
+
+		if (i == m->CascadeCount-1)
+		{
+			cascade.SplitDistance = farPlane;
+		}
+		else
+		{
+			float frac = (float)(i+1) / m->CascadeCount;
+			float uniformSplit = nearPlane + (farPlane - nearPlane) * frac;
+			float logSplit = nearPlane * pow(farPlane / nearPlane, frac);
+			cascade.SplitDistance = Interpolate(uniformSplit, logSplit, CASCADE_SPLIT_LOG_WEIGHT);
+		}
+
+		if (m->CascadeCount > 1)
+		{
+			float splitNear = (i == 0) ? nearPlane : m->Cascades[i-1].SplitDistance;
+			cascade.LightspaceCamera.SetProjection(splitNear, cascade.SplitDistance, camera.GetFOV());
+		}
+
+		cascade.LightspaceCamera.m_Orientation = m->LightTransform * camera.m_Orientation;
+		cascade.LightspaceCamera.UpdateFrustum();
+	}
 }
 
 
@@ -218,41 +374,134 @@ void ShadowMap::AddShadowedBound(const CBoundingBoxAligned& bounds)
 	m->ShadowBound += lightspacebounds;
 }
 
+void ShadowMap::SubmitStaticCaster(const void* key, const CBoundingBoxAligned& bounds)
+{
+	if (!m->UseStaticCache)
+		return;
+
+	boost::unordered_map<const void*, size_t>::iterator moving = m->MovingCasters.find(key);
+	if (moving != m->MovingCasters.end())
+	{
+		moving->second = m->FrameNumber;
+		return;
+	}
+
+	ShadowMapInternals::CasterMap::iterator it = m->StaticCasters.find(key);
+	if (it == m->StaticCasters.end())
+	{
+		// Not visible when the static layer was rendered, so it's rendered
+		// with the dynamic casters for now
+		m->FrameStaticCasters.push_back(std::make_pair(key, bounds));
+		++m->NumUncachedCasters;
+		return;
+	}
+
+	if (!(it->second.bounds[0] == bounds[0] && it->second.bounds[1] == bounds[1]))
+	{
+		// It moved, so its old shadow has to be removed from the static layer,
+		// and it shouldn't be put there again
+		m->MovingCasters[key] = m->FrameNumber;
+		m->StaticCasters.erase(it);
+		m->StaticValid = false;
+		return;
+	}
+
+	m->FrameStaticCasters.push_back(std::make_pair(key, bounds));
+	it->second.frame = m->FrameNumber;
+}
+
+void ShadowMap::SubmitStaticPatch(const void* key, bool changed)
+{
+	// Multiply by a large odd constant to spread the pointer bits, before summing
+	m->PatchChecksum += (size_t)key * (size_t)0x9E3779B1u;
+	++m->NumPatches;
+	if (changed)
+		m->PatchChanged = true;
+}
+
+bool ShadowMap::IsStaticCacheEnabled() const
+{
+	return m->UseStaticCache;
+}
+
+bool ShadowMap::IsInStaticLayer(const void* key) const
+{
+	if (!m->UseStaticCache)
+		return false;
+
+	ShadowMapInternals::CasterMap::const_iterator it = m->StaticCasters.find(key);
+	return it != m->StaticCasters.end() && it->second.frame == m->FrameNumber;
+}
+
+size_t ShadowMap::GetCascadeCount() const
+{
+	return m->CascadeCount;
+}
+
+bool ShadowMap::IsCasterVisible(const CBoundingBoxAligned& bounds, size_t cascade) const
+{
+	if (m->Cascades[cascade].ShadowBound.IsEmpty())
+		return false;
+
+	return m->Cascades[cascade].CasterFrustum.IsBoxVisible(CVector3D(0, 0, 0), bounds);
+}
+
+const CFrustum& ShadowMap::GetCasterFrustum(size_t cascade) const
+{
+	return m->Cascades[cascade].CasterFrustum;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // CalcShadowMatrices: calculate required matrices for shadow map generation - the light's
-// projection and transformation matrices
-void ShadowMapInternals::CalcShadowMatrices()
+// projection and transformation matrices - for the given cascade
+void ShadowMapInternals::CalcShadowMatrices(size_t i)
 {
+	ShadowCascade& cascade = Cascades[i];
+
 	float minZ = ShadowBound[0].Z;
 
-	ShadowBound.IntersectFrustumConservative(LightspaceCamera.GetFrustum());
+	cascade.ShadowBound = ShadowBound;
+	cascade.ShadowBound.IntersectFrustumConservative(cascade.LightspaceCamera.GetFrustum());
 
 	// ShadowBound might have been empty to begin with, producing an empty result
-	if (ShadowBound.IsEmpty())
+	if (cascade.ShadowBound.IsEmpty())
 	{
 		// no-op
-		LightProjection.SetIdentity();
-		TextureMatrix = LightTransform;
+		cascade.LightProjection.SetIdentity();
+		cascade.TextureMatrix = LightTransform;
+		cascade.CasterFrustum = CFrustum();
 		return;
 	}
 
+	CBoundingBoxAligned& bound = cascade.ShadowBound;
+
+	// The static layer has to cover the view from anywhere within the threshold
+	if (UseStaticCache)
+	{
+		bound[0].X -= STATIC_CACHE_MARGIN;
+		bound[0].Y -= STATIC_CACHE_MARGIN;
+		bound[1].X += STATIC_CACHE_MARGIN;
+		bound[1].Y += STATIC_CACHE_MARGIN;
+		bound[1].Z += STATIC_CACHE_MARGIN;
+	}
+
 	// round off the shadow boundaries to sane increments to help reduce swim effect
 	float boundInc = 16.0f;
-	ShadowBound[0].X = floor(ShadowBound[0].X / boundInc) * boundInc;
-	ShadowBound[0].Y = floor(ShadowBound[0].Y / boundInc) * boundInc;
-	ShadowBound[1].X = ceil(ShadowBound[1].X / boundInc) * boundInc;
-	ShadowBound[1].Y = ceil(ShadowBound[1].Y / boundInc) * boundInc;
+	bound[0].X = floor(bound[0].X / boundInc) * boundInc;
+	bound[0].Y = floor(bound[0].Y / boundInc) * boundInc;
+	bound[1].X = ceil(bound[1].X / boundInc) * boundInc;
+	bound[1].Y = ceil(bound[1].Y / boundInc) * boundInc;
 
 	// minimum Z bound must not be clipped too much, because objects that lie outside
 	// the shadow bounds cannot cast shadows either
 	// the 2.0 is rather arbitrary: it should be big enough so that we won't accidentally miss
 	// a shadow generator, and small enough not to affect Z precision
-	ShadowBound[0].Z = minZ - 2.0;
+	bound[0].Z = minZ - 2.0;
 
 	// Setup orthogonal projection (lightspace -> clip space) for shadowmap rendering
-	CVector3D scale = ShadowBound[1] - ShadowBound[0];
-	CVector3D shift = (ShadowBound[1] + ShadowBound[0]) * -0.5;
+	CVector3D scale = bound[1] - bound[0];
+	CVector3D shift = (bound[1] + bound[0]) * -0.5;
 
 	if (scale.X < 1.0)
 		scale.X = 1.0;
@@ -266,20 +515,22 @@ void ShadowMapInternals::CalcShadowMatrices()
 	scale.Z = 2.0 / scale.Z;
 
 	// make sure a given world position falls on a consistent shadowmap texel fractional offset
-	float offsetX = fmod(ShadowBound[0].X - LightTransform._14, 2.0f/(scale.X*EffectiveWidth));
-	float offsetY = fmod(ShadowBound[0].Y - LightTransform._24, 2.0f/(scale.Y*EffectiveHeight));
-
-	LightProjection.SetZero();
-	LightProjection._11 = scale.X;
-	LightProjection._14 = (shift.X + offsetX) * scale.X;
-	LightProjection._22 = scale.Y;
-	LightProjection._24 = (shift.Y + offsetY) * scale.Y;
-	LightProjection._33 = scale.Z;
-	LightProjection._34 = shift.Z * scale.Z;
-	LightProjection._44 = 1.0;
+	float offsetX = fmod(bound[0].X - LightTransform._14, 2.0f/(scale.X*EffectiveWidth));
+	float offsetY = fmod(bound[0].Y - LightTransform._24, 2.0f/(scale.Y*EffectiveHeight));
+
+	CMatrix3D& lightProjection = cascade.LightProjection;
+	lightProjection.SetZero();
+	lightProjection._11 = scale.X;
+	lightProjection._14 = (shift.X + offsetX) * scale.X;
+	lightProjection._22 = scale.Y;
+	lightProjection._24 = (shift.Y + offsetY) * scale.Y;
+	lightProjection._33 = scale.Z;
+	lightProjection._34 = shift.Z * scale.Z;
+	lightProjection._44 = 1.0;
 
 	// Calculate texture matrix by creating the clip space to texture coordinate matrix
 	// and then concatenating all matrices that have been calculated so far
+	// (the cascades are side by side in the texture)
 
 	float texscalex = scale.X * 0.5f * (float)EffectiveWidth / (float)Width;
 	float texscaley = scale.Y * 0.5f * (float)EffectiveHeight / (float)Height;
@@ -288,14 +539,28 @@ void ShadowMapInternals::CalcShadowMatrices()
 	CMatrix3D lightToTex;
 	lightToTex.SetZero();
 	lightToTex._11 = texscalex;
-	lightToTex._14 = (offsetX - ShadowBound[0].X) * texscalex;
+	lightToTex._14 = (offsetX - bound[0].X) * texscalex + (float)(i * EffectiveWidth) / (float)Width;
 	lightToTex._22 = texscaley;
-	lightToTex._24 = (offsetY - ShadowBound[0].Y) * texscaley;
+	lightToTex._24 = (offsetY - bound[0].Y) * texscaley;
 	lightToTex._33 = texscalez;
-	lightToTex._34 = -ShadowBound[0].Z * texscalez;
+	lightToTex._34 = -bound[0].Z * texscalez;
 	lightToTex._44 = 1.0;
 
-	TextureMatrix = lightToTex * LightTransform;
+	cascade.TextureMatrix = lightToTex * LightTransform;
+
+	// Casters can only shadow the receivers if they overlap them perpendicular
+	// to the light, and aren't entirely behind them; express that as world-space
+	// planes from the rows of the light transform
+	CVector3D rowX(LightTransform._11, LightTransform._12, LightTransform._13);
+	CVector3D rowY(LightTransform._21, LightTransform._22, LightTransform._23);
+	CVector3D rowZ(LightTransform._31, LightTransform._32, LightTransform._33);
+
+	cascade.CasterFrustum = CFrustum();
+	cascade.CasterFrustum.AddPlane(CPlane(CVector4D(rowX.X, rowX.Y, rowX.Z, LightTransform._14 - bound[0].X)));
+	cascade.CasterFrustum.AddPlane(CPlane(CVector4D(-rowX.X, -rowX.Y, -rowX.Z, bound[1].X - LightTransform._14)));
+	cascade.CasterFrustum.AddPlane(CPlane(CVector4D(rowY.X, rowY.Y, rowY.Z, LightTransform._24 - bound[0].Y)));
+	cascade.CasterFrustum.AddPlane(CPlane(CVector4D(-rowY.X, -rowY.Y, -rowY.Z, bound[1].Y - LightTransform._24)));
+	cascade.CasterFrustum.AddPlane(CPlane(CVector4D(-rowZ.X, -rowZ.Y, -rowZ.Z, bound[1].Z - LightTransform._34)));
 }
 
 
@@ -320,29 +585,53 @@ void ShadowMapInternals::CreateTexture()
 		pglDeleteFramebuffersEXT(1, &Framebuffer);
 		Framebuffer = 0;
 	}
+	if (StaticTexture)
+	{
+		glDeleteTextures(1, &StaticTexture);
+		StaticTexture = 0;
+	}
+	if (StaticFramebuffer)
+	{
+		pglDeleteFramebuffersEXT(1, &StaticFramebuffer);
+		StaticFramebuffer = 0;
+	}
+	StaticValid = false;
+
+#if CONFIG2_GLES
+	UseStaticCache = false;
+#else
+	// The static layer is copied into the shadow map with glBlitFramebuffer
+	UseStaticCache = g_Renderer.m_Options.m_ShadowCache && ogl_HaveExtension("GL_EXT_framebuffer_blit");
+#endif
 	
 	// save the caller's FBO	
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &SavedViewFBO);
 
 	pglGenFramebuffersEXT(1, &Framebuffer);
 
+	CascadeCount = (size_t)clamp(g_Renderer.m_Options.m_ShadowCascades, 1, (int)ShadowMap::MAX_CASCADES);
+
+	int size;
 	if (g_Renderer.m_ShadowMapSize != 0)
 	{
-		// non-default option to override the size
-		Width = Height = g_Renderer.m_ShadowMapSize;
+		// non-default option to override the size (of each cascade)
+		size = g_Renderer.m_ShadowMapSize;
 	}
 	else
 	{
 		// get shadow map size as next power of two up from view width/height
-		Width = Height = (int)round_up_to_pow2((unsigned)std::max(g_Renderer.GetWidth(), g_Renderer.GetHeight()));
+		// (halved for cascades, since each covers much less of the view)
+		size = (int)round_up_to_pow2((unsigned)std::max(g_Renderer.GetWidth(), g_Renderer.GetHeight()));
+		if (CascadeCount > 1)
+			size /= 2;
 	}
-	// Clamp to the maximum texture size
-	Width = std::min(Width, (int)ogl_max_tex_size);
-	Height = std::min(Height, (int)ogl_max_tex_size);
+	// Clamp to the maximum texture size (with the cascades side by side)
+	size = std::min(size, (int)ogl_max_tex_size / (int)CascadeCount);
 
 	// Since we're using a framebuffer object, the whole texture is available
-	EffectiveWidth = Width;
-	EffectiveHeight = Height;
+	EffectiveWidth = EffectiveHeight = size;
+	Width = size * (int)CascadeCount;
+	Height = size;
 
 	const char* formatname;
 
@@ -354,8 +643,8 @@ void ShadowMapInternals::CreateTexture()
 	default: formatname = "DEPTH_COMPONENT"; break;
 	}
 
-	LOGMESSAGE(L"Creating shadow texture (size %dx%d) (format = %hs)",
-		Width, Height, formatname);
+	LOGMESSAGE(L"Creating shadow texture (size %dx%d) (cascades = %d) (format = %hs)",
+		Width, Height, (int)CascadeCount, formatname);
 
 
 	if (g_Renderer.m_Options.m_ShadowAlphaFix)
@@ -438,6 +727,39 @@ void ShadowMapInternals::CreateTexture()
 
 	GLenum status = pglCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
 
+#if !CONFIG2_GLES
+	if (status == GL_FRAMEBUFFER_COMPLETE_EXT && UseStaticCache)
+	{
+		// The static layer uses the same format (so it can be blitted), with no filtering or comparisons
+		glGenTextures(1, &StaticTexture);
+		g_Renderer.BindTexture(0, StaticTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, Width, Height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		pglGenFramebuffersEXT(1, &StaticFramebuffer);
+		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, StaticFramebuffer);
+		pglFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, StaticTexture, 0);
+		if (g_Renderer.m_Options.m_ShadowAlphaFix)
+			pglFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, DummyTexture, 0);
+		else
+			glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+
+		ogl_WarnIfError();
+
+		if (pglCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT)
+		{
+			// Fall back to rendering everything every frame
+			LOGWARNING(L"Static shadow framebuffer object incomplete; disabling shadow caching");
+			UseStaticCache = false;
+		}
+	}
+#endif
+
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, SavedViewFBO);
 
 	if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
@@ -449,23 +771,128 @@ void ShadowMapInternals::CreateTexture()
 	}
 }
 
+bool ShadowMapInternals::IsStaticCacheUsable()
+{
+	if (!StaticValid)
+		return false;
+
+	// The terrain has to be unchanged
+	if (PatchChanged || PatchChecksum != CachedPatchChecksum || NumPatches != CachedNumPatches)
+		return false;
+
+	// Too many static casters are missing from the static layer
+	if (NumUncachedCasters > STATIC_CACHE_MAX_UNCACHED)
+		return false;
+
+	// Cached casters that weren't submitted but should be visible have probably been
+	// removed (or hidden), so their shadows have to be removed too
+	for (CasterMap::const_iterator it = StaticCasters.begin(); it != StaticCasters.end(); ++it)
+	{
+		if (it->second.frame != FrameNumber && CameraFrustum.IsBoxVisible(CVector3D(0, 0, 0), it->second.bounds))
+			return false;
+	}
+
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Set up to render into the static layer, if it needs to be updated
+bool ShadowMap::BeginRenderStatic()
+{
+	if (!m->UseStaticCache)
+	{
+		// Calc remaining shadow matrices
+		for (size_t i = 0; i < m->CascadeCount; ++i)
+			m->CalcShadowMatrices(i);
+		return false;
+	}
+
+	if (m->IsStaticCacheUsable())
+	{
+		// Keep using the matrices the static layer was rendered with
+		m->LightTransform = m->CachedLightTransform;
+		m->InvLightTransform = m->CachedInvLightTransform;
+		for (size_t i = 0; i < m->CascadeCount; ++i)
+		{
+			ShadowCascade& cascade = m->Cascades[i];
+			cascade.LightProjection = cascade.CachedLightProjection;
+			cascade.TextureMatrix = cascade.CachedTextureMatrix;
+			cascade.ShadowBound = cascade.CachedShadowBound;
+			cascade.CasterFrustum = cascade.CachedCasterFrustum;
+		}
+		return false;
+	}
+
+	PROFILE("update static shadows");
+
+	bool anyShadowed = false;
+	for (size_t i = 0; i < m->CascadeCount; ++i)
+	{
+		m->CalcShadowMatrices(i);
+
+		ShadowCascade& cascade = m->Cascades[i];
+		cascade.CachedLightProjection = cascade.LightProjection;
+		cascade.CachedTextureMatrix = cascade.TextureMatrix;
+		cascade.CachedShadowBound = cascade.ShadowBound;
+		cascade.CachedCasterFrustum = cascade.CasterFrustum;
+		if (!cascade.ShadowBound.IsEmpty())
+			anyShadowed = true;
+	}
+
+	m->CachedLightTransform = m->LightTransform;
+	m->CachedInvLightTransform = m->InvLightTransform;
+	m->CachedEyePos = m->EyePos;
+	m->CachedViewDir = m->ViewDir;
+	m->CachedLightDir = m->LightDir;
+	m->CachedPatchChecksum = m->PatchChecksum;
+	m->CachedNumPatches = m->NumPatches;
+
+	// All the static casters submitted this frame will be in the layer
+	m->StaticCasters.clear();
+	for (size_t i = 0; i < m->FrameStaticCasters.size(); ++i)
+	{
+		ShadowMapInternals::CasterEntry& entry = m->StaticCasters[m->FrameStaticCasters[i].first];
+		entry.bounds = m->FrameStaticCasters[i].second;
+		entry.frame = m->FrameNumber;
+	}
+	m->NumUncachedCasters = 0;
+
+	// Forget about moving casters that haven't been seen for a while
+	// (so their pointers can be reused by new static ones)
+	for (boost::unordered_map<const void*, size_t>::iterator it = m->MovingCasters.begin(); it != m->MovingCasters.end(); )
+	{
+		if (m->FrameNumber - it->second > STATIC_CACHE_MOVING_EXPIRY_FRAMES)
+			it = m->MovingCasters.erase(it);
+		else
+			++it;
+	}
+
+	// With no shadowed objects the matrices are meaningless, so don't reuse them
+	m->StaticValid = anyShadowed;
+
+	m->BeginFramebuffer(m->StaticFramebuffer, false);
+	return true;
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Set up to render into shadow map texture
 void ShadowMap::BeginRender()
+{
+	m->BeginFramebuffer(m->Framebuffer, m->UseStaticCache);
+}
+
+void ShadowMapInternals::BeginFramebuffer(GLuint framebuffer, bool copyStatic)
 {
 	// HACK HACK: this depends in non-obvious ways on the behaviour of the caller
 	
 	// save caller's FBO
-	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &m->SavedViewFBO);
-
-	// Calc remaining shadow matrices
-	m->CalcShadowMatrices();
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &SavedViewFBO);
 
 	{
 		PROFILE("bind framebuffer");
 		glBindTexture(GL_TEXTURE_2D, 0);
-		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m->Framebuffer);
+		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
 	}
 
 	// clear buffers
@@ -474,29 +901,56 @@ void ShadowMap::BeginRender()
 		// In case we used m_ShadowAlphaFix, we ought to clear the unused
 		// color buffer too, else Mali 400 drivers get confused.
 		// Might as well clear stencil too for completeness.
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		if (copyStatic)
+			glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		else
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 		glColorMask(0,0,0,0);
 	}
 
-	// setup viewport
-	glViewport(0, 0, m->EffectiveWidth, m->EffectiveHeight);
+#if !CONFIG2_GLES
+	if (copyStatic)
+	{
+		// Start from the static casters' shadows, so only the dynamic ones have to be rendered
+		PROFILE("copy static shadows");
+		pglBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, StaticFramebuffer);
+		pglBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, framebuffer);
+		pglBlitFramebufferEXT(0, 0, Width, Height, 0, 0, Width, Height,
+			GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+	}
+#endif
 
-	m->SavedViewCamera = g_Renderer.GetViewCamera();
+	SavedViewCamera = g_Renderer.GetViewCamera();
+
+	glEnable(GL_SCISSOR_TEST);
+}
+
+bool ShadowMap::BeginCascade(size_t i)
+{
+	const ShadowCascade& cascade = m->Cascades[i];
+	if (cascade.ShadowBound.IsEmpty())
+		return false;
+
+	// setup viewport
+	int x = (int)i * m->EffectiveWidth;
+	glViewport(x, 0, m->EffectiveWidth, m->EffectiveHeight);
 
 	CCamera c = m->SavedViewCamera;
-	c.SetProjection(m->LightProjection);
+	c.SetProjection(cascade.LightProjection);
 	c.GetOrientation() = m->InvLightTransform;
 	g_Renderer.SetViewCamera(c);
 
 #if !CONFIG2_GLES
 	glMatrixMode(GL_PROJECTION);
-	glLoadMatrixf(&m->LightProjection._11);
+	glLoadMatrixf(&cascade.LightProjection._11);
 	glMatrixMode(GL_MODELVIEW);
 	glLoadMatrixf(&m->LightTransform._11);
 #endif
 
-	glEnable(GL_SCISSOR_TEST);
-	glScissor(1,1, m->EffectiveWidth-2, m->EffectiveHeight-2);
+	// keep a border of one texel (so nothing bleeds into the neighbouring cascades)
+	glScissor(x+1, 1, m->EffectiveWidth-2, m->EffectiveHeight-2);
+	return true;
 }
 
 
@@ -528,7 +982,29 @@ GLuint ShadowMap::GetTexture() const
 
 const CMatrix3D& ShadowMap::GetTextureMatrix() const
 {
-	return m->TextureMatrix;
+	return m->Cascades[0].TextureMatrix;
+}
+
+void ShadowMap::BindTo(const CShaderProgramPtr& shader) const
+{
+	shader->BindTexture("shadowTex", m->Texture);
+	shader->Uniform("shadowTransform", m->Cascades[0].TextureMatrix);
+	shader->Uniform("shadowScale", m->Width, m->Height, 1.0f / m->Width, 1.0f / m->Height);
+
+	if (m->CascadeCount > 1)
+	{
+		// The receivers select the cascade by their view-space distance
+		CMatrix3D transforms[MAX_CASCADES];
+		float splits[MAX_CASCADES];
+		for (size_t i = 0; i < MAX_CASCADES; ++i)
+		{
+			size_t c = std::min(i, m->CascadeCount-1);
+			transforms[i] = m->Cascades[c].TextureMatrix;
+			splits[i] = m->Cascades[c].SplitDistance;
+		}
+		shader->Uniform("shadowTransforms", MAX_CASCADES, transforms);
+		shader->Uniform("shadowCascadeSplits", splits[0], splits[1], splits[2], splits[3]);
+	}
 }
 
 
@@ -577,17 +1053,22 @@ void ShadowMap::RenderDebugBounds()
 	glDepthMask(0);
 	glDisable(GL_CULL_FACE);
 
-	// Render shadow bound
+	// Render shadow bound of each cascade
 	shader->Uniform("transform", g_Renderer.GetViewCamera().GetViewProjection() * m->InvLightTransform);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	shader->Uniform("color", 0.0f, 0.0f, 1.0f, 0.25f);
-	m->ShadowBound.Render(shader);
-	glDisable(GL_BLEND);
+	for (size_t i = 0; i < m->CascadeCount; ++i)
+	{
+		float shade = 1.0f - 0.25f * i;
 
-	shader->Uniform("color", 0.0f, 0.0f, 1.0f, 1.0f);
-	m->ShadowBound.RenderOutline(shader);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		shader->Uniform("color", 0.0f, 0.0f, shade, 0.25f);
+		m->Cascades[i].ShadowBound.Render(shader);
+		glDisable(GL_BLEND);
+
+		shader->Uniform("color", 0.0f, 0.0f, shade, 1.0f);
+		m->Cascades[i].ShadowBound.RenderOutline(shader);
+	}
 
 	// Draw a funny line/triangle direction indicator thing for unknown reasons
 	float shadowLineVerts[] = {
@@ -612,7 +1093,7 @@ void ShadowMap::RenderDebugBounds()
 #if 0
 	CMatrix3D InvTexTransform;
 
-	m->TextureMatrix.GetInverse(InvTexTransform);
+	m->Cascades[0].TextureMatrix.GetInverse(InvTexTransform);
 
 	// Render representative texture rectangle
 	glPushMatrix();
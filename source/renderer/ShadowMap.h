@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,8 +23,10 @@
 #define INCLUDED_SHADOWMAP
 
 #include "lib/ogl.h"
+#include "graphics/ShaderProgram.h"
 
 class CBoundingBoxAligned;
+class CFrustum;
 class CMatrix3D;
 
 struct ShadowMapInternals;
@@ -35,10 +37,24 @@ struct ShadowMapInternals;
  *
  * The class will automatically generate a texture the first time the shadow map is rendered into.
  * The texture will not be resized afterwards.
+ *
+ * If supported (and the shadowcache option is enabled), the shadows of terrain and static
+ * models (submitted with SubmitStaticPatch and SubmitStaticCaster) are cached in a separate
+ * static layer. It is re-rendered only when the camera moves or turns past a threshold, the
+ * light or terrain changes, or static casters appear, move or disappear. Otherwise each frame
+ * starts from a copy of the static layer, and only the other casters are rendered on top.
+ *
+ * With the shadowcascades option above 1, the view frustum is split by distance into
+ * cascades, each covering its part of the shadowed objects with its own (side by side)
+ * part of the texture, so nearby shadows get more resolution. Each cascade has its own
+ * caster culling volume, so casters are only rendered into the cascades they can affect.
  */
 class ShadowMap
 {
 public:
+	/// Maximum number of cascades (which the shaders have to support).
+	static const size_t MAX_CASCADES = 4;
+
 	ShadowMap();
 	~ShadowMap();
 
@@ -96,15 +112,85 @@ public:
 	 */
 	void AddShadowedBound(const CBoundingBoxAligned& bounds);
 
+	/**
+	 * SubmitStaticCaster: Declare that the given shadow caster is static (i.e. not
+	 * expected to move), so it may be rendered into the static layer. Casters that
+	 * are found to move are treated as dynamic afterwards.
+	 * Must be called each frame (between SetupFrame and BeginRenderStatic) for every
+	 * static caster.
+	 *
+	 * @param key identifies the caster between frames
+	 * @param bounds world space bounding box of the caster
+	 */
+	void SubmitStaticCaster(const void* key, const CBoundingBoxAligned& bounds);
+
+	/**
+	 * SubmitStaticPatch: Declare that the given terrain patch will be rendered into
+	 * the shadow map. Must be called each frame for every patch.
+	 *
+	 * @param key identifies the patch between frames
+	 * @param changed whether the patch's geometry has changed since the last frame
+	 */
+	void SubmitStaticPatch(const void* key, bool changed);
+
+	/**
+	 * IsStaticCacheEnabled: Whether the static layer is used, in which case the terrain
+	 * and the static casters should only be rendered after BeginRenderStatic.
+	 */
+	bool IsStaticCacheEnabled() const;
+
+	/**
+	 * IsInStaticLayer: Whether the caster's shadow is in the static layer this frame
+	 * (so it doesn't need to be rendered after BeginRender).
+	 */
+	bool IsInStaticLayer(const void* key) const;
+
+	/**
+	 * GetCascadeCount: Return the number of cascades (at least 1).
+	 */
+	size_t GetCascadeCount() const;
+
+	/**
+	 * IsCasterVisible: Whether a caster with the given world space bounds might
+	 * cast a shadow onto the shadowed objects in the given cascade (after
+	 * BeginRenderStatic has computed the final shadow bounds), so casters that can't
+	 * be seen can be skipped.
+	 */
+	bool IsCasterVisible(const CBoundingBoxAligned& bounds, size_t cascade) const;
+
+	/**
+	 * GetCasterFrustum: Return the world space volume containing every caster that
+	 * might shadow something in the given cascade (as tested by IsCasterVisible).
+	 */
+	const CFrustum& GetCasterFrustum(size_t cascade) const;
+
+	/**
+	 * BeginRenderStatic: Calculate the shadow matrices for this frame, and if the
+	 * static layer has to be updated, set OpenGL state for rendering the terrain and
+	 * static casters into it. Must be called before BeginRender.
+	 *
+	 * @return true if the static layer should be rendered (followed by EndRender)
+	 */
+	bool BeginRenderStatic();
+
 	/**
 	 * BeginRender: Set OpenGL state for rendering into the shadow map texture.
+	 * If the static layer is used, the shadow map starts as a copy of it.
 	 *
 	 * @todo this depends in non-obvious ways on the behaviour of the call-site
 	 */
 	void BeginRender();
 
 	/**
-	 * EndRender: Finish rendering into the shadow map.
+	 * BeginCascade: Set up the viewport and camera for rendering the casters of the
+	 * given cascade, between BeginRenderStatic/BeginRender and EndRender.
+	 *
+	 * @return false if nothing in the cascade is shadowed, so it can be skipped
+	 */
+	bool BeginCascade(size_t cascade);
+
+	/**
+	 * EndRender: Finish rendering into the shadow map (or the static layer).
 	 *
 	 * @todo this depends in non-obvious ways on the behaviour of the call-site
 	 */
@@ -126,6 +212,13 @@ public:
 	 */
 	const CMatrix3D& GetTextureMatrix() const;
 
+	/**
+	 * BindTo: Bind the shadow map texture and the uniforms for sampling it
+	 * (shadowTex, shadowTransform and shadowScale, plus shadowTransforms and
+	 * shadowCascadeSplits when there are several cascades) to the given shader.
+	 */
+	void BindTo(const CShaderProgramPtr& shader) const;
+
 	/**
 	 * Visualize shadow mapping calculations to help in
 	 * debugging and optimal shadow map usage.
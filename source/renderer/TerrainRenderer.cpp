@@ -125,8 +125,10 @@ void TerrainRenderer::Submit(CPatch* patch)
 		data = new CPatchRData(patch, m->simulation);
 		patch->SetRenderData(data);
 	}
-	data->Update(m->simulation);
 
+	data->SelectLOD(g_Renderer.GetViewCamera());
+
+	// (The render data is updated for all the patches at once in PrepareForRendering)
 	m->visiblePatches.push_back(data);
 }
 
@@ -154,6 +156,8 @@ void TerrainRenderer::PrepareForRendering()
 {
 	ENSURE(m->phase == Phase_Submit);
 
+	CPatchRData::UpdatePatches(m->visiblePatches, m->simulation);
+
 	m->phase = Phase_Render;
 }
 
@@ -474,11 +478,7 @@ void TerrainRenderer::PrepareShader(const CShaderProgramPtr& shader, ShadowMap*
 
 	if (shadow)
 	{
-		shader->BindTexture("shadowTex", shadow->GetTexture());
-		shader->Uniform("shadowTransform", shadow->GetTextureMatrix());
-		int width = shadow->GetWidth();
-		int height = shadow->GetHeight();
-		shader->Uniform("shadowScale", width, height, 1.0f / width, 1.0f / height);
+		shadow->BindTo(shader);
 	}
 
 	CLOSTexture& los = g_Renderer.GetScene().GetLOSTexture();
@@ -859,11 +859,7 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 	
 	if (shadow && WaterMgr->m_WaterShadows)
 	{
-		m->fancyWaterShader->BindTexture("shadowTex", shadow->GetTexture());
-		m->fancyWaterShader->Uniform("shadowTransform", shadow->GetTextureMatrix());
-		int width = shadow->GetWidth();
-		int height = shadow->GetHeight();
-		m->fancyWaterShader->Uniform("shadowScale", width, height, 1.0f / width, 1.0f / height);
+		shadow->BindTo(m->fancyWaterShader);
 	}
 
 	for (size_t i = 0; i < m->visiblePatches.size(); ++i)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -57,6 +57,8 @@ void VertexArray::Free()
 		g_VBMan.Release(m_VB);
 		m_VB = 0;
 	}
+
+	m_Stream = CStreamingBuffer::Allocation();
 }
 
 
@@ -279,6 +281,12 @@ void VertexArray::Layout()
 void VertexArray::Upload()
 {
 	ENSURE(m_BackingStore);
+
+	if (m_Usage == GL_STREAM_DRAW)
+	{
+		m_Stream = g_VBMan.GetStreamingBuffer(m_Target).Append(m_BackingStore, m_Stride * m_NumVertices, m_Stride);
+		return;
+	}
 	
 	if (!m_VB)
 		m_VB = g_VBMan.Allocate(m_Stride, m_NumVertices, m_Usage, m_Target);
@@ -289,10 +297,39 @@ void VertexArray::Upload()
 	m_VB->m_Owner->UpdateChunkVertices(m_VB, m_BackingStore);
 }
 
+void VertexArray::UploadRange(size_t first, size_t count)
+{
+	ENSURE(m_BackingStore);
+	ENSURE(first + count <= m_NumVertices);
+
+	// Streaming data has to be uploaded in one piece, and an unallocated
+	// VBO has no existing data to keep
+	if (m_Usage == GL_STREAM_DRAW || !m_VB)
+	{
+		Upload();
+		return;
+	}
+
+	m_VB->m_Owner->UpdateChunkVertices(m_VB, m_BackingStore, first, count);
+}
+
 
 // Bind this array, returns the base address for calls to glVertexPointer etc.
 u8* VertexArray::Bind()
 {
+	if (m_Usage == GL_STREAM_DRAW)
+	{
+		CStreamingBuffer& buffer = g_VBMan.GetStreamingBuffer(m_Target);
+		if (!buffer.IsCurrent(m_Stream))
+		{
+			// The data is from an earlier frame (or was never uploaded)
+			if (!m_BackingStore)
+				return NULL;
+			Upload();
+		}
+		return buffer.Bind(m_Stream);
+	}
+
 	if (!m_VB)
 		return NULL;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -175,7 +175,13 @@ public:
 	void Layout();
 	// (Re-)Upload the attributes of the vertex array from the backing store to
 	// the underlying VBO object.
+	// If the usage is GL_STREAM_DRAW, the data is put in the shared streaming buffer
+	// instead, and is only valid for the current frame (so it should be uploaded
+	// every frame; otherwise Bind will upload it again if the backing store exists).
 	void Upload();
+	// Upload only the vertices [first, first+count) from the backing store,
+	// if the rest was already uploaded (otherwise this uploads everything).
+	void UploadRange(size_t first, size_t count);
 	// Bind this array, returns the base address for calls to glVertexPointer etc.
 	u8* Bind();
 
@@ -199,6 +205,7 @@ private:
 	std::vector<Attribute*> m_Attributes;
 
 	CVertexBuffer::VBChunk* m_VB;
+	CStreamingBuffer::Allocation m_Stream; // used instead of m_VB for GL_STREAM_DRAW
 	size_t m_Stride;
 	char* m_BackingStore; // 16-byte aligned, to allow fast SSE access
 };
@@ -21,6 +21,7 @@
 
 #include "precompiled.h"
 #include "ps/Errors.h"
+#include "lib/bits.h"
 #include "lib/ogl.h"
 #include "lib/sysdep/cpu.h"
 #include "Renderer.h"
@@ -55,14 +56,26 @@ CVertexBuffer::CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target)
 	}
 
 	// store max/free vertex counts
-	m_MaxVertices = m_FreeVertices = size/vertexSize;
-	
+	m_MaxVertices = size/vertexSize;
+	m_FreeVertices = 0;
+
+	m_FLBitmap = 0;
+	for (size_t fl = 0; fl < FL_COUNT; ++fl)
+	{
+		m_SLBitmaps[fl] = 0;
+		for (size_t sl = 0; sl < SL_COUNT; ++sl)
+			m_FreeLists[fl][sl] = 0;
+	}
+
 	// create sole free chunk
 	VBChunk* chunk = new VBChunk;
 	chunk->m_Owner = this;
-	chunk->m_Count = m_FreeVertices;
+	chunk->m_Count = m_MaxVertices;
 	chunk->m_Index = 0;
-	m_FreeList.push_front(chunk);
+	chunk->m_Prev = 0;
+	chunk->m_Next = 0;
+	m_FirstChunk = chunk;
+	InsertFree(chunk);
 }
 
 CVertexBuffer::~CVertexBuffer()
@@ -72,9 +85,14 @@ CVertexBuffer::~CVertexBuffer()
 
 	delete[] m_SysMem;
 
-	typedef std::list<VBChunk*>::iterator Iter;
-	for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter)
-		delete *iter;
+	// (Allocated chunks belong to their users until they're released)
+	for (VBChunk* chunk = m_FirstChunk; chunk; )
+	{
+		VBChunk* next = chunk->m_Next;
+		if (chunk->m_Free)
+			delete chunk;
+		chunk = next;
+	}
 }
 
 
@@ -86,6 +104,130 @@ bool CVertexBuffer::CompatibleVertexType(size_t vertexSize, GLenum usage, GLenum
 	return true;
 }
 
+/// floor(log2(x)) for x > 0
+static size_t FloorLog2(size_t x)
+{
+	size_t log = 0;
+	while (x >>= 1)
+		++log;
+	return log;
+}
+
+/// Index of the lowest set bit; mask must be non-zero
+static size_t LowestBitIndex(u32 mask)
+{
+	return ceil_log2(LeastSignificantBit(mask));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MapSize: find the size class (the free list indexes) of chunks of the
+// given number of vertices
+void CVertexBuffer::MapSize(size_t count, size_t& fl, size_t& sl)
+{
+	if (count < SL_COUNT)
+	{
+		// Small sizes each get their own class
+		fl = 0;
+		sl = count;
+	}
+	else
+	{
+		size_t log = FloorLog2(count);
+		fl = log - SL_LOG2 + 1;
+		sl = (count >> (log - SL_LOG2)) - SL_COUNT;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FindFree: find a free chunk with at least the given number of vertices,
+// or return null if there isn't one
+CVertexBuffer::VBChunk* CVertexBuffer::FindFree(size_t numVertices) const
+{
+	// Round up to the start of the next size class, so that every chunk
+	// in the class we find is big enough
+	size_t count = numVertices;
+	if (count >= SL_COUNT)
+		count += ((size_t)1 << (FloorLog2(count) - SL_LOG2)) - 1;
+
+	size_t fl, sl;
+	MapSize(count, fl, sl);
+	if (fl >= FL_COUNT)
+		return 0;
+
+	// Look for the smallest non-empty class that's at least as large,
+	// first in the same power of two and then in larger ones
+	u32 slMap = m_SLBitmaps[fl] & (~0u << sl);
+	if (!slMap)
+	{
+		u32 flMap = (fl+1 < FL_COUNT) ? (m_FLBitmap & (~0u << (fl+1))) : 0;
+		if (!flMap)
+			return 0;
+		fl = LowestBitIndex(flMap);
+		slMap = m_SLBitmaps[fl];
+	}
+	sl = LowestBitIndex(slMap);
+
+	return m_FreeLists[fl][sl];
+}
+
+void CVertexBuffer::InsertFree(VBChunk* chunk)
+{
+	size_t fl, sl;
+	MapSize(chunk->m_Count, fl, sl);
+
+	chunk->m_Free = true;
+	chunk->m_PrevFree = 0;
+	chunk->m_NextFree = m_FreeLists[fl][sl];
+	if (chunk->m_NextFree)
+		chunk->m_NextFree->m_PrevFree = chunk;
+	m_FreeLists[fl][sl] = chunk;
+
+	m_FLBitmap |= 1u << fl;
+	m_SLBitmaps[fl] |= 1u << sl;
+
+	m_FreeVertices += chunk->m_Count;
+}
+
+void CVertexBuffer::RemoveFree(VBChunk* chunk)
+{
+	size_t fl, sl;
+	MapSize(chunk->m_Count, fl, sl);
+
+	if (chunk->m_PrevFree)
+		chunk->m_PrevFree->m_NextFree = chunk->m_NextFree;
+	else
+		m_FreeLists[fl][sl] = chunk->m_NextFree;
+	if (chunk->m_NextFree)
+		chunk->m_NextFree->m_PrevFree = chunk->m_PrevFree;
+
+	if (!m_FreeLists[fl][sl])
+	{
+		m_SLBitmaps[fl] &= ~(1u << sl);
+		if (!m_SLBitmaps[fl])
+			m_FLBitmap &= ~(1u << fl);
+	}
+
+	chunk->m_Free = false;
+
+	m_FreeVertices -= chunk->m_Count;
+}
+
+// Remove the chunk from the list of all chunks
+void CVertexBuffer::Unlink(VBChunk* chunk)
+{
+	if (chunk->m_Prev)
+		chunk->m_Prev->m_Next = chunk->m_Next;
+	else
+		m_FirstChunk = chunk->m_Next;
+	if (chunk->m_Next)
+		chunk->m_Next->m_Prev = chunk->m_Prev;
+}
+
+bool CVertexBuffer::CanAllocate(size_t numVertices) const
+{
+	return numVertices <= m_FreeVertices && FindFree(numVertices) != 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Allocate: try to allocate a buffer of given number of vertices (each of 
 // given size), with the given type, and using the given texture - return null 
@@ -100,25 +242,14 @@ CVertexBuffer::VBChunk* CVertexBuffer::Allocate(size_t vertexSize, size_t numVer
 	if (numVertices > m_FreeVertices)
 		return 0;
 
-	// trawl free list looking for first free chunk with enough space
-	VBChunk* chunk = 0;
-	typedef std::list<VBChunk*>::iterator Iter;
-	for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter) {
-		if (numVertices <= (*iter)->m_Count) {
-			chunk = *iter;
-			// remove this chunk from the free list
-			m_FreeList.erase(iter);
-			m_FreeVertices -= chunk->m_Count;
-			// no need to search further ..
-			break;
-		}
-	}
-
+	VBChunk* chunk = FindFree(numVertices);
 	if (!chunk) {
 		// no big enough spare chunk available
 		return 0;
 	}
 
+	RemoveFree(chunk);
+
 	// split chunk into two; - allocate a new chunk using all unused vertices in the 
 	// found chunk, and add it to the free list
 	if (chunk->m_Count > numVertices)
@@ -127,8 +258,12 @@ CVertexBuffer::VBChunk* CVertexBuffer::Allocate(size_t vertexSize, size_t numVer
 		newchunk->m_Owner = this;
 		newchunk->m_Count = chunk->m_Count - numVertices;
 		newchunk->m_Index = chunk->m_Index + numVertices;
-		m_FreeList.push_front(newchunk);
-		m_FreeVertices += newchunk->m_Count;
+		newchunk->m_Prev = chunk;
+		newchunk->m_Next = chunk->m_Next;
+		if (chunk->m_Next)
+			chunk->m_Next->m_Prev = newchunk;
+		chunk->m_Next = newchunk;
+		InsertFree(newchunk);
 
 		// resize given chunk
 		chunk->m_Count = numVertices;
@@ -142,52 +277,137 @@ CVertexBuffer::VBChunk* CVertexBuffer::Allocate(size_t vertexSize, size_t numVer
 // Release: return given chunk to this buffer
 void CVertexBuffer::Release(VBChunk* chunk)
 {
-	// Update total free count before potentially modifying this chunk's count
-	m_FreeVertices += chunk->m_Count;
+	ENSURE(chunk->m_Owner == this && !chunk->m_Free);
 
-	typedef std::list<VBChunk*>::iterator Iter;
+	// Coalesce with the adjacent chunks if they're free, keeping the first one
+	VBChunk* prev = chunk->m_Prev;
+	if (prev && prev->m_Free)
+	{
+		RemoveFree(prev);
+		prev->m_Count += chunk->m_Count;
+		Unlink(chunk);
+		delete chunk;
+		chunk = prev;
+	}
 
-	// Coalesce with any free-list items that are adjacent to this chunk;
-	// merge the found chunk with the new one, and remove the old one
-	// from the list, and repeat until no more are found
-	bool coalesced;
-	do
+	VBChunk* next = chunk->m_Next;
+	if (next && next->m_Free)
 	{
-		coalesced = false;
-		for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter)
+		RemoveFree(next);
+		chunk->m_Count += next->m_Count;
+		Unlink(next);
+		delete next;
+	}
+
+	InsertFree(chunk);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MoveChunk: copy the chunk's contents into a new chunk in the target buffer,
+// and make the chunk refer to that instead
+bool CVertexBuffer::MoveChunk(VBChunk* chunk, CVertexBuffer& target)
+{
+	ENSURE(chunk->m_Owner == this && !chunk->m_Free && &target != this);
+
+	VBChunk* dest = target.Allocate(m_VertexSize, chunk->m_Count, m_Usage, m_Target);
+	if (!dest)
+		return false;
+
+	if (chunk->m_Count)
+	{
+		if (g_Renderer.m_Caps.m_VBO)
+		{
+			// (Reading the data back will stall, but compaction is rare)
+			std::vector<u8> data(chunk->m_Count * m_VertexSize);
+			pglBindBufferARB(m_Target, m_Handle);
+			pglGetBufferSubDataARB(m_Target, chunk->m_Index * m_VertexSize, data.size(), &data[0]);
+			pglBindBufferARB(m_Target, 0);
+			target.UpdateChunkVertices(dest, &data[0]);
+		}
+		else
 		{
-			if ((*iter)->m_Index == chunk->m_Index + chunk->m_Count
-			 || (*iter)->m_Index + (*iter)->m_Count == chunk->m_Index)
-			{
-				chunk->m_Index = std::min(chunk->m_Index, (*iter)->m_Index);
-				chunk->m_Count += (*iter)->m_Count;
-				delete *iter;
-				m_FreeList.erase(iter);
-				coalesced = true;
-				break;
-			}
+			target.UpdateChunkVertices(dest, m_SysMem + chunk->m_Index * m_VertexSize);
 		}
 	}
-	while (coalesced);
 
-	m_FreeList.push_front(chunk);
+	// Swap the two chunk objects' places (both are allocated, so they're
+	// not in any free lists), so that the user's chunk refers to the new
+	// space and the old space can be released
+	std::swap(chunk->m_Owner, dest->m_Owner);
+	std::swap(chunk->m_Index, dest->m_Index);
+	std::swap(chunk->m_Prev, dest->m_Prev);
+	std::swap(chunk->m_Next, dest->m_Next);
+	VBChunk* swapped[] = { chunk, dest };
+	for (size_t i = 0; i < ARRAY_SIZE(swapped); ++i)
+	{
+		VBChunk* c = swapped[i];
+		if (c->m_Prev)
+			c->m_Prev->m_Next = c;
+		else
+			c->m_Owner->m_FirstChunk = c;
+		if (c->m_Next)
+			c->m_Next->m_Prev = c;
+	}
+
+	Release(dest);
+	return true;
+}
+
+bool CVertexBuffer::MoveChunksTo(const std::vector<CVertexBuffer*>& targets)
+{
+#if CONFIG2_GLES
+	// GLES can't read back buffer contents
+	UNUSED2(targets);
+	return IsEmpty();
+#else
+	// (Releasing the old space only deletes free chunks, so the next
+	// allocated chunk stays valid while moving each one)
+	VBChunk* chunk = m_FirstChunk;
+	while (chunk && chunk->m_Free)
+		chunk = chunk->m_Next;
+
+	while (chunk)
+	{
+		VBChunk* next = chunk->m_Next;
+		while (next && next->m_Free)
+			next = next->m_Next;
+
+		bool moved = false;
+		for (size_t i = 0; i < targets.size() && !moved; ++i)
+			moved = MoveChunk(chunk, *targets[i]);
+		if (!moved)
+			break;
+
+		chunk = next;
+	}
+
+	return IsEmpty();
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // UpdateChunkVertices: update vertex data for given chunk
 void CVertexBuffer::UpdateChunkVertices(VBChunk* chunk, void* data)
 {
+	UpdateChunkVertices(chunk, data, 0, chunk->m_Count);
+}
+
+void CVertexBuffer::UpdateChunkVertices(VBChunk* chunk, void* data, size_t first, size_t count)
+{
+	ENSURE(first + count <= chunk->m_Count);
+
+	u8* src = (u8*)data + first * m_VertexSize;
 	if (g_Renderer.m_Caps.m_VBO)
 	{
 		ENSURE(m_Handle);
 		pglBindBufferARB(m_Target, m_Handle);
-		pglBufferSubDataARB(m_Target, chunk->m_Index * m_VertexSize, chunk->m_Count * m_VertexSize, data);
+		pglBufferSubDataARB(m_Target, (chunk->m_Index + first) * m_VertexSize, count * m_VertexSize, src);
 		pglBindBufferARB(m_Target, 0);
 	}
 	else
 	{
 		ENSURE(m_SysMem);
-		memcpy(m_SysMem + chunk->m_Index * m_VertexSize, data, chunk->m_Count * m_VertexSize);
+		memcpy(m_SysMem + (chunk->m_Index + first) * m_VertexSize, src, count * m_VertexSize);
 	}
 }
 
@@ -226,7 +446,7 @@ void CVertexBuffer::Unbind()
 
 size_t CVertexBuffer::GetBytesReserved() const
 {
-	return MAX_VB_SIZE_BYTES;
+	return m_MaxVertices * m_VertexSize;
 }
 
 size_t CVertexBuffer::GetBytesAllocated() const
@@ -234,16 +454,149 @@ size_t CVertexBuffer::GetBytesAllocated() const
 	return (m_MaxVertices - m_FreeVertices) * m_VertexSize;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// CStreamingBuffer
+
+// Minimum size of each streaming buffer object
+static const size_t STREAMING_BLOCK_SIZE = MAX_VB_SIZE_BYTES;
+
+CStreamingBuffer::CStreamingBuffer(GLenum target)
+	: m_Target(target), m_Current(0), m_Frame(1)
+{
+}
+
+CStreamingBuffer::~CStreamingBuffer()
+{
+	for (size_t i = 0; i < m_Blocks.size(); ++i)
+	{
+		if (m_Blocks[i].m_Handle)
+			pglDeleteBuffersARB(1, &m_Blocks[i].m_Handle);
+		delete[] m_Blocks[i].m_SysMem;
+	}
+}
+
+CStreamingBuffer::Allocation CStreamingBuffer::Append(const void* data, size_t size, size_t alignment)
+{
+	// Find the first block (from the current one) with enough space left;
+	// earlier blocks are never revisited within a frame, to keep this O(1)
+	size_t offset = 0;
+	while (m_Current < m_Blocks.size())
+	{
+		Block& block = m_Blocks[m_Current];
+		offset = (block.m_Used + alignment-1) / alignment * alignment;
+		if (offset + size <= block.m_Size)
+			break;
+		++m_Current;
+	}
+
+	if (m_Current == m_Blocks.size())
+	{
+		Block block;
+		block.m_Handle = 0;
+		block.m_SysMem = 0;
+		block.m_Size = std::max(size, STREAMING_BLOCK_SIZE);
+		block.m_Used = 0;
+		if (g_Renderer.m_Caps.m_VBO)
+		{
+			pglGenBuffersARB(1, &block.m_Handle);
+			pglBindBufferARB(m_Target, block.m_Handle);
+			pglBufferDataARB(m_Target, block.m_Size, 0, GL_STREAM_DRAW);
+			pglBindBufferARB(m_Target, 0);
+		}
+		else
+		{
+			block.m_SysMem = new u8[block.m_Size];
+		}
+		m_Blocks.push_back(block);
+		offset = 0;
+	}
+
+	Block& block = m_Blocks[m_Current];
+	if (g_Renderer.m_Caps.m_VBO)
+	{
+		pglBindBufferARB(m_Target, block.m_Handle);
+		pglBufferSubDataARB(m_Target, offset, size, data);
+		pglBindBufferARB(m_Target, 0);
+	}
+	else
+	{
+		memcpy(block.m_SysMem + offset, data, size);
+	}
+	block.m_Used = offset + size;
+
+	Allocation allocation;
+	allocation.m_Frame = m_Frame;
+	allocation.m_Block = m_Current;
+	allocation.m_Offset = offset;
+	return allocation;
+}
+
+u8* CStreamingBuffer::Bind(const Allocation& allocation)
+{
+	ENSURE(IsCurrent(allocation));
+
+	const Block& block = m_Blocks[allocation.m_Block];
+	if (g_Renderer.m_Caps.m_VBO)
+	{
+		pglBindBufferARB(m_Target, block.m_Handle);
+		return (u8*)0 + allocation.m_Offset;
+	}
+	else
+	{
+		return block.m_SysMem + allocation.m_Offset;
+	}
+}
+
+void CStreamingBuffer::EndFrame()
+{
+	for (size_t i = 0; i < m_Blocks.size(); ++i)
+	{
+		Block& block = m_Blocks[i];
+		if (!block.m_Used)
+			continue;
+
+		// Orphan the old contents, which the GPU may still be using
+		if (block.m_Handle)
+		{
+			pglBindBufferARB(m_Target, block.m_Handle);
+			pglBufferDataARB(m_Target, block.m_Size, 0, GL_STREAM_DRAW);
+			pglBindBufferARB(m_Target, 0);
+		}
+		block.m_Used = 0;
+	}
+
+	m_Current = 0;
+	++m_Frame;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+size_t CVertexBuffer::GetBytesFragmented() const
+{
+	if (!m_FLBitmap)
+		return 0;
+
+	// The largest free chunk is in the highest non-empty size class
+	size_t fl = FloorLog2(m_FLBitmap);
+	size_t sl = FloorLog2(m_SLBitmaps[fl]);
+	size_t largest = 0;
+	for (VBChunk* chunk = m_FreeLists[fl][sl]; chunk; chunk = chunk->m_NextFree)
+		largest = std::max(largest, chunk->m_Count);
+
+	return (m_FreeVertices - largest) * m_VertexSize;
+}
+
 void CVertexBuffer::DumpStatus()
 {
 	debug_printf(L"freeverts = %d\n", (int)m_FreeVertices);
 
 	size_t maxSize = 0;
-	typedef std::list<VBChunk*>::iterator Iter;
-	for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter)
+	for (VBChunk* chunk = m_FirstChunk; chunk; chunk = chunk->m_Next)
 	{
-		debug_printf(L"free chunk %p: size=%d\n", *iter, (int)((*iter)->m_Count));
-		maxSize = std::max((*iter)->m_Count, maxSize);
+		if (!chunk->m_Free)
+			continue;
+		debug_printf(L"free chunk %p: size=%d\n", chunk, (int)chunk->m_Count);
+		maxSize = std::max(chunk->m_Count, maxSize);
 	}
 	debug_printf(L"max size = %d\n", (int)maxSize);
 }
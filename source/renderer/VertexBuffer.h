@@ -24,7 +24,6 @@
 
 #include "lib/res/graphics/ogl_tex.h"
 
-#include <list>
 #include <vector>
 
 // Absolute maximum (bytewise) size of each GL vertex buffer object.
@@ -36,6 +35,11 @@
 /**
  * CVertexBuffer: encapsulation of ARB_vertex_buffer_object, also supplying 
  * some additional functionality for sharing buffers between multiple objects
+ *
+ * The free space is managed like in TLSF: free chunks are kept in segregated
+ * lists by size class (each power of two is split linearly into SL_COUNT classes)
+ * with bitmaps of the non-empty classes, and every chunk knows its neighbours,
+ * so allocation and release (including coalescing) take constant time.
  */
 class CVertexBuffer
 {
@@ -59,6 +63,15 @@ public:
 		friend class CVertexBuffer;
 		VBChunk() {}
 		~VBChunk() {}
+
+		/// Adjacent chunks in the owner (in order of m_Index), whether free or not
+		VBChunk* m_Prev;
+		VBChunk* m_Next;
+		/// Adjacent chunks in the same free list, if this chunk is free
+		VBChunk* m_PrevFree;
+		VBChunk* m_NextFree;
+		/// Whether this chunk is in a free list
+		bool m_Free;
 	};
 
 public:
@@ -79,10 +92,23 @@ public:
 	/// Update vertex data for given chunk. Transfers the provided data to the actual OpenGL vertex buffer.
 	void UpdateChunkVertices(VBChunk* chunk, void* data);
 
+	/// Update only the vertices [first, first+count) of the given chunk, from the
+	/// corresponding part of @p data (which contains the data for the whole chunk).
+	void UpdateChunkVertices(VBChunk* chunk, void* data, size_t first, size_t count);
+
 	size_t GetVertexSize() const { return m_VertexSize; }
+	GLenum GetUsage() const { return m_Usage; }
 	size_t GetBytesReserved() const;
 	size_t GetBytesAllocated() const;
 
+	/// Returns the number of free bytes outside the largest free chunk, i.e. the
+	/// free space that can only be used by smaller allocations
+	size_t GetBytesFragmented() const;
+
+	/// Returns whether nothing is allocated from this buffer
+	/// (free chunks are always coalesced, so there's a single free chunk then)
+	bool IsEmpty() const { return m_FirstChunk->m_Free && !m_FirstChunk->m_Next; }
+
 	/// Returns true if this vertex buffer is compatible with the specified vertex type and intended usage.
 	bool CompatibleVertexType(size_t vertexSize, GLenum usage, GLenum target);
 
@@ -96,15 +122,45 @@ protected:
 	VBChunk* Allocate(size_t vertexSize, size_t numVertices, GLenum usage, GLenum target);
 	/// Return given chunk to this buffer
 	void Release(VBChunk* chunk);
+
+	/// Returns whether Allocate would succeed for this many vertices (of a compatible type)
+	bool CanAllocate(size_t numVertices) const;
+
+	/// Try to move the contents of all allocated chunks into the given other buffers
+	/// (which must be compatible), updating the chunks in place.
+	/// @return whether this buffer is empty afterwards
+	bool MoveChunksTo(const std::vector<CVertexBuffer*>& targets);
 	
 	
 private:	
+	enum
+	{
+		/// log2 of the number of size classes per power of two
+		SL_LOG2 = 2,
+		SL_COUNT = 1 << SL_LOG2,
+		/// Number of powers of two (enough for any chunk size)
+		FL_COUNT = 32
+	};
+
+	static void MapSize(size_t count, size_t& fl, size_t& sl);
+	VBChunk* FindFree(size_t numVertices) const;
+	void InsertFree(VBChunk* chunk);
+	void RemoveFree(VBChunk* chunk);
+	void Unlink(VBChunk* chunk);
+	bool MoveChunk(VBChunk* chunk, CVertexBuffer& target);
+
 	/// Vertex size of this vertex buffer
 	size_t m_VertexSize;
 	/// Number of vertices of above size in this buffer
 	size_t m_MaxVertices;
-	/// List of free chunks in this buffer
-	std::list<VBChunk*> m_FreeList;
+	/// Chunk at index 0 (the start of the list of all chunks)
+	VBChunk* m_FirstChunk;
+	/// Free chunks in each size class
+	VBChunk* m_FreeLists[FL_COUNT][SL_COUNT];
+	/// Bit fl is set if any of m_FreeLists[fl] is non-empty
+	u32 m_FLBitmap;
+	/// Bit sl of m_SLBitmaps[fl] is set if m_FreeLists[fl][sl] is non-empty
+	u32 m_SLBitmaps[FL_COUNT];
 	/// Available free vertices - total of all free vertices in the free list
 	size_t m_FreeVertices;
 	/// Handle to the actual GL vertex buffer object
@@ -117,4 +173,61 @@ private:
 	GLenum m_Target;
 };
 
+/**
+ * CStreamingBuffer: storage for data that is rewritten every frame (GL_STREAM_DRAW),
+ * shared by all its users. Data is appended to the current buffer object, and is
+ * only valid until the end of the frame. Then every buffer is orphaned (respecified
+ * with glBufferData) before being reused, so the driver can give us fresh memory
+ * instead of stalling until the GPU has finished drawing from the old contents.
+ * If a frame needs more space than one buffer, more buffers are added.
+ */
+class CStreamingBuffer
+{
+	NONCOPYABLE(CStreamingBuffer);
+
+public:
+	/// Location of some appended data
+	struct Allocation
+	{
+		Allocation() : m_Frame(0), m_Block(0), m_Offset(0) {}
+
+		/// Value of GetFrame() when the data was appended (0 if there's no data)
+		size_t m_Frame;
+		size_t m_Block;
+		size_t m_Offset;
+	};
+
+	CStreamingBuffer(GLenum target);
+	~CStreamingBuffer();
+
+	/// Copy the data into the buffer, at an offset that is a multiple of @p alignment
+	Allocation Append(const void* data, size_t size, size_t alignment);
+
+	/// Returns whether the allocation's data was appended this frame (so it's still valid)
+	bool IsCurrent(const Allocation& allocation) const { return allocation.m_Frame == m_Frame; }
+
+	/// Bind the buffer containing the (current) allocation; return the address for
+	/// glVertexPointer etc calls
+	u8* Bind(const Allocation& allocation);
+
+	/// Discard all the data appended this frame
+	void EndFrame();
+
+private:
+	struct Block
+	{
+		GLuint m_Handle;
+		u8* m_SysMem;
+		size_t m_Size;
+		size_t m_Used;
+	};
+
+	GLenum m_Target;
+	std::vector<Block> m_Blocks;
+	/// Index of the block currently being appended to
+	size_t m_Current;
+	/// Number of the current frame (starting at 1)
+	size_t m_Frame;
+};
+
 #endif
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,7 @@
 
 #include "lib/ogl.h"
 #include "ps/CLogger.h"
+#include "ps/Profile.h"
 
 #define DUMP_VB_STATS 0 // for debugging
 
@@ -36,10 +37,14 @@ CVertexBufferManager g_VBMan;
 // global instances.
 void CVertexBufferManager::Shutdown()
 {
-	typedef std::list<CVertexBuffer*>::iterator Iter;
-	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
-		delete *iter;
+	for (size_t i = 0; i < m_Buffers.size(); ++i)
+		delete m_Buffers[i];
 	m_Buffers.clear();
+
+	delete m_StreamingVertices;
+	m_StreamingVertices = 0;
+	delete m_StreamingIndices;
+	m_StreamingIndices = 0;
 }
 
 
@@ -51,18 +56,17 @@ CVertexBuffer::VBChunk* CVertexBufferManager::Allocate(size_t vertexSize, size_t
 {
 	CVertexBuffer::VBChunk* result=0;
 
-	ENSURE(usage == GL_STREAM_DRAW || usage == GL_STATIC_DRAW || usage == GL_DYNAMIC_DRAW);
+	// (GL_STREAM_DRAW data should use GetStreamingBuffer instead)
+	ENSURE(usage == GL_STATIC_DRAW || usage == GL_DYNAMIC_DRAW);
 
 	ENSURE(target == GL_ARRAY_BUFFER || target == GL_ELEMENT_ARRAY_BUFFER);
 
 	// TODO, RC - run some sanity checks on allocation request
 
-	typedef std::list<CVertexBuffer*>::iterator Iter;
-
 #if DUMP_VB_STATS
 	debug_printf(L"\n============================\n# allocate vsize=%d nverts=%d\n\n", vertexSize, numVertices);
-	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter) {
-		CVertexBuffer* buffer = *iter;
+	for (size_t i = 0; i < m_Buffers.size(); ++i) {
+		CVertexBuffer* buffer = m_Buffers[i];
 		if (buffer->CompatibleVertexType(vertexSize, usage, target))
 		{
 			debug_printf(L"%p\n", buffer);
@@ -71,18 +75,24 @@ CVertexBuffer::VBChunk* CVertexBufferManager::Allocate(size_t vertexSize, size_t
 	}
 #endif
 
-	// iterate through all existing buffers testing for one that'll 
-	// satisfy the allocation
-	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter) {
-		CVertexBuffer* buffer = *iter;
-		result = buffer->Allocate(vertexSize, numVertices, usage, target);
-		if (result)
-			return result;
+	// find the fullest existing buffer that can satisfy the allocation,
+	// so that the emptier ones are more likely to become empty and be
+	// deleted by Compact
+	CVertexBuffer* best = 0;
+	for (size_t i = 0; i < m_Buffers.size(); ++i) {
+		CVertexBuffer* buffer = m_Buffers[i];
+		if (buffer->CompatibleVertexType(vertexSize, usage, target) && buffer->CanAllocate(numVertices))
+		{
+			if (!best || buffer->GetBytesAllocated() > best->GetBytesAllocated())
+				best = buffer;
+		}
 	}
+	if (best)
+		return best->Allocate(vertexSize, numVertices, usage, target);
 
 	// got this far; need to allocate a new buffer
 	CVertexBuffer* buffer = new CVertexBuffer(vertexSize, usage, target);
-	m_Buffers.push_front(buffer);
+	m_Buffers.push_back(buffer);
 	result = buffer->Allocate(vertexSize, numVertices, usage, target);
 	
 	if (!result)
@@ -105,13 +115,101 @@ void CVertexBufferManager::Release(CVertexBuffer::VBChunk* chunk)
 }
 
 
+CStreamingBuffer& CVertexBufferManager::GetStreamingBuffer(GLenum target)
+{
+	ENSURE(target == GL_ARRAY_BUFFER || target == GL_ELEMENT_ARRAY_BUFFER);
+
+	CStreamingBuffer*& buffer = (target == GL_ARRAY_BUFFER) ? m_StreamingVertices : m_StreamingIndices;
+	if (!buffer)
+		buffer = new CStreamingBuffer(target);
+	return *buffer;
+}
+
+void CVertexBufferManager::EndFrame()
+{
+	if (m_StreamingVertices)
+		m_StreamingVertices->EndFrame();
+	if (m_StreamingIndices)
+		m_StreamingIndices->EndFrame();
+
+	Compact();
+}
+
+void CVertexBufferManager::GetCompatibleBuffers(CVertexBuffer* buffer, std::vector<CVertexBuffer*>& out)
+{
+	out.clear();
+	for (size_t i = 0; i < m_Buffers.size(); ++i)
+	{
+		CVertexBuffer* other = m_Buffers[i];
+		if (other != buffer && other->CompatibleVertexType(buffer->GetVertexSize(), buffer->GetUsage(), buffer->m_Target))
+			out.push_back(other);
+	}
+}
+
+// Compaction is only worthwhile for buffers that are less than 1/COMPACT_THRESHOLD full
+static const size_t COMPACT_THRESHOLD = 4;
+
+void CVertexBufferManager::Compact()
+{
+	std::vector<CVertexBuffer*> compatible;
+
+	// Delete empty buffers, unless they're the only one of their type
+	// (in which case they'd probably just be recreated soon)
+	for (size_t i = 0; i < m_Buffers.size(); )
+	{
+		CVertexBuffer* buffer = m_Buffers[i];
+		if (buffer->IsEmpty())
+		{
+			GetCompatibleBuffers(buffer, compatible);
+			if (!compatible.empty())
+			{
+				delete buffer;
+				m_Buffers.erase(m_Buffers.begin() + i);
+				continue;
+			}
+		}
+		++i;
+	}
+
+	// Find the emptiest dynamic buffer that's worth compacting
+	CVertexBuffer* emptiest = 0;
+	for (size_t i = 0; i < m_Buffers.size(); ++i)
+	{
+		CVertexBuffer* buffer = m_Buffers[i];
+		if (buffer->GetUsage() == GL_STATIC_DRAW || buffer->IsEmpty())
+			continue;
+		if (buffer->GetBytesAllocated() * COMPACT_THRESHOLD > buffer->GetBytesReserved())
+			continue;
+		if (!emptiest || buffer->GetBytesAllocated() < emptiest->GetBytesAllocated())
+			emptiest = buffer;
+	}
+	if (!emptiest)
+		return;
+
+	// Only bother if the other buffers have enough free space (so it's likely
+	// that everything can be moved)
+	GetCompatibleBuffers(emptiest, compatible);
+	size_t freeBytes = 0;
+	for (size_t i = 0; i < compatible.size(); ++i)
+		freeBytes += compatible[i]->GetBytesReserved() - compatible[i]->GetBytesAllocated();
+	if (freeBytes < emptiest->GetBytesAllocated())
+		return;
+
+	PROFILE3("compact vertex buffers");
+
+	if (emptiest->MoveChunksTo(compatible))
+	{
+		m_Buffers.erase(std::find(m_Buffers.begin(), m_Buffers.end(), emptiest));
+		delete emptiest;
+	}
+}
+
 size_t CVertexBufferManager::GetBytesReserved()
 {
 	size_t total = 0;
 
-	typedef std::list<CVertexBuffer*>::iterator Iter;
-	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
-		total += (*iter)->GetBytesReserved();
+	for (size_t i = 0; i < m_Buffers.size(); ++i)
+		total += m_Buffers[i]->GetBytesReserved();
 
 	return total;
 }
@@ -120,9 +218,18 @@ size_t CVertexBufferManager::GetBytesAllocated()
 {
 	size_t total = 0;
 
-	typedef std::list<CVertexBuffer*>::iterator Iter;
-	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
-		total += (*iter)->GetBytesAllocated();
+	for (size_t i = 0; i < m_Buffers.size(); ++i)
+		total += m_Buffers[i]->GetBytesAllocated();
+
+	return total;
+}
+
+size_t CVertexBufferManager::GetBytesFragmented()
+{
+	size_t total = 0;
+
+	for (size_t i = 0; i < m_Buffers.size(); ++i)
+		total += m_Buffers[i]->GetBytesFragmented();
 
 	return total;
 }
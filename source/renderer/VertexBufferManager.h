@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -30,6 +30,7 @@
 class CVertexBufferManager
 {
 public:
+	CVertexBufferManager() : m_StreamingVertices(0), m_StreamingIndices(0) { }
 	
 	/**
 	 * Try to allocate a vertex buffer of the given size and type.
@@ -45,11 +46,27 @@ public:
 	/// Returns the given @p chunk to its owning buffer
 	void Release(CVertexBuffer::VBChunk* chunk);
 
+	/// Returns the buffer for per-frame (GL_STREAM_DRAW) data of the given target
+	CStreamingBuffer& GetStreamingBuffer(GLenum target);
+
+	/// Recycle the streaming buffers and compact the others; called once per frame
+	void EndFrame();
+
 	/// Returns a list of all buffers
-	const std::list<CVertexBuffer*>& GetBufferList() const { return m_Buffers; }
+	const std::vector<CVertexBuffer*>& GetBufferList() const { return m_Buffers; }
 
 	size_t GetBytesReserved();
 	size_t GetBytesAllocated();
+	size_t GetBytesFragmented();
+
+	/**
+	 * Reduce the number of buffers: deletes empty buffers (keeping at least one of
+	 * each type), and if a dynamic buffer is mostly empty, moves its chunks into the
+	 * other buffers of its type so it can be deleted too. (Static buffers aren't
+	 * compacted, since their users may have stored indexes relative to the buffer.)
+	 * Called by EndFrame; it moves at most one buffer each time.
+	 */
+	void Compact();
 
 	/// Returns the maximum possible size of a single vertex buffer
 	size_t GetMaxBufferSize() const { return MAX_VB_SIZE_BYTES; }
@@ -58,8 +75,15 @@ public:
 	void Shutdown();
 
 private:
+	/// Returns the buffers compatible with the given one, excluding itself
+	void GetCompatibleBuffers(CVertexBuffer* buffer, std::vector<CVertexBuffer*>& out);
+
 	/// List of all known vertex buffers
-	std::list<CVertexBuffer*> m_Buffers;
+	std::vector<CVertexBuffer*> m_Buffers;
+
+	/// Streaming buffers for GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER (lazily created)
+	CStreamingBuffer* m_StreamingVertices;
+	CStreamingBuffer* m_StreamingIndices;
 };
 
 extern CVertexBufferManager g_VBMan;
@@ -21,6 +21,7 @@
 
 #include "precompiled.h"
 
+#include "graphics/RenderableObject.h"
 #include "graphics/Terrain.h"
 #include "graphics/TextureManager.h"
 
@@ -33,6 +34,7 @@
 #include "maths/Vector2D.h"
 
 #include "ps/Game.h"
+#include "ps/Profile.h"
 #include "ps/World.h"
 
 #include "renderer/WaterManager.h"
@@ -41,6 +43,7 @@
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpWaterManager.h"
 #include "simulation2/components/ICmpRangeManager.h"
+#include "simulation2/helpers/WorkerPool.h"
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -82,6 +85,8 @@ WaterManager::WaterManager()
 	m_WaveZ = NULL;
 	m_DistanceToShore = NULL;
 	m_FoamFactor = NULL;
+	m_ShoreDataSize = 0;
+	m_ShoreDirtyI0 = m_ShoreDirtyJ0 = m_ShoreDirtyI1 = m_ShoreDirtyJ1 = 0;
 
 	m_WaterNormal = false;
 	m_WaterRealDepth = false;
@@ -231,72 +236,80 @@ void WaterManager::UnloadWaterTextures()
 
 ///////////////////////////////////////////////////////////////////
 // Create information about the terrain and wave vertices.
-void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
+
+// Terrain changes can affect the shore data of vertices up to this far away
+// (the wave force looks 18 vertices back diagonally, plus the blurred normals)
+static const ssize_t SHORE_DATA_RADIUS = 20;
+
+// Radius of the blur of the terrain normals for the shore data
+static const ssize_t SHORE_NORMALS_RADIUS = 4;
+
+// Number of rows of vertices computed by each job on the worker threads
+// (so that the per-job overhead is insignificant)
+static const ssize_t SHORE_DATA_ROWS_PER_JOB = 4;
+
+// Size (in vertices) of the squares in which coastal waves are placed
+static const int WAVE_SQUARE_SIZE = 8;
+
+struct ShoreDataJobs
 {
-	if (m_VBWaves)
-	{
-		g_VBMan.Release(m_VBWaves);
-		m_VBWaves = NULL;
-	}
-	if (m_VBWavesIndices)
-	{
-		g_VBMan.Release(m_VBWavesIndices);
-		m_VBWavesIndices = NULL;
-	}
+	WaterManager* waterManager;
+	const CTerrain* terrain;
+	ssize_t mapSize;
+	bool circular;
 
-	CTerrain* terrain = g_Game->GetWorld()->GetTerrain();
-	ssize_t mapSize = terrain->GetVerticesPerSide();
-	
-	CmpPtr<ICmpWaterManager> cmpWaterManager(*simulation, SYSTEM_ENTITY);
-	if (!cmpWaterManager)
-		return;	// REALLY shouldn't happen and will most likely crash.
+	// Range of vertices to recompute the shore data of
+	ssize_t i0, j0, i1, j1;
+
+	// Terrain normals of that range extended by SHORE_NORMALS_RADIUS,
+	// cached since each is used by many vertices
+	CVector3D* normals;
+	ssize_t ni0, nj0, ni1, nj1;
+
+	// Range of squares to recompute the coastal waves of
+	ssize_t si0, sj0, si1, sj1;
+	ssize_t numSquares;
+};
+
+static void ComputeShoreNormalsJob(void* data, size_t index)
+{
+	const ShoreDataJobs& jobs = *static_cast<ShoreDataJobs*>(data);
+
+	ssize_t j = jobs.nj0 + (ssize_t)index;
+	CVector3D* normals = jobs.normals + (j - jobs.nj0)*(jobs.ni1 - jobs.ni0);
+	for (ssize_t i = jobs.ni0; i < jobs.ni1; ++i)
+		normals[i - jobs.ni0] = jobs.terrain->CalcExactNormal(((float)i)*4.0f,((float)j)*4.0f);
+}
+
+static void ComputeShoreDataJob(void* data, size_t index)
+{
+	const ShoreDataJobs& jobs = *static_cast<ShoreDataJobs*>(data);
+	WaterManager& waterMgr = *jobs.waterManager;
+	const CTerrain* terrain = jobs.terrain;
+	ssize_t mapSize = jobs.mapSize;
 
-	// Using this to get some more optimization on circular maps
-	CmpPtr<ICmpRangeManager> cmpRangeManager(*simulation, SYSTEM_ENTITY);
-	if (!cmpRangeManager)
-		return;
-	bool circular = cmpRangeManager->GetLosCircular();
 	float mSize = mapSize*mapSize;
 	float halfSize = (mapSize/2.0);
 
-	// Warning: this won't work with multiple water planes
-	m_WaterHeight = cmpWaterManager->GetExactWaterLevel(0,0);
-	
-	// TODO: change this whenever we incrementally update because it's def. not too efficient
-	delete[] m_WaveX;
-	delete[] m_WaveZ;
-	delete[] m_DistanceToShore;
-	delete[] m_FoamFactor;
-	
-	m_WaveX = new float[mapSize*mapSize];
-	m_WaveZ = new float[mapSize*mapSize];
-	m_DistanceToShore = new float[mapSize*mapSize];
-	m_FoamFactor = new float[mapSize*mapSize];
+	const u16* heightmap = terrain->GetHeightMap();
+	u16 waterHeightInu16 = waterMgr.m_WaterHeight/HEIGHT_SCALE;
 
-	u16* heightmap = terrain->GetHeightMap();
-	
-	// some temporary stuff for wave intensity
-	// not really used too much right now.
-	u8* waveForceHQ = new u8[mapSize*mapSize];
-	u16 waterHeightInu16 = m_WaterHeight/HEIGHT_SCALE;
-
-	// used to cache terrain normals since otherwise we'd recalculate them a lot (I'm blurring the "normal" map).
-	// this might be updated to actually cache in the terrain manager but that's not for now.
-	CVector3D* normals = new CVector3D[mapSize*mapSize];
-
-	// calculate wave force (not really used right now)
-	// and puts into "normals" the terrain normal at that point
-	// so as to avoid recalculating terrain normals too often.
-	for (ssize_t i = 0; i < mapSize; ++i)
+	ssize_t jStart = jobs.j0 + (ssize_t)index*SHORE_DATA_ROWS_PER_JOB;
+	ssize_t jEnd = std::min(jStart + SHORE_DATA_ROWS_PER_JOB, jobs.j1);
+	for (ssize_t j = jStart; j < jEnd; ++j)
 	{
-		for (ssize_t j = 0; j < mapSize; ++j)
+		for (ssize_t i = jobs.i0; i < jobs.i1; ++i)
 		{
-			normals[j*mapSize + i] = terrain->CalcExactNormal(((float)i)*4.0f,((float)j)*4.0f);
-			if (circular && (i-halfSize)*(i-halfSize)+(j-halfSize)*(j-halfSize) > mSize)
+			if (jobs.circular && (i-halfSize)*(i-halfSize)+(j-halfSize)*(j-halfSize) > mSize)
 			{
-				waveForceHQ[j*mapSize + i] = 255;
+				waterMgr.m_WaveX[j*mapSize + i] = 0.0f;
+				waterMgr.m_WaveZ[j*mapSize + i] = 0.0f;
+				waterMgr.m_DistanceToShore[j*mapSize + i] = 100;
+				waterMgr.m_FoamFactor[j*mapSize + i] = 0.0f;
 				continue;
 			}
+
+			// calculate wave force (not really used right now)
 			u8 color = 0;
 			for (int v = 0; v <= 18; v += 3){
 				if (j-v >= 0 && i-v >= 0 && heightmap[(j-v)*mapSize + i-v] > waterHeightInu16)
@@ -307,23 +320,9 @@ void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
 						color++;
 				}
 			}
-			waveForceHQ[j*mapSize + i] = 255 - color * 40;
-		}
-	}
-	// this creates information for waves and stores it in float arrays. PatchRData then puts it in the vertex info for speed.
-	for (ssize_t i = 0; i < mapSize; ++i)
-	{
-		for (ssize_t j = 0; j < mapSize; ++j)
-		{
-			if (circular && (i-halfSize)*(i-halfSize)+(j-halfSize)*(j-halfSize) > mSize)
-			{
-				m_WaveX[j*mapSize + i] = 0.0f;
-				m_WaveZ[j*mapSize + i] = 0.0f;
-				m_DistanceToShore[j*mapSize + i] = 100;
-				m_FoamFactor[j*mapSize + i] = 0.0f;
-				continue;
-			}
-			float depth = m_WaterHeight - heightmap[j*mapSize + i]*HEIGHT_SCALE;
+			u8 waveForceHQ = 255 - color * 40;
+
+			float depth = waterMgr.m_WaterHeight - heightmap[j*mapSize + i]*HEIGHT_SCALE;
 			int distanceToShore = 10000;
 			
 			// calculation of the distance to the shore.
@@ -339,7 +338,7 @@ void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
 						if (i+xx >= 0 && i + xx < mapSize)
 							if (j + yy >= 0 && j + yy < mapSize)
 							{
-								float hereDepth = m_WaterHeight - heightmap[(j+yy)*mapSize + (i+xx)]*HEIGHT_SCALE;
+								float hereDepth = waterMgr.m_WaterHeight - heightmap[(j+yy)*mapSize + (i+xx)]*HEIGHT_SCALE;
 								if (hereDepth < 0 && xx*xx + yy*yy < distanceToShore)
 									distanceToShore = xx*xx + yy*yy;
 							}
@@ -352,7 +351,7 @@ void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
 					{
 						for (float yy = -2.5f; yy <= 2.5f; ++yy)
 						{
-							float hereDepth = m_WaterHeight - terrain->GetExactGroundLevel( (i+xx)*4, (j+yy)*4 );
+							float hereDepth = waterMgr.m_WaterHeight - terrain->GetExactGroundLevel( (i+xx)*4, (j+yy)*4 );
 							if (hereDepth < 0 && xx*xx + yy*yy < distanceToShore)
 								distanceToShore = xx*xx + yy*yy;
 						}
@@ -365,7 +364,7 @@ void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
 				{
 					for (int yy = -2; yy <= 2; ++yy)
 					{
-						float hereDepth = m_WaterHeight - terrain->GetVertexGroundLevel(i+xx, j+yy);
+						float hereDepth = waterMgr.m_WaterHeight - terrain->GetVertexGroundLevel(i+xx, j+yy);
 						if (hereDepth > 0)
 							distanceToShore = 0;
 					}
@@ -375,10 +374,10 @@ void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
 			// speedup with default values for land squares
 			if (distanceToShore == 10000)
 			{
-				m_WaveX[j*mapSize + i] = 0.0f;
-				m_WaveZ[j*mapSize + i] = 0.0f;
-				m_DistanceToShore[j*mapSize + i] = 100;
-				m_FoamFactor[j*mapSize + i] = 0.0f;
+				waterMgr.m_WaveX[j*mapSize + i] = 0.0f;
+				waterMgr.m_WaveZ[j*mapSize + i] = 0.0f;
+				waterMgr.m_DistanceToShore[j*mapSize + i] = 100;
+				waterMgr.m_FoamFactor[j*mapSize + i] = 0.0f;
 				continue;
 			}
 			// We'll compute the normals and the "water raise", to know about foam
@@ -390,7 +389,7 @@ void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
 				for (int yy = -4; yy <= 4; yy += 2)
 				{
 					if (j+yy < mapSize && i+xx < mapSize && i+xx >= 0 && j+yy >= 0)
-						normal += normals[(j+yy)*mapSize + (i+xx)];
+						normal += jobs.normals[(j+yy - jobs.nj0)*(jobs.ni1 - jobs.ni0) + (i+xx - jobs.ni0)];
 					if (terrain->GetVertexGroundLevel(i+xx,j+yy) < heightmap[j*mapSize + i]*HEIGHT_SCALE)
 						waterRaise += heightmap[j*mapSize + i]*HEIGHT_SCALE - terrain->GetVertexGroundLevel(i+xx,j+yy);
 				}
@@ -400,105 +399,238 @@ void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
 			normal[1] = 0.1f;
 			normal = normal.Normalized();
 
-			m_WaveX[j*mapSize + i] = normal[0];
-			m_WaveZ[j*mapSize + i] = normal[2];
+			waterMgr.m_WaveX[j*mapSize + i] = normal[0];
+			waterMgr.m_WaveZ[j*mapSize + i] = normal[2];
 			// distance is /5.0 to be a [0,1] value.
 
-			m_DistanceToShore[j*mapSize + i] = sqrtf(distanceToShore)/5.0f; // TODO: this can probably be cached as I'm integer here.
+			waterMgr.m_DistanceToShore[j*mapSize + i] = sqrtf(distanceToShore)/5.0f; // TODO: this can probably be cached as I'm integer here.
 
 			// computing the amount of foam I want
 
 			depth = clamp(depth,0.0f,10.0f);
-			float foamAmount = (waterRaise/255.0f) * (1.0f - depth/10.0f) * (waveForceHQ[j*mapSize+i]/255.0f) * (m_Waviness/8.0f);
-			foamAmount += clamp(m_Waviness/2.0f - distanceToShore,0.0f,m_Waviness/2.0f)/(m_Waviness/2.0f) * clamp(m_Waviness/9.0f,0.3f,1.0f);
+			float foamAmount = (waterRaise/255.0f) * (1.0f - depth/10.0f) * (waveForceHQ/255.0f) * (waterMgr.m_Waviness/8.0f);
+			foamAmount += clamp(waterMgr.m_Waviness/2.0f - distanceToShore,0.0f,waterMgr.m_Waviness/2.0f)/(waterMgr.m_Waviness/2.0f) * clamp(waterMgr.m_Waviness/9.0f,0.3f,1.0f);
 			foamAmount = foamAmount > 1.0f ? 1.0f: foamAmount;
 			
-			m_FoamFactor[j*mapSize + i] = foamAmount;
+			waterMgr.m_FoamFactor[j*mapSize + i] = foamAmount;
+		}
+	}
+}
+
+// Finds where the coastal wave of each square should start: if the square is
+// mostly land with a fairly flat shore, look for the best positionning (in order
+// to have a nice blending with the shore).
+static void ComputeWaveSquaresJob(void* data, size_t index)
+{
+	const ShoreDataJobs& jobs = *static_cast<ShoreDataJobs*>(data);
+	WaterManager& waterMgr = *jobs.waterManager;
+	const CTerrain* terrain = jobs.terrain;
+
+	int size = WAVE_SQUARE_SIZE;
+	ssize_t i = jobs.si0 + (ssize_t)index;
+	for (ssize_t j = jobs.sj0; j < jobs.sj1; ++j)
+	{
+		CVector2D& squarePos = waterMgr.m_WaveSquares[i*jobs.numSquares + j];
+		squarePos = CVector2D(-1,-1);
+
+		int landTexel = 0;
+		int waterTexel = 0;
+		CVector3D avnormal (0.0f,0.0f,0.0f);
+		CVector2D landPosition(0.0f,0.0f);
+		CVector2D waterPosition(0.0f,0.0f);
+		for (int xx = 0; xx < size; ++xx)
+		{
+			for (int yy = 0; yy < size; ++yy)
+			{
+				if (terrain->GetVertexGroundLevel(i*size+xx,j*size+yy) > waterMgr.m_WaterHeight)
+				{
+					landTexel++;
+					landPosition += CVector2D(i*size+xx,j*size+yy);
+				}
+				else
+				{
+					waterPosition += CVector2D(i*size+xx,j*size+yy);
+					waterTexel++;
+					avnormal += terrain->CalcExactNormal( (i*size+xx)*4.0f,(j*size+yy)*4.0f);
+				}
+			}
+		}
+		if (landTexel < size/2)
+			continue;
+
+		landPosition /= landTexel;
+		waterPosition /= waterTexel;
+		
+		avnormal[1] = 1.0f;
+		avnormal.Normalize();
+		avnormal[1] = 0.0f;
+		
+		// this should help ensure that the shore is pretty flat.
+		if (avnormal.Length() <= 0.2f)
+			continue;
+		
+		// To get the best position for squares, I start at the mean "ocean" position
+		// And step by step go to the mean "land" position. I keep the position where I change from water to land.
+		// If this never happens, the square is scrapped.
+		if (terrain->GetExactGroundLevel(waterPosition.X*4.0f,waterPosition.Y*4.0f) > waterMgr.m_WaterHeight)
+			continue;
+		
+		for (u8 k = 0; k < 40; k++)
+		{
+			squarePos = landPosition * (k/40.0f) + waterPosition * (1.0f-(k/40.0f));
+			if (terrain->GetExactGroundLevel(squarePos.X*4.0f,squarePos.Y*4.0f) > waterMgr.m_WaterHeight)
+				break;
 		}
 	}
+}
+
+void WaterManager::MakeShoreDataDirty(CTerrain& terrain, ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1)
+{
+	// The heights of tiles [i0,i1) are stored at vertices [i0,i1]
+	i0 -= SHORE_DATA_RADIUS;
+	j0 -= SHORE_DATA_RADIUS;
+	i1 += SHORE_DATA_RADIUS + 1;
+	j1 += SHORE_DATA_RADIUS + 1;
+
+	if (m_ShoreDirtyI0 < m_ShoreDirtyI1)
+	{
+		m_ShoreDirtyI0 = std::min(m_ShoreDirtyI0, i0);
+		m_ShoreDirtyJ0 = std::min(m_ShoreDirtyJ0, j0);
+		m_ShoreDirtyI1 = std::max(m_ShoreDirtyI1, i1);
+		m_ShoreDirtyJ1 = std::max(m_ShoreDirtyJ1, j1);
+	}
+	else
+	{
+		m_ShoreDirtyI0 = i0;
+		m_ShoreDirtyJ0 = j0;
+		m_ShoreDirtyI1 = i1;
+		m_ShoreDirtyJ1 = j1;
+	}
+
+	// The water vertices of the surrounding patches use the shore data too
+	terrain.MakeDirty(i0, j0, i1, j1, RENDERDATA_UPDATE_VERTICES);
+}
+
+void WaterManager::CreateSuperfancyInfo(CSimulation2* simulation)
+{
+	PROFILE3("create superfancy water info");
+
+	bool fullUpdate = m_NeedsFullReloading;
+	m_NeedsFullReloading = false;
+
+	ssize_t i0 = m_ShoreDirtyI0;
+	ssize_t j0 = m_ShoreDirtyJ0;
+	ssize_t i1 = m_ShoreDirtyI1;
+	ssize_t j1 = m_ShoreDirtyJ1;
+	m_ShoreDirtyI0 = m_ShoreDirtyJ0 = m_ShoreDirtyI1 = m_ShoreDirtyJ1 = 0;
+
+	if (m_VBWaves)
+	{
+		g_VBMan.Release(m_VBWaves);
+		m_VBWaves = NULL;
+	}
+	if (m_VBWavesIndices)
+	{
+		g_VBMan.Release(m_VBWavesIndices);
+		m_VBWavesIndices = NULL;
+	}
+
+	CTerrain* terrain = g_Game->GetWorld()->GetTerrain();
+	ssize_t mapSize = terrain->GetVerticesPerSide();
+	
+	CmpPtr<ICmpWaterManager> cmpWaterManager(*simulation, SYSTEM_ENTITY);
+	if (!cmpWaterManager)
+		return;	// REALLY shouldn't happen and will most likely crash.
+
+	// Using this to get some more optimization on circular maps
+	CmpPtr<ICmpRangeManager> cmpRangeManager(*simulation, SYSTEM_ENTITY);
+	if (!cmpRangeManager)
+		return;
+
+	// Warning: this won't work with multiple water planes
+	float waterHeight = cmpWaterManager->GetExactWaterLevel(0,0);
+
+	// The water height affects every vertex, and a new map needs new arrays
+	if (waterHeight != m_WaterHeight || mapSize != m_ShoreDataSize)
+		fullUpdate = true;
+	m_WaterHeight = waterHeight;
+
+	ssize_t numSquares = mapSize/WAVE_SQUARE_SIZE;
+	if (fullUpdate)
+	{
+		delete[] m_WaveX;
+		delete[] m_WaveZ;
+		delete[] m_DistanceToShore;
+		delete[] m_FoamFactor;
+
+		m_WaveX = new float[mapSize*mapSize];
+		m_WaveZ = new float[mapSize*mapSize];
+		m_DistanceToShore = new float[mapSize*mapSize];
+		m_FoamFactor = new float[mapSize*mapSize];
+		m_ShoreDataSize = mapSize;
+
+		m_WaveSquares.assign(numSquares*numSquares, CVector2D(-1,-1));
 
-	delete[] normals;
-	delete[] waveForceHQ;
+		i0 = j0 = 0;
+		i1 = j1 = mapSize;
+	}
+
+	ShoreDataJobs jobs;
+	jobs.waterManager = this;
+	jobs.terrain = terrain;
+	jobs.mapSize = mapSize;
+	jobs.circular = cmpRangeManager->GetLosCircular();
+	jobs.i0 = clamp(i0, (ssize_t)0, mapSize);
+	jobs.j0 = clamp(j0, (ssize_t)0, mapSize);
+	jobs.i1 = clamp(i1, jobs.i0, mapSize);
+	jobs.j1 = clamp(j1, jobs.j0, mapSize);
+	jobs.ni0 = std::max(jobs.i0 - SHORE_NORMALS_RADIUS, (ssize_t)0);
+	jobs.nj0 = std::max(jobs.j0 - SHORE_NORMALS_RADIUS, (ssize_t)0);
+	jobs.ni1 = std::min(jobs.i1 + SHORE_NORMALS_RADIUS, mapSize);
+	jobs.nj1 = std::min(jobs.j1 + SHORE_NORMALS_RADIUS, mapSize);
+	jobs.si0 = std::min(jobs.i0/WAVE_SQUARE_SIZE, numSquares);
+	jobs.sj0 = std::min(jobs.j0/WAVE_SQUARE_SIZE, numSquares);
+	jobs.si1 = std::min((jobs.i1 + WAVE_SQUARE_SIZE - 1)/WAVE_SQUARE_SIZE, numSquares);
+	jobs.sj1 = std::min((jobs.j1 + WAVE_SQUARE_SIZE - 1)/WAVE_SQUARE_SIZE, numSquares);
+	jobs.numSquares = numSquares;
+
+	// The vertices only read the terrain and write their own shore data, so
+	// they can be computed in parallel. The normals are computed first since
+	// each is blurred into the data of many vertices.
+	std::vector<CVector3D> normals((jobs.ni1 - jobs.ni0)*(jobs.nj1 - jobs.nj0));
+	jobs.normals = normals.empty() ? NULL : &normals[0];
+
+	WorkerPool& workerPool = g_Renderer.GetWorkerPool();
+	workerPool.Run(&ComputeShoreNormalsJob, &jobs, jobs.nj1 - jobs.nj0);
+	workerPool.Run(&ComputeShoreDataJob, &jobs, (jobs.j1 - jobs.j0 + SHORE_DATA_ROWS_PER_JOB - 1)/SHORE_DATA_ROWS_PER_JOB);
+	workerPool.Run(&ComputeWaveSquaresJob, &jobs, jobs.si1 - jobs.si0);
 	
 	// TODO: The rest should be cleaned up
 	
 	// okay let's create the waves squares. i'll divide the map in arbitrary squares
-	// For each of these squares, check if waves are needed.
-	// If yes, look for the best positionning (in order to have a nice blending with the shore)
+	// For each of these squares, check if waves are needed (done by the jobs above).
 	// Then clean-up: remove squares that are too close to each other
 	
 	std::vector<CVector2D> waveSquares;
 	
-	int size = 8;	// I think this is the size of the squares.
-	for (int i = 0; i < mapSize/size; ++i)
+	int size = WAVE_SQUARE_SIZE;
+	for (size_t s = 0; s < m_WaveSquares.size(); ++s)
 	{
-		for (int j = 0; j < mapSize/size; ++j)
+		const CVector2D& squarePos = m_WaveSquares[s];
+		if (squarePos.X == -1)
+			continue;
+		
+		u8 enter = 1;
+		// okaaaaaay. Got a square. Check for proximity.
+		for (unsigned long i = 0; i < waveSquares.size(); i++)
 		{
-			
-			int landTexel = 0;
-			int waterTexel = 0;
-			CVector3D avnormal (0.0f,0.0f,0.0f);
-			CVector2D landPosition(0.0f,0.0f);
-			CVector2D waterPosition(0.0f,0.0f);
-			for (int xx = 0; xx < size; ++xx)
-			{
-				for (int yy = 0; yy < size; ++yy)
-				{
-					if (terrain->GetVertexGroundLevel(i*size+xx,j*size+yy) > m_WaterHeight)
-					{
-						landTexel++;
-						landPosition += CVector2D(i*size+xx,j*size+yy);
-					}
-					else
-					{
-						waterPosition += CVector2D(i*size+xx,j*size+yy);
-						waterTexel++;
-						avnormal += terrain->CalcExactNormal( (i*size+xx)*4.0f,(j*size+yy)*4.0f);
-					}
-				}
-			}
-			if (landTexel < size/2)
-				continue;
-
-			landPosition /= landTexel;
-			waterPosition /= waterTexel;
-			
-			avnormal[1] = 1.0f;
-			avnormal.Normalize();
-			avnormal[1] = 0.0f;
-			
-			// this should help ensure that the shore is pretty flat.
-			if (avnormal.Length() <= 0.2f)
-				continue;
-			
-			// To get the best position for squares, I start at the mean "ocean" position
-			// And step by step go to the mean "land" position. I keep the position where I change from water to land.
-			// If this never happens, the square is scrapped.
-			if (terrain->GetExactGroundLevel(waterPosition.X*4.0f,waterPosition.Y*4.0f) > m_WaterHeight)
-				continue;
-			
-			CVector2D squarePos(-1,-1);
-			for (u8 i = 0; i < 40; i++)
-			{
-				squarePos = landPosition * (i/40.0f) + waterPosition * (1.0f-(i/40.0f));
-				if (terrain->GetExactGroundLevel(squarePos.X*4.0f,squarePos.Y*4.0f) > m_WaterHeight)
-					break;
-			}
-			if (squarePos.X == -1)
-				continue;
-			
-			u8 enter = 1;
-			// okaaaaaay. Got a square. Check for proximity.
-			for (unsigned long i = 0; i < waveSquares.size(); i++)
-			{
-				if ( CVector2D(waveSquares[i]-squarePos).LengthSquared() < 80) {
-					enter = 0;
-					break;
-				}
+			if ( CVector2D(waveSquares[i]-squarePos).LengthSquared() < 80) {
+				enter = 0;
+				break;
 			}
-			if (enter == 1)
-				waveSquares.push_back(squarePos);
 		}
+		if (enter == 1)
+			waveSquares.push_back(squarePos);
 	}
 	
 	// Actually create the waves' meshes.
@@ -25,10 +25,12 @@
 #include "graphics/Texture.h"
 #include "lib/ogl.h"
 #include "maths/Matrix3D.h"
+#include "maths/Vector2D.h"
 #include "ps/Overlay.h"
 #include "renderer/VertexBufferManager.h"
 
 class CSimulation2;
+class CTerrain;
 
 struct SWavesVertex {
 	// vertex position
@@ -57,6 +59,16 @@ public:
 	float* m_WaveZ;
 	float* m_DistanceToShore;
 	float* m_FoamFactor;
+
+	// Size (in vertices per side) of the map the arrays above were computed for
+	ssize_t m_ShoreDataSize;
+	// Range of vertices whose shore data is out of date (inclusive lower bound,
+	// exclusive upper bound), for incremental updates after terrain changes.
+	// Empty if m_ShoreDirtyI0 >= m_ShoreDirtyI1.
+	ssize_t m_ShoreDirtyI0, m_ShoreDirtyJ0, m_ShoreDirtyI1, m_ShoreDirtyJ1;
+	// Start position of the coastal wave of each square of the map,
+	// or (-1,-1) if the square has none.
+	std::vector<CVector2D> m_WaveSquares;
 	
 	ssize_t m_TexSize;
 
@@ -143,10 +155,28 @@ public:
 	void UnloadWaterTextures();
 
 	/**
-	 * CreateSuperfancyInfo: creates textures and wave vertices for superfancy water
+	 * CreateSuperfancyInfo: creates textures and wave vertices for superfancy water.
+	 * Recomputes the data for the whole map if m_NeedsFullReloading is set,
+	 * else only for the region marked by MakeShoreDataDirty.
+	 * The work is split between the renderer's worker threads.
 	 */
 	void CreateSuperfancyInfo(CSimulation2* simulation);
 
+	/**
+	 * Marks the shore data around the given range of tiles (inclusive lower bound,
+	 * exclusive upper bound) as out of date, and makes the patches whose water
+	 * depends on it rebuild their render data.
+	 */
+	void MakeShoreDataDirty(CTerrain& terrain, ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1);
+
+	/**
+	 * Returns whether CreateSuperfancyInfo needs to be called before using the shore data.
+	 */
+	bool NeedsSuperfancyInfoUpdate() const
+	{
+		return m_NeedsFullReloading || m_ShoreDirtyI0 < m_ShoreDirtyI1;
+	}
+
 	/**
 	 * Updates the settings to the one from the renderer, and sets m_NeedsReloading.
 	 */
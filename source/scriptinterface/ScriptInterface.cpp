@@ -27,6 +27,7 @@
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
 #include "ps/Profile.h"
+#include "ps/Profiler2.h"
 #include "ps/utf16string.h"
 
 #include <cassert>
@@ -69,21 +70,24 @@ class ScriptRuntime
 {
 public:
 	ScriptRuntime(int runtimeSize) :
-		m_rooter(NULL), m_compartmentGlobal(NULL)
+		m_rooter(NULL), m_compartmentGlobal(NULL), m_ProfileEnabled(false), m_Profile2Enabled(false)
 	{
 		m_rt = JS_NewRuntime(runtimeSize);
 		ENSURE(m_rt); // TODO: error handling
 
 		if (g_ScriptProfilingEnabled)
 		{
-			// Profiler isn't thread-safe, so only enable this on the main thread
-			if (ThreadUtil::IsMainThread())
+			// CProfileManager isn't thread-safe, so only use it on the main thread
+			m_ProfileEnabled = (ThreadUtil::IsMainThread() && CProfileManager::IsInitialised());
+
+			// Profiler2 works in any thread (e.g. the AI worker) that has registered with it.
+			// (A runtime is only used by the thread that created it.)
+			m_Profile2Enabled = g_Profiler2.IsCurrentThreadRegistered();
+
+			if (m_ProfileEnabled || m_Profile2Enabled)
 			{
-				if (CProfileManager::IsInitialised())
-				{
-					JS_SetExecuteHook(m_rt, jshook_script, this);
-					JS_SetCallHook(m_rt, jshook_function, this);
-				}
+				JS_SetExecuteHook(m_rt, jshook_script, this);
+				JS_SetCallHook(m_rt, jshook_function, this);
 			}
 		}
 
@@ -102,20 +106,50 @@ public:
 
 private:
 
+	bool m_ProfileEnabled;
+	bool m_Profile2Enabled;
+
+	// Names of the currently-running profiled scripts/functions, so the
+	// Profiler2 regions can be left with the same name they were entered with
+	std::vector<const char*> m_ProfileStack;
+
+	void ProfileEnter(const char* name)
+	{
+		if (m_ProfileEnabled)
+			g_Profiler.StartScript(name);
+		if (m_Profile2Enabled)
+		{
+			g_Profiler2.RecordRegionEnter(name);
+			m_ProfileStack.push_back(name);
+		}
+	}
+
+	void ProfileLeave()
+	{
+		if (m_ProfileEnabled)
+			g_Profiler.Stop();
+		if (m_Profile2Enabled && !m_ProfileStack.empty())
+		{
+			g_Profiler2.RecordRegionLeave(m_ProfileStack.back());
+			m_ProfileStack.pop_back();
+		}
+	}
 
 	static void* jshook_script(JSContext* UNUSED(cx), JSStackFrame* UNUSED(fp), JSBool before, JSBool* UNUSED(ok), void* closure)
 	{
+		ScriptRuntime* m = static_cast<ScriptRuntime*>(closure);
 		if (before)
-			g_Profiler.StartScript("script invocation");
+			m->ProfileEnter("script invocation");
 		else
-			g_Profiler.Stop();
+			m->ProfileLeave();
 
 		return closure;
 	}
 
 	// To profile scripts usefully, we use a call hook that's called on every enter/exit,
-	// and need to find the function name. But most functions are anonymous so we make do
-	// with filename plus line number instead.
+	// and need to find the function name and location. Most functions are anonymous
+	// (e.g. component methods defined as Foo.prototype.Bar = function() {...}), so
+	// the location is the most useful part.
 	// Computing the names is fairly expensive, and we need to return an interned char*
 	// for the profiler to hold a copy of, so we use boost::flyweight to construct interned
 	// strings per call location.
@@ -127,6 +161,11 @@ private:
 		JSScript* script;
 		jsbytecode* pc;
 
+		// The function being entered at this location. This is only used
+		// when first computing the name (the location always identifies
+		// the same function), so it's not part of the key.
+		JSFunction* fn;
+
 		bool operator==(const ScriptLocation& b) const
 		{
 			return cx == b.cx && script == b.script && pc == b.pc;
@@ -142,7 +181,8 @@ private:
 		}
 	};
 
-	// Computes and stores the name of a location in a script
+	// Computes and stores the name of a location in a script,
+	// as "name (file:line)" or "(file:line)" for anonymous functions
 	struct ScriptLocationName
 	{
 		ScriptLocationName(const ScriptLocation& loc)
@@ -151,66 +191,68 @@ private:
 			JSScript* script = loc.script;
 			jsbytecode* pc = loc.pc;
 
-			std::string filename = JS_GetScriptFilename(cx, script);
-			size_t slash = filename.rfind('/');
-			if (slash != filename.npos)
-				filename = filename.substr(slash+1);
+			std::stringstream ss;
+
+			JSString* id = loc.fn ? JS_GetFunctionId(loc.fn) : NULL;
+			if (id)
+			{
+				char* chars = JS_EncodeString(cx, id);
+				if (chars)
+				{
+					ss << chars << " ";
+					JS_free(cx, chars);
+				}
+			}
+
+			if (script)
+			{
+				std::string filename = JS_GetScriptFilename(cx, script);
+				size_t slash = filename.rfind('/');
+				if (slash != filename.npos)
+					filename = filename.substr(slash+1);
 
-			uintN line = JS_PCToLineNumber(cx, script, pc);
+				uintN line = JS_PCToLineNumber(cx, script, pc);
+
+				ss << "(" << filename << ":" << line << ")";
+			}
+			else
+			{
+				ss << "(native)";
+			}
 
-			std::stringstream ss;
-			ss << "(" << filename << ":" << line << ")";
 			name = ss.str();
 		}
 
 		std::string name;
 	};
 
-	// Flyweight types (with no_locking because the call hooks are only used in the
-	// main thread, and no_tracking because we mustn't delete values the profiler is
-	// using and it's not going to waste much memory)
-	typedef boost::flyweight<
-		std::string,
-		boost::flyweights::no_tracking,
-		boost::flyweights::no_locking
-	> StringFlyweight;
+	// Flyweight type (with no_tracking because we mustn't delete values the profiler is
+	// using and it's not going to waste much memory; and with locking because the
+	// call hooks may be used in several threads when Profiler2 is enabled)
 	typedef boost::flyweight<
 		boost::flyweights::key_value<ScriptLocation, ScriptLocationName>,
-		boost::flyweights::no_tracking,
-		boost::flyweights::no_locking
+		boost::flyweights::no_tracking
 	> LocFlyweight;
 
 	static void* jshook_function(JSContext* cx, JSStackFrame* fp, JSBool before, JSBool* UNUSED(ok), void* closure)
 	{
+		ScriptRuntime* m = static_cast<ScriptRuntime*>(closure);
+
 		if (!before)
 		{
-			g_Profiler.Stop();
+			m->ProfileLeave();
 			return closure;
 		}
 
 		JSFunction* fn = JS_GetFrameFunction(cx, fp);
 		if (!fn)
 		{
-			g_Profiler.StartScript("(function)");
+			m->ProfileEnter("(function)");
 			return closure;
 		}
 
-		// Try to get the name of non-anonymous functions
-		JSString* name = JS_GetFunctionId(fn);
-		if (name)
-		{
-			char* chars = JS_EncodeString(cx, name);
-			if (chars)
-			{
-				g_Profiler.StartScript(StringFlyweight(chars).get().c_str());
-				JS_free(cx, chars);
-				return closure;
-			}
-		}
-
-		// No name - compute from the location instead
-		ScriptLocation loc = { cx, JS_GetFrameScript(cx, fp), JS_GetFramePC(cx, fp) };
-		g_Profiler.StartScript(LocFlyweight(loc).get().name.c_str());
+		ScriptLocation loc = { cx, JS_GetFrameScript(cx, fp), JS_GetFramePC(cx, fp), fn };
+		m->ProfileEnter(LocFlyweight(loc).get().name.c_str());
 
 		return closure;
 	}
@@ -231,6 +231,11 @@ public:
 	{
 	}
 
+	virtual CMessage* Clone() const
+	{
+		return new CMessageOwnershipChanged(entity, from, to);
+	}
+
 	entity_id_t entity;
 	player_id_t from;
 	player_id_t to;
@@ -252,6 +257,11 @@ public:
 	{
 	}
 
+	virtual CMessage* Clone() const
+	{
+		return new CMessagePositionChanged(entity, inWorld, x, z, a);
+	}
+
 	entity_id_t entity;
 	bool inWorld;
 	entity_pos_t x, z;
@@ -289,6 +299,11 @@ public:
 	{
 	}
 
+	virtual CMessage* Clone() const
+	{
+		return new CMessageTerrainChanged(i0, j0, i1, j1);
+	}
+
 	int32_t i0, j0, i1, j1; // inclusive lower bound, exclusive upper bound, in tiles
 };
 
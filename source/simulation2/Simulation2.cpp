@@ -37,6 +37,7 @@
 #include "ps/Filesystem.h"
 #include "ps/Loader.h"
 #include "ps/Profile.h"
+#include "ps/ProfileViewer.h"
 #include "ps/Pyrogenesis.h"
 #include "ps/XML/Xeromyces.h"
 
@@ -56,12 +57,86 @@ static std::string Hexify(const std::string& s) // TODO: shouldn't duplicate thi
 	return str.str();
 }
 
+/**
+ * Profiler table showing the time spent in each component type's handlers
+ * for each message type, when the "profilemessages" config option is enabled.
+ */
+class CMessageHandlerStatsTable : public AbstractProfileTable
+{
+	NONCOPYABLE(CMessageHandlerStatsTable);
+public:
+	CMessageHandlerStatsTable(const CComponentManager& componentManager) :
+		m_ComponentManager(componentManager)
+	{
+		m_ColumnDescriptions.push_back(ProfileColumn("Name", 300));
+		m_ColumnDescriptions.push_back(ProfileColumn("calls", 80));
+		m_ColumnDescriptions.push_back(ProfileColumn("self msec", 100));
+		m_ColumnDescriptions.push_back(ProfileColumn("total msec", 100));
+	}
+
+	CStr GetName()
+	{
+		return "simmessages";
+	}
+
+	CStr GetTitle()
+	{
+		return "Simulation message handlers";
+	}
+
+	size_t GetNumberRows()
+	{
+		// This is called first whenever the table is displayed, so update the data now
+		m_Stats = m_ComponentManager.GetMessageHandlerStats();
+		return m_Stats.size();
+	}
+
+	const std::vector<ProfileColumn>& GetColumns()
+	{
+		return m_ColumnDescriptions;
+	}
+
+	CStr GetCellText(size_t row, size_t col)
+	{
+		if (row >= m_Stats.size())
+			return "???";
+
+		const CComponentManager::MessageHandlerStats& stats = m_Stats[row];
+		char buf[256];
+		switch (col)
+		{
+		case 0:
+			return stats.componentName + " " + stats.messageName;
+		case 1:
+			return CStr::FromUInt(stats.calls);
+		case 2:
+			sprintf_s(buf, sizeof(buf), "%.3f", stats.selfTime * 1000.0);
+			return buf;
+		case 3:
+			sprintf_s(buf, sizeof(buf), "%.3f", stats.totalTime * 1000.0);
+			return buf;
+		default:
+			return "???";
+		}
+	}
+
+	AbstractProfileTable* GetChild(size_t UNUSED(row))
+	{
+		return 0;
+	}
+
+private:
+	const CComponentManager& m_ComponentManager;
+	std::vector<ProfileColumn> m_ColumnDescriptions;
+	std::vector<CComponentManager::MessageHandlerStats> m_Stats;
+};
+
 class CSimulation2Impl
 {
 public:
 	CSimulation2Impl(CUnitManager* unitManager, CTerrain* terrain) :
 		m_SimContext(), m_ComponentManager(m_SimContext),
-		m_EnableOOSLog(false), m_EnableSerializationTest(false)
+		m_EnableOOSLog(false), m_MessageHandlerStatsTable(NULL), m_EnableSerializationTest(false)
 	{
 		m_SimContext.m_UnitManager = unitManager;
 		m_SimContext.m_Terrain = terrain;
@@ -74,11 +149,25 @@ public:
 		{
 			CFG_GET_VAL("ooslog", Bool, m_EnableOOSLog);
 			CFG_GET_VAL("serializationtest", Bool, m_EnableSerializationTest);
+
+			bool profileMessages = false;
+			CFG_GET_VAL("profilemessages", Bool, profileMessages);
+			if (profileMessages)
+			{
+				m_ComponentManager.SetProfileMessageHandlers(true);
+				if (CProfileViewer::IsInitialised())
+				{
+					m_MessageHandlerStatsTable = new CMessageHandlerStatsTable(m_ComponentManager);
+					g_ProfileViewer.AddRootTable(m_MessageHandlerStatsTable);
+				}
+			}
 		}
 	}
 
 	~CSimulation2Impl()
 	{
+		delete m_MessageHandlerStatsTable;
+
 		UnregisterFileReloadFunc(ReloadChangedFileCB, this);
 	}
 
@@ -109,6 +198,8 @@ public:
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_SoundManager, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_Terrain, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_TerritoryManager, noParam);
+		componentManager.AddComponent(SYSTEM_ENTITY, CID_UnitMotionManager, noParam);
+		componentManager.AddComponent(SYSTEM_ENTITY, CID_UnitRenderer, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_WaterManager, noParam);
 
 		// Add scripted system components:
@@ -171,6 +262,8 @@ public:
 
 	bool m_EnableOOSLog;
 
+	CMessageHandlerStatsTable* m_MessageHandlerStatsTable;
+
 
 	// Functions and data for the serialization test mode: (see Update() for relevant comments)
 
@@ -471,6 +564,7 @@ void CSimulation2Impl::UpdateComponents(CSimContext& simContext, fixed turnLengt
 
 	CMessageTurnStart msgTurnStart;
 	componentManager.BroadcastMessage(msgTurnStart);
+	componentManager.FlushDeferredMessages();
 
 	CmpPtr<ICmpPathfinder> cmpPathfinder(simContext, SYSTEM_ENTITY);
 	if (cmpPathfinder)
@@ -484,19 +578,22 @@ void CSimulation2Impl::UpdateComponents(CSimContext& simContext, fixed turnLengt
 	CmpPtr<ICmpCommandQueue> cmpCommandQueue(simContext, SYSTEM_ENTITY);
 	if (cmpCommandQueue)
 		cmpCommandQueue->FlushTurn(commands);
+	componentManager.FlushDeferredMessages();
 
 	// Process newly generated move commands so the UI feels snappy
 	if (cmpPathfinder)
 		cmpPathfinder->ProcessSameTurnMoves();
 
-	// Send all the update phases
+	// Send all the update phases, delivering the deferred messages after each one
 	{
 		CMessageUpdate msgUpdate(turnLengthFixed);
 		componentManager.BroadcastMessage(msgUpdate);
+		componentManager.FlushDeferredMessages();
 	}
 	{
 		CMessageUpdate_MotionFormation msgUpdate(turnLengthFixed);
 		componentManager.BroadcastMessage(msgUpdate);
+		componentManager.FlushDeferredMessages();
 	}
 
 	// Process move commands for formations (group proxy)
@@ -506,10 +603,12 @@ void CSimulation2Impl::UpdateComponents(CSimContext& simContext, fixed turnLengt
 	{
 		CMessageUpdate_MotionUnit msgUpdate(turnLengthFixed);
 		componentManager.BroadcastMessage(msgUpdate);
+		componentManager.FlushDeferredMessages();
 	}
 	{
 		CMessageUpdate_Final msgUpdate(turnLengthFixed);
 		componentManager.BroadcastMessage(msgUpdate);
+		componentManager.FlushDeferredMessages();
 	}
 
 	// Process moves resulting from group proxy movement (unit needs to catch up or realign) and any others
@@ -518,6 +617,7 @@ void CSimulation2Impl::UpdateComponents(CSimContext& simContext, fixed turnLengt
 
 	// Clean up any entities destroyed during the simulation update
 	componentManager.FlushDestroyedComponents();
+	componentManager.FlushDeferredMessages();
 }
 
 void CSimulation2Impl::Interpolate(float simFrameLength, float frameOffset, float realFrameLength)
@@ -757,9 +857,9 @@ void CSimulation2::ResetState(bool skipScriptedComponents, bool skipAI)
 	m->ResetState(skipScriptedComponents, skipAI);
 }
 
-bool CSimulation2::ComputeStateHash(std::string& outHash, bool quick)
+bool CSimulation2::ComputeStateHash(std::string& outHash, bool quick, bool md5)
 {
-	return m->m_ComponentManager.ComputeStateHash(outHash, quick);
+	return m->m_ComponentManager.ComputeStateHash(outHash, quick, md5);
 }
 
 bool CSimulation2::DumpDebugState(std::ostream& stream)
@@ -778,6 +878,17 @@ bool CSimulation2::DeserializeState(std::istream& stream)
 	return m->m_ComponentManager.DeserializeState(stream);
 }
 
+bool CSimulation2::SerializeState(std::string& outState)
+{
+	return m->m_ComponentManager.SerializeState(outState);
+}
+
+bool CSimulation2::DeserializeState(const u8* data, size_t len)
+{
+	// TODO: need to make sure the required SYSTEM_ENTITY components get constructed
+	return m->m_ComponentManager.DeserializeState(data, len);
+}
+
 std::string CSimulation2::GenerateSchema()
 {
 	return m->m_ComponentManager.GenerateSchema();
@@ -209,11 +209,21 @@ public:
 	const CSimContext& GetSimContext() const;
 	ScriptInterface& GetScriptInterface() const;
 
-	bool ComputeStateHash(std::string& outHash, bool quick);
+	/**
+	 * Computes a hash of the simulation state (see CComponentManager::ComputeStateHash).
+	 */
+	bool ComputeStateHash(std::string& outHash, bool quick, bool md5 = false);
 	bool DumpDebugState(std::ostream& stream);
 	bool SerializeState(std::ostream& stream);
 	bool DeserializeState(std::istream& stream);
 
+	/**
+	 * In-memory versions of SerializeState/DeserializeState, which are faster than using
+	 * stringstreams (see CComponentManager::SerializeState).
+	 */
+	bool SerializeState(std::string& outState);
+	bool DeserializeState(const u8* data, size_t len);
+
 	std::string GenerateSchema();
 
 	/////////////////////////////////////////////////////////////////////////////
@@ -153,10 +153,16 @@ COMPONENT(TerritoryInfluence)
 INTERFACE(TerritoryManager)
 COMPONENT(TerritoryManager)
 
+INTERFACE(UnitMotionManager)
+COMPONENT(UnitMotionManager) // must be before UnitMotion (which registers with it in Deserialize)
+
 INTERFACE(UnitMotion)
 COMPONENT(UnitMotion) // must be after Obstruction
 COMPONENT(UnitMotionScripted)
 
+INTERFACE(UnitRenderer)
+COMPONENT(UnitRenderer) // must be before VisualActor (which registers with it in Init)
+
 INTERFACE(Vision)
 COMPONENT(Vision)
 
@@ -23,11 +23,14 @@
 #include "simulation2/MessageTypes.h"
 
 #include "graphics/Terrain.h"
+#include "lib/external_libraries/libsdl.h"
 #include "lib/timer.h"
 #include "lib/tex/tex.h"
 #include "lib/allocators/shared_ptr.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/Profiler2.h"
+#include "ps/ThreadUtil.h"
 #include "ps/Util.h"
 #include "simulation2/components/ICmpAIInterface.h"
 #include "simulation2/components/ICmpCommandQueue.h"
@@ -42,6 +45,11 @@
 #include "simulation2/serialization/StdSerializer.h"
 #include "simulation2/serialization/SerializeTemplates.h"
 
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+
+#include <deque>
+
 /**
  * @file
  * Player AI interface.
@@ -62,9 +70,9 @@
  *
  * JS values are passed between the game and AI threads using ScriptInterface::StructuredClone.
  *
- * TODO: actually the thread isn't implemented yet, because performance hasn't been
- * sufficiently problematic to justify the complexity yet, but the CAIWorker interface
- * is designed to hopefully support threading when we want it.
+ * The thread itself is managed by CAIWorkerThread, which owns the CAIWorker and
+ * forwards every call from CCmpAIManager to it as a queued task. Each AI player
+ * has its own worker thread and runtime, so multiple AIs run in parallel.
  */
 
 /**
@@ -342,6 +350,7 @@ public:
 		m_GameState.reset();
 		m_PassabilityMapVal = CScriptValRooted();
 		m_TerritoryMapVal = CScriptValRooted();
+		m_PassabilityClassesVal = CScriptValRooted();
 	}
 
 	// This is called by AIs if they use the v3 API.
@@ -538,8 +547,7 @@ public:
 		m_TerritoryMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, territoryMap));
 		if (m_HasSharedComponent)
 		{
-			m_ScriptInterface.SetProperty(state.get(), "passabilityMap", m_PassabilityMapVal, true);
-			m_ScriptInterface.SetProperty(state.get(), "territoryMap", m_TerritoryMapVal, true);
+			AddPersistentState(state);
 
 			m_ScriptInterface.CallFunctionVoid(m_SharedAIObj.get(), "initWithState", state);
 			m_ScriptInterface.MaybeGC();
@@ -553,31 +561,46 @@ public:
 		
 		return true;
 	}
-	void StartComputation(const shared_ptr<ScriptInterface::StructuredClone>& gameState, const Grid<u16>& passabilityMap, const Grid<u8>& territoryMap, bool territoryMapDirty)
+	/**
+	 * Set up the state for the next computation. The grids may be NULL if they
+	 * are unchanged since the previous turn, to avoid copying and converting
+	 * them every turn.
+	 */
+	void StartComputation(const shared_ptr<ScriptInterface::StructuredClone>& gameState, const shared_ptr<Grid<u16> >& passabilityMap, const shared_ptr<Grid<u8> >& territoryMap)
 	{
 		ENSURE(m_CommandsComputed);
 
 		m_GameState = gameState;
 
-		if (passabilityMap.m_DirtyID != m_PassabilityMap.m_DirtyID)
+		if (passabilityMap)
 		{
 			m_PassabilityMap = passabilityMap;
 
 			JSContext* cx = m_ScriptInterface.GetContext();
-			m_PassabilityMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, m_PassabilityMap));
+			m_PassabilityMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, *m_PassabilityMap));
 		}
 
-		if (territoryMapDirty)
+		if (territoryMap)
 		{
 			m_TerritoryMap = territoryMap;
 
 			JSContext* cx = m_ScriptInterface.GetContext();
-			m_TerritoryMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, m_TerritoryMap));
+			m_TerritoryMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, *m_TerritoryMap));
 		}
 
 		m_CommandsComputed = false;
 	}
 
+	/**
+	 * Set the passability class table. This is constant for the whole game, so
+	 * it's sent once and kept by the worker instead of being cloned every turn.
+	 */
+	void SetPassabilityClasses(const shared_ptr<ScriptInterface::StructuredClone>& classes)
+	{
+		JSContext* cx = m_ScriptInterface.GetContext();
+		m_PassabilityClassesVal = CScriptValRooted(cx, m_ScriptInterface.ReadStructuredClone(classes));
+	}
+
 	void WaitToFinishComputation()
 	{
 		if (!m_CommandsComputed)
@@ -605,17 +628,16 @@ public:
 		m_TechTemplates = CScriptValRooted(cx, m_ScriptInterface.ReadStructuredClone(techTemplates));
 	}
 	
-	void LoadEntityTemplates(const std::vector<std::pair<std::string, const CParamNode*> >& templates)
+	/**
+	 * Load the entity templates from a clone prepared by CCmpAIManager, so
+	 * the CParamNode conversion is only done once and shared by all workers.
+	 */
+	void LoadEntityTemplates(const shared_ptr<ScriptInterface::StructuredClone>& templates)
 	{
 		m_HasLoadedEntityTemplates = true;
 
-		m_ScriptInterface.Eval("({})", m_EntityTemplates);
-
-		for (size_t i = 0; i < templates.size(); ++i)
-		{
-			jsval val = templates[i].second->ToJSVal(m_ScriptInterface.GetContext(), false);
-			m_ScriptInterface.SetProperty(m_EntityTemplates.get(), templates[i].first.c_str(), CScriptVal(val), true);
-		}
+		JSContext* cx = m_ScriptInterface.GetContext();
+		m_EntityTemplates = CScriptValRooted(cx, m_ScriptInterface.ReadStructuredClone(templates));
 
 		// Since the template data is shared between AI players, freeze it
 		// to stop any of them changing it and confusing the other players
@@ -783,6 +805,18 @@ public:
 	}
 
 private:
+	/**
+	 * Attach the data that the worker keeps between turns (only sent when it
+	 * changes) to the per-turn state received from the simulation.
+	 */
+	void AddPersistentState(CScriptVal state)
+	{
+		m_ScriptInterface.SetProperty(state.get(), "passabilityMap", m_PassabilityMapVal, true);
+		m_ScriptInterface.SetProperty(state.get(), "territoryMap", m_TerritoryMapVal, true);
+		if (!m_PassabilityClassesVal.uninitialised())
+			m_ScriptInterface.SetProperty(state.get(), "passabilityClasses", m_PassabilityClassesVal, true);
+	}
+
 	CScriptValRooted LoadMetadata(const VfsPath& path)
 	{
 		if (m_PlayerMetadata.find(path) == m_PlayerMetadata.end())
@@ -814,8 +848,7 @@ private:
 		{
 			PROFILE3("AI compute read state");
 			state = m_ScriptInterface.ReadStructuredClone(m_GameState);
-			m_ScriptInterface.SetProperty(state.get(), "passabilityMap", m_PassabilityMapVal, true);
-			m_ScriptInterface.SetProperty(state.get(), "territoryMap", m_TerritoryMapVal, true);
+			AddPersistentState(state);
 		}
 
 		// It would be nice to do
@@ -877,10 +910,11 @@ private:
 	std::vector<SCommandSets> m_Commands;
 	
 	shared_ptr<ScriptInterface::StructuredClone> m_GameState;
-	Grid<u16> m_PassabilityMap;
+	shared_ptr<Grid<u16> > m_PassabilityMap;
 	CScriptValRooted m_PassabilityMapVal;
-	Grid<u8> m_TerritoryMap;
+	shared_ptr<Grid<u8> > m_TerritoryMap;
 	CScriptValRooted m_TerritoryMapVal;
+	CScriptValRooted m_PassabilityClassesVal;
 
 	bool m_CommandsComputed;
 
@@ -889,8 +923,263 @@ private:
 };
 
 
+/**
+ * Runs a CAIWorker in its own thread.
+ *
+ * A ScriptRuntime must only be used on a single thread, so the CAIWorker (and
+ * every ScriptInterface it creates) is constructed, used and destroyed entirely
+ * by the worker thread. The main thread communicates with it by queueing tasks:
+ * StartComputation returns immediately (so the AI scripts run in parallel with
+ * the rest of the engine), and every other call blocks until all previously
+ * queued tasks (including any pending computation) have completed.
+ *
+ * Since tasks are executed strictly in order and the AI state only depends on
+ * the data passed in, the results are the same as when running synchronously.
+ */
+class CAIWorkerThread
+{
+	NONCOPYABLE(CAIWorkerThread);
+
+	typedef boost::function<void (CAIWorker&)> Task;
+
+public:
+	CAIWorkerThread() :
+		m_Shutdown(false), m_Error(PSRETURN_OK), m_NumPlayers(0)
+	{
+		// Use SDL semaphores since OS X doesn't implement sem_init
+		m_WorkerSem = SDL_CreateSemaphore(0);
+		ENSURE(m_WorkerSem);
+		m_DoneSem = SDL_CreateSemaphore(0);
+		ENSURE(m_DoneSem);
+
+		int ret = pthread_create(&m_WorkerThread, NULL, &RunThread, this);
+		ENSURE(ret == 0);
+	}
+
+	~CAIWorkerThread()
+	{
+		// Tell the thread to shut down once it has processed the remaining tasks
+		{
+			CScopeLock lock(m_WorkerMutex);
+			m_Shutdown = true;
+		}
+
+		// Wake it up so it sees the notification
+		SDL_SemPost(m_WorkerSem);
+
+		// Wait for it to shut down cleanly
+		pthread_join(m_WorkerThread, NULL);
+
+		SDL_DestroySemaphore(m_WorkerSem);
+		SDL_DestroySemaphore(m_DoneSem);
+	}
+
+	bool AddPlayer(const std::wstring& aiName, player_id_t player, uint8_t difficulty, bool callConstructor)
+	{
+		bool ok = false;
+		Call(boost::bind(&CAIWorkerThread::AddPlayerTask, _1, boost::ref(ok), aiName, player, difficulty, callConstructor));
+		if (ok)
+			++m_NumPlayers;
+		return ok;
+	}
+
+	bool TryLoadSharedComponent(bool hasTechs)
+	{
+		bool ok = false;
+		Call(boost::bind(&CAIWorkerThread::TryLoadSharedComponentTask, _1, boost::ref(ok), hasTechs));
+		return ok;
+	}
+
+	void RunGamestateInit(const shared_ptr<ScriptInterface::StructuredClone>& gameState, const Grid<u16>& passabilityMap, const Grid<u8>& territoryMap)
+	{
+		Call(boost::bind(&CAIWorker::RunGamestateInit, _1, gameState, boost::cref(passabilityMap), boost::cref(territoryMap)));
+	}
+
+	/**
+	 * Queue a computation of the AI scripts, and return without waiting for it.
+	 * The grids may be NULL if unchanged since the last computation. They
+	 * are only read by the worker, so they can be shared between workers.
+	 */
+	void StartComputation(const shared_ptr<ScriptInterface::StructuredClone>& gameState, const shared_ptr<Grid<u16> >& passabilityMap, const shared_ptr<Grid<u8> >& territoryMap)
+	{
+		Post(boost::bind(&CAIWorkerThread::ComputeTask, _1, gameState, passabilityMap, territoryMap));
+	}
+
+	void SetPassabilityClasses(const shared_ptr<ScriptInterface::StructuredClone>& classes)
+	{
+		// Tasks are run in order, so there's no need to wait for this one
+		Post(boost::bind(&CAIWorker::SetPassabilityClasses, _1, classes));
+	}
+
+	void GetCommands(std::vector<CAIWorker::SCommandSets>& commands)
+	{
+		Call(boost::bind(&CAIWorker::GetCommands, _1, boost::ref(commands)));
+	}
+
+	void RegisterTechTemplates(const shared_ptr<ScriptInterface::StructuredClone>& techTemplates)
+	{
+		Call(boost::bind(&CAIWorker::RegisterTechTemplates, _1, techTemplates));
+	}
+
+	void LoadEntityTemplates(const shared_ptr<ScriptInterface::StructuredClone>& templates)
+	{
+		Call(boost::bind(&CAIWorker::LoadEntityTemplates, _1, templates));
+	}
+
+	void Serialize(std::ostream& stream, bool isDebug)
+	{
+		Call(boost::bind(&CAIWorker::Serialize, _1, boost::ref(stream), isDebug));
+	}
+
+	void Deserialize(std::istream& stream)
+	{
+		Call(boost::bind(&CAIWorker::Deserialize, _1, boost::ref(stream)));
+		Call(boost::bind(&CAIWorkerThread::GetPlayerSizeTask, _1, boost::ref(m_NumPlayers)));
+	}
+
+	int getPlayerSize()
+	{
+		// Tracked on this thread, so we don't have to wait for the worker
+		return m_NumPlayers;
+	}
+
+private:
+	static void AddPlayerTask(CAIWorker& worker, bool& ok, const std::wstring& aiName, player_id_t player, uint8_t difficulty, bool callConstructor)
+	{
+		ok = worker.AddPlayer(aiName, player, difficulty, callConstructor);
+	}
+
+	static void TryLoadSharedComponentTask(CAIWorker& worker, bool& ok, bool hasTechs)
+	{
+		ok = worker.TryLoadSharedComponent(hasTechs);
+	}
+
+	static void ComputeTask(CAIWorker& worker, const shared_ptr<ScriptInterface::StructuredClone>& gameState, const shared_ptr<Grid<u16> >& passabilityMap, const shared_ptr<Grid<u8> >& territoryMap)
+	{
+		worker.StartComputation(gameState, passabilityMap, territoryMap);
+		worker.WaitToFinishComputation();
+	}
+
+	static void GetPlayerSizeTask(CAIWorker& worker, int& numPlayers)
+	{
+		numPlayers = worker.getPlayerSize();
+	}
+
+	/**
+	 * Queue a task for the worker thread, without waiting for it.
+	 */
+	void Post(const Task& task)
+	{
+		{
+			CScopeLock lock(m_WorkerMutex);
+			m_Tasks.push_back(std::make_pair(task, false));
+		}
+		SDL_SemPost(m_WorkerSem);
+	}
+
+	/**
+	 * Queue a task for the worker thread and wait until it has completed.
+	 * Deserialization errors raised by the task are rethrown on this thread.
+	 */
+	void Call(const Task& task)
+	{
+		{
+			CScopeLock lock(m_WorkerMutex);
+			m_Tasks.push_back(std::make_pair(task, true));
+		}
+		SDL_SemPost(m_WorkerSem);
+
+		SDL_SemWait(m_DoneSem);
+
+		PSRETURN error;
+		{
+			CScopeLock lock(m_WorkerMutex);
+			error = m_Error;
+			m_Error = PSRETURN_OK;
+		}
+		if (error != PSRETURN_OK)
+			ThrowError(error);
+	}
+
+	static void* RunThread(void* data)
+	{
+		debug_SetThreadName("AIWorker");
+		g_Profiler2.RegisterCurrentThread("AI");
+
+		static_cast<CAIWorkerThread*>(data)->Run();
+
+		return NULL;
+	}
+
+	void Run()
+	{
+		CAIWorker* worker = new CAIWorker();
+
+		// Process tasks until we're told to shut down
+		while (SDL_SemWait(m_WorkerSem) == 0)
+		{
+			std::pair<Task, bool> task;
+			{
+				CScopeLock lock(m_WorkerMutex);
+				if (m_Tasks.empty())
+				{
+					if (m_Shutdown)
+						break;
+					continue;
+				}
+				task = m_Tasks.front();
+				m_Tasks.pop_front();
+			}
+
+			PSRETURN error = PSRETURN_OK;
+			try
+			{
+				task.first(*worker);
+			}
+			catch (PSERROR& e)
+			{
+				error = e.getCode();
+			}
+
+			if (task.second)
+			{
+				{
+					CScopeLock lock(m_WorkerMutex);
+					m_Error = error;
+				}
+				SDL_SemPost(m_DoneSem);
+			}
+			else if (error != PSRETURN_OK)
+			{
+				LOGERROR(L"AI worker task failed with error %u", error);
+			}
+		}
+
+		delete worker;
+	}
+
+	pthread_t m_WorkerThread;
+	CMutex m_WorkerMutex;
+	SDL_sem* m_WorkerSem;
+	SDL_sem* m_DoneSem;
+
+	// Protected by m_WorkerMutex:
+	std::deque<std::pair<Task, bool> > m_Tasks;
+	bool m_Shutdown;
+	PSRETURN m_Error;
+
+	// Only accessed by the main thread:
+	int m_NumPlayers;
+};
+
+
 /**
  * Implementation of ICmpAIManager.
+ *
+ * Each AI player gets its own CAIWorkerThread (and therefore its own script
+ * runtime and shared component), so several AIs compute in parallel. Data that
+ * is common to all of them (entity and tech templates, the game state and grids)
+ * is converted once on the main thread and handed to every worker read-only.
  */
 class CCmpAIManager : public ICmpAIManager
 {
@@ -910,22 +1199,28 @@ public:
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
 		m_TerritoriesDirtyID = 0;
+		m_PassabilityMapDirtyID = 0;
+		m_ResendMaps = false;
+		m_PassabilityClasses.reset();
 
 		StartLoadEntityTemplates();
 	}
 
 	virtual void Deinit()
 	{
+		m_Workers.clear();
 	}
 
 	virtual void Serialize(ISerializer& serialize)
 	{
-		// Because the AI worker uses its own ScriptInterface, we can't use the
+		// Because the AI workers use their own ScriptInterfaces, we can't use the
 		// ISerializer (which was initialised with the simulation ScriptInterface)
 		// directly. So we'll just grab the ISerializer's stream and write to it
-		// with an independent serializer.
+		// with an independent serializer per worker.
 
-		m_Worker.Serialize(serialize.GetStream(), serialize.IsDebug());
+		serialize.NumberU32_Unbounded("num workers", (u32)m_Workers.size());
+		for (size_t i = 0; i < m_Workers.size(); ++i)
+			m_Workers[i]->Serialize(serialize.GetStream(), serialize.IsDebug());
 	}
 
 	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& deserialize)
@@ -934,7 +1229,13 @@ public:
 
 		ForceLoadEntityTemplates();
 
-		m_Worker.Deserialize(deserialize.GetStream());
+		u32 numWorkers;
+		deserialize.NumberU32_Unbounded("num workers", numWorkers);
+		for (u32 i = 0; i < numWorkers; ++i)
+		{
+			shared_ptr<CAIWorkerThread> worker = CreateWorker();
+			worker->Deserialize(deserialize.GetStream());
+		}
 	}
 
 	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
@@ -962,7 +1263,11 @@ public:
 
 	virtual void AddPlayer(std::wstring id, player_id_t player, uint8_t difficulty)
 	{
-		m_Worker.AddPlayer(id, player, difficulty, true);
+		ForceLoadEntityTemplates();
+
+		shared_ptr<CAIWorkerThread> worker = CreateWorker();
+		if (!worker->AddPlayer(id, player, difficulty, true))
+			m_Workers.pop_back();
 
 		// AI players can cheat and see through FoW/SoD, since that greatly simplifies
 		// their implementation.
@@ -982,8 +1287,12 @@ public:
 		// Get the game state from AIInterface
 		CScriptVal techTemplates = cmpTechTemplateManager->GetAllTechs();
 		
-		m_Worker.RegisterTechTemplates(scriptInterface.WriteStructuredClone(techTemplates.get()));
-		m_Worker.TryLoadSharedComponent(true);
+		shared_ptr<ScriptInterface::StructuredClone> techTemplatesClone = scriptInterface.WriteStructuredClone(techTemplates.get());
+		for (size_t i = 0; i < m_Workers.size(); ++i)
+		{
+			m_Workers[i]->RegisterTechTemplates(techTemplatesClone);
+			m_Workers[i]->TryLoadSharedComponent(true);
+		}
 	}
 
 	virtual void RunGamestateInit()
@@ -1013,9 +1322,11 @@ public:
 			territoryMap = &cmpTerritoryManager->GetTerritoryGrid();
 		}
 		
-		LoadPathfinderClasses(state);
+		SendPassabilityClasses();
 
-		m_Worker.RunGamestateInit(scriptInterface.WriteStructuredClone(state.get()), *passabilityMap, *territoryMap);
+		shared_ptr<ScriptInterface::StructuredClone> stateClone = scriptInterface.WriteStructuredClone(state.get());
+		for (size_t i = 0; i < m_Workers.size(); ++i)
+			m_Workers[i]->RunGamestateInit(stateClone, *passabilityMap, *territoryMap);
 	}
 
 	virtual void StartComputation()
@@ -1026,56 +1337,81 @@ public:
 
 		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
 
-		if (m_Worker.getPlayerSize() == 0)
+		if (m_Workers.empty())
 			return;
 		
 		CmpPtr<ICmpAIInterface> cmpAIInterface(GetSimContext(), SYSTEM_ENTITY);
 		ENSURE(cmpAIInterface);
 
-		// Get the game state from AIInterface
+		// Get the game state from AIInterface. This only contains the entities
+		// that AIProxy has recorded as changed since the last turn (the full
+		// representation is only used by RunGamestateInit); the persistent parts
+		// of the state (grids, passability classes) are kept by the workers and
+		// only resent when they change.
 		CScriptVal state = cmpAIInterface->GetRepresentation();
 
-		// Get the passability data
-		Grid<u16> dummyGrid;
-		const Grid<u16>* passabilityMap = &dummyGrid;
+		// Get the passability data, and copy it for the workers if it has changed
+		// (or if a newly-added worker hasn't received it yet)
+		shared_ptr<Grid<u16> > passabilityMap;
 		CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
 		if (cmpPathfinder)
-			passabilityMap = &cmpPathfinder->GetPassabilityGrid();
+		{
+			const Grid<u16>& grid = cmpPathfinder->GetPassabilityGrid();
+			if (m_ResendMaps || grid.m_DirtyID != m_PassabilityMapDirtyID)
+			{
+				passabilityMap.reset(new Grid<u16>(grid));
+				m_PassabilityMapDirtyID = grid.m_DirtyID;
+			}
+		}
+		else if (m_ResendMaps)
+		{
+			passabilityMap.reset(new Grid<u16>());
+		}
 
 		// Get the territory data
 		//	Since getting the territory grid can trigger a recalculation, we check NeedUpdate first
-		bool territoryMapDirty = false;
-		Grid<u8> dummyGrid2;
-		const Grid<u8>* territoryMap = &dummyGrid2;
+		shared_ptr<Grid<u8> > territoryMap;
 		CmpPtr<ICmpTerritoryManager> cmpTerritoryManager(GetSimContext(), SYSTEM_ENTITY);
-		if (cmpTerritoryManager && cmpTerritoryManager->NeedUpdate(&m_TerritoriesDirtyID))
-		{
-			territoryMap = &cmpTerritoryManager->GetTerritoryGrid();
-			territoryMapDirty = true;
-		}
+		if (cmpTerritoryManager && (cmpTerritoryManager->NeedUpdate(&m_TerritoriesDirtyID) || m_ResendMaps))
+			territoryMap.reset(new Grid<u8>(cmpTerritoryManager->GetTerritoryGrid()));
+		else if (m_ResendMaps)
+			territoryMap.reset(new Grid<u8>());
 
-		LoadPathfinderClasses(state);
+		if (m_ResendMaps)
+			SendPassabilityClasses();
 
-		m_Worker.StartComputation(scriptInterface.WriteStructuredClone(state.get()), *passabilityMap, *territoryMap, territoryMapDirty);
+		m_ResendMaps = false;
+
+		// Every worker reads the same clone, so we only need to write it once
+		shared_ptr<ScriptInterface::StructuredClone> stateClone = scriptInterface.WriteStructuredClone(state.get());
+		for (size_t i = 0; i < m_Workers.size(); ++i)
+			m_Workers[i]->StartComputation(stateClone, passabilityMap, territoryMap);
 	}
 
 	virtual void PushCommands()
 	{
 		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
 
-		std::vector<CAIWorker::SCommandSets> commands;
-		m_Worker.GetCommands(commands);
-
 		CmpPtr<ICmpCommandQueue> cmpCommandQueue(GetSimContext(), SYSTEM_ENTITY);
-		if (!cmpCommandQueue)
-			return;
 
-		for (size_t i = 0; i < commands.size(); ++i)
+		// Collect commands in worker order (i.e. the order players were added),
+		// so the command queue is the same on every machine regardless of which
+		// worker finishes first
+		std::vector<CAIWorker::SCommandSets> commands;
+		for (size_t w = 0; w < m_Workers.size(); ++w)
 		{
-			for (size_t j = 0; j < commands[i].commands.size(); ++j)
+			m_Workers[w]->GetCommands(commands);
+
+			if (!cmpCommandQueue)
+				continue;
+
+			for (size_t i = 0; i < commands.size(); ++i)
 			{
-				cmpCommandQueue->PushLocalCommand(commands[i].player,
-					scriptInterface.ReadStructuredClone(commands[i].commands[j]));
+				for (size_t j = 0; j < commands[i].commands.size(); ++j)
+				{
+					cmpCommandQueue->PushLocalCommand(commands[i].player,
+						scriptInterface.ReadStructuredClone(commands[i].commands[j]));
+				}
 			}
 		}
 	}
@@ -1084,7 +1420,24 @@ private:
 	std::vector<std::string> m_TemplateNames;
 	size_t m_TemplateLoadedIdx;
 	std::vector<std::pair<std::string, const CParamNode*> > m_Templates;
+	shared_ptr<ScriptInterface::StructuredClone> m_EntityTemplates;
 	size_t m_TerritoriesDirtyID;
+	size_t m_PassabilityMapDirtyID;
+	bool m_ResendMaps;
+	shared_ptr<ScriptInterface::StructuredClone> m_PassabilityClasses;
+
+	shared_ptr<CAIWorkerThread> CreateWorker()
+	{
+		shared_ptr<CAIWorkerThread> worker(new CAIWorkerThread());
+		if (m_EntityTemplates)
+			worker->LoadEntityTemplates(m_EntityTemplates);
+		m_Workers.push_back(worker);
+
+		// The new worker hasn't seen any of the grids yet
+		m_ResendMaps = true;
+
+		return worker;
+	}
 
 	void StartLoadEntityTemplates()
 	{
@@ -1094,6 +1447,7 @@ private:
 		m_TemplateNames = cmpTemplateManager->FindAllTemplates(false);
 		m_TemplateLoadedIdx = 0;
 		m_Templates.reserve(m_TemplateNames.size());
+		m_EntityTemplates.reset();
 	}
 
 	// Tries to load the next entity template. Returns true if we did some work.
@@ -1111,9 +1465,24 @@ private:
 
 		m_TemplateLoadedIdx++;
 
-		// If this was the last template, send the data to the worker
+		// If this was the last template, convert the data once and send it to the workers
 		if (m_TemplateLoadedIdx == m_TemplateNames.size())
-			m_Worker.LoadEntityTemplates(m_Templates);
+		{
+			ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
+
+			CScriptVal templates;
+			scriptInterface.Eval("({})", templates);
+			for (size_t i = 0; i < m_Templates.size(); ++i)
+			{
+				jsval val = m_Templates[i].second->ToJSVal(scriptInterface.GetContext(), false);
+				scriptInterface.SetProperty(templates.get(), m_Templates[i].first.c_str(), CScriptVal(val), true);
+			}
+
+			m_EntityTemplates = scriptInterface.WriteStructuredClone(templates.get());
+
+			for (size_t i = 0; i < m_Workers.size(); ++i)
+				m_Workers[i]->LoadEntityTemplates(m_EntityTemplates);
+		}
 
 		return true;
 	}
@@ -1125,25 +1494,36 @@ private:
 		}
 	}
 
-	void LoadPathfinderClasses(CScriptVal state)
+	/**
+	 * Send the passability class table to every worker. The classes don't
+	 * change during a game, so they're only converted once, and workers keep
+	 * them rather than receiving them in every turn's state.
+	 */
+	void SendPassabilityClasses()
 	{
 		CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
 		if (!cmpPathfinder)
 			return;
 
-		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
+		if (!m_PassabilityClasses)
+		{
+			ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
+
+			CScriptVal classesVal;
+			scriptInterface.Eval("({ pathfinderObstruction: 1, foundationObstruction: 2 })", classesVal);
 
-		CScriptVal classesVal;
-		scriptInterface.Eval("({ pathfinderObstruction: 1, foundationObstruction: 2 })", classesVal);
+			std::map<std::string, ICmpPathfinder::pass_class_t> classes = cmpPathfinder->GetPassabilityClasses();
+			for (std::map<std::string, ICmpPathfinder::pass_class_t>::iterator it = classes.begin(); it != classes.end(); ++it)
+				scriptInterface.SetProperty(classesVal.get(), it->first.c_str(), it->second, true);
 
-		std::map<std::string, ICmpPathfinder::pass_class_t> classes = cmpPathfinder->GetPassabilityClasses();
-		for (std::map<std::string, ICmpPathfinder::pass_class_t>::iterator it = classes.begin(); it != classes.end(); ++it)
-			scriptInterface.SetProperty(classesVal.get(), it->first.c_str(), it->second, true);
+			m_PassabilityClasses = scriptInterface.WriteStructuredClone(classesVal.get());
+		}
 
-		scriptInterface.SetProperty(state.get(), "passabilityClasses", classesVal, true);
+		for (size_t i = 0; i < m_Workers.size(); ++i)
+			m_Workers[i]->SetPassabilityClasses(m_PassabilityClasses);
 	}
 
-	CAIWorker m_Worker;
+	std::vector<shared_ptr<CAIWorkerThread> > m_Workers;
 };
 
 REGISTER_COMPONENT_TYPE(AIManager)
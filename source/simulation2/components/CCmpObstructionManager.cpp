@@ -31,12 +31,13 @@
 #include "maths/MathUtil.h"
 #include "ps/Overlay.h"
 #include "ps/Profile.h"
+#include "ps/ThreadUtil.h"
 #include "renderer/Scene.h"
 #include "ps/CLogger.h"
 
 // Externally, tags are opaque non-zero positive integers.
-// Internally, they are tagged (by shape) indexes into shape lists.
-// idx must be non-zero.
+// Internally, they are tagged (by shape) IDs of items in the shape SlotMaps.
+// idx must be non-zero (which SlotMap IDs always are).
 #define TAG_IS_VALID(tag) ((tag).valid())
 #define TAG_IS_UNIT(tag) (((tag).n & 1) == 0)
 #define TAG_IS_STATIC(tag) (((tag).n & 1) == 1)
@@ -44,6 +45,25 @@
 #define STATIC_INDEX_TO_TAG(idx) tag_t(((idx) << 1) | 1)
 #define TAG_TO_INDEX(tag) ((tag).n >> 1)
 
+// For tile-based pathfinding:
+// Since we only count tiles whose centers are inside the square,
+// we maybe want to expand the square a bit so we're less likely to think there's
+// free space between buildings when there isn't. But this is just a random guess
+// and needs to be tweaked until everything works nicely.
+//static const entity_pos_t EXPAND_PATHFINDING = entity_pos_t::FromInt(TERRAIN_TILE_SIZE / 2);
+// Actually that's bad because units get stuck when the A* pathfinder thinks they're
+// blocked on all sides, so it's better to underestimate
+static const entity_pos_t EXPAND_PATHFINDING = entity_pos_t::FromInt(0);
+
+// For AI building foundation planning, we want to definitely block all
+// potentially-obstructed tiles (so we don't blindly build on top of an obstruction),
+// so we need to expand by at least 1/sqrt(2) of a tile
+static const entity_pos_t EXPAND_FOUNDATION = (entity_pos_t::FromInt(TERRAIN_TILE_SIZE) * 3) / 4;
+
+// The exact tests for rotated static shapes use approximate unit vectors,
+// so allow a little slack around their bounding boxes in the broadphase
+static const entity_pos_t BROADPHASE_STATIC_MARGIN = entity_pos_t::FromInt(1) / 8;
+
 /**
  * Internal representation of axis-aligned sometimes-square sometimes-circle shapes for moving units
  */
@@ -127,14 +147,25 @@ public:
 	SpatialSubdivision<u32> m_UnitSubdivision;
 	SpatialSubdivision<u32> m_StaticSubdivision;
 
-	// TODO: using std::map is a bit inefficient; is there a better way to store these?
-	std::map<u32, UnitShape> m_UnitShapes;
-	std::map<u32, StaticShape> m_StaticShapes;
-	u32 m_UnitShapeNext; // next allocated id
-	u32 m_StaticShapeNext;
+	SlotMap<UnitShape> m_UnitShapes;
+	SlotMap<StaticShape> m_StaticShapes;
+
+	// Largest radius of any unit shape added since Init/Deserialize, so that
+	// shape tests can find all the unit shapes they might touch in the
+	// subdivision (not serialized; it only affects which shapes get tested)
+	entity_pos_t m_UnitShapeMaxRadius;
+
+	// Reused result buffers for subdivision queries on the main thread (not serialized)
+	std::vector<u32> m_UnitShapesScratch;
+	std::vector<u32> m_StaticShapesScratch;
+	Geometry::PackedBoundingBoxes m_BroadphaseBoxesScratch;
+	std::vector<u32> m_BroadphaseHitsScratch;
 
 	bool m_PassabilityCircular;
 
+	// Tiles changed by recent shape updates, for incremental rasterisation (not serialized)
+	GridUpdateHistory m_DirtyHistory;
+
 	entity_pos_t m_WorldX0;
 	entity_pos_t m_WorldZ0;
 	entity_pos_t m_WorldX1;
@@ -150,10 +181,13 @@ public:
 		m_DebugOverlayEnabled = false;
 		m_DebugOverlayDirty = true;
 
-		m_UnitShapeNext = 1;
-		m_StaticShapeNext = 1;
+		m_UnitShapeMaxRadius = entity_pos_t::Zero();
 
 		m_DirtyID = 1; // init to 1 so default-initialised grids are considered dirty
+		m_DirtyHistory.Reset(m_DirtyID);
+
+		m_StaticDirtyID = 1;
+		m_StaticDirtyHistory.Reset(m_StaticDirtyID);
 
 		m_PassabilityCircular = false;
 
@@ -174,10 +208,8 @@ public:
 		SerializeSpatialSubdivision<SerializeU32_Unbounded>()(serialize, "unit subdiv", m_UnitSubdivision);
 		SerializeSpatialSubdivision<SerializeU32_Unbounded>()(serialize, "static subdiv", m_StaticSubdivision);
 
-		SerializeMap<SerializeU32_Unbounded, SerializeUnitShape>()(serialize, "unit shapes", m_UnitShapes);
-		SerializeMap<SerializeU32_Unbounded, SerializeStaticShape>()(serialize, "static shapes", m_StaticShapes);
-		serialize.NumberU32_Unbounded("unit shape next", m_UnitShapeNext);
-		serialize.NumberU32_Unbounded("static shape next", m_StaticShapeNext);
+		SerializeSlotMap<SerializeUnitShape>()(serialize, "unit shapes", m_UnitShapes);
+		SerializeSlotMap<SerializeStaticShape>()(serialize, "static shapes", m_StaticShapes);
 
 		serialize.Bool("circular", m_PassabilityCircular);
 
@@ -200,6 +232,9 @@ public:
 		Init(paramNode);
 
 		SerializeCommon(deserialize);
+
+		for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+			m_UnitShapeMaxRadius = std::max(m_UnitShapeMaxRadius, it->second.r);
 	}
 
 	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
@@ -235,14 +270,14 @@ public:
 		m_UnitSubdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
 		m_StaticSubdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
 
-		for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+		for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
 		{
 			CFixedVector2D center(it->second.x, it->second.z);
 			CFixedVector2D halfSize(it->second.r, it->second.r);
 			m_UnitSubdivision.Add(it->first, center - halfSize, center + halfSize);
 		}
 
-		for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+		for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
 		{
 			CFixedVector2D center(it->second.x, it->second.z);
 			CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, CFixedVector2D(it->second.hw, it->second.hh));
@@ -253,9 +288,9 @@ public:
 	virtual tag_t AddUnitShape(entity_id_t ent, entity_pos_t x, entity_pos_t z, entity_pos_t r, flags_t flags, entity_id_t group)
 	{
 		UnitShape shape = { ent, x, z, r, flags, group };
-		u32 id = m_UnitShapeNext++;
-		m_UnitShapes[id] = shape;
-		MakeDirtyUnit(flags);
+		u32 id = m_UnitShapes.insert(shape);
+		m_UnitShapeMaxRadius = std::max(m_UnitShapeMaxRadius, r);
+		MakeDirtyUnit(flags, x, z, r);
 
 		m_UnitSubdivision.Add(id, CFixedVector2D(x - r, z - r), CFixedVector2D(x + r, z + r));
 
@@ -270,12 +305,11 @@ public:
 		CFixedVector2D v(s, c);
 
 		StaticShape shape = { ent, x, z, u, v, w/2, h/2, flags, group, group2 };
-		u32 id = m_StaticShapeNext++;
-		m_StaticShapes[id] = shape;
-		MakeDirtyStatic(flags);
+		u32 id = m_StaticShapes.insert(shape);
 
 		CFixedVector2D center(x, z);
 		CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(u, v, CFixedVector2D(w/2, h/2));
+		MakeDirtyStatic(flags, center, bbHalfSize);
 		m_StaticSubdivision.Add(id, center - bbHalfSize, center + bbHalfSize);
 
 		return STATIC_INDEX_TO_TAG(id);
@@ -314,10 +348,12 @@ public:
 				CFixedVector2D(x - shape.r, z - shape.r),
 				CFixedVector2D(x + shape.r, z + shape.r));
 
+			// Both the old and new positions need rasterising again
+			MakeDirtyUnit(shape.flags, shape.x, shape.z, shape.r);
+			MakeDirtyUnit(shape.flags, x, z, shape.r);
+
 			shape.x = x;
 			shape.z = z;
-
-			MakeDirtyUnit(shape.flags);
 		}
 		else
 		{
@@ -336,12 +372,14 @@ public:
 				CFixedVector2D(x, z) - toBbHalfSize,
 				CFixedVector2D(x, z) + toBbHalfSize);
 
+			// Both the old and new positions need rasterising again
+			MakeDirtyStatic(shape.flags, CFixedVector2D(shape.x, shape.z), fromBbHalfSize);
+			MakeDirtyStatic(shape.flags, CFixedVector2D(x, z), toBbHalfSize);
+
 			shape.x = x;
 			shape.z = z;
 			shape.u = u;
 			shape.v = v;
-
-			MakeDirtyStatic(shape.flags);
 		}
 	}
 
@@ -381,6 +419,11 @@ public:
 			StaticShape& shape = m_StaticShapes[TAG_TO_INDEX(tag)];
 			shape.group = group;
 			shape.group2 = group2;
+
+			// Filters may treat the shape differently now
+			CFixedVector2D center(shape.x, shape.z);
+			CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
+			MakeDirtyStaticShapes(center - bbHalfSize, center + bbHalfSize);
 		}
 	}
 
@@ -395,7 +438,7 @@ public:
 				CFixedVector2D(shape.x - shape.r, shape.z - shape.r),
 				CFixedVector2D(shape.x + shape.r, shape.z + shape.r));
 
-			MakeDirtyUnit(shape.flags);
+			MakeDirtyUnit(shape.flags, shape.x, shape.z, shape.r);
 			m_UnitShapes.erase(TAG_TO_INDEX(tag));
 		}
 		else
@@ -406,7 +449,7 @@ public:
 			CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
 			m_StaticSubdivision.Remove(TAG_TO_INDEX(tag), center - bbHalfSize, center + bbHalfSize);
 
-			MakeDirtyStatic(shape.flags);
+			MakeDirtyStatic(shape.flags, center, bbHalfSize);
 			m_StaticShapes.erase(TAG_TO_INDEX(tag));
 		}
 	}
@@ -435,8 +478,18 @@ public:
 	virtual bool TestStaticShape(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t a, entity_pos_t w, entity_pos_t h, std::vector<entity_id_t>* out);
 	virtual bool TestUnitShape(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t r, std::vector<entity_id_t>* out);
 
-	virtual bool Rasterise(Grid<u8>& grid);
+	virtual bool Rasterise(Grid<u8>& grid, GridUpdateInformation& updateInfo);
 	virtual void GetObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares);
+	virtual void GetUnitObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares);
+	virtual void GetStaticShapesInRange(entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<StaticShapeData>& shapes);
+
+	virtual GridUpdateInformation GetStaticShapeChanges(size_t& dirtyID)
+	{
+		GridUpdateInformation info = m_StaticDirtyHistory.GetChangesSince(dirtyID, m_StaticDirtyID);
+		dirtyID = m_StaticDirtyID;
+		return info;
+	}
+
 	virtual bool FindMostImportantObstruction(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t r, ObstructionSquare& square);
 
 	virtual void SetPassabilityCircular(bool enabled)
@@ -459,9 +512,17 @@ private:
 	// To support lazy updates of grid rasterisations of obstruction data,
 	// we maintain a DirtyID here and increment it whenever obstructions change;
 	// if a grid has a lower DirtyID then it needs to be updated.
+	// m_DirtyHistory records which tiles each increment affected, so grids that
+	// are only slightly out of date can be updated incrementally.
 
 	size_t m_DirtyID;
 
+	// Static shapes have their own ID and history, which (unlike m_DirtyID) also
+	// cover shapes that don't affect the rasterised grids, for GetStaticShapeChanges.
+
+	size_t m_StaticDirtyID;
+	GridUpdateHistory m_StaticDirtyHistory;
+
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, and the debug display.
 	 * Call this when the world bounds have changed.
@@ -469,6 +530,9 @@ private:
 	void MakeDirtyAll()
 	{
 		++m_DirtyID;
+		m_DirtyHistory.Reset(m_DirtyID);
+		++m_StaticDirtyID;
+		m_StaticDirtyHistory.Reset(m_StaticDirtyID);
 		m_DebugOverlayDirty = true;
 	}
 
@@ -483,28 +547,94 @@ private:
 
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, if they depend on this shape.
-	 * Call this when a static shape has changed.
+	 * Call this when a static shape has changed, with the shape's bounding box
+	 * (before the change if it has moved or been removed, after the change if it has
+	 * moved or been added).
 	 */
-	void MakeDirtyStatic(flags_t flags)
+	void MakeDirtyStatic(flags_t flags, CFixedVector2D center, CFixedVector2D bbHalfSize)
 	{
 		if (flags & (FLAG_BLOCK_PATHFINDING|FLAG_BLOCK_FOUNDATION))
-			++m_DirtyID;
+			MakeDirtyRegion(center - bbHalfSize, center + bbHalfSize);
+
+		MakeDirtyStaticShapes(center - bbHalfSize, center + bbHalfSize);
 
 		m_DebugOverlayDirty = true;
 	}
 
+	/**
+	 * Record that the static shapes overlapping the given bounding box have changed,
+	 * for GetStaticShapeChanges.
+	 */
+	void MakeDirtyStaticShapes(CFixedVector2D bbMin, CFixedVector2D bbMax)
+	{
+		++m_StaticDirtyID;
+
+		// Allow a tile for rounding
+		entity_pos_t margin = entity_pos_t::FromInt(TERRAIN_TILE_SIZE);
+
+		GridUpdateInformation info;
+		info.Merge(DirtyTileIndex(bbMin.X - margin), DirtyTileIndex(bbMin.Y - margin),
+			DirtyTileIndex(bbMax.X + margin), DirtyTileIndex(bbMax.Y + margin));
+		m_StaticDirtyHistory.Add(m_StaticDirtyID, info);
+	}
+
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, if they depend on this shape.
-	 * Call this when a unit shape has changed.
+	 * Call this when a unit shape has changed, with the shape's position
+	 * (as for MakeDirtyStatic).
 	 */
-	void MakeDirtyUnit(flags_t flags)
+	void MakeDirtyUnit(flags_t flags, entity_pos_t x, entity_pos_t z, entity_pos_t r)
 	{
 		if (flags & (FLAG_BLOCK_PATHFINDING|FLAG_BLOCK_FOUNDATION))
-			++m_DirtyID;
+			MakeDirtyRegion(CFixedVector2D(x - r, z - r), CFixedVector2D(x + r, z + r));
 
 		m_DebugOverlayDirty = true;
 	}
 
+	/**
+	 * Mark all previous Rasterise()d grids as dirty, and record that only the tiles
+	 * that may be covered by a shape with the given bounding box need updating.
+	 */
+	void MakeDirtyRegion(CFixedVector2D bbMin, CFixedVector2D bbMax)
+	{
+		++m_DirtyID;
+
+		// Allow for the foundation expansion, plus a tile for rounding
+		entity_pos_t margin = EXPAND_FOUNDATION + entity_pos_t::FromInt(TERRAIN_TILE_SIZE);
+
+		GridUpdateInformation info;
+		info.Merge(DirtyTileIndex(bbMin.X - margin), DirtyTileIndex(bbMin.Y - margin),
+			DirtyTileIndex(bbMax.X + margin), DirtyTileIndex(bbMax.Y + margin));
+		m_DirtyHistory.Add(m_DirtyID, info);
+	}
+
+	/**
+	 * Convert a world-space coordinate into a tile index for a dirty region.
+	 * (This is only clamped to the range of u16; Rasterise clamps it to the grid.)
+	 */
+	static u16 DirtyTileIndex(entity_pos_t x)
+	{
+		return (u16)clamp((x / (int)TERRAIN_TILE_SIZE).ToInt_RoundToZero(), 0, 0xFFFF);
+	}
+
+	/**
+	 * Remove the IDs from @p unitShapes whose shapes' bounding boxes don't overlap
+	 * the box from @p bbMin to @p bbMax, keeping the rest in order.
+	 */
+	void BroadphaseUnitShapes(std::vector<u32>& unitShapes, CFixedVector2D bbMin, CFixedVector2D bbMax);
+
+	/**
+	 * As BroadphaseUnitShapes, for static shapes (whose bounding boxes are expanded
+	 * by BROADPHASE_STATIC_MARGIN).
+	 */
+	void BroadphaseStaticShapes(std::vector<u32>& staticShapes, CFixedVector2D bbMin, CFixedVector2D bbMax);
+
+	/**
+	 * Rasterise all shapes and world edges onto the tiles (i0, j0)-(i1, j1) (inclusive)
+	 * of the grid, replacing their previous contents.
+	 */
+	void RasteriseRegion(Grid<u8>& grid, u16 i0, u16 j0, u16 i1, u16 j1, bool allShapes);
+
 	/**
 	 * Test whether a Rasterise()d grid is dirty and needs updating
 	 */
@@ -544,10 +674,17 @@ bool CCmpObstructionManager::TestLine(const IObstructionTestFilter& filter, enti
 	CFixedVector2D posMin (std::min(x0, x1) - r, std::min(z0, z1) - r);
 	CFixedVector2D posMax (std::max(x0, x1) + r, std::max(z0, z1) + r);
 
-	std::vector<u32> unitShapes = m_UnitSubdivision.GetInRange(posMin, posMax);
+	// The pathfinder calls this from worker threads too, and only
+	// the main thread is allowed to reuse the member buffers
+	std::vector<u32> localUnitShapes, localStaticShapes;
+	bool mainThread = ThreadUtil::IsMainThread();
+
+	std::vector<u32>& unitShapes = mainThread ? m_UnitShapesScratch : localUnitShapes;
+	m_UnitSubdivision.GetInRange(unitShapes, posMin, posMax);
+	BroadphaseUnitShapes(unitShapes, posMin, posMax);
 	for (size_t i = 0; i < unitShapes.size(); ++i)
 	{
-		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
+		SlotMap<UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
 		ENSURE(it != m_UnitShapes.end());
 
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
@@ -559,10 +696,12 @@ bool CCmpObstructionManager::TestLine(const IObstructionTestFilter& filter, enti
 			return true;
 	}
 
-	std::vector<u32> staticShapes = m_StaticSubdivision.GetInRange(posMin, posMax);
+	std::vector<u32>& staticShapes = mainThread ? m_StaticShapesScratch : localStaticShapes;
+	m_StaticSubdivision.GetInRange(staticShapes, posMin, posMax);
+	BroadphaseStaticShapes(staticShapes, posMin, posMax);
 	for (size_t i = 0; i < staticShapes.size(); ++i)
 	{
-		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		SlotMap<StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
 		ENSURE(it != m_StaticShapes.end());
 
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
@@ -583,8 +722,6 @@ bool CCmpObstructionManager::TestStaticShape(const IObstructionTestFilter& filte
 {
 	PROFILE("TestStaticShape");
 
-	// TODO: should use the subdivision stuff here, if performance is non-negligible
-
 	if (out)
 		out->clear();
 
@@ -607,8 +744,24 @@ bool CCmpObstructionManager::TestStaticShape(const IObstructionTestFilter& filte
 			return true;
 	}
 
-	for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+	std::vector<u32> localUnitShapes, localStaticShapes;
+	bool mainThread = ThreadUtil::IsMainThread();
+
+	// A unit collides if its center is inside the square expanded by its radius,
+	// so it must be inside this box
+	CFixedVector2D unitBbHalfSize = Geometry::GetHalfBoundingBox(u, v, halfSize + CFixedVector2D(m_UnitShapeMaxRadius, m_UnitShapeMaxRadius));
+	std::vector<u32>& unitShapes = mainThread ? m_UnitShapesScratch : localUnitShapes;
+	m_UnitSubdivision.GetInRange(unitShapes, center - unitBbHalfSize, center + unitBbHalfSize);
+
+	// and the unit's own box must then be within r1*(sqrt(2)-1) of the square's bounding box
+	CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(u, v, halfSize);
+	CFixedVector2D unitBroadphaseHalfSize = bbHalfSize + CFixedVector2D(m_UnitShapeMaxRadius/2, m_UnitShapeMaxRadius/2);
+	BroadphaseUnitShapes(unitShapes, center - unitBroadphaseHalfSize, center + unitBroadphaseHalfSize);
+	for (size_t i = 0; i < unitShapes.size(); ++i)
 	{
+		SlotMap<UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
+		ENSURE(it != m_UnitShapes.end());
+
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
 			continue;
 
@@ -623,8 +776,16 @@ bool CCmpObstructionManager::TestStaticShape(const IObstructionTestFilter& filte
 		}
 	}
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+	// Static shapes can only collide if their bounding boxes overlap
+	std::vector<u32>& staticShapes = mainThread ? m_StaticShapesScratch : localStaticShapes;
+	CFixedVector2D staticBbHalfSize = bbHalfSize + CFixedVector2D(BROADPHASE_STATIC_MARGIN, BROADPHASE_STATIC_MARGIN);
+	m_StaticSubdivision.GetInRange(staticShapes, center - staticBbHalfSize, center + staticBbHalfSize);
+	BroadphaseStaticShapes(staticShapes, center - bbHalfSize, center + bbHalfSize);
+	for (size_t i = 0; i < staticShapes.size(); ++i)
 	{
+		SlotMap<StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		ENSURE(it != m_StaticShapes.end());
+
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
 			continue;
 
@@ -651,8 +812,6 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 {
 	PROFILE("TestUnitShape");
 
-	// TODO: should use the subdivision stuff here, if performance is non-negligible
-
 	// Check that the shape is within the world
 	if (!IsInWorld(x, z, r))
 	{
@@ -664,8 +823,17 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 
 	CFixedVector2D center(x, z);
 
-	for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+	std::vector<u32> localUnitShapes, localStaticShapes;
+	bool mainThread = ThreadUtil::IsMainThread();
+
+	std::vector<u32>& unitShapes = mainThread ? m_UnitShapesScratch : localUnitShapes;
+	m_UnitSubdivision.GetInRange(unitShapes, CFixedVector2D(x - r, z - r), CFixedVector2D(x + r, z + r));
+	BroadphaseUnitShapes(unitShapes, CFixedVector2D(x - r, z - r), CFixedVector2D(x + r, z + r));
+	for (size_t i = 0; i < unitShapes.size(); ++i)
 	{
+		SlotMap<UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
+		ENSURE(it != m_UnitShapes.end());
+
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
 			continue;
 
@@ -680,8 +848,16 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 		}
 	}
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+	// We collide if our center is inside the static square expanded by r,
+	// so the square's bounding box must be within r*sqrt(2) of our center
+	std::vector<u32>& staticShapes = mainThread ? m_StaticShapesScratch : localStaticShapes;
+	m_StaticSubdivision.GetInRange(staticShapes, CFixedVector2D(x - r*2, z - r*2), CFixedVector2D(x + r*2, z + r*2));
+	BroadphaseStaticShapes(staticShapes, CFixedVector2D(x - r*3/2, z - r*3/2), CFixedVector2D(x + r*3/2, z + r*3/2));
+	for (size_t i = 0; i < staticShapes.size(); ++i)
 	{
+		SlotMap<StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		ENSURE(it != m_StaticShapes.end());
+
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
 			continue;
 
@@ -702,6 +878,55 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 		return false; // didn't collide, if we got this far
 }
 
+void CCmpObstructionManager::BroadphaseUnitShapes(std::vector<u32>& unitShapes, CFixedVector2D bbMin, CFixedVector2D bbMax)
+{
+	Geometry::PackedBoundingBoxes localBoxes;
+	std::vector<u32> localHits;
+	bool mainThread = ThreadUtil::IsMainThread();
+
+	Geometry::PackedBoundingBoxes& boxes = mainThread ? m_BroadphaseBoxesScratch : localBoxes;
+	boxes.clear();
+	for (size_t i = 0; i < unitShapes.size(); ++i)
+	{
+		const UnitShape& shape = m_UnitShapes[unitShapes[i]];
+		boxes.push_back(shape.x - shape.r, shape.z - shape.r, shape.x + shape.r, shape.z + shape.r);
+	}
+
+	std::vector<u32>& hits = mainThread ? m_BroadphaseHitsScratch : localHits;
+	hits.clear();
+	Geometry::TestBoundingBoxes(boxes, bbMin.X, bbMin.Y, bbMax.X, bbMax.Y, hits);
+
+	// hits is sorted, so this never overwrites an ID before it's copied
+	for (size_t i = 0; i < hits.size(); ++i)
+		unitShapes[i] = unitShapes[hits[i]];
+	unitShapes.resize(hits.size());
+}
+
+void CCmpObstructionManager::BroadphaseStaticShapes(std::vector<u32>& staticShapes, CFixedVector2D bbMin, CFixedVector2D bbMax)
+{
+	Geometry::PackedBoundingBoxes localBoxes;
+	std::vector<u32> localHits;
+	bool mainThread = ThreadUtil::IsMainThread();
+
+	Geometry::PackedBoundingBoxes& boxes = mainThread ? m_BroadphaseBoxesScratch : localBoxes;
+	boxes.clear();
+	for (size_t i = 0; i < staticShapes.size(); ++i)
+	{
+		const StaticShape& shape = m_StaticShapes[staticShapes[i]];
+		CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
+		bbHalfSize += CFixedVector2D(BROADPHASE_STATIC_MARGIN, BROADPHASE_STATIC_MARGIN);
+		boxes.push_back(shape.x - bbHalfSize.X, shape.z - bbHalfSize.Y, shape.x + bbHalfSize.X, shape.z + bbHalfSize.Y);
+	}
+
+	std::vector<u32>& hits = mainThread ? m_BroadphaseHitsScratch : localHits;
+	hits.clear();
+	Geometry::TestBoundingBoxes(boxes, bbMin.X, bbMin.Y, bbMax.X, bbMax.Y, hits);
+
+	for (size_t i = 0; i < hits.size(); ++i)
+		staticShapes[i] = staticShapes[hits[i]];
+	staticShapes.resize(hits.size());
+}
+
 /**
  * Compute the tile indexes on the grid nearest to a given point
  */
@@ -720,108 +945,141 @@ static void TileCenter(u16 i, u16 j, entity_pos_t& x, entity_pos_t& z)
 	z = entity_pos_t::FromInt(j*(int)TERRAIN_TILE_SIZE + (int)TERRAIN_TILE_SIZE/2);
 }
 
-bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
+bool CCmpObstructionManager::Rasterise(Grid<u8>& grid, GridUpdateInformation& updateInfo)
 {
+	updateInfo.Reset();
+
 	if (!IsDirty(grid))
 		return false;
 
 	PROFILE("Rasterise");
 
-	grid.m_DirtyID = m_DirtyID;
+	if (grid.m_W == 0 || grid.m_H == 0)
+	{
+		grid.m_DirtyID = m_DirtyID;
+		return false;
+	}
 
-	// TODO: this is all hopelessly inefficient
-	// What we should perhaps do is have some kind of quadtree storing Shapes so it's
-	// quick to invalidate and update small numbers of tiles
+	// Find which tiles have changed since the grid was last rasterised
+	GridUpdateInformation changes = m_DirtyHistory.GetChangesSince(grid.m_DirtyID, m_DirtyID);
 
-	grid.reset();
+	grid.m_DirtyID = m_DirtyID;
 
-	// For tile-based pathfinding:
-	// Since we only count tiles whose centers are inside the square,
-	// we maybe want to expand the square a bit so we're less likely to think there's
-	// free space between buildings when there isn't. But this is just a random guess
-	// and needs to be tweaked until everything works nicely.
-	//entity_pos_t expandPathfinding = entity_pos_t::FromInt(TERRAIN_TILE_SIZE / 2);
-	// Actually that's bad because units get stuck when the A* pathfinder thinks they're
-	// blocked on all sides, so it's better to underestimate
-	entity_pos_t expandPathfinding = entity_pos_t::FromInt(0);
+	if (changes.globallyDirty)
+	{
+		RasteriseRegion(grid, 0, 0, (u16)(grid.m_W-1), (u16)(grid.m_H-1), true);
+		updateInfo.MarkAll();
+		return true;
+	}
 
-	// For AI building foundation planning, we want to definitely block all
-	// potentially-obstructed tiles (so we don't blindly build on top of an obstruction),
-	// so we need to expand by at least 1/sqrt(2) of a tile
-	entity_pos_t expandFoundation = (entity_pos_t::FromInt(TERRAIN_TILE_SIZE) * 3) / 4;
+	if (!changes.dirty || changes.i0 >= grid.m_W || changes.j0 >= grid.m_H)
+		return false;
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
-	{
-		CFixedVector2D center(it->second.x, it->second.z);
+	u16 i1 = std::min(changes.i1, (u16)(grid.m_W-1));
+	u16 j1 = std::min(changes.j1, (u16)(grid.m_H-1));
+	RasteriseRegion(grid, changes.i0, changes.j0, i1, j1, false);
+	updateInfo.Merge(changes.i0, changes.j0, i1, j1);
+	return true;
+}
 
-		if (it->second.flags & FLAG_BLOCK_PATHFINDING)
+/**
+ * Sets the given flags on every tile in the (inclusive) region whose center
+ * is inside the static shape expanded by the given amount.
+ */
+static void RasteriseStaticShape(Grid<u8>& grid, const StaticShape& shape, entity_pos_t expand, u8 flags,
+	u16 ri0, u16 rj0, u16 ri1, u16 rj1)
+{
+	CFixedVector2D center(shape.x, shape.z);
+	CFixedVector2D halfSize(shape.hw + expand, shape.hh + expand);
+	CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(shape.u, shape.v, halfSize);
+
+	u16 i0, j0, i1, j1;
+	NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
+	NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
+	i0 = std::max(i0, ri0);
+	j0 = std::max(j0, rj0);
+	i1 = std::min(i1, ri1);
+	j1 = std::min(j1, rj1);
+	for (u16 j = j0; j <= j1; ++j)
+	{
+		for (u16 i = i0; i <= i1; ++i)
 		{
-			CFixedVector2D halfSize(it->second.hw + expandPathfinding, it->second.hh + expandPathfinding);
-			CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, halfSize);
-
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-			{
-				for (u16 i = i0; i <= i1; ++i)
-				{
-					entity_pos_t x, z;
-					TileCenter(i, j, x, z);
-					if (Geometry::PointIsInSquare(CFixedVector2D(x, z) - center, it->second.u, it->second.v, halfSize))
-						grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_PATHFINDING);
-				}
-			}
+			entity_pos_t x, z;
+			TileCenter(i, j, x, z);
+			if (Geometry::PointIsInSquare(CFixedVector2D(x, z) - center, shape.u, shape.v, halfSize))
+				grid.set(i, j, grid.get(i, j) | flags);
 		}
+	}
+}
 
-		if (it->second.flags & FLAG_BLOCK_FOUNDATION)
-		{
-			CFixedVector2D halfSize(it->second.hw + expandFoundation, it->second.hh + expandFoundation);
-			CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, halfSize);
+/**
+ * Sets the given flags on every tile in the (inclusive) region that is
+ * covered by the unit shape expanded by the given amount.
+ */
+static void RasteriseUnitShape(Grid<u8>& grid, const UnitShape& shape, entity_pos_t expand, u8 flags,
+	u16 ri0, u16 rj0, u16 ri1, u16 rj1)
+{
+	entity_pos_t r = shape.r + expand;
+
+	u16 i0, j0, i1, j1;
+	NearestTile(shape.x - r, shape.z - r, i0, j0, grid.m_W, grid.m_H);
+	NearestTile(shape.x + r, shape.z + r, i1, j1, grid.m_W, grid.m_H);
+	i0 = std::max(i0, ri0);
+	j0 = std::max(j0, rj0);
+	i1 = std::min(i1, ri1);
+	j1 = std::min(j1, rj1);
+	for (u16 j = j0; j <= j1; ++j)
+		for (u16 i = i0; i <= i1; ++i)
+			grid.set(i, j, grid.get(i, j) | flags);
+}
 
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-			{
-				for (u16 i = i0; i <= i1; ++i)
-				{
-					entity_pos_t x, z;
-					TileCenter(i, j, x, z);
-					if (Geometry::PointIsInSquare(CFixedVector2D(x, z) - center, it->second.u, it->second.v, halfSize))
-						grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_FOUNDATION);
-				}
-			}
-		}
+void CCmpObstructionManager::RasteriseRegion(Grid<u8>& grid, u16 i0, u16 j0, u16 i1, u16 j1, bool allShapes)
+{
+	for (u16 j = j0; j <= j1; ++j)
+		for (u16 i = i0; i <= i1; ++i)
+			grid.set(i, j, 0);
+
+	std::vector<u32> staticShapes, unitShapes;
+	if (allShapes)
+	{
+		for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+			staticShapes.push_back(it->first);
+		for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+			unitShapes.push_back(it->first);
+	}
+	else
+	{
+		// Find the shapes that might touch the region (the subdivisions store
+		// unexpanded bounds, so allow for the expansion and tile rounding)
+		entity_pos_t margin = EXPAND_FOUNDATION + entity_pos_t::FromInt(TERRAIN_TILE_SIZE);
+		CFixedVector2D posMin(entity_pos_t::FromInt(i0*(int)TERRAIN_TILE_SIZE) - margin,
+			entity_pos_t::FromInt(j0*(int)TERRAIN_TILE_SIZE) - margin);
+		CFixedVector2D posMax(entity_pos_t::FromInt((i1+1)*(int)TERRAIN_TILE_SIZE) + margin,
+			entity_pos_t::FromInt((j1+1)*(int)TERRAIN_TILE_SIZE) + margin);
+		m_StaticSubdivision.GetInRange(staticShapes, posMin, posMax);
+		m_UnitSubdivision.GetInRange(unitShapes, posMin, posMax);
 	}
 
-	for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+	for (size_t n = 0; n < staticShapes.size(); ++n)
 	{
-		CFixedVector2D center(it->second.x, it->second.z);
+		const StaticShape& shape = m_StaticShapes[staticShapes[n]];
 
-		if (it->second.flags & FLAG_BLOCK_PATHFINDING)
-		{
-			entity_pos_t r = it->second.r + expandPathfinding;
-
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - r, center.Y - r, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + r, center.Y + r, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-				for (u16 i = i0; i <= i1; ++i)
-					grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_PATHFINDING);
-		}
+		if (shape.flags & FLAG_BLOCK_PATHFINDING)
+			RasteriseStaticShape(grid, shape, EXPAND_PATHFINDING, TILE_OBSTRUCTED_PATHFINDING, i0, j0, i1, j1);
 
-		if (it->second.flags & FLAG_BLOCK_FOUNDATION)
-		{
-			entity_pos_t r = it->second.r + expandFoundation;
-
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - r, center.Y - r, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + r, center.Y + r, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-				for (u16 i = i0; i <= i1; ++i)
-					grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_FOUNDATION);
-		}
+		if (shape.flags & FLAG_BLOCK_FOUNDATION)
+			RasteriseStaticShape(grid, shape, EXPAND_FOUNDATION, TILE_OBSTRUCTED_FOUNDATION, i0, j0, i1, j1);
+	}
+
+	for (size_t n = 0; n < unitShapes.size(); ++n)
+	{
+		const UnitShape& shape = m_UnitShapes[unitShapes[n]];
+
+		if (shape.flags & FLAG_BLOCK_PATHFINDING)
+			RasteriseUnitShape(grid, shape, EXPAND_PATHFINDING, TILE_OBSTRUCTED_PATHFINDING, i0, j0, i1, j1);
+
+		if (shape.flags & FLAG_BLOCK_FOUNDATION)
+			RasteriseUnitShape(grid, shape, EXPAND_FOUNDATION, TILE_OBSTRUCTED_FOUNDATION, i0, j0, i1, j1);
 	}
 
 	// Any tiles outside or very near the edge of the map are impassable
@@ -833,9 +1091,9 @@ bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
 
 	if (m_PassabilityCircular)
 	{
-		for (u16 j = 0; j < grid.m_H; ++j)
+		for (u16 j = j0; j <= j1; ++j)
 		{
-			for (u16 i = 0; i < grid.m_W; ++i)
+			for (u16 i = i0; i <= i1; ++i)
 			{
 				// Based on CCmpRangeManager::LosIsOffWorld
 				// but tweaked since it's tile-based instead.
@@ -853,25 +1111,19 @@ bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
 	}
 	else
 	{
-		u16 i0, j0, i1, j1;
-		NearestTile(m_WorldX0, m_WorldZ0, i0, j0, grid.m_W, grid.m_H);
-		NearestTile(m_WorldX1, m_WorldZ1, i1, j1, grid.m_W, grid.m_H);
+		u16 wi0, wj0, wi1, wj1;
+		NearestTile(m_WorldX0, m_WorldZ0, wi0, wj0, grid.m_W, grid.m_H);
+		NearestTile(m_WorldX1, m_WorldZ1, wi1, wj1, grid.m_W, grid.m_H);
 
-		for (u16 j = 0; j < grid.m_H; ++j)
-			for (u16 i = 0; i < i0+edgeSize; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = 0; j < grid.m_H; ++j)
-			for (u16 i = (u16)(i1-edgeSize+1); i < grid.m_W; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = 0; j < j0+edgeSize; ++j)
-			for (u16 i = (u16)(i0+edgeSize); i < i1-edgeSize+1; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = (u16)(j1-edgeSize+1); j < grid.m_H; ++j)
-			for (u16 i = (u16)(i0+edgeSize); i < i1-edgeSize+1; ++i)
-				grid.set(i, j, edgeFlags);
+		for (u16 j = j0; j <= j1; ++j)
+		{
+			for (u16 i = i0; i <= i1; ++i)
+			{
+				if (i < wi0+edgeSize || i+edgeSize > wi1 || j < wj0+edgeSize || j+edgeSize > wj1)
+					grid.set(i, j, edgeFlags);
+			}
+		}
 	}
-
-	return true;
 }
 
 void CCmpObstructionManager::GetObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares)
@@ -880,10 +1132,48 @@ void CCmpObstructionManager::GetObstructionsInRange(const IObstructionTestFilter
 
 	ENSURE(x0 <= x1 && z0 <= z1);
 
-	std::vector<u32> unitShapes = m_UnitSubdivision.GetInRange(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
+	GetUnitObstructionsInRange(filter, x0, z0, x1, z1, squares);
+
+	// The pathfinder calls this from worker threads too, and only
+	// the main thread is allowed to reuse the member buffers
+	std::vector<u32> localStaticShapes;
+	bool mainThread = ThreadUtil::IsMainThread();
+
+	std::vector<u32>& staticShapes = mainThread ? m_StaticShapesScratch : localStaticShapes;
+	m_StaticSubdivision.GetInRange(staticShapes, CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
+	for (size_t i = 0; i < staticShapes.size(); ++i)
+	{
+		SlotMap<StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		ENSURE(it != m_StaticShapes.end());
+
+		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
+			continue;
+
+		entity_pos_t r = it->second.hw + it->second.hh; // overestimate the max dist of an edge from the center
+
+		// Skip this object if its overestimated bounding box is completely outside the requested range
+		if (it->second.x + r < x0 || it->second.x - r > x1 || it->second.z + r < z0 || it->second.z - r > z1)
+			continue;
+
+		// TODO: maybe we should use Geometry::GetHalfBoundingBox to be more precise?
+
+		ObstructionSquare s = { it->second.x, it->second.z, it->second.u, it->second.v, it->second.hw, it->second.hh };
+		squares.push_back(s);
+	}
+}
+
+void CCmpObstructionManager::GetUnitObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares)
+{
+	ENSURE(x0 <= x1 && z0 <= z1);
+
+	std::vector<u32> localUnitShapes;
+	bool mainThread = ThreadUtil::IsMainThread();
+
+	std::vector<u32>& unitShapes = mainThread ? m_UnitShapesScratch : localUnitShapes;
+	m_UnitSubdivision.GetInRange(unitShapes, CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
 	for (size_t i = 0; i < unitShapes.size(); ++i)
 	{
-		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
+		SlotMap<UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
 		ENSURE(it != m_UnitShapes.end());
 
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
@@ -900,26 +1190,38 @@ void CCmpObstructionManager::GetObstructionsInRange(const IObstructionTestFilter
 		ObstructionSquare s = { it->second.x, it->second.z, u, v, r, r };
 		squares.push_back(s);
 	}
+}
+
+void CCmpObstructionManager::GetStaticShapesInRange(entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<StaticShapeData>& shapes)
+{
+	ENSURE(x0 <= x1 && z0 <= z1);
 
-	std::vector<u32> staticShapes = m_StaticSubdivision.GetInRange(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
+	std::vector<u32> localStaticShapes;
+	bool mainThread = ThreadUtil::IsMainThread();
+
+	std::vector<u32>& staticShapes = mainThread ? m_StaticShapesScratch : localStaticShapes;
+	m_StaticSubdivision.GetInRange(staticShapes, CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
 	for (size_t i = 0; i < staticShapes.size(); ++i)
 	{
-		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		SlotMap<StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
 		ENSURE(it != m_StaticShapes.end());
 
-		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
-			continue;
-
-		entity_pos_t r = it->second.hw + it->second.hh; // overestimate the max dist of an edge from the center
+		CFixedVector2D center(it->second.x, it->second.z);
+		CFixedVector2D halfSize(it->second.hw, it->second.hh);
+		CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, halfSize);
 
-		// Skip this object if its overestimated bounding box is completely outside the requested range
-		if (it->second.x + r < x0 || it->second.x - r > x1 || it->second.z + r < z0 || it->second.z - r > z1)
+		// Skip this object if its bounding box is completely outside the requested range
+		if (center.X + bbHalfSize.X < x0 || center.X - bbHalfSize.X > x1 || center.Y + bbHalfSize.Y < z0 || center.Y - bbHalfSize.Y > z1)
 			continue;
 
-		// TODO: maybe we should use Geometry::GetHalfBoundingBox to be more precise?
-
+		StaticShapeData data;
+		data.tag = STATIC_INDEX_TO_TAG(it->first);
+		data.flags = it->second.flags;
+		data.group = it->second.group;
+		data.group2 = it->second.group2;
 		ObstructionSquare s = { it->second.x, it->second.z, it->second.u, it->second.v, it->second.hw, it->second.hh };
-		squares.push_back(s);
+		data.square = s;
+		shapes.push_back(data);
 	}
 }
 
@@ -981,14 +1283,14 @@ void CCmpObstructionManager::RenderSubmit(SceneCollector& collector)
 				(m_WorldX1-m_WorldX0).ToFloat(), (m_WorldZ1-m_WorldZ0).ToFloat(),
 				0, m_DebugOverlayLines.back(), true);
 
-		for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+		for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
 		{
 			m_DebugOverlayLines.push_back(SOverlayLine());
 			m_DebugOverlayLines.back().m_Color = ((it->second.flags & FLAG_MOVING) ? movingColour : defaultColour);
 			SimRender::ConstructSquareOnGround(GetSimContext(), it->second.x.ToFloat(), it->second.z.ToFloat(), it->second.r.ToFloat()*2, it->second.r.ToFloat()*2, 0, m_DebugOverlayLines.back(), true);
 		}
 
-		for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+		for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
 		{
 			m_DebugOverlayLines.push_back(SOverlayLine());
 			m_DebugOverlayLines.back().m_Color = defaultColour;
@@ -33,6 +33,7 @@
 #include "simulation2/components/ICmpObstructionManager.h"
 #include "simulation2/components/ICmpTerrain.h"
 #include "simulation2/components/ICmpWaterManager.h"
+#include "simulation2/helpers/WorkerPool.h"
 #include "simulation2/serialization/SerializeTemplates.h"
 
 // Default cost to move a single tile is a fairly arbitrary number, which should be big
@@ -47,15 +48,23 @@ void CCmpPathfinder::Init(const CParamNode& UNUSED(paramNode))
 	m_MapSize = 0;
 	m_Grid = NULL;
 	m_ObstructionGrid = NULL;
-	m_TerrainDirty = true;
+	m_WaterGrid = NULL;
+	m_ShoreGrid = NULL;
+	m_TerrainDirty.MarkAll();
 	m_NextAsyncTicket = 1;
 
+	m_ShortPathChunksW = 0;
+	m_ShortPathStaticDirtyID = 0;
+	m_ShortPathGridDirtyID = 0;
+
 	m_DebugOverlay = NULL;
 	m_DebugGrid = NULL;
 	m_DebugPath = NULL;
 
 	m_SameTurnMovesCount = 0;
 
+	m_WorkerPool = NULL;
+
 	// Since this is used as a system component (not loaded from an entity template),
 	// we can't use the real paramNode (it won't get handled properly when deserializing),
 	// so load the data from a special XML file.
@@ -80,6 +89,13 @@ void CCmpPathfinder::Init(const CParamNode& UNUSED(paramNode))
 	const CParamNode pathingSettings = externalParamNode.GetChild("Pathfinder");
 	m_MaxSameTurnMoves = (u16)pathingSettings.GetChild("MaxSameTurnMoves").ToInt();
 
+	// Long path requests from at least this many units with the same goal are computed
+	// together with a single flow field
+	if (pathingSettings.GetChild("FlowFieldMinGroupSize").IsOk())
+		m_FlowFieldMinGroupSize = (u16)pathingSettings.GetChild("FlowFieldMinGroupSize").ToInt();
+	else
+		m_FlowFieldMinGroupSize = 8;
+
 
 	const CParamNode::ChildrenMap& passClasses = externalParamNode.GetChild("Pathfinder").GetChild("PassabilityClasses").GetChildren();
 	for (CParamNode::ChildrenMap::const_iterator it = passClasses.begin(); it != passClasses.end(); ++it)
@@ -154,6 +170,11 @@ void CCmpPathfinder::Deinit()
 
 	delete m_Grid;
 	delete m_ObstructionGrid;
+	delete m_WaterGrid;
+	delete m_ShoreGrid;
+
+	delete m_WorkerPool;
+	m_WorkerPool = NULL;
 }
 
 struct SerializeLongRequest
@@ -219,8 +240,11 @@ void CCmpPathfinder::HandleMessage(const CMessage& msg, bool UNUSED(global))
 	}
 	case MT_TerrainChanged:
 	{
-		// TODO: we ought to only bother updating the dirtied region
-		m_TerrainDirty = true;
+		const CMessageTerrainChanged& msgData = static_cast<const CMessageTerrainChanged&> (msg);
+		// Only bother updating the dirtied region (the message's upper bounds are exclusive)
+		if (msgData.i0 < msgData.i1 && msgData.j0 < msgData.j1)
+			m_TerrainDirty.Merge((u16)clamp(msgData.i0, 0, 0xFFFF), (u16)clamp(msgData.j0, 0, 0xFFFF),
+				(u16)clamp(msgData.i1 - 1, 0, 0xFFFF), (u16)clamp(msgData.j1 - 1, 0, 0xFFFF));
 		break;
 	}
 	case MT_TurnStart:
@@ -304,18 +328,38 @@ const Grid<u16>& CCmpPathfinder::GetPassabilityGrid()
 	return *m_Grid;
 }
 
+GridUpdateInformation CCmpPathfinder::GetPassabilityGridChanges(size_t dirtyID)
+{
+	UpdateGrid();
+
+	if (!m_Grid)
+	{
+		GridUpdateInformation info;
+		info.MarkAll();
+		return info;
+	}
+
+	return m_GridHistory.GetChangesSince(dirtyID, m_Grid->m_DirtyID);
+}
+
 void CCmpPathfinder::UpdateGrid()
 {
 	CmpPtr<ICmpTerrain> cmpTerrain(GetSimContext(), SYSTEM_ENTITY);
 	if (!cmpTerrain)
 		return; // error
 
+	// Keep the dirty ID increasing even if the grid is recreated, so that users
+	// of the grid don't mistake the new one for a copy they already have
+	size_t dirtyID = 0;
+
 	// If the terrain was resized then delete the old grid data
 	if (m_Grid && m_MapSize != cmpTerrain->GetTilesPerSide())
 	{
+		dirtyID = m_Grid->m_DirtyID;
 		SAFE_DELETE(m_Grid);
 		SAFE_DELETE(m_ObstructionGrid);
-		m_TerrainDirty = true;
+		SAFE_DELETE(m_WaterGrid);
+		SAFE_DELETE(m_ShoreGrid);
 	}
 
 	// Initialise the terrain data when first needed
@@ -323,219 +367,363 @@ void CCmpPathfinder::UpdateGrid()
 	{
 		m_MapSize = cmpTerrain->GetTilesPerSide();
 		m_Grid = new Grid<TerrainTile>(m_MapSize, m_MapSize);
+		m_Grid->m_DirtyID = dirtyID;
 		m_ObstructionGrid = new Grid<u8>(m_MapSize, m_MapSize);
+		m_WaterGrid = new Grid<bool>(m_MapSize, m_MapSize);
+		m_ShoreGrid = new Grid<u16>(m_MapSize, m_MapSize);
+		m_TerrainDirty.MarkAll();
 	}
 
 	CmpPtr<ICmpObstructionManager> cmpObstructionManager(GetSimContext(), SYSTEM_ENTITY);
 
-	bool obstructionsDirty = cmpObstructionManager->Rasterise(*m_ObstructionGrid);
+	GridUpdateInformation obstructionsDirty;
+	cmpObstructionManager->Rasterise(*m_ObstructionGrid, obstructionsDirty);
+
+	// If the obstruction grid was redone from scratch (e.g. because the world bounds
+	// or their shape changed), TILE_OUTOFBOUNDS may have changed too, which affects
+	// the passability classes, so we have to recompute everything
+	if (obstructionsDirty.globallyDirty)
+		m_TerrainDirty.MarkAll();
+
+	if (!obstructionsDirty.dirty && !m_TerrainDirty.dirty)
+		return;
 
-	if (obstructionsDirty && !m_TerrainDirty)
+	GridUpdateInformation changed;
+
+	if (m_TerrainDirty.dirty)
 	{
-		PROFILE("UpdateGrid obstructions");
+		UpdateTerrainTiles(m_TerrainDirty, changed);
+		m_TerrainDirty.Reset();
+	}
+
+	// (If everything was recomputed then the obstruction bits are already up-to-date)
+	if (obstructionsDirty.dirty && !changed.globallyDirty)
+		UpdateObstructionTiles(obstructionsDirty, changed);
 
-		// Obstructions changed - we need to recompute passability
-		// Since terrain hasn't changed we only need to update the obstruction bits
-		// and can skip the rest of the data
+	if (!changed.dirty)
+		return;
+
+	++m_Grid->m_DirtyID;
+	m_GridHistory.Add(m_Grid->m_DirtyID, changed);
+
+	UpdateChunkCostClasses(changed);
+
+	if (m_HierPath.IsInitialised(m_MapSize))
+		m_HierPath.Update(*m_Grid);
+	else
+		m_HierPath.Recompute(m_PassClassMasks, *m_Grid);
+}
+
+void CCmpPathfinder::UpdateObstructionTiles(const GridUpdateInformation& region, GridUpdateInformation& changed)
+{
+	PROFILE("UpdateGrid obstructions");
 
-		// TODO: if ObstructionManager::SetPassabilityCircular was called at runtime
-		// (which should probably never happen, but that's not guaranteed),
-		// then TILE_OUTOFBOUNDS will change and we can't use this fast path, but
-		// currently it'll just set obstructionsDirty and we won't notice
+	// Obstructions changed - we need to recompute passability
+	// Since terrain hasn't changed we only need to update the obstruction bits
+	// and can skip the rest of the data
 
-		for (u16 j = 0; j < m_MapSize; ++j)
+	bool hierInitialised = m_HierPath.IsInitialised(m_MapSize);
+
+	u16 i1 = std::min(region.i1, (u16)(m_MapSize-1));
+	u16 j1 = std::min(region.j1, (u16)(m_MapSize-1));
+
+	for (u16 j = region.j0; j <= j1; ++j)
+	{
+		for (u16 i = region.i0; i <= i1; ++i)
 		{
-			for (u16 i = 0; i < m_MapSize; ++i)
-			{
-				TerrainTile& t = m_Grid->get(i, j);
+			TerrainTile& t = m_Grid->get(i, j);
+			TerrainTile old = t;
 
-				u8 obstruct = m_ObstructionGrid->get(i, j);
+			u8 obstruct = m_ObstructionGrid->get(i, j);
 
-				if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_PATHFINDING)
-					t |= 1;
-				else
-					t &= (TerrainTile)~1;
+			if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_PATHFINDING)
+				t |= 1;
+			else
+				t &= (TerrainTile)~1;
 
-				if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_FOUNDATION)
-					t |= 2;
-				else
-					t &= (TerrainTile)~2;
+			if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_FOUNDATION)
+				t |= 2;
+			else
+				t &= (TerrainTile)~2;
+
+			if (t != old)
+			{
+				changed.Merge(i, j, i, j);
+
+				// (Only the pathfinding bit affects the hierarchical pathfinder)
+				if (hierInitialised && ((t ^ old) & 1))
+					m_HierPath.MarkDirty(i, j);
 			}
 		}
-
-		++m_Grid->m_DirtyID;
 	}
-	else if (obstructionsDirty || m_TerrainDirty)
+}
+
+void CCmpPathfinder::UpdateTerrainTiles(const GridUpdateInformation& region, GridUpdateInformation& changed)
+{
+	PROFILE("UpdateGrid terrain");
+
+	// Changing a terrain vertex moves the ground level of all the tiles that
+	// share it, so extend the region by a tile in each direction
+	u16 ri0 = 0, rj0 = 0, ri1 = (u16)(m_MapSize-1), rj1 = (u16)(m_MapSize-1);
+	if (!region.globallyDirty)
 	{
-		PROFILE("UpdateGrid full");
+		if (region.i0 > m_MapSize || region.j0 > m_MapSize)
+			return;
 
-		// Obstructions or terrain changed - we need to recompute passability
-		// TODO: only bother recomputing the region that has actually changed
+		ri0 = (u16)std::max((int)region.i0 - 1, 0);
+		rj0 = (u16)std::max((int)region.j0 - 1, 0);
+		ri1 = (u16)std::min((int)region.i1 + 1, (int)ri1);
+		rj1 = (u16)std::min((int)region.j1 + 1, (int)rj1);
+	}
+
+	CmpPtr<ICmpWaterManager> cmpWaterManager(GetSimContext(), SYSTEM_ENTITY);
 
-		CmpPtr<ICmpWaterManager> cmpWaterManager(GetSimContext(), SYSTEM_ENTITY);
+	// TOOD: these bits should come from ICmpTerrain
+	CTerrain& terrain = GetSimContext().GetTerrain();
 
-		// TOOD: these bits should come from ICmpTerrain
-		CTerrain& terrain = GetSimContext().GetTerrain();
+	// avoid integer overflow in intermediate calculation
+	const u16 shoreMax = 32767;
 
-		// avoid integer overflow in intermediate calculation
-		const u16 shoreMax = 32767;
-		
-		// First pass - find underwater tiles
-		Grid<bool> waterGrid(m_MapSize, m_MapSize);
-		for (u16 j = 0; j < m_MapSize; ++j)
+	// First pass - find underwater tiles
+	Grid<bool>& waterGrid = *m_WaterGrid;
+	for (u16 j = rj0; j <= rj1; ++j)
+	{
+		for (u16 i = ri0; i <= ri1; ++i)
 		{
-			for (u16 i = 0; i < m_MapSize; ++i)
-			{
-				fixed x, z;
-				TileCenter(i, j, x, z);
-				
-				bool underWater = cmpWaterManager && (cmpWaterManager->GetWaterLevel(x, z) > terrain.GetExactGroundLevelFixed(x, z));
-				waterGrid.set(i, j, underWater);
-			}
+			fixed x, z;
+			TileCenter(i, j, x, z);
+
+			bool underWater = cmpWaterManager && (cmpWaterManager->GetWaterLevel(x, z) > terrain.GetExactGroundLevelFixed(x, z));
+			waterGrid.set(i, j, underWater);
 		}
-		// Second pass - find shore tiles
-		Grid<u16> shoreGrid(m_MapSize, m_MapSize);
-		for (u16 j = 0; j < m_MapSize; ++j)
+	}
+
+	// Second pass - find shore tiles
+	// (This is cheap compared to the passability computation, so it's always done
+	// for the whole map, and only the tiles whose shore distance changes are updated)
+	Grid<u16> shoreGrid(m_MapSize, m_MapSize);
+	for (u16 j = 0; j < m_MapSize; ++j)
+	{
+		for (u16 i = 0; i < m_MapSize; ++i)
 		{
-			for (u16 i = 0; i < m_MapSize; ++i)
+			// Find a land tile
+			if (!waterGrid.get(i, j))
 			{
-				// Find a land tile
-				if (!waterGrid.get(i, j))
+				if ((i > 0 && waterGrid.get(i-1, j)) || (i > 0 && j < m_MapSize-1 && waterGrid.get(i-1, j+1)) || (i > 0 && j > 0 && waterGrid.get(i-1, j-1))
+					|| (i < m_MapSize-1 && waterGrid.get(i+1, j)) || (i < m_MapSize-1 && j < m_MapSize-1 && waterGrid.get(i+1, j+1)) || (i < m_MapSize-1 && j > 0 && waterGrid.get(i+1, j-1))
+					|| (j > 0 && waterGrid.get(i, j-1)) || (j < m_MapSize-1 && waterGrid.get(i, j+1))
+					)
+				{	// If it's bordered by water, it's a shore tile
+					shoreGrid.set(i, j, 0);
+				}
+				else
 				{
-					if ((i > 0 && waterGrid.get(i-1, j)) || (i > 0 && j < m_MapSize-1 && waterGrid.get(i-1, j+1)) || (i > 0 && j > 0 && waterGrid.get(i-1, j-1))
-						|| (i < m_MapSize-1 && waterGrid.get(i+1, j)) || (i < m_MapSize-1 && j < m_MapSize-1 && waterGrid.get(i+1, j+1)) || (i < m_MapSize-1 && j > 0 && waterGrid.get(i+1, j-1))
-						|| (j > 0 && waterGrid.get(i, j-1)) || (j < m_MapSize-1 && waterGrid.get(i, j+1))
-						)
-					{	// If it's bordered by water, it's a shore tile
-						shoreGrid.set(i, j, 0);
-					}
-					else
-					{
-						shoreGrid.set(i, j, shoreMax);
-					}
+					shoreGrid.set(i, j, shoreMax);
 				}
 			}
 		}
+	}
 
-		// Expand influences on land to find shore distance
-		for (u16 y = 0; y < m_MapSize; ++y)
+	// Expand influences on land to find shore distance
+	for (u16 y = 0; y < m_MapSize; ++y)
+	{
+		u16 min = shoreMax;
+		for (u16 x = 0; x < m_MapSize; ++x)
 		{
-			u16 min = shoreMax;
-			for (u16 x = 0; x < m_MapSize; ++x)
+			if (!waterGrid.get(x, y))
 			{
-				if (!waterGrid.get(x, y))
-				{
-					u16 g = shoreGrid.get(x, y);
-					if (g > min)
-						shoreGrid.set(x, y, min);
-					else if (g < min)
-						min = g;
+				u16 g = shoreGrid.get(x, y);
+				if (g > min)
+					shoreGrid.set(x, y, min);
+				else if (g < min)
+					min = g;
 
-					++min;
-				}
+				++min;
 			}
-			for (u16 x = m_MapSize; x > 0; --x)
+		}
+		for (u16 x = m_MapSize; x > 0; --x)
+		{
+			if (!waterGrid.get(x-1, y))
 			{
-				if (!waterGrid.get(x-1, y))
-				{
-					u16 g = shoreGrid.get(x-1, y);
-					if (g > min)
-						shoreGrid.set(x-1, y, min);
-					else if (g < min)
-						min = g;
+				u16 g = shoreGrid.get(x-1, y);
+				if (g > min)
+					shoreGrid.set(x-1, y, min);
+				else if (g < min)
+					min = g;
 
-					++min;
-				}
+				++min;
 			}
 		}
-		for (u16 x = 0; x < m_MapSize; ++x)
+	}
+	for (u16 x = 0; x < m_MapSize; ++x)
+	{
+		u16 min = shoreMax;
+		for (u16 y = 0; y < m_MapSize; ++y)
 		{
-			u16 min = shoreMax;
-			for (u16 y = 0; y < m_MapSize; ++y)
+			if (!waterGrid.get(x, y))
 			{
-				if (!waterGrid.get(x, y))
-				{
-					u16 g = shoreGrid.get(x, y);
-					if (g > min)
-						shoreGrid.set(x, y, min);
-					else if (g < min)
-						min = g;
+				u16 g = shoreGrid.get(x, y);
+				if (g > min)
+					shoreGrid.set(x, y, min);
+				else if (g < min)
+					min = g;
 
-					++min;
-				}
+				++min;
 			}
-			for (u16 y = m_MapSize; y > 0; --y)
+		}
+		for (u16 y = m_MapSize; y > 0; --y)
+		{
+			if (!waterGrid.get(x, y-1))
 			{
-				if (!waterGrid.get(x, y-1))
-				{
-					u16 g = shoreGrid.get(x, y-1);
-					if (g > min)
-						shoreGrid.set(x, y-1, min);
-					else if (g < min)
-						min = g;
+				u16 g = shoreGrid.get(x, y-1);
+				if (g > min)
+					shoreGrid.set(x, y-1, min);
+				else if (g < min)
+					min = g;
 
-					++min;
-				}
+				++min;
 			}
 		}
+	}
 
-		// Apply passability classes to terrain
-		for (u16 j = 0; j < m_MapSize; ++j)
+	// Apply passability classes to terrain
+	bool hierInitialised = m_HierPath.IsInitialised(m_MapSize);
+	for (u16 j = 0; j < m_MapSize; ++j)
+	{
+		for (u16 i = 0; i < m_MapSize; ++i)
 		{
-			for (u16 i = 0; i < m_MapSize; ++i)
-			{
-				fixed x, z;
-				TileCenter(i, j, x, z);
+			if (!region.globallyDirty && !(ri0 <= i && i <= ri1 && rj0 <= j && j <= rj1)
+				&& shoreGrid.get(i, j) == m_ShoreGrid->get(i, j))
+				continue;
+
+			fixed x, z;
+			TileCenter(i, j, x, z);
 
-				TerrainTile t = 0;
+			TerrainTile t = 0;
 
-				u8 obstruct = m_ObstructionGrid->get(i, j);
+			u8 obstruct = m_ObstructionGrid->get(i, j);
 
-				fixed height = terrain.GetExactGroundLevelFixed(x, z);
+			fixed height = terrain.GetExactGroundLevelFixed(x, z);
 
-				fixed water;
-				if (cmpWaterManager)
-					water = cmpWaterManager->GetWaterLevel(x, z);
+			fixed water;
+			if (cmpWaterManager)
+				water = cmpWaterManager->GetWaterLevel(x, z);
 
-				fixed depth = water - height;
+			fixed depth = water - height;
 
-				fixed slope = terrain.GetSlopeFixed(i, j);
+			fixed slope = terrain.GetSlopeFixed(i, j);
 
-				fixed shoredist = fixed::FromInt(shoreGrid.get(i, j));
+			fixed shoredist = fixed::FromInt(shoreGrid.get(i, j));
 
-				if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_PATHFINDING)
-					t |= 1;
+			if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_PATHFINDING)
+				t |= 1;
 
-				if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_FOUNDATION)
-					t |= 2;
+			if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_FOUNDATION)
+				t |= 2;
 
-				if (obstruct & ICmpObstructionManager::TILE_OUTOFBOUNDS)
+			if (obstruct & ICmpObstructionManager::TILE_OUTOFBOUNDS)
+			{
+				// If out of bounds, nobody is allowed to pass
+				for (size_t n = 0; n < m_PassClasses.size(); ++n)
+					t |= m_PassClasses[n].m_Mask;
+			}
+			else
+			{
+				for (size_t n = 0; n < m_PassClasses.size(); ++n)
 				{
-					// If out of bounds, nobody is allowed to pass
-					for (size_t n = 0; n < m_PassClasses.size(); ++n)
+					if (!m_PassClasses[n].IsPassable(depth, slope, shoredist))
 						t |= m_PassClasses[n].m_Mask;
 				}
-				else
+			}
+
+			std::string moveClass = terrain.GetMovementClass(i, j);
+			if (m_TerrainCostClassTags.find(moveClass) != m_TerrainCostClassTags.end())
+				t |= COST_CLASS_MASK(m_TerrainCostClassTags[moveClass]);
+
+			if (m_Grid->get(i, j) != t)
+			{
+				changed.Merge(i, j, i, j);
+
+				if (hierInitialised)
+					m_HierPath.MarkDirty(i, j);
+
+				m_Grid->set(i, j, t);
+			}
+		}
+	}
+
+	*m_ShoreGrid = shoreGrid;
+
+	if (region.globallyDirty)
+		changed.MarkAll();
+}
+
+void CCmpPathfinder::UpdateChunkCostClasses(const GridUpdateInformation& changed)
+{
+	const u16 chunkSize = HierarchicalPathfinder::CHUNK_SIZE;
+	u16 chunksW = (u16)((m_MapSize + chunkSize - 1) / chunkSize);
+
+	u16 ci0 = 0, cj0 = 0, ci1 = (u16)(chunksW - 1), cj1 = (u16)(chunksW - 1);
+	if (changed.globallyDirty || m_ChunkCostClasses.size() != (size_t)chunksW*chunksW)
+	{
+		m_ChunkCostClasses.assign(chunksW*chunksW, NONUNIFORM_COST_CLASS);
+	}
+	else
+	{
+		ci0 = changed.i0 / chunkSize;
+		cj0 = changed.j0 / chunkSize;
+		ci1 = std::min((u16)(changed.i1 / chunkSize), ci1);
+		cj1 = std::min((u16)(changed.j1 / chunkSize), cj1);
+	}
+
+	for (u16 cj = cj0; cj <= cj1; ++cj)
+	{
+		for (u16 ci = ci0; ci <= ci1; ++ci)
+		{
+			u16 i1 = std::min((int)(ci+1)*chunkSize, (int)m_MapSize);
+			u16 j1 = std::min((int)(cj+1)*chunkSize, (int)m_MapSize);
+
+			u16 costClass = GET_COST_CLASS(m_Grid->get(ci*chunkSize, cj*chunkSize));
+			for (u16 j = cj*chunkSize; j < j1 && costClass != NONUNIFORM_COST_CLASS; ++j)
+			{
+				for (u16 i = ci*chunkSize; i < i1; ++i)
 				{
-					for (size_t n = 0; n < m_PassClasses.size(); ++n)
+					if (GET_COST_CLASS(m_Grid->get(i, j)) != costClass)
 					{
-						if (!m_PassClasses[n].IsPassable(depth, slope, shoredist))
-							t |= m_PassClasses[n].m_Mask;
+						costClass = NONUNIFORM_COST_CLASS;
+						break;
 					}
 				}
-
-				std::string moveClass = terrain.GetMovementClass(i, j);
-				if (m_TerrainCostClassTags.find(moveClass) != m_TerrainCostClassTags.end())
-					t |= COST_CLASS_MASK(m_TerrainCostClassTags[moveClass]);
-
-				m_Grid->set(i, j, t);
 			}
+
+			m_ChunkCostClasses[ci + cj*chunksW] = costClass;
 		}
+	}
+}
+
+bool CCmpPathfinder::IsUniformCost(const std::vector<u32>& moveCosts, const std::vector<u8>* corridor, u32& cost) const
+{
+	if (corridor && corridor->size() != m_ChunkCostClasses.size())
+		return false;
+
+	bool found = false;
+	for (size_t n = 0; n < m_ChunkCostClasses.size(); ++n)
+	{
+		if (corridor && !(*corridor)[n])
+			continue;
 
-		m_TerrainDirty = false;
+		if (m_ChunkCostClasses[n] == NONUNIFORM_COST_CLASS)
+			return false;
 
-		++m_Grid->m_DirtyID;
+		u32 chunkCost = moveCosts.at(m_ChunkCostClasses[n]);
+		if (found && chunkCost != cost)
+			return false;
+
+		cost = chunkCost;
+		found = true;
 	}
+
+	return found;
 }
 
 //////////////////////////////////////////////////////////
@@ -574,28 +762,233 @@ void CCmpPathfinder::FinishAsyncRequests()
 	ProcessShortRequests(shortRequests);
 }
 
+/**
+ * Orders long path requests so that requests which can share a flow field are equal.
+ */
+struct LongPathGroupLess
+{
+	bool operator()(const AsyncLongPathRequest* a, const AsyncLongPathRequest* b) const
+	{
+		if (a->passClass != b->passClass)
+			return a->passClass < b->passClass;
+		if (a->costClass != b->costClass)
+			return a->costClass < b->costClass;
+
+		const ICmpPathfinder::Goal& ga = a->goal;
+		const ICmpPathfinder::Goal& gb = b->goal;
+		if (ga.type != gb.type)
+			return ga.type < gb.type;
+		if (ga.x != gb.x)
+			return ga.x < gb.x;
+		if (ga.z != gb.z)
+			return ga.z < gb.z;
+		if (ga.hw != gb.hw)
+			return ga.hw < gb.hw;
+		if (ga.hh != gb.hh)
+			return ga.hh < gb.hh;
+		if (ga.u.X != gb.u.X)
+			return ga.u.X < gb.u.X;
+		if (ga.u.Y != gb.u.Y)
+			return ga.u.Y < gb.u.Y;
+		if (ga.v.X != gb.v.X)
+			return ga.v.X < gb.v.X;
+		return ga.v.Y < gb.v.Y;
+	}
+};
+
+/**
+ * Long path requests that share a flow field.
+ */
+struct LongPathGroup
+{
+	std::vector<size_t> requests;
+	Grid<FlowFieldTile>* field;
+};
+
+/**
+ * Input and output data for a batch of long path jobs.
+ */
+struct LongPathJobs
+{
+	CCmpPathfinder* pathfinder;
+	const std::vector<AsyncLongPathRequest>* requests;
+	std::vector<ICmpPathfinder::Path>* paths;
+
+	std::vector<size_t> separate; // requests that are computed on their own
+	std::vector<LongPathGroup> groups;
+	std::vector<std::pair<size_t, size_t> > grouped; // (group, request) for every request in a group
+};
+
+// Computes either a separate path, or a group's flow field
+static void ComputeLongPathJob(void* data, size_t index)
+{
+	LongPathJobs& jobs = *static_cast<LongPathJobs*>(data);
+	if (index < jobs.separate.size())
+	{
+		size_t r = jobs.separate[index];
+		const AsyncLongPathRequest& req = (*jobs.requests)[r];
+		jobs.pathfinder->ComputePathImpl(req.x0, req.z0, req.goal, req.passClass, req.costClass, (*jobs.paths)[r], NULL, NULL);
+		return;
+	}
+
+	LongPathGroup& group = jobs.groups[index - jobs.separate.size()];
+	std::vector<std::pair<u16, u16> > startTiles;
+	for (size_t n = 0; n < group.requests.size(); ++n)
+	{
+		const AsyncLongPathRequest& req = (*jobs.requests)[group.requests[n]];
+		u16 i, j;
+		jobs.pathfinder->NearestTile(req.x0, req.z0, i, j);
+		startTiles.push_back(std::make_pair(i, j));
+	}
+
+	const AsyncLongPathRequest& first = (*jobs.requests)[group.requests[0]];
+	group.field = jobs.pathfinder->ComputeFlowField(first.goal, first.passClass, first.costClass, startTiles);
+}
+
+static void FollowFlowFieldJob(void* data, size_t index)
+{
+	LongPathJobs& jobs = *static_cast<LongPathJobs*>(data);
+	const LongPathGroup& group = jobs.groups[jobs.grouped[index].first];
+	size_t r = jobs.grouped[index].second;
+	const AsyncLongPathRequest& req = (*jobs.requests)[r];
+	ICmpPathfinder::Path& path = (*jobs.paths)[r];
+	if (!jobs.pathfinder->ComputePathFromFlowField(req.x0, req.z0, req.goal, req.passClass, req.costClass, *group.field, path))
+		jobs.pathfinder->ComputePathImpl(req.x0, req.z0, req.goal, req.passClass, req.costClass, path, NULL, NULL);
+}
+
+/**
+ * Input and output data for a batch of short path jobs.
+ */
+struct ShortPathJobs
+{
+	CCmpPathfinder* pathfinder;
+	const std::vector<AsyncShortPathRequest>* requests;
+	std::vector<ICmpPathfinder::Path>* paths;
+};
+
+static void ComputeShortPathJob(void* data, size_t index)
+{
+	ShortPathJobs& jobs = *static_cast<ShortPathJobs*>(data);
+	const AsyncShortPathRequest& req = (*jobs.requests)[index];
+	ControlGroupMovementObstructionFilter filter(req.avoidMovingUnits, req.group);
+	jobs.pathfinder->ComputeShortPathImpl(filter, req.x0, req.z0, req.r, req.range, req.goal, req.passClass, (*jobs.paths)[index], false);
+}
+
+WorkerPool& CCmpPathfinder::GetWorkerPool()
+{
+	if (!m_WorkerPool)
+		m_WorkerPool = new WorkerPool();
+	return *m_WorkerPool;
+}
+
 void CCmpPathfinder::ProcessLongRequests(const std::vector<AsyncLongPathRequest>& longRequests)
 {
+	if (longRequests.empty())
+		return;
+
+	std::vector<Path> paths(longRequests.size());
+
+	if (m_DebugOverlay)
+	{
+		// Compute the paths serially so the debug display shows the last one
+		for (size_t i = 0; i < longRequests.size(); ++i)
+		{
+			const AsyncLongPathRequest& req = longRequests[i];
+			ComputePath(req.x0, req.z0, req.goal, req.passClass, req.costClass, paths[i]);
+		}
+	}
+	else
+	{
+		// All the paths are computed against the current grid, which can't change
+		// until they've all finished
+		UpdateGrid();
+
+		LongPathJobs jobs;
+		jobs.pathfinder = this;
+		jobs.requests = &longRequests;
+		jobs.paths = &paths;
+
+		// Units given the same destination together (e.g. formations, or a large selection)
+		// share a flow field, instead of each searching for most of the same path
+		std::map<const AsyncLongPathRequest*, size_t, LongPathGroupLess> groupIndexes;
+		std::vector<std::vector<size_t> > candidates;
+		for (size_t i = 0; i < longRequests.size(); ++i)
+		{
+			std::map<const AsyncLongPathRequest*, size_t, LongPathGroupLess>::iterator it = groupIndexes.find(&longRequests[i]);
+			if (it == groupIndexes.end())
+			{
+				it = groupIndexes.insert(std::make_pair(&longRequests[i], candidates.size())).first;
+				candidates.push_back(std::vector<size_t>());
+			}
+			candidates[it->second].push_back(i);
+		}
+
+		for (size_t g = 0; g < candidates.size(); ++g)
+		{
+			if (m_FlowFieldMinGroupSize == 0 || candidates[g].size() < m_FlowFieldMinGroupSize)
+			{
+				jobs.separate.insert(jobs.separate.end(), candidates[g].begin(), candidates[g].end());
+				continue;
+			}
+
+			LongPathGroup group = { candidates[g], NULL };
+			for (size_t n = 0; n < group.requests.size(); ++n)
+				jobs.grouped.push_back(std::make_pair(jobs.groups.size(), group.requests[n]));
+			jobs.groups.push_back(group);
+		}
+
+		// Compute the separate paths and the flow fields, then follow the fields
+		GetWorkerPool().Run(&ComputeLongPathJob, &jobs, jobs.separate.size() + jobs.groups.size());
+		if (!jobs.grouped.empty())
+			GetWorkerPool().Run(&FollowFlowFieldJob, &jobs, jobs.grouped.size());
+
+		for (size_t g = 0; g < jobs.groups.size(); ++g)
+			delete jobs.groups[g].field;
+	}
+
+	// Send the results in request order, so the simulation doesn't depend
+	// on how the work was split between threads
 	for (size_t i = 0; i < longRequests.size(); ++i)
 	{
-		const AsyncLongPathRequest& req = longRequests[i];
-		Path path;
-		ComputePath(req.x0, req.z0, req.goal, req.passClass, req.costClass, path);
-		CMessagePathResult msg(req.ticket, path);
-		GetSimContext().GetComponentManager().PostMessage(req.notify, msg);
+		CMessagePathResult msg(longRequests[i].ticket, paths[i]);
+		GetSimContext().GetComponentManager().PostMessage(longRequests[i].notify, msg);
 	}
 }
 
 void CCmpPathfinder::ProcessShortRequests(const std::vector<AsyncShortPathRequest>& shortRequests)
 {
+	if (shortRequests.empty())
+		return;
+
+	std::vector<Path> paths(shortRequests.size());
+
+	if (m_DebugOverlay)
+	{
+		// Compute the paths serially so the debug display shows the last one
+		for (size_t i = 0; i < shortRequests.size(); ++i)
+		{
+			const AsyncShortPathRequest& req = shortRequests[i];
+			ControlGroupMovementObstructionFilter filter(req.avoidMovingUnits, req.group);
+			ComputeShortPath(filter, req.x0, req.z0, req.r, req.range, req.goal, req.passClass, paths[i]);
+		}
+	}
+	else
+	{
+		// All the paths are computed against the current grid and obstructions,
+		// which can't change until they've all finished
+		UpdateGrid();
+		UpdateShortPathCache();
+
+		ShortPathJobs jobs = { this, &shortRequests, &paths };
+		GetWorkerPool().Run(&ComputeShortPathJob, &jobs, shortRequests.size());
+	}
+
+	// Send the results in request order, so the simulation doesn't depend
+	// on how the work was split between threads
 	for (size_t i = 0; i < shortRequests.size(); ++i)
 	{
-		const AsyncShortPathRequest& req = shortRequests[i];
-		Path path;
-		ControlGroupMovementObstructionFilter filter(req.avoidMovingUnits, req.group);
-		ComputeShortPath(filter, req.x0, req.z0, req.r, req.range, req.goal, req.passClass, path);
-		CMessagePathResult msg(req.ticket, path);
-		GetSimContext().GetComponentManager().PostMessage(req.notify, msg);
+		CMessagePathResult msg(shortRequests[i].ticket, paths[i]);
+		GetSimContext().GetComponentManager().PostMessage(shortRequests[i].notify, msg);
 	}
 }
 
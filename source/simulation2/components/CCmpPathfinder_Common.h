@@ -24,7 +24,9 @@
  * and provides common code needed for more than one of those files.
  * CCmpPathfinder includes two pathfinding algorithms (one tile-based, one vertex-based)
  * with some shared state and functionality, so the code is split into
- * CCmpPathfinder_Vertex.cpp, CCmpPathfinder_Tile.cpp and CCmpPathfinder.cpp
+ * CCmpPathfinder_Vertex.cpp, CCmpPathfinder_Tile.cpp and CCmpPathfinder.cpp.
+ * The tile-based algorithm is guided by HierarchicalPathfinder, which tracks
+ * the connectivity of the passability grid.
  */
 
 #include "simulation2/system/Component.h"
@@ -34,10 +36,14 @@
 #include "graphics/Overlay.h"
 #include "graphics/Terrain.h"
 #include "maths/MathUtil.h"
+#include "ps/ThreadUtil.h"
+#include "simulation2/components/ICmpObstructionManager.h"
 #include "simulation2/helpers/Geometry.h"
 #include "simulation2/helpers/Grid.h"
+#include "simulation2/helpers/HierarchicalPathfinder.h"
 
 class PathfinderOverlay;
+class WorkerPool;
 class SceneCollector;
 struct PathfindTile;
 
@@ -136,6 +142,9 @@ const int COST_CLASS_BITS = 16 - (PASS_CLASS_BITS + 2);
 #define GET_COST_CLASS(item) ((item) >> (PASS_CLASS_BITS + 2))
 #define COST_CLASS_MASK(id) ( (TerrainTile) ((id) << (PASS_CLASS_BITS + 2)) )
 
+// Value of CCmpPathfinder::m_ChunkCostClasses for chunks containing several cost classes
+const u16 NONUNIFORM_COST_CLASS = 0xFFFF;
+
 typedef SparseGrid<PathfindTile> PathfindTileGrid;
 
 struct AsyncLongPathRequest
@@ -163,6 +172,60 @@ struct AsyncShortPathRequest
 	entity_id_t notify;
 };
 
+/**
+ * Tile data for a flow field: the movement costs from every tile to a single goal,
+ * shared by the long path requests of units heading for that goal
+ * (see CCmpPathfinder::ComputeFlowField).
+ */
+struct FlowFieldTile
+{
+	enum {
+		STATUS_UNEXPLORED = 0,
+		STATUS_OPEN = 1,
+		STATUS_CLOSED = 2
+	};
+
+	u32 cost; // cost of moving from this tile to the goal
+	u8 status;
+	u8 next; // index into the neighbour offsets of the next tile towards the goal
+	bool start; // whether a request starts on this tile
+};
+
+/**
+ * Edge of an impassable tile that borders a passable tile.
+ */
+struct TileEdge
+{
+	u16 i, j;
+	enum { TOP, BOTTOM, LEFT, RIGHT } dir;
+};
+
+/**
+ * The static shapes overlapping one HierarchicalPathfinder chunk, for the
+ * short-range pathfinder.
+ */
+struct ShortPathStaticChunk
+{
+	struct Shape
+	{
+		ICmpObstructionManager::StaticShapeData data;
+		CFixedVector2D bbHalfSize;
+	};
+
+	bool valid;
+	std::vector<Shape> shapes;
+};
+
+/**
+ * The terrain edges of one HierarchicalPathfinder chunk for a single passability
+ * class, for the short-range pathfinder. Edges of the same tile are adjacent.
+ */
+struct ShortPathTerrainChunk
+{
+	bool valid;
+	std::vector<TileEdge> edges;
+};
+
 /**
  * Implementation of ICmpPathfinder
  */
@@ -201,12 +264,31 @@ public:
 	u16 m_MapSize; // tiles per side
 	Grid<TerrainTile>* m_Grid; // terrain/passability information
 	Grid<u8>* m_ObstructionGrid; // cached obstruction information (TODO: we shouldn't bother storing this, it's redundant with LSBs of m_Grid)
-	bool m_TerrainDirty; // indicates if m_Grid has been updated since terrain changed
+	GridUpdateInformation m_TerrainDirty; // tiles of m_Grid that need updating since terrain changed
+	Grid<bool>* m_WaterGrid; // cached underwater tiles
+	Grid<u16>* m_ShoreGrid; // cached distance of land tiles from the shore
+	GridUpdateHistory m_GridHistory; // tiles of m_Grid changed by recent updates
+	HierarchicalPathfinder m_HierPath; // connectivity and abstract graph derived from m_Grid
+	std::vector<u16> m_ChunkCostClasses; // terrain cost class of each HierarchicalPathfinder chunk of m_Grid, or NONUNIFORM_COST_CLASS
+
+	// Parts of the short-range pathfinder's search graph that don't depend on unit shapes,
+	// per HierarchicalPathfinder chunk. Invalid chunks are rebuilt when first needed,
+	// possibly by the worker threads, so lookups must hold m_ShortPathCacheMutex.
+	u16 m_ShortPathChunksW;
+	std::vector<ShortPathStaticChunk> m_ShortPathStaticChunks; // indexed by ci + cj*m_ShortPathChunksW
+	std::map<pass_class_t, std::vector<ShortPathTerrainChunk> > m_ShortPathTerrainChunks;
+	size_t m_ShortPathStaticDirtyID; // obstruction manager's static shapes version that the cache matches
+	size_t m_ShortPathGridDirtyID; // version of m_Grid that the cache matches
+	CMutex m_ShortPathCacheMutex;
 	
 	// For responsiveness we will process some moves in the same turn they were generated in
 	
 	u16 m_MaxSameTurnMoves; // max number of moves that can be created and processed in the same turn
 
+	u16 m_FlowFieldMinGroupSize; // min number of long path requests with the same goal that share a flow field (0 = never)
+
+	WorkerPool* m_WorkerPool; // threads for computing async paths (lazily constructed)
+
 	// Debugging - output from last pathfind operation:
 
 	PathfindTileGrid* m_DebugGrid;
@@ -240,12 +322,52 @@ public:
 
 	virtual const Grid<u16>& GetPassabilityGrid();
 
+	virtual GridUpdateInformation GetPassabilityGridChanges(size_t dirtyID);
+
 	virtual void ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, Path& ret);
 
+	/**
+	 * Implementation of ComputePath. UpdateGrid must have been called first.
+	 * This doesn't modify any of the pathfinder's state, so it can be called from
+	 * several threads at once. If @p debugGrid is non-NULL, the search grid is
+	 * returned through it (and must be deleted by the caller).
+	 */
+	void ComputePathImpl(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, Path& ret,
+		PathfindTileGrid** debugGrid, u32* debugSteps);
+
+	/**
+	 * Computes a flow field towards @p goal, which ComputePathFromFlowField can follow
+	 * from any tile in @p startTiles, for a group of units sharing the goal, passability
+	 * class and cost class. The search stops as soon as all those tiles have been reached,
+	 * so the field isn't valid elsewhere. UpdateGrid must have been called first.
+	 * Like ComputePathImpl, this can be called from several threads at once.
+	 * The returned grid must be deleted by the caller.
+	 */
+	Grid<FlowFieldTile>* ComputeFlowField(const Goal& goal, pass_class_t passClass, cost_class_t costClass,
+		const std::vector<std::pair<u16, u16> >& startTiles);
+
+	/**
+	 * Computes a path from (x0, z0) to the goal of a field returned by ComputeFlowField.
+	 * Returns false, and leaves @p ret unchanged, if the field doesn't lead to the goal
+	 * from there (e.g. because the unit is stuck on an impassable tile, or the goal can't
+	 * be reached); ComputePathImpl should be used instead then.
+	 */
+	bool ComputePathFromFlowField(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass,
+		const Grid<FlowFieldTile>& field, Path& ret);
+
 	virtual u32 ComputePathAsync(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, entity_id_t notify);
 
 	virtual void ComputeShortPath(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t r, entity_pos_t range, const Goal& goal, pass_class_t passClass, Path& ret);
 
+	/**
+	 * Implementation of ComputeShortPath. UpdateGrid must have been called first.
+	 * If @p allowDebug is false, this doesn't modify any of the pathfinder's state
+	 * (so it can be called from several threads at once); otherwise it updates the
+	 * debug overlay lines.
+	 */
+	void ComputeShortPathImpl(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t r, entity_pos_t range, const Goal& goal, pass_class_t passClass, Path& ret,
+		bool allowDebug);
+
 	virtual u32 ComputeShortPathAsync(entity_pos_t x0, entity_pos_t z0, entity_pos_t r, entity_pos_t range, const Goal& goal, pass_class_t passClass, bool avoidMovingUnits, entity_id_t controller, entity_id_t notify);
 
 	virtual void SetDebugPath(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass);
@@ -270,6 +392,8 @@ virtual ICmpObstruction::EFoundationCheck CheckUnitPlacement(const IObstructionT
 
 	virtual void FinishAsyncRequests();
 
+	virtual WorkerPool& GetWorkerPool();
+
 	void ProcessLongRequests(const std::vector<AsyncLongPathRequest>& longRequests);
 	
 	void ProcessShortRequests(const std::vector<AsyncShortPathRequest>& shortRequests);
@@ -301,6 +425,49 @@ virtual ICmpObstruction::EFoundationCheck CheckUnitPlacement(const IObstructionT
 	 */
 	void UpdateGrid();
 
+	/**
+	 * Recomputes the obstruction bits of the tiles of m_Grid in the given region,
+	 * from m_ObstructionGrid. Tiles whose value changed are added to @p changed.
+	 */
+	void UpdateObstructionTiles(const GridUpdateInformation& region, GridUpdateInformation& changed);
+
+	/**
+	 * Recomputes all data of the tiles of m_Grid in the given region of changed terrain,
+	 * plus any tiles whose distance from the shore changed as a result.
+	 * Tiles whose value changed are added to @p changed.
+	 */
+	void UpdateTerrainTiles(const GridUpdateInformation& region, GridUpdateInformation& changed);
+
+	/**
+	 * Recomputes m_ChunkCostClasses for the chunks overlapping the given region of m_Grid.
+	 */
+	void UpdateChunkCostClasses(const GridUpdateInformation& changed);
+
+	/**
+	 * Returns whether every tile in the marked chunks of @p corridor (or in the whole
+	 * map, if it's NULL) has the same movement cost for a unit with the given costs,
+	 * and sets @p cost to that cost.
+	 */
+	bool IsUniformCost(const std::vector<u32>& moveCosts, const std::vector<u8>* corridor, u32& cost) const;
+
+	/**
+	 * Invalidates the chunks of the short-range pathfinder's cache that are affected by
+	 * changes to static shapes or to m_Grid. Must be called on the main thread, after
+	 * UpdateGrid and before any ComputeShortPathImpl.
+	 */
+	void UpdateShortPathCache();
+
+	/**
+	 * Returns the cached static shapes of the given chunk, computing them if necessary.
+	 */
+	const ShortPathStaticChunk& GetShortPathStaticChunk(u16 ci, u16 cj);
+
+	/**
+	 * Returns the cached terrain edges of the given chunk for the given passability class,
+	 * computing them if necessary.
+	 */
+	const ShortPathTerrainChunk& GetShortPathTerrainChunk(u16 ci, u16 cj, pass_class_t passClass);
+
 	void RenderSubmit(SceneCollector& collector);
 };
 
@@ -68,9 +68,9 @@ public:
 		dpi = (i8)((int)pi_ - (int)i);
 		dpj = (i8)((int)pj_ - (int)j);
 #if PATHFIND_DEBUG
-		// predecessor must be adjacent
-		ENSURE(pi_-i == -1 || pi_-i == 0 || pi_-i == 1);
-		ENSURE(pj_-j == -1 || pj_-j == 0 || pj_-j == 1);
+		// predecessor must be in a straight line (adjacent, except for jump point search)
+		ENSURE(pi_ == i || pj_ == j);
+		ENSURE(abs(pi_-i) <= 127 && abs(pj_-j) <= 127);
 #endif
 	}
 
@@ -202,9 +202,20 @@ struct PathfinderState
 
 	bool ignoreImpassable; // allows us to escape if stuck in patches of impassability
 
+	// If non-NULL, the search is restricted to tiles in the marked chunks
+	// (indexed as in HierarchicalPathfinder::GetCorridor)
+	const std::vector<u8>* corridor;
+	u16 corridorChunksW;
+
 	u32 hBest; // heuristic of closest discovered tile to goal
 	u16 iBest, jBest; // closest tile
 
+	const ICmpPathfinder::Goal* goal;
+	u16 iGoalMin, jGoalMin, iGoalMax, jGoalMax; // range of tiles that might be AtGoal
+
+	bool jumpPointSearch; // whether to use jump point search instead of plain A*
+	u32 uniformCost; // cost of moving to any tile, when using jump point search
+
 #if PATHFIND_STATS
 	// Performance debug counters
 	size_t numProcessed;
@@ -287,22 +298,9 @@ static u32 CalculateCostDelta(u16 pi, u16 pj, u16 i, u16 j, PathfindTileGrid* te
 	return dg;
 }
 
-// Do the A* processing for a neighbour tile i,j.
-static void ProcessNeighbour(u16 pi, u16 pj, u16 i, u16 j, u32 pg, PathfinderState& state)
+// Do the A* processing for tile i,j, reached from tile pi,pj with cost g.
+static void ProcessNode(u16 pi, u16 pj, u16 i, u16 j, u32 g, PathfinderState& state)
 {
-#if PATHFIND_STATS
-	state.numProcessed++;
-#endif
-
-	// Reject impassable tiles
-	TerrainTile tileTag = state.terrain->get(i, j);
-	if (!IS_PASSABLE(tileTag, state.passClass) && !state.ignoreImpassable)
-		return;
-
-	u32 dg = CalculateCostDelta(pi, pj, i, j, state.tiles, state.moveCosts.at(GET_COST_CLASS(tileTag)));
-
-	u32 g = pg + dg; // cost to this tile = cost to predecessor + delta from predecessor
-
 	PathfindTile& n = state.tiles->get(i, j);
 
 	// If this is a new tile, compute the heuristic distance
@@ -363,10 +361,352 @@ static void ProcessNeighbour(u16 pi, u16 pj, u16 i, u16 j, u32 pg, PathfinderSta
 #endif
 }
 
+// Do the A* processing for a neighbour tile i,j.
+static void ProcessNeighbour(u16 pi, u16 pj, u16 i, u16 j, u32 pg, PathfinderState& state)
+{
+#if PATHFIND_STATS
+	state.numProcessed++;
+#endif
+
+	// Reject impassable tiles
+	TerrainTile tileTag = state.terrain->get(i, j);
+	if (!IS_PASSABLE(tileTag, state.passClass) && !state.ignoreImpassable)
+		return;
+
+	// Reject tiles outside the abstract path's corridor
+	if (state.corridor && !(*state.corridor)[i / HierarchicalPathfinder::CHUNK_SIZE + (j / HierarchicalPathfinder::CHUNK_SIZE) * state.corridorChunksW])
+		return;
+
+	u32 dg = CalculateCostDelta(pi, pj, i, j, state.tiles, state.moveCosts.at(GET_COST_CLASS(tileTag)));
+
+	u32 g = pg + dg; // cost to this tile = cost to predecessor + delta from predecessor
+
+	ProcessNode(pi, pj, i, j, g, state);
+}
+
+/**
+ * Computes the range of tiles that might satisfy AtGoal (allowing for its tolerance).
+ */
+static void GetGoalTileBounds(const ICmpPathfinder::Goal& goal, u16 mapSize, u16& i0, u16& j0, u16& i1, u16& j1)
+{
+	entity_pos_t radius;
+	if (goal.type == ICmpPathfinder::Goal::POINT)
+		radius = entity_pos_t::Zero();
+	else if (goal.type == ICmpPathfinder::Goal::CIRCLE)
+		radius = goal.hw;
+	else
+		radius = goal.hw + goal.hh; // overestimate the max dist of an edge from the center
+
+	int r = (radius / (int)TERRAIN_TILE_SIZE).ToInt_RoundToInfinity() + 2;
+	int ic = (goal.x / (int)TERRAIN_TILE_SIZE).ToInt_RoundToZero();
+	int jc = (goal.z / (int)TERRAIN_TILE_SIZE).ToInt_RoundToZero();
+
+	i0 = (u16)clamp(ic - r, 0, mapSize - 1);
+	j0 = (u16)clamp(jc - r, 0, mapSize - 1);
+	i1 = (u16)clamp(ic + r, 0, mapSize - 1);
+	j1 = (u16)clamp(jc + r, 0, mapSize - 1);
+}
+
+/**
+ * Uses the hierarchical pathfinder to check whether any tile satisfying AtGoal
+ * can be reached from the given global region. If so, returns true and sets
+ * (iTarget, jTarget) to the reachable goal tile nearest to (i0, j0).
+ */
+static bool FindReachableGoalTile(const HierarchicalPathfinder& hier, u16 globalRegion, u16 i0, u16 j0,
+	const ICmpPathfinder::Goal& goal, ICmpPathfinder::pass_class_t passClass, u16 mapSize, u16& iTarget, u16& jTarget)
+{
+	// Find the tiles that might be at the goal
+	u16 iMin, jMin, iMax, jMax;
+	GetGoalTileBounds(goal, mapSize, iMin, jMin, iMax, jMax);
+
+	bool found = false;
+	int bestDist = std::numeric_limits<int>::max();
+	for (int j = jMin; j <= jMax; ++j)
+	{
+		for (int i = iMin; i <= iMax; ++i)
+		{
+			int dist = (i - i0)*(i - i0) + (j - j0)*(j - j0);
+			if (dist >= bestDist)
+				continue;
+			if (hier.GetGlobalRegion((u16)i, (u16)j, passClass) != globalRegion)
+				continue;
+			if (!AtGoal((u16)i, (u16)j, goal))
+				continue;
+
+			found = true;
+			bestDist = dist;
+			iTarget = (u16)i;
+			jTarget = (u16)j;
+		}
+	}
+
+	return found;
+}
+
+// Jump point search:
+//
+// When every tile the search may use has the same movement cost, there are usually
+// very many equally short paths, and A* wastes most of its time adding all of their
+// tiles to the open list. Instead we only consider one canonical path to each tile:
+// a path may turn from horizontal to vertical anywhere, but from vertical to horizontal
+// only next to the end of an obstacle (where the tile beside it is free but the one
+// behind that is blocked, i.e. a 'forced' neighbour).
+// The straight lines of these paths are scanned without touching the open list, and
+// only the tiles where they branch ('jump points') are added to it.
+// (This is the pruning rule of Harabor and Grastien's JPS, adapted to our
+// 4-connected grid.)
+
+// Maximum distance from a jump point to its predecessor, so it fits in PathfindTile
+static const int JUMP_MAX_LENGTH = 127;
+
+// Returns whether the jump point search may enter tile i,j.
+static bool IsJumpPassable(int i, int j, const PathfinderState& state)
+{
+	if (i < 0 || j < 0 || i >= state.terrain->m_W || j >= state.terrain->m_H)
+		return false;
+
+	if (!IS_PASSABLE(state.terrain->get(i, j), state.passClass))
+		return false;
+
+	if (state.corridor && !(*state.corridor)[i / HierarchicalPathfinder::CHUNK_SIZE + (j / HierarchicalPathfinder::CHUNK_SIZE) * state.corridorChunksW])
+		return false;
+
+	return true;
+}
+
+static bool IsJumpGoal(u16 i, u16 j, const PathfinderState& state)
+{
+	return (state.iGoalMin <= i && i <= state.iGoalMax && state.jGoalMin <= j && j <= state.jGoalMax
+		&& AtGoal(i, j, *state.goal));
+}
+
+// Scans vertically from tile i,j (exclusive) in direction dj, for the next jump point.
+// If @p limitLength, the tile JUMP_MAX_LENGTH away is treated as a jump point too.
+static bool JumpVertical(u16 i, u16 j, int dj, const PathfinderState& state, bool limitLength, u16& jOut)
+{
+	for (int n = 1; ; ++n)
+	{
+		int jj = j + n*dj;
+		if (!IsJumpPassable(i, jj, state))
+			return false;
+
+		if ((limitLength && n == JUMP_MAX_LENGTH) || IsJumpGoal(i, (u16)jj, state)
+			|| (IsJumpPassable(i-1, jj, state) && !IsJumpPassable(i-1, jj-dj, state))
+			|| (IsJumpPassable(i+1, jj, state) && !IsJumpPassable(i+1, jj-dj, state)))
+		{
+			jOut = (u16)jj;
+			return true;
+		}
+	}
+}
+
+// Scans horizontally from tile i,j (exclusive) in direction di, for the next jump point.
+static bool JumpHorizontal(u16 i, u16 j, int di, const PathfinderState& state, u16& iOut)
+{
+	for (int n = 1; ; ++n)
+	{
+		int ii = i + n*di;
+		if (!IsJumpPassable(ii, j, state))
+			return false;
+
+		// Vertical moves can follow horizontal ones anywhere, so this is a jump point
+		// if there's one anywhere directly above or below it
+		u16 jOut;
+		if (n == JUMP_MAX_LENGTH || IsJumpGoal((u16)ii, j, state)
+			|| JumpVertical((u16)ii, j, -1, state, false, jOut) || JumpVertical((u16)ii, j, 1, state, false, jOut))
+		{
+			iOut = (u16)ii;
+			return true;
+		}
+	}
+}
+
+// Adds the jump point i,j (in a straight line from pi,pj) to the open list.
+static void ProcessJumpPoint(u16 pi, u16 pj, u16 i, u16 j, u32 pg, PathfinderState& state)
+{
+	u32 dist = (u32)(abs((int)i - (int)pi) + abs((int)j - (int)pj));
+	ProcessNode(pi, pj, i, j, pg + dist*state.uniformCost, state);
+}
+
+// Finds the successors of jump point i,j (with cost g), and adds them to the open list.
+static void ExpandJumpPoint(u16 i, u16 j, u32 g, PathfinderState& state)
+{
+	PathfindTile& n = state.tiles->get(i, j);
+	int pi = n.GetPredI(i);
+	int pj = n.GetPredJ(j);
+	int di = (i > pi) ? 1 : (i < pi) ? -1 : 0;
+	int dj = (j > pj) ? 1 : (j < pj) ? -1 : 0;
+
+	u16 iOut, jOut;
+
+	if (dj == 0)
+	{
+		// Reached horizontally (or this is the start): carry on horizontally,
+		// and try going vertically in both directions
+		if (di >= 0 && JumpHorizontal(i, j, 1, state, iOut))
+			ProcessJumpPoint(i, j, iOut, j, g, state);
+		if (di <= 0 && JumpHorizontal(i, j, -1, state, iOut))
+			ProcessJumpPoint(i, j, iOut, j, g, state);
+		if (JumpVertical(i, j, 1, state, true, jOut))
+			ProcessJumpPoint(i, j, i, jOut, g, state);
+		if (JumpVertical(i, j, -1, state, true, jOut))
+			ProcessJumpPoint(i, j, i, jOut, g, state);
+	}
+	else
+	{
+		// Reached vertically: carry on vertically, and only turn towards forced neighbours
+		if (JumpVertical(i, j, dj, state, true, jOut))
+			ProcessJumpPoint(i, j, i, jOut, g, state);
+		if (IsJumpPassable(i+1, j, state) && !IsJumpPassable(i+1, j-dj, state) && JumpHorizontal(i, j, 1, state, iOut))
+			ProcessJumpPoint(i, j, iOut, j, g, state);
+		if (IsJumpPassable(i-1, j, state) && !IsJumpPassable(i-1, j-dj, state) && JumpHorizontal(i, j, -1, state, iOut))
+			ProcessJumpPoint(i, j, iOut, j, g, state);
+	}
+}
+
+/**
+ * Returns whether the straight line between the centers of two tiles only touches
+ * tiles that the jump point search may enter. (Where the line passes exactly through
+ * a corner, both tiles beside the corner must be passable, since units can't squeeze
+ * diagonally between obstructions.)
+ * If the costs aren't uniform (i.e. !state.jumpPointSearch), the line must also only
+ * touch tiles with the same cost as the first, so it doesn't cut across slower terrain.
+ */
+static bool CheckLineMovement(u16 i0, u16 j0, u16 i1, u16 j1, const PathfinderState& state)
+{
+	u32 lineCost = state.moveCosts.at(GET_COST_CLASS(state.terrain->get(i0, j0)));
+
+	int ni = abs((int)i1 - (int)i0);
+	int nj = abs((int)j1 - (int)j0);
+	int si = (i1 > i0) ? 1 : -1;
+	int sj = (j1 > j0) ? 1 : -1;
+
+	int i = i0, j = j0;
+	for (int ix = 0, jx = 0; ix < ni || jx < nj; )
+	{
+		// Compare the distances along the line to the next vertical and horizontal tile edges,
+		// i.e. (0.5+ix)/ni and (0.5+jx)/nj
+		int cmp;
+		if (ni == 0)
+			cmp = 1;
+		else if (nj == 0)
+			cmp = -1;
+		else
+			cmp = (1 + 2*ix)*nj - (1 + 2*jx)*ni;
+
+		if (cmp == 0)
+		{
+			if (!IsJumpPassable(i + si, j, state) || !IsJumpPassable(i, j + sj, state))
+				return false;
+			i += si;
+			j += sj;
+			++ix;
+			++jx;
+		}
+		else if (cmp < 0)
+		{
+			i += si;
+			++ix;
+		}
+		else
+		{
+			j += sj;
+			++jx;
+		}
+
+		if (!IsJumpPassable(i, j, state))
+			return false;
+
+		if (!state.jumpPointSearch && state.moveCosts.at(GET_COST_CLASS(state.terrain->get(i, j))) != lineCost)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Converts a path of adjacent tiles (from the end back to the start) into waypoints.
+ * Paths along the grid are made of horizontal and vertical lines, which look silly,
+ * so they're pulled taut wherever there's a clear straight line (see CheckLineMovement),
+ * then split back into roughly tile-sized steps (as expected by CCmpUnitMotion).
+ */
+static void ReconstructTautPath(const std::vector<std::pair<u16, u16> >& tiles, const PathfinderState& state, ICmpPathfinder::Path& path)
+{
+	// Pull the path taut: starting from the start tile, repeatedly move to the
+	// furthest tile along the path that can be reached in a straight line
+	std::vector<std::pair<u16, u16> > corners;
+	size_t anchor = tiles.size() - 1;
+	corners.push_back(tiles[anchor]);
+	while (anchor > 0)
+	{
+		size_t next = anchor - 1;
+		while (next > 0 && CheckLineMovement(tiles[anchor].first, tiles[anchor].second, tiles[next-1].first, tiles[next-1].second, state))
+			--next;
+		corners.push_back(tiles[next]);
+		anchor = next;
+	}
+
+	// Add waypoints about a tile apart along each straight line (in reverse order, as expected)
+	for (size_t c = corners.size() - 1; c > 0; --c)
+	{
+		entity_pos_t x0, z0, x1, z1;
+		CCmpPathfinder::TileCenter(corners[c-1].first, corners[c-1].second, x0, z0);
+		CCmpPathfinder::TileCenter(corners[c].first, corners[c].second, x1, z1);
+		int steps = std::max(abs((int)corners[c].first - (int)corners[c-1].first), abs((int)corners[c].second - (int)corners[c-1].second));
+		for (int k = steps; k > 0; --k)
+		{
+			fixed t = fixed::FromInt(k) / steps;
+			ICmpPathfinder::Waypoint w = { x0 + (x1 - x0).Multiply(t), z0 + (z1 - z0).Multiply(t) };
+			path.m_Waypoints.push_back(w);
+		}
+	}
+}
+
+/**
+ * Converts the result of a jump point search (ending at state.iBest, state.jBest)
+ * into waypoints.
+ */
+static void ReconstructJumpPointPath(u16 i0, u16 j0, const PathfinderState& state, ICmpPathfinder::Path& path)
+{
+	// Find every tile along the path, from the end back to the start
+	std::vector<std::pair<u16, u16> > tiles;
+	u16 ip = state.iBest, jp = state.jBest;
+	tiles.push_back(std::make_pair(ip, jp));
+	while (ip != i0 || jp != j0)
+	{
+		PathfindTile& n = state.tiles->get(ip, jp);
+		u16 pi = n.GetPredI(ip);
+		u16 pj = n.GetPredJ(jp);
+		while (ip != pi || jp != pj)
+		{
+			if (ip != pi)
+				ip = (ip < pi) ? (u16)(ip+1) : (u16)(ip-1);
+			else
+				jp = (jp < pj) ? (u16)(jp+1) : (u16)(jp-1);
+			tiles.push_back(std::make_pair(ip, jp));
+		}
+	}
+
+	ReconstructTautPath(tiles, state, path);
+}
+
 void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, Path& path)
 {
 	UpdateGrid();
 
+	PathfindTileGrid* debugGrid = NULL;
+	u32 debugSteps = 0;
+	ComputePathImpl(x0, z0, goal, passClass, costClass, path, &debugGrid, &debugSteps);
+
+	// Save this grid for debug display
+	delete m_DebugGrid;
+	m_DebugGrid = debugGrid;
+	m_DebugSteps = debugSteps;
+}
+
+void CCmpPathfinder::ComputePathImpl(entity_pos_t x0, entity_pos_t z0, const Goal& origGoal, pass_class_t passClass, cost_class_t costClass, Path& path,
+	PathfindTileGrid** debugGrid, u32* debugSteps)
+{
 	PROFILE3("ComputePath");
 
 	PathfinderState state = { 0 };
@@ -374,6 +714,48 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 	// Convert the start/end coordinates to tile indexes
 	u16 i0, j0;
 	NearestTile(x0, z0, i0, j0);
+
+	// Use the hierarchical pathfinder to make sure the goal is reachable
+	// (so we don't waste time searching the whole map when it's not),
+	// and to find an abstract path to it
+	Goal goal = origGoal;
+	std::vector<u8> corridor;
+
+	u16 iStart = i0, jStart = j0;
+	if (m_HierPath.GetGlobalRegion(iStart, jStart, passClass) == 0)
+	{
+		// We're starting on an impassable tile, and the search will escape to
+		// the nearest passable tile, so use that tile's connectivity instead
+		m_HierPath.FindNearestPassableTile(iStart, jStart, passClass, 0);
+	}
+
+	u16 startRegion = m_HierPath.GetGlobalRegion(iStart, jStart, passClass);
+	if (startRegion)
+	{
+		u16 iTarget, jTarget;
+		if (!FindReachableGoalTile(m_HierPath, startRegion, iStart, jStart, goal, passClass, m_MapSize, iTarget, jTarget))
+		{
+			// The goal is unreachable, so head for the nearest tile to it that we can reach
+			NearestTile(goal.x, goal.z, iTarget, jTarget);
+			m_HierPath.FindNearestPassableTile(iTarget, jTarget, passClass, startRegion);
+
+			goal.type = Goal::POINT;
+			TileCenter(iTarget, jTarget, goal.x, goal.z);
+		}
+
+		// Restrict the tile search to chunks along the abstract path. (When starting
+		// on an impassable tile the search might escape in a different direction,
+		// so don't restrict it then.)
+		std::vector<HierarchicalPathfinder::RegionID> abstractPath;
+		if (iStart == i0 && jStart == j0 &&
+			m_HierPath.ComputeAbstractPath(iStart, jStart, iTarget, jTarget, passClass, abstractPath))
+		{
+			m_HierPath.GetCorridor(abstractPath, corridor);
+			state.corridor = &corridor;
+			state.corridorChunksW = m_HierPath.GetChunksW();
+		}
+	}
+
 	NearestTile(goal.x, goal.z, state.iGoal, state.jGoal);
 
 	// If we're already at the goal tile, then move directly to the exact goal coordinates
@@ -414,6 +796,12 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 	// surrounded entirely by impassable tiles, we ignore the impassability
 	state.ignoreImpassable = !IS_PASSABLE(state.terrain->get(i0, j0), state.passClass);
 
+	// If every tile we might use has the same movement cost, use jump point search,
+	// which finds an equally short path while adding far fewer tiles to the open list
+	state.goal = &goal;
+	GetGoalTileBounds(goal, m_MapSize, state.iGoalMin, state.jGoalMin, state.iGoalMax, state.jGoalMax);
+	state.jumpPointSearch = !state.ignoreImpassable && IsUniformCost(state.moveCosts, state.corridor, state.uniformCost);
+
 	while (1)
 	{
 		++state.steps;
@@ -461,6 +849,12 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 		}
 
 		u32 g = state.tiles->get(i, j).cost;
+		if (state.jumpPointSearch)
+		{
+			ExpandJumpPoint(i, j, g, state);
+			continue;
+		}
+
 		if (i > 0)
 			ProcessNeighbour(i, j, (u16)(i-1), j, g, state);
 		if (i < m_MapSize-1)
@@ -472,31 +866,203 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 	}
 
 	// Reconstruct the path (in reverse)
-	u16 ip = state.iBest, jp = state.jBest;
-	while (ip != i0 || jp != j0)
+	if (state.jumpPointSearch)
 	{
-		PathfindTile& n = state.tiles->get(ip, jp);
-		entity_pos_t x, z;
-		TileCenter(ip, jp, x, z);
-		Waypoint w = { x, z };
-		path.m_Waypoints.push_back(w);
-
-		// Follow the predecessor link
-		ip = n.GetPredI(ip);
-		jp = n.GetPredJ(jp);
+		ReconstructJumpPointPath(i0, j0, state, path);
+	}
+	else
+	{
+		u16 ip = state.iBest, jp = state.jBest;
+		while (ip != i0 || jp != j0)
+		{
+			PathfindTile& n = state.tiles->get(ip, jp);
+			entity_pos_t x, z;
+			TileCenter(ip, jp, x, z);
+			Waypoint w = { x, z };
+			path.m_Waypoints.push_back(w);
+
+			// Follow the predecessor link
+			ip = n.GetPredI(ip);
+			jp = n.GetPredJ(jp);
+		}
 	}
 
-	// Save this grid for debug display
-	delete m_DebugGrid;
-	m_DebugGrid = state.tiles;
-	m_DebugSteps = state.steps;
+	// Return this grid for debug display, if wanted
+	if (debugGrid)
+	{
+		*debugGrid = state.tiles;
+		*debugSteps = state.steps;
+	}
+	else
+	{
+		delete state.tiles;
+	}
 
 	PROFILE2_ATTR("from: (%d, %d)", i0, j0);
 	PROFILE2_ATTR("to: (%d, %d)", state.iGoal, state.jGoal);
 	PROFILE2_ATTR("reached: (%d, %d)", state.iBest, state.jBest);
 	PROFILE2_ATTR("steps: %u", state.steps);
+	PROFILE2_ATTR("jps: %d", state.jumpPointSearch ? 1 : 0);
 
 #if PATHFIND_STATS
 	printf("PATHFINDER: steps=%d avgo=%d proc=%d impc=%d impo=%d addo=%d\n", state.steps, state.sumOpenSize/state.steps, state.numProcessed, state.numImproveClosed, state.numImproveOpen, state.numAddToOpen);
 #endif
 }
+
+//////////////////////////////////////////////////////////
+
+// Flow fields:
+//
+// When many units are sent to the same goal (e.g. a formation or a large selection),
+// their long paths all end up crossing the same tiles, so instead of searching for
+// each path separately we do a single Dijkstra search outwards from the goal, which
+// finds the cheapest way to the goal from every tile it reaches. Each unit's path is
+// then just a walk down the field from its own tile.
+
+// Offsets of the neighbours of a tile, in FlowFieldTile::next.
+// (Opposite directions differ only in the lowest bit.)
+static const int g_FlowFieldDI[4] = { -1, 1, 0, 0 };
+static const int g_FlowFieldDJ[4] = { 0, 0, -1, 1 };
+
+Grid<FlowFieldTile>* CCmpPathfinder::ComputeFlowField(const Goal& goal, pass_class_t passClass, cost_class_t costClass,
+	const std::vector<std::pair<u16, u16> >& startTiles)
+{
+	PROFILE3("ComputeFlowField");
+
+	Grid<FlowFieldTile>* field = new Grid<FlowFieldTile>(m_MapSize, m_MapSize);
+	const std::vector<u32>& moveCosts = m_MoveCosts.at(costClass);
+
+	// Only wait for the start tiles that can reach the goal, since we'd otherwise
+	// search everything we can reach before giving up on them
+	size_t numStarts = 0;
+	std::map<u16, bool> reachableRegions;
+	for (size_t n = 0; n < startTiles.size(); ++n)
+	{
+		u16 i = startTiles[n].first;
+		u16 j = startTiles[n].second;
+		FlowFieldTile& t = field->get(i, j);
+		if (t.start)
+			continue;
+
+		u16 region = m_HierPath.GetGlobalRegion(i, j, passClass);
+		if (region == 0)
+			continue;
+
+		std::map<u16, bool>::iterator it = reachableRegions.find(region);
+		if (it == reachableRegions.end())
+		{
+			u16 iTarget, jTarget;
+			bool reachable = FindReachableGoalTile(m_HierPath, region, i, j, goal, passClass, m_MapSize, iTarget, jTarget);
+			it = reachableRegions.insert(std::make_pair(region, reachable)).first;
+		}
+		if (!it->second)
+			continue;
+
+		t.start = true;
+		++numStarts;
+	}
+
+	// Start the search from every passable tile at the goal
+	PriorityQueue open;
+	u16 iMin, jMin, iMax, jMax;
+	GetGoalTileBounds(goal, m_MapSize, iMin, jMin, iMax, jMax);
+	for (u16 j = jMin; j <= jMax; ++j)
+	{
+		for (u16 i = iMin; i <= iMax; ++i)
+		{
+			if (!IS_PASSABLE(m_Grid->get(i, j), passClass) || !AtGoal(i, j, goal))
+				continue;
+
+			FlowFieldTile& t = field->get(i, j);
+			t.status = FlowFieldTile::STATUS_OPEN;
+			t.cost = 0;
+			PriorityQueue::Item item = { std::make_pair(i, j), 0 };
+			open.push(item);
+		}
+	}
+
+	while (numStarts > 0 && !open.empty())
+	{
+		PriorityQueue::Item curr = open.pop();
+		u16 i = curr.id.first;
+		u16 j = curr.id.second;
+
+		// Tiles are pushed again instead of being promoted when their cost improves
+		// (since promoting is slow in large queues), so skip the stale copies
+		FlowFieldTile& t = field->get(i, j);
+		if (t.status == FlowFieldTile::STATUS_CLOSED)
+			continue;
+
+		t.status = FlowFieldTile::STATUS_CLOSED;
+		if (t.start)
+			--numStarts;
+
+		// Units reach this tile by moving into it from a neighbour
+		u32 cost = t.cost + moveCosts.at(GET_COST_CLASS(m_Grid->get(i, j)));
+		for (u8 d = 0; d < 4; ++d)
+		{
+			int ni = i + g_FlowFieldDI[d];
+			int nj = j + g_FlowFieldDJ[d];
+			if (ni < 0 || nj < 0 || ni >= m_MapSize || nj >= m_MapSize)
+				continue;
+
+			if (!IS_PASSABLE(m_Grid->get(ni, nj), passClass))
+				continue;
+
+			FlowFieldTile& n = field->get(ni, nj);
+			if (n.status == FlowFieldTile::STATUS_CLOSED)
+				continue;
+			if (n.status == FlowFieldTile::STATUS_OPEN && cost >= n.cost)
+				continue;
+
+			n.status = FlowFieldTile::STATUS_OPEN;
+			n.cost = cost;
+			n.next = (u8)(d ^ 1);
+			PriorityQueue::Item item = { std::make_pair((u16)ni, (u16)nj), cost };
+			open.push(item);
+		}
+	}
+
+	return field;
+}
+
+bool CCmpPathfinder::ComputePathFromFlowField(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass,
+	const Grid<FlowFieldTile>& field, Path& path)
+{
+	u16 i0, j0;
+	NearestTile(x0, z0, i0, j0);
+
+	// If we're already at the goal tile, then move directly to the exact goal coordinates
+	if (AtGoal(i0, j0, goal))
+	{
+		Waypoint w = { goal.x, goal.z };
+		path.m_Waypoints.push_back(w);
+		return true;
+	}
+
+	// The field is only complete for the tiles closed by its search
+	if (field.get(i0, j0).status != FlowFieldTile::STATUS_CLOSED)
+		return false;
+
+	// Walk down the field to the goal, then reverse the tiles as expected by ReconstructTautPath
+	std::vector<std::pair<u16, u16> > tiles;
+	u16 i = i0, j = j0;
+	tiles.push_back(std::make_pair(i, j));
+	while (!AtGoal(i, j, goal))
+	{
+		u8 d = field.get(i, j).next;
+		i = (u16)(i + g_FlowFieldDI[d]);
+		j = (u16)(j + g_FlowFieldDJ[d]);
+		tiles.push_back(std::make_pair(i, j));
+	}
+	std::reverse(tiles.begin(), tiles.end());
+
+	PathfinderState state = { 0 };
+	state.passClass = passClass;
+	state.moveCosts = m_MoveCosts.at(costClass);
+	state.terrain = m_Grid;
+	// (This makes CheckLineMovement avoid cutting across slower terrain when there is any)
+	state.jumpPointSearch = IsUniformCost(state.moveCosts, NULL, state.uniformCost);
+	ReconstructTautPath(tiles, state, path);
+	return true;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,9 +22,11 @@
  *
  * Useful search term for this algorithm: "points of visibility".
  *
- * Since we sometimes want to use this for avoiding moving units, there is no
- * pre-computation - the whole visibility graph is effectively regenerated for
- * each path, and it does A* over that graph.
+ * Since we sometimes want to use this for avoiding moving units, the visibility
+ * graph is effectively regenerated for each path, and it does A* over that graph.
+ * The terrain edges and static shapes are cached per chunk of the map (and
+ * invalidated when they change), so only the unit shapes have to be looked up
+ * for each path.
  *
  * This scales very poorly in the number of obstructions, so it should be used
  * with a limited range and not exceedingly frequently.
@@ -168,21 +170,95 @@ inline static bool CheckVisibility(CFixedVector2D a, CFixedVector2D b, const std
 
 // Handle the axis-aligned shape edges separately (for performance):
 // (These are specialised versions of the general unaligned edge code.
-// They assume the caller has already excluded edges for which 'a' is
-// on the wrong side.)
+// They use an EdgeAAIndex, so they can start at the first edge that 'a' is
+// on the right side of, and stop at the first edge that's beyond 'b'.)
 
-inline static bool CheckVisibilityLeft(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges)
+/**
+ * The axis-aligned edges, split by the direction they face, and each
+ * sorted by its position along that axis starting from the edge nearest
+ * to the side that it blocks crossings from.
+ */
+struct EdgeAAIndex
+{
+	std::vector<EdgeAA> left; // increasing X
+	std::vector<EdgeAA> right; // decreasing X
+	std::vector<EdgeAA> bottom; // increasing Y
+	std::vector<EdgeAA> top; // decreasing Y
+};
+
+/**
+ * Ordering of EdgeAAs by the X or Y coordinate of p0, either increasing
+ * or decreasing. Can be used for sorting and for binary searching.
+ */
+template<bool Y, bool DESCENDING>
+struct EdgeAAOrder
+{
+	static fixed Key(const EdgeAA& e) { return Y ? e.p0.Y : e.p0.X; }
+
+	bool operator()(const EdgeAA& a, const EdgeAA& b) const
+	{
+		return DESCENDING ? Key(b) < Key(a) : Key(a) < Key(b);
+	}
+
+	bool operator()(const EdgeAA& a, fixed b) const
+	{
+		return DESCENDING ? b < Key(a) : Key(a) < b;
+	}
+};
+
+/**
+ * Positions in each list of an EdgeAAIndex of the first edge that 'a' is on the
+ * front side of (i.e. the start of the edges that a ray from 'a' might cross).
+ */
+struct EdgeAAStart
+{
+	size_t left, right, bottom, top;
+};
+
+static void BuildEdgeAAIndex(const std::vector<Edge>& edgesAA, EdgeAAIndex& index)
+{
+	index.left.reserve(edgesAA.size());
+	index.right.reserve(edgesAA.size());
+	index.bottom.reserve(edgesAA.size());
+	index.top.reserve(edgesAA.size());
+
+	for (size_t i = 0; i < edgesAA.size(); ++i)
+	{
+		EdgeAA l = { edgesAA[i].p0, edgesAA[i].p1.Y };
+		index.left.push_back(l);
+		EdgeAA r = { edgesAA[i].p1, edgesAA[i].p0.Y };
+		index.right.push_back(r);
+		EdgeAA b = { edgesAA[i].p0, edgesAA[i].p1.X };
+		index.bottom.push_back(b);
+		EdgeAA t = { edgesAA[i].p1, edgesAA[i].p0.X };
+		index.top.push_back(t);
+	}
+
+	std::sort(index.left.begin(), index.left.end(), EdgeAAOrder<false, false>());
+	std::sort(index.right.begin(), index.right.end(), EdgeAAOrder<false, true>());
+	std::sort(index.bottom.begin(), index.bottom.end(), EdgeAAOrder<true, false>());
+	std::sort(index.top.begin(), index.top.end(), EdgeAAOrder<true, true>());
+}
+
+static EdgeAAStart FindEdgeAAStart(CFixedVector2D a, const EdgeAAIndex& index)
+{
+	EdgeAAStart start;
+	start.left = std::lower_bound(index.left.begin(), index.left.end(), a.X, EdgeAAOrder<false, false>()) - index.left.begin();
+	start.right = std::lower_bound(index.right.begin(), index.right.end(), a.X, EdgeAAOrder<false, true>()) - index.right.begin();
+	start.bottom = std::lower_bound(index.bottom.begin(), index.bottom.end(), a.Y, EdgeAAOrder<true, false>()) - index.bottom.begin();
+	start.top = std::lower_bound(index.top.begin(), index.top.end(), a.Y, EdgeAAOrder<true, true>()) - index.top.begin();
+	return start;
+}
+
+inline static bool CheckVisibilityLeft(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges, size_t start)
 {
 	if (a.X >= b.X)
 		return true;
 
 	CFixedVector2D abn = (b - a).Perpendicular();
 
-	for (size_t i = 0; i < edges.size(); ++i)
+	for (size_t i = start; i < edges.size() && edges[i].p0.X <= b.X; ++i)
 	{
-		if (b.X < edges[i].p0.X)
-			continue;
-
 		CFixedVector2D p0 (edges[i].p0.X, edges[i].c1);
 		fixed s = (p0 - a).Dot(abn);
 		if (s > fixed::Zero())
@@ -199,18 +275,15 @@ inline static bool CheckVisibilityLeft(CFixedVector2D a, CFixedVector2D b, const
 	return true;
 }
 
-inline static bool CheckVisibilityRight(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges)
+inline static bool CheckVisibilityRight(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges, size_t start)
 {
 	if (a.X <= b.X)
 		return true;
 
 	CFixedVector2D abn = (b - a).Perpendicular();
 
-	for (size_t i = 0; i < edges.size(); ++i)
+	for (size_t i = start; i < edges.size() && edges[i].p0.X >= b.X; ++i)
 	{
-		if (b.X > edges[i].p0.X)
-			continue;
-
 		CFixedVector2D p0 (edges[i].p0.X, edges[i].c1);
 		fixed s = (p0 - a).Dot(abn);
 		if (s > fixed::Zero())
@@ -227,18 +300,15 @@ inline static bool CheckVisibilityRight(CFixedVector2D a, CFixedVector2D b, cons
 	return true;
 }
 
-inline static bool CheckVisibilityBottom(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges)
+inline static bool CheckVisibilityBottom(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges, size_t start)
 {
 	if (a.Y >= b.Y)
 		return true;
 
 	CFixedVector2D abn = (b - a).Perpendicular();
 
-	for (size_t i = 0; i < edges.size(); ++i)
+	for (size_t i = start; i < edges.size() && edges[i].p0.Y <= b.Y; ++i)
 	{
-		if (b.Y < edges[i].p0.Y)
-			continue;
-
 		CFixedVector2D p0 (edges[i].p0.X, edges[i].p0.Y);
 		fixed s = (p0 - a).Dot(abn);
 		if (s > fixed::Zero())
@@ -255,18 +325,15 @@ inline static bool CheckVisibilityBottom(CFixedVector2D a, CFixedVector2D b, con
 	return true;
 }
 
-inline static bool CheckVisibilityTop(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges)
+inline static bool CheckVisibilityTop(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges, size_t start)
 {
 	if (a.Y <= b.Y)
 		return true;
 
 	CFixedVector2D abn = (b - a).Perpendicular();
 
-	for (size_t i = 0; i < edges.size(); ++i)
+	for (size_t i = start; i < edges.size() && edges[i].p0.Y >= b.Y; ++i)
 	{
-		if (b.Y > edges[i].p0.Y)
-			continue;
-
 		CFixedVector2D p0 (edges[i].p0.X, edges[i].p0.Y);
 		fixed s = (p0 - a).Dot(abn);
 		if (s > fixed::Zero())
@@ -283,6 +350,18 @@ inline static bool CheckVisibilityTop(CFixedVector2D a, CFixedVector2D b, const
 	return true;
 }
 
+/**
+ * Check whether a ray from 'a' to 'b' crosses any of the axis-aligned edges.
+ */
+inline static bool CheckVisibilityAA(CFixedVector2D a, CFixedVector2D b, const EdgeAAIndex& index, const EdgeAAStart& start)
+{
+	return
+		CheckVisibilityLeft(a, b, index.left, start.left) &&
+		CheckVisibilityRight(a, b, index.right, start.right) &&
+		CheckVisibilityBottom(a, b, index.bottom, start.bottom) &&
+		CheckVisibilityTop(a, b, index.top, start.top);
+}
+
 
 static CFixedVector2D NearestPointOnGoal(CFixedVector2D pos, const CCmpPathfinder::Goal& goal)
 {
@@ -327,79 +406,76 @@ CFixedVector2D CCmpPathfinder::GetNearestPointOnGoal(CFixedVector2D pos, const C
 
 typedef PriorityQueueHeap<u16, fixed> PriorityQueue;
 
-struct TileEdge
-{
-	u16 i, j;
-	enum { TOP, BOTTOM, LEFT, RIGHT } dir;
-};
-
-static void AddTerrainEdges(std::vector<Edge>& edgesAA, std::vector<Vertex>& vertexes,
-	u16 i0, u16 j0, u16 i1, u16 j1, fixed r,
+/**
+ * Find all edges between impassable tiles in the given range (inclusive)
+ * and their passable neighbours.
+ */
+static void ComputeTileEdges(std::vector<TileEdge>& tileEdges,
+	u16 i0, u16 j0, u16 i1, u16 j1,
 	ICmpPathfinder::pass_class_t passClass, const Grid<TerrainTile>& terrain)
 {
-	PROFILE("AddTerrainEdges");
-
-	std::vector<TileEdge> tileEdges;
-
-	// Find all edges between tiles of differently passability statuses
 	for (u16 j = j0; j <= j1; ++j)
 	{
 		for (u16 i = i0; i <= i1; ++i)
 		{
 			if (!IS_TERRAIN_PASSABLE(terrain.get(i, j), passClass))
 			{
-				bool any = false; // whether we're adding any edges of this tile
-
 				if (j > 0 && IS_TERRAIN_PASSABLE(terrain.get(i, j-1), passClass))
 				{
 					TileEdge e = { i, j, TileEdge::BOTTOM };
 					tileEdges.push_back(e);
-					any = true;
 				}
 
 				if (j < terrain.m_H-1 && IS_TERRAIN_PASSABLE(terrain.get(i, j+1), passClass))
 				{
 					TileEdge e = { i, j, TileEdge::TOP };
 					tileEdges.push_back(e);
-					any = true;
 				}
 
 				if (i > 0 && IS_TERRAIN_PASSABLE(terrain.get(i-1, j), passClass))
 				{
 					TileEdge e = { i, j, TileEdge::LEFT };
 					tileEdges.push_back(e);
-					any = true;
 				}
 
 				if (i < terrain.m_W-1 && IS_TERRAIN_PASSABLE(terrain.get(i+1, j), passClass))
 				{
 					TileEdge e = { i, j, TileEdge::RIGHT };
 					tileEdges.push_back(e);
-					any = true;
-				}
-
-				// If we want to add any edge, then add the whole square to the axis-aligned-edges list.
-				// (The inner edges are redundant but it's easier than trying to split the squares apart.)
-				if (any)
-				{
-					CFixedVector2D v0 = CFixedVector2D(fixed::FromInt(i * (int)TERRAIN_TILE_SIZE) - r, fixed::FromInt(j * (int)TERRAIN_TILE_SIZE) - r);
-					CFixedVector2D v1 = CFixedVector2D(fixed::FromInt((i+1) * (int)TERRAIN_TILE_SIZE) + r, fixed::FromInt((j+1) * (int)TERRAIN_TILE_SIZE) + r);
-					Edge e = { v0, v1 };
-					edgesAA.push_back(e);
 				}
 			}
 		}
 	}
+}
 
-	// TODO: maybe we should precompute these terrain edges since they'll rarely change?
-
-	// TODO: for efficiency (minimising the A* search space), we should coalesce adjoining edges
-
-	// Add all the tile outer edges to the search vertex lists
+/**
+ * Add the collision edges and search vertexes for the tile edges that are
+ * within the given range of tiles (inclusive), expanded by the unit radius @p r.
+ * Edges of the same tile must be adjacent in @p tileEdges.
+ */
+static void AddTileEdges(std::vector<Edge>& edgesAA, std::vector<Vertex>& vertexes,
+	const std::vector<TileEdge>& tileEdges, u16 i0, u16 j0, u16 i1, u16 j1, fixed r)
+{
 	for (size_t n = 0; n < tileEdges.size(); ++n)
 	{
 		u16 i = tileEdges[n].i;
 		u16 j = tileEdges[n].j;
+		if (i < i0 || i > i1 || j < j0 || j > j1)
+			continue;
+
+		// Add the whole square of the first edge of each tile to the axis-aligned-edges list.
+		// (The inner edges are redundant but it's easier than trying to split the squares apart.)
+		if (n == 0 || tileEdges[n-1].i != i || tileEdges[n-1].j != j)
+		{
+			CFixedVector2D v0 = CFixedVector2D(fixed::FromInt(i * (int)TERRAIN_TILE_SIZE) - r, fixed::FromInt(j * (int)TERRAIN_TILE_SIZE) - r);
+			CFixedVector2D v1 = CFixedVector2D(fixed::FromInt((i+1) * (int)TERRAIN_TILE_SIZE) + r, fixed::FromInt((j+1) * (int)TERRAIN_TILE_SIZE) + r);
+			Edge e = { v0, v1 };
+			edgesAA.push_back(e);
+		}
+
+		// TODO: for efficiency (minimising the A* search space), we should coalesce adjoining edges
+
+		// Add the tile outer edge to the search vertex lists
 		CFixedVector2D v0, v1;
 		Vertex vert;
 		vert.status = Vertex::UNEXPLORED;
@@ -443,68 +519,266 @@ static void AddTerrainEdges(std::vector<Edge>& edgesAA, std::vector<Vertex>& ver
 	}
 }
 
-static void SplitAAEdges(CFixedVector2D a,
-		const std::vector<Edge>& edgesAA,
-		std::vector<EdgeAA>& edgesLeft, std::vector<EdgeAA>& edgesRight,
-		std::vector<EdgeAA>& edgesBottom, std::vector<EdgeAA>& edgesTop)
+static void AddTerrainEdges(std::vector<Edge>& edgesAA, std::vector<Vertex>& vertexes,
+	u16 i0, u16 j0, u16 i1, u16 j1, fixed r,
+	ICmpPathfinder::pass_class_t passClass, const Grid<TerrainTile>& terrain)
 {
-	edgesLeft.reserve(edgesAA.size());
-	edgesRight.reserve(edgesAA.size());
-	edgesBottom.reserve(edgesAA.size());
-	edgesTop.reserve(edgesAA.size());
+	PROFILE("AddTerrainEdges");
 
+	std::vector<TileEdge> tileEdges;
+	ComputeTileEdges(tileEdges, i0, j0, i1, j1, passClass, terrain);
+	AddTileEdges(edgesAA, vertexes, tileEdges, i0, j0, i1, j1, r);
+}
+
+/**
+ * Add the collision edges and search vertexes for an obstruction square,
+ * expanded by the unit radius @p r.
+ */
+static void AddObstructionSquare(std::vector<Edge>& edges, std::vector<Edge>& edgesAA, std::vector<Vertex>& vertexes,
+	const ICmpObstructionManager::ObstructionSquare& square, fixed r)
+{
+	CFixedVector2D center(square.x, square.z);
+	CFixedVector2D u = square.u;
+	CFixedVector2D v = square.v;
+
+	// Expand the vertexes by the moving unit's collision radius, to find the
+	// closest we can get to it
+
+	CFixedVector2D hd0(square.hw + r + EDGE_EXPAND_DELTA, square.hh + r + EDGE_EXPAND_DELTA);
+	CFixedVector2D hd1(square.hw + r + EDGE_EXPAND_DELTA, -(square.hh + r + EDGE_EXPAND_DELTA));
+
+	// Check whether this is an axis-aligned square
+	bool aa = (u.X == fixed::FromInt(1) && u.Y == fixed::Zero() && v.X == fixed::Zero() && v.Y == fixed::FromInt(1));
+
+	Vertex vert;
+	vert.status = Vertex::UNEXPLORED;
+	vert.quadInward = QUADRANT_NONE;
+	vert.quadOutward = QUADRANT_ALL;
+	vert.p.X = center.X - hd0.Dot(u); vert.p.Y = center.Y + hd0.Dot(v); if (aa) vert.quadInward = QUADRANT_BR; vertexes.push_back(vert);
+	vert.p.X = center.X - hd1.Dot(u); vert.p.Y = center.Y + hd1.Dot(v); if (aa) vert.quadInward = QUADRANT_TR; vertexes.push_back(vert);
+	vert.p.X = center.X + hd0.Dot(u); vert.p.Y = center.Y - hd0.Dot(v); if (aa) vert.quadInward = QUADRANT_TL; vertexes.push_back(vert);
+	vert.p.X = center.X + hd1.Dot(u); vert.p.Y = center.Y - hd1.Dot(v); if (aa) vert.quadInward = QUADRANT_BL; vertexes.push_back(vert);
+
+	// Add the edges:
+
+	CFixedVector2D h0(square.hw + r, square.hh + r);
+	CFixedVector2D h1(square.hw + r, -(square.hh + r));
+
+	CFixedVector2D ev0(center.X - h0.Dot(u), center.Y + h0.Dot(v));
+	CFixedVector2D ev1(center.X - h1.Dot(u), center.Y + h1.Dot(v));
+	CFixedVector2D ev2(center.X + h0.Dot(u), center.Y - h0.Dot(v));
+	CFixedVector2D ev3(center.X + h1.Dot(u), center.Y - h1.Dot(v));
+	if (aa)
+	{
+		Edge e = { ev1, ev3 };
+		edgesAA.push_back(e);
+	}
+	else
+	{
+		Edge e0 = { ev0, ev1 };
+		Edge e1 = { ev1, ev2 };
+		Edge e2 = { ev2, ev3 };
+		Edge e3 = { ev3, ev0 };
+		edges.push_back(e0);
+		edges.push_back(e1);
+		edges.push_back(e2);
+		edges.push_back(e3);
+	}
+}
+
+/**
+ * Remove the vertexes (except the first @p numFixed) and edges that lie entirely
+ * outside the search range. The range boundary edges stop paths leaving the range,
+ * so those vertexes can never be reached and those edges can never block a path.
+ */
+static void ClipToRange(std::vector<Edge>& edges, std::vector<Edge>& edgesAA, std::vector<Vertex>& vertexes, size_t numFixed,
+	fixed rangeXMin, fixed rangeZMin, fixed rangeXMax, fixed rangeZMax)
+{
+	size_t n = numFixed;
+	for (size_t i = numFixed; i < vertexes.size(); ++i)
+	{
+		const CFixedVector2D& p = vertexes[i].p;
+		if (p.X < rangeXMin || p.X > rangeXMax || p.Y < rangeZMin || p.Y > rangeZMax)
+			continue;
+		vertexes[n++] = vertexes[i];
+	}
+	vertexes.resize(n);
+
+	n = 0;
 	for (size_t i = 0; i < edgesAA.size(); ++i)
 	{
-		if (a.X <= edgesAA[i].p0.X)
-		{
-			EdgeAA e = { edgesAA[i].p0, edgesAA[i].p1.Y };
-			edgesLeft.push_back(e);
-		}
-		if (a.X >= edgesAA[i].p1.X)
-		{
-			EdgeAA e = { edgesAA[i].p1, edgesAA[i].p0.Y };
-			edgesRight.push_back(e);
-		}
-		if (a.Y <= edgesAA[i].p0.Y)
-		{
-			EdgeAA e = { edgesAA[i].p0, edgesAA[i].p1.X };
-			edgesBottom.push_back(e);
-		}
-		if (a.Y >= edgesAA[i].p1.Y)
-		{
-			EdgeAA e = { edgesAA[i].p1, edgesAA[i].p0.X };
-			edgesTop.push_back(e);
-		}
+		if (edgesAA[i].p1.X < rangeXMin || edgesAA[i].p0.X > rangeXMax || edgesAA[i].p1.Y < rangeZMin || edgesAA[i].p0.Y > rangeZMax)
+			continue;
+		edgesAA[n++] = edgesAA[i];
+	}
+	edgesAA.resize(n);
+
+	n = 0;
+	for (size_t i = 0; i < edges.size(); ++i)
+	{
+		const CFixedVector2D& p0 = edges[i].p0;
+		const CFixedVector2D& p1 = edges[i].p1;
+		if ((p0.X < rangeXMin && p1.X < rangeXMin) || (p0.X > rangeXMax && p1.X > rangeXMax) ||
+			(p0.Y < rangeZMin && p1.Y < rangeZMin) || (p0.Y > rangeZMax && p1.Y > rangeZMax))
+			continue;
+		edges[n++] = edges[i];
 	}
+	edges.resize(n);
 }
 
 /**
- * Functor for sorting edges by approximate proximity to a fixed point.
+ * Functor for sorting static shapes by tag.
  */
-struct EdgeSort
+struct StaticShapeTagSort
 {
-	CFixedVector2D src;
-	EdgeSort(CFixedVector2D src) : src(src) { }
-	bool operator()(const Edge& a, const Edge& b)
+	bool operator()(const ShortPathStaticChunk::Shape* a, const ShortPathStaticChunk::Shape* b) const
 	{
-		if ((a.p0 - src).CompareLength(b.p0 - src) < 0)
-			return true;
-		return false;
+		return a->data.tag.n < b->data.tag.n;
 	}
 };
 
+/**
+ * Marks the chunks overlapping the given tiles (expanded by @p border tiles) as invalid.
+ */
+template<typename T>
+static void InvalidateShortPathChunks(std::vector<T>& chunks, u16 chunksW, const GridUpdateInformation& changed, int border)
+{
+	if (!changed.dirty)
+		return;
+
+	if (changed.globallyDirty)
+	{
+		for (size_t n = 0; n < chunks.size(); ++n)
+			chunks[n].valid = false;
+		return;
+	}
+
+	const int chunkSize = HierarchicalPathfinder::CHUNK_SIZE;
+	int ci0 = std::max((int)changed.i0 - border, 0) / chunkSize;
+	int cj0 = std::max((int)changed.j0 - border, 0) / chunkSize;
+	int ci1 = std::min(((int)changed.i1 + border) / chunkSize, chunksW - 1);
+	int cj1 = std::min(((int)changed.j1 + border) / chunkSize, chunksW - 1);
+
+	for (int cj = cj0; cj <= cj1; ++cj)
+		for (int ci = ci0; ci <= ci1; ++ci)
+			chunks[ci + cj*chunksW].valid = false;
+}
+
+void CCmpPathfinder::UpdateShortPathCache()
+{
+	if (!m_Grid)
+		return;
+
+	const u16 chunkSize = HierarchicalPathfinder::CHUNK_SIZE;
+	u16 chunksW = (u16)((m_MapSize + chunkSize - 1) / chunkSize);
+
+	CmpPtr<ICmpObstructionManager> cmpObstructionManager(GetSimContext(), SYSTEM_ENTITY);
+	GridUpdateInformation staticChanges = cmpObstructionManager->GetStaticShapeChanges(m_ShortPathStaticDirtyID);
+
+	GridUpdateInformation gridChanges = m_GridHistory.GetChangesSince(m_ShortPathGridDirtyID, m_Grid->m_DirtyID);
+	m_ShortPathGridDirtyID = m_Grid->m_DirtyID;
+
+	if (chunksW != m_ShortPathChunksW)
+	{
+		m_ShortPathChunksW = chunksW;
+
+		ShortPathStaticChunk emptyChunk;
+		emptyChunk.valid = false;
+		m_ShortPathStaticChunks.assign(chunksW*chunksW, emptyChunk);
+		m_ShortPathTerrainChunks.clear();
+		return;
+	}
+
+	InvalidateShortPathChunks(m_ShortPathStaticChunks, chunksW, staticChanges, 0);
+
+	// Terrain edges also depend on the passability of the neighbouring tiles
+	for (std::map<pass_class_t, std::vector<ShortPathTerrainChunk> >::iterator it = m_ShortPathTerrainChunks.begin(); it != m_ShortPathTerrainChunks.end(); ++it)
+		InvalidateShortPathChunks(it->second, chunksW, gridChanges, 1);
+}
+
+const ShortPathStaticChunk& CCmpPathfinder::GetShortPathStaticChunk(u16 ci, u16 cj)
+{
+	CScopeLock lock(m_ShortPathCacheMutex);
+
+	ShortPathStaticChunk& chunk = m_ShortPathStaticChunks[ci + cj*m_ShortPathChunksW];
+	if (chunk.valid)
+		return chunk;
+
+	const int chunkSize = HierarchicalPathfinder::CHUNK_SIZE * (int)TERRAIN_TILE_SIZE;
+
+	std::vector<ICmpObstructionManager::StaticShapeData> shapes;
+	CmpPtr<ICmpObstructionManager> cmpObstructionManager(GetSimContext(), SYSTEM_ENTITY);
+	cmpObstructionManager->GetStaticShapesInRange(
+		entity_pos_t::FromInt(ci * chunkSize), entity_pos_t::FromInt(cj * chunkSize),
+		entity_pos_t::FromInt((ci+1) * chunkSize), entity_pos_t::FromInt((cj+1) * chunkSize), shapes);
+
+	chunk.shapes.clear();
+	chunk.shapes.reserve(shapes.size());
+	for (size_t i = 0; i < shapes.size(); ++i)
+	{
+		const ICmpObstructionManager::ObstructionSquare& square = shapes[i].square;
+		ShortPathStaticChunk::Shape shape;
+		shape.data = shapes[i];
+		shape.bbHalfSize = Geometry::GetHalfBoundingBox(square.u, square.v, CFixedVector2D(square.hw, square.hh));
+		chunk.shapes.push_back(shape);
+	}
+
+	chunk.valid = true;
+	return chunk;
+}
+
+const ShortPathTerrainChunk& CCmpPathfinder::GetShortPathTerrainChunk(u16 ci, u16 cj, pass_class_t passClass)
+{
+	CScopeLock lock(m_ShortPathCacheMutex);
+
+	std::vector<ShortPathTerrainChunk>& chunks = m_ShortPathTerrainChunks[passClass];
+	if (chunks.empty())
+	{
+		ShortPathTerrainChunk emptyChunk;
+		emptyChunk.valid = false;
+		chunks.resize(m_ShortPathChunksW*m_ShortPathChunksW, emptyChunk);
+	}
+
+	ShortPathTerrainChunk& chunk = chunks[ci + cj*m_ShortPathChunksW];
+	if (chunk.valid)
+		return chunk;
+
+	const int chunkSize = HierarchicalPathfinder::CHUNK_SIZE;
+	u16 i0 = (u16)(ci * chunkSize);
+	u16 j0 = (u16)(cj * chunkSize);
+	u16 i1 = (u16)(std::min((ci+1) * chunkSize, (int)m_MapSize) - 1);
+	u16 j1 = (u16)(std::min((cj+1) * chunkSize, (int)m_MapSize) - 1);
+
+	chunk.edges.clear();
+	ComputeTileEdges(chunk.edges, i0, j0, i1, j1, passClass, *m_Grid);
+
+	chunk.valid = true;
+	return chunk;
+}
+
 void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 	entity_pos_t x0, entity_pos_t z0, entity_pos_t r,
 	entity_pos_t range, const Goal& goal, pass_class_t passClass, Path& path)
 {
 	UpdateGrid(); // TODO: only need to bother updating if the terrain changed
+	UpdateShortPathCache();
+
+	ComputeShortPathImpl(filter, x0, z0, r, range, goal, passClass, path, true);
+}
 
+void CCmpPathfinder::ComputeShortPathImpl(const IObstructionTestFilter& filter,
+	entity_pos_t x0, entity_pos_t z0, entity_pos_t r,
+	entity_pos_t range, const Goal& goal, pass_class_t passClass, Path& path, bool allowDebug)
+{
 	PROFILE3("ComputeShortPath");
 //	ScopeTimer UID__(L"ComputeShortPath");
 
-	m_DebugOverlayShortPathLines.clear();
+	const bool debugOverlay = (allowDebug && m_DebugOverlay);
 
-	if (m_DebugOverlay)
+	if (allowDebug)
+		m_DebugOverlayShortPathLines.clear();
+
+	if (debugOverlay)
 	{
 		// Render the goal shape
 		m_DebugOverlayShortPathLines.push_back(SOverlayLine());
@@ -571,81 +845,92 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 	vertexes.push_back(end);
 	const size_t GOAL_VERTEX_ID = 1;
 
-	// Add terrain obstructions
+	// Add terrain obstructions, from the cached edges of the chunks the range covers
 	{
+		PROFILE("AddTerrainEdges");
+
 		u16 i0, j0, i1, j1;
 		NearestTile(rangeXMin, rangeZMin, i0, j0);
 		NearestTile(rangeXMax, rangeZMax, i1, j1);
-		AddTerrainEdges(edgesAA, vertexes, i0, j0, i1, j1, r, passClass, *m_Grid);
+
+		const u16 chunkSize = HierarchicalPathfinder::CHUNK_SIZE;
+		for (u16 cj = j0 / chunkSize; cj <= j1 / chunkSize; ++cj)
+		{
+			for (u16 ci = i0 / chunkSize; ci <= i1 / chunkSize; ++ci)
+			{
+				const ShortPathTerrainChunk& chunk = GetShortPathTerrainChunk(ci, cj, passClass);
+				AddTileEdges(edgesAA, vertexes, chunk.edges, i0, j0, i1, j1, r);
+			}
+		}
 	}
 
-	// Find all the obstruction squares that might affect us
+	// Find all the unit obstruction squares that might affect us
 	CmpPtr<ICmpObstructionManager> cmpObstructionManager(GetSimContext(), SYSTEM_ENTITY);
 	std::vector<ICmpObstructionManager::ObstructionSquare> squares;
-	cmpObstructionManager->GetObstructionsInRange(filter, rangeXMin - r, rangeZMin - r, rangeXMax + r, rangeZMax + r, squares);
+	cmpObstructionManager->GetUnitObstructionsInRange(filter, rangeXMin - r, rangeZMin - r, rangeXMax + r, rangeZMax + r, squares);
 
-	// Resize arrays to reduce reallocations
-	vertexes.reserve(vertexes.size() + squares.size()*4);
-	edgesAA.reserve(edgesAA.size() + squares.size()); // (assume most squares are AA)
-
-	// Convert each obstruction square into collision edges and search graph vertexes
-	for (size_t i = 0; i < squares.size(); ++i)
+	// Find the cached static shapes that might affect us. Expanding a rotated shape
+	// by r can grow its bounding box by up to r*sqrt(2), so allow a margin of 2r
+	std::vector<const ShortPathStaticChunk::Shape*> staticShapes;
 	{
-		CFixedVector2D center(squares[i].x, squares[i].z);
-		CFixedVector2D u = squares[i].u;
-		CFixedVector2D v = squares[i].v;
-
-		// Expand the vertexes by the moving unit's collision radius, to find the
-		// closest we can get to it
-
-		CFixedVector2D hd0(squares[i].hw + r + EDGE_EXPAND_DELTA, squares[i].hh + r + EDGE_EXPAND_DELTA);
-		CFixedVector2D hd1(squares[i].hw + r + EDGE_EXPAND_DELTA, -(squares[i].hh + r + EDGE_EXPAND_DELTA));
+		CFixedVector2D shapesMin(rangeXMin - r*2, rangeZMin - r*2);
+		CFixedVector2D shapesMax(rangeXMax + r*2, rangeZMax + r*2);
 
-		// Check whether this is an axis-aligned square
-		bool aa = (u.X == fixed::FromInt(1) && u.Y == fixed::Zero() && v.X == fixed::Zero() && v.Y == fixed::FromInt(1));
+		u16 i0, j0, i1, j1;
+		NearestTile(shapesMin.X, shapesMin.Y, i0, j0);
+		NearestTile(shapesMax.X, shapesMax.Y, i1, j1);
 
-		Vertex vert;
-		vert.status = Vertex::UNEXPLORED;
-		vert.quadInward = QUADRANT_NONE;
-		vert.quadOutward = QUADRANT_ALL;
-		vert.p.X = center.X - hd0.Dot(u); vert.p.Y = center.Y + hd0.Dot(v); if (aa) vert.quadInward = QUADRANT_BR; vertexes.push_back(vert);
-		vert.p.X = center.X - hd1.Dot(u); vert.p.Y = center.Y + hd1.Dot(v); if (aa) vert.quadInward = QUADRANT_TR; vertexes.push_back(vert);
-		vert.p.X = center.X + hd0.Dot(u); vert.p.Y = center.Y - hd0.Dot(v); if (aa) vert.quadInward = QUADRANT_TL; vertexes.push_back(vert);
-		vert.p.X = center.X + hd1.Dot(u); vert.p.Y = center.Y - hd1.Dot(v); if (aa) vert.quadInward = QUADRANT_BL; vertexes.push_back(vert);
+		const u16 chunkSize = HierarchicalPathfinder::CHUNK_SIZE;
+		for (u16 cj = j0 / chunkSize; cj <= j1 / chunkSize; ++cj)
+		{
+			for (u16 ci = i0 / chunkSize; ci <= i1 / chunkSize; ++ci)
+			{
+				const ShortPathStaticChunk& chunk = GetShortPathStaticChunk(ci, cj);
+				for (size_t n = 0; n < chunk.shapes.size(); ++n)
+				{
+					const ShortPathStaticChunk::Shape& shape = chunk.shapes[n];
+					const ICmpObstructionManager::StaticShapeData& data = shape.data;
 
-		// Add the edges:
+					CFixedVector2D center(data.square.x, data.square.z);
+					if (center.X + shape.bbHalfSize.X < shapesMin.X || center.X - shape.bbHalfSize.X > shapesMax.X ||
+						center.Y + shape.bbHalfSize.Y < shapesMin.Y || center.Y - shape.bbHalfSize.Y > shapesMax.Y)
+						continue;
 
-		CFixedVector2D h0(squares[i].hw + r, squares[i].hh + r);
-		CFixedVector2D h1(squares[i].hw + r, -(squares[i].hh + r));
+					if (!filter.TestShape(data.tag, data.flags, data.group, data.group2))
+						continue;
 
-		CFixedVector2D ev0(center.X - h0.Dot(u), center.Y + h0.Dot(v));
-		CFixedVector2D ev1(center.X - h1.Dot(u), center.Y + h1.Dot(v));
-		CFixedVector2D ev2(center.X + h0.Dot(u), center.Y - h0.Dot(v));
-		CFixedVector2D ev3(center.X + h1.Dot(u), center.Y - h1.Dot(v));
-		if (aa)
-		{
-			Edge e = { ev1, ev3 };
-			edgesAA.push_back(e);
-		}
-		else
-		{
-			Edge e0 = { ev0, ev1 };
-			Edge e1 = { ev1, ev2 };
-			Edge e2 = { ev2, ev3 };
-			Edge e3 = { ev3, ev0 };
-			edges.push_back(e0);
-			edges.push_back(e1);
-			edges.push_back(e2);
-			edges.push_back(e3);
+					staticShapes.push_back(&shape);
+				}
+			}
 		}
 
-		// TODO: should clip out vertexes and edges that are outside the range,
-		// to reduce the search space
+		// Shapes may overlap several chunks, so remove the duplicates (and use a
+		// consistent order, since it can affect the chosen path)
+		std::sort(staticShapes.begin(), staticShapes.end(), StaticShapeTagSort());
+		size_t numUnique = 0;
+		for (size_t n = 0; n < staticShapes.size(); ++n)
+			if (numUnique == 0 || staticShapes[numUnique-1]->data.tag.n != staticShapes[n]->data.tag.n)
+				staticShapes[numUnique++] = staticShapes[n];
+		staticShapes.resize(numUnique);
 	}
 
+	// Resize arrays to reduce reallocations
+	vertexes.reserve(vertexes.size() + (squares.size() + staticShapes.size())*4);
+	edgesAA.reserve(edgesAA.size() + squares.size() + staticShapes.size()); // (assume most squares are AA)
+
+	// Convert each obstruction square into collision edges and search graph vertexes
+	for (size_t i = 0; i < squares.size(); ++i)
+		AddObstructionSquare(edges, edgesAA, vertexes, squares[i], r);
+
+	for (size_t i = 0; i < staticShapes.size(); ++i)
+		AddObstructionSquare(edges, edgesAA, vertexes, staticShapes[i]->data.square, r);
+
+	// Clip out vertexes and edges that are outside the range, to reduce the search space
+	ClipToRange(edges, edgesAA, vertexes, GOAL_VERTEX_ID + 1, rangeXMin, rangeZMin, rangeXMax, rangeZMax);
+
 	ENSURE(vertexes.size() < 65536); // we store array indexes as u16
 
-	if (m_DebugOverlay)
+	if (debugOverlay)
 	{
 		// Render the obstruction edges
 		for (size_t i = 0; i < edges.size(); ++i)
@@ -692,6 +977,11 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 
 	PROFILE_START("A*");
 
+	// Index the axis-aligned edges once, so each visibility check only
+	// needs to look at the edges between its two points
+	EdgeAAIndex edgesAAIndex;
+	BuildEdgeAAIndex(edgesAA, edgesAAIndex);
+
 	PriorityQueue open;
 	PriorityQueue::Item qiStart = { START_VERTEX_ID, start.h };
 	open.push(qiStart);
@@ -712,15 +1002,10 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 			break;
 		}
 
-		// Sort the edges so ones nearer this vertex are checked first by CheckVisibility,
-		// since they're more likely to block the rays
-		std::sort(edgesAA.begin(), edgesAA.end(), EdgeSort(vertexes[curr.id].p));
-
-		std::vector<EdgeAA> edgesLeft;
-		std::vector<EdgeAA> edgesRight;
-		std::vector<EdgeAA> edgesBottom;
-		std::vector<EdgeAA> edgesTop;
-		SplitAAEdges(vertexes[curr.id].p, edgesAA, edgesLeft, edgesRight, edgesBottom, edgesTop);
+		// Find the axis-aligned edges this vertex is in front of. (They're sorted
+		// so ones nearer this vertex are checked first, since they're more likely
+		// to block the rays.)
+		EdgeAAStart edgesAAStart = FindEdgeAAStart(vertexes[curr.id].p, edgesAAIndex);
 
 		// Check the lines to every other vertex
 		for (size_t n = 0; n < vertexes.size(); ++n)
@@ -764,10 +1049,7 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 			}
 
 			bool visible =
-				CheckVisibilityLeft(vertexes[curr.id].p, npos, edgesLeft) &&
-				CheckVisibilityRight(vertexes[curr.id].p, npos, edgesRight) &&
-				CheckVisibilityBottom(vertexes[curr.id].p, npos, edgesBottom) &&
-				CheckVisibilityTop(vertexes[curr.id].p, npos, edgesTop) &&
+				CheckVisibilityAA(vertexes[curr.id].p, npos, edgesAAIndex, edgesAAStart) &&
 				CheckVisibility(vertexes[curr.id].p, npos, edges);
 
 			/*
@@ -878,17 +1160,8 @@ bool CCmpPathfinder::CheckMovement(const IObstructionTestFilter& filter,
 	CFixedVector2D a(x0, z0);
 	CFixedVector2D b(x1, z1);
 
-	std::vector<EdgeAA> edgesLeft;
-	std::vector<EdgeAA> edgesRight;
-	std::vector<EdgeAA> edgesBottom;
-	std::vector<EdgeAA> edgesTop;
-	SplitAAEdges(a, edgesAA, edgesLeft, edgesRight, edgesBottom, edgesTop);
-
-	bool visible =
-		CheckVisibilityLeft(a, b, edgesLeft) &&
-		CheckVisibilityRight(a, b, edgesRight) &&
-		CheckVisibilityBottom(a, b, edgesBottom) &&
-		CheckVisibilityTop(a, b, edgesTop);
+	EdgeAAIndex edgesAAIndex;
+	BuildEdgeAAIndex(edgesAA, edgesAAIndex);
 
-	return visible;
+	return CheckVisibilityAA(a, b, edgesAAIndex, FindEdgeAAStart(a, edgesAAIndex));
 }
@@ -24,6 +24,7 @@
 #include "simulation2/components/ICmpPosition.h"
 #include "simulation2/components/ICmpTerritoryManager.h"
 #include "simulation2/components/ICmpVision.h"
+#include "simulation2/helpers/EntityMap.h"
 #include "simulation2/helpers/Render.h"
 #include "simulation2/helpers/Spatial.h"
 
@@ -36,6 +37,12 @@
 #include "ps/Profile.h"
 #include "renderer/Scene.h"
 
+#include <deque>
+
+#if HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 #define DEBUG_RANGE_MANAGER_BOUNDS 0
 
 /**
@@ -149,27 +156,70 @@ struct SerializeEntityData
  */
 struct EntityDistanceOrdering
 {
-	EntityDistanceOrdering(const std::map<entity_id_t, EntityData>& entities, const CFixedVector2D& source) :
+	EntityDistanceOrdering(const EntityMap<EntityData>& entities, const CFixedVector2D& source) :
 		m_EntityData(entities), m_Source(source)
 	{
 	}
 
 	bool operator()(entity_id_t a, entity_id_t b)
 	{
-		const EntityData& da = m_EntityData.find(a)->second;
-		const EntityData& db = m_EntityData.find(b)->second;
+		const EntityData& da = *m_EntityData.get(a);
+		const EntityData& db = *m_EntityData.get(b);
 		CFixedVector2D vecA = CFixedVector2D(da.x, da.z) - m_Source;
 		CFixedVector2D vecB = CFixedVector2D(db.x, db.z) - m_Source;
 		return (vecA.CompareLength(vecB) < 0);
 	}
 
-	const std::map<entity_id_t, EntityData>& m_EntityData;
+	const EntityMap<EntityData>& m_EntityData;
 	CFixedVector2D m_Source;
 
 private:
 	EntityDistanceOrdering& operator=(const EntityDistanceOrdering&);
 };
 
+/**
+ * An enabled active query, with the data needed to batch it with other
+ * queries in ExecuteActiveQueries.
+ */
+struct ActiveQueryItem
+{
+	ICmpRangeManager::tag_t tag;
+	Query* query;
+	CFixedVector2D pos; // position of the query source
+	u64 key; // identifies the subdivisions covered by the query
+	size_t order; // index in tag order
+
+	static bool CompareKey(const ActiveQueryItem& a, const ActiveQueryItem& b)
+	{
+		if (a.key != b.key)
+			return a.key < b.key;
+		return a.order < b.order;
+	}
+};
+
+/**
+ * Functor for sorting queued range update messages back into tag order.
+ */
+struct MessageOrdering
+{
+	typedef std::vector<std::pair<size_t, std::pair<entity_id_t, CMessageRangeUpdate> > > messages_t;
+
+	MessageOrdering(const messages_t& messages) :
+		m_Messages(messages)
+	{
+	}
+
+	bool operator()(size_t a, size_t b)
+	{
+		return m_Messages[a].first < m_Messages[b].first;
+	}
+
+	const messages_t& m_Messages;
+
+private:
+	MessageOrdering& operator=(const MessageOrdering&);
+};
+
 /**
  * Range manager implementation.
  * Maintains a list of all entities (and their positions and owners), which is used for
@@ -210,7 +260,7 @@ public:
 	// Range query state:
 	tag_t m_QueryNext; // next allocated id
 	std::map<tag_t, Query> m_Queries;
-	std::map<entity_id_t, EntityData> m_EntityData;
+	EntityMap<EntityData> m_EntityData; // dense table indexed by entity ID
 	SpatialSubdivision<entity_id_t> m_Subdivision; // spatial index of m_EntityData
 
 	// LOS state:
@@ -242,6 +292,29 @@ public:
 	u32 m_TotalInworldVertices;
 	std::vector<u32> m_ExploredVertices;
 
+	// Inclusive bounds of vertexes whose LOS state has changed, so renderers can
+	// update only those parts (not serialized)
+	struct SLosDirtyRect
+	{
+		i32 i0, j0, i1, j1; // empty if i0 > i1
+	};
+	SLosDirtyRect m_LosDirtyCurrent; // changes since the last rect was added to m_LosDirtyHistory
+	std::deque<SLosDirtyRect> m_LosDirtyHistory; // most recent turns' rects, the last with ID m_LosDirtyID
+	size_t m_LosDirtyID;
+	static const size_t MAX_LOS_DIRTY_HISTORY = 16;
+
+	// Scratch buffers for ExecuteActiveQueries, kept to avoid reallocating them
+	// every turn (not serialized)
+	std::vector<ActiveQueryItem> m_ActiveQueryItems;
+	std::vector<entity_id_t> m_QueryResultScratch;
+	std::vector<size_t> m_MessageOrderScratch;
+	std::vector<entity_id_t> m_CandidateIds;
+	std::vector<entity_id_t> m_NearScratch;
+	std::vector<i32> m_CandidateX;
+	std::vector<i32> m_CandidateZ;
+	std::vector<u32> m_CandidateOwnerMask;
+	std::vector<u8> m_CandidateFlags;
+
 	static std::string GetSchema()
 	{
 		return "<a:component type='system'/><empty/>";
@@ -272,6 +345,10 @@ public:
 		m_TerrainVerticesPerSide = 0;
 
 		m_TerritoriesDirtyID = 0;
+
+		m_LosDirtyCurrent.i0 = m_LosDirtyCurrent.j0 = 0;
+		m_LosDirtyCurrent.i1 = m_LosDirtyCurrent.j1 = -1;
+		m_LosDirtyID = 1;
 	}
 
 	virtual void Deinit()
@@ -288,7 +365,7 @@ public:
 
 		serialize.NumberU32_Unbounded("query next", m_QueryNext);
 		SerializeMap<SerializeU32_Unbounded, SerializeQuery>()(serialize, "queries", m_Queries);
-		SerializeMap<SerializeU32_Unbounded, SerializeEntityData>()(serialize, "entity data", m_EntityData);
+		SerializeEntityMap<SerializeEntityData>()(serialize, "entity data", m_EntityData);
 
 		SerializeMap<SerializeI32_Unbounded, SerializeBool>()(serialize, "los reveal all", m_LosRevealAll);
 		serialize.Bool("los circular", m_LosCircular);
@@ -359,7 +436,7 @@ public:
 			const CMessagePositionChanged& msgData = static_cast<const CMessagePositionChanged&> (msg);
 			entity_id_t ent = msgData.entity;
 
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+			EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
@@ -406,7 +483,7 @@ public:
 			const CMessageOwnershipChanged& msgData = static_cast<const CMessageOwnershipChanged&> (msg);
 			entity_id_t ent = msgData.entity;
 
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+			EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
@@ -429,7 +506,7 @@ public:
 			const CMessageDestroy& msgData = static_cast<const CMessageDestroy&> (msg);
 			entity_id_t ent = msgData.entity;
 
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+			EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
@@ -451,7 +528,7 @@ public:
 			const CMessageVisionRangeChanged& msgData = static_cast<const CMessageVisionRangeChanged&> (msg);
 			entity_id_t ent = msgData.entity;
 
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+			EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
@@ -482,6 +559,7 @@ public:
 			m_DebugOverlayDirty = true;
 			UpdateTerritoriesLos();
 			ExecuteActiveQueries();
+			CloseLosDirtyRect();
 			break;
 		}
 		case MT_RenderSubmit:
@@ -576,7 +654,9 @@ public:
 		m_LosStateRevealed.clear();
 		m_LosStateRevealed.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
 
-		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
+		MarkLosDirtyAll();
+
+		for (EntityMap<EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 		{
 			if (it->second.inWorld)
 				LosAdd(it->second.owner, it->second.visionRange, CFixedVector2D(it->second.x, it->second.z));
@@ -602,7 +682,7 @@ public:
 		// (TODO: find the optimal number instead of blindly guessing)
 		m_Subdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
 
-		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
+		for (EntityMap<EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 		{
 			if (it->second.inWorld)
 				m_Subdivision.Add(it->first, CFixedVector2D(it->second.x, it->second.z));
@@ -723,7 +803,7 @@ public:
 
 		u32 ownerMask = CalcOwnerMask(player);
 
-		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
+		for (EntityMap<EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 		{
 			// Check owner and add to list if it matches
 			if (CalcOwnerMask(it->second.owner) & ownerMask)
@@ -743,15 +823,20 @@ public:
 
 	/**
 	 * Update all currently-enabled active queries.
+	 *
+	 * Queries are evaluated in batches: all queries whose range covers the same set
+	 * of subdivisions (typically units and buildings standing close together with
+	 * the same range) share a single GetNear call, and the candidates' data is
+	 * copied once into flat arrays that each query in the batch then scans.
+	 * The resulting messages are still sent in tag order.
 	 */
 	void ExecuteActiveQueries()
 	{
 		PROFILE3("ExecuteActiveQueries");
 
-		// Store a queue of all messages before sending any, so we can assume
-		// no entities will move until we've finished checking all the ranges
-		std::vector<std::pair<entity_id_t, CMessageRangeUpdate> > messages;
-
+		// Gather the queries that need evaluating
+		std::vector<ActiveQueryItem>& items = m_ActiveQueryItems;
+		items.clear();
 		for (std::map<tag_t, Query>::iterator it = m_Queries.begin(); it != m_Queries.end(); ++it)
 		{
 			Query& q = it->second;
@@ -763,34 +848,150 @@ public:
 			if (!cmpSourcePosition || !cmpSourcePosition->IsInWorld())
 				continue;
 
-			std::vector<entity_id_t> r;
-			r.reserve(q.lastMatch.size());
+			ActiveQueryItem item;
+			item.tag = it->first;
+			item.query = &q;
+			item.pos = cmpSourcePosition->GetPosition2D();
+			// Queries with unlimited range can't share candidates, so give them their own batch
+			if (q.maxRange == entity_pos_t::FromInt(-1))
+				item.key = std::numeric_limits<u64>::max();
+			else
+				item.key = m_Subdivision.GetNearKey(item.pos, q.maxRange);
+			item.order = items.size();
+			items.push_back(item);
+		}
 
-			PerformQuery(q, r);
+		// Group queries with the same candidate set together
+		std::sort(items.begin(), items.end(), ActiveQueryItem::CompareKey);
 
-			// Compute the changes vs the last match
-			std::vector<entity_id_t> added;
-			std::vector<entity_id_t> removed;
-			std::set_difference(r.begin(), r.end(), q.lastMatch.begin(), q.lastMatch.end(), std::back_inserter(added));
-			std::set_difference(q.lastMatch.begin(), q.lastMatch.end(), r.begin(), r.end(), std::back_inserter(removed));
+		// Store a queue of all messages before sending any, so we can assume
+		// no entities will move until we've finished checking all the ranges
+		std::vector<std::pair<size_t, std::pair<entity_id_t, CMessageRangeUpdate> > > messages;
 
-			if (added.empty() && removed.empty())
-				continue;
+		std::vector<entity_id_t>& r = m_QueryResultScratch;
+		std::vector<entity_id_t> added;
+		std::vector<entity_id_t> removed;
 
-			// Return the 'added' list sorted by distance from the entity
-			// (Don't bother sorting 'removed' because they might not even have positions or exist any more)
-			CFixedVector2D pos = cmpSourcePosition->GetPosition2D();
-			std::stable_sort(added.begin(), added.end(), EntityDistanceOrdering(m_EntityData, pos));
+		for (size_t batchStart = 0; batchStart < items.size(); )
+		{
+			size_t batchEnd = batchStart + 1;
+			while (batchEnd < items.size() && items[batchEnd].key == items[batchStart].key)
+				++batchEnd;
+
+			bool batched = (items[batchStart].key != std::numeric_limits<u64>::max());
+			if (batched)
+				LoadCandidates(items[batchStart].pos, items[batchStart].query->maxRange);
+
+			for (size_t n = batchStart; n < batchEnd; ++n)
+			{
+				Query& q = *items[n].query;
+
+				r.clear();
+				if (batched)
+					PerformQueryOnCandidates(q, items[n].pos, r);
+				else
+					PerformQuery(q, r);
+
+				// Compute the changes vs the last match
+				added.clear();
+				removed.clear();
+				std::set_difference(r.begin(), r.end(), q.lastMatch.begin(), q.lastMatch.end(), std::back_inserter(added));
+				std::set_difference(q.lastMatch.begin(), q.lastMatch.end(), r.begin(), r.end(), std::back_inserter(removed));
+
+				if (added.empty() && removed.empty())
+					continue;
 
-			messages.push_back(std::make_pair(q.source, CMessageRangeUpdate(it->first)));
-			messages.back().second.added.swap(added);
-			messages.back().second.removed.swap(removed);
+				// Return the 'added' list sorted by distance from the entity
+				// (Don't bother sorting 'removed' because they might not even have positions or exist any more)
+				std::stable_sort(added.begin(), added.end(), EntityDistanceOrdering(m_EntityData, items[n].pos));
 
-			it->second.lastMatch.swap(r);
+				messages.push_back(std::make_pair(items[n].order, std::make_pair(q.source, CMessageRangeUpdate(items[n].tag))));
+				messages.back().second.second.added.swap(added);
+				messages.back().second.second.removed.swap(removed);
+
+				q.lastMatch.assign(r.begin(), r.end());
+			}
+
+			batchStart = batchEnd;
 		}
 
+		// Send the messages in the same order as if the queries had been run one by one
+		std::vector<size_t>& messageOrder = m_MessageOrderScratch;
+		messageOrder.resize(messages.size());
 		for (size_t i = 0; i < messages.size(); ++i)
-			GetSimContext().GetComponentManager().PostMessage(messages[i].first, messages[i].second);
+			messageOrder[i] = i;
+		std::sort(messageOrder.begin(), messageOrder.end(), MessageOrdering(messages));
+
+		for (size_t i = 0; i < messageOrder.size(); ++i)
+			GetSimContext().GetComponentManager().PostMessage(messages[messageOrder[i]].second.first, messages[messageOrder[i]].second.second);
+	}
+
+	/**
+	 * Fetch the entities near the given point, and copy the data needed for
+	 * filtering them into the flat candidate arrays.
+	 */
+	void LoadCandidates(CFixedVector2D pos, entity_pos_t range)
+	{
+		m_Subdivision.GetNear(m_CandidateIds, pos, range);
+
+		size_t count = m_CandidateIds.size();
+		m_CandidateX.resize(count);
+		m_CandidateZ.resize(count);
+		m_CandidateOwnerMask.resize(count);
+		m_CandidateFlags.resize(count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const EntityData* entity = m_EntityData.get(m_CandidateIds[i]);
+			ENSURE(entity);
+			m_CandidateX[i] = entity->x.GetInternalValue();
+			m_CandidateZ[i] = entity->z.GetInternalValue();
+			m_CandidateOwnerMask[i] = CalcOwnerMask(entity->owner);
+			// Fold the in-world test into the flags, so no flags mask will match
+			m_CandidateFlags[i] = (entity->inWorld ? entity->flags : 0);
+		}
+	}
+
+	/**
+	 * Equivalent to PerformQuery, but tests the candidates loaded by the last
+	 * LoadCandidates call (which must have covered this query's range).
+	 * The distance tests use the same exact integer comparison as
+	 * CFixedVector2D::CompareLength.
+	 */
+	void PerformQueryOnCandidates(const Query& q, CFixedVector2D pos, std::vector<entity_id_t>& r)
+	{
+		const i64 px = pos.X.GetInternalValue();
+		const i64 pz = pos.Y.GetInternalValue();
+		const i64 maxRange = q.maxRange.GetInternalValue();
+		const i64 minRange = q.minRange.GetInternalValue();
+		const u64 maxRange2 = (u64)(maxRange * maxRange);
+		const u64 minRange2 = (u64)(minRange * minRange);
+		const bool testMin = !q.minRange.IsZero();
+
+		const size_t count = m_CandidateIds.size();
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!(m_CandidateOwnerMask[i] & q.ownersMask) || !(m_CandidateFlags[i] & q.flagsMask))
+				continue;
+
+			i64 dx = (i64)m_CandidateX[i] - px;
+			i64 dz = (i64)m_CandidateZ[i] - pz;
+			u64 d2 = (u64)(dx * dx) + (u64)(dz * dz);
+			if (d2 > maxRange2 || (testMin && d2 < minRange2))
+				continue;
+
+			entity_id_t id = m_CandidateIds[i];
+
+			// Ignore self
+			if (id == q.source)
+				continue;
+
+			// Ignore if it's missing the required interface
+			if (q.interface && !GetSimContext().GetComponentManager().QueryInterface(id, q.interface))
+				continue;
+
+			r.push_back(id);
+		}
 	}
 
 	/**
@@ -834,7 +1035,7 @@ public:
 		// Special case: range -1.0 means check all entities ignoring distance
 		if (q.maxRange == entity_pos_t::FromInt(-1))
 		{
-			for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
+			for (EntityMap<EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 			{
 				if (!TestEntityQuery(q, it->first, it->second))
 					continue;
@@ -845,29 +1046,30 @@ public:
 		else
 		{
 			// Get a quick list of entities that are potentially in range
-			std::vector<entity_id_t> ents = m_Subdivision.GetNear(pos, q.maxRange);
+			std::vector<entity_id_t>& ents = m_NearScratch;
+			m_Subdivision.GetNear(ents, pos, q.maxRange);
 
 			for (size_t i = 0; i < ents.size(); ++i)
 			{
-				std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.find(ents[i]);
-				ENSURE(it != m_EntityData.end());
+				const EntityData* entity = m_EntityData.get(ents[i]);
+				ENSURE(entity);
 
-				if (!TestEntityQuery(q, it->first, it->second))
+				if (!TestEntityQuery(q, ents[i], *entity))
 					continue;
 
 				// Restrict based on precise distance
-				int distVsMax = (CFixedVector2D(it->second.x, it->second.z) - pos).CompareLength(q.maxRange);
+				int distVsMax = (CFixedVector2D(entity->x, entity->z) - pos).CompareLength(q.maxRange);
 				if (distVsMax > 0)
 					continue;
 
 				if (!q.minRange.IsZero())
 				{
-					int distVsMin = (CFixedVector2D(it->second.x, it->second.z) - pos).CompareLength(q.minRange);
+					int distVsMin = (CFixedVector2D(entity->x, entity->z) - pos).CompareLength(q.minRange);
 					if (distVsMin < 0)
 						continue;
 				}
 
-				r.push_back(it->first);
+				r.push_back(ents[i]);
 			}
 		}
 	}
@@ -975,7 +1177,7 @@ public:
 
 	virtual void SetEntityFlag(entity_id_t ent, std::string identifier, bool value)
 	{
-		std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+		EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 		// We don't have this entity
 		if (it == m_EntityData.end())
@@ -1052,6 +1254,7 @@ public:
 	virtual void SetLosRevealAll(player_id_t player, bool enabled)
 	{
 		m_LosRevealAll[player] = enabled;
+		MarkLosDirtyAll();
 	}
 
 	virtual bool GetLosRevealAll(player_id_t player)
@@ -1086,6 +1289,82 @@ public:
 	virtual void SetSharedLos(player_id_t player, std::vector<player_id_t> players)
 	{
 		m_SharedLosMasks[player] = CalcSharedLosMask(players);
+		MarkLosDirtyAll();
+	}
+
+	virtual bool GetLosDirtyRect(size_t* dirtyID, i32& i0, i32& j0, i32& i1, i32& j1)
+	{
+		CloseLosDirtyRect();
+
+		if (*dirtyID == m_LosDirtyID)
+			return false;
+
+		if (*dirtyID > m_LosDirtyID || m_LosDirtyID - *dirtyID > m_LosDirtyHistory.size())
+		{
+			// Too old (or from before a reset), so everything might have changed
+			i0 = j0 = 0;
+			i1 = j1 = m_TerrainVerticesPerSide-1;
+		}
+		else
+		{
+			i0 = j0 = std::numeric_limits<i32>::max();
+			i1 = j1 = std::numeric_limits<i32>::min();
+			for (size_t n = m_LosDirtyHistory.size() - (m_LosDirtyID - *dirtyID); n < m_LosDirtyHistory.size(); ++n)
+			{
+				const SLosDirtyRect& rect = m_LosDirtyHistory[n];
+				i0 = std::min(i0, rect.i0);
+				j0 = std::min(j0, rect.j0);
+				i1 = std::max(i1, rect.i1);
+				j1 = std::max(j1, rect.j1);
+			}
+		}
+
+		*dirtyID = m_LosDirtyID;
+		return true;
+	}
+
+	/**
+	 * Adds the given vertexes to the current LOS dirty rect.
+	 */
+	void MarkLosDirty(i32 i0, i32 j0, i32 i1, i32 j1)
+	{
+		SLosDirtyRect& rect = m_LosDirtyCurrent;
+		if (rect.i0 > rect.i1)
+		{
+			rect.i0 = i0;
+			rect.j0 = j0;
+			rect.i1 = i1;
+			rect.j1 = j1;
+		}
+		else
+		{
+			rect.i0 = std::min(rect.i0, i0);
+			rect.j0 = std::min(rect.j0, j0);
+			rect.i1 = std::max(rect.i1, i1);
+			rect.j1 = std::max(rect.j1, j1);
+		}
+	}
+
+	void MarkLosDirtyAll()
+	{
+		MarkLosDirty(0, 0, m_TerrainVerticesPerSide-1, m_TerrainVerticesPerSide-1);
+	}
+
+	/**
+	 * Gives the current LOS dirty rect (if there are any changes) a new ID in the history.
+	 */
+	void CloseLosDirtyRect()
+	{
+		if (m_LosDirtyCurrent.i0 > m_LosDirtyCurrent.i1)
+			return;
+
+		m_LosDirtyHistory.push_back(m_LosDirtyCurrent);
+		if (m_LosDirtyHistory.size() > MAX_LOS_DIRTY_HISTORY)
+			m_LosDirtyHistory.pop_front();
+		++m_LosDirtyID;
+
+		m_LosDirtyCurrent.i0 = m_LosDirtyCurrent.j0 = 0;
+		m_LosDirtyCurrent.i1 = m_LosDirtyCurrent.j1 = -1;
 	}
 
 	virtual u32 GetSharedLosMask(player_id_t player)
@@ -1105,6 +1384,8 @@ public:
 		const Grid<u8>& grid = cmpTerritoryManager->GetTerritoryGrid();
 		ENSURE(grid.m_W == m_TerrainVerticesPerSide-1 && grid.m_H == m_TerrainVerticesPerSide-1);
 
+		MarkLosDirtyAll();
+
 		// For each tile, if it is owned by a valid player then update the LOS
 		// for every vertex around that tile, to mark them as explored
 
@@ -1170,23 +1451,58 @@ public:
 
 		i32 idx0 = j*m_TerrainVerticesPerSide + i0;
 		i32 idx1 = j*m_TerrainVerticesPerSide + i1;
-		u32 &explored = m_ExploredVertices.at(owner);
-		for (i32 idx = idx0; idx <= idx1; ++idx)
+		i32 changed0 = i1+1, changed1 = i0-1; // range of vertexes that became visible
+		i32 idx = idx0;
+
+#if HAVE_SSE2
+		// Increment 8 counts at once, and only look at the individual vertexes
+		// that are increasing from zero
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1);
+		for (; idx + 8 <= idx1 + 1; idx += 8)
 		{
-			// Increasing from zero to non-zero - move from unexplored/explored to visible+explored
-			if (counts[idx] == 0)
+			__m128i c = _mm_loadu_si128((const __m128i*)&counts[idx]);
+			int fromZero = _mm_movemask_epi8(_mm_cmpeq_epi16(c, zero));
+			_mm_storeu_si128((__m128i*)&counts[idx], _mm_add_epi16(c, one));
+
+			// (movemask gives two bits per 16-bit count)
+			for (i32 k = 0; fromZero; ++k, fromZero >>= 2)
 			{
-				i32 i = i0 + idx - idx0;
-				if (!LosIsOffWorld(i, j))
-				{
-					explored += !(m_LosState[idx] & (LOS_EXPLORED << (2*(owner-1))));
-					m_LosState[idx] |= ((LOS_VISIBLE | LOS_EXPLORED) << (2*(owner-1)));
-				}
+				if (fromZero & 1)
+					LosRevealVertex(owner, i0 + idx - idx0 + k, j, idx + k, changed0, changed1);
 			}
+		}
+#endif
+
+		for (; idx <= idx1; ++idx)
+		{
+			// Increasing from zero to non-zero - move from unexplored/explored to visible+explored
+			if (counts[idx] == 0)
+				LosRevealVertex(owner, i0 + idx - idx0, j, idx, changed0, changed1);
 
 			ASSERT(counts[idx] < 65535);
 			counts[idx] = (u16)(counts[idx] + 1); // ignore overflow; the player should never have 64K units
 		}
+
+		if (changed0 <= changed1)
+			MarkLosDirty(changed0, j, changed1, j);
+	}
+
+	/**
+	 * Marks vertex (i,j) as visible and explored by the owner, as its count
+	 * increases from zero, and extends [changed0, changed1] to contain i.
+	 */
+	inline void LosRevealVertex(u8 owner, i32 i, i32 j, i32 idx, i32& changed0, i32& changed1)
+	{
+		if (LosIsOffWorld(i, j))
+			return;
+
+		u32 &explored = m_ExploredVertices.at(owner);
+		explored += !(m_LosState[idx] & (LOS_EXPLORED << (2*(owner-1))));
+		m_LosState[idx] |= ((LOS_VISIBLE | LOS_EXPLORED) << (2*(owner-1)));
+
+		changed0 = std::min(changed0, i);
+		changed1 = std::max(changed1, i);
 	}
 
 	/**
@@ -1199,7 +1515,35 @@ public:
 
 		i32 idx0 = j*m_TerrainVerticesPerSide + i0;
 		i32 idx1 = j*m_TerrainVerticesPerSide + i1;
-		for (i32 idx = idx0; idx <= idx1; ++idx)
+		i32 changed0 = idx1+1, changed1 = idx0-1; // range of indexes that stopped being visible
+		const u32 visibleMask = ~(LOS_VISIBLE << (2*(owner-1)));
+		i32 idx = idx0;
+
+#if HAVE_SSE2
+		// Decrement 8 counts at once, and only look at the individual vertexes
+		// that have decreased to zero
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1);
+		for (; idx + 8 <= idx1 + 1; idx += 8)
+		{
+			__m128i c = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)&counts[idx]), one);
+			_mm_storeu_si128((__m128i*)&counts[idx], c);
+			int toZero = _mm_movemask_epi8(_mm_cmpeq_epi16(c, zero));
+
+			// (movemask gives two bits per 16-bit count)
+			for (i32 k = 0; toZero; ++k, toZero >>= 2)
+			{
+				if (toZero & 1)
+				{
+					m_LosState[idx + k] &= visibleMask;
+					changed0 = std::min(changed0, idx + k);
+					changed1 = std::max(changed1, idx + k);
+				}
+			}
+		}
+#endif
+
+		for (; idx <= idx1; ++idx)
 		{
 			ASSERT(counts[idx] > 0);
 			counts[idx] = (u16)(counts[idx] - 1);
@@ -1208,9 +1552,14 @@ public:
 			if (counts[idx] == 0)
 			{
 				// (If LosIsOffWorld then this is a no-op, so don't bother doing the check)
-				m_LosState[idx] &= ~(LOS_VISIBLE << (2*(owner-1)));
+				m_LosState[idx] &= visibleMask;
+				changed0 = std::min(changed0, idx);
+				changed1 = std::max(changed1, idx);
 			}
 		}
+
+		if (changed0 <= changed1)
+			MarkLosDirty(i0 + changed0 - idx0, j, i0 + changed1 - idx0, j);
 	}
 
 	/**
@@ -45,6 +45,9 @@
 #include "simulation2/helpers/Grid.h"
 #include "simulation2/helpers/PriorityQueue.h"
 #include "simulation2/helpers/Render.h"
+#include "simulation2/helpers/WorkerPool.h"
+
+#include <deque>
 
 class CCmpTerritoryManager;
 
@@ -59,13 +62,27 @@ public:
 	virtual void ProcessTile(ssize_t i, ssize_t j);
 };
 
+/**
+ * Inclusive rectangle of tiles.
+ */
+struct STileRect
+{
+	u16 i0, j0, i1, j1;
+
+	bool Intersects(const STileRect& r) const
+	{
+		return i0 <= r.i1 && r.i0 <= i1 && j0 <= r.j1 && r.j0 <= j1;
+	}
+};
+
 class CCmpTerritoryManager : public ICmpTerritoryManager
 {
 public:
 	static void ClassInit(CComponentManager& componentManager)
 	{
-		componentManager.SubscribeGloballyToMessageType(MT_OwnershipChanged);
-		componentManager.SubscribeGloballyToMessageType(MT_PositionChanged);
+		// These are only used to mark influences as dirty, so handle them in batches
+		componentManager.SubscribeGloballyToMessageTypeDeferred(MT_OwnershipChanged);
+		componentManager.SubscribeGloballyToMessageTypeDeferred(MT_PositionChanged);
 		componentManager.SubscribeGloballyToMessageType(MT_TechnologyModification);
 		componentManager.SubscribeToMessageType(MT_TerrainChanged);
 		componentManager.SubscribeToMessageType(MT_Update);
@@ -93,6 +110,41 @@ public:
 	// during the Update phase
 	bool m_TriggerEvent;
 
+	/**
+	 * The last computed effect of an entity with a TerritoryInfluence component,
+	 * so it can be undone when the entity changes without recomputing everything else.
+	 */
+	struct SInfluence
+	{
+		// Tiles whose cost are overridden by the entity's obstruction (if hasFootprint)
+		bool hasFootprint;
+		STileRect footprint;
+
+		// Flood-filled weights of the entity over the tiles of 'area', in row order
+		// (if owner != 0, else the entity has no influence)
+		player_id_t owner;
+		bool root;
+		u16 i, j; // tile under the entity
+		u32 weight, falloff;
+		STileRect area;
+		std::vector<u32> weights;
+	};
+
+	// Intermediate data of the last territory computation, which is only created by
+	// CalculateTerritories along with m_Territories:
+	Grid<u8>* m_CostGrid; // influence cost of each tile
+	std::map<entity_id_t, SInfluence> m_Influences;
+	std::map<player_id_t, Grid<u32>*> m_PlayerInfluences; // sum of each player's weights
+
+	// Influence entities that may have changed since the last computation
+	std::set<entity_id_t> m_DirtyInfluences;
+
+	// Bounds of the tiles whose owners changed in the most recent computations,
+	// the last with ID m_ChangedID (not serialized)
+	std::deque<STileRect> m_ChangedHistory;
+	size_t m_ChangedID;
+	static const size_t MAX_CHANGED_HISTORY = 16;
+
 	struct SBoundaryLine
 	{
 		bool connected;
@@ -113,6 +165,8 @@ public:
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
 		m_Territories = NULL;
+		m_CostGrid = NULL;
+		m_ChangedID = 1;
 		m_DebugOverlay = NULL;
 //		m_DebugOverlay = new TerritoryOverlay(*this);
 		m_BoundaryLinesDirty = true;
@@ -135,6 +189,7 @@ public:
 	virtual void Deinit()
 	{
 		SAFE_DELETE(m_Territories);
+		ResetInfluences();
 		SAFE_DELETE(m_DebugOverlay);
 	}
 
@@ -153,18 +208,6 @@ public:
 	{
 		switch (msg.GetType())
 		{
-		case MT_OwnershipChanged:
-		{
-			const CMessageOwnershipChanged& msgData = static_cast<const CMessageOwnershipChanged&> (msg);
-			MakeDirtyIfRelevantEntity(msgData.entity);
-			break;
-		}
-		case MT_PositionChanged:
-		{
-			const CMessagePositionChanged& msgData = static_cast<const CMessagePositionChanged&> (msg);
-			MakeDirtyIfRelevantEntity(msgData.entity);
-			break;
-		}
 		case MT_TechnologyModification:
 		{
 			const CMessageTechnologyModification& msgData = static_cast<const CMessageTechnologyModification&> (msg);
@@ -202,6 +245,28 @@ public:
 		}
 	}
 
+	virtual void HandleMessageBatch(const std::vector<CMessage*>& msgs)
+	{
+		// A moving or converted entity usually sends several messages per turn,
+		// so only check each entity once
+		std::set<entity_id_t> entities;
+		for (size_t i = 0; i < msgs.size(); ++i)
+		{
+			switch (msgs[i]->GetType())
+			{
+			case MT_OwnershipChanged:
+				entities.insert(static_cast<const CMessageOwnershipChanged*> (msgs[i])->entity);
+				break;
+			case MT_PositionChanged:
+				entities.insert(static_cast<const CMessagePositionChanged*> (msgs[i])->entity);
+				break;
+			}
+		}
+
+		for (std::set<entity_id_t>::const_iterator it = entities.begin(); it != entities.end(); ++it)
+			MakeDirtyIfRelevantEntity(*it);
+	}
+
 	// Check whether the entity is either a settlement or territory influence;
 	// ignore any others
 	void MakeDirtyIfRelevantEntity(entity_id_t ent)
@@ -212,7 +277,7 @@ public:
 
 		CmpPtr<ICmpTerritoryInfluence> cmpTerritoryInfluence(GetSimContext(), ent);
 		if (cmpTerritoryInfluence)
-			MakeDirty();
+			MakeInfluenceDirty(ent);
 	}
 
 	virtual const Grid<u8>& GetTerritoryGrid()
@@ -222,6 +287,38 @@ public:
 		return *m_Territories;
 	}
 
+	virtual bool GetChangedTiles(size_t* changedID, i32& i0, i32& j0, i32& i1, i32& j1)
+	{
+		CalculateTerritories();
+
+		if (!m_Territories || *changedID == m_ChangedID)
+			return false;
+
+		if (*changedID > m_ChangedID || m_ChangedID - *changedID > m_ChangedHistory.size())
+		{
+			// Too old (or from before a reset), so everything might have changed
+			i0 = j0 = 0;
+			i1 = m_Territories->m_W-1;
+			j1 = m_Territories->m_H-1;
+		}
+		else
+		{
+			i0 = j0 = std::numeric_limits<i32>::max();
+			i1 = j1 = std::numeric_limits<i32>::min();
+			for (size_t n = m_ChangedHistory.size() - (m_ChangedID - *changedID); n < m_ChangedHistory.size(); ++n)
+			{
+				const STileRect& rect = m_ChangedHistory[n];
+				i0 = std::min(i0, (i32)rect.i0);
+				j0 = std::min(j0, (i32)rect.j0);
+				i1 = std::max(i1, (i32)rect.i1);
+				j1 = std::max(j1, (i32)rect.j1);
+			}
+		}
+
+		*changedID = m_ChangedID;
+		return true;
+	}
+
 	virtual player_id_t GetOwner(entity_pos_t x, entity_pos_t z);
 	virtual bool IsConnected(entity_pos_t x, entity_pos_t z);
 
@@ -231,6 +328,9 @@ public:
 
 	size_t m_DirtyID;
 
+	/**
+	 * Makes everything be recomputed.
+	 */
 	void MakeDirty()
 	{
 		SAFE_DELETE(m_Territories);
@@ -239,6 +339,30 @@ public:
 		m_TriggerEvent = true;
 	}
 
+	/**
+	 * Makes the given influence entity's contribution be recomputed, along with
+	 * the territories in the area it affects.
+	 */
+	void MakeInfluenceDirty(entity_id_t ent)
+	{
+		m_DirtyInfluences.insert(ent);
+		++m_DirtyID;
+		m_BoundaryLinesDirty = true;
+		m_TriggerEvent = true;
+	}
+
+	/**
+	 * Deletes the intermediate data cached for incremental updates.
+	 */
+	void ResetInfluences()
+	{
+		SAFE_DELETE(m_CostGrid);
+		for (std::map<player_id_t, Grid<u32>*>::iterator it = m_PlayerInfluences.begin(); it != m_PlayerInfluences.end(); ++it)
+			delete it->second;
+		m_PlayerInfluences.clear();
+		m_Influences.clear();
+	}
+
 	virtual bool NeedUpdate(size_t* dirtyID)
 	{
 		if (*dirtyID != m_DirtyID)
@@ -249,14 +373,33 @@ public:
 		return false;
 	}
 
+	/**
+	 * Brings m_Territories up to date. Only the influences of entities that have
+	 * changed since the last call (and of entities whose influence spreads over
+	 * the tiles whose costs they changed) are recomputed, and the owners of the
+	 * tiles in their areas, unless MakeDirty was called.
+	 */
 	void CalculateTerritories();
 
 	/**
-	 * Updates @p grid based on the obstruction shapes of all entities with
-	 * a TerritoryInfluence component. Grid cells are 0 if no influence,
+	 * Returns the tiles whose cost are overridden by the entity's obstruction shape,
+	 * or false if it doesn't override them.
+	 */
+	bool GetInfluenceFootprint(entity_id_t ent, ICmpTerritoryInfluence* cmpTerritoryInfluence, STileRect& footprint);
+
+	/**
+	 * Updates the tiles of @p grid inside @p rect based on the obstruction shapes of all
+	 * entities with a TerritoryInfluence component (which should be in order of entity ID,
+	 * since later ones override earlier ones). Grid cells are 0 if no influence,
 	 * or 1+c if the influence have cost c (assumed between 0 and 254).
 	 */
-	void RasteriseInfluences(CComponentManager::InterfaceList& infls, Grid<u8>& grid);
+	void RasteriseInfluences(CComponentManager::InterfaceList& infls, Grid<u8>& grid, const STileRect& rect);
+
+	/**
+	 * Sets up everything in @p infl except for the flood-filled area and weights,
+	 * from the current state of the entity.
+	 */
+	void SetupInfluence(entity_id_t ent, ICmpTerritoryInfluence* cmpTerritoryInfluence, SInfluence& infl);
 
 	std::vector<STerritoryBoundary> ComputeBoundaries();
 
@@ -277,7 +420,7 @@ of extending to each neighbour (based on radius-determining 'falloff' value,
 adjusted by terrain movement cost), and repeating until all tiles are processed.
 */
 
-typedef PriorityQueueHeap<std::pair<u16, u16>, u32, std::greater<u32> > OpenQueue;
+typedef PriorityQueueRadix<std::pair<u16, u16> > OpenQueue;
 
 static void ProcessNeighbour(u32 falloff, u16 i, u16 j, u32 pg, bool diagonal,
 		Grid<u32>& grid, OpenQueue& queue, const Grid<u8>& costGrid)
@@ -298,7 +441,11 @@ static void ProcessNeighbour(u32 falloff, u16 i, u16 j, u32 pg, bool diagonal,
 	queue.push(tile);
 }
 
-static void FloodFill(Grid<u32>& grid, Grid<u8>& costGrid, OpenQueue& openTiles, u32 falloff)
+/**
+ * Expands the influences in @p openTiles outwards. @p area must contain the open
+ * tiles, and is extended to contain every tile that's reached.
+ */
+static void FloodFill(Grid<u32>& grid, const Grid<u8>& costGrid, OpenQueue& openTiles, u32 falloff, STileRect& area)
 {
 	u16 tilesW = grid.m_W;
 	u16 tilesH = grid.m_H;
@@ -310,6 +457,12 @@ static void FloodFill(Grid<u32>& grid, Grid<u8>& costGrid, OpenQueue& openTiles,
 		// Process neighbours (if they're not off the edge of the map)
 		u16 x = tile.id.first;
 		u16 z = tile.id.second;
+
+		area.i0 = std::min(area.i0, x);
+		area.j0 = std::min(area.j0, z);
+		area.i1 = std::max(area.i1, x);
+		area.j1 = std::max(area.j1, z);
+
 		if (x > 0)
 			ProcessNeighbour(falloff, (u16)(x-1), z, tile.rank, false, grid, openTiles, costGrid);
 		if (x < tilesW-1)
@@ -329,9 +482,87 @@ static void FloodFill(Grid<u32>& grid, Grid<u8>& costGrid, OpenQueue& openTiles,
 	}
 }
 
+// Adds the weights of an influence to (or subtracts them from) a player's grid
+static void AddWeights(Grid<u32>& grid, const STileRect& area, const std::vector<u32>& weights, bool subtract)
+{
+	size_t n = 0;
+	for (u16 j = area.j0; j <= area.j1; ++j)
+	{
+		for (u16 i = area.i0; i <= area.i1; ++i, ++n)
+		{
+			if (subtract)
+				grid.set(i, j, grid.get(i, j) - weights[n]);
+			else
+				grid.set(i, j, grid.get(i, j) + weights[n]);
+		}
+	}
+}
+
+/**
+ * Flood-fills the influence set up in @p infl, using @p floodGrid (empty, and left
+ * empty) as temporary storage, and stores the reached area and weights.
+ */
+static void FloodInfluence(const Grid<u8>& costGrid, Grid<u32>& floodGrid, CCmpTerritoryManager::SInfluence& infl)
+{
+	// Initialise the tile under the entity
+	floodGrid.set(infl.i, infl.j, infl.weight);
+	OpenQueue openTiles;
+	OpenQueue::Item tile = { std::make_pair(infl.i, infl.j), infl.weight };
+	openTiles.push(tile);
+
+	// Expand influences outwards
+	STileRect area = { infl.i, infl.j, infl.i, infl.j };
+	FloodFill(floodGrid, costGrid, openTiles, infl.falloff, area);
+
+	// Keep the reached area, and clear it for the next entity
+	infl.area = area;
+	infl.weights.clear();
+	infl.weights.reserve((area.i1 - area.i0 + 1) * (area.j1 - area.j0 + 1));
+	for (u16 j = area.j0; j <= area.j1; ++j)
+	{
+		for (u16 i = area.i0; i <= area.i1; ++i)
+		{
+			infl.weights.push_back(floodGrid.get(i, j));
+			floodGrid.set(i, j, 0);
+		}
+	}
+}
+
+/**
+ * The influences of a single player that need to be flood-filled and added to
+ * the player's grid. Each player's job is independent of the others.
+ */
+struct PlayerInfluenceJob
+{
+	Grid<u32>* playerGrid;
+	std::vector<CCmpTerritoryManager::SInfluence*> influences;
+};
+
+struct PlayerInfluenceJobs
+{
+	const Grid<u8>* costGrid;
+	std::vector<PlayerInfluenceJob> players;
+};
+
+static void FloodPlayerInfluencesJob(void* data, size_t index)
+{
+	PlayerInfluenceJobs& jobs = *static_cast<PlayerInfluenceJobs*>(data);
+	PlayerInfluenceJob& job = jobs.players[index];
+
+	Grid<u32> floodGrid(jobs.costGrid->m_W, jobs.costGrid->m_H);
+	for (size_t n = 0; n < job.influences.size(); ++n)
+	{
+		FloodInfluence(*jobs.costGrid, floodGrid, *job.influences[n]);
+		AddWeights(*job.playerGrid, job.influences[n]->area, job.influences[n]->weights, false);
+	}
+}
+
 void CCmpTerritoryManager::CalculateTerritories()
 {
-	if (m_Territories)
+	// Make sure we've seen any position/ownership changes that are still queued
+	GetSimContext().GetComponentManager().FlushDeferredMessages();
+
+	if (m_Territories && m_DirtyInfluences.empty())
 		return;
 
 	PROFILE("CalculateTerritories");
@@ -345,161 +576,221 @@ void CCmpTerritoryManager::CalculateTerritories()
 
 	u16 tilesW = cmpTerrain->GetTilesPerSide();
 	u16 tilesH = cmpTerrain->GetTilesPerSide();
+	STileRect wholeMap = { 0, 0, (u16)(tilesW-1), (u16)(tilesH-1) };
+
+	// Find all territory influence entities
+	CComponentManager::InterfaceList influences = GetSimContext().GetComponentManager().GetEntitiesWithInterface(IID_TerritoryInfluence);
+
+	std::vector<STileRect> costChanges; // areas of m_CostGrid that need recomputing
+	std::vector<STileRect> weightChanges; // areas where the players' influences have changed
 
-	m_Territories = new Grid<u8>(tilesW, tilesH);
+	if (!m_Territories)
+	{
+		// Start again from nothing, with every influence entity needing to be computed
+		ResetInfluences();
+		m_Territories = new Grid<u8>(tilesW, tilesH);
+		m_CostGrid = new Grid<u8>(tilesW, tilesH);
+
+		m_DirtyInfluences.clear();
+		for (CComponentManager::InterfaceList::iterator it = influences.begin(); it != influences.end(); ++it)
+			m_DirtyInfluences.insert(it->first);
 
-	// Compute terrain-passability-dependent costs per tile
-	Grid<u8> influenceGrid(tilesW, tilesH);
+		costChanges.push_back(wholeMap);
+		weightChanges.push_back(wholeMap);
+	}
+	else
+	{
+		// Find where the changed entities' obstructions override the tile costs, before and after
+		for (std::set<entity_id_t>::iterator it = m_DirtyInfluences.begin(); it != m_DirtyInfluences.end(); ++it)
+		{
+			std::map<entity_id_t, SInfluence>::iterator iit = m_Influences.find(*it);
+			if (iit != m_Influences.end() && iit->second.hasFootprint)
+				costChanges.push_back(iit->second.footprint);
+
+			CmpPtr<ICmpTerritoryInfluence> cmpTerritoryInfluence(GetSimContext(), *it);
+			STileRect footprint;
+			if (cmpTerritoryInfluence && GetInfluenceFootprint(*it, cmpTerritoryInfluence.operator->(), footprint))
+				costChanges.push_back(footprint);
+		}
+	}
 
+	// Compute terrain-passability-dependent costs per tile,
+	// and allow influence entities to override the terrain costs
 	CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
 	ICmpPathfinder::pass_class_t passClassDefault = cmpPathfinder->GetPassabilityClass("default");
 	ICmpPathfinder::pass_class_t passClassUnrestricted = cmpPathfinder->GetPassabilityClass("unrestricted");
 
 	const Grid<u16>& passGrid = cmpPathfinder->GetPassabilityGrid();
-	for (u16 j = 0; j < tilesH; ++j)
+	for (size_t n = 0; n < costChanges.size(); ++n)
 	{
-		for (u16 i = 0; i < tilesW; ++i)
+		const STileRect& rect = costChanges[n];
+		for (u16 j = rect.j0; j <= rect.j1; ++j)
 		{
-			u16 g = passGrid.get(i, j);
-			u8 cost;
-			if (g & passClassUnrestricted)
-				cost = 255; // off the world; use maximum cost
-			else if (g & passClassDefault)
-				cost = m_ImpassableCost;
-			else
-				cost = 1;
-			influenceGrid.set(i, j, cost);
+			for (u16 i = rect.i0; i <= rect.i1; ++i)
+			{
+				u16 g = passGrid.get(i, j);
+				u8 cost;
+				if (g & passClassUnrestricted)
+					cost = 255; // off the world; use maximum cost
+				else if (g & passClassDefault)
+					cost = m_ImpassableCost;
+				else
+					cost = 1;
+				m_CostGrid->set(i, j, cost);
+			}
 		}
+
+		RasteriseInfluences(influences, *m_CostGrid, rect);
 	}
 
-	// Find all territory influence entities
-	CComponentManager::InterfaceList influences = GetSimContext().GetComponentManager().GetEntitiesWithInterface(IID_TerritoryInfluence);
+	// Any influence that spread over (or up to) the changed costs might spread differently now
+	std::set<entity_id_t> recompute = m_DirtyInfluences;
+	if (!costChanges.empty())
+	{
+		for (std::map<entity_id_t, SInfluence>::iterator it = m_Influences.begin(); it != m_Influences.end(); ++it)
+		{
+			if (it->second.owner == 0)
+				continue;
 
-	// Allow influence entities to override the terrain costs
-	RasteriseInfluences(influences, influenceGrid);
+			const STileRect& area = it->second.area;
+			STileRect border = { (u16)std::max(area.i0-1, 0), (u16)std::max(area.j0-1, 0),
+				(u16)std::min(area.i1+1, tilesW-1), (u16)std::min(area.j1+1, tilesH-1) };
+			for (size_t n = 0; n < costChanges.size(); ++n)
+			{
+				if (border.Intersects(costChanges[n]))
+				{
+					recompute.insert(it->first);
+					break;
+				}
+			}
+		}
+	}
 
-	// Split influence entities into per-player lists, ignoring any with invalid properties
-	std::map<player_id_t, std::vector<entity_id_t> > influenceEntities;
-	std::vector<entity_id_t> rootInfluenceEntities;
-	for (CComponentManager::InterfaceList::iterator it = influences.begin(); it != influences.end(); ++it)
+	// Replace the old influences of those entities with their new ones, in each player's sum
+	PlayerInfluenceJobs jobs;
+	jobs.costGrid = m_CostGrid;
+	std::map<player_id_t, size_t> playerJobs; // index in jobs.players of each player's job
+	for (std::set<entity_id_t>::iterator it = recompute.begin(); it != recompute.end(); ++it)
 	{
-		// Ignore any with no weight or radius (to avoid divide-by-zero later)
-		ICmpTerritoryInfluence* cmpTerritoryInfluence = static_cast<ICmpTerritoryInfluence*>(it->second);
-		if (cmpTerritoryInfluence->GetWeight() == 0 || cmpTerritoryInfluence->GetRadius() == 0)
-			continue;
-
-		CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), it->first);
-		if (!cmpOwnership)
-			continue;
+		std::map<entity_id_t, SInfluence>::iterator iit = m_Influences.find(*it);
+		if (iit != m_Influences.end())
+		{
+			const SInfluence& old = iit->second;
+			if (old.owner != 0)
+			{
+				AddWeights(*m_PlayerInfluences[old.owner], old.area, old.weights, true);
+				weightChanges.push_back(old.area);
+			}
+		}
 
-		// Ignore Gaia and unassigned
-		player_id_t owner = cmpOwnership->GetOwner();
-		if (owner <= 0)
+		CmpPtr<ICmpTerritoryInfluence> cmpTerritoryInfluence(GetSimContext(), *it);
+		if (!cmpTerritoryInfluence)
+		{
+			// The entity has been destroyed
+			if (iit != m_Influences.end())
+				m_Influences.erase(iit);
 			continue;
+		}
 
-		// We only have so many bits to store tile ownership, so ignore unrepresentable players
-		if (owner > TERRITORY_PLAYER_MASK)
+		SInfluence& infl = m_Influences[*it];
+		SetupInfluence(*it, cmpTerritoryInfluence.operator->(), infl);
+		if (infl.owner == 0)
 			continue;
 
-		// Ignore if invalid position
-		CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), it->first);
-		if (!cmpPosition || !cmpPosition->IsInWorld())
-			continue;
+		std::map<player_id_t, size_t>::iterator pit = playerJobs.find(infl.owner);
+		if (pit == playerJobs.end())
+		{
+			Grid<u32>*& playerGrid = m_PlayerInfluences[infl.owner];
+			if (!playerGrid)
+				playerGrid = new Grid<u32>(tilesW, tilesH);
+
+			PlayerInfluenceJob job;
+			job.playerGrid = playerGrid;
+			pit = playerJobs.insert(std::make_pair(infl.owner, jobs.players.size())).first;
+			jobs.players.push_back(job);
+		}
+		jobs.players[pit->second].influences.push_back(&infl);
+	}
 
-		influenceEntities[owner].push_back(it->first);
+	// Flood-fill each player's influences in parallel
+	if (!jobs.players.empty())
+	{
+		cmpPathfinder->GetWorkerPool().Run(&FloodPlayerInfluencesJob, &jobs, jobs.players.size());
 
-		if (cmpTerritoryInfluence->IsRoot())
-			rootInfluenceEntities.push_back(it->first);
+		for (size_t p = 0; p < jobs.players.size(); ++p)
+			for (size_t n = 0; n < jobs.players[p].influences.size(); ++n)
+				weightChanges.push_back(jobs.players[p].influences[n]->area);
 	}
 
-	// For each player, store the sum of influences on each tile
-	std::vector<std::pair<player_id_t, Grid<u32> > > playerGrids;
-	// TODO: this is a large waste of memory; we don't really need to store
-	// all the intermediate grids
+	m_DirtyInfluences.clear();
 
-	for (std::map<player_id_t, std::vector<entity_id_t> >::iterator it = influenceEntities.begin(); it != influenceEntities.end(); ++it)
+	// Remember the changed area for GetChangedTiles
+	if (!weightChanges.empty())
 	{
-		Grid<u32> playerGrid(tilesW, tilesH);
-
-		std::vector<entity_id_t>& ents = it->second;
-		for (std::vector<entity_id_t>::iterator eit = ents.begin(); eit != ents.end(); ++eit)
+		STileRect changed = weightChanges[0];
+		for (size_t n = 1; n < weightChanges.size(); ++n)
 		{
-			// Compute the influence map of the current entity, then add it to the player grid
-
-			Grid<u32> entityGrid(tilesW, tilesH);
-
-			CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), *eit);
-			CFixedVector2D pos = cmpPosition->GetPosition2D();
-			u16 i = (u16)clamp((pos.X / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesW-1);
-			u16 j = (u16)clamp((pos.Y / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesH-1);
-
-			CmpPtr<ICmpTerritoryInfluence> cmpTerritoryInfluence(GetSimContext(), *eit);
-			u32 weight = cmpTerritoryInfluence->GetWeight();
-			u32 radius = cmpTerritoryInfluence->GetRadius() / TERRAIN_TILE_SIZE;
-			u32 falloff = weight / radius; // earlier check for GetRadius() == 0 prevents divide-by-zero
-
-			// TODO: we should have some maximum value on weight, to avoid overflow
-			// when doing all the sums
-
-			// Initialise the tile under the entity
-			entityGrid.set(i, j, weight);
-			OpenQueue openTiles;
-			OpenQueue::Item tile = { std::make_pair((u16)i, (i16)j), weight };
-			openTiles.push(tile);
-
-			// Expand influences outwards
-			FloodFill(entityGrid, influenceGrid, openTiles, falloff);
-
-			// TODO: we should do a sparse grid and only add the non-zero regions, for performance
-			for (u16 j = 0; j < entityGrid.m_H; ++j)
-				for (u16 i = 0; i < entityGrid.m_W; ++i)
-					playerGrid.set(i, j, playerGrid.get(i, j) + entityGrid.get(i, j));
+			changed.i0 = std::min(changed.i0, weightChanges[n].i0);
+			changed.j0 = std::min(changed.j0, weightChanges[n].j0);
+			changed.i1 = std::max(changed.i1, weightChanges[n].i1);
+			changed.j1 = std::max(changed.j1, weightChanges[n].j1);
 		}
 
-		playerGrids.push_back(std::make_pair(it->first, playerGrid));
+		m_ChangedHistory.push_back(changed);
+		if (m_ChangedHistory.size() > MAX_CHANGED_HISTORY)
+			m_ChangedHistory.pop_front();
+		++m_ChangedID;
 	}
 
-	// Set m_Territories to the player ID with the highest influence for each tile
-	for (u16 j = 0; j < tilesH; ++j)
+	// Set m_Territories to the player ID with the highest influence for each changed tile
+	// (and clear the connected flags, which are recomputed below)
+	for (size_t n = 0; n < weightChanges.size(); ++n)
 	{
-		for (u16 i = 0; i < tilesW; ++i)
+		const STileRect& rect = weightChanges[n];
+		for (u16 j = rect.j0; j <= rect.j1; ++j)
 		{
-			u32 bestWeight = 0;
-			for (size_t k = 0; k < playerGrids.size(); ++k)
+			for (u16 i = rect.i0; i <= rect.i1; ++i)
 			{
-				u32 w = playerGrids[k].second.get(i, j);
-				if (w > bestWeight)
+				u8 owner = 0;
+				u32 bestWeight = 0;
+				for (std::map<player_id_t, Grid<u32>*>::iterator it = m_PlayerInfluences.begin(); it != m_PlayerInfluences.end(); ++it)
 				{
-					player_id_t id = playerGrids[k].first;
-					m_Territories->set(i, j, (u8)id);
-					bestWeight = w;
+					u32 w = it->second->get(i, j);
+					if (w > bestWeight)
+					{
+						owner = (u8)it->first;
+						bestWeight = w;
+					}
 				}
+				m_Territories->set(i, j, owner);
 			}
 		}
 	}
 
+	// Losing a root influence can disconnect territory anywhere, so redo all the connected flags
+	Grid<u8>& grid = *m_Territories;
+	for (u16 j = 0; j < tilesH; ++j)
+		for (u16 i = 0; i < tilesW; ++i)
+			grid.set(i, j, grid.get(i, j) & ~TERRITORY_CONNECTED_MASK);
+
 	// Detect territories connected to a 'root' influence (typically a civ center)
 	// belonging to their player, and mark them with the connected flag
-	for (std::vector<entity_id_t>::iterator it = rootInfluenceEntities.begin(); it != rootInfluenceEntities.end(); ++it)
+	for (std::map<entity_id_t, SInfluence>::iterator it = m_Influences.begin(); it != m_Influences.end(); ++it)
 	{
-		// (These components must be valid else the entities wouldn't be added to this list)
-		CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), *it);
-		CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), *it);
+		if (it->second.owner == 0 || !it->second.root)
+			continue;
 
-		CFixedVector2D pos = cmpPosition->GetPosition2D();
-		u16 i = (u16)clamp((pos.X / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesW-1);
-		u16 j = (u16)clamp((pos.Y / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesH-1);
+		u16 i = it->second.i;
+		u16 j = it->second.j;
 
-		u8 owner = (u8)cmpOwnership->GetOwner();
+		u8 owner = (u8)it->second.owner;
 
-		if (m_Territories->get(i, j) != owner)
+		if (grid.get(i, j) != owner)
 			continue;
 
 		// TODO: would be nice to refactor some of the many flood fill
 		// algorithms in this component
 
-		Grid<u8>& grid = *m_Territories;
-
 		u16 maxi = (u16)(grid.m_W-1);
 		u16 maxj = (u16)(grid.m_H-1);
 
@@ -537,6 +828,53 @@ void CCmpTerritoryManager::CalculateTerritories()
 	}
 }
 
+void CCmpTerritoryManager::SetupInfluence(entity_id_t ent, ICmpTerritoryInfluence* cmpTerritoryInfluence, SInfluence& infl)
+{
+	infl.hasFootprint = GetInfluenceFootprint(ent, cmpTerritoryInfluence, infl.footprint);
+	infl.owner = 0;
+	infl.weights.clear();
+
+	// Ignore any with no weight or radius (to avoid divide-by-zero later)
+	if (cmpTerritoryInfluence->GetWeight() == 0 || cmpTerritoryInfluence->GetRadius() == 0)
+		return;
+
+	CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), ent);
+	if (!cmpOwnership)
+		return;
+
+	// Ignore Gaia and unassigned
+	player_id_t owner = cmpOwnership->GetOwner();
+	if (owner <= 0)
+		return;
+
+	// We only have so many bits to store tile ownership, so ignore unrepresentable players
+	if (owner > TERRITORY_PLAYER_MASK)
+		return;
+
+	// Ignore if invalid position
+	CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), ent);
+	if (!cmpPosition || !cmpPosition->IsInWorld())
+		return;
+
+	CFixedVector2D pos = cmpPosition->GetPosition2D();
+	u16 i = (u16)clamp((pos.X / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, m_CostGrid->m_W-1);
+	u16 j = (u16)clamp((pos.Y / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, m_CostGrid->m_H-1);
+
+	u32 weight = cmpTerritoryInfluence->GetWeight();
+	u32 radius = cmpTerritoryInfluence->GetRadius() / TERRAIN_TILE_SIZE;
+	u32 falloff = weight / radius; // earlier check for GetRadius() == 0 prevents divide-by-zero
+
+	// TODO: we should have some maximum value on weight, to avoid overflow
+	// when doing all the sums
+
+	infl.owner = owner;
+	infl.root = cmpTerritoryInfluence->IsRoot();
+	infl.i = i;
+	infl.j = j;
+	infl.weight = weight;
+	infl.falloff = falloff;
+}
+
 /**
  * Compute the tile indexes on the grid nearest to a given point
  */
@@ -557,8 +895,30 @@ static void TileCenter(u16 i, u16 j, entity_pos_t& x, entity_pos_t& z)
 
 // TODO: would be nice not to duplicate those two functions from CCmpObstructionManager.cpp
 
+bool CCmpTerritoryManager::GetInfluenceFootprint(entity_id_t ent, ICmpTerritoryInfluence* cmpTerritoryInfluence, STileRect& footprint)
+{
+	if (cmpTerritoryInfluence->GetCost() == -1)
+		return false;
+
+	CmpPtr<ICmpObstruction> cmpObstruction(GetSimContext(), ent);
+	if (!cmpObstruction)
+		return false;
+
+	ICmpObstructionManager::ObstructionSquare square;
+	if (!cmpObstruction->GetObstructionSquare(square))
+		return false;
+
+	CmpPtr<ICmpTerrain> cmpTerrain(GetSimContext(), SYSTEM_ENTITY);
+	u16 tilesW = cmpTerrain->GetTilesPerSide();
+	u16 tilesH = cmpTerrain->GetTilesPerSide();
+
+	CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(square.u, square.v, CFixedVector2D(square.hw, square.hh));
+	NearestTile(square.x - halfBound.X, square.z - halfBound.Y, footprint.i0, footprint.j0, tilesW, tilesH);
+	NearestTile(square.x + halfBound.X, square.z + halfBound.Y, footprint.i1, footprint.j1, tilesW, tilesH);
+	return true;
+}
 
-void CCmpTerritoryManager::RasteriseInfluences(CComponentManager::InterfaceList& infls, Grid<u8>& grid)
+void CCmpTerritoryManager::RasteriseInfluences(CComponentManager::InterfaceList& infls, Grid<u8>& grid, const STileRect& rect)
 {
 	for (CComponentManager::InterfaceList::iterator it = infls.begin(); it != infls.end(); ++it)
 	{
@@ -582,7 +942,11 @@ void CCmpTerritoryManager::RasteriseInfluences(CComponentManager::InterfaceList&
 		u16 i0, j0, i1, j1;
 		NearestTile(square.x - halfBound.X, square.z - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
 		NearestTile(square.x + halfBound.X, square.z + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
-		for (u16 j = j0; j <= j1; ++j)
+		i0 = std::max(i0, rect.i0);
+		j0 = std::max(j0, rect.j0);
+		i1 = std::min(i1, rect.i1);
+		j1 = std::min(j1, rect.j1);
+		for (u16 j = j0; j <= j1 && j0 <= j1; ++j)
 		{
 			for (u16 i = i0; i <= i1; ++i)
 			{
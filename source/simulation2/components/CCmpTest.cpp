@@ -155,6 +155,7 @@ public:
 	{
 		componentManager.SubscribeToMessageType(MT_TurnStart);
 		componentManager.SubscribeToMessageType(MT_Update);
+		componentManager.SubscribeGloballyToMessageTypeDeferred(MT_TerrainChanged);
 	}
 
 	DEFAULT_COMPONENT_ALLOCATOR(Test2A)
@@ -205,6 +206,11 @@ public:
 			break;
 		}
 	}
+
+	virtual void HandleMessageBatch(const std::vector<CMessage*>& msgs)
+	{
+		m_x += 1000 * (int32_t)msgs.size();
+	}
 };
 
 REGISTER_COMPONENT_TYPE(Test2A)
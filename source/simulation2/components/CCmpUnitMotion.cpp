@@ -26,6 +26,7 @@
 #include "simulation2/components/ICmpPosition.h"
 #include "simulation2/components/ICmpPathfinder.h"
 #include "simulation2/components/ICmpRangeManager.h"
+#include "simulation2/components/ICmpUnitMotionManager.h"
 #include "simulation2/helpers/Geometry.h"
 #include "simulation2/helpers/Render.h"
 #include "simulation2/MessageTypes.h"
@@ -105,8 +106,6 @@ class CCmpUnitMotion : public ICmpUnitMotion
 public:
 	static void ClassInit(CComponentManager& componentManager)
 	{
-		componentManager.SubscribeToMessageType(MT_Update_MotionFormation);
-		componentManager.SubscribeToMessageType(MT_Update_MotionUnit);
 		componentManager.SubscribeToMessageType(MT_RenderSubmit); // for debug overlays
 		componentManager.SubscribeToMessageType(MT_PathResult);
 	}
@@ -315,6 +314,11 @@ public:
 		m_FinalGoal.type = ICmpPathfinder::Goal::POINT;
 
 		m_DebugOverlayEnabled = false;
+
+		// The manager calls Move every turn (and forgets us when we're destroyed)
+		CmpPtr<ICmpUnitMotionManager> cmpUnitMotionManager(GetSimContext(), SYSTEM_ENTITY);
+		if (cmpUnitMotionManager)
+			cmpUnitMotionManager->Register(GetEntityId(), this, m_FormationController);
 	}
 
 	virtual void Deinit()
@@ -365,24 +369,6 @@ public:
 	{
 		switch (msg.GetType())
 		{
-		case MT_Update_MotionFormation:
-		{
-			if (m_FormationController)
-			{
-				fixed dt = static_cast<const CMessageUpdate_MotionFormation&> (msg).turnLength;
-				Move(dt);
-			}
-			break;
-		}
-		case MT_Update_MotionUnit:
-		{
-			if (!m_FormationController)
-			{
-				fixed dt = static_cast<const CMessageUpdate_MotionUnit&> (msg).turnLength;
-				Move(dt);
-			}
-			break;
-		}
 		case MT_RenderSubmit:
 		{
 			const CMessageRenderSubmit& msgData = static_cast<const CMessageRenderSubmit&> (msg);
@@ -433,6 +419,8 @@ public:
 		m_DebugOverlayEnabled = enabled;
 	}
 
+	virtual void Move(ICmpPosition* cmpPosition, ICmpPathfinder* cmpPathfinder, fixed dt);
+
 	virtual bool MoveToPointRange(entity_pos_t x, entity_pos_t z, entity_pos_t minRange, entity_pos_t maxRange);
 	virtual bool IsInPointRange(entity_pos_t x, entity_pos_t z, entity_pos_t minRange, entity_pos_t maxRange);
 	virtual bool MoveToTargetRange(entity_id_t target, entity_pos_t minRange, entity_pos_t maxRange);
@@ -518,11 +506,6 @@ private:
 	 */
 	void PathResult(u32 ticket, const ICmpPathfinder::Path& path);
 
-	/**
-	 * Do the per-turn movement and other updates.
-	 */
-	void Move(fixed dt);
-
 	/**
 	 * Decide whether to approximate the given range from a square target as a circle,
 	 * rather than as a square.
@@ -753,10 +736,8 @@ void CCmpUnitMotion::PathResult(u32 ticket, const ICmpPathfinder::Path& path)
 	}
 }
 
-void CCmpUnitMotion::Move(fixed dt)
+void CCmpUnitMotion::Move(ICmpPosition* cmpPosition, ICmpPathfinder* cmpPathfinder, fixed dt)
 {
-	PROFILE("Move");
-
 	if (m_State == STATE_STOPPING)
 	{
 		m_State = STATE_IDLE;
@@ -794,12 +775,7 @@ void CCmpUnitMotion::Move(fixed dt)
 		// Maybe we should split the updates into multiple phases to minimise
 		// that problem.
 
-		CmpPtr<ICmpPathfinder> cmpPathfinder (GetSimContext(), SYSTEM_ENTITY);
-		if (!cmpPathfinder)
-			return;
-
-		CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
-		if (!cmpPosition || !cmpPosition->IsInWorld())
+		if (!cmpPathfinder || !cmpPosition || !cmpPosition->IsInWorld())
 			return;
 
 		CFixedVector2D initialPos = cmpPosition->GetPosition2D();
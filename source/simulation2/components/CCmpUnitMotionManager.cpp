@@ -0,0 +1,154 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "simulation2/system/Component.h"
+#include "ICmpUnitMotionManager.h"
+
+#include "simulation2/MessageTypes.h"
+#include "simulation2/components/ICmpPathfinder.h"
+#include "simulation2/components/ICmpPosition.h"
+#include "simulation2/components/ICmpUnitMotion.h"
+
+#include "ps/Profile.h"
+
+/**
+ * Implementation of ICmpUnitMotionManager.
+ *
+ * With thousands of moving units, dispatching the update messages to every UnitMotion
+ * component and looking up the components they need was a noticeable part of each turn,
+ * so the units are kept in one array and moved in a single loop here instead.
+ * (They're still moved one after another, in the same order as the messages were
+ * delivered, since each unit's collision checks see the units that have already moved.)
+ */
+class CCmpUnitMotionManager : public ICmpUnitMotionManager
+{
+public:
+	static void ClassInit(CComponentManager& componentManager)
+	{
+		componentManager.SubscribeToMessageType(MT_Update_MotionFormation);
+		componentManager.SubscribeToMessageType(MT_Update_MotionUnit);
+		componentManager.SubscribeGloballyToMessageType(MT_Destroy);
+	}
+
+	DEFAULT_COMPONENT_ALLOCATOR(UnitMotionManager)
+
+	struct Unit
+	{
+		entity_id_t ent;
+		ICmpUnitMotion* cmpUnitMotion;
+		ICmpPosition* cmpPosition;
+		bool formationController;
+	};
+
+	struct UnitLess
+	{
+		bool operator()(const Unit& a, entity_id_t b) const
+		{
+			return a.ent < b;
+		}
+	};
+
+	// The registered units, sorted by entity ID.
+	// (Not serialized, since the units register again when they're deserialized.)
+	std::vector<Unit> m_Units;
+
+	std::vector<Unit> m_MovingUnits; // copy of m_Units during a turn
+
+	static std::string GetSchema()
+	{
+		return "<a:component type='system'/><empty/>";
+	}
+
+	virtual void Init(const CParamNode& UNUSED(paramNode))
+	{
+	}
+
+	virtual void Deinit()
+	{
+	}
+
+	virtual void Serialize(ISerializer& UNUSED(serialize))
+	{
+	}
+
+	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& UNUSED(deserialize))
+	{
+		Init(paramNode);
+	}
+
+	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
+	{
+		switch (msg.GetType())
+		{
+		case MT_Update_MotionFormation:
+		{
+			fixed dt = static_cast<const CMessageUpdate_MotionFormation&> (msg).turnLength;
+			MoveUnits(dt, true);
+			break;
+		}
+		case MT_Update_MotionUnit:
+		{
+			fixed dt = static_cast<const CMessageUpdate_MotionUnit&> (msg).turnLength;
+			MoveUnits(dt, false);
+			break;
+		}
+		case MT_Destroy:
+		{
+			const CMessageDestroy& msgData = static_cast<const CMessageDestroy&> (msg);
+			std::vector<Unit>::iterator it = std::lower_bound(m_Units.begin(), m_Units.end(), msgData.entity, UnitLess());
+			if (it != m_Units.end() && it->ent == msgData.entity)
+				m_Units.erase(it);
+			break;
+		}
+		}
+	}
+
+	virtual void Register(entity_id_t ent, ICmpUnitMotion* cmpUnitMotion, bool formationController)
+	{
+		// Position is initialised before UnitMotion, so it can be looked up now
+		// (and it lasts as long as the entity)
+		ICmpPosition* cmpPosition = static_cast<ICmpPosition*>(GetSimContext().GetComponentManager().QueryInterface(ent, IID_Position));
+
+		Unit unit = { ent, cmpUnitMotion, cmpPosition, formationController };
+		std::vector<Unit>::iterator it = std::lower_bound(m_Units.begin(), m_Units.end(), ent, UnitLess());
+		if (it != m_Units.end() && it->ent == ent)
+			*it = unit;
+		else
+			m_Units.insert(it, unit);
+	}
+
+	void MoveUnits(fixed dt, bool formationControllers)
+	{
+		PROFILE("Move");
+
+		ICmpPathfinder* cmpPathfinder = static_cast<ICmpPathfinder*>(GetSimContext().GetComponentManager().QueryInterface(SYSTEM_ENTITY, IID_Pathfinder));
+
+		// Scripts reacting to the units' movement can create new units,
+		// so iterate over a copy of the list
+		m_MovingUnits = m_Units;
+		for (size_t i = 0; i < m_MovingUnits.size(); ++i)
+		{
+			const Unit& unit = m_MovingUnits[i];
+			if (unit.formationController == formationControllers)
+				unit.cmpUnitMotion->Move(unit.cmpPosition, cmpPathfinder, dt);
+		}
+	}
+};
+
+REGISTER_COMPONENT_TYPE(UnitMotionManager)
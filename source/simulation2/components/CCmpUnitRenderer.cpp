@@ -0,0 +1,270 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "simulation2/system/Component.h"
+#include "ICmpUnitRenderer.h"
+
+#include "simulation2/MessageTypes.h"
+#include "simulation2/helpers/SlotMap.h"
+
+#include "graphics/Frustum.h"
+#include "graphics/ModelAbstract.h"
+#include "maths/BoundingBoxAligned.h"
+#include "renderer/Scene.h"
+
+#include "tools/atlas/GameInterface/GameLoop.h"
+
+/**
+ * Implementation of ICmpUnitRenderer.
+ *
+ * The units are grouped into a uniform grid of cells by the centre of their bounds,
+ * and each cell keeps the union of its units' bounds. When submitting, cells outside
+ * the frustum are skipped entirely, and the units of cells entirely inside it are
+ * submitted without testing them individually, so with thousands of units (mostly
+ * trees) most of the per-model frustum tests are avoided.
+ *
+ * A cell's bounds are extended when one of its units' bounds change, and only
+ * recomputed (to shrink them again) after a unit has left the cell. Since each unit
+ * belongs to the cell containing its centre, they can't grow much beyond the cell.
+ *
+ * The grid covers a fixed area; units outside it are put in the nearest edge cell,
+ * which is still correct (just less effective).
+ */
+class CCmpUnitRenderer : public ICmpUnitRenderer
+{
+public:
+	static void ClassInit(CComponentManager& componentManager)
+	{
+		componentManager.SubscribeToMessageType(MT_RenderSubmit);
+	}
+
+	DEFAULT_COMPONENT_ALLOCATOR(UnitRenderer)
+
+	static const u32 NO_CELL = 0xFFFFFFFFu;
+
+	struct Unit
+	{
+		CModelAbstract* model;
+		CBoundingBoxAligned bounds;
+		u32 cell; // index into m_Cells, or NO_CELL if the unit has no bounds yet
+		u32 indexInCell; // index into the cell's m_Units
+		bool hidden;
+		bool visibleInAtlasOnly;
+	};
+
+	struct Cell
+	{
+		std::vector<u32> m_Units; // tags of the units in this cell
+		CBoundingBoxAligned m_Bounds; // contains (at least) the bounds of all units in this cell
+		bool m_BoundsDirty; // whether m_Bounds should be recomputed before it's next used
+	};
+
+	/**
+	 * Width of a cell, in world-space units.
+	 */
+	static const float CELL_SIZE;
+
+	/**
+	 * Number of cells in each direction (covering the largest supported map size).
+	 */
+	static const u32 GRID_SIZE = 64;
+
+	// The registered units.
+	// (Not serialized, since visual actors register again when they're deserialized.)
+	SlotMap<Unit> m_Units;
+
+	std::vector<Cell> m_Cells; // GRID_SIZE*GRID_SIZE cells, indexed by i + j*GRID_SIZE
+
+	static std::string GetSchema()
+	{
+		return "<a:component type='system'/><empty/>";
+	}
+
+	virtual void Init(const CParamNode& UNUSED(paramNode))
+	{
+		m_Cells.resize(GRID_SIZE*GRID_SIZE);
+		for (size_t i = 0; i < m_Cells.size(); ++i)
+			m_Cells[i].m_BoundsDirty = false;
+	}
+
+	virtual void Deinit()
+	{
+	}
+
+	virtual void Serialize(ISerializer& UNUSED(serialize))
+	{
+	}
+
+	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& UNUSED(deserialize))
+	{
+		Init(paramNode);
+	}
+
+	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
+	{
+		switch (msg.GetType())
+		{
+		case MT_RenderSubmit:
+		{
+			const CMessageRenderSubmit& msgData = static_cast<const CMessageRenderSubmit&> (msg);
+			RenderSubmit(msgData.collector, msgData.frustum, msgData.culling);
+			break;
+		}
+		}
+	}
+
+	virtual tag_t AddUnit(CModelAbstract* model, bool visibleInAtlasOnly)
+	{
+		Unit unit;
+		unit.model = model;
+		unit.cell = NO_CELL;
+		unit.indexInCell = 0;
+		unit.hidden = true;
+		unit.visibleInAtlasOnly = visibleInAtlasOnly;
+		return tag_t(m_Units.insert(unit));
+	}
+
+	virtual void UpdateUnitModel(tag_t tag, CModelAbstract* model)
+	{
+		Unit* unit = m_Units.get(tag.n);
+		ENSURE(unit);
+
+		unit->model = model;
+		RemoveFromCell(*unit);
+	}
+
+	virtual void UpdateUnitBounds(tag_t tag)
+	{
+		Unit* unit = m_Units.get(tag.n);
+		ENSURE(unit);
+
+		unit->bounds = unit->model->GetWorldBoundsRec();
+		if (unit->bounds.IsEmpty())
+		{
+			RemoveFromCell(*unit);
+			return;
+		}
+
+		CVector3D centre;
+		unit->bounds.GetCentre(centre);
+		u32 cell = GetCellIndex(centre.X, centre.Z);
+		if (cell != unit->cell)
+		{
+			RemoveFromCell(*unit);
+			unit->cell = cell;
+			unit->indexInCell = (u32)m_Cells[cell].m_Units.size();
+			m_Cells[cell].m_Units.push_back(tag.n);
+		}
+
+		m_Cells[cell].m_Bounds += unit->bounds;
+	}
+
+	virtual void SetUnitHidden(tag_t tag, bool hidden)
+	{
+		Unit* unit = m_Units.get(tag.n);
+		ENSURE(unit);
+
+		unit->hidden = hidden;
+	}
+
+	virtual void RemoveUnit(tag_t tag)
+	{
+		Unit* unit = m_Units.get(tag.n);
+		ENSURE(unit);
+
+		RemoveFromCell(*unit);
+		m_Units.erase(tag.n);
+	}
+
+	u32 GetCellIndex(float x, float z) const
+	{
+		int i = Clamp((int)floor(x / CELL_SIZE), 0, (int)GRID_SIZE-1);
+		int j = Clamp((int)floor(z / CELL_SIZE), 0, (int)GRID_SIZE-1);
+		return (u32)(i + j*GRID_SIZE);
+	}
+
+	void RemoveFromCell(Unit& unit)
+	{
+		if (unit.cell == NO_CELL)
+			return;
+
+		// Move the cell's last unit into the removed unit's place
+		Cell& cell = m_Cells[unit.cell];
+		u32 last = cell.m_Units.back();
+		cell.m_Units[unit.indexInCell] = last;
+		m_Units[last].indexInCell = unit.indexInCell;
+		cell.m_Units.pop_back();
+
+		cell.m_BoundsDirty = true;
+		unit.cell = NO_CELL;
+	}
+
+	void RecomputeCellBounds(Cell& cell)
+	{
+		cell.m_Bounds.SetEmpty();
+		for (size_t i = 0; i < cell.m_Units.size(); ++i)
+			cell.m_Bounds += m_Units[cell.m_Units[i]].bounds;
+		cell.m_BoundsDirty = false;
+	}
+
+	void SubmitUnit(SceneCollector& collector, const Unit& unit)
+	{
+		if (!g_AtlasGameLoop->running && unit.visibleInAtlasOnly)
+			return;
+
+		collector.SubmitRecursive(unit.model);
+	}
+
+	void RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling)
+	{
+		for (size_t c = 0; c < m_Cells.size(); ++c)
+		{
+			Cell& cell = m_Cells[c];
+			if (cell.m_Units.empty())
+				continue;
+
+			if (cell.m_BoundsDirty)
+				RecomputeCellBounds(cell);
+
+			bool testUnits = false;
+			if (culling)
+			{
+				if (!frustum.IsBoxVisible(CVector3D(0, 0, 0), cell.m_Bounds))
+					continue;
+				testUnits = !frustum.IsBoxInside(cell.m_Bounds);
+			}
+
+			for (size_t i = 0; i < cell.m_Units.size(); ++i)
+			{
+				const Unit& unit = m_Units[cell.m_Units[i]];
+				if (unit.hidden)
+					continue;
+
+				if (testUnits && !frustum.IsBoxVisible(CVector3D(0, 0, 0), unit.bounds))
+					continue;
+
+				SubmitUnit(collector, unit);
+			}
+		}
+	}
+};
+
+const float CCmpUnitRenderer::CELL_SIZE = 32.f;
+
+REGISTER_COMPONENT_TYPE(UnitRenderer)
@@ -30,9 +30,9 @@
 #include "ICmpTemplateManager.h"
 #include "ICmpTerrain.h"
 #include "ICmpUnitMotion.h"
+#include "ICmpUnitRenderer.h"
 #include "ICmpVision.h"
 
-#include "graphics/Frustum.h"
 #include "graphics/Model.h"
 #include "graphics/ObjectBase.h"
 #include "graphics/ObjectEntry.h"
@@ -42,9 +42,6 @@
 #include "maths/Matrix3D.h"
 #include "maths/Vector3D.h"
 #include "ps/CLogger.h"
-#include "renderer/Scene.h"
-
-#include "tools/atlas/GameInterface/GameLoop.h"
 
 class CCmpVisualActor : public ICmpVisual
 {
@@ -53,8 +50,8 @@ public:
 	{
 		componentManager.SubscribeToMessageType(MT_Update_Final);
 		componentManager.SubscribeToMessageType(MT_Interpolate);
-		componentManager.SubscribeToMessageType(MT_RenderSubmit);
 		componentManager.SubscribeToMessageType(MT_OwnershipChanged);
+		componentManager.SubscribeToMessageType(MT_Destroy);
 		componentManager.SubscribeGloballyToMessageType(MT_TerrainChanged);
 	}
 
@@ -64,6 +61,8 @@ private:
 	std::wstring m_ActorName;
 	CUnit* m_Unit;
 
+	ICmpUnitRenderer::tag_t m_RendererTag; // the model's registration with the UnitRenderer, if any
+
 	fixed m_R, m_G, m_B; // shading colour
 
 	std::map<std::string, std::string> m_AnimOverride;
@@ -167,6 +166,7 @@ public:
 	{
 		m_PreviouslyRendered = false;
 		m_Unit = NULL;
+		m_RendererTag = ICmpUnitRenderer::tag_t();
 		m_Visibility = ICmpRangeManager::VIS_HIDDEN;
 		m_R = m_G = m_B = fixed::FromInt(1);
 
@@ -281,12 +281,6 @@ public:
 			Interpolate(msgData.deltaSimTime, msgData.offset);
 			break;
 		}
-		case MT_RenderSubmit:
-		{
-			const CMessageRenderSubmit& msgData = static_cast<const CMessageRenderSubmit&> (msg);
-			RenderSubmit(msgData.collector, msgData.frustum, msgData.culling);
-			break;
-		}
 		case MT_OwnershipChanged:
 		{
 			const CMessageOwnershipChanged& msgData = static_cast<const CMessageOwnershipChanged&> (msg);
@@ -299,6 +293,19 @@ public:
 			m_Unit->GetModel().SetTerrainDirty(msgData.i0, msgData.j0, msgData.i1, msgData.j1);
 			break;
 		}
+		case MT_Destroy:
+		{
+			// Unregister now, since the UnitRenderer might be deleted before us
+			// when the whole simulation is reset
+			if (m_RendererTag.valid())
+			{
+				CmpPtr<ICmpUnitRenderer> cmpUnitRenderer(GetSimContext(), SYSTEM_ENTITY);
+				if (cmpUnitRenderer)
+					cmpUnitRenderer->RemoveUnit(m_RendererTag);
+				m_RendererTag = ICmpUnitRenderer::tag_t();
+			}
+			break;
+		}
 		}
 	}
 
@@ -493,7 +500,6 @@ private:
 	void Update(fixed turnLength);
 	void UpdateVisibility();
 	void Interpolate(float frameTime, float frameOffset);
-	void RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling);
 };
 
 REGISTER_COMPONENT_TYPE(VisualActor)
@@ -534,6 +540,19 @@ void CCmpVisualActor::InitModel(const CParamNode& paramNode)
 			InitSelectionShapeDescriptor(paramNode);
 
 			m_Unit->SetID(GetEntityId());
+
+			// Let the UnitRenderer submit the new model for rendering
+			CmpPtr<ICmpUnitRenderer> cmpUnitRenderer(GetSimContext(), SYSTEM_ENTITY);
+			if (cmpUnitRenderer)
+			{
+				if (m_RendererTag.valid())
+				{
+					cmpUnitRenderer->UpdateUnitModel(m_RendererTag, &m_Unit->GetModel());
+					cmpUnitRenderer->SetUnitHidden(m_RendererTag, m_Visibility == ICmpRangeManager::VIS_HIDDEN);
+				}
+				else
+					m_RendererTag = cmpUnitRenderer->AddUnit(&m_Unit->GetModel(), m_VisibleInAtlasOnly);
+			}
 		}
 	}
 }
@@ -727,6 +746,13 @@ void CCmpVisualActor::UpdateVisibility()
 		CmpPtr<ICmpSelectable> cmpSelectable(GetSimContext(), GetEntityId());
 		if (cmpSelectable)
 			cmpSelectable->SetVisibility(m_Visibility == ICmpRangeManager::VIS_HIDDEN ? false : true);
+
+		if (m_RendererTag.valid())
+		{
+			CmpPtr<ICmpUnitRenderer> cmpUnitRenderer(GetSimContext(), SYSTEM_ENTITY);
+			if (cmpUnitRenderer)
+				cmpUnitRenderer->SetUnitHidden(m_RendererTag, m_Visibility == ICmpRangeManager::VIS_HIDDEN);
+		}
 	}
 }
 
@@ -786,24 +812,13 @@ void CCmpVisualActor::Interpolate(float frameTime, float frameOffset)
 	{
 		model.ValidatePosition();
 		model.SetShadingColor(CColor(m_R.ToFloat(), m_G.ToFloat(), m_B.ToFloat(), 1.0f));
-	}
-}
 
-void CCmpVisualActor::RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling)
-{
-	if (m_Unit == NULL)
-		return;
-
-	if (m_Visibility == ICmpRangeManager::VIS_HIDDEN)
-		return;
-
-	CModelAbstract& model = m_Unit->GetModel();
-
-	if (culling && !frustum.IsBoxVisible(CVector3D(0, 0, 0), model.GetWorldBoundsRec()))
-		return;
-
-	if (!g_AtlasGameLoop->running && m_VisibleInAtlasOnly)
-		return;
-
-	collector.SubmitRecursive(&model);
+		// The model has moved, so the UnitRenderer needs its new bounds
+		if (m_RendererTag.valid())
+		{
+			CmpPtr<ICmpUnitRenderer> cmpUnitRenderer(GetSimContext(), SYSTEM_ENTITY);
+			if (cmpUnitRenderer)
+				cmpUnitRenderer->UpdateUnitBounds(m_RendererTag);
+		}
+	}
 }
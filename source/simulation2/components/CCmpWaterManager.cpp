@@ -80,10 +80,12 @@ public:
 			}
 			case MT_TerrainChanged:
 			{
-				// Tell the renderer to redraw the map.
+				// Tell the renderer to redraw the map, recomputing the shore data
+				// only around the changed tiles.
 				if (CRenderer::IsInitialised())
 				{
-					g_Renderer.GetWaterManager()->m_NeedsFullReloading = true;
+					const CMessageTerrainChanged& msgData = static_cast<const CMessageTerrainChanged&> (msg);
+					g_Renderer.GetWaterManager()->MakeShoreDataDirty(GetSimContext().GetTerrain(), msgData.i0, msgData.j0, msgData.i1, msgData.j1);
 					g_Renderer.GetWaterManager()->m_NeedsReloading = true;
 					g_Renderer.GetWaterManager()->m_TerrainChangeThisTurn = true;
 				}
@@ -24,8 +24,10 @@ class ICmpAIInterface : public IComponent
 {
 public:
 	/**
-	 * Returns a script object that represents the current world state,
-	 * to be passed to AI scripts.
+	 * Returns a script object that represents the changes to the world state
+	 * since the previous call, to be passed to AI scripts. Entities are only
+	 * included if their AIProxy has recorded a change, so AI workers must apply
+	 * this to their own persistent copy of the state.
 	 */
 	virtual CScriptVal GetRepresentation() = 0;
 	/**
@@ -220,11 +220,14 @@ public:
 	 * tiles that are intersected by a foundation-blocking shape will also have TILE_OBSTRUCTED_FOUNDATION;
 	 * tiles that are outside the world bounds will also have TILE_OUTOFBOUNDS;
 	 * others will be set to 0.
-	 * This is very cheap if the grid has been rasterised before and the set of shapes has not changed.
+	 * This is very cheap if the grid has been rasterised before and the set of shapes has not changed,
+	 * and if only a few shapes have changed then only the tiles near them are updated.
 	 * @param grid the grid to be updated
+	 * @param updateInfo set to the region of tiles that were recomputed (which is
+	 *   globally dirty if the whole grid was redone)
 	 * @return true if any changes were made to the grid, false if it was already up-to-date
 	 */
-	virtual bool Rasterise(Grid<u8>& grid) = 0;
+	virtual bool Rasterise(Grid<u8>& grid, GridUpdateInformation& updateInfo) = 0;
 
 	/**
 	 * Standard representation for all types of shapes, for use with geometry processing code.
@@ -247,6 +250,40 @@ public:
 	 */
 	virtual void GetObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares) = 0;
 
+	/**
+	 * Find the unit obstructions (ignoring static shapes) that are inside (or partially
+	 * inside) the given range. Parameters are as for GetObstructionsInRange.
+	 */
+	virtual void GetUnitObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares) = 0;
+
+	/**
+	 * A static shape, with the properties that an IObstructionTestFilter tests.
+	 */
+	struct StaticShapeData
+	{
+		tag_t tag;
+		flags_t flags;
+		entity_id_t group;
+		entity_id_t group2;
+		ObstructionSquare square;
+	};
+
+	/**
+	 * Find all the static shapes whose bounding boxes are inside (or partially inside)
+	 * the given range. No filter is applied, so that callers can cache the results
+	 * and filter them later.
+	 */
+	virtual void GetStaticShapesInRange(entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<StaticShapeData>& shapes) = 0;
+
+	/**
+	 * Returns the tiles that may be covered by static shapes which have been added,
+	 * moved, removed or had their control groups changed since @p dirtyID was returned
+	 * (everything is globally dirty if that was too long ago), and updates @p dirtyID
+	 * to the current state.
+	 * Pass 0 initially to get a globally dirty result.
+	 */
+	virtual GridUpdateInformation GetStaticShapeChanges(size_t& dirtyID) = 0;
+
 	/**
 	 * Find a single obstruction that blocks a unit at the given point with the given radius.
 	 * Static obstructions (buildings) are more important than unit obstructions, and
@@ -29,8 +29,10 @@
 #include <vector>
 
 class IObstructionTestFilter;
+class WorkerPool;
 
 template<typename T> class Grid;
+struct GridUpdateInformation;
 
 /**
  * Pathfinder algorithms.
@@ -96,6 +98,13 @@ public:
 
 	virtual const Grid<u16>& GetPassabilityGrid() = 0;
 
+	/**
+	 * Returns the region of the passability grid that has changed since it had
+	 * the given Grid::m_DirtyID, so that users holding an older copy only need to
+	 * update those tiles. The result is globally dirty if the changes are no longer known.
+	 */
+	virtual GridUpdateInformation GetPassabilityGridChanges(size_t dirtyID) = 0;
+
 	/**
 	 * Compute a tile-based path from the given point to the goal, and return the set of waypoints.
 	 * The waypoints correspond to the centers of horizontally/vertically adjacent tiles
@@ -200,6 +209,12 @@ public:
 	 */
 	virtual void ProcessSameTurnMoves() = 0;
 
+	/**
+	 * Returns the pool of threads that paths are computed with, which other components
+	 * can use for batches of independent jobs too.
+	 */
+	virtual WorkerPool& GetWorkerPool() = 0;
+
 	DECLARE_INTERFACE_TYPE(Pathfinder)
 };
 
@@ -319,6 +319,14 @@ public:
 	 */
 	virtual u8 GetPercentMapExplored(player_id_t player) = 0;
 
+	/**
+	 * Returns whether the LOS state of any vertex (for any player) may have changed
+	 * since @p dirtyID was last updated by this function (initialise it to 0), and
+	 * if so sets the inclusive bounds of the changed vertexes and updates @p dirtyID.
+	 * This lets renderers update only the changed parts of their LOS data.
+	 */
+	virtual bool GetLosDirtyRect(size_t* dirtyID, i32& i0, i32& j0, i32& i1, i32& j1) = 0;
+
 
 	/**
 	 * Perform some internal consistency checks for testing/debugging.
@@ -40,6 +40,15 @@ public:
 	 */
 	virtual const Grid<u8>& GetTerritoryGrid() = 0;
 
+	/**
+	 * Returns whether the owners of any tiles in the territory grid have changed since
+	 * @p changedID was last updated by this function (initialise it to 0), and if so
+	 * sets the inclusive bounds of the changed tiles and updates @p changedID.
+	 * (Changes to only the connected flags are not included.)
+	 * This lets renderers update only the changed parts of their territory data.
+	 */
+	virtual bool GetChangedTiles(size_t* changedID, i32& i0, i32& j0, i32& i1, i32& j1) = 0;
+
 	/**
 	 * Get owner of territory at given position.
 	 * @return player ID of owner; 0 if neutral territory
@@ -119,6 +119,11 @@ public:
 		m_Script.CallVoid("SetDebugOverlay", enabled);
 	}
 
+	virtual void Move(ICmpPosition* UNUSED(cmpPosition), ICmpPathfinder* UNUSED(cmpPathfinder), fixed UNUSED(dt))
+	{
+		// Scripted components don't register with the manager, and handle the update messages themselves
+	}
+
 };
 
 REGISTER_COMPONENT_SCRIPT_WRAPPER(UnitMotionScripted)
@@ -126,6 +126,13 @@ public:
 	 */
 	virtual void SetDebugOverlay(bool enabled) = 0;
 
+	/**
+	 * Do the per-turn movement and other updates, given the unit's own Position
+	 * component (which may be NULL) and the pathfinder.
+	 * This is called by ICmpUnitMotionManager, for the components that registered with it.
+	 */
+	virtual void Move(ICmpPosition* cmpPosition, ICmpPathfinder* cmpPathfinder, fixed dt) = 0;
+
 	DECLARE_INTERFACE_TYPE(UnitMotion)
 };
 
@@ -0,0 +1,42 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ICMPUNITMOTIONMANAGER
+#define INCLUDED_ICMPUNITMOTIONMANAGER
+
+#include "simulation2/system/Interface.h"
+
+class ICmpUnitMotion;
+
+/**
+ * Moves every unit with a (native) UnitMotion component each turn, instead of each
+ * of them handling the update messages separately.
+ */
+class ICmpUnitMotionManager : public IComponent
+{
+public:
+	/**
+	 * Adds the given component to the units that are moved every turn, in order of entity ID:
+	 * formation controllers on MT_Update_MotionFormation, and all other units
+	 * on MT_Update_MotionUnit. It is removed when its entity is destroyed.
+	 */
+	virtual void Register(entity_id_t ent, ICmpUnitMotion* cmpUnitMotion, bool formationController) = 0;
+
+	DECLARE_INTERFACE_TYPE(UnitMotionManager)
+};
+
+#endif // INCLUDED_ICMPUNITMOTIONMANAGER
@@ -0,0 +1,81 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ICMPUNITRENDERER
+#define INCLUDED_ICMPUNITRENDERER
+
+#include "simulation2/system/Interface.h"
+
+class CModelAbstract;
+
+/**
+ * Submits the models of every visual actor for rendering on MT_RenderSubmit,
+ * using a spatial index of their bounds so that only the models in visible parts
+ * of the map have to be tested against the frustum.
+ *
+ * The bounds are only updated when the owner calls UpdateUnitBounds (after
+ * interpolating the model's transform), so the owner must keep them current
+ * while the unit isn't hidden.
+ */
+class ICmpUnitRenderer : public IComponent
+{
+public:
+	/**
+	 * External identifiers for units.
+	 * (This is a struct rather than a raw u32 for type-safety.)
+	 */
+	struct tag_t
+	{
+		tag_t() : n(0) {}
+		explicit tag_t(u32 n) : n(n) {}
+		bool valid() const { return n != 0; }
+
+		u32 n;
+	};
+
+	/**
+	 * Adds the given model, initially hidden and without any bounds
+	 * (so it won't be rendered until UpdateUnitBounds has been called).
+	 * @param visibleInAtlasOnly only render the model while Atlas is in editing mode
+	 * @return a valid tag for manipulating the unit
+	 */
+	virtual tag_t AddUnit(CModelAbstract* model, bool visibleInAtlasOnly) = 0;
+
+	/**
+	 * Replaces the unit's model (which must then have its bounds updated before it's rendered).
+	 */
+	virtual void UpdateUnitModel(tag_t tag, CModelAbstract* model) = 0;
+
+	/**
+	 * Updates the bounds of the unit from the current world-space bounds of its model.
+	 */
+	virtual void UpdateUnitBounds(tag_t tag) = 0;
+
+	/**
+	 * Sets whether the unit should be skipped when rendering (e.g. because of LOS).
+	 */
+	virtual void SetUnitHidden(tag_t tag, bool hidden) = 0;
+
+	/**
+	 * Removes an existing unit. The tag must not be used afterwards.
+	 */
+	virtual void RemoveUnit(tag_t tag) = 0;
+
+	DECLARE_INTERFACE_TYPE(UnitRenderer)
+};
+
+#endif // INCLUDED_ICMPUNITRENDERER
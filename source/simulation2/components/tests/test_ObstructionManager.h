@@ -474,4 +474,119 @@ public:
 		TS_ASSERT_EQUALS(obSquare3.u, CFixedVector2D(fixed::FromInt(1), fixed::FromInt(0)));
 		TS_ASSERT_EQUALS(obSquare3.v, CFixedVector2D(fixed::FromInt(0), fixed::FromInt(1)));
 	}
+
+	/**
+	 * Verifies that incrementally rasterising a grid after shapes have changed
+	 * gives the same result as rasterising it from scratch.
+	 */
+	void test_rasterise_incremental()
+	{
+		const u16 size = 250; // 1000 world units / TERRAIN_TILE_SIZE
+		Grid<u8> grid(size, size);
+		GridUpdateInformation updateInfo;
+
+		TS_ASSERT(cmp->Rasterise(grid, updateInfo));
+		TS_ASSERT(updateInfo.globallyDirty);
+
+		TS_ASSERT(!cmp->Rasterise(grid, updateInfo));
+		TS_ASSERT(!updateInfo.dirty);
+
+		tag_t shape4 = cmp->AddStaticShape(4, fixed::FromInt(500), fixed::FromInt(500), fixed::FromFloat(0.5f), fixed::FromInt(20), fixed::FromInt(10),
+			ICmpObstructionManager::FLAG_BLOCK_PATHFINDING | ICmpObstructionManager::FLAG_BLOCK_FOUNDATION, INVALID_ENTITY);
+		cmp->MoveShape(shape3, fixed::FromInt(600), fixed::FromInt(200), fixed::Zero());
+		cmp->RemoveShape(shape2);
+
+		TS_ASSERT(cmp->Rasterise(grid, updateInfo));
+		TS_ASSERT(updateInfo.dirty);
+		TS_ASSERT(!updateInfo.globallyDirty);
+
+		Grid<u8> fullGrid(size, size);
+		GridUpdateInformation fullUpdateInfo;
+		TS_ASSERT(cmp->Rasterise(fullGrid, fullUpdateInfo));
+		TS_ASSERT(fullUpdateInfo.globallyDirty);
+
+		for (u16 j = 0; j < size; ++j)
+			for (u16 i = 0; i < size; ++i)
+				TS_ASSERT_EQUALS(grid.get(i, j), fullGrid.get(i, j));
+
+		TS_ASSERT(grid.get(125, 125) & ICmpObstructionManager::TILE_OBSTRUCTED_PATHFINDING);
+		TS_ASSERT(grid.get(150, 50) & ICmpObstructionManager::TILE_OBSTRUCTED_FOUNDATION);
+		TS_ASSERT(grid.get(0, 0) & ICmpObstructionManager::TILE_OUTOFBOUNDS);
+
+		cmp->RemoveShape(shape4);
+		TS_ASSERT(cmp->Rasterise(grid, updateInfo));
+		TS_ASSERT_EQUALS(grid.get(125, 125), (u8)0);
+	}
+
+	/**
+	 * Verifies that static shape changes are reported in the right region, so that
+	 * cached results of GetStaticShapesInRange can be invalidated.
+	 */
+	void test_static_shape_changes()
+	{
+		size_t dirtyID = 0;
+		GridUpdateInformation changes = cmp->GetStaticShapeChanges(dirtyID);
+		TS_ASSERT(changes.globallyDirty);
+
+		changes = cmp->GetStaticShapeChanges(dirtyID);
+		TS_ASSERT(!changes.dirty);
+
+		// Unit shapes don't count
+		cmp->MoveShape(shape3, fixed::FromInt(600), fixed::FromInt(200), fixed::Zero());
+		changes = cmp->GetStaticShapeChanges(dirtyID);
+		TS_ASSERT(!changes.dirty);
+
+		std::vector<ICmpObstructionManager::StaticShapeData> shapes;
+		cmp->GetStaticShapesInRange(fixed::FromInt(0), fixed::FromInt(0), fixed::FromInt(20), fixed::FromInt(20), shapes);
+		TS_ASSERT_EQUALS(shapes.size(), (size_t)1);
+		TS_ASSERT_EQUALS(shapes[0].tag.n, shape1.n);
+		TS_ASSERT_EQUALS(shapes[0].group, ent1g1);
+		TS_ASSERT_EQUALS(shapes[0].square.x, ent1x);
+
+		// Shapes that don't affect the rasterised grids still count
+		cmp->MoveShape(shape1, fixed::FromInt(500), fixed::FromInt(400), fixed::Zero());
+		changes = cmp->GetStaticShapeChanges(dirtyID);
+		TS_ASSERT(changes.dirty);
+		TS_ASSERT(!changes.globallyDirty);
+		TS_ASSERT(changes.i0 <= 2 && changes.j0 <= 2); // old position
+		TS_ASSERT(changes.i1 >= 125 && changes.j1 >= 100); // new position
+		TS_ASSERT(changes.i1 < 130 && changes.j1 < 105);
+
+		shapes.clear();
+		cmp->GetStaticShapesInRange(fixed::FromInt(0), fixed::FromInt(0), fixed::FromInt(20), fixed::FromInt(20), shapes);
+		TS_ASSERT(shapes.empty());
+
+		cmp->SetStaticControlGroup(shape1, ent1g1, 5);
+		changes = cmp->GetStaticShapeChanges(dirtyID);
+		TS_ASSERT(changes.dirty);
+		TS_ASSERT(changes.i0 >= 120 && changes.j0 >= 95);
+
+		cmp->SetBounds(fixed::FromInt(0), fixed::FromInt(0), fixed::FromInt(1000), fixed::FromInt(1000));
+		changes = cmp->GetStaticShapeChanges(dirtyID);
+		TS_ASSERT(changes.globallyDirty);
+	}
+
+	void test_tags_after_removal()
+	{
+		NullObstructionFilter nullFilter;
+
+		cmp->RemoveShape(shape2);
+		cmp->RemoveShape(shape1);
+
+		// Serialization must preserve which tags will be allocated next
+		testHelper->Roundtrip();
+
+		tag_t shape4 = cmp->AddUnitShape(ent2, ent2x, ent2z, ent2r, ICmpObstructionManager::FLAG_BLOCK_MOVEMENT, ent2g);
+		tag_t shape5 = cmp->AddStaticShape(ent1, ent1x, ent1z, ent1a, ent1w, ent1h, ICmpObstructionManager::FLAG_BLOCK_MOVEMENT, ent1g1, ent1g2);
+		TS_ASSERT(shape4.n != shape2.n && shape4.n != shape3.n);
+		TS_ASSERT(shape5.n != shape1.n);
+
+		std::vector<entity_id_t> out;
+		cmp->TestUnitShape(nullFilter, ent2x, ent2z, ent2r/2, &out);
+		TS_ASSERT_EQUALS(2U, out.size());
+		TS_ASSERT_VECTOR_CONTAINS(out, ent1);
+		TS_ASSERT_VECTOR_CONTAINS(out, ent2);
+
+		testHelper->Roundtrip();
+	}
 };
@@ -139,4 +139,102 @@ public:
 		for (size_t i = 0; i < path.m_Waypoints.size(); ++i)
 			printf("# %d: %f %f\n", (int)i, path.m_Waypoints[i].x.ToFloat(), path.m_Waypoints[i].z.ToFloat());
 	}
+
+	/**
+	 * Short paths through a dense forest, where the search range contains
+	 * hundreds of small static obstructions.
+	 */
+	void test_performance_short_forest_DISABLED()
+	{
+		CTerrain terrain;
+		terrain.Initialize(5, NULL);
+
+		CSimulation2 sim2(NULL, &terrain);
+		sim2.LoadDefaultScripts();
+		sim2.ResetState();
+
+		const entity_pos_t range = entity_pos_t::FromInt(TERRAIN_TILE_SIZE*12);
+
+		CmpPtr<ICmpObstructionManager> cmpObstructionMan(sim2, SYSTEM_ENTITY);
+		CmpPtr<ICmpPathfinder> cmpPathfinder(sim2, SYSTEM_ENTITY);
+
+		// Trees every 3 units, slightly jittered and a quarter of them rotated
+		srand(0);
+		for (int j = 0; j < 48; ++j)
+		{
+			for (int i = 0; i < 48; ++i)
+			{
+				fixed x = fixed::FromInt(i*3 + 2) + fixed::FromInt(rand() % 8) / 8;
+				fixed z = fixed::FromInt(j*3 + 2) + fixed::FromInt(rand() % 8) / 8;
+				entity_angle_t a = (rand() % 4 == 0) ? fixed::FromInt(rand() % 6) / 8 : fixed::Zero();
+				cmpObstructionMan->AddStaticShape(INVALID_ENTITY, x, z, a, fixed::FromFloat(1.5f), fixed::FromFloat(1.5f),
+					ICmpObstructionManager::FLAG_BLOCK_MOVEMENT, INVALID_ENTITY);
+			}
+		}
+
+		NullObstructionFilter filter;
+		ICmpPathfinder::pass_class_t passClass = cmpPathfinder->GetPassabilityClass("default");
+
+		double t = timer_Time();
+
+		for (size_t n = 0; n < 64; ++n)
+		{
+			entity_pos_t x0 = range + entity_pos_t::FromInt(rand() % 48);
+			entity_pos_t z0 = range + entity_pos_t::FromInt(rand() % 48);
+			ICmpPathfinder::Goal goal = { ICmpPathfinder::Goal::POINT, x0 + range/2, z0 + range/3 };
+			ICmpPathfinder::Path path;
+			cmpPathfinder->ComputeShortPath(filter, x0, z0, fixed::FromFloat(0.8f), range, goal, passClass, path);
+		}
+
+		t = timer_Time() - t;
+		printf("[%f]", t);
+	}
+
+	/**
+	 * Long paths for a large group of units sent to the same goal,
+	 * which are computed together with a flow field.
+	 */
+	void test_performance_group_DISABLED()
+	{
+		CTerrain terrain;
+
+		CSimulation2 sim2(NULL, &terrain);
+		sim2.LoadDefaultScripts();
+		sim2.ResetState();
+
+		CMapReader* mapReader = new CMapReader(); // it'll call "delete this" itself
+
+		LDR_BeginRegistering();
+		mapReader->LoadMap(L"maps/scenarios/Median Oasis 01.pmp", &terrain, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+			&sim2, &sim2.GetSimContext(), -1, false);
+		LDR_EndRegistering();
+		TS_ASSERT_OK(LDR_NonprogressiveLoad());
+
+		sim2.Update(0);
+
+		CmpPtr<ICmpPathfinder> cmp(sim2, SYSTEM_ENTITY);
+
+		ICmpPathfinder::Goal goal = { ICmpPathfinder::Goal::CIRCLE, entity_pos_t::FromInt(400), entity_pos_t::FromInt(400) };
+		goal.hw = entity_pos_t::FromInt(8);
+
+		double t = timer_Time();
+
+		srand(1234);
+		for (size_t n = 0; n < 16; ++n)
+		{
+			// A blob of 100 units ordered to the same place
+			entity_pos_t x = entity_pos_t::FromInt(32 + rand() % 128);
+			entity_pos_t z = entity_pos_t::FromInt(32 + rand() % 128);
+			for (size_t u = 0; u < 100; ++u)
+			{
+				entity_pos_t x0 = x + entity_pos_t::FromInt(rand() % 32);
+				entity_pos_t z0 = z + entity_pos_t::FromInt(rand() % 32);
+				cmp->ComputePathAsync(x0, z0, goal, cmp->GetPassabilityClass("default"), cmp->GetCostClass("default"), INVALID_ENTITY);
+			}
+			cmp->FinishAsyncRequests();
+		}
+
+		t = timer_Time() - t;
+		printf("[%f]", t);
+	}
 };
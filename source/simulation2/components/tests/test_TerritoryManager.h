@@ -18,8 +18,16 @@
 #include "simulation2/system/ComponentTest.h"
 
 #include "ps/CStr.h"
+#include "graphics/MapReader.h"
 #include "graphics/Terrain.h"
+#include "graphics/TerrainTextureManager.h"
 #include "graphics/TerritoryBoundary.h"
+#include "lib/timer.h"
+#include "lib/tex/tex.h"
+#include "ps/Loader.h"
+#include "simulation2/MessageTypes.h"
+#include "simulation2/Simulation2.h"
+#include "simulation2/components/ICmpTerritoryManager.h"
 #include "simulation2/helpers/Grid.h"
 
 class TestCmpTerritoryManager : public CxxTest::TestSuite
@@ -246,6 +254,60 @@ public:
 		TestBoundaryPointsEqual(threesOuter->points, threesOuterExpectedPoints);
 	}
 
+	// disabled by default; run tests with the "-test TestCmpTerritoryManager" flag to enable
+	void test_performance_DISABLED()
+	{
+		CXeromyces::Startup();
+
+		g_VFS = CreateVfs(20 * MiB);
+		TS_ASSERT_OK(g_VFS->Mount(L"", DataDir()/"mods"/"public", VFS_MOUNT_MUST_EXIST));
+		TS_ASSERT_OK(g_VFS->Mount(L"cache/", DataDir()/"cache"));
+
+		// Need some stuff for terrain movement costs
+		tex_codec_register_all();
+		new CTerrainTextureManager;
+		g_TexMan.LoadTerrainTextures();
+
+		{
+			CTerrain terrain;
+
+			CSimulation2 sim2(NULL, &terrain);
+			sim2.LoadDefaultScripts();
+			sim2.ResetState();
+
+			CMapReader* mapReader = new CMapReader(); // it'll call "delete this" itself
+
+			LDR_BeginRegistering();
+			mapReader->LoadMap(L"maps/scenarios/Median Oasis 01.pmp", &terrain, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+				&sim2, &sim2.GetSimContext(), -1, false);
+			LDR_EndRegistering();
+			TS_ASSERT_OK(LDR_NonprogressiveLoad());
+
+			sim2.Update(0);
+
+			CmpPtr<ICmpTerritoryManager> cmpTerritoryManager(sim2, SYSTEM_ENTITY);
+			ssize_t tiles = terrain.GetTilesPerSide();
+
+			// Time full recomputations, which flood-fill every influence entity
+			double t = timer_Time();
+			for (size_t i = 0; i < 16; ++i)
+			{
+				CMessageTerrainChanged msg(0, 0, tiles, tiles);
+				sim2.GetSimContext().GetComponentManager().BroadcastMessage(msg);
+				cmpTerritoryManager->GetTerritoryGrid();
+			}
+			t = timer_Time() - t;
+			printf("[%f]", t / 16);
+		}
+
+		delete &g_TexMan;
+		tex_codec_unregister_all();
+
+		g_VFS.reset();
+
+		CXeromyces::Terminate();
+	}
+
 private:
 	/// Parses a string representation of a grid into an actual Grid structure, such that the (i,j) axes are located in the bottom
 	/// left hand side of the map. Note: leaves all custom bits in the grid values at zero (anything outside 
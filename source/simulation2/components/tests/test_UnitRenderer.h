@@ -0,0 +1,157 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation2/system/ComponentTest.h"
+
+#include "simulation2/components/ICmpUnitRenderer.h"
+
+#include "graphics/Frustum.h"
+#include "graphics/ModelAbstract.h"
+#include "maths/Vector4D.h"
+#include "renderer/Scene.h"
+
+#include <set>
+
+class MockModel : public CModelAbstract
+{
+public:
+	MockModel(float x0, float x1) { SetBounds(x0, x1); }
+
+	void SetBounds(float x0, float x1)
+	{
+		m_Bounds = CBoundingBoxAligned(CVector3D(x0, 0, 10), CVector3D(x1, 5, 12));
+		InvalidateBounds();
+	}
+
+	virtual CModelAbstract* Clone() const { return NULL; }
+	virtual void SetDirtyRec(int UNUSED(dirtyflags)) { }
+	virtual void SetTerrainDirty(ssize_t UNUSED(i0), ssize_t UNUSED(j0), ssize_t UNUSED(i1), ssize_t UNUSED(j1)) { }
+	virtual void ValidatePosition() { }
+	virtual void InvalidatePosition() { }
+	virtual void CalcBounds() { m_WorldBounds = m_Bounds; }
+
+	CBoundingBoxAligned m_Bounds;
+};
+
+class MockCollector : public SceneCollector
+{
+public:
+	virtual void Submit(CPatch* UNUSED(patch)) { }
+	virtual void Submit(SOverlayLine* UNUSED(overlay)) { }
+	virtual void Submit(SOverlayTexturedLine* UNUSED(overlay)) { }
+	virtual void Submit(SOverlaySprite* UNUSED(overlay)) { }
+	virtual void Submit(SOverlayQuad* UNUSED(overlay)) { }
+	virtual void Submit(CModelDecal* UNUSED(decal)) { }
+	virtual void Submit(CParticleEmitter* UNUSED(emitter)) { }
+	virtual void SubmitNonRecursive(CModel* UNUSED(model)) { }
+	virtual void SubmitRecursive(CModelAbstract* model) { m_Models.insert(model); }
+
+	std::set<CModelAbstract*> m_Models;
+};
+
+class TestCmpUnitRenderer : public CxxTest::TestSuite
+{
+	typedef ICmpUnitRenderer::tag_t tag_t;
+
+public:
+	void setUp()
+	{
+		CXeromyces::Startup();
+	}
+
+	void tearDown()
+	{
+		CXeromyces::Terminate();
+	}
+
+	std::set<CModelAbstract*> Submit(ComponentTestHelper& test, ICmpUnitRenderer* cmp, const CFrustum& frustum, bool culling)
+	{
+		MockCollector collector;
+		CMessageRenderSubmit msg(collector, frustum, culling);
+		test.HandleMessage(cmp, msg, false);
+		return collector.m_Models;
+	}
+
+	void test_submit()
+	{
+		ComponentTestHelper test;
+		ICmpUnitRenderer* cmp = test.Add<ICmpUnitRenderer>(CID_UnitRenderer, "");
+
+		// Only x > 100 is visible
+		CFrustum frustum;
+		frustum.AddPlane(CPlane(CVector4D(1, 0, 0, -100)));
+
+		MockModel a(5, 15); // fully outside
+		MockModel b(195, 205); // fully inside
+		MockModel c(94, 104); // intersecting, in the same cell (96 <= x < 128) as d and e
+		MockModel d(97, 99); // outside, in a partially visible cell
+		MockModel e(110, 115); // inside, in a partially visible cell
+		MockModel hidden(195, 205);
+		MockModel noBounds(195, 205);
+
+		MockModel* models[] = { &a, &b, &c, &d, &e, &hidden, &noBounds };
+		tag_t tags[7];
+		for (size_t i = 0; i < 7; ++i)
+		{
+			tags[i] = cmp->AddUnit(models[i], false);
+			TS_ASSERT(tags[i].valid());
+			if (models[i] != &noBounds)
+			{
+				cmp->UpdateUnitBounds(tags[i]);
+				if (models[i] != &hidden)
+					cmp->SetUnitHidden(tags[i], false);
+			}
+		}
+
+		std::set<CModelAbstract*> out = Submit(test, cmp, frustum, true);
+		TS_ASSERT_EQUALS(out.size(), (size_t)3);
+		TS_ASSERT(out.count(&b) && out.count(&c) && out.count(&e));
+
+		// Without culling, everything not hidden (and with bounds) is submitted
+		out = Submit(test, cmp, frustum, false);
+		TS_ASSERT_EQUALS(out.size(), (size_t)5);
+		TS_ASSERT(!out.count(&hidden) && !out.count(&noBounds));
+
+		// Move units into and out of view
+		a.SetBounds(300, 310);
+		cmp->UpdateUnitBounds(tags[0]);
+		b.SetBounds(20, 30);
+		cmp->UpdateUnitBounds(tags[1]);
+		c.SetBounds(600, 610);
+		cmp->UpdateUnitBounds(tags[2]);
+		out = Submit(test, cmp, frustum, true);
+		TS_ASSERT_EQUALS(out.size(), (size_t)3);
+		TS_ASSERT(out.count(&a) && out.count(&c) && out.count(&e));
+
+		cmp->SetUnitHidden(tags[0], true);
+		cmp->SetUnitHidden(tags[5], false);
+		cmp->RemoveUnit(tags[4]);
+		out = Submit(test, cmp, frustum, true);
+		TS_ASSERT_EQUALS(out.size(), (size_t)2);
+		TS_ASSERT(out.count(&c) && out.count(&hidden));
+
+		// Replaced models aren't submitted until they have bounds
+		MockModel f(400, 410);
+		cmp->UpdateUnitModel(tags[2], &f);
+		out = Submit(test, cmp, frustum, true);
+		TS_ASSERT_EQUALS(out.size(), (size_t)1);
+		cmp->UpdateUnitBounds(tags[2]);
+		out = Submit(test, cmp, frustum, true);
+		TS_ASSERT_EQUALS(out.size(), (size_t)2);
+		TS_ASSERT(out.count(&f) && out.count(&hidden));
+	}
+};
@@ -0,0 +1,217 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ENTITYMAP
+#define INCLUDED_ENTITYMAP
+
+#include "simulation2/system/Entity.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+/**
+ * A fast replacement for std::map<entity_id_t, T>, for data attached to
+ * normal (non-local) entities.
+ *
+ * Since entity IDs are allocated sequentially and never reused, the values
+ * are stored contiguously in a vector indexed directly by ID, so lookups are
+ * a single array access instead of a tree walk, and entities created close
+ * together in time are close together in memory.
+ * Unused slots have their key set to INVALID_ENTITY.
+ *
+ * Iteration is in increasing ID order, the same as std::map, so serialization
+ * is deterministic and byte-compatible with SerializeMap.
+ *
+ * Local entities must not be stored here (their IDs are far too large).
+ */
+template<typename T>
+class EntityMap
+{
+public:
+	typedef entity_id_t key_type;
+	typedef T mapped_type;
+	typedef std::pair<entity_id_t, T> value_type;
+
+private:
+	typedef std::vector<value_type> container_type;
+
+	// Grow by at least this many slots at a time, to avoid frequent reallocation
+	// while the map is being populated
+	static const size_t GROWTH_INCREMENT = 4096;
+
+public:
+	template<typename C, typename V, typename I>
+	class iterator_base
+	{
+		friend class EntityMap;
+		template<typename C2, typename V2, typename I2> friend class iterator_base;
+
+	public:
+		iterator_base() : m_Container(NULL) { }
+
+		// Allow conversion from iterator to const_iterator
+		template<typename C2, typename V2, typename I2>
+		iterator_base(const iterator_base<C2, V2, I2>& other) :
+			m_Container(other.m_Container), m_It(other.m_It)
+		{
+		}
+
+		V& operator*() const { return *m_It; }
+		V* operator->() const { return &*m_It; }
+
+		iterator_base& operator++()
+		{
+			++m_It;
+			SkipInvalid();
+			return *this;
+		}
+
+		iterator_base operator++(int)
+		{
+			iterator_base ret = *this;
+			++*this;
+			return ret;
+		}
+
+		template<typename C2, typename V2, typename I2>
+		bool operator==(const iterator_base<C2, V2, I2>& rhs) const { return m_It == rhs.m_It; }
+
+		template<typename C2, typename V2, typename I2>
+		bool operator!=(const iterator_base<C2, V2, I2>& rhs) const { return m_It != rhs.m_It; }
+
+	private:
+		iterator_base(C* container, I it) : m_Container(container), m_It(it)
+		{
+			SkipInvalid();
+		}
+
+		void SkipInvalid()
+		{
+			while (m_It != m_Container->end() && m_It->first == INVALID_ENTITY)
+				++m_It;
+		}
+
+		C* m_Container;
+		I m_It;
+	};
+
+	typedef iterator_base<container_type, value_type, typename container_type::iterator> iterator;
+	typedef iterator_base<const container_type, const value_type, typename container_type::const_iterator> const_iterator;
+
+	EntityMap() : m_Count(0)
+	{
+	}
+
+	iterator begin() { return iterator(&m_Data, m_Data.begin()); }
+	iterator end() { return iterator(&m_Data, m_Data.end()); }
+	const_iterator begin() const { return const_iterator(&m_Data, m_Data.begin()); }
+	const_iterator end() const { return const_iterator(&m_Data, m_Data.end()); }
+
+	size_t size() const { return m_Count; }
+	bool empty() const { return m_Count == 0; }
+
+	void clear()
+	{
+		m_Data.clear();
+		m_Count = 0;
+	}
+
+	/**
+	 * Insert a value if the key isn't already present.
+	 * Returns the iterator for the key, and whether the insertion happened
+	 * (like std::map::insert).
+	 */
+	std::pair<iterator, bool> insert(const value_type& value)
+	{
+		entity_id_t ent = value.first;
+		ENSURE(ent != INVALID_ENTITY && ENTITY_IS_NORMAL(ent));
+
+		if (ent >= m_Data.size())
+		{
+			if (ent >= m_Data.capacity())
+				m_Data.reserve(std::max((size_t)ent + GROWTH_INCREMENT, m_Data.capacity() * 2));
+			m_Data.resize(ent + 1, value_type(INVALID_ENTITY, T()));
+		}
+
+		value_type& slot = m_Data[ent];
+		if (slot.first != INVALID_ENTITY)
+			return std::make_pair(iterator(&m_Data, m_Data.begin() + ent), false);
+
+		slot = value;
+		++m_Count;
+		return std::make_pair(iterator(&m_Data, m_Data.begin() + ent), true);
+	}
+
+	iterator find(entity_id_t ent)
+	{
+		if (ent >= m_Data.size() || m_Data[ent].first == INVALID_ENTITY)
+			return end();
+		return iterator(&m_Data, m_Data.begin() + ent);
+	}
+
+	const_iterator find(entity_id_t ent) const
+	{
+		if (ent >= m_Data.size() || m_Data[ent].first == INVALID_ENTITY)
+			return end();
+		return const_iterator(&m_Data, m_Data.begin() + ent);
+	}
+
+	/**
+	 * Returns a pointer to the value for the given entity, or NULL if it's
+	 * not present. (Cheaper than find() since no iterator needs constructing.)
+	 */
+	T* get(entity_id_t ent)
+	{
+		if (ent >= m_Data.size() || m_Data[ent].first == INVALID_ENTITY)
+			return NULL;
+		return &m_Data[ent].second;
+	}
+
+	const T* get(entity_id_t ent) const
+	{
+		if (ent >= m_Data.size() || m_Data[ent].first == INVALID_ENTITY)
+			return NULL;
+		return &m_Data[ent].second;
+	}
+
+	void erase(iterator it)
+	{
+		it.m_It->first = INVALID_ENTITY;
+		it.m_It->second = T();
+		--m_Count;
+
+		// Shrink the used range if we removed the highest entity
+		while (!m_Data.empty() && m_Data.back().first == INVALID_ENTITY)
+			m_Data.pop_back();
+	}
+
+	size_t erase(entity_id_t ent)
+	{
+		iterator it = find(ent);
+		if (it == end())
+			return 0;
+		erase(it);
+		return 1;
+	}
+
+private:
+	container_type m_Data;
+	size_t m_Count;
+};
+
+#endif // INCLUDED_ENTITYMAP
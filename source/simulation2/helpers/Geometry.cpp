@@ -21,6 +21,10 @@
 
 #include "maths/FixedVector2D.h"
 
+#if HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 using namespace Geometry;
 
 // TODO: all of these things could be optimised quite easily
@@ -333,3 +337,66 @@ bool Geometry::TestSquareSquare(
 
 	return true;
 }
+
+void Geometry::TestBoundingBoxes_Scalar(const PackedBoundingBoxes& boxes, fixed x0, fixed z0, fixed x1, fixed z1, std::vector<u32>& out)
+{
+	const i32 qx0 = x0.GetInternalValue();
+	const i32 qz0 = z0.GetInternalValue();
+	const i32 qx1 = x1.GetInternalValue();
+	const i32 qz1 = z1.GetInternalValue();
+
+	for (size_t i = 0; i < boxes.size(); ++i)
+	{
+		if (!(qx0 > boxes.x1[i] || boxes.x0[i] > qx1 || qz0 > boxes.z1[i] || boxes.z0[i] > qz1))
+			out.push_back((u32)i);
+	}
+}
+
+void Geometry::TestBoundingBoxes(const PackedBoundingBoxes& boxes, fixed x0, fixed z0, fixed x1, fixed z1, std::vector<u32>& out)
+{
+#if HAVE_SSE2
+	const size_t n = boxes.size();
+	size_t i = 0;
+
+	if (n >= 4)
+	{
+		const __m128i qx0 = _mm_set1_epi32(x0.GetInternalValue());
+		const __m128i qz0 = _mm_set1_epi32(z0.GetInternalValue());
+		const __m128i qx1 = _mm_set1_epi32(x1.GetInternalValue());
+		const __m128i qz1 = _mm_set1_epi32(z1.GetInternalValue());
+
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128i bx0 = _mm_loadu_si128((const __m128i*)&boxes.x0[i]);
+			__m128i bz0 = _mm_loadu_si128((const __m128i*)&boxes.z0[i]);
+			__m128i bx1 = _mm_loadu_si128((const __m128i*)&boxes.x1[i]);
+			__m128i bz1 = _mm_loadu_si128((const __m128i*)&boxes.z1[i]);
+
+			// A box is separated if it's entirely to one side of the query box
+			__m128i separated = _mm_or_si128(
+				_mm_or_si128(_mm_cmpgt_epi32(qx0, bx1), _mm_cmpgt_epi32(bx0, qx1)),
+				_mm_or_si128(_mm_cmpgt_epi32(qz0, bz1), _mm_cmpgt_epi32(bz0, qz1)));
+
+			int overlapping = ~_mm_movemask_ps(_mm_castsi128_ps(separated)) & 0xF;
+			for (int k = 0; overlapping; ++k, overlapping >>= 1)
+			{
+				if (overlapping & 1)
+					out.push_back((u32)(i + k));
+			}
+		}
+	}
+
+	// Test the remaining boxes one at a time
+	const i32 sqx0 = x0.GetInternalValue();
+	const i32 sqz0 = z0.GetInternalValue();
+	const i32 sqx1 = x1.GetInternalValue();
+	const i32 sqz1 = z1.GetInternalValue();
+	for (; i < n; ++i)
+	{
+		if (!(sqx0 > boxes.x1[i] || boxes.x0[i] > sqx1 || sqz0 > boxes.z1[i] || boxes.z0[i] > sqz1))
+			out.push_back((u32)i);
+	}
+#else
+	TestBoundingBoxes_Scalar(boxes, x0, z0, x1, z1, out);
+#endif
+}
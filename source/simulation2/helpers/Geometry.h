@@ -26,6 +26,8 @@
 #include "maths/Fixed.h"
 #include "maths/MathUtil.h"
 
+#include <vector>
+
 class CFixedVector2D;
 
 namespace Geometry
@@ -85,6 +87,49 @@ bool TestSquareSquare(
 		CFixedVector2D c0, CFixedVector2D u0, CFixedVector2D v0, CFixedVector2D halfSize0,
 		CFixedVector2D c1, CFixedVector2D u1, CFixedVector2D v1, CFixedVector2D halfSize1);
 
+/**
+ * Axis-aligned bounding boxes of a list of shapes, stored as separate arrays
+ * of the CFixed internal values so that TestBoundingBoxes can load several
+ * boxes at once.
+ */
+struct PackedBoundingBoxes
+{
+	std::vector<i32> x0, z0, x1, z1;
+
+	size_t size() const { return x0.size(); }
+
+	void clear()
+	{
+		x0.clear();
+		z0.clear();
+		x1.clear();
+		z1.clear();
+	}
+
+	void push_back(fixed bx0, fixed bz0, fixed bx1, fixed bz1)
+	{
+		x0.push_back(bx0.GetInternalValue());
+		z0.push_back(bz0.GetInternalValue());
+		x1.push_back(bx1.GetInternalValue());
+		z1.push_back(bz1.GetInternalValue());
+	}
+};
+
+/**
+ * Broadphase collision test: appends to @p out the indexes (in increasing order)
+ * of the boxes that overlap the box from (x0, z0) to (x1, z1). Boxes that only
+ * touch count as overlapping.
+ *
+ * This only compares integers, so the SSE2 version (used when the compiler
+ * supports it) gives exactly the same results as TestBoundingBoxes_Scalar.
+ */
+void TestBoundingBoxes(const PackedBoundingBoxes& boxes, fixed x0, fixed z0, fixed x1, fixed z1, std::vector<u32>& out);
+
+/**
+ * Non-SIMD version of TestBoundingBoxes (exposed for testing).
+ */
+void TestBoundingBoxes_Scalar(const PackedBoundingBoxes& boxes, fixed x0, fixed z0, fixed x1, fixed z1, std::vector<u32>& out);
+
 } // namespace
 
 #endif // INCLUDED_HELPER_GEOMETRY
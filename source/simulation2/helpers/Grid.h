@@ -18,7 +18,10 @@
 #ifndef INCLUDED_GRID
 #define INCLUDED_GRID
 
+#include <algorithm>
 #include <cstring>
+#include <deque>
+#include <utility>
 
 #ifdef NDEBUG
 #define GRID_BOUNDS_DEBUG 0
@@ -173,4 +176,141 @@ public:
 	size_t m_DirtyID; // if this is < the id maintained by ICmpObstructionManager then it needs to be updated
 };
 
+/**
+ * Describes the region of a grid that was modified by an update:
+ * either nothing, an inclusive rectangle of cells, or (if @c globallyDirty)
+ * potentially the whole grid.
+ */
+struct GridUpdateInformation
+{
+	bool dirty;
+	bool globallyDirty;
+	u16 i0, j0, i1, j1; // inclusive bounds of the dirty cells (only meaningful if dirty && !globallyDirty)
+
+	GridUpdateInformation()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		dirty = globallyDirty = false;
+		i0 = j0 = i1 = j1 = 0;
+	}
+
+	void MarkAll()
+	{
+		dirty = globallyDirty = true;
+		i0 = j0 = 0;
+		i1 = j1 = 0xFFFF;
+	}
+
+	/**
+	 * Extend the dirty region to include the given (inclusive) rectangle.
+	 */
+	void Merge(u16 ri0, u16 rj0, u16 ri1, u16 rj1)
+	{
+		if (globallyDirty)
+			return;
+
+		if (!dirty)
+		{
+			dirty = true;
+			i0 = ri0;
+			j0 = rj0;
+			i1 = ri1;
+			j1 = rj1;
+			return;
+		}
+
+		i0 = std::min(i0, ri0);
+		j0 = std::min(j0, rj0);
+		i1 = std::max(i1, ri1);
+		j1 = std::max(j1, rj1);
+	}
+
+	void Merge(const GridUpdateInformation& other)
+	{
+		if (other.globallyDirty)
+			MarkAll();
+		else if (other.dirty)
+			Merge(other.i0, other.j0, other.i1, other.j1);
+	}
+};
+
+/**
+ * Records the regions modified by the most recent updates of a grid (identified
+ * by their Grid::m_DirtyID), so that the owner of a copy made at an older
+ * m_DirtyID can find which cells it needs to refresh instead of redoing everything.
+ * Only a limited number of updates are remembered; older copies are reported as
+ * globally dirty.
+ */
+class GridUpdateHistory
+{
+public:
+	GridUpdateHistory() : m_BaseID(0)
+	{
+	}
+
+	/**
+	 * Forget all recorded updates, so that any copy older than @p dirtyID
+	 * is considered globally dirty.
+	 */
+	void Reset(size_t dirtyID)
+	{
+		m_Updates.clear();
+		m_BaseID = dirtyID;
+	}
+
+	/**
+	 * Record the region modified by the update that produced @p dirtyID.
+	 */
+	void Add(size_t dirtyID, const GridUpdateInformation& info)
+	{
+		if (info.globallyDirty)
+		{
+			Reset(dirtyID);
+			return;
+		}
+
+		m_Updates.push_back(std::make_pair(dirtyID, info));
+
+		if (m_Updates.size() > MAX_UPDATES)
+		{
+			m_BaseID = m_Updates.front().first;
+			m_Updates.pop_front();
+		}
+	}
+
+	/**
+	 * Returns the region modified between a copy made at @p dirtyID and
+	 * the current version @p currentID.
+	 */
+	GridUpdateInformation GetChangesSince(size_t dirtyID, size_t currentID) const
+	{
+		GridUpdateInformation info;
+
+		if (dirtyID == currentID)
+			return info;
+
+		if (dirtyID < m_BaseID || dirtyID > currentID)
+		{
+			info.MarkAll();
+			return info;
+		}
+
+		for (std::deque<std::pair<size_t, GridUpdateInformation> >::const_iterator it = m_Updates.begin(); it != m_Updates.end(); ++it)
+			if (it->first > dirtyID)
+				info.Merge(it->second);
+
+		return info;
+	}
+
+private:
+	static const size_t MAX_UPDATES = 256;
+
+	std::deque<std::pair<size_t, GridUpdateInformation> > m_Updates;
+	size_t m_BaseID; // copies at this ID or newer can be updated from m_Updates
+};
+
 #endif // INCLUDED_GRID
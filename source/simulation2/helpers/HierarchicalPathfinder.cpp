@@ -0,0 +1,514 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "HierarchicalPathfinder.h"
+
+#include "maths/FixedVector2D.h"
+#include "ps/Profile.h"
+#include "simulation2/components/CCmpPathfinder_Common.h"
+#include "simulation2/helpers/PriorityQueue.h"
+
+void HierarchicalPathfinder::Chunk::InitRegions(int ci, int cj, const Grid<u16>& grid, pass_class_t passClass)
+{
+	ENSURE(ci < 256 && cj < 256); // avoid overflows
+
+	m_ChunkI = (u8)ci;
+	m_ChunkJ = (u8)cj;
+
+	memset(m_Regions, 0, sizeof(m_Regions));
+	m_NumRegions = 0;
+
+	int i0 = ci * CHUNK_SIZE;
+	int j0 = cj * CHUNK_SIZE;
+	int w = std::min((int)CHUNK_SIZE, (int)grid.m_W - i0);
+	int h = std::min((int)CHUNK_SIZE, (int)grid.m_H - j0);
+
+	// Flood-fill each group of 4-connected passable tiles with a new region ID,
+	// summing up the tile positions so we can find the middle of each region
+	std::vector<u32> sumI, sumJ, count;
+	std::vector<std::pair<int, int> > stack;
+
+	for (int j = 0; j < h; ++j)
+	{
+		for (int i = 0; i < w; ++i)
+		{
+			if (m_Regions[j][i] || !IS_PASSABLE(grid.get(i0 + i, j0 + j), passClass))
+				continue;
+
+			u16 r = ++m_NumRegions;
+			sumI.push_back(0);
+			sumJ.push_back(0);
+			count.push_back(0);
+
+			m_Regions[j][i] = r;
+			stack.push_back(std::make_pair(i, j));
+			while (!stack.empty())
+			{
+				int pi = stack.back().first;
+				int pj = stack.back().second;
+				stack.pop_back();
+
+				sumI[r-1] += pi;
+				sumJ[r-1] += pj;
+				count[r-1] += 1;
+
+				const int di[] = { -1, 1, 0, 0 };
+				const int dj[] = { 0, 0, -1, 1 };
+				for (int n = 0; n < 4; ++n)
+				{
+					int ni = pi + di[n];
+					int nj = pj + dj[n];
+					if (ni < 0 || ni >= w || nj < 0 || nj >= h)
+						continue;
+					if (m_Regions[nj][ni] || !IS_PASSABLE(grid.get(i0 + ni, j0 + nj), passClass))
+						continue;
+					m_Regions[nj][ni] = r;
+					stack.push_back(std::make_pair(ni, nj));
+				}
+			}
+		}
+	}
+
+	// Pick the tile of each region closest to the region's average position,
+	// to act as its centre for the abstract search
+	m_GlobalRegions.assign(m_NumRegions, 0);
+	m_CentreI.assign(m_NumRegions, 0);
+	m_CentreJ.assign(m_NumRegions, 0);
+	std::vector<u32> bestDist(m_NumRegions, std::numeric_limits<u32>::max());
+
+	for (int j = 0; j < h; ++j)
+	{
+		for (int i = 0; i < w; ++i)
+		{
+			u16 r = m_Regions[j][i];
+			if (!r)
+				continue;
+
+			int di = i - (int)(sumI[r-1] / count[r-1]);
+			int dj = j - (int)(sumJ[r-1] / count[r-1]);
+			u32 dist = (u32)(di*di + dj*dj);
+			if (dist < bestDist[r-1])
+			{
+				bestDist[r-1] = dist;
+				m_CentreI[r-1] = (u16)(i0 + i);
+				m_CentreJ[r-1] = (u16)(j0 + j);
+			}
+		}
+	}
+}
+
+HierarchicalPathfinder::HierarchicalPathfinder() :
+	m_MapSize(0), m_ChunksW(0), m_ChunksH(0)
+{
+}
+
+void HierarchicalPathfinder::Recompute(const std::map<std::string, pass_class_t>& passClassMasks, const Grid<u16>& grid)
+{
+	PROFILE3("Hierarchical Recompute");
+
+	m_MapSize = grid.m_W;
+	m_ChunksW = (u16)((grid.m_W + CHUNK_SIZE - 1) / CHUNK_SIZE);
+	m_ChunksH = (u16)((grid.m_H + CHUNK_SIZE - 1) / CHUNK_SIZE);
+
+	m_Classes.clear();
+	m_DirtyChunks.assign(m_ChunksW * m_ChunksH, false);
+
+	for (std::map<std::string, pass_class_t>::const_iterator it = passClassMasks.begin(); it != passClassMasks.end(); ++it)
+	{
+		pass_class_t passClass = it->second;
+
+		// Several names might share a mask
+		if (m_Classes.find(passClass) != m_Classes.end())
+			continue;
+
+		ClassData& data = m_Classes[passClass];
+		data.m_Chunks.resize(m_ChunksW * m_ChunksH);
+
+		for (int cj = 0; cj < m_ChunksH; ++cj)
+			for (int ci = 0; ci < m_ChunksW; ++ci)
+				data.m_Chunks[ci + cj*m_ChunksW].InitRegions(ci, cj, grid, passClass);
+
+		for (int cj = 0; cj < m_ChunksH; ++cj)
+			for (int ci = 0; ci < m_ChunksW; ++ci)
+				FindEdges(data, ci, cj);
+
+		UpdateGlobalRegions(data);
+	}
+}
+
+void HierarchicalPathfinder::Update(const Grid<u16>& grid)
+{
+	if (std::find(m_DirtyChunks.begin(), m_DirtyChunks.end(), true) == m_DirtyChunks.end())
+		return;
+
+	PROFILE3("Hierarchical Update");
+
+	for (std::map<pass_class_t, ClassData>::iterator it = m_Classes.begin(); it != m_Classes.end(); ++it)
+	{
+		ClassData& data = it->second;
+
+		// Recompute all the dirty chunks before linking them up, since
+		// neighbouring dirty chunks will refer to each other's regions
+		for (int cj = 0; cj < m_ChunksH; ++cj)
+		{
+			for (int ci = 0; ci < m_ChunksW; ++ci)
+			{
+				if (!m_DirtyChunks[ci + cj*m_ChunksW])
+					continue;
+				RemoveEdges(data, ci, cj);
+				data.m_Chunks[ci + cj*m_ChunksW].InitRegions(ci, cj, grid, it->first);
+			}
+		}
+
+		for (int cj = 0; cj < m_ChunksH; ++cj)
+			for (int ci = 0; ci < m_ChunksW; ++ci)
+				if (m_DirtyChunks[ci + cj*m_ChunksW])
+					FindEdges(data, ci, cj);
+
+		UpdateGlobalRegions(data);
+	}
+
+	m_DirtyChunks.assign(m_DirtyChunks.size(), false);
+}
+
+void HierarchicalPathfinder::RemoveEdges(ClassData& data, int ci, int cj)
+{
+	const Chunk& chunk = data.m_Chunks[ci + cj*m_ChunksW];
+	for (u16 r = 1; r <= chunk.m_NumRegions; ++r)
+	{
+		RegionID region((u8)ci, (u8)cj, r);
+		EdgesMap::iterator it = data.m_Edges.find(region);
+		if (it == data.m_Edges.end())
+			continue;
+
+		// Edges are symmetric, so we can find all the references to this region
+		for (std::set<RegionID>::const_iterator nit = it->second.begin(); nit != it->second.end(); ++nit)
+			data.m_Edges[*nit].erase(region);
+
+		data.m_Edges.erase(it);
+	}
+}
+
+void HierarchicalPathfinder::FindEdges(ClassData& data, int ci, int cj)
+{
+	const Chunk& a = data.m_Chunks[ci + cj*m_ChunksW];
+
+	// Tiles outside the map are stored as impassable, so we can always
+	// scan the whole border of partial chunks
+
+	if (ci > 0)
+	{
+		const Chunk& b = data.m_Chunks[(ci-1) + cj*m_ChunksW];
+		for (int j = 0; j < CHUNK_SIZE; ++j)
+		{
+			RegionID ra((u8)ci, (u8)cj, a.m_Regions[j][0]);
+			RegionID rb((u8)(ci-1), (u8)cj, b.m_Regions[j][CHUNK_SIZE-1]);
+			if (ra.r && rb.r)
+			{
+				data.m_Edges[ra].insert(rb);
+				data.m_Edges[rb].insert(ra);
+			}
+		}
+	}
+
+	if (ci < m_ChunksW-1)
+	{
+		const Chunk& b = data.m_Chunks[(ci+1) + cj*m_ChunksW];
+		for (int j = 0; j < CHUNK_SIZE; ++j)
+		{
+			RegionID ra((u8)ci, (u8)cj, a.m_Regions[j][CHUNK_SIZE-1]);
+			RegionID rb((u8)(ci+1), (u8)cj, b.m_Regions[j][0]);
+			if (ra.r && rb.r)
+			{
+				data.m_Edges[ra].insert(rb);
+				data.m_Edges[rb].insert(ra);
+			}
+		}
+	}
+
+	if (cj > 0)
+	{
+		const Chunk& b = data.m_Chunks[ci + (cj-1)*m_ChunksW];
+		for (int i = 0; i < CHUNK_SIZE; ++i)
+		{
+			RegionID ra((u8)ci, (u8)cj, a.m_Regions[0][i]);
+			RegionID rb((u8)ci, (u8)(cj-1), b.m_Regions[CHUNK_SIZE-1][i]);
+			if (ra.r && rb.r)
+			{
+				data.m_Edges[ra].insert(rb);
+				data.m_Edges[rb].insert(ra);
+			}
+		}
+	}
+
+	if (cj < m_ChunksH-1)
+	{
+		const Chunk& b = data.m_Chunks[ci + (cj+1)*m_ChunksW];
+		for (int i = 0; i < CHUNK_SIZE; ++i)
+		{
+			RegionID ra((u8)ci, (u8)cj, a.m_Regions[CHUNK_SIZE-1][i]);
+			RegionID rb((u8)ci, (u8)(cj+1), b.m_Regions[0][i]);
+			if (ra.r && rb.r)
+			{
+				data.m_Edges[ra].insert(rb);
+				data.m_Edges[rb].insert(ra);
+			}
+		}
+	}
+}
+
+void HierarchicalPathfinder::UpdateGlobalRegions(ClassData& data)
+{
+	for (size_t n = 0; n < data.m_Chunks.size(); ++n)
+		std::fill(data.m_Chunks[n].m_GlobalRegions.begin(), data.m_Chunks[n].m_GlobalRegions.end(), 0);
+
+	// Flood-fill the abstract graph, giving each connected component a new ID
+	u16 nextGlobal = 1;
+	std::vector<RegionID> stack;
+	for (size_t n = 0; n < data.m_Chunks.size(); ++n)
+	{
+		Chunk& chunk = data.m_Chunks[n];
+		for (u16 r = 1; r <= chunk.m_NumRegions; ++r)
+		{
+			if (chunk.m_GlobalRegions[r-1])
+				continue;
+
+			u16 g = nextGlobal++;
+			chunk.m_GlobalRegions[r-1] = g;
+			stack.push_back(RegionID(chunk.m_ChunkI, chunk.m_ChunkJ, r));
+			while (!stack.empty())
+			{
+				RegionID curr = stack.back();
+				stack.pop_back();
+
+				EdgesMap::const_iterator it = data.m_Edges.find(curr);
+				if (it == data.m_Edges.end())
+					continue;
+
+				for (std::set<RegionID>::const_iterator nit = it->second.begin(); nit != it->second.end(); ++nit)
+				{
+					Chunk& neighbour = data.m_Chunks[nit->ci + nit->cj*m_ChunksW];
+					if (neighbour.m_GlobalRegions[nit->r-1])
+						continue;
+					neighbour.m_GlobalRegions[nit->r-1] = g;
+					stack.push_back(*nit);
+				}
+			}
+		}
+	}
+}
+
+const HierarchicalPathfinder::ClassData* HierarchicalPathfinder::GetClassData(pass_class_t passClass) const
+{
+	std::map<pass_class_t, ClassData>::const_iterator it = m_Classes.find(passClass);
+	if (it == m_Classes.end())
+		return NULL;
+	return &it->second;
+}
+
+HierarchicalPathfinder::RegionID HierarchicalPathfinder::Get(u16 i, u16 j, pass_class_t passClass) const
+{
+	const ClassData* data = GetClassData(passClass);
+	if (!data || i >= m_MapSize || j >= m_MapSize)
+		return RegionID();
+
+	int ci = i / CHUNK_SIZE;
+	int cj = j / CHUNK_SIZE;
+	const Chunk& chunk = data->m_Chunks[ci + cj*m_ChunksW];
+	return RegionID((u8)ci, (u8)cj, chunk.m_Regions[j % CHUNK_SIZE][i % CHUNK_SIZE]);
+}
+
+u16 HierarchicalPathfinder::GetGlobalRegion(u16 i, u16 j, pass_class_t passClass) const
+{
+	RegionID region = Get(i, j, passClass);
+	if (!region.r)
+		return 0;
+
+	const ClassData* data = GetClassData(passClass);
+	return data->m_Chunks[region.ci + region.cj*m_ChunksW].m_GlobalRegions[region.r-1];
+}
+
+bool HierarchicalPathfinder::FindNearestPassableTile(u16& i, u16& j, pass_class_t passClass, u16 globalRegion) const
+{
+	const ClassData* data = GetClassData(passClass);
+	if (!data)
+		return false;
+
+	bool found = false;
+	int bestDist = std::numeric_limits<int>::max();
+	u16 bestI = i, bestJ = j;
+
+	// Search outwards in square rings, until no tile in the next ring
+	// could be closer than the best tile found so far
+	for (int r = 0; r < m_MapSize; ++r)
+	{
+		if (found && r*r > bestDist)
+			break;
+
+		for (int dj = -r; dj <= r; ++dj)
+		{
+			// Only visit the edges of the ring
+			int step = (dj == -r || dj == r) ? 1 : 2*r;
+			for (int di = -r; di <= r; di += step)
+			{
+				int ti = (int)i + di;
+				int tj = (int)j + dj;
+				if (ti < 0 || ti >= m_MapSize || tj < 0 || tj >= m_MapSize)
+					continue;
+
+				int dist = di*di + dj*dj;
+				if (dist >= bestDist)
+					continue;
+
+				int ci = ti / CHUNK_SIZE;
+				int cj = tj / CHUNK_SIZE;
+				const Chunk& chunk = data->m_Chunks[ci + cj*m_ChunksW];
+				u16 region = chunk.m_Regions[tj % CHUNK_SIZE][ti % CHUNK_SIZE];
+				if (!region)
+					continue;
+				if (globalRegion && chunk.m_GlobalRegions[region-1] != globalRegion)
+					continue;
+
+				found = true;
+				bestDist = dist;
+				bestI = (u16)ti;
+				bestJ = (u16)tj;
+			}
+		}
+	}
+
+	if (!found)
+		return false;
+
+	i = bestI;
+	j = bestJ;
+	return true;
+}
+
+/**
+ * Node data for the abstract A* search.
+ */
+struct AbstractPathNode
+{
+	u32 g;
+	HierarchicalPathfinder::RegionID pred;
+	bool closed;
+};
+
+bool HierarchicalPathfinder::ComputeAbstractPath(u16 i0, u16 j0, u16 i1, u16 j1, pass_class_t passClass, std::vector<RegionID>& path) const
+{
+	PROFILE3("ComputeAbstractPath");
+
+	const ClassData* data = GetClassData(passClass);
+	if (!data)
+		return false;
+
+	RegionID start = Get(i0, j0, passClass);
+	RegionID goal = Get(i1, j1, passClass);
+	if (!start.r || !goal.r)
+		return false;
+
+	path.clear();
+	if (start == goal)
+	{
+		path.push_back(start);
+		return true;
+	}
+
+	// Costs and heuristics are the straight-line distances between region
+	// centres, in fixed-point tiles (which is consistent, so closed nodes
+	// never need reopening)
+	const Chunk& goalChunk = data->m_Chunks[goal.ci + goal.cj*m_ChunksW];
+	CFixedVector2D goalPos(fixed::FromInt(goalChunk.m_CentreI[goal.r-1]), fixed::FromInt(goalChunk.m_CentreJ[goal.r-1]));
+
+	typedef PriorityQueueHeap<RegionID, u32> AbstractQueue;
+	AbstractQueue open;
+	std::map<RegionID, AbstractPathNode> nodes;
+
+	AbstractPathNode startNode = { 0, start, false };
+	nodes[start] = startNode;
+	AbstractQueue::Item startItem = { start, 0 };
+	open.push(startItem);
+
+	while (!open.empty())
+	{
+		AbstractQueue::Item curr = open.pop();
+		AbstractPathNode& currNode = nodes[curr.id];
+		currNode.closed = true;
+
+		if (curr.id == goal)
+		{
+			// Reconstruct the path (in reverse)
+			for (RegionID r = goal; r != start; r = nodes[r].pred)
+				path.push_back(r);
+			path.push_back(start);
+			std::reverse(path.begin(), path.end());
+			return true;
+		}
+
+		EdgesMap::const_iterator it = data->m_Edges.find(curr.id);
+		if (it == data->m_Edges.end())
+			continue;
+
+		const Chunk& currChunk = data->m_Chunks[curr.id.ci + curr.id.cj*m_ChunksW];
+		CFixedVector2D currPos(fixed::FromInt(currChunk.m_CentreI[curr.id.r-1]), fixed::FromInt(currChunk.m_CentreJ[curr.id.r-1]));
+		u32 currG = currNode.g;
+
+		for (std::set<RegionID>::const_iterator nit = it->second.begin(); nit != it->second.end(); ++nit)
+		{
+			const Chunk& chunk = data->m_Chunks[nit->ci + nit->cj*m_ChunksW];
+			CFixedVector2D pos(fixed::FromInt(chunk.m_CentreI[nit->r-1]), fixed::FromInt(chunk.m_CentreJ[nit->r-1]));
+
+			u32 g = currG + (u32)(pos - currPos).Length().GetInternalValue();
+			u32 h = (u32)(goalPos - pos).Length().GetInternalValue();
+
+			std::map<RegionID, AbstractPathNode>::iterator nodeIt = nodes.find(*nit);
+			if (nodeIt == nodes.end())
+			{
+				AbstractPathNode n = { g, curr.id, false };
+				nodes[*nit] = n;
+				AbstractQueue::Item t = { *nit, g + h };
+				open.push(t);
+			}
+			else if (!nodeIt->second.closed && g < nodeIt->second.g)
+			{
+				nodeIt->second.g = g;
+				nodeIt->second.pred = curr.id;
+				open.promote(*nit, g + h);
+			}
+		}
+	}
+
+	return false;
+}
+
+void HierarchicalPathfinder::GetCorridor(const std::vector<RegionID>& path, std::vector<u8>& corridor) const
+{
+	corridor.assign(m_ChunksW * m_ChunksH, 0);
+	for (size_t n = 0; n < path.size(); ++n)
+	{
+		int ci0 = std::max((int)path[n].ci - 1, 0);
+		int cj0 = std::max((int)path[n].cj - 1, 0);
+		int ci1 = std::min((int)path[n].ci + 1, (int)m_ChunksW - 1);
+		int cj1 = std::min((int)path[n].cj + 1, (int)m_ChunksH - 1);
+		for (int cj = cj0; cj <= cj1; ++cj)
+			for (int ci = ci0; ci <= ci1; ++ci)
+				corridor[ci + cj*m_ChunksW] = 1;
+	}
+}
@@ -0,0 +1,209 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_HIERARCHICALPATHFINDER
+#define INCLUDED_HIERARCHICALPATHFINDER
+
+#include "simulation2/components/ICmpPathfinder.h"
+#include "simulation2/helpers/Grid.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+/**
+ * Hierarchical pathfinder.
+ *
+ * The map is split into square chunks of CHUNK_SIZE*CHUNK_SIZE tiles. Within each
+ * chunk, the passable tiles of each passability class are grouped into regions
+ * (sets of tiles that are 4-connected to each other inside the chunk, matching
+ * the moves made by the tile pathfinder). Regions in adjacent chunks are connected
+ * by an edge when they share a border, giving a small abstract graph, and each
+ * connected component of that graph is given a 'global region' ID.
+ *
+ * This lets us:
+ *  - test whether one tile can be reached from another in O(1), by comparing
+ *    their global regions;
+ *  - quickly find the nearest reachable tile to an unreachable goal;
+ *  - find an abstract path of regions across the map, which the tile pathfinder
+ *    can use to restrict its search to a corridor of chunks.
+ *
+ * The data is derived entirely from the passability grid, so it is not serialized.
+ * When the grid changes, callers should MarkDirty() the changed tiles and then
+ * call Update(), which only recomputes the affected chunks.
+ */
+class HierarchicalPathfinder
+{
+public:
+	typedef ICmpPathfinder::pass_class_t pass_class_t;
+
+	/**
+	 * Width/height of a chunk, in tiles.
+	 */
+	static const u16 CHUNK_SIZE = 32;
+
+	/**
+	 * Identifies a region within a chunk. r == 0 means an impassable tile.
+	 */
+	struct RegionID
+	{
+		u8 ci, cj; // chunk ID
+		u16 r; // unique-per-chunk local region ID
+
+		RegionID() : ci(0), cj(0), r(0) { }
+		RegionID(u8 ci, u8 cj, u16 r) : ci(ci), cj(cj), r(r) { }
+
+		bool operator<(const RegionID& b) const
+		{
+			// Sort by chunk ID, then by per-chunk region ID
+			if (ci < b.ci)
+				return true;
+			if (b.ci < ci)
+				return false;
+			if (cj < b.cj)
+				return true;
+			if (b.cj < cj)
+				return false;
+			return r < b.r;
+		}
+
+		bool operator==(const RegionID& b) const
+		{
+			return ((ci == b.ci) && (cj == b.cj) && (r == b.r));
+		}
+
+		bool operator!=(const RegionID& b) const
+		{
+			return !(*this == b);
+		}
+	};
+
+	HierarchicalPathfinder();
+
+	/**
+	 * Returns whether Recompute has been called for a map of the given size.
+	 */
+	bool IsInitialised(u16 mapSize) const
+	{
+		return !m_Classes.empty() && m_MapSize == mapSize;
+	}
+
+	/**
+	 * Recomputes all chunks for every passability class.
+	 */
+	void Recompute(const std::map<std::string, pass_class_t>& passClassMasks, const Grid<u16>& grid);
+
+	/**
+	 * Records that the given tile's passability has changed, so that the next
+	 * Update() will recompute its chunk.
+	 */
+	void MarkDirty(u16 i, u16 j)
+	{
+		m_DirtyChunks[(i / CHUNK_SIZE) + (j / CHUNK_SIZE) * m_ChunksW] = true;
+	}
+
+	/**
+	 * Recomputes every chunk marked by MarkDirty() since the last update,
+	 * then the global regions.
+	 */
+	void Update(const Grid<u16>& grid);
+
+	/**
+	 * Returns the region containing the given tile (with r == 0 if the tile is impassable).
+	 */
+	RegionID Get(u16 i, u16 j, pass_class_t passClass) const;
+
+	/**
+	 * Returns the global region (connected component) of the given tile,
+	 * or 0 if the tile is impassable.
+	 */
+	u16 GetGlobalRegion(u16 i, u16 j, pass_class_t passClass) const;
+
+	/**
+	 * Returns whether a unit of the given class at tile (i0, j0)
+	 * could move to tile (i1, j1).
+	 */
+	bool IsReachable(u16 i0, u16 j0, u16 i1, u16 j1, pass_class_t passClass) const
+	{
+		u16 g = GetGlobalRegion(i0, j0, passClass);
+		return g != 0 && g == GetGlobalRegion(i1, j1, passClass);
+	}
+
+	/**
+	 * Finds the passable tile nearest to (i, j) (including (i, j) itself).
+	 * If @p globalRegion is non-zero, only tiles in that global region are considered.
+	 * Returns false (and leaves i, j unchanged) if there is no such tile.
+	 */
+	bool FindNearestPassableTile(u16& i, u16& j, pass_class_t passClass, u16 globalRegion) const;
+
+	/**
+	 * Computes a sequence of regions leading from the region of (i0, j0) to the
+	 * region of (i1, j1), using A* over the abstract graph.
+	 * Both tiles must be passable and in the same global region.
+	 * Returns false if no path was found.
+	 */
+	bool ComputeAbstractPath(u16 i0, u16 j0, u16 i1, u16 j1, pass_class_t passClass, std::vector<RegionID>& path) const;
+
+	/**
+	 * Marks the chunks containing the given regions, and the chunks
+	 * surrounding them, in @p corridor (indexed by ci + cj*GetChunksW()).
+	 */
+	void GetCorridor(const std::vector<RegionID>& path, std::vector<u8>& corridor) const;
+
+	u16 GetChunksW() const { return m_ChunksW; }
+
+private:
+	struct Chunk
+	{
+		u8 m_ChunkI, m_ChunkJ;
+
+		u16 m_NumRegions;
+		u16 m_Regions[CHUNK_SIZE][CHUNK_SIZE]; // local region ID per tile, indexed [j][i]; 0 = impassable
+
+		// Per-region data, indexed by r-1
+		std::vector<u16> m_GlobalRegions; // connected component of each region
+		std::vector<u16> m_CentreI, m_CentreJ; // representative tile of each region (in map coordinates)
+
+		void InitRegions(int ci, int cj, const Grid<u16>& grid, pass_class_t passClass);
+	};
+
+	typedef std::map<RegionID, std::set<RegionID> > EdgesMap;
+
+	struct ClassData
+	{
+		std::vector<Chunk> m_Chunks; // indexed by ci + cj*m_ChunksW
+		EdgesMap m_Edges;
+	};
+
+	const ClassData* GetClassData(pass_class_t passClass) const;
+
+	void RecomputeChunk(ClassData& data, int ci, int cj, const Grid<u16>& grid, pass_class_t passClass);
+
+	void FindEdges(ClassData& data, int ci, int cj);
+
+	void RemoveEdges(ClassData& data, int ci, int cj);
+
+	void UpdateGlobalRegions(ClassData& data);
+
+	u16 m_MapSize;
+	u16 m_ChunksW, m_ChunksH;
+
+	std::map<pass_class_t, ClassData> m_Classes;
+	std::vector<bool> m_DirtyChunks;
+};
+
+#endif // INCLUDED_HIERARCHICALPATHFINDER
@@ -196,4 +196,101 @@ public:
 	std::vector<Item> m_List;
 };
 
+/**
+ * Priority queue of u32 ranks implemented as a radix heap, which pops the
+ * highest rank first (like PriorityQueueHeap with std::greater<u32>).
+ *
+ * It's a monotone queue: an item must never be pushed with a higher rank than
+ * the last popped item, which holds for best-first searches whose steps can't
+ * increase the rank (e.g. flood fills with non-negative falloffs).
+ * Items are kept in buckets by the highest bit in which their rank differs from
+ * the last popped rank, so push is O(1) and pop is amortised O(log R) in the range
+ * of ranks, with no comparisons between items except when a bucket is split.
+ *
+ * Items of equal rank are popped in an unspecified (but deterministic) order.
+ */
+template <typename ID>
+class PriorityQueueRadix
+{
+public:
+	struct Item
+	{
+		ID id;
+		u32 rank;
+	};
+
+	PriorityQueueRadix() :
+		m_Last(0xFFFFFFFF), m_Size(0)
+	{
+	}
+
+	void push(const Item& item)
+	{
+#if PRIORITYQUEUE_DEBUG
+		ENSURE(item.rank <= m_Last);
+#endif
+		m_Buckets[BucketIndex(item.rank)].push_back(item);
+		++m_Size;
+	}
+
+	Item pop()
+	{
+#if PRIORITYQUEUE_DEBUG
+		ENSURE(m_Size);
+#endif
+		if (m_Buckets[0].empty())
+		{
+			// Find the bucket with the highest ranks, and split it up relative to its best rank
+			size_t b = 1;
+			while (m_Buckets[b].empty())
+				++b;
+
+			std::vector<Item>& bucket = m_Buckets[b];
+			u32 best = 0;
+			for (size_t n = 0; n < bucket.size(); ++n)
+				best = std::max(best, bucket[n].rank);
+
+			m_Last = best;
+			for (size_t n = 0; n < bucket.size(); ++n)
+				m_Buckets[BucketIndex(bucket[n].rank)].push_back(bucket[n]); // always into a lower bucket
+			bucket.clear();
+		}
+
+		Item r = m_Buckets[0].back();
+		m_Buckets[0].pop_back();
+		--m_Size;
+		return r;
+	}
+
+	bool empty()
+	{
+		return m_Size == 0;
+	}
+
+	size_t size()
+	{
+		return m_Size;
+	}
+
+private:
+	size_t BucketIndex(u32 rank) const
+	{
+		u32 x = rank ^ m_Last;
+		if (x == 0)
+			return 0;
+
+		size_t n = 1;
+		if (x & 0xFFFF0000) { n += 16; x >>= 16; }
+		if (x & 0xFF00) { n += 8; x >>= 8; }
+		if (x & 0xF0) { n += 4; x >>= 4; }
+		if (x & 0xC) { n += 2; x >>= 2; }
+		if (x & 0x2) { n += 1; }
+		return n;
+	}
+
+	std::vector<Item> m_Buckets[33];
+	u32 m_Last; // rank of the last popped item
+	size_t m_Size;
+};
+
 #endif // INCLUDED_PRIORITYQUEUE
@@ -0,0 +1,252 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_SLOTMAP
+#define INCLUDED_SLOTMAP
+
+#include <utility>
+#include <vector>
+
+template<typename VS> struct SerializeSlotMap;
+
+/**
+ * A container for objects that are referred to by an ID allocated on insertion,
+ * as a replacement for std::map<u32, T> with a counter.
+ *
+ * The values are stored contiguously in a vector of slots, and removed values'
+ * slots are reused by later insertions, so the storage stays as dense as the
+ * number of live values allows. An ID combines the slot index (in the low
+ * INDEX_BITS bits) with a generation number that changes each time the slot
+ * is reused, so lookups are a single array access and an ID that refers to a
+ * removed value is detected instead of silently finding its replacement.
+ * (Generations wrap around after MAX_GENERATION reuses of a single slot.)
+ *
+ * IDs are never 0, and always fit in 31 bits.
+ *
+ * Iteration is in increasing slot index order. Allocation only depends on the
+ * sequence of insertions and removals, and SerializeSlotMap stores the free
+ * slots too, so IDs allocated after deserialization are the same as they would
+ * have been without it.
+ */
+template<typename T>
+class SlotMap
+{
+	template<typename VS> friend struct SerializeSlotMap;
+
+public:
+	typedef u32 id_t;
+	typedef T mapped_type;
+	typedef std::pair<id_t, T> value_type;
+
+	static const u32 INDEX_BITS = 20;
+	static const u32 INDEX_MASK = (1u << INDEX_BITS) - 1;
+	static const u32 MAX_GENERATION = (1u << (31 - INDEX_BITS)) - 1;
+
+private:
+	// Each slot stores the ID of its current value, or the ID of the last value
+	// it held with FREE_BIT set (so the generation can be incremented on reuse)
+	static const u32 FREE_BIT = 0x80000000u;
+
+	typedef std::vector<value_type> container_type;
+
+public:
+	template<typename C, typename V, typename I>
+	class iterator_base
+	{
+		friend class SlotMap;
+		template<typename C2, typename V2, typename I2> friend class iterator_base;
+
+	public:
+		iterator_base() : m_Container(NULL) { }
+
+		// Allow conversion from iterator to const_iterator
+		template<typename C2, typename V2, typename I2>
+		iterator_base(const iterator_base<C2, V2, I2>& other) :
+			m_Container(other.m_Container), m_It(other.m_It)
+		{
+		}
+
+		V& operator*() const { return *m_It; }
+		V* operator->() const { return &*m_It; }
+
+		iterator_base& operator++()
+		{
+			++m_It;
+			SkipFree();
+			return *this;
+		}
+
+		iterator_base operator++(int)
+		{
+			iterator_base ret = *this;
+			++*this;
+			return ret;
+		}
+
+		template<typename C2, typename V2, typename I2>
+		bool operator==(const iterator_base<C2, V2, I2>& rhs) const { return m_It == rhs.m_It; }
+
+		template<typename C2, typename V2, typename I2>
+		bool operator!=(const iterator_base<C2, V2, I2>& rhs) const { return m_It != rhs.m_It; }
+
+	private:
+		iterator_base(C* container, I it) : m_Container(container), m_It(it)
+		{
+			SkipFree();
+		}
+
+		void SkipFree()
+		{
+			while (m_It != m_Container->end() && (m_It->first & FREE_BIT))
+				++m_It;
+		}
+
+		C* m_Container;
+		I m_It;
+	};
+
+	typedef iterator_base<container_type, value_type, typename container_type::iterator> iterator;
+	typedef iterator_base<const container_type, const value_type, typename container_type::const_iterator> const_iterator;
+
+	SlotMap() : m_Count(0)
+	{
+	}
+
+	iterator begin() { return iterator(&m_Slots, m_Slots.begin()); }
+	iterator end() { return iterator(&m_Slots, m_Slots.end()); }
+	const_iterator begin() const { return const_iterator(&m_Slots, m_Slots.begin()); }
+	const_iterator end() const { return const_iterator(&m_Slots, m_Slots.end()); }
+
+	size_t size() const { return m_Count; }
+	bool empty() const { return m_Count == 0; }
+
+	void clear()
+	{
+		m_Slots.clear();
+		m_FreeSlots.clear();
+		m_Count = 0;
+	}
+
+	/**
+	 * Stores a copy of the value in a free slot, and returns its new ID.
+	 */
+	id_t insert(const T& value)
+	{
+		id_t id;
+		if (m_FreeSlots.empty())
+		{
+			id = (id_t)m_Slots.size() | (1u << INDEX_BITS);
+			ENSURE((id & INDEX_MASK) == m_Slots.size()); // too many values
+			m_Slots.push_back(value_type(id, value));
+		}
+		else
+		{
+			u32 index = m_FreeSlots.back();
+			m_FreeSlots.pop_back();
+
+			value_type& slot = m_Slots[index];
+			u32 generation = ((slot.first & ~FREE_BIT) >> INDEX_BITS) + 1;
+			if (generation > MAX_GENERATION)
+				generation = 1;
+			id = (generation << INDEX_BITS) | index;
+			slot.first = id;
+			slot.second = value;
+		}
+
+		++m_Count;
+		return id;
+	}
+
+	iterator find(id_t id)
+	{
+		if (!contains(id))
+			return end();
+		return iterator(&m_Slots, m_Slots.begin() + (id & INDEX_MASK));
+	}
+
+	const_iterator find(id_t id) const
+	{
+		if (!contains(id))
+			return end();
+		return const_iterator(&m_Slots, m_Slots.begin() + (id & INDEX_MASK));
+	}
+
+	/**
+	 * Returns a pointer to the value with the given ID, or NULL if there
+	 * is none (e.g. because it has been erased).
+	 */
+	T* get(id_t id)
+	{
+		if (!contains(id))
+			return NULL;
+		return &m_Slots[id & INDEX_MASK].second;
+	}
+
+	const T* get(id_t id) const
+	{
+		if (!contains(id))
+			return NULL;
+		return &m_Slots[id & INDEX_MASK].second;
+	}
+
+	/**
+	 * Returns the value with the given ID, which must be valid.
+	 * (Unlike std::map, this never inserts anything.)
+	 */
+	T& operator[](id_t id)
+	{
+		ENSURE(contains(id));
+		return m_Slots[id & INDEX_MASK].second;
+	}
+
+	const T& operator[](id_t id) const
+	{
+		ENSURE(contains(id));
+		return m_Slots[id & INDEX_MASK].second;
+	}
+
+	void erase(iterator it)
+	{
+		m_FreeSlots.push_back(it.m_It->first & INDEX_MASK);
+		it.m_It->first |= FREE_BIT;
+		it.m_It->second = T();
+		--m_Count;
+	}
+
+	size_t erase(id_t id)
+	{
+		iterator it = find(id);
+		if (it == end())
+			return 0;
+		erase(it);
+		return 1;
+	}
+
+private:
+	bool contains(id_t id) const
+	{
+		// Free slots never match, since IDs don't have FREE_BIT set
+		u32 index = id & INDEX_MASK;
+		return index < m_Slots.size() && m_Slots[index].first == id;
+	}
+
+	container_type m_Slots;
+	std::vector<u32> m_FreeSlots; // indexes of free slots, reused from the back
+	size_t m_Count;
+};
+
+#endif // INCLUDED_SLOTMAP
@@ -46,28 +46,34 @@ public:
 	/**
 	 * Equivalence test (ignoring order of items within each subdivision)
 	 */
-	bool operator==(const SpatialSubdivision& rhs)
+	bool operator==(const SpatialSubdivision& rhs) const
 	{
 		if (m_DivisionSize != rhs.m_DivisionSize || m_DivisionsW != rhs.m_DivisionsW || m_DivisionsH != rhs.m_DivisionsH)
 			return false;
-		
-		for (u32 j = 0; j < m_DivisionsH; ++j)
+
+		// Reuse the same buffers for every division, so we only allocate
+		// when a division is bigger than any seen before
+		std::vector<T> div1;
+		std::vector<T> div2;
+		for (size_t n = 0; n < m_Divisions.size(); ++n)
 		{
-			for (u32 i = 0; i < m_DivisionsW; ++i)
-			{
-				std::vector<T> div1 = m_Divisions.at(i + j*m_DivisionsW);
-				std::vector<T> div2 = rhs.m_Divisions.at(i + j*m_DivisionsW);
-				std::sort(div1.begin(), div1.end());
-				std::sort(div2.begin(), div2.end());
-				if (div1 != div2)
-					return false;
-			}
+			const std::vector<T>& lhsDiv = m_Divisions[n];
+			const std::vector<T>& rhsDiv = rhs.m_Divisions.at(n);
+			if (lhsDiv.size() != rhsDiv.size())
+				return false;
+
+			div1.assign(lhsDiv.begin(), lhsDiv.end());
+			div2.assign(rhsDiv.begin(), rhsDiv.end());
+			std::sort(div1.begin(), div1.end());
+			std::sort(div2.begin(), div2.end());
+			if (div1 != div2)
+				return false;
 		}
 
 		return true;
 	}
 
-	bool operator!=(const SpatialSubdivision& rhs)
+	bool operator!=(const SpatialSubdivision& rhs) const
 	{
 		return !(*this == rhs);
 	}
@@ -177,10 +183,12 @@ public:
 	/**
 	 * Returns a sorted list of unique items that includes all items
 	 * within the given axis-aligned square range.
+	 * The list is written into @p out (replacing its previous contents), so
+	 * callers that reuse the same vector avoid allocating on every query.
 	 */
-	std::vector<T> GetInRange(CFixedVector2D posMin, CFixedVector2D posMax)
+	void GetInRange(std::vector<T>& out, CFixedVector2D posMin, CFixedVector2D posMax) const
 	{
-		std::vector<T> ret;
+		out.clear();
 
 		ENSURE(posMin.X <= posMax.X && posMin.Y <= posMax.Y);
 
@@ -192,28 +200,61 @@ public:
 		{
 			for (u32 i = i0; i <= i1; ++i)
 			{
-				std::vector<T>& div = m_Divisions.at(i + j*m_DivisionsW);
-				ret.insert(ret.end(), div.begin(), div.end());
+				const std::vector<T>& div = m_Divisions.at(i + j*m_DivisionsW);
+				out.insert(out.end(), div.begin(), div.end());
 			}
 		}
 
-		// Remove duplicates
-		std::sort(ret.begin(), ret.end());
-		ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+		std::sort(out.begin(), out.end());
 
-		return ret;
+		// Remove duplicates (a single division never contains any)
+		if (i0 != i1 || j0 != j1)
+			out.erase(std::unique(out.begin(), out.end()), out.end());
 	}
 
 	/**
 	 * Returns a sorted list of unique items that includes all items
 	 * within the given circular distance of the given point.
+	 * The list is written into @p out (replacing its previous contents).
 	 */
-	std::vector<T> GetNear(CFixedVector2D pos, entity_pos_t range)
+	void GetNear(std::vector<T>& out, CFixedVector2D pos, entity_pos_t range) const
 	{
 		// TODO: be cleverer and return a circular pattern of divisions,
 		// not this square over-approximation
 
-		return GetInRange(pos - CFixedVector2D(range, range), pos + CFixedVector2D(range, range));
+		GetInRange(out, pos - CFixedVector2D(range, range), pos + CFixedVector2D(range, range));
+	}
+
+	/**
+	 * Convenience version of GetInRange() returning a new vector.
+	 */
+	std::vector<T> GetInRange(CFixedVector2D posMin, CFixedVector2D posMax) const
+	{
+		std::vector<T> ret;
+		GetInRange(ret, posMin, posMax);
+		return ret;
+	}
+
+	/**
+	 * Convenience version of GetNear() returning a new vector.
+	 */
+	std::vector<T> GetNear(CFixedVector2D pos, entity_pos_t range) const
+	{
+		std::vector<T> ret;
+		GetNear(ret, pos, range);
+		return ret;
+	}
+
+	/**
+	 * Returns a value identifying the set of divisions that GetNear(pos, range)
+	 * would look at. Calls with equal keys return identical results, so callers
+	 * running many queries can share a single GetNear between them.
+	 */
+	u64 GetNearKey(CFixedVector2D pos, entity_pos_t range) const
+	{
+		CFixedVector2D posMin = pos - CFixedVector2D(range, range);
+		CFixedVector2D posMax = pos + CFixedVector2D(range, range);
+		return ((u64)GetI0(posMin.X) << 48) | ((u64)GetJ0(posMin.Y) << 32) | ((u64)GetI1(posMax.X) << 16) | (u64)GetJ1(posMax.Y);
 	}
 
 private:
@@ -221,32 +262,32 @@ private:
 	// (avoiding out-of-bounds accesses, and rounding correctly so that
 	// points precisely between divisions are counted in both):
 
-	u32 GetI0(entity_pos_t x)
+	u32 GetI0(entity_pos_t x) const
 	{
 		return Clamp((x / m_DivisionSize).ToInt_RoundToInfinity()-1, 0, (int)m_DivisionsW-1);
 	}
 
-	u32 GetJ0(entity_pos_t z)
+	u32 GetJ0(entity_pos_t z) const
 	{
 		return Clamp((z / m_DivisionSize).ToInt_RoundToInfinity()-1, 0, (int)m_DivisionsH-1);
 	}
 
-	u32 GetI1(entity_pos_t x)
+	u32 GetI1(entity_pos_t x) const
 	{
 		return Clamp((x / m_DivisionSize).ToInt_RoundToNegInfinity(), 0, (int)m_DivisionsW-1);
 	}
 
-	u32 GetJ1(entity_pos_t z)
+	u32 GetJ1(entity_pos_t z) const
 	{
 		return Clamp((z / m_DivisionSize).ToInt_RoundToNegInfinity(), 0, (int)m_DivisionsH-1);
 	}
 
-	u32 GetIndex0(CFixedVector2D pos)
+	u32 GetIndex0(CFixedVector2D pos) const
 	{
 		return GetI0(pos.X) + GetJ0(pos.Y)*m_DivisionsW;
 	}
 
-	u32 GetIndex1(CFixedVector2D pos)
+	u32 GetIndex1(CFixedVector2D pos) const
 	{
 		return GetI1(pos.X) + GetJ1(pos.Y)*m_DivisionsW;
 	}
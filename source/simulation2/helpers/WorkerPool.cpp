@@ -0,0 +1,147 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "WorkerPool.h"
+
+#include "lib/sysdep/os_cpu.h"
+#include "ps/Profiler2.h"
+
+// Upper limit on the default number of worker threads
+const size_t MAX_WORKER_THREADS = 8;
+
+WorkerPool::WorkerPool(const char* name) :
+	m_Name(name)
+{
+	Start(std::min(os_cpu_NumProcessors() - 1, MAX_WORKER_THREADS));
+}
+
+WorkerPool::WorkerPool(const char* name, size_t numThreads) :
+	m_Name(name)
+{
+	Start(numThreads);
+}
+
+void WorkerPool::Start(size_t numThreads)
+{
+	m_Func = NULL;
+	m_Data = NULL;
+	m_Count = 0;
+	m_Next = 0;
+	m_Shutdown = false;
+
+	// Use SDL semaphores since OS X doesn't implement sem_init
+	m_StartSem = SDL_CreateSemaphore(0);
+	ENSURE(m_StartSem);
+	m_DoneSem = SDL_CreateSemaphore(0);
+	ENSURE(m_DoneSem);
+
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		pthread_t thread;
+		int ret = pthread_create(&thread, NULL, &RunThread, this);
+		ENSURE(ret == 0);
+		m_Threads.push_back(thread);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		CScopeLock lock(m_Mutex);
+		m_Shutdown = true;
+	}
+
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+		SDL_SemPost(m_StartSem);
+
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+		pthread_join(m_Threads[i], NULL);
+
+	SDL_DestroySemaphore(m_StartSem);
+	SDL_DestroySemaphore(m_DoneSem);
+}
+
+void WorkerPool::Run(JobFunc func, void* data, size_t count)
+{
+	{
+		CScopeLock lock(m_Mutex);
+		m_Func = func;
+		m_Data = data;
+		m_Count = count;
+		m_Next = 0;
+	}
+
+	// Don't bother waking threads that won't have anything to do
+	size_t numWoken = std::min(m_Threads.size(), count > 0 ? count - 1 : 0);
+	for (size_t i = 0; i < numWoken; ++i)
+		SDL_SemPost(m_StartSem);
+
+	RunJobs();
+
+	for (size_t i = 0; i < numWoken; ++i)
+		SDL_SemWait(m_DoneSem);
+}
+
+void* WorkerPool::RunThread(void* data)
+{
+	WorkerPool* pool = static_cast<WorkerPool*>(data);
+
+	debug_SetThreadName(pool->m_Name);
+	g_Profiler2.RegisterCurrentThread(pool->m_Name);
+
+	pool->Work();
+
+	return NULL;
+}
+
+void WorkerPool::Work()
+{
+	while (SDL_SemWait(m_StartSem) == 0)
+	{
+		{
+			CScopeLock lock(m_Mutex);
+			if (m_Shutdown)
+				break;
+		}
+
+		RunJobs();
+
+		SDL_SemPost(m_DoneSem);
+	}
+}
+
+void WorkerPool::RunJobs()
+{
+	while (true)
+	{
+		JobFunc func;
+		void* data;
+		size_t index;
+		{
+			CScopeLock lock(m_Mutex);
+			if (m_Next >= m_Count)
+				return;
+			func = m_Func;
+			data = m_Data;
+			index = m_Next++;
+		}
+
+		func(data, index);
+	}
+}
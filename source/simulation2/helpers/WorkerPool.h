@@ -0,0 +1,82 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_WORKERPOOL
+#define INCLUDED_WORKERPOOL
+
+#include "lib/external_libraries/libsdl.h"
+#include "ps/ThreadUtil.h"
+
+#include <vector>
+
+/**
+ * Pool of threads for computing batches of independent jobs in the simulation
+ * (e.g. paths, or territory influences) or the renderer (e.g. model skinning).
+ *
+ * Run() splits a batch of jobs between the worker threads and the calling
+ * thread, and returns once they have all completed. The caller must ensure
+ * nothing modifies the state the jobs read until then.
+ *
+ * The jobs must not depend on the order in which they run, and must only write
+ * to their own output, so the results are the same regardless of the number of
+ * threads (which matters for keeping the simulation deterministic).
+ */
+class WorkerPool
+{
+	NONCOPYABLE(WorkerPool);
+public:
+	typedef void (*JobFunc)(void* data, size_t index);
+
+	/**
+	 * Starts one thread per processor other than the calling one's (up to a small limit).
+	 * @param name name of the threads, for debuggers and the profiler (which must outlive the pool)
+	 */
+	WorkerPool(const char* name = "Sim worker");
+
+	WorkerPool(const char* name, size_t numThreads);
+
+	~WorkerPool();
+
+	/**
+	 * Calls func(data, i) for every i in [0, count), and waits for them all to finish.
+	 */
+	void Run(JobFunc func, void* data, size_t count);
+
+private:
+	void Start(size_t numThreads);
+
+	static void* RunThread(void* data);
+
+	void Work();
+
+	void RunJobs();
+
+	const char* m_Name;
+	std::vector<pthread_t> m_Threads;
+	SDL_sem* m_StartSem;
+	SDL_sem* m_DoneSem;
+
+	// Protected by m_Mutex:
+	CMutex m_Mutex;
+	JobFunc m_Func;
+	void* m_Data;
+	size_t m_Count;
+	size_t m_Next;
+	bool m_Shutdown;
+};
+
+#endif // INCLUDED_WORKERPOOL
@@ -388,6 +388,14 @@ u32 CBinarySerializerScriptImpl::GetScriptBackrefTag(JSObject* obj)
 	return 0;
 }
 
+void CBinarySerializerScriptImpl::ClearScriptBackrefs()
+{
+	// (The objects stay rooted until the serializer is destroyed, which is harmless)
+	m_ScriptBackrefs.clear();
+	m_ScriptBackrefsArena.DeallocateAll();
+	m_ScriptBackrefsNext = 1;
+}
+
 bool CBinarySerializerScriptImpl::IsSerializablePrototype(JSObject* prototype)
 {
 	return m_SerializablePrototypes.find(prototype) != m_SerializablePrototypes.end();
@@ -60,6 +60,7 @@ public:
 	void ScriptString(const char* name, JSString* string);
 	void HandleScriptVal(jsval val);
 	void SetSerializablePrototypes(std::map<JSObject*, std::wstring>& prototypes);
+	void ClearScriptBackrefs();
 private:
 	ScriptInterface& m_ScriptInterface;
 	ISerializer& m_Serializer;
@@ -201,6 +202,15 @@ protected:
 	}
 
 protected:
+	/**
+	 * Forgets which script objects have already been serialized, so that later
+	 * references to them are serialized in full instead of as backrefs.
+	 */
+	void ClearScriptBackrefs()
+	{
+		m_ScriptImpl->ClearScriptBackrefs();
+	}
+
 	T m_Impl;
 
 private:
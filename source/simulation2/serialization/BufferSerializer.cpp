@@ -0,0 +1,44 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "BufferSerializer.h"
+
+CBufferSerializerImpl::CBufferSerializerImpl(std::string& buffer) :
+	m_Buffer(buffer), m_Size(buffer.size())
+{
+	// Make sure there's some spare space, so Append never has to index an empty string
+	Grow(0);
+}
+
+CBufferSerializerImpl::~CBufferSerializerImpl()
+{
+	m_Buffer.resize(m_Size);
+}
+
+void CBufferSerializerImpl::Grow(size_t len)
+{
+	// Grow geometrically, so the total cost of copying is linear in the final size
+	size_t newSize = std::max(std::max(m_Buffer.size() * 2, m_Size + len), (size_t)4*KiB);
+	m_Buffer.resize(newSize);
+}
+
+CBufferSerializer::CBufferSerializer(ScriptInterface& scriptInterface, std::string& buffer) :
+	CBinarySerializer<CBufferSerializerImpl>(scriptInterface, buffer)
+{
+}
@@ -0,0 +1,74 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_BUFFERSERIALIZER
+#define INCLUDED_BUFFERSERIALIZER
+
+#include "BinarySerializer.h"
+#include "StdSerializer.h" // for DEBUG_SERIALIZER_ANNOTATE
+
+#include <cstring>
+
+class CBufferSerializerImpl
+{
+	NONCOPYABLE(CBufferSerializerImpl);
+public:
+	CBufferSerializerImpl(std::string& buffer);
+	~CBufferSerializerImpl();
+
+	void Put(const char* name, const u8* data, size_t len)
+	{
+#if DEBUG_SERIALIZER_ANNOTATE
+		Append((const u8*)"<", 1);
+		Append((const u8*)name, strlen(name));
+		Append((const u8*)">", 1);
+#else
+		UNUSED2(name);
+#endif
+		Append(data, len);
+	}
+
+private:
+	void Append(const u8* data, size_t len)
+	{
+		if (m_Size + len > m_Buffer.size())
+			Grow(len);
+		memcpy(&m_Buffer[m_Size], data, len);
+		m_Size += len;
+	}
+
+	void Grow(size_t len);
+
+	// m_Buffer is kept larger than the data written so far (which is the first m_Size bytes),
+	// so that most writes are just a memcpy, and trimmed when the serializer is destroyed
+	std::string& m_Buffer;
+	size_t m_Size;
+};
+
+/**
+ * Serializer that appends the binary data to a string in memory, in the same format as
+ * CStdSerializer (so it can be read by CStdDeserializer) but without the overhead
+ * of writing through a std::ostream.
+ * The string's contents are only valid after the serializer has been destroyed.
+ */
+class CBufferSerializer : public CBinarySerializer<CBufferSerializerImpl>
+{
+public:
+	CBufferSerializer(ScriptInterface& scriptInterface, std::string& buffer);
+};
+
+#endif // INCLUDED_BUFFERSERIALIZER
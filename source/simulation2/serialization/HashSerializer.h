@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,16 +21,27 @@
 #include "BinarySerializer.h"
 
 #include "maths/MD5.h"
+#include "maths/XXH64.h"
 
+template<typename HashFunc>
 class CHashSerializerImpl
 {
-	// We don't care about cryptographic strength, just about detection of
-	// unintended changes and about performance, so MD5 is an adequate choice
-	typedef MD5 HashFunc;
-
 public:
-	size_t GetHashLength();
-	const u8* ComputeHash();
+	size_t GetHashLength()
+	{
+		return HashFunc::DIGESTSIZE;
+	}
+
+	const u8* ComputeHash()
+	{
+		m_Hash.Final(m_HashData);
+		return m_HashData;
+	}
+
+	void Reset()
+	{
+		m_Hash = HashFunc();
+	}
 
 	void Put(const char* UNUSED(name), const u8* data, size_t len)
 	{
@@ -42,13 +53,46 @@ private:
 	u8 m_HashData[HashFunc::DIGESTSIZE];
 };
 
-class CHashSerializer : public CBinarySerializer<CHashSerializerImpl>
+/**
+ * Serializer that computes a hash of the serialized data (without storing it).
+ *
+ * We don't care about cryptographic strength, just about detection of
+ * unintended changes and about performance, so CHashSerializer uses the
+ * fast XXH64. CMD5HashSerializer computes the MD5 hashes that older
+ * versions used, for comparing against hashes that were saved with them
+ * (e.g. in replays).
+ */
+template<typename HashFunc>
+class CBasicHashSerializer : public CBinarySerializer<CHashSerializerImpl<HashFunc> >
 {
 public:
-	CHashSerializer(ScriptInterface& scriptInterface);
+	CBasicHashSerializer(ScriptInterface& scriptInterface) :
+		CBinarySerializer<CHashSerializerImpl<HashFunc> >(scriptInterface)
+	{
+	}
+
+	size_t GetHashLength()
+	{
+		return this->m_Impl.GetHashLength();
+	}
 
-	size_t GetHashLength();
-	const u8* ComputeHash();
+	const u8* ComputeHash()
+	{
+		return this->m_Impl.ComputeHash();
+	}
+
+	/**
+	 * Starts hashing new data, as if this serializer had just been constructed
+	 * (which is much more expensive than resetting one).
+	 */
+	void Reset()
+	{
+		this->m_Impl.Reset();
+		this->ClearScriptBackrefs();
+	}
 };
 
+typedef CBasicHashSerializer<XXH64> CHashSerializer;
+typedef CBasicHashSerializer<MD5> CMD5HashSerializer;
+
 #endif // INCLUDED_HASHSERIALIZER
@@ -24,6 +24,8 @@
  */
 
 #include "simulation2/components/ICmpPathfinder.h"
+#include "simulation2/helpers/EntityMap.h"
+#include "simulation2/helpers/SlotMap.h"
 
 template<typename ELEM>
 struct SerializeVector
@@ -105,6 +107,40 @@ struct SerializeUnorderedMap
 	}
 };
 
+/**
+ * Serializes an EntityMap in the same format as SerializeMap with entity ID keys.
+ */
+template<typename VS>
+struct SerializeEntityMap
+{
+	template<typename V>
+	void operator()(ISerializer& serialize, const char* UNUSED(name), EntityMap<V>& value)
+	{
+		serialize.NumberU32_Unbounded("length", (u32)value.size());
+		for (typename EntityMap<V>::iterator it = value.begin(); it != value.end(); ++it)
+		{
+			serialize.NumberU32_Unbounded("key", it->first);
+			VS()(serialize, "value", it->second);
+		}
+	}
+
+	template<typename V>
+	void operator()(IDeserializer& deserialize, const char* UNUSED(name), EntityMap<V>& value)
+	{
+		value.clear();
+		u32 len;
+		deserialize.NumberU32_Unbounded("length", len);
+		for (size_t i = 0; i < len; ++i)
+		{
+			entity_id_t k;
+			V v;
+			deserialize.NumberU32_Unbounded("key", k);
+			VS()(deserialize, "value", v);
+			value.insert(std::make_pair(k, v));
+		}
+	}
+};
+
 template<typename T, T max>
 struct SerializeU8_Enum
 {
@@ -147,6 +183,46 @@ struct SerializeI32_Unbounded
 	}
 };
 
+/**
+ * Serializes a SlotMap, including its free slots, so the deserialized map
+ * allocates the same IDs as the original.
+ */
+template<typename VS>
+struct SerializeSlotMap
+{
+	template<typename V>
+	void operator()(ISerializer& serialize, const char* UNUSED(name), SlotMap<V>& value)
+	{
+		serialize.NumberU32_Unbounded("length", (u32)value.m_Slots.size());
+		for (size_t i = 0; i < value.m_Slots.size(); ++i)
+		{
+			serialize.NumberU32_Unbounded("id", value.m_Slots[i].first);
+			if (!(value.m_Slots[i].first & SlotMap<V>::FREE_BIT))
+				VS()(serialize, "value", value.m_Slots[i].second);
+		}
+		SerializeVector<SerializeU32_Unbounded>()(serialize, "free slots", value.m_FreeSlots);
+	}
+
+	template<typename V>
+	void operator()(IDeserializer& deserialize, const char* UNUSED(name), SlotMap<V>& value)
+	{
+		value.clear();
+		u32 len;
+		deserialize.NumberU32_Unbounded("length", len);
+		value.m_Slots.resize(len);
+		for (size_t i = 0; i < len; ++i)
+		{
+			deserialize.NumberU32_Unbounded("id", value.m_Slots[i].first);
+			if (!(value.m_Slots[i].first & SlotMap<V>::FREE_BIT))
+			{
+				VS()(deserialize, "value", value.m_Slots[i].second);
+				++value.m_Count;
+			}
+		}
+		SerializeVector<SerializeU32_Unbounded>()(deserialize, "free slots", value.m_FreeSlots);
+	}
+};
+
 struct SerializeBool
 {
 	void operator()(ISerializer& serialize, const char* name, bool value)
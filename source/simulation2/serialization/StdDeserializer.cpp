@@ -61,6 +61,14 @@ CStdDeserializer::CStdDeserializer(ScriptInterface& scriptInterface, std::istrea
 {
 }
 
+CStdDeserializer::CStdDeserializer(ScriptInterface& scriptInterface, const u8* data, size_t len) :
+	m_ScriptInterface(scriptInterface),
+	m_MemoryBuf(new CMemoryStreamBuf(data, len)),
+	m_MemoryStream(new std::istream(m_MemoryBuf.get())),
+	m_Stream(*m_MemoryStream)
+{
+}
+
 CStdDeserializer::~CStdDeserializer()
 {
 	FreeScriptBackrefs();
@@ -84,6 +92,14 @@ void CStdDeserializer::Get(const char* name, u8* data, size_t len)
 #else
 	UNUSED2(name);
 #endif
+	if (m_MemoryBuf.get())
+	{
+		if (len > m_MemoryBuf->Remaining())
+			throw PSERROR_Deserialize_ReadFailed();
+		memcpy(data, m_MemoryBuf->Consume(len), len);
+		return;
+	}
+
 	m_Stream.read((char*)data, (std::streamsize)len);
 	if (!m_Stream.good()) // hit eof before len, or other errors
 		throw PSERROR_Deserialize_ReadFailed();
@@ -96,6 +112,14 @@ std::istream& CStdDeserializer::GetStream()
 
 void CStdDeserializer::RequireBytesInStream(size_t numBytes)
 {
+	// When reading from memory we know exactly how much is left
+	if (m_MemoryBuf.get())
+	{
+		if (numBytes > m_MemoryBuf->Remaining())
+			throw PSERROR_Deserialize_OutOfBounds("RequireBytesInStream");
+		return;
+	}
+
 	// It would be nice to do:
 // 	if (numBytes > (size_t)m_Stream.rdbuf()->in_avail())
 // 		throw PSERROR_Deserialize_OutOfBounds("RequireBytesInStream");
@@ -108,6 +132,14 @@ void CStdDeserializer::RequireBytesInStream(size_t numBytes)
 		throw PSERROR_Deserialize_OutOfBounds("RequireBytesInStream");
 }
 
+bool CStdDeserializer::IsAtEnd()
+{
+	if (m_MemoryBuf.get())
+		return m_MemoryBuf->Remaining() == 0;
+
+	return m_Stream.peek() == EOF;
+}
+
 void CStdDeserializer::AddScriptBackref(JSObject* obj)
 {
 	std::pair<std::map<u32, JSObject*>::iterator, bool> it = m_ScriptBackrefs.insert(std::make_pair((u32)m_ScriptBackrefs.size()+1, obj));
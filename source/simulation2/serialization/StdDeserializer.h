@@ -23,12 +23,20 @@
 #include "ps/utf16string.h"
 
 #include <map>
+#include <memory>
 
 class CStdDeserializer : public IDeserializer
 {
 	NONCOPYABLE(CStdDeserializer);
 public:
 	CStdDeserializer(ScriptInterface& scriptInterface, std::istream& stream);
+
+	/**
+	 * Reads directly from the given block of memory (which must stay valid until the
+	 * deserializer is destroyed), which is much faster than reading through a std::istream.
+	 */
+	CStdDeserializer(ScriptInterface& scriptInterface, const u8* data, size_t len);
+
 	virtual ~CStdDeserializer();
 
 	virtual void ScriptVal(const char* name, jsval& out);
@@ -41,6 +49,11 @@ public:
 	virtual void RequireBytesInStream(size_t numBytes);
 
 	virtual void SetSerializablePrototypes(std::map<std::wstring, JSObject*>& prototypes);
+
+	/**
+	 * Returns whether all the input has been read.
+	 */
+	bool IsAtEnd();
 	
 protected:
 	virtual void Get(const char* name, u8* data, size_t len);
@@ -57,6 +70,36 @@ private:
 	std::map<u32, JSObject*> m_ScriptBackrefs; // vector would be nice but maintaining JS roots would be harder
 	ScriptInterface& m_ScriptInterface;
 
+	/**
+	 * Stream buffer over the input block of memory, which Get reads from directly
+	 * (so that reads through GetStream and Get stay in step).
+	 */
+	class CMemoryStreamBuf : public std::streambuf
+	{
+	public:
+		CMemoryStreamBuf(const u8* data, size_t len)
+		{
+			char* begin = const_cast<char*>(reinterpret_cast<const char*>(data));
+			setg(begin, begin, begin + len);
+		}
+
+		size_t Remaining() const
+		{
+			return egptr() - gptr();
+		}
+
+		const u8* Consume(size_t len)
+		{
+			const u8* data = reinterpret_cast<const u8*>(gptr());
+			gbump((int)len);
+			return data;
+		}
+	};
+
+	// These are only set when reading from memory
+	std::auto_ptr<CMemoryStreamBuf> m_MemoryBuf;
+	std::auto_ptr<std::istream> m_MemoryStream;
+
 	std::istream& m_Stream;
 
 	std::map<std::wstring, JSObject*> m_SerializablePrototypes;
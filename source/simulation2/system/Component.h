@@ -21,6 +21,7 @@
 #include "simulation2/system/CmpPtr.h"
 #include "simulation2/system/Components.h"
 #include "simulation2/system/ComponentManager.h"
+#include "simulation2/system/ComponentPool.h"
 #include "simulation2/system/IComponent.h"
 #include "simulation2/system/ParamNode.h"
 #include "simulation2/system/SimContext.h"
@@ -42,18 +43,18 @@
 	}
 
 #define DEFAULT_COMPONENT_ALLOCATOR(cname) \
-	static IComponent* Allocate(ScriptInterface&, jsval) { return new CCmp##cname(); } \
-	static void Deallocate(IComponent* cmp) { delete static_cast<CCmp##cname*> (cmp); } \
+	static IComponent* Allocate(ScriptInterface&, jsval) { return ComponentPool<CCmp##cname>::Allocate(); } \
+	static void Deallocate(IComponent* cmp) { ComponentPool<CCmp##cname>::Deallocate(static_cast<CCmp##cname*> (cmp)); } \
 
 #define DEFAULT_SCRIPT_WRAPPER(cname) \
 	static void ClassInit(CComponentManager& UNUSED(componentManager)) { } \
 	static IComponent* Allocate(ScriptInterface& scriptInterface, jsval instance) \
 	{ \
-		return new CCmp##cname(scriptInterface, instance); \
+		return ComponentPool<CCmp##cname>::Allocate(scriptInterface, instance); \
 	} \
 	static void Deallocate(IComponent* cmp) \
 	{ \
-		delete static_cast<CCmp##cname*> (cmp); \
+		ComponentPool<CCmp##cname>::Deallocate(static_cast<CCmp##cname*> (cmp)); \
 	} \
 	CCmp##cname(ScriptInterface& scriptInterface, jsval instance) : m_Script(scriptInterface, instance) { } \
 	static std::string GetSchema() \
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,9 +26,12 @@
 #include "simulation2/MessageTypes.h"
 #include "simulation2/components/ICmpTemplateManager.h"
 
+#include "lib/timer.h"
 #include "lib/utf8.h"
 #include "ps/CLogger.h"
+#include "ps/CStrIntern.h"
 #include "ps/Filesystem.h"
+#include "ps/Profiler2.h"
 
 /**
  * Used for script-only message types.
@@ -52,10 +55,32 @@ public:
 	CScriptValRooted msg;
 };
 
+/**
+ * Orders ComponentArray elements by entity ID, for binary searches.
+ */
+struct CompareEntityId
+{
+	bool operator()(const std::pair<entity_id_t, IComponent*>& a, entity_id_t b) const { return a.first < b; }
+	bool operator()(entity_id_t a, const std::pair<entity_id_t, IComponent*>& b) const { return a < b.first; }
+	bool operator()(const std::pair<entity_id_t, IComponent*>& a, const std::pair<entity_id_t, IComponent*>& b) const { return a.first < b.first; }
+};
+
+/**
+ * Returns whether handling the message might change the receiver's serialized state
+ * (so its cached state hash must be discarded).
+ * Interpolate and RenderSubmit are sent once per rendered frame, which differs between
+ * machines, so they must never affect the synchronised state anyway.
+ */
+static bool MessageMayChangeState(const CMessage& msg)
+{
+	return msg.GetType() != MT_Interpolate && msg.GetType() != MT_RenderSubmit;
+}
+
 CComponentManager::CComponentManager(CSimContext& context, bool skipScriptFunctions) :
 	m_NextScriptComponentTypeId(CID__LastNative),
 	m_ScriptInterface("Engine", "Simulation", ScriptInterface::CreateRuntime()),
-	m_SimContext(context), m_CurrentlyHotloading(false)
+	m_SimContext(context), m_CurrentlyHotloading(false), m_HasDeferredMessages(false),
+	m_ProfileMessageHandlers(false)
 {
 	context.SetComponentManager(this);
 
@@ -164,6 +189,7 @@ void CComponentManager::Script_RegisterComponentType(void* cbdata, int iid, std:
 		// Allocate a new cid number
 		cid = componentManager->m_NextScriptComponentTypeId++;
 		componentManager->m_ComponentTypeIdsByName[cname] = cid;
+		componentManager->EnsureComponentTypeStorage(cid);
 	}
 	else
 	{
@@ -197,20 +223,19 @@ void CComponentManager::Script_RegisterComponentType(void* cbdata, int iid, std:
 		}
 
 		// Remove the old component type's message subscriptions
-		std::map<MessageTypeId, std::vector<ComponentTypeId> >::iterator it;
+		MessageSubscriber subscriber = { cid, true };
+		std::vector<std::vector<MessageSubscriber> >::iterator it;
 		for (it = componentManager->m_LocalMessageSubscriptions.begin(); it != componentManager->m_LocalMessageSubscriptions.end(); ++it)
 		{
-			std::vector<ComponentTypeId>& types = it->second;
-			std::vector<ComponentTypeId>::iterator ctit = find(types.begin(), types.end(), cid);
-			if (ctit != types.end())
-				types.erase(ctit);
+			std::vector<MessageSubscriber>::iterator ctit = std::lower_bound(it->begin(), it->end(), subscriber);
+			if (ctit != it->end() && ctit->cid == cid)
+				it->erase(ctit);
 		}
 		for (it = componentManager->m_GlobalMessageSubscriptions.begin(); it != componentManager->m_GlobalMessageSubscriptions.end(); ++it)
 		{
-			std::vector<ComponentTypeId>& types = it->second;
-			std::vector<ComponentTypeId>::iterator ctit = find(types.begin(), types.end(), cid);
-			if (ctit != types.end())
-				types.erase(ctit);
+			std::vector<MessageSubscriber>::iterator ctit = std::lower_bound(it->begin(), it->end(), subscriber);
+			if (ctit != it->end() && ctit->cid == cid)
+				it->erase(ctit);
 		}
 
 		mustReloadComponents = true;
@@ -283,8 +308,8 @@ void CComponentManager::Script_RegisterComponentType(void* cbdata, int iid, std:
 	{
 		// For every script component with this cid, we need to switch its
 		// prototype from the old constructor's prototype property to the new one's
-		const std::map<entity_id_t, IComponent*>& comps = componentManager->m_ComponentsByTypeId[cid];
-		std::map<entity_id_t, IComponent*>::const_iterator eit = comps.begin();
+		const ComponentArray& comps = componentManager->m_ComponentsByTypeId[cid];
+		ComponentArray::const_iterator eit = comps.begin();
 		for (; eit != comps.end(); ++eit)
 		{
 			jsval instance = eit->second->GetJSInstance();
@@ -450,25 +475,26 @@ void CComponentManager::Script_DestroyEntity(void* cbdata, int ent)
 void CComponentManager::ResetState()
 {
 	// Delete all IComponents
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::iterator iit = m_ComponentsByTypeId.begin();
-	for (; iit != m_ComponentsByTypeId.end(); ++iit)
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
-		std::map<entity_id_t, IComponent*>::iterator eit = iit->second.begin();
-		for (; eit != iit->second.end(); ++eit)
+		ComponentArray& comps = m_ComponentsByTypeId[cid];
+		for (ComponentArray::iterator eit = comps.begin(); eit != comps.end(); ++eit)
 		{
 			eit->second->Deinit();
-			m_ComponentTypesById[iit->first].dealloc(eit->second);
+			m_ComponentTypesById[(ComponentTypeId)cid].dealloc(eit->second);
 		}
+		// Keep the array itself, since it's indexed by the (still registered) type ID
+		comps.clear();
 	}
 
 	std::vector<boost::unordered_map<entity_id_t, IComponent*> >::iterator ifcit = m_ComponentsByInterface.begin();
 	for (; ifcit != m_ComponentsByInterface.end(); ++ifcit)
 		ifcit->clear();
 
-	m_ComponentsByTypeId.clear();
-
 	m_DestructionQueue.clear();
 
+	ClearDeferredMessages();
+
 	// Reset IDs
 	m_NextEntityId = SYSTEM_ENTITY + 1;
 	m_NextLocalEntityId = FIRST_LOCAL_ENTITY;
@@ -480,6 +506,7 @@ void CComponentManager::RegisterComponentType(InterfaceId iid, ComponentTypeId c
 	ComponentType c = { CT_Native, iid, alloc, dealloc, name, schema, CScriptValRooted() };
 	m_ComponentTypesById.insert(std::make_pair(cid, c));
 	m_ComponentTypeIdsByName[name] = cid;
+	EnsureComponentTypeStorage(cid);
 }
 
 void CComponentManager::RegisterComponentTypeScriptWrapper(InterfaceId iid, ComponentTypeId cid, AllocFunc alloc,
@@ -488,6 +515,7 @@ void CComponentManager::RegisterComponentTypeScriptWrapper(InterfaceId iid, Comp
 	ComponentType c = { CT_ScriptWrapper, iid, alloc, dealloc, name, schema, CScriptValRooted() };
 	m_ComponentTypesById.insert(std::make_pair(cid, c));
 	m_ComponentTypeIdsByName[name] = cid;
+	EnsureComponentTypeStorage(cid);
 	// TODO: merge with RegisterComponentType
 }
 
@@ -497,22 +525,50 @@ void CComponentManager::RegisterMessageType(MessageTypeId mtid, const char* name
 	m_MessageTypeNamesById[mtid] = name;
 }
 
-void CComponentManager::SubscribeToMessageType(MessageTypeId mtid)
+void CComponentManager::EnsureComponentTypeStorage(ComponentTypeId cid)
+{
+	ENSURE(cid >= 0);
+	if ((size_t)cid >= m_ComponentsByTypeId.size())
+		m_ComponentsByTypeId.resize(cid + 1);
+}
+
+void CComponentManager::AddMessageSubscriber(std::vector<std::vector<MessageSubscriber> >& subscriptions, MessageTypeId mtid)
 {
 	// TODO: verify mtid
 	ENSURE(m_CurrentComponent != CID__Invalid);
-	std::vector<ComponentTypeId>& types = m_LocalMessageSubscriptions[mtid];
-	types.push_back(m_CurrentComponent);
+	ENSURE(mtid >= 0);
+
+	if ((size_t)mtid >= subscriptions.size())
+		subscriptions.resize(mtid + 1);
+
+	std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(m_CurrentComponent);
+	MessageSubscriber subscriber = { m_CurrentComponent, it != m_ComponentTypesById.end() && it->second.type == CT_Script };
+
+	std::vector<MessageSubscriber>& types = subscriptions[mtid];
+	types.push_back(subscriber);
 	std::sort(types.begin(), types.end()); // TODO: just sort once at the end of LoadComponents
 }
 
+void CComponentManager::SubscribeToMessageType(MessageTypeId mtid)
+{
+	AddMessageSubscriber(m_LocalMessageSubscriptions, mtid);
+}
+
 void CComponentManager::SubscribeGloballyToMessageType(MessageTypeId mtid)
 {
-	// TODO: verify mtid
-	ENSURE(m_CurrentComponent != CID__Invalid);
-	std::vector<ComponentTypeId>& types = m_GlobalMessageSubscriptions[mtid];
-	types.push_back(m_CurrentComponent);
-	std::sort(types.begin(), types.end()); // TODO: just sort once at the end of LoadComponents
+	AddMessageSubscriber(m_GlobalMessageSubscriptions, mtid);
+}
+
+void CComponentManager::SubscribeGloballyToMessageTypeDeferred(MessageTypeId mtid)
+{
+	AddMessageSubscriber(m_DeferredMessageSubscriptions, mtid);
+
+	// Scripts don't have a batch handler, and shouldn't see local entities' messages anyway
+	std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(m_CurrentComponent);
+	ENSURE(it != m_ComponentTypesById.end() && it->second.type == CT_Native);
+
+	if (m_DeferredMessages.size() < m_DeferredMessageSubscriptions.size())
+		m_DeferredMessages.resize(m_DeferredMessageSubscriptions.size());
 }
 
 CComponentManager::ComponentTypeId CComponentManager::LookupCID(const std::string& cname) const
@@ -602,7 +658,7 @@ IComponent* CComponentManager::ConstructComponent(entity_id_t ent, ComponentType
 		return NULL;
 	}
 
-	std::map<entity_id_t, IComponent*>& emap2 = m_ComponentsByTypeId[cid];
+	ComponentArray& emap2 = m_ComponentsByTypeId[cid];
 
 	// If this is a scripted component, construct the appropriate JS object first
 	jsval obj = JSVAL_NULL;
@@ -625,7 +681,8 @@ IComponent* CComponentManager::ConstructComponent(entity_id_t ent, ComponentType
 
 	// Store a reference to the new component
 	emap1.insert(std::make_pair(ent, component));
-	emap2.insert(std::make_pair(ent, component));
+	// (New entities almost always have the highest ID so far, so this is usually an append)
+	emap2.insert(std::upper_bound(emap2.begin(), emap2.end(), ent, CompareEntityId()), std::make_pair(ent, component));
 	// TODO: We need to more careful about this - if an entity is constructed by a component
 	// while we're iterating over all components, this will invalidate the iterators and everything
 	// will break.
@@ -712,16 +769,19 @@ void CComponentManager::FlushDestroyedComponents()
 			CMessageDestroy msg(ent);
 			PostMessage(ent, msg);
 
+			// Let deferred message handlers see the entity before it goes away
+			FlushDeferredMessages();
+
 			// Destroy the components, and remove from m_ComponentsByTypeId:
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::iterator iit = m_ComponentsByTypeId.begin();
-			for (; iit != m_ComponentsByTypeId.end(); ++iit)
+			for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 			{
-				std::map<entity_id_t, IComponent*>::iterator eit = iit->second.find(ent);
-				if (eit != iit->second.end())
+				ComponentArray& comps = m_ComponentsByTypeId[cid];
+				ComponentArray::iterator eit = std::lower_bound(comps.begin(), comps.end(), ent, CompareEntityId());
+				if (eit != comps.end() && eit->first == ent)
 				{
 					eit->second->Deinit();
-					m_ComponentTypesById[iit->first].dealloc(eit->second);
-					iit->second.erase(ent);
+					m_ComponentTypesById[(ComponentTypeId)cid].dealloc(eit->second);
+					comps.erase(eit);
 				}
 			}
 
@@ -750,6 +810,8 @@ IComponent* CComponentManager::QueryInterface(entity_id_t ent, InterfaceId iid)
 		return NULL;
 	}
 
+	// The caller might modify the component through the returned pointer
+	eit->second->SetStateHashDirty();
 	return eit->second;
 }
 
@@ -767,7 +829,10 @@ CComponentManager::InterfaceList CComponentManager::GetEntitiesWithInterface(Int
 
 	boost::unordered_map<entity_id_t, IComponent*>::const_iterator it = m_ComponentsByInterface[iid].begin();
 	for (; it != m_ComponentsByInterface[iid].end(); ++it)
+	{
+		it->second->SetStateHashDirty();
 		ret.push_back(*it);
+	}
 
 	std::sort(ret.begin(), ret.end()); // lexicographic pair comparison means this'll sort by entity ID
 
@@ -789,22 +854,23 @@ const CComponentManager::InterfaceListUnordered& CComponentManager::GetEntitiesW
 void CComponentManager::PostMessage(entity_id_t ent, const CMessage& msg) const
 {
 	// Send the message to components of ent, that subscribed locally to this message
-	std::map<MessageTypeId, std::vector<ComponentTypeId> >::const_iterator it;
-	it = m_LocalMessageSubscriptions.find(msg.GetType());
-	if (it != m_LocalMessageSubscriptions.end())
+	size_t mtid = (size_t)msg.GetType();
+	if (mtid < m_LocalMessageSubscriptions.size())
 	{
-		std::vector<ComponentTypeId>::const_iterator ctit = it->second.begin();
-		for (; ctit != it->second.end(); ++ctit)
+		const std::vector<MessageSubscriber>& subscribers = m_LocalMessageSubscriptions[mtid];
+		for (size_t i = 0; i < subscribers.size(); ++i)
 		{
-			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
-			if (emap == m_ComponentsByTypeId.end())
-				continue;
-
-			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.find(ent);
-			if (eit != emap->second.end())
+			// Find the component instance of this type (if any)
+			const ComponentArray& comps = m_ComponentsByTypeId[subscribers[i].cid];
+			ComponentArray::const_iterator eit = std::lower_bound(comps.begin(), comps.end(), ent, CompareEntityId());
+			if (eit != comps.end() && eit->first == ent)
+			{
+				double t = m_ProfileMessageHandlers ? BeginMessageHandler(subscribers[i].cid, msg) : 0.0;
+				eit->second->SetStateHashDirty();
 				eit->second->HandleMessage(msg, false);
+				if (m_ProfileMessageHandlers)
+					EndMessageHandler(subscribers[i].cid, msg.GetType(), t, 1);
+			}
 		}
 	}
 
@@ -814,22 +880,16 @@ void CComponentManager::PostMessage(entity_id_t ent, const CMessage& msg) const
 void CComponentManager::BroadcastMessage(const CMessage& msg) const
 {
 	// Send the message to components of all entities that subscribed locally to this message
-	std::map<MessageTypeId, std::vector<ComponentTypeId> >::const_iterator it;
-	it = m_LocalMessageSubscriptions.find(msg.GetType());
-	if (it != m_LocalMessageSubscriptions.end())
+	size_t mtid = (size_t)msg.GetType();
+	if (mtid < m_LocalMessageSubscriptions.size())
 	{
-		std::vector<ComponentTypeId>::const_iterator ctit = it->second.begin();
-		for (; ctit != it->second.end(); ++ctit)
+		const std::vector<MessageSubscriber>& subscribers = m_LocalMessageSubscriptions[mtid];
+		for (size_t i = 0; i < subscribers.size(); ++i)
 		{
-			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
-			if (emap == m_ComponentsByTypeId.end())
-				continue;
-
-			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.begin();
-			for (; eit != emap->second.end(); ++eit)
-				eit->second->HandleMessage(msg, false);
+			double t = m_ProfileMessageHandlers ? BeginMessageHandler(subscribers[i].cid, msg) : 0.0;
+			size_t calls = BroadcastToComponents(m_ComponentsByTypeId[subscribers[i].cid], msg, false);
+			if (m_ProfileMessageHandlers)
+				EndMessageHandler(subscribers[i].cid, msg.GetType(), t, calls);
 		}
 	}
 
@@ -841,36 +901,193 @@ void CComponentManager::SendGlobalMessage(entity_id_t ent, const CMessage& msg)
 	// (Common functionality for PostMessage and BroadcastMessage)
 
 	// Send the message to components of all entities that subscribed globally to this message
-	std::map<MessageTypeId, std::vector<ComponentTypeId> >::const_iterator it;
-	it = m_GlobalMessageSubscriptions.find(msg.GetType());
-	if (it != m_GlobalMessageSubscriptions.end())
+	size_t mtid = (size_t)msg.GetType();
+	if (mtid < m_GlobalMessageSubscriptions.size())
 	{
-		std::vector<ComponentTypeId>::const_iterator ctit = it->second.begin();
-		for (; ctit != it->second.end(); ++ctit)
+		const std::vector<MessageSubscriber>& subscribers = m_GlobalMessageSubscriptions[mtid];
+		for (size_t i = 0; i < subscribers.size(); ++i)
 		{
 			// Special case: Messages for non-local entities shouldn't be sent to script
 			// components that subscribed globally, so that we don't have to worry about
 			// them accidentally picking up non-network-synchronised data.
-			if (ENTITY_IS_LOCAL(ent))
+			if (ENTITY_IS_LOCAL(ent) && subscribers[i].isScript)
+				continue;
+
+			double t = m_ProfileMessageHandlers ? BeginMessageHandler(subscribers[i].cid, msg) : 0.0;
+			size_t calls = BroadcastToComponents(m_ComponentsByTypeId[subscribers[i].cid], msg, true);
+			if (m_ProfileMessageHandlers)
+				EndMessageHandler(subscribers[i].cid, msg.GetType(), t, calls);
+		}
+	}
+
+	QueueDeferredMessage(msg);
+}
+
+void CComponentManager::QueueDeferredMessage(const CMessage& msg) const
+{
+	size_t mtid = (size_t)msg.GetType();
+	if (mtid >= m_DeferredMessageSubscriptions.size() || m_DeferredMessageSubscriptions[mtid].empty())
+		return;
+
+	CMessage* copy = msg.Clone();
+	ENSURE(copy); // deferred subscriptions are only allowed for message types that implement Clone
+
+	m_DeferredMessages[mtid].push_back(copy);
+	m_HasDeferredMessages = true;
+}
+
+void CComponentManager::FlushDeferredMessages()
+{
+	while (m_HasDeferredMessages)
+	{
+		m_HasDeferredMessages = false;
+
+		for (size_t mtid = 0; mtid < m_DeferredMessages.size(); ++mtid)
+		{
+			if (m_DeferredMessages[mtid].empty())
+				continue;
+
+			// Take the queue, so the handlers can safely send more messages of this type
+			// (which will be delivered in the next iteration)
+			std::vector<CMessage*> batch;
+			batch.swap(m_DeferredMessages[mtid]);
+
+			const std::vector<MessageSubscriber>& subscribers = m_DeferredMessageSubscriptions[mtid];
+			for (size_t i = 0; i < subscribers.size(); ++i)
 			{
-				std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(*ctit);
-				if (it != m_ComponentTypesById.end() && it->second.type == CT_Script)
-					continue;
+				double t = m_ProfileMessageHandlers ? BeginMessageHandler(subscribers[i].cid, *batch[0]) : 0.0;
+				const ComponentArray& comps = m_ComponentsByTypeId[subscribers[i].cid];
+				size_t calls = 0;
+				for (size_t j = 0; j < comps.size(); ++j)
+				{
+					entity_id_t ent = comps[j].first;
+					comps[j].second->SetStateHashDirty();
+					comps[j].second->HandleMessageBatch(batch);
+					++calls;
+
+					// Find our place again if the handler constructed components (see BroadcastToComponents)
+					if (j >= comps.size() || comps[j].first != ent)
+						j = (size_t)(std::upper_bound(comps.begin(), comps.end(), ent, CompareEntityId()) - comps.begin()) - 1;
+				}
+				if (m_ProfileMessageHandlers)
+					EndMessageHandler(subscribers[i].cid, (MessageTypeId)mtid, t, calls);
 			}
 
-			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
-			if (emap == m_ComponentsByTypeId.end())
+			for (size_t i = 0; i < batch.size(); ++i)
+				delete batch[i];
+		}
+	}
+}
+
+void CComponentManager::ClearDeferredMessages()
+{
+	for (size_t mtid = 0; mtid < m_DeferredMessages.size(); ++mtid)
+	{
+		for (size_t i = 0; i < m_DeferredMessages[mtid].size(); ++i)
+			delete m_DeferredMessages[mtid][i];
+		m_DeferredMessages[mtid].clear();
+	}
+	m_HasDeferredMessages = false;
+}
+
+size_t CComponentManager::BroadcastToComponents(const ComponentArray& comps, const CMessage& msg, bool global)
+{
+	size_t calls = 0;
+	bool dirty = MessageMayChangeState(msg);
+	for (size_t i = 0; i < comps.size(); ++i)
+	{
+		entity_id_t ent = comps[i].first;
+		if (dirty)
+			comps[i].second->SetStateHashDirty();
+		comps[i].second->HandleMessage(msg, global);
+		++calls;
+
+		// The handler might have constructed new components of this type, shifting
+		// this one along the array, so find our place again (and continue with the
+		// next higher entity ID, like iterating over a std::map would)
+		if (i >= comps.size() || comps[i].first != ent)
+			i = (size_t)(std::upper_bound(comps.begin(), comps.end(), ent, CompareEntityId()) - comps.begin()) - 1;
+	}
+	return calls;
+}
+
+double CComponentManager::BeginMessageHandler(ComponentTypeId cid, const CMessage& msg) const
+{
+	if ((size_t)cid >= m_MessageHandlerProfileNames.size())
+		m_MessageHandlerProfileNames.resize(cid + 1);
+	if (!m_MessageHandlerProfileNames[cid])
+	{
+		// Profiler2 needs names that stay valid forever, even after we're destroyed
+		std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(cid);
+		m_MessageHandlerProfileNames[cid] = CStrIntern(it != m_ComponentTypesById.end() ? it->second.name : "?").c_str();
+	}
+
+	g_Profiler2.RecordRegionEnter(m_MessageHandlerProfileNames[cid]);
+	g_Profiler2.RecordAttribute("%s", msg.GetScriptHandlerName());
+
+	m_NestedHandlerTimes.push_back(0.0);
+	return timer_Time();
+}
+
+void CComponentManager::EndMessageHandler(ComponentTypeId cid, MessageTypeId mtid, double startTime, size_t calls) const
+{
+	double time = timer_Time() - startTime;
+
+	double nestedTime = m_NestedHandlerTimes.back();
+	m_NestedHandlerTimes.pop_back();
+	if (!m_NestedHandlerTimes.empty())
+		m_NestedHandlerTimes.back() += time;
+
+	if ((size_t)cid >= m_MessageHandlerTimes.size())
+		m_MessageHandlerTimes.resize(cid + 1);
+	std::vector<HandlerTimes>& times = m_MessageHandlerTimes[cid];
+	if ((size_t)mtid >= times.size())
+		times.resize(mtid + 1);
+	times[mtid].calls += (u32)calls;
+	times[mtid].totalTime += time;
+	times[mtid].selfTime += time - nestedTime;
+
+	g_Profiler2.RecordRegionLeave(m_MessageHandlerProfileNames[cid]);
+}
+
+static bool CompareHandlerStats(const CComponentManager::MessageHandlerStats& a, const CComponentManager::MessageHandlerStats& b)
+{
+	return a.selfTime > b.selfTime;
+}
+
+std::vector<CComponentManager::MessageHandlerStats> CComponentManager::GetMessageHandlerStats() const
+{
+	std::vector<MessageHandlerStats> stats;
+	for (size_t cid = 0; cid < m_MessageHandlerTimes.size(); ++cid)
+	{
+		std::map<ComponentTypeId, ComponentType>::const_iterator cit = m_ComponentTypesById.find((ComponentTypeId)cid);
+		if (cit == m_ComponentTypesById.end())
+			continue;
+
+		for (size_t mtid = 0; mtid < m_MessageHandlerTimes[cid].size(); ++mtid)
+		{
+			const HandlerTimes& times = m_MessageHandlerTimes[cid][mtid];
+			if (times.calls == 0 && times.totalTime == 0.0)
 				continue;
 
-			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.begin();
-			for (; eit != emap->second.end(); ++eit)
-				eit->second->HandleMessage(msg, true);
+			MessageHandlerStats stat;
+			std::map<MessageTypeId, std::string>::const_iterator mit = m_MessageTypeNamesById.find((MessageTypeId)mtid);
+			stat.messageName = (mit != m_MessageTypeNamesById.end() ? mit->second : "?");
+			stat.componentName = cit->second.name;
+			stat.calls = times.calls;
+			stat.totalTime = times.totalTime;
+			stat.selfTime = times.selfTime;
+			stats.push_back(stat);
 		}
 	}
+	std::sort(stats.begin(), stats.end(), CompareHandlerStats);
+	return stats;
 }
 
+void CComponentManager::ResetMessageHandlerStats()
+{
+	m_MessageHandlerTimes.clear();
+}
 
 std::string CComponentManager::GenerateSchema()
 {
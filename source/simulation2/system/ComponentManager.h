@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,11 +28,14 @@
 #include <boost/unordered_map.hpp>
 
 #include <map>
+#include <vector>
 
 class IComponent;
 class CParamNode;
 class CMessage;
 class CSimContext;
+class CStdDeserializer;
+class ISerializer;
 
 class CComponentManager
 {
@@ -112,6 +115,17 @@ public:
 	 */
 	void SubscribeGloballyToMessageType(MessageTypeId mtid);
 
+	/**
+	 * Subscribe the current component type to all messages of the given message type,
+	 * like SubscribeGloballyToMessageType, but with delivery deferred: the messages are
+	 * queued (in the order they were sent) and passed to each component's HandleMessageBatch
+	 * by the next FlushDeferredMessages. This lets components that do some work per message
+	 * handle a whole turn's worth of them in one pass.
+	 * The message type must implement CMessage::Clone.
+	 * Must only be called by a native component type's ClassInit.
+	 */
+	void SubscribeGloballyToMessageTypeDeferred(MessageTypeId mtid);
+
 	/**
 	 * @param cname Requested component type name (not including any "CID" or "CCmp" prefix)
 	 * @return The component type id, or CID__Invalid if not found
@@ -185,12 +199,28 @@ public:
 	 */
 	void FlushDestroyedComponents();
 
+	/**
+	 * Delivers all the messages queued for SubscribeGloballyToMessageTypeDeferred subscribers,
+	 * as one batch per message type. Messages sent by the batch handlers are delivered
+	 * before this returns.
+	 * This is called at fixed points during the simulation update, and before any entity
+	 * is destroyed (so the handlers can still query the entities the messages refer to).
+	 */
+	void FlushDeferredMessages();
+
 	IComponent* QueryInterface(entity_id_t ent, InterfaceId iid) const;
 
 	typedef std::vector<std::pair<entity_id_t, IComponent*> > InterfaceList;
 	typedef boost::unordered_map<entity_id_t, IComponent*> InterfaceListUnordered;
 
 	InterfaceList GetEntitiesWithInterface(InterfaceId iid) const;
+
+	/**
+	 * Returns the components implementing the interface, without copying or sorting them.
+	 * Unlike QueryInterface and GetEntitiesWithInterface, this doesn't mark the components
+	 * as possibly modified (see IComponent::SetStateHashDirty), so callers that change
+	 * their state must do that themselves.
+	 */
 	const InterfaceListUnordered& GetEntitiesWithInterfaceUnordered(InterfaceId iid) const;
 
 	/**
@@ -213,15 +243,71 @@ public:
 	void ResetState();
 
 	// Various state serialization functions:
-	bool ComputeStateHash(std::string& outHash, bool quick);
+	/**
+	 * Computes a hash of the simulation state, for detecting out-of-sync errors.
+	 *
+	 * The hash is built from a separate hash of each component's state. Native components'
+	 * hashes are cached until they might have been modified (see IComponent::SetStateHashDirty).
+	 * If @p quick is true, only native components are included, and only those that were
+	 * modified since the previous hash are reserialized, so it is cheap enough to run every turn.
+	 * Otherwise every component is reserialized (refreshing the cache).
+	 *
+	 * If @p md5 is true, computes the (much slower) MD5 hash used by older versions,
+	 * for comparing against hashes recorded by them. Those don't use the cache, and
+	 * their quick hashes only include the positions.
+	 */
+	bool ComputeStateHash(std::string& outHash, bool quick, bool md5 = false);
 	bool DumpDebugState(std::ostream& stream, bool includeDebugInfo);
 	// FlushDestroyedComponents must be called before SerializeState (since the destruction queue
 	// won't get serialized)
 	bool SerializeState(std::ostream& stream);
 	bool DeserializeState(std::istream& stream);
 
+	/**
+	 * Appends the serialized state to @p outState. This is the same data SerializeState(std::ostream&)
+	 * writes, but it's faster to produce.
+	 */
+	bool SerializeState(std::string& outState);
+
+	/**
+	 * Deserializes the state from a block of memory, which must contain exactly the
+	 * data written by SerializeState. This is faster than reading from a stream.
+	 */
+	bool DeserializeState(const u8* data, size_t len);
+
 	std::string GenerateSchema();
 
+	/**
+	 * Enables or disables measuring the real time spent in each component type's
+	 * message handlers (which adds some overhead to every message).
+	 * While enabled, each handler call is also recorded as a Profiler2 region.
+	 */
+	void SetProfileMessageHandlers(bool enabled) { m_ProfileMessageHandlers = enabled; }
+
+	/**
+	 * Cumulative timings of one component type's handlers for one message type.
+	 */
+	struct MessageHandlerStats
+	{
+		std::string messageName;
+		std::string componentName;
+		u32 calls; // number of components that handled the message
+		double totalTime; // seconds, including any messages sent by the handlers
+		double selfTime; // seconds, excluding the handlers of nested messages
+	};
+
+	/**
+	 * Returns the times spent in the message handlers of each (message type,
+	 * component type) pair while profiling was enabled, in decreasing order
+	 * of self time.
+	 */
+	std::vector<MessageHandlerStats> GetMessageHandlerStats() const;
+
+	/**
+	 * Resets all the timings returned by GetMessageHandlerStats.
+	 */
+	void ResetMessageHandlerStats();
+
 	ScriptInterface& GetScriptInterface() { return m_ScriptInterface; }
 
 private:
@@ -247,6 +333,38 @@ private:
 	// callback function to handle recursively finding files in a directory
 	static Status FindJSONFilesCallback(const VfsPath&, const FileInfo&, const uintptr_t);
 
+	/**
+	 * All the components of a single type, sorted by entity ID.
+	 * This is a flat array (rather than a map) so that the common case of broadcasting a
+	 * message to every component of a type is a linear walk over contiguous memory.
+	 */
+	typedef std::vector<std::pair<entity_id_t, IComponent*> > ComponentArray;
+
+	/**
+	 * Entry in the message dispatch tables, for a component type that subscribed to a
+	 * message type. Whether the type is implemented in script is cached here so that
+	 * dispatching doesn't need to look up the ComponentType.
+	 */
+	struct MessageSubscriber
+	{
+		ComponentTypeId cid;
+		bool isScript;
+
+		bool operator<(const MessageSubscriber& b) const { return cid < b.cid; }
+	};
+
+	void AddMessageSubscriber(std::vector<std::vector<MessageSubscriber> >& subscriptions, MessageTypeId mtid);
+	void EnsureComponentTypeStorage(ComponentTypeId cid);
+	static size_t BroadcastToComponents(const ComponentArray& comps, const CMessage& msg, bool global);
+	void QueueDeferredMessage(const CMessage& msg) const;
+	double BeginMessageHandler(ComponentTypeId cid, const CMessage& msg) const;
+	void EndMessageHandler(ComponentTypeId cid, MessageTypeId mtid, double startTime, size_t calls) const;
+
+	bool ComputeStateHashMD5(std::string& outHash, bool quick);
+	bool SerializeStateTo(ISerializer& serializer);
+	bool DeserializeStateFrom(CStdDeserializer& deserializer);
+	void ClearDeferredMessages();
+
 	CMessage* ConstructMessage(int mtid, CScriptVal data);
 	void SendGlobalMessage(entity_id_t ent, const CMessage& msg) const;
 
@@ -261,9 +379,10 @@ private:
 	// TODO: some of these should be vectors
 	std::map<ComponentTypeId, ComponentType> m_ComponentTypesById;
 	std::vector<boost::unordered_map<entity_id_t, IComponent*> > m_ComponentsByInterface; // indexed by InterfaceId
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> > m_ComponentsByTypeId;
-	std::map<MessageTypeId, std::vector<ComponentTypeId> > m_LocalMessageSubscriptions;
-	std::map<MessageTypeId, std::vector<ComponentTypeId> > m_GlobalMessageSubscriptions;
+	std::vector<ComponentArray> m_ComponentsByTypeId; // indexed by ComponentTypeId
+	std::vector<std::vector<MessageSubscriber> > m_LocalMessageSubscriptions; // indexed by MessageTypeId
+	std::vector<std::vector<MessageSubscriber> > m_GlobalMessageSubscriptions; // indexed by MessageTypeId
+	std::vector<std::vector<MessageSubscriber> > m_DeferredMessageSubscriptions; // indexed by MessageTypeId
 	std::map<std::string, ComponentTypeId> m_ComponentTypeIdsByName;
 	std::map<std::string, MessageTypeId> m_MessageTypeIdsByName;
 	std::map<MessageTypeId, std::string> m_MessageTypeNamesById;
@@ -274,6 +393,23 @@ private:
 
 	std::vector<entity_id_t> m_DestructionQueue;
 
+	// Copies of the messages waiting for FlushDeferredMessages, indexed by MessageTypeId
+	// (mutable since they're queued by the const PostMessage/BroadcastMessage)
+	mutable std::vector<std::vector<CMessage*> > m_DeferredMessages;
+	mutable bool m_HasDeferredMessages;
+
+	bool m_ProfileMessageHandlers;
+	struct HandlerTimes
+	{
+		HandlerTimes() : calls(0), totalTime(0.0), selfTime(0.0) { }
+		u32 calls;
+		double totalTime;
+		double selfTime;
+	};
+	mutable std::vector<std::vector<HandlerTimes> > m_MessageHandlerTimes; // indexed by ComponentTypeId, then MessageTypeId
+	mutable std::vector<double> m_NestedHandlerTimes; // total time of nested handlers, for each currently running handler
+	mutable std::vector<const char*> m_MessageHandlerProfileNames; // interned component type names for Profiler2, indexed by ComponentTypeId
+
 	ComponentTypeId m_NextScriptComponentTypeId;
 	entity_id_t m_NextEntityId;
 	entity_id_t m_NextLocalEntityId;
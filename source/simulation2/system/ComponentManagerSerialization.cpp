@@ -21,6 +21,7 @@
 #include "IComponent.h"
 #include "ParamNode.h"
 
+#include "simulation2/serialization/BufferSerializer.h"
 #include "simulation2/serialization/DebugSerializer.h"
 #include "simulation2/serialization/HashSerializer.h"
 #include "simulation2/serialization/StdSerializer.h"
@@ -56,13 +57,12 @@ bool CComponentManager::DumpDebugState(std::ostream& stream, bool includeDebugIn
 	std::map<entity_id_t, std::map<ComponentTypeId, IComponent*> > components;
 	std::map<ComponentTypeId, std::string> names;
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator ctit = m_ComponentsByTypeId.begin();
-	for (; ctit != m_ComponentsByTypeId.end(); ++ctit)
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
-		std::map<entity_id_t, IComponent*>::const_iterator eit = ctit->second.begin();
-		for (; eit != ctit->second.end(); ++eit)
+		ComponentArray::const_iterator eit = m_ComponentsByTypeId[cid].begin();
+		for (; eit != m_ComponentsByTypeId[cid].end(); ++eit)
 		{
-			components[eit->first][ctit->first] = eit->second;
+			components[eit->first][(ComponentTypeId)cid] = eit->second;
 		}
 	}
 
@@ -93,29 +93,116 @@ bool CComponentManager::DumpDebugState(std::ostream& stream, bool includeDebugIn
 	return true;
 }
 
-bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
+bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick, bool md5)
 {
+	if (md5)
+		return ComputeStateHashMD5(outHash, quick);
+
 	// Hash serialization: this includes the minimal data necessary to detect
 	// differences in the state, and ignores things like counts and names
 
-	// If 'quick' is set, this checks even fewer things, so that it will
-	// be fast enough to run every turn but will typically detect any
-	// out-of-syncs fairly soon
+	// Each component is hashed on its own (reusing one serializer, since constructing
+	// them is relatively expensive), and the overall hash is computed from the entity
+	// IDs and the components' hashes.
+	// Only native components' hashes are cached: script components can be modified through
+	// references that other scripts keep, so we can't tell when their state has changed.
+	// That's why quick mode skips them.
+
+	cassert(sizeof(((IComponent*)NULL)->m_StateHash) == XXH64::DIGESTSIZE);
 
 	CHashSerializer serializer(m_ScriptInterface);
+	CHashSerializer componentSerializer(m_ScriptInterface);
+
+	serializer.StringASCII("rng", SerializeRNG(m_RNG), 0, 32);
+
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
+	{
+		const ComponentArray& comps = m_ComponentsByTypeId[cid];
+		if (comps.empty())
+			continue;
+
+		std::map<ComponentTypeId, ComponentType>::const_iterator ctit = m_ComponentTypesById.find((ComponentTypeId)cid);
+		bool cacheable = (ctit != m_ComponentTypesById.end() && ctit->second.type == CT_Native);
+
+		if (quick && !cacheable)
+			continue;
+
+		// Only emit component types if they have a component that will be serialized
+		bool needsSerialization = false;
+		for (ComponentArray::const_iterator eit = comps.begin(); eit != comps.end(); ++eit)
+		{
+			// Don't serialize local entities
+			if (ENTITY_IS_LOCAL(eit->first))
+				continue;
+
+			needsSerialization = true;
+			break;
+		}
+
+		if (!needsSerialization)
+			continue;
+
+		serializer.NumberI32_Unbounded("component type id", (ComponentTypeId)cid);
+
+		for (ComponentArray::const_iterator eit = comps.begin(); eit != comps.end(); ++eit)
+		{
+			// Don't serialize local entities
+			if (ENTITY_IS_LOCAL(eit->first))
+				continue;
+
+			IComponent* cmp = eit->second;
+			const u8* hash = cmp->m_StateHash;
+
+			if (!quick || !cmp->m_StateHashValid)
+			{
+				componentSerializer.Reset();
+				cmp->Serialize(componentSerializer);
+				hash = componentSerializer.ComputeHash();
+
+				if (cacheable)
+				{
+					// If the state changed while the cached hash was still considered valid,
+					// then something modified it without marking it dirty, and quick hashes
+					// may have missed the change
+					if (cmp->m_StateHashValid && memcmp(cmp->m_StateHash, hash, XXH64::DIGESTSIZE) != 0)
+						LOGWARNING(L"State of component '%hs' of entity %u changed without invalidating its cached hash",
+							LookupComponentTypeName((ComponentTypeId)cid).c_str(), eit->first);
+
+					memcpy(cmp->m_StateHash, hash, XXH64::DIGESTSIZE);
+					cmp->m_StateHashValid = true;
+				}
+			}
+
+			serializer.NumberU32_Unbounded("entity id", eit->first);
+			serializer.RawBytes("state hash", hash, XXH64::DIGESTSIZE);
+		}
+	}
+
+	outHash = std::string((const char*)serializer.ComputeHash(), serializer.GetHashLength());
+
+	// TODO: catch exceptions
+	return true;
+}
+
+bool CComponentManager::ComputeStateHashMD5(std::string& outHash, bool quick)
+{
+	// The format used by older versions, which serializes the whole state into a single hash
+
+	CMD5HashSerializer serializer(m_ScriptInterface);
 
 	serializer.StringASCII("rng", SerializeRNG(m_RNG), 0, 32);
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator cit = m_ComponentsByTypeId.begin();
-	for (; cit != m_ComponentsByTypeId.end(); ++cit)
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
 		// In quick mode, only check unit positions
-		if (quick && !(cit->first == CID_Position))
+		if (quick && !((ComponentTypeId)cid == CID_Position))
 			continue;
 
+		const ComponentArray& comps = m_ComponentsByTypeId[cid];
+
 		// Only emit component types if they have a component that will be serialized
 		bool needsSerialization = false;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentArray::const_iterator eit = comps.begin(); eit != comps.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -128,9 +215,9 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
 		if (!needsSerialization)
 			continue;
 
-		serializer.NumberI32_Unbounded("component type id", cit->first);
+		serializer.NumberI32_Unbounded("component type id", (ComponentTypeId)cid);
 
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentArray::const_iterator eit = comps.begin(); eit != comps.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -172,7 +259,17 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
 bool CComponentManager::SerializeState(std::ostream& stream)
 {
 	CStdSerializer serializer(m_ScriptInterface, stream);
+	return SerializeStateTo(serializer);
+}
+
+bool CComponentManager::SerializeState(std::string& outState)
+{
+	CBufferSerializer serializer(m_ScriptInterface, outState);
+	return SerializeStateTo(serializer);
+}
 
+bool CComponentManager::SerializeStateTo(ISerializer& serializer)
+{
 	// We don't serialize the destruction queue, since we'd have to be careful to skip local entities etc
 	// and it's (hopefully) easier to just expect callers to flush the queue before serializing
 	ENSURE(m_DestructionQueue.empty());
@@ -180,16 +277,16 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 	serializer.StringASCII("rng", SerializeRNG(m_RNG), 0, 32);
 	serializer.NumberU32_Unbounded("next entity id", m_NextEntityId);
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator cit;
-	
 	uint32_t numComponentTypes = 0;
 	std::set<ComponentTypeId> serializedComponentTypes;
 
-	for (cit = m_ComponentsByTypeId.begin(); cit != m_ComponentsByTypeId.end(); ++cit)
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
+		const ComponentArray& comps = m_ComponentsByTypeId[cid];
+
 		// Only emit component types if they have a component that will be serialized
 		bool needsSerialization = false;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentArray::const_iterator eit = comps.begin(); eit != comps.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -203,17 +300,19 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 			continue;
 
 		numComponentTypes++;
-		serializedComponentTypes.insert(cit->first);
+		serializedComponentTypes.insert((ComponentTypeId)cid);
 	}
 
 	serializer.NumberU32_Unbounded("num component types", numComponentTypes);
 
-	for (cit = m_ComponentsByTypeId.begin(); cit != m_ComponentsByTypeId.end(); ++cit)
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
-		if (serializedComponentTypes.find(cit->first) == serializedComponentTypes.end())
+		if (serializedComponentTypes.find((ComponentTypeId)cid) == serializedComponentTypes.end())
 			continue;
 
-		std::map<ComponentTypeId, ComponentType>::const_iterator ctit = m_ComponentTypesById.find(cit->first);
+		const ComponentArray& comps = m_ComponentsByTypeId[cid];
+
+		std::map<ComponentTypeId, ComponentType>::const_iterator ctit = m_ComponentTypesById.find((ComponentTypeId)cid);
 		if (ctit == m_ComponentTypesById.end())
 		{
 			debug_warn(L"Invalid ctit"); // this should never happen
@@ -224,7 +323,7 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 
 		// Count the components before serializing any of them
 		uint32_t numComponents = 0;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentArray::const_iterator eit = comps.begin(); eit != comps.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -237,7 +336,7 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 		serializer.NumberU32_Unbounded("num components", numComponents);
 
 		// Serialize the components now
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentArray::const_iterator eit = comps.begin(); eit != comps.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -256,75 +355,92 @@ bool CComponentManager::DeserializeState(std::istream& stream)
 {
 	try
 	{
-
 		CStdDeserializer deserializer(m_ScriptInterface, stream);
+		return DeserializeStateFrom(deserializer);
+	}
+	catch (PSERROR_Deserialize& e)
+	{
+		LOGERROR(L"Deserialization failed: %hs", e.what());
+		return false;
+	}
+}
 
-		ResetState();
-
-		std::string rng;
-		deserializer.StringASCII("rng", rng, 0, 32);
-		DeserializeRNG(rng, m_RNG);
-
-		deserializer.NumberU32_Unbounded("next entity id", m_NextEntityId); // TODO: use sensible bounds
+bool CComponentManager::DeserializeState(const u8* data, size_t len)
+{
+	try
+	{
+		CStdDeserializer deserializer(m_ScriptInterface, data, len);
+		return DeserializeStateFrom(deserializer);
+	}
+	catch (PSERROR_Deserialize& e)
+	{
+		LOGERROR(L"Deserialization failed: %hs", e.what());
+		return false;
+	}
+}
 
-		uint32_t numComponentTypes;
-		deserializer.NumberU32_Unbounded("num component types", numComponentTypes);
+bool CComponentManager::DeserializeStateFrom(CStdDeserializer& deserializer)
+{
+	ResetState();
 
-		ICmpTemplateManager* templateManager = NULL;
-		CParamNode noParam;
+	std::string rng;
+	deserializer.StringASCII("rng", rng, 0, 32);
+	DeserializeRNG(rng, m_RNG);
 
-		for (size_t i = 0; i < numComponentTypes; ++i)
-		{
-			std::string ctname;
-			deserializer.StringASCII("name", ctname, 0, 255);
+	deserializer.NumberU32_Unbounded("next entity id", m_NextEntityId); // TODO: use sensible bounds
 
-			ComponentTypeId ctid = LookupCID(ctname);
-			if (ctid == CID__Invalid)
-			{
-				LOGERROR(L"Deserialization saw unrecognised component type '%hs'", ctname.c_str());
-				return false;
-			}
+	uint32_t numComponentTypes;
+	deserializer.NumberU32_Unbounded("num component types", numComponentTypes);
 
-			uint32_t numComponents;
-			deserializer.NumberU32_Unbounded("num components", numComponents);
+	ICmpTemplateManager* templateManager = NULL;
+	CParamNode noParam;
 
-			for (size_t j = 0; j < numComponents; ++j)
-			{
-				entity_id_t ent;
-				deserializer.NumberU32_Unbounded("entity id", ent);
-				IComponent* component = ConstructComponent(ent, ctid);
-				if (!component)
-					return false;
-
-				// Try to find the template for this entity
-				const CParamNode* entTemplate = NULL;
-				if (templateManager && ent != SYSTEM_ENTITY) // (system entities don't use templates)
-					entTemplate = templateManager->LoadLatestTemplate(ent);
-
-				// Deserialize, with the appropriate template for this component
-				if (entTemplate)
-					component->Deserialize(entTemplate->GetChild(ctname.c_str()), deserializer);
-				else
-					component->Deserialize(noParam, deserializer);
-
-				// If this was the template manager, remember it so we can use it when
-				// deserializing any further non-system entities
-				if (ent == SYSTEM_ENTITY && ctid == CID_TemplateManager)
-					templateManager = static_cast<ICmpTemplateManager*> (component);
-			}
-		}
+	for (size_t i = 0; i < numComponentTypes; ++i)
+	{
+		std::string ctname;
+		deserializer.StringASCII("name", ctname, 0, 255);
 
-		if (stream.peek() != EOF)
+		ComponentTypeId ctid = LookupCID(ctname);
+		if (ctid == CID__Invalid)
 		{
-			LOGERROR(L"Deserialization didn't reach EOF");
+			LOGERROR(L"Deserialization saw unrecognised component type '%hs'", ctname.c_str());
 			return false;
 		}
 
-		return true;
+		uint32_t numComponents;
+		deserializer.NumberU32_Unbounded("num components", numComponents);
+
+		for (size_t j = 0; j < numComponents; ++j)
+		{
+			entity_id_t ent;
+			deserializer.NumberU32_Unbounded("entity id", ent);
+			IComponent* component = ConstructComponent(ent, ctid);
+			if (!component)
+				return false;
+
+			// Try to find the template for this entity
+			const CParamNode* entTemplate = NULL;
+			if (templateManager && ent != SYSTEM_ENTITY) // (system entities don't use templates)
+				entTemplate = templateManager->LoadLatestTemplate(ent);
+
+			// Deserialize, with the appropriate template for this component
+			if (entTemplate)
+				component->Deserialize(entTemplate->GetChild(ctname.c_str()), deserializer);
+			else
+				component->Deserialize(noParam, deserializer);
+
+			// If this was the template manager, remember it so we can use it when
+			// deserializing any further non-system entities
+			if (ent == SYSTEM_ENTITY && ctid == CID_TemplateManager)
+				templateManager = static_cast<ICmpTemplateManager*> (component);
+		}
 	}
-	catch (PSERROR_Deserialize& e)
+
+	if (!deserializer.IsAtEnd())
 	{
-		LOGERROR(L"Deserialization failed: %hs", e.what());
+		LOGERROR(L"Deserialization didn't reach EOF");
 		return false;
 	}
+
+	return true;
 }
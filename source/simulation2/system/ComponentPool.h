@@ -0,0 +1,104 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_COMPONENTPOOL
+#define INCLUDED_COMPONENTPOOL
+
+#include "lib/allocators/pool.h"
+
+#include <new>
+
+/**
+ * Allocator for the instances of a single native component type.
+ *
+ * All instances of the type are allocated from one pool, so the components that a
+ * BroadcastMessage walks over (e.g. every CCmpPosition for MT_Interpolate) are close
+ * together in memory instead of scattered around the heap. The pool reserves address
+ * space up front and commits it as it grows, so allocated components never move and
+ * pointers to them (e.g. in CmpPtr) stay valid. Freed slots are reused first,
+ * which keeps the pool dense as entities are created and destroyed.
+ *
+ * If the pool is full (or couldn't be created), this falls back to the normal heap.
+ */
+template<typename T>
+class ComponentPool
+{
+public:
+	/**
+	 * Maximum number of instances allocated from the pool, per component type.
+	 */
+	static const size_t MAX_POOLED = 16384;
+
+	static T* Allocate()
+	{
+		void* p = Get().Alloc();
+		if (!p)
+			return new T();
+		return new (p) T();
+	}
+
+	template<typename A, typename B>
+	static T* Allocate(A& a, B b)
+	{
+		void* p = Get().Alloc();
+		if (!p)
+			return new T(a, b);
+		return new (p) T(a, b);
+	}
+
+	static void Deallocate(T* cmp)
+	{
+		ComponentPool& pool = Get();
+		if (!pool.m_Valid || !pool_contains(&pool.m_Pool, cmp))
+		{
+			delete cmp;
+			return;
+		}
+		cmp->~T();
+		pool_free(&pool.m_Pool, cmp);
+	}
+
+private:
+	ComponentPool()
+	{
+		m_Valid = (pool_create(&m_Pool, MAX_POOLED * sizeof(T), sizeof(T)) == INFO::OK);
+	}
+
+	~ComponentPool()
+	{
+		if (m_Valid)
+			(void)pool_destroy(&m_Pool);
+	}
+
+	static ComponentPool& Get()
+	{
+		static ComponentPool pool;
+		return pool;
+	}
+
+	void* Alloc()
+	{
+		if (!m_Valid)
+			return NULL;
+		return pool_alloc(&m_Pool, 0);
+	}
+
+	Pool m_Pool;
+	bool m_Valid;
+};
+
+#endif // INCLUDED_COMPONENTPOOL
@@ -33,6 +33,12 @@ void IComponent::HandleMessage(const CMessage& UNUSED(msg), bool UNUSED(global))
 {
 }
 
+void IComponent::HandleMessageBatch(const std::vector<CMessage*>& msgs)
+{
+	for (size_t i = 0; i < msgs.size(); ++i)
+		HandleMessage(*msgs[i], true);
+}
+
 JSClass* IComponent::GetJSClass() const
 {
 	return NULL;
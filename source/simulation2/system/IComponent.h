@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,8 @@
 
 #include "scriptinterface/ScriptTypes.h"
 
+#include <vector>
+
 class CParamNode;
 class CSimContext;
 class CMessage;
@@ -33,6 +35,7 @@ class IDeserializer;
 class IComponent
 {
 public:
+	IComponent() : m_StateHashValid(false) { }
 	virtual ~IComponent();
 
 	static std::string GetSchema();
@@ -42,6 +45,13 @@ public:
 
 	virtual void HandleMessage(const CMessage& msg, bool global);
 
+	/**
+	 * Handles a batch of messages of a single type, for component types that subscribed
+	 * with CComponentManager::SubscribeGloballyToMessageTypeDeferred.
+	 * The default implementation passes each message to HandleMessage in turn, as a global message.
+	 */
+	virtual void HandleMessageBatch(const std::vector<CMessage*>& msgs);
+
 	entity_id_t GetEntityId() const { return m_EntityId; }
 	void SetEntityId(entity_id_t ent) { m_EntityId = ent; }
 
@@ -52,12 +62,27 @@ public:
 	virtual void Serialize(ISerializer& serialize) = 0;
 	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& deserialize) = 0;
 
+	/**
+	 * Marks this component's serialized state as possibly changed, so that
+	 * CComponentManager::ComputeStateHash won't reuse its cached hash.
+	 * The component manager already does this whenever it passes the component a
+	 * message or returns it from a query, so this is only needed by code that changes
+	 * a component's state in any other way (e.g. through a pointer kept from an earlier query).
+	 */
+	void SetStateHashDirty() { m_StateHashValid = false; }
+
 	virtual JSClass* GetJSClass() const;
 	virtual jsval GetJSInstance() const;
 
 private:
+	friend class CComponentManager;
+
 	entity_id_t m_EntityId;
 	const CSimContext* m_SimContext;
+
+	// Cached hash of the serialized state (see CComponentManager::ComputeStateHash)
+	u8 m_StateHash[8];
+	bool m_StateHashValid;
 };
 
 #endif // INCLUDED_ICOMPONENT
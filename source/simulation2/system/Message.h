@@ -33,6 +33,13 @@ public:
 	virtual const char* GetScriptGlobalHandlerName() const = 0;
 	virtual jsval ToJSVal(ScriptInterface&) const = 0;
 	jsval ToJSValCached(ScriptInterface&) const;
+
+	/**
+	 * Returns a new copy of this message, for deferred delivery
+	 * (see CComponentManager::SubscribeGloballyToMessageTypeDeferred),
+	 * or NULL if this message type doesn't support that.
+	 */
+	virtual CMessage* Clone() const { return NULL; }
 private:
 	mutable CScriptValRooted m_Cached;
 };
@@ -39,9 +39,53 @@
 
 static CParamNode g_NullNode(false);
 
+/**
+ * Orders ChildrenMap elements by name, for binary searches.
+ */
+struct CompareChildName
+{
+	bool operator()(const std::pair<std::string, CParamNode>& a, const char* b) const { return strcmp(a.first.c_str(), b) < 0; }
+	bool operator()(const char* a, const std::pair<std::string, CParamNode>& b) const { return strcmp(a, b.first.c_str()) < 0; }
+	bool operator()(const std::pair<std::string, CParamNode>& a, const std::pair<std::string, CParamNode>& b) const { return a.first < b.first; }
+};
+
 CParamNode::CParamNode(bool isOk) :
-	m_IsOk(isOk)
+	m_Data(new Data()), m_IsOk(isOk)
+{
+}
+
+CParamNode::Data& CParamNode::MutableData()
 {
+	if (!m_Data.unique())
+	{
+		m_Data.reset(new Data(*m_Data));
+		m_Data->m_ScriptVal = CScriptValRooted();
+	}
+	return *m_Data;
+}
+
+CParamNode& CParamNode::GetOrAddChild(const std::string& name)
+{
+	Data& data = MutableData();
+	ChildrenMap::iterator it = std::lower_bound(data.m_Childs.begin(), data.m_Childs.end(), name.c_str(), CompareChildName());
+	if (it == data.m_Childs.end() || it->first != name)
+	{
+		size_t idx = it - data.m_Childs.begin();
+		data.m_ChildNames.insert(data.m_ChildNames.begin() + idx, CStrIntern(name));
+		it = data.m_Childs.insert(it, std::make_pair(name, CParamNode()));
+	}
+	return it->second;
+}
+
+void CParamNode::RemoveChild(const std::string& name)
+{
+	Data& data = MutableData();
+	ChildrenMap::iterator it = std::lower_bound(data.m_Childs.begin(), data.m_Childs.end(), name.c_str(), CompareChildName());
+	if (it != data.m_Childs.end() && it->first == name)
+	{
+		data.m_ChildNames.erase(data.m_ChildNames.begin() + (it - data.m_Childs.begin()));
+		data.m_Childs.erase(it);
+	}
 }
 
 void CParamNode::LoadXML(CParamNode& ret, const XMBFile& xmb, const wchar_t* sourceIdentifier /*= NULL*/)
@@ -90,12 +134,12 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 		{
 			if (attr.Name == at_disable)
 			{
-				m_Childs.erase(name);
+				RemoveChild(name);
 				return;
 			}
 			else if (attr.Name == at_replace)
 			{
-				m_Childs.erase(name);
+				RemoveChild(name);
 				replacing = true;
 			}
 		}
@@ -105,13 +149,13 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 		{
 			if (attr.Name == at_datatype && std::wstring(attr.Value.begin(), attr.Value.end()) == L"tokens")
 			{
-				CParamNode& node = m_Childs[name];
+				CParamNode& node = GetOrAddChild(name);
 
 				// Split into tokens
 				std::vector<std::wstring> oldTokens;
 				std::vector<std::wstring> newTokens;
 				if (!replacing) // ignore the old tokens if replace="" was given
-					boost::algorithm::split(oldTokens, node.m_Value, boost::algorithm::is_space());
+					boost::algorithm::split(oldTokens, node.m_Data->m_Value, boost::algorithm::is_space());
 				boost::algorithm::split(newTokens, value, boost::algorithm::is_space());
 
 				// Delete empty tokens
@@ -138,7 +182,7 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 					}
 				}
 
-				node.m_Value = boost::algorithm::join(tokens, L" ");
+				node.MutableData().m_Value = boost::algorithm::join(tokens, L" ");
 				hasSetValue = true;
 				break;
 			}
@@ -146,9 +190,9 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 	}
 
 	// Add this element as a child node
-	CParamNode& node = m_Childs[name];
+	CParamNode& node = GetOrAddChild(name);
 	if (!hasSetValue)
-		node.m_Value = value;
+		node.MutableData().m_Value = value;
 
 	// Recurse through the element's children
 	XERO_ITER_EL(element, child)
@@ -163,7 +207,7 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 		if (attr.Name == at_replace) continue;
 		// Add any others
 		std::string attrName = xmb.GetAttributeString(attr.Name);
-		node.m_Childs["@" + attrName].m_Value = attr.Value.FromUTF8();
+		node.GetOrAddChild("@" + attrName).MutableData().m_Value = attr.Value.FromUTF8();
 	}
 }
 
@@ -171,25 +215,38 @@ void CParamNode::CopyFilteredChildrenOfChild(const CParamNode& src, const char*
 {
 	ResetScriptVal();
 
-	ChildrenMap::iterator dstChild = m_Childs.find(name);
-	ChildrenMap::const_iterator srcChild = src.m_Childs.find(name);
-	if (dstChild == m_Childs.end() || srcChild == src.m_Childs.end())
+	const CParamNode& srcChild = src.GetChild(name);
+	if (!GetChild(name).IsOk() || !srcChild.IsOk())
 		return; // error
 
-	ChildrenMap::const_iterator it = srcChild->second.m_Childs.begin();
-	for (; it != srcChild->second.m_Childs.end(); ++it)
+	// (The copied children are shared with src, not duplicated)
+	CParamNode& dstChild = GetOrAddChild(name);
+	const ChildrenMap& srcChilds = srcChild.m_Data->m_Childs;
+	for (ChildrenMap::const_iterator it = srcChilds.begin(); it != srcChilds.end(); ++it)
 		if (permitted.count(it->first))
-			dstChild->second.m_Childs[it->first] = it->second;
+			dstChild.GetOrAddChild(it->first) = it->second;
 }
 
 const CParamNode& CParamNode::GetChild(const char* name) const
 {
-	ChildrenMap::const_iterator it = m_Childs.find(name);
-	if (it == m_Childs.end())
+	const ChildrenMap& childs = m_Data->m_Childs;
+	ChildrenMap::const_iterator it = std::lower_bound(childs.begin(), childs.end(), name, CompareChildName());
+	if (it == childs.end() || strcmp(it->first.c_str(), name) != 0)
 		return g_NullNode;
 	return it->second;
 }
 
+const CParamNode& CParamNode::GetChild(const CStrIntern& name) const
+{
+	// Nodes have few enough children that a linear scan over the interned
+	// names (which are just pointers) is faster than a binary search
+	const std::vector<CStrIntern>& names = m_Data->m_ChildNames;
+	for (size_t i = 0; i < names.size(); ++i)
+		if (names[i] == name)
+			return m_Data->m_Childs[i].second;
+	return g_NullNode;
+}
+
 bool CParamNode::IsOk() const
 {
 	return m_IsOk;
@@ -197,45 +254,45 @@ bool CParamNode::IsOk() const
 
 const std::wstring& CParamNode::ToString() const
 {
-	return m_Value;
+	return m_Data->m_Value;
 }
 
 const std::string CParamNode::ToUTF8() const
 {
-	return utf8_from_wstring(m_Value);
+	return utf8_from_wstring(m_Data->m_Value);
 }
 
 const CStrIntern CParamNode::ToUTF8Intern() const
 {
-	return CStrIntern(utf8_from_wstring(m_Value));
+	return CStrIntern(utf8_from_wstring(m_Data->m_Value));
 }
 
 int CParamNode::ToInt() const
 {
 	int ret = 0;
 	std::wstringstream strm;
-	strm << m_Value;
+	strm << m_Data->m_Value;
 	strm >> ret;
 	return ret;
 }
 
 fixed CParamNode::ToFixed() const
 {
-	return fixed::FromString(CStrW(m_Value));
+	return fixed::FromString(CStrW(m_Data->m_Value));
 }
 
 float CParamNode::ToFloat() const 
 {
 	float ret = 0;
 	std::wstringstream strm;
-	strm << m_Value;
+	strm << m_Data->m_Value;
 	strm >> ret;
 	return ret;
 }
 
 bool CParamNode::ToBool() const
 {
-	if (m_Value == L"true")
+	if (m_Data->m_Value == L"true")
 		return true;
 	else
 		return false;
@@ -243,7 +300,7 @@ bool CParamNode::ToBool() const
 
 const CParamNode::ChildrenMap& CParamNode::GetChildren() const
 {
-	return m_Childs;
+	return m_Data->m_Childs;
 }
 
 std::wstring CParamNode::EscapeXMLString(const std::wstring& str)
@@ -281,10 +338,10 @@ std::wstring CParamNode::ToXML() const
 
 void CParamNode::ToXML(std::wostream& strm) const
 {
-	strm << m_Value;
+	strm << m_Data->m_Value;
 
-	ChildrenMap::const_iterator it = m_Childs.begin();
-	for (; it != m_Childs.end(); ++it)
+	ChildrenMap::const_iterator it = m_Data->m_Childs.begin();
+	for (; it != m_Data->m_Childs.end(); ++it)
 	{
 		// Skip attributes here (they were handled when the caller output the tag)
 		if (it->first.length() && it->first[0] == '@')
@@ -295,13 +352,13 @@ void CParamNode::ToXML(std::wostream& strm) const
 		strm << L"<" << name;
 
 		// Output the child's attributes first
-		ChildrenMap::const_iterator cit = it->second.m_Childs.begin();
-		for (; cit != it->second.m_Childs.end(); ++cit)
+		const ChildrenMap& childs = it->second.m_Data->m_Childs;
+		for (ChildrenMap::const_iterator cit = childs.begin(); cit != childs.end(); ++cit)
 		{
 			if (cit->first.length() && cit->first[0] == '@')
 			{
 				std::wstring attrname (cit->first.begin()+1, cit->first.end());
-				strm << L" " << attrname << L"=\"" << EscapeXMLString(cit->second.m_Value) << L"\"";
+				strm << L" " << attrname << L"=\"" << EscapeXMLString(cit->second.m_Data->m_Value) << L"\"";
 			}
 		}
 
@@ -315,27 +372,30 @@ void CParamNode::ToXML(std::wostream& strm) const
 
 jsval CParamNode::ToJSVal(JSContext* cx, bool cacheValue) const
 {
-	if (cacheValue && !m_ScriptVal.uninitialised())
-		return m_ScriptVal.get();
+	if (cacheValue && !m_Data->m_ScriptVal.uninitialised())
+		return m_Data->m_ScriptVal.get();
 
 	jsval val = ConstructJSVal(cx);
 
 	if (cacheValue)
-		m_ScriptVal = CScriptValRooted(cx, val);
+		m_Data->m_ScriptVal = CScriptValRooted(cx, val);
 
 	return val;
 }
 
 jsval CParamNode::ConstructJSVal(JSContext* cx) const
 {
-	if (m_Childs.empty())
+	const std::wstring& value = m_Data->m_Value;
+	const ChildrenMap& childs = m_Data->m_Childs;
+
+	if (childs.empty())
 	{
 		// Empty node - map to undefined
-		if (m_Value.empty())
+		if (value.empty())
 			return JSVAL_VOID;
 
 		// Just a string
-		utf16string text(m_Value.begin(), m_Value.end());
+		utf16string text(value.begin(), value.end());
 		JSString* str = JS_InternUCStringN(cx, reinterpret_cast<const jschar*>(text.data()), text.length());
 		if (str)
 			return STRING_TO_JSVAL(str);
@@ -349,7 +409,7 @@ jsval CParamNode::ConstructJSVal(JSContext* cx) const
 	if (!obj)
 		return JSVAL_VOID; // TODO: report error
 
-	for (std::map<std::string, CParamNode>::const_iterator it = m_Childs.begin(); it != m_Childs.end(); ++it)
+	for (ChildrenMap::const_iterator it = childs.begin(); it != childs.end(); ++it)
 	{
 		jsval childVal = it->second.ConstructJSVal(cx);
 		if (!JS_SetProperty(cx, obj, it->first.c_str(), &childVal))
@@ -357,9 +417,9 @@ jsval CParamNode::ConstructJSVal(JSContext* cx) const
 	}
 
 	// If the node has a string too, add that as an extra property
-	if (!m_Value.empty())
+	if (!value.empty())
 	{
-		utf16string text(m_Value.begin(), m_Value.end());
+		utf16string text(value.begin(), value.end());
 		JSString* str = JS_InternUCStringN(cx, reinterpret_cast<const jschar*>(text.data()), text.length());
 		if (!str)
 			return JSVAL_VOID; // TODO: report error
@@ -373,5 +433,5 @@ jsval CParamNode::ConstructJSVal(JSContext* cx) const
 
 void CParamNode::ResetScriptVal()
 {
-	m_ScriptVal = CScriptValRooted();
+	MutableData().m_ScriptVal = CScriptValRooted();
 }
@@ -24,8 +24,8 @@
 #include "ps/Errors.h"
 #include "scriptinterface/ScriptVal.h"
 
-#include <map>
 #include <set>
+#include <vector>
 
 class XMBFile;
 class XMBElement;
@@ -108,11 +108,19 @@ class XMBElement;
  * }
  * @endcode
  * (Note the special @c _string for the hopefully-rare cases where a node contains both child nodes and text.)
+ *
+ * Copying a node is cheap: the copies share their contents (including all the
+ * children) until one of them is modified, at which point only the modified node
+ * and its ancestors are duplicated. This lets templates that inherit from each other
+ * (or derived templates like "preview|...") share most of their data.
  */
 class CParamNode
 {
 public:
-	typedef std::map<std::string, CParamNode> ChildrenMap;
+	/**
+	 * Children of a node, sorted by name (like a std::map, but stored flat).
+	 */
+	typedef std::vector<std::pair<std::string, CParamNode> > ChildrenMap;
 
 	/**
 	 * Constructs a new, empty node.
@@ -160,6 +168,13 @@ public:
 	// (Children are returned as const in order to allow future optimisations, where we assume
 	// a node is always modified explicitly and not indirectly via its children, e.g. to cache jsvals)
 
+	/**
+	 * Returns the (unique) child node with the given name, or a node with IsOk() == false if there is none.
+	 * This avoids any string comparisons, so it's faster than the string version when
+	 * the name has already been interned (e.g. in a static variable).
+	 */
+	const CParamNode& GetChild(const CStrIntern& name) const;
+
 	/**
 	 * Returns true if this is a valid CParamNode, false if it represents a non-existent node
 	 */
@@ -249,14 +264,35 @@ private:
 
 	jsval ConstructJSVal(JSContext* cx) const;
 
-	std::wstring m_Value;
-	ChildrenMap m_Childs;
-	bool m_IsOk;
+	/**
+	 * The contents of a node, which may be shared by several copies of it.
+	 */
+	struct Data
+	{
+		std::wstring m_Value;
+		ChildrenMap m_Childs;
+		std::vector<CStrIntern> m_ChildNames; // interned names of m_Childs, in the same order
+
+		/**
+		 * Caches the ToJSVal script representation of this node.
+		 */
+		mutable CScriptValRooted m_ScriptVal;
+	};
+
+	/**
+	 * Returns the contents for modification, first making a private copy if they're shared.
+	 */
+	Data& MutableData();
 
 	/**
-	 * Caches the ToJSVal script representation of this node.
+	 * Returns the child with the given name, adding an empty one if there is none.
 	 */
-	mutable CScriptValRooted m_ScriptVal;
+	CParamNode& GetOrAddChild(const std::string& name);
+
+	void RemoveChild(const std::string& name);
+
+	shared_ptr<Data> m_Data;
+	bool m_IsOk;
 };
 
 #endif // INCLUDED_PARAMNODE
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -211,6 +211,89 @@ public:
 		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent4, IID_Test2))->GetX(), 21150);
 	}
 
+	void test_SendMessage_deferred()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		entity_id_t ent1 = 1, ent2 = 2;
+		CParamNode noParam;
+
+		man.AddComponent(ent1, CID_Test1A, noParam);
+		man.AddComponent(ent1, CID_Test2A, noParam);
+		man.AddComponent(ent2, CID_Test2A, noParam);
+
+		// Test_2A subscribed globally to msg with deferred delivery
+		CMessageTerrainChanged msg(0, 0, 4, 4);
+		man.PostMessage(ent1, msg);
+		man.BroadcastMessage(msg);
+		man.PostMessage(ent2, msg);
+
+		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent1, IID_Test2))->GetX(), 21000);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent2, IID_Test2))->GetX(), 21000);
+
+		// Every component gets all the messages as one batch
+		man.FlushDeferredMessages();
+
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent1, IID_Test1))->GetX(), 11000);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent1, IID_Test2))->GetX(), 24000);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent2, IID_Test2))->GetX(), 24000);
+
+		man.FlushDeferredMessages();
+
+		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent1, IID_Test2))->GetX(), 24000);
+
+		// Queued messages are delivered before an entity is destroyed
+		man.PostMessage(ent2, msg);
+		man.DestroyComponentsSoon(ent1);
+		man.FlushDestroyedComponents();
+
+		TS_ASSERT(man.QueryInterface(ent1, IID_Test2) == NULL);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent2, IID_Test2))->GetX(), 25000);
+	}
+
+	void test_SendMessage_profile()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+		man.SetProfileMessageHandlers(true);
+
+		entity_id_t ent1 = 1, ent2 = 2, ent3 = 3;
+		CParamNode noParam;
+
+		man.AddComponent(ent1, CID_Test1A, noParam);
+		man.AddComponent(ent2, CID_Test1A, noParam);
+		man.AddComponent(ent3, CID_Test2A, noParam);
+
+		// Test_1A and Test_2A subscribed locally to msg
+		CMessageTurnStart msg;
+		man.BroadcastMessage(msg);
+		man.BroadcastMessage(msg);
+		man.PostMessage(ent1, msg);
+
+		std::vector<CComponentManager::MessageHandlerStats> stats = man.GetMessageHandlerStats();
+		TS_ASSERT_EQUALS(stats.size(), (size_t)2);
+		for (size_t i = 0; i < stats.size(); ++i)
+		{
+			TS_ASSERT_EQUALS(stats[i].messageName, "TurnStart");
+			if (stats[i].componentName == "Test1A")
+			{
+				TS_ASSERT_EQUALS(stats[i].calls, (u32)5);
+			}
+			else
+			{
+				TS_ASSERT_EQUALS(stats[i].componentName, "Test2A");
+				TS_ASSERT_EQUALS(stats[i].calls, (u32)2);
+			}
+			TS_ASSERT(stats[i].selfTime <= stats[i].totalTime);
+		}
+
+		man.ResetMessageHandlerStats();
+		TS_ASSERT(man.GetMessageHandlerStats().empty());
+	}
+
 	void test_ParamNode()
 	{
 		CSimContext context;
@@ -602,10 +685,17 @@ public:
 
 		std::string hash;
 		TS_ASSERT(man.ComputeStateHash(hash, false));
+		TS_ASSERT_EQUALS(hash.length(), (size_t)8);
+		TS_ASSERT_SAME_DATA(hash.data(), "\x7e\x59\xf7\xce\x9a\x87\xdc\xd8", 8);
+		// echo -en "\x05\x00\x00\x0078606\x01\0\0\0\x01\0\0\0\x85\x32\x69\x97\x4d\x2c\x12\x3d\x02\0\0\0\x27\x57\x72\xfe\xcb\x91\x84\x54\x04\0\0\0\x01\0\0\0\x64\x24\x39\xa6\xb3\xd0\x63\x00" | xxhsum -H1
+		//           ^^^^^^^^ rng ^^^^^^^^ ^^Test1A^^ ^^^ent1^^ ^^^^^^^^^^^^^ hash(11000) ^^^^^^^^^^^^^ ^^^ent2^^ ^^^^^^^^^^^^^ hash(1234) ^^^^^^^^^^^^^^ ^^Test2A^^ ^^^ent1^^ ^^^^^^^^^^^^^ hash(21000) ^^^^^^^^^^^^^
+		// where e.g. hash(11000) = echo -en "\xf8\x2a\0\0" | xxhsum -H1
+
+		// The old MD5 format hashes the serialized state directly
+		TS_ASSERT(man.ComputeStateHash(hash, false, true));
 		TS_ASSERT_EQUALS(hash.length(), (size_t)16);
 		TS_ASSERT_SAME_DATA(hash.data(), "\x1c\x45\x2b\x20\x1f\x0c\x00\x93\x60\x78\xe2\x63\xb1\x47\x08\x19", 16);
 		// echo -en "\x05\x00\x00\x0078606\x01\0\0\0\x01\0\0\0\xf8\x2a\0\0\x02\0\0\0\xd2\x04\0\0\x04\0\0\0\x01\0\0\0\x08\x52\0\0" | openssl md5 | perl -pe 's/(..)/\\x$1/g'
-		//           ^^^^^^^^ rng ^^^^^^^^ ^^Test1A^^ ^^^ent1^^ ^^^11000^^^ ^^^ent2^^ ^^^1234^^^ ^^Test2A^^ ^^ent1^^ ^^^21000^^^
 
 		std::stringstream stateStream;
 		TS_ASSERT(man.SerializeState(stateStream));
@@ -642,6 +732,41 @@ public:
 		TS_ASSERT(man2.QueryInterface(ent3, IID_Test2) == NULL);
 	}
 
+	void test_hash_cached()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		entity_id_t ent1 = 1, ent2 = 2;
+		CParamNode noParam;
+
+		man.AddComponent(ent1, CID_Test1A, noParam);
+		man.AddComponent(ent2, CID_Test1A, noParam);
+
+		// With only native components, quick hashes cover the same state as full hashes
+		std::string hashFull, hash1, hash2, hash3, hash4;
+		TS_ASSERT(man.ComputeStateHash(hashFull, false));
+		TS_ASSERT(man.ComputeStateHash(hash1, true));
+		TS_ASSERT_EQUALS(hash1, hashFull);
+
+		// Messages mark their receivers as modified
+		man.BroadcastMessage(CMessageTurnStart());
+		TS_ASSERT(man.ComputeStateHash(hash2, true));
+		TS_ASSERT_DIFFERS(hash2, hash1);
+
+		// Test1A (incorrectly) changes its state when interpolating, but Interpolate isn't
+		// expected to change state so that goes unnoticed by quick hashes
+		man.BroadcastMessage(CMessageInterpolate(0.0f, 0.0f, 0.0f));
+		TS_ASSERT(man.ComputeStateHash(hash3, true));
+		TS_ASSERT_EQUALS(hash3, hash2);
+
+		// Querying a component marks it as (possibly) modified
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent1, IID_Test1))->GetX(), 11003);
+		TS_ASSERT(man.ComputeStateHash(hash4, true));
+		TS_ASSERT_DIFFERS(hash4, hash3);
+	}
+
 	void test_script_serialization()
 	{
 		CSimContext context;
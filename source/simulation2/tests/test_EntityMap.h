@@ -0,0 +1,80 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/EntityMap.h"
+
+class TestEntityMap : public CxxTest::TestSuite
+{
+public:
+	void test_insert_find()
+	{
+		EntityMap<int> map;
+		TS_ASSERT(map.empty());
+		TS_ASSERT(map.find(1) == map.end());
+		TS_ASSERT(map.get(100) == NULL);
+
+		TS_ASSERT(map.insert(std::make_pair(5, 50)).second);
+		TS_ASSERT(map.insert(std::make_pair(2, 20)).second);
+		TS_ASSERT(!map.insert(std::make_pair(5, 51)).second);
+		TS_ASSERT_EQUALS(map.size(), (size_t)2);
+
+		TS_ASSERT(map.find(5) != map.end());
+		TS_ASSERT_EQUALS(map.find(5)->second, 50);
+		TS_ASSERT_EQUALS(*map.get(2), 20);
+		TS_ASSERT(map.find(3) == map.end());
+		TS_ASSERT(map.get(3) == NULL);
+	}
+
+	void test_iterate_ordered()
+	{
+		EntityMap<int> map;
+		map.insert(std::make_pair(10, 100));
+		map.insert(std::make_pair(3, 30));
+		map.insert(std::make_pair(7, 70));
+
+		std::vector<entity_id_t> keys;
+		for (EntityMap<int>::const_iterator it = map.begin(); it != map.end(); ++it)
+			keys.push_back(it->first);
+
+		TS_ASSERT_EQUALS(keys.size(), (size_t)3);
+		TS_ASSERT_EQUALS(keys[0], (entity_id_t)3);
+		TS_ASSERT_EQUALS(keys[1], (entity_id_t)7);
+		TS_ASSERT_EQUALS(keys[2], (entity_id_t)10);
+	}
+
+	void test_erase()
+	{
+		EntityMap<int> map;
+		map.insert(std::make_pair(4, 40));
+		map.insert(std::make_pair(8, 80));
+
+		TS_ASSERT_EQUALS(map.erase(8), (size_t)1);
+		TS_ASSERT_EQUALS(map.erase(8), (size_t)0);
+		TS_ASSERT(map.find(8) == map.end());
+		TS_ASSERT_EQUALS(map.size(), (size_t)1);
+
+		map.erase(map.find(4));
+		TS_ASSERT(map.empty());
+		TS_ASSERT(map.begin() == map.end());
+
+		// Reinserting after removal must work
+		TS_ASSERT(map.insert(std::make_pair(8, 81)).second);
+		TS_ASSERT_EQUALS(map.find(8)->second, 81);
+	}
+};
@@ -0,0 +1,120 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/Geometry.h"
+
+#include "lib/timer.h"
+
+class TestGeometry : public CxxTest::TestSuite
+{
+	// Fills the boxes with n random boxes in a 256x256 area
+	void RandomBoxes(Geometry::PackedBoundingBoxes& boxes, size_t n)
+	{
+		boxes.clear();
+		for (size_t i = 0; i < n; ++i)
+		{
+			fixed x = fixed::FromInt(rand() % 256);
+			fixed z = fixed::FromInt(rand() % 256);
+			fixed hw = fixed::FromInt(rand() % 32) / 4;
+			fixed hh = fixed::FromInt(rand() % 32) / 4;
+			boxes.push_back(x - hw, z - hh, x + hw, z + hh);
+		}
+	}
+
+public:
+	void test_bounding_boxes()
+	{
+		Geometry::PackedBoundingBoxes boxes;
+		boxes.push_back(fixed::FromInt(0), fixed::FromInt(0), fixed::FromInt(2), fixed::FromInt(2));
+		boxes.push_back(fixed::FromInt(4), fixed::FromInt(0), fixed::FromInt(6), fixed::FromInt(2));
+		boxes.push_back(fixed::FromInt(0), fixed::FromInt(4), fixed::FromInt(2), fixed::FromInt(6));
+		boxes.push_back(fixed::FromInt(3), fixed::FromInt(3), fixed::FromInt(4), fixed::FromInt(4));
+		boxes.push_back(fixed::FromInt(10), fixed::FromInt(10), fixed::FromInt(12), fixed::FromInt(12));
+
+		// Touching edges count as overlapping
+		std::vector<u32> out;
+		Geometry::TestBoundingBoxes(boxes, fixed::FromInt(2), fixed::FromInt(1), fixed::FromInt(4), fixed::FromInt(3), out);
+		TS_ASSERT_EQUALS(out.size(), (size_t)3);
+		TS_ASSERT_EQUALS(out[0], (u32)0);
+		TS_ASSERT_EQUALS(out[1], (u32)1);
+		TS_ASSERT_EQUALS(out[2], (u32)3);
+
+		out.clear();
+		Geometry::TestBoundingBoxes(boxes, fixed::FromInt(11), fixed::FromInt(11), fixed::FromInt(11), fixed::FromInt(11), out);
+		TS_ASSERT_EQUALS(out.size(), (size_t)1);
+		TS_ASSERT_EQUALS(out[0], (u32)4);
+
+		out.clear();
+		Geometry::TestBoundingBoxes(boxes, fixed::FromInt(7), fixed::FromInt(-5), fixed::FromInt(9), fixed::FromInt(20), out);
+		TS_ASSERT(out.empty());
+	}
+
+	void test_bounding_boxes_scalar()
+	{
+		// The SIMD version must match the scalar version exactly, including
+		// for box counts that aren't a multiple of the SIMD width
+		srand(1234);
+		Geometry::PackedBoundingBoxes boxes;
+		for (size_t n = 0; n < 64; ++n)
+		{
+			RandomBoxes(boxes, n);
+			for (size_t q = 0; q < 16; ++q)
+			{
+				fixed x = fixed::FromInt(rand() % 256);
+				fixed z = fixed::FromInt(rand() % 256);
+				fixed r = fixed::FromInt(rand() % 64);
+
+				std::vector<u32> out, outScalar;
+				Geometry::TestBoundingBoxes(boxes, x - r, z - r, x + r, z + r, out);
+				Geometry::TestBoundingBoxes_Scalar(boxes, x - r, z - r, x + r, z + r, outScalar);
+				TS_ASSERT(out == outScalar);
+			}
+		}
+	}
+
+	void test_performance_bounding_boxes_DISABLED()
+	{
+		srand(1234);
+		Geometry::PackedBoundingBoxes boxes;
+		RandomBoxes(boxes, 1024);
+
+		std::vector<u32> out;
+		const size_t iterations = 100000;
+
+		double t = timer_Time();
+		for (size_t i = 0; i < iterations; ++i)
+		{
+			out.clear();
+			fixed x = fixed::FromInt(i % 256);
+			Geometry::TestBoundingBoxes_Scalar(boxes, x, x, x + fixed::FromInt(16), x + fixed::FromInt(16), out);
+		}
+		double tScalar = timer_Time() - t;
+
+		t = timer_Time();
+		for (size_t i = 0; i < iterations; ++i)
+		{
+			out.clear();
+			fixed x = fixed::FromInt(i % 256);
+			Geometry::TestBoundingBoxes(boxes, x, x, x + fixed::FromInt(16), x + fixed::FromInt(16), out);
+		}
+		double tSimd = timer_Time() - t;
+
+		printf("[scalar %f, simd %f]", tScalar, tSimd);
+	}
+};
@@ -0,0 +1,98 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/HierarchicalPathfinder.h"
+
+const ICmpPathfinder::pass_class_t PASS_CLASS = 4;
+
+class TestHierarchicalPathfinder : public CxxTest::TestSuite
+{
+	void Recompute(HierarchicalPathfinder& hier, const Grid<u16>& grid)
+	{
+		std::map<std::string, ICmpPathfinder::pass_class_t> classes;
+		classes["default"] = PASS_CLASS;
+		hier.Recompute(classes, grid);
+	}
+
+public:
+	void test_reachability()
+	{
+		Grid<u16> grid(100, 100);
+
+		// Wall across the map, with a gap near the top
+		for (int j = 0; j < 100; ++j)
+			if (j != 90)
+				grid.set(50, j, PASS_CLASS);
+
+		// Enclosed area
+		for (int k = 10; k <= 20; ++k)
+		{
+			grid.set(k, 10, PASS_CLASS);
+			grid.set(k, 20, PASS_CLASS);
+			grid.set(10, k, PASS_CLASS);
+			grid.set(20, k, 1); // obstructions are impassable too
+		}
+
+		HierarchicalPathfinder hier;
+		Recompute(hier, grid);
+
+		TS_ASSERT(hier.IsReachable(5, 5, 95, 5, PASS_CLASS));
+		TS_ASSERT(!hier.IsReachable(5, 5, 15, 15, PASS_CLASS));
+		TS_ASSERT(!hier.IsReachable(5, 5, 50, 5, PASS_CLASS));
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(50, 5, PASS_CLASS), 0);
+
+		std::vector<HierarchicalPathfinder::RegionID> path;
+		TS_ASSERT(hier.ComputeAbstractPath(5, 5, 95, 5, PASS_CLASS, path));
+		TS_ASSERT(path.front() == hier.Get(5, 5, PASS_CLASS));
+		TS_ASSERT(path.back() == hier.Get(95, 5, PASS_CLASS));
+		TS_ASSERT(!hier.ComputeAbstractPath(5, 5, 15, 15, PASS_CLASS, path));
+
+		u16 i = 15, j = 15;
+		TS_ASSERT(hier.FindNearestPassableTile(i, j, PASS_CLASS, hier.GetGlobalRegion(5, 5, PASS_CLASS)));
+		TS_ASSERT_EQUALS(i, 15);
+		TS_ASSERT_EQUALS(j, 9);
+	}
+
+	void test_update()
+	{
+		Grid<u16> grid(100, 100);
+		for (int j = 0; j < 100; ++j)
+			if (j != 90)
+				grid.set(50, j, PASS_CLASS);
+
+		HierarchicalPathfinder hier;
+		Recompute(hier, grid);
+		TS_ASSERT(hier.IsReachable(5, 5, 95, 5, PASS_CLASS));
+
+		// Close the gap
+		grid.set(50, 90, PASS_CLASS);
+		hier.MarkDirty(50, 90);
+		hier.Update(grid);
+		TS_ASSERT(!hier.IsReachable(5, 5, 95, 5, PASS_CLASS));
+
+		// Open a new gap
+		grid.set(50, 10, 0);
+		hier.MarkDirty(50, 10);
+		hier.Update(grid);
+		TS_ASSERT(hier.IsReachable(5, 5, 95, 5, PASS_CLASS));
+
+		std::vector<HierarchicalPathfinder::RegionID> path;
+		TS_ASSERT(hier.ComputeAbstractPath(5, 5, 95, 5, PASS_CLASS, path));
+	}
+};
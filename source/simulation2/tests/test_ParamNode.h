@@ -135,6 +135,35 @@ public:
 		TS_ASSERT_WSTR_EQUALS(node.ToXML(), L"<test><a datatype=\"tokens\">Y X</a></test>");
 	}
 
+	void test_interned()
+	{
+		CParamNode node;
+		TS_ASSERT_EQUALS(CParamNode::LoadXMLString(node, "<test><Foo>1</Foo><Bar a='b'>2</Bar></test>"), PSRETURN_OK);
+		TS_ASSERT_EQUALS(node.GetChild(CStrIntern("test")).GetChild(CStrIntern("Foo")).ToInt(), 1);
+		TS_ASSERT_EQUALS(node.GetChild(CStrIntern("test")).GetChild(CStrIntern("Bar")).ToInt(), 2);
+		TS_ASSERT_WSTR_EQUALS(node.GetChild("test").GetChild("Bar").GetChild(CStrIntern("@a")).ToString(), L"b");
+		TS_ASSERT(!node.GetChild(CStrIntern("test")).GetChild(CStrIntern("Baz")).IsOk());
+	}
+
+	void test_copy_on_write()
+	{
+		CParamNode base;
+		TS_ASSERT_EQUALS(CParamNode::LoadXMLString(base, "<test><x><a>1</a><b>2</b></x><y>3</y></test>"), PSRETURN_OK);
+
+		// Copies share their data until they're modified
+		CParamNode derived = base;
+		TS_ASSERT_EQUALS(&derived.GetChild("test").GetChild("y"), &base.GetChild("test").GetChild("y"));
+
+		TS_ASSERT_EQUALS(CParamNode::LoadXMLString(derived, "<test><x><a>4</a></x></test>"), PSRETURN_OK);
+		TS_ASSERT_WSTR_EQUALS(base.ToXML(), L"<test><x><a>1</a><b>2</b></x><y>3</y></test>");
+		TS_ASSERT_WSTR_EQUALS(derived.ToXML(), L"<test><x><a>4</a><b>2</b></x><y>3</y></test>");
+
+		// Unmodified subtrees are still shared
+		TS_ASSERT_EQUALS(&derived.GetChild("test").GetChild("x").GetChild("b").ToString(), &base.GetChild("test").GetChild("x").GetChild("b").ToString());
+		TS_ASSERT_EQUALS(&derived.GetChild("test").GetChild("y").ToString(), &base.GetChild("test").GetChild("y").ToString());
+		TS_ASSERT_DIFFERS(&derived.GetChild("test").GetChild("x").GetChild("a").ToString(), &base.GetChild("test").GetChild("x").GetChild("a").ToString());
+	}
+
 	void test_types()
 	{
 		CParamNode node;
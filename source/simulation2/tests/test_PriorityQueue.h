@@ -0,0 +1,84 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/PriorityQueue.h"
+
+class TestPriorityQueue : public CxxTest::TestSuite
+{
+public:
+	void test_radix_order()
+	{
+		PriorityQueueRadix<u32> queue;
+		TS_ASSERT(queue.empty());
+
+		u32 ranks[] = { 100, 7, 100, 0, 64, 65, 99 };
+		for (size_t i = 0; i < ARRAY_SIZE(ranks); ++i)
+		{
+			PriorityQueueRadix<u32>::Item item = { (u32)i, ranks[i] };
+			queue.push(item);
+		}
+		TS_ASSERT_EQUALS(queue.size(), ARRAY_SIZE(ranks));
+
+		u32 expected[] = { 100, 100, 99, 65, 64, 7, 0 };
+		for (size_t i = 0; i < ARRAY_SIZE(expected); ++i)
+			TS_ASSERT_EQUALS(queue.pop().rank, expected[i]);
+		TS_ASSERT(queue.empty());
+	}
+
+	void test_radix_monotone()
+	{
+		// Interleaved pushes and pops (never pushing above the last popped rank)
+		// must pop the same ranks as a binary heap
+		typedef PriorityQueueHeap<u32, u32, std::greater<u32> > HeapQueue;
+		PriorityQueueRadix<u32> radix;
+		HeapQueue heap;
+
+		srand(1234);
+		u32 id = 0;
+		u32 last = 0xFFFFFFFF;
+		for (size_t i = 0; i < 8; ++i)
+		{
+			u32 rank = last - (u32)(rand() % 1000);
+			PriorityQueueRadix<u32>::Item r = { id, rank };
+			HeapQueue::Item h = { id, rank };
+			++id;
+			radix.push(r);
+			heap.push(h);
+		}
+
+		while (!heap.empty())
+		{
+			TS_ASSERT_EQUALS(radix.size(), heap.size());
+			last = heap.pop().rank;
+			TS_ASSERT_EQUALS(radix.pop().rank, last);
+
+			size_t pushes = rand() % 3;
+			for (size_t i = 0; i < pushes && id < 10000; ++i)
+			{
+				u32 rank = last - std::min(last, (u32)(rand() % 5000));
+				PriorityQueueRadix<u32>::Item r = { id, rank };
+				HeapQueue::Item h = { id, rank };
+				++id;
+				radix.push(r);
+				heap.push(h);
+			}
+		}
+		TS_ASSERT(radix.empty());
+	}
+};
@@ -17,6 +17,7 @@
 
 #include "lib/self_test.h"
 
+#include "simulation2/serialization/BufferSerializer.h"
 #include "simulation2/serialization/DebugSerializer.h"
 #include "simulation2/serialization/HashSerializer.h"
 #include "simulation2/serialization/StdSerializer.h"
@@ -236,6 +237,100 @@ public:
 		TS_ASSERT_EQUALS(stream.peek(), EOF);
 	}
 
+	void test_Buffer_basic()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		std::string buffer = "prefix";
+		{
+			CBufferSerializer serialize(script, buffer);
+
+			serialize.NumberI32_Unbounded("x", -123);
+			serialize.NumberU32_Unbounded("y", 1234);
+			serialize.NumberI32("z", 12345, 0, 65535);
+		}
+
+		TS_ASSERT_EQUALS(buffer.length(), (size_t)18);
+		TS_ASSERT_SAME_DATA(buffer.data(), "prefix" "\x85\xff\xff\xff" "\xd2\x04\x00\x00" "\x39\x30\x00\x00", 18);
+
+		CStdDeserializer deserialize(script, (const u8*)buffer.data() + 6, buffer.length() - 6);
+		int32_t n;
+
+		deserialize.NumberI32_Unbounded("x", n);
+		TS_ASSERT_EQUALS(n, -123);
+		deserialize.NumberI32_Unbounded("y", n);
+		TS_ASSERT_EQUALS(n, 1234);
+		TS_ASSERT(!deserialize.IsAtEnd());
+		deserialize.NumberI32("z", n, 0, 65535);
+		TS_ASSERT_EQUALS(n, 12345);
+		TS_ASSERT(deserialize.IsAtEnd());
+
+		// Reading past the end must fail
+		TS_ASSERT_THROWS(deserialize.NumberI32_Unbounded("x", n), PSERROR_Deserialize_ReadFailed);
+		TS_ASSERT_THROWS(deserialize.RequireBytesInStream(1), PSERROR_Deserialize_OutOfBounds);
+	}
+
+	void test_Buffer_types()
+	{
+		// The buffer serializer must produce exactly the same data as the stream serializer
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+
+		std::stringstream stream;
+		{
+			CStdSerializer serialize(script, stream);
+			serialize_types(serialize);
+		}
+
+		std::string buffer;
+		{
+			CBufferSerializer serialize(script, buffer);
+			serialize_types(serialize);
+
+			// Write enough to need to grow the buffer a few times
+			for (size_t i = 0; i < 10000; ++i)
+				serialize.NumberU32_Unbounded("i", (u32)i);
+		}
+
+		std::string expected = stream.str();
+		TS_ASSERT_EQUALS(buffer.length(), expected.length() + 10000*4);
+		TS_ASSERT(buffer.compare(0, expected.length(), expected) == 0);
+
+		CStdDeserializer deserialize(script, (const u8*)buffer.data() + expected.length(), buffer.length() - expected.length());
+		for (size_t i = 0; i < 10000; ++i)
+		{
+			u32 n;
+			deserialize.NumberU32_Unbounded("i", n);
+			TS_ASSERT_EQUALS(n, (u32)i);
+		}
+		TS_ASSERT(deserialize.IsAtEnd());
+	}
+
+	void test_Buffer_stream()
+	{
+		// Reads through GetStream must stay in step with the deserializer's own reads
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		std::string buffer;
+		{
+			CBufferSerializer serializer(script, buffer);
+			ISerializer& serialize = serializer;
+			serialize.NumberU8_Unbounded("a", 1);
+			serialize.GetStream() << "xyz";
+			serialize.NumberU8_Unbounded("b", 2);
+		}
+
+		TS_ASSERT_EQUALS(buffer, std::string("\x01xyz\x02"));
+
+		CStdDeserializer deserialize(script, (const u8*)buffer.data(), buffer.length());
+		u8 n;
+		char str[4] = { 0 };
+		deserialize.NumberU8_Unbounded("a", n);
+		TS_ASSERT_EQUALS(n, 1);
+		deserialize.GetStream().read(str, 3);
+		TS_ASSERT_STR_EQUALS(str, "xyz");
+		deserialize.NumberU8_Unbounded("b", n);
+		TS_ASSERT_EQUALS(n, 2);
+		TS_ASSERT(deserialize.IsAtEnd());
+	}
+
 	void test_Hash_basic()
 	{
 		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
@@ -245,6 +340,20 @@ public:
 		serialize.NumberU32_Unbounded("y", 1234);
 		serialize.NumberI32("z", 12345, 0, 65535);
 
+		TS_ASSERT_EQUALS(serialize.GetHashLength(), (size_t)8);
+		TS_ASSERT_SAME_DATA(serialize.ComputeHash(), "\x5f\x36\xce\x1d\x01\x17\x8d\x80", 8);
+		// echo -en "\x85\xff\xff\xff\xd2\x04\x00\x00\x39\x30\x00\x00" | xxhsum -H1
+	}
+
+	void test_Hash_MD5()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		CMD5HashSerializer serialize(script);
+
+		serialize.NumberI32_Unbounded("x", -123);
+		serialize.NumberU32_Unbounded("y", 1234);
+		serialize.NumberI32("z", 12345, 0, 65535);
+
 		TS_ASSERT_EQUALS(serialize.GetHashLength(), (size_t)16);
 		TS_ASSERT_SAME_DATA(serialize.ComputeHash(), "\xa0\x3a\xe5\x3e\x9b\xd7\xfb\x11\x88\x35\xc6\xfb\xb9\x94\xa9\x72", 16);
 		// echo -en "\x85\xff\xff\xff\xd2\x04\x00\x00\x39\x30\x00\x00" | openssl md5 | perl -pe 's/(..)/\\x$1/g'
@@ -676,6 +785,17 @@ public:
 		t = timer_Time() - t;
 		debug_printf(L"# time = %f (%f/%d)\n", t/reps, t, (int)reps);
 
+		// Compare with the old MD5 hash, to see how much of the time is spent hashing
+		// rather than serializing
+		t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			std::string hash;
+			sim2.ComputeStateHash(hash, false, true);
+		}
+		t = timer_Time() - t;
+		debug_printf(L"# time (MD5) = %f (%f/%d)\n", t/reps, t, (int)reps);
+
 		// Shut down the world
 		g_VFS.reset();
 		CXeromyces::Terminate();
@@ -0,0 +1,91 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/SlotMap.h"
+
+class TestSlotMap : public CxxTest::TestSuite
+{
+public:
+	void test_insert_find()
+	{
+		SlotMap<int> map;
+		TS_ASSERT(map.empty());
+		TS_ASSERT(map.find(1) == map.end());
+		TS_ASSERT(map.get(0) == NULL);
+
+		u32 a = map.insert(10);
+		u32 b = map.insert(20);
+		TS_ASSERT(a != 0 && b != 0 && a != b);
+		TS_ASSERT(a < 0x80000000u && b < 0x80000000u);
+		TS_ASSERT_EQUALS(map.size(), (size_t)2);
+
+		TS_ASSERT_EQUALS(map.find(a)->first, a);
+		TS_ASSERT_EQUALS(map.find(a)->second, 10);
+		TS_ASSERT_EQUALS(*map.get(b), 20);
+		TS_ASSERT_EQUALS(map[b], 20);
+
+		map[b] = 21;
+		TS_ASSERT_EQUALS(*map.get(b), 21);
+	}
+
+	void test_erase_reuse()
+	{
+		SlotMap<int> map;
+		u32 a = map.insert(10);
+		u32 b = map.insert(20);
+
+		TS_ASSERT_EQUALS(map.erase(a), (size_t)1);
+		TS_ASSERT_EQUALS(map.erase(a), (size_t)0);
+		TS_ASSERT(map.find(a) == map.end());
+		TS_ASSERT(map.get(a) == NULL);
+		TS_ASSERT_EQUALS(map.size(), (size_t)1);
+
+		// The freed slot is reused, but with a different ID, so the old ID stays invalid
+		u32 c = map.insert(30);
+		TS_ASSERT((c & SlotMap<int>::INDEX_MASK) == (a & SlotMap<int>::INDEX_MASK));
+		TS_ASSERT(c != a);
+		TS_ASSERT(map.get(a) == NULL);
+		TS_ASSERT_EQUALS(*map.get(c), 30);
+		TS_ASSERT_EQUALS(*map.get(b), 20);
+
+		map.erase(map.find(b));
+		map.erase(c);
+		TS_ASSERT(map.empty());
+		TS_ASSERT(map.begin() == map.end());
+	}
+
+	void test_iterate_ordered()
+	{
+		SlotMap<int> map;
+		u32 a = map.insert(10);
+		u32 b = map.insert(20);
+		u32 c = map.insert(30);
+		map.erase(a);
+		u32 d = map.insert(40); // reuses a's slot, so comes first
+
+		std::vector<u32> ids;
+		for (SlotMap<int>::const_iterator it = map.begin(); it != map.end(); ++it)
+			ids.push_back(it->first);
+
+		TS_ASSERT_EQUALS(ids.size(), (size_t)3);
+		TS_ASSERT_EQUALS(ids[0], d);
+		TS_ASSERT_EQUALS(ids[1], b);
+		TS_ASSERT_EQUALS(ids[2], c);
+	}
+};
@@ -0,0 +1,73 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/system/ComponentTest.h"
+#include "simulation2/helpers/Spatial.h"
+
+class TestSpatial : public CxxTest::TestSuite
+{
+	CFixedVector2D Pos(int x, int z)
+	{
+		return CFixedVector2D(entity_pos_t::FromInt(x), entity_pos_t::FromInt(z));
+	}
+
+public:
+	void test_get_in_range()
+	{
+		SpatialSubdivision<u32> sub;
+		sub.Reset(entity_pos_t::FromInt(100), entity_pos_t::FromInt(100), entity_pos_t::FromInt(10));
+
+		sub.Add(3, Pos(15, 15));
+		sub.Add(1, Pos(5, 5), Pos(25, 5)); // spans several divisions
+		sub.Add(2, Pos(85, 85));
+
+		std::vector<u32> out;
+		sub.GetInRange(out, Pos(0, 0), Pos(30, 30));
+		TS_ASSERT_EQUALS(out.size(), (size_t)2);
+		TS_ASSERT_EQUALS(out[0], (u32)1);
+		TS_ASSERT_EQUALS(out[1], (u32)3);
+
+		// The output buffer is replaced, not appended to
+		sub.GetNear(out, Pos(85, 85), entity_pos_t::FromInt(2));
+		TS_ASSERT_EQUALS(out.size(), (size_t)1);
+		TS_ASSERT_EQUALS(out[0], (u32)2);
+
+		TS_ASSERT(sub.GetNear(Pos(85, 85), entity_pos_t::FromInt(2)) == out);
+
+		sub.Remove(1, Pos(5, 5), Pos(25, 5));
+		sub.GetInRange(out, Pos(0, 0), Pos(30, 30));
+		TS_ASSERT_EQUALS(out.size(), (size_t)1);
+		TS_ASSERT_EQUALS(out[0], (u32)3);
+	}
+
+	void test_equality()
+	{
+		SpatialSubdivision<u32> a, b;
+		a.Reset(entity_pos_t::FromInt(50), entity_pos_t::FromInt(50), entity_pos_t::FromInt(10));
+		b.Reset(entity_pos_t::FromInt(50), entity_pos_t::FromInt(50), entity_pos_t::FromInt(10));
+
+		a.Add(1, Pos(5, 5));
+		a.Add(2, Pos(5, 5));
+		b.Add(2, Pos(5, 5));
+		TS_ASSERT(a != b);
+
+		b.Add(1, Pos(5, 5));
+		TS_ASSERT(a == b);
+	}
+};